@@ -22,6 +22,7 @@
 #define BIT_HAS_SYNC_CAS 1
 #define BIT_HAS_UNNAMED_UNIONS 1
 #define BIT_HTTP_PORT 80
+#define BIT_IO_URING 0
 #define BIT_MANAGER "appman"
 #define BIT_MDB 1
 #define BIT_MINIMAL "doxygen,dsi,ejs,man,man2html,pmaker,ssl,ejscript,php,matrixssl,openssl"
@@ -77,7 +78,9 @@
 #define BIT_PACK_EJS 0
 #define BIT_PACK_EJSCRIPT 0
 #define BIT_PACK_ESP 1
+#define BIT_PACK_FAST 1
 #define BIT_PACK_HTTP 1
+#define BIT_PACK_IO_URING 1
 #define BIT_PACK_LINK 1
 #define BIT_PACK_MAN 0
 #define BIT_PACK_MAN2HTML 0
@@ -86,8 +89,9 @@
 #define BIT_PACK_PCRE 1
 #define BIT_PACK_PHP 0
 #define BIT_PACK_PMAKER 0
+#define BIT_PACK_PROXY 1
 #define BIT_PACK_SQLITE 1
 #define BIT_PACK_SSL 0
 #define BIT_PACK_UTEST 1
 #define BIT_PACK_ZIP 1
-#define BIT_PACK_ZLIB 0
+#define BIT_PACK_ZLIB 1
@@ -77,6 +77,7 @@
 #define BIT_PACK_EJS 0
 #define BIT_PACK_EJSCRIPT 0
 #define BIT_PACK_ESP 1
+#define BIT_PACK_FAST 1
 #define BIT_PACK_HTTP 1
 #define BIT_PACK_LINK 1
 #define BIT_PACK_MAN 0
@@ -86,8 +87,9 @@
 #define BIT_PACK_PCRE 1
 #define BIT_PACK_PHP 0
 #define BIT_PACK_PMAKER 0
+#define BIT_PACK_PROXY 1
 #define BIT_PACK_SQLITE 1
 #define BIT_PACK_SSL 0
 #define BIT_PACK_UTEST 1
 #define BIT_PACK_ZIP 1
-#define BIT_PACK_ZLIB 0
+#define BIT_PACK_ZLIB 1
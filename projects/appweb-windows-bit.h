@@ -70,6 +70,7 @@
 #define BIT_PACK_EJS 0
 #define BIT_PACK_EJSCRIPT 0
 #define BIT_PACK_ESP 1
+#define BIT_PACK_FAST 0
 #define BIT_PACK_HTTP 1
 #define BIT_PACK_LINK 1
 #define BIT_PACK_MAN 0
@@ -79,6 +80,7 @@
 #define BIT_PACK_PCRE 1
 #define BIT_PACK_PHP 0
 #define BIT_PACK_PMAKER 0
+#define BIT_PACK_PROXY 0
 #define BIT_PACK_RC 1
 #define BIT_PACK_SQLITE 1
 #define BIT_PACK_SSL 0
@@ -22,6 +22,7 @@ extern "C" {
 #define MA_MAX_CONFIG_DEPTH     16                  /**< Max nest of directives in config file */
 #define MA_MAX_ACCESS_LOG       20971520            /**< Access file size (20 MB) */
 #define MA_MAX_REWRITE          10                  /**< Maximum recursive URI rewrites */
+#define MA_MAX_FILE_READS       4                   /**< Maximum threads reading uncached file data */
 #define MA_SDB_MEMORY           (20 * 1024 * 1024)  /**< SDB heap memory */
 #define MA_SDB_TIMEOUT          (20 * 1000)         /**< SDB busy timeout */
 
@@ -201,6 +202,16 @@ extern int maStartAppweb(MaAppweb *appweb);
  */
 extern int maStopAppweb(MaAppweb *appweb);
 
+/**
+    Get proxy upstream statistics
+    @description Return the statistics for each member of the route's proxy upstream. This is provided by mod_proxy.
+    @param route Route configured with a ProxyUpstream directive
+    @return A JSON array with the member name, availability, in-flight requests, total requests, errors and average
+        latency in msec for each member. Returns null if the route has no upstream.
+    @ingroup Appweb
+ */
+extern char *maGetProxyStats(HttpRoute *route);
+
 /*
     Internal
  */
@@ -208,7 +219,9 @@ extern int maCgiHandlerInit(Http *http, MprModule *mp);
 extern int maDirHandlerInit(Http *http, MprModule *mp);
 extern int maEjsHandlerInit(Http *http, MprModule *mp);
 extern int maEspHandlerInit(Http *http, MprModule *mp);
+extern int maFastHandlerInit(Http *http, MprModule *mp);
 extern int maPhpHandlerInit(Http *http, MprModule *mp);
+extern int maProxyHandlerInit(Http *http, MprModule *mp);
 extern int maSslModuleInit(Http *http, MprModule *mp);
 extern int maOpenDirHandler(Http *http);
 extern int maOpenFileHandler(Http *http);
@@ -672,6 +672,37 @@ static int conditionDirective(MaState *state, cchar *key, cchar *value)
 }
 
 
+/*
+    Coroutines on|off
+
+    Run blocking handlers on coroutines. Waiting for I/O suspends the request and releases the worker thread.
+ */
+static int coroutinesDirective(MaState *state, cchar *key, cchar *value)
+{
+    bool    on;
+
+    if (!maTokenize(state, value, "%B", &on)) {
+        return MPR_ERR_BAD_SYNTAX;
+    }
+    if (on) {
+        state->route->flags |= HTTP_ROUTE_COROUTINE;
+    } else {
+        state->route->flags &= ~HTTP_ROUTE_COROUTINE;
+    }
+    return 0;
+}
+
+
+/*
+    CoroutineStack bytes
+ */
+static int coroutineStackDirective(MaState *state, cchar *key, cchar *value)
+{
+    mprSetCoroutineStackSize(getint(value));
+    return 0;
+}
+
+
 static int defaultLanguageDirective(MaState *state, cchar *key, cchar *value)
 {
     httpSetRouteDefaultLanguage(state->route, value);
@@ -1311,6 +1342,28 @@ static int limitKeepAliveDirective(MaState *state, cchar *key, cchar *value)
 }
 
 
+/*
+    LimitStreams count
+ */
+static int limitStreamsDirective(MaState *state, cchar *key, cchar *value)
+{
+    state->limits = httpGraduateLimits(state->route, state->server->limits);
+    state->limits->streamMax = getint(value);
+    return 0;
+}
+
+
+/*
+    LimitWebSocketsMessage bytes
+ */
+static int limitWebSocketsMessageDirective(MaState *state, cchar *key, cchar *value)
+{
+    state->limits = httpGraduateLimits(state->route, state->server->limits);
+    state->limits->webSocketsMessageSize = (ssize) getnum(value);
+    return 0;
+}
+
+
 /*
     LimitWorkers count
  */
@@ -1690,6 +1743,51 @@ static int serverRootDirective(MaState *state, cchar *key, cchar *value)
 }
 
 
+/*
+    SessionKey secret
+ */
+static int sessionKeyDirective(MaState *state, cchar *key, cchar *value)
+{
+    char    *secret;
+
+    if (!maTokenize(state, value, "%S", &secret)) {
+        return MPR_ERR_BAD_SYNTAX;
+    }
+    httpAddRouteSessionKey(state->route, secret);
+    return 0;
+}
+
+
+/*
+    SessionStore server|client [encrypt] [maxCookieSize]
+ */
+static int sessionStoreDirective(MaState *state, cchar *key, cchar *value)
+{
+    char    *option, *tok;
+    ssize   maxCookie;
+    int     store;
+
+    store = HTTP_SESSION_SERVER;
+    maxCookie = 0;
+    for (option = stok(sclone(value), " \t", &tok); option; option = stok(0, " \t", &tok)) {
+        if (smatch(option, "server")) {
+            store = HTTP_SESSION_SERVER;
+        } else if (smatch(option, "client")) {
+            store |= HTTP_SESSION_CLIENT;
+        } else if (smatch(option, "encrypt")) {
+            store |= HTTP_SESSION_ENCRYPT;
+        } else if (snumber(option)) {
+            maxCookie = (ssize) getnum(option);
+        } else {
+            mprError("Unknown SessionStore option %s", option);
+            return MPR_ERR_BAD_SYNTAX;
+        }
+    }
+    httpSetRouteSessionStore(state->route, store, maxCookie);
+    return 0;
+}
+
+
 /*
     SessionTimeout secs
  */
@@ -1890,6 +1988,27 @@ static int uploadAutoDeleteDirective(MaState *state, cchar *key, cchar *value)
 }
 
 
+/*
+    UploadStream on|off
+
+    Pass upload file data to the handler as it is received instead of saving it to temp files
+ */
+static int uploadStreamDirective(MaState *state, cchar *key, cchar *value)
+{
+    bool    on;
+
+    if (!maTokenize(state, value, "%B", &on)) {
+        return MPR_ERR_BAD_SYNTAX;
+    }
+    if (on) {
+        state->route->flags |= HTTP_ROUTE_UPLOAD_STREAM;
+    } else {
+        state->route->flags &= ~HTTP_ROUTE_UPLOAD_STREAM;
+    }
+    return 0;
+}
+
+
 /*
     User name password abilities...
  */
@@ -1956,6 +2075,29 @@ static int virtualHostDirective(MaState *state, cchar *key, cchar *value)
 }
 
 
+/*
+    WebSocketsDeflate on|off [windowBits [noTakeover]]
+ */
+static int webSocketsDeflateDirective(MaState *state, cchar *key, cchar *value)
+{
+    char    *takeover;
+    bool    on;
+    int     bits;
+
+    if (!maTokenize(state, value, "%B ?N ?S", &on, &bits, &takeover)) {
+        return MPR_ERR_BAD_SYNTAX;
+    }
+    if (bits == 0) {
+        bits = 15;
+    } else if (bits < 9 || bits > 15) {
+        mprError("WebSocketsDeflate window bits must be between 9 and 15");
+        return MPR_ERR_BAD_SYNTAX;
+    }
+    httpSetRouteWebSocketsDeflate(state->route, on ? bits : 0, !smatch(takeover, "noTakeover"));
+    return 0;
+}
+
+
 bool maValidateServer(MaServer *server)
 {
     MaAppweb        *appweb;
@@ -2062,9 +2204,15 @@ static bool conditionalDefinition(MaState *state, cchar *key)
         } else if (scaselessmatch(key, "ESP_MODULE")) {
             result = BIT_PACK_ESP;
 
+        } else if (scaselessmatch(key, "FAST_MODULE")) {
+            result = BIT_PACK_FAST;
+
         } else if (scaselessmatch(key, "PHP_MODULE")) {
             result = BIT_PACK_PHP;
 
+        } else if (scaselessmatch(key, "PROXY_MODULE")) {
+            result = BIT_PACK_PROXY;
+
         } else if (scaselessmatch(key, "SSL_MODULE")) {
             result = BIT_PACK_SSL;
         }
@@ -2405,6 +2553,8 @@ int maParseInit(MaAppweb *appweb)
     maAddDirective(appweb, "Chroot", chrootDirective);
     maAddDirective(appweb, "Compress", compressDirective);
     maAddDirective(appweb, "Condition", conditionDirective);
+    maAddDirective(appweb, "CoroutineStack", coroutineStackDirective);
+    maAddDirective(appweb, "Coroutines", coroutinesDirective);
     maAddDirective(appweb, "DefaultLanguage", defaultLanguageDirective);
     maAddDirective(appweb, "Deny", denyDirective);
     maAddDirective(appweb, "DirectoryIndex", directoryIndexDirective);
@@ -2436,8 +2586,10 @@ int maParseInit(MaAppweb *appweb)
     maAddDirective(appweb, "LimitRequestHeader", limitRequestHeaderDirective);
     maAddDirective(appweb, "LimitResponseBody", limitResponseBodyDirective);
     maAddDirective(appweb, "LimitStageBuffer", limitStageBufferDirective);
+    maAddDirective(appweb, "LimitStreams", limitStreamsDirective);
     maAddDirective(appweb, "LimitUri", limitUriDirective);
     maAddDirective(appweb, "LimitUpload", limitUploadDirective);
+    maAddDirective(appweb, "LimitWebSocketsMessage", limitWebSocketsMessageDirective);
     maAddDirective(appweb, "LimitWorkers", limitWorkersDirective);
 
     maAddDirective(appweb, "Listen", listenDirective);
@@ -2468,6 +2620,8 @@ int maParseInit(MaAppweb *appweb)
     maAddDirective(appweb, "</Route", closeDirective);
     maAddDirective(appweb, "ServerName", serverNameDirective);
     maAddDirective(appweb, "ServerRoot", serverRootDirective);
+    maAddDirective(appweb, "SessionKey", sessionKeyDirective);
+    maAddDirective(appweb, "SessionStore", sessionStoreDirective);
     maAddDirective(appweb, "SessionTimeout", sessionTimeoutDirective);
     maAddDirective(appweb, "Set", setDirective);
     maAddDirective(appweb, "SetConnector", setConnectorDirective);
@@ -2486,11 +2640,13 @@ int maParseInit(MaAppweb *appweb)
     maAddDirective(appweb, "UnloadModule", unloadModuleDirective);
     maAddDirective(appweb, "UploadAutoDelete", uploadAutoDeleteDirective);
     maAddDirective(appweb, "UploadDir", uploadDirDirective);
+    maAddDirective(appweb, "UploadStream", uploadStreamDirective);
     maAddDirective(appweb, "User", userDirective);
     maAddDirective(appweb, "UserAccount", userAccountDirective);
 
     maAddDirective(appweb, "<VirtualHost", virtualHostDirective);
     maAddDirective(appweb, "</VirtualHost", closeDirective);
+    maAddDirective(appweb, "WebSocketsDeflate", webSocketsDeflateDirective);
 
 #if !BIT_ROM
     maAddDirective(appweb, "AccessLog", accessLogDirective);
@@ -17,6 +17,13 @@ typedef struct ThreadData {
     MprDispatcher   *dispatcher;
     char            *url;
     MprList         *files;
+    MprSocket       *sock;              /* Pipelining socket */
+    MprBuf          *requests;          /* Batch of pipelined requests */
+    MprBuf          *responses;         /* Pipelined response data */
+    HttpUri         *uri;               /* Pipelining target */
+    uint64          *latency;           /* Benchmark request latencies in ticks */
+    int             latencyCount;       /* Count of recorded latencies */
+    int             latencyMax;         /* Size of the latency array */
 } ThreadData;
 
 typedef struct App {
@@ -46,6 +53,7 @@ typedef struct App {
     char     *outFilename;       /* Output filename */
     MprFile  *outFile;           /* Output file */
     char     *password;          /* Password for authentication */
+    int      pipeline;           /* Pipeline depth. Number of requests to write before reading responses */
     int      printable;          /* Make binary output printable */
     char     *protocol;          /* HTTP/1.0, HTTP/1.1 */
     char     *provider;          /* SSL provider to use */
@@ -76,7 +84,9 @@ static App *app;
 /***************************** Forward Declarations ***************************/
 
 static void     addFormVars(cchar *buf);
+static void     printLatency(uint64 ticks, MprTime elapsed);
 static void     processing();
+static int      doPipeline(ThreadData *td);
 static int      doRequest(HttpConn *conn, cchar *url, MprList *files);
 static void     finishThread(MprThread *tp);
 static char     *getPassword();
@@ -86,6 +96,7 @@ static bool     iterationsComplete();
 static void     manageApp(App *app, int flags);
 static void     manageThreadData(ThreadData *data, int flags);
 static bool     parseArgs(int argc, char **argv);
+static void     recordLatency(uint64 ticks);
 static int      processThread(HttpConn *conn, MprEvent *event);
 static void     threadMain(void *data, MprThread *tp);
 static char     *resolveUrl(HttpConn *conn, cchar *url);
@@ -101,6 +112,7 @@ static ssize    writeBody(HttpConn *conn, MprList *files);
 MAIN(httpMain, int argc, char **argv, char **envp)
 {
     MprTime     start;
+    uint64      ticks;
     double      elapsed;
 
     if (mprCreate(argc, argv, MPR_USER_EVENTS_THREAD) == 0) {
@@ -123,6 +135,7 @@ MAIN(httpMain, int argc, char **argv, char **envp)
         exit(2);
     }
     start = mprGetTime();
+    ticks = mprGetTicks();
     app->http = httpCreate();
     httpEaseLimits(app->http->clientLimits);
 
@@ -141,6 +154,10 @@ MAIN(httpMain, int argc, char **argv, char **envp)
         mprPrintf("Requests per second: %13.4f\n", app->fetchCount * 1.0 / (elapsed / 1000.0));
         mprPrintf("Load threads:        %13d\n", app->loadThreads);
         mprPrintf("Worker threads:      %13d\n", app->workers);
+        if (app->pipeline) {
+            mprPrintf("Pipeline depth:      %13d\n", app->pipeline);
+        }
+        printLatency(mprGetTicks() - ticks, mprGetTime() - start);
     }
     if (!app->success && app->verbose) {
         mprError("Request failed");
@@ -351,6 +368,13 @@ static bool parseArgs(int argc, char **argv)
                 app->password = sclone(argv[++nextArg]);
             }
 
+        } else if (smatch(argp, "--pipeline")) {
+            if (nextArg >= argc) {
+                return 0;
+            } else {
+                app->pipeline = atoi(argv[++nextArg]);
+            }
+
         } else if (smatch(argp, "--post")) {
             app->method = "POST";
 
@@ -498,6 +522,10 @@ static bool parseArgs(int argc, char **argv)
             app->method = "GET";
         }
     }
+    if (app->pipeline > 0 && (app->files || app->bodyData || app->formData || app->upload || app->username)) {
+        mprError("Pipelining does not support request body data or authentication");
+        return 0;
+    }
 #if BIT_PACK_SSL
     if (app->validate || app->cert || app->provider) {
         app->ssl = mprCreateSsl();
@@ -543,6 +571,7 @@ static void showUsage()
         "  --noout               # Don't output files to stdout.\n"
         "  --out file            # Send output to file\n"
         "  --password pass       # Password for authentication.\n"
+        "  --pipeline depth      # Pipeline requests. Write depth requests before reading responses.\n"
         "  --post                # Use POST method. Shortcut for --method POST.\n"
         "  --printable           # Make binary output printable.\n"
         "  --protocol PROTO      # Set HTTP protocol to HTTP/1.0 or HTTP/1.1 .\n"
@@ -598,6 +627,11 @@ static void manageThreadData(ThreadData *data, int flags)
         mprMark(data->url);
         mprMark(data->files);
         mprMark(data->conn);
+        mprMark(data->sock);
+        mprMark(data->requests);
+        mprMark(data->responses);
+        mprMark(data->uri);
+        mprMark(data->latency);
     }
 }
 
@@ -668,6 +702,12 @@ static int processThread(HttpConn *conn, MprEvent *event)
                     break;
                 }
             }
+        } else if (app->pipeline > 0) {
+            td->url = url = resolveUrl(conn, app->target);
+            if (doPipeline(td) < 0) {
+                app->success = 0;
+            }
+            break;
         } else {
             td->url = url = resolveUrl(conn, app->target);
             if (doRequest(conn, url, app->files) < 0) {
@@ -883,12 +923,14 @@ static int doRequest(HttpConn *conn, cchar *url, MprList *files)
 {
     MprTime         mark, remaining;
     HttpLimits      *limits;
+    uint64          ticks;
 
     mprAssert(url && *url);
     limits = conn->limits;
 
     mprLog(MPR_DEBUG, "fetch: %s %s", app->method, url);
     mark = mprGetTime();
+    ticks = mprGetTicks();
 
     if (issueRequest(conn, url, files) < 0) {
         return MPR_ERR_CANT_CONNECT;
@@ -906,13 +948,151 @@ static int doRequest(HttpConn *conn, cchar *url, MprList *files)
         readBody(conn);
     }
     reportResponse(conn, url, mprGetTime() - mark);
-
+    if (app->benchmark) {
+        recordLatency(mprGetTicks() - ticks);
+    }
     httpDestroyRx(conn->rx);
     httpDestroyTx(conn->tx);
     return 0;
 }
 
 
+/*
+    Parse one response from the buffer. Return the length of the complete response, zero if more data is required, 
+    or a negative error code.
+ */
+static ssize parsePipelineResponse(MprBuf *buf, int *status)
+{
+    char    *start, *end, *cp;
+    ssize   headerLen;
+    MprOff  length;
+
+    mprAddNullToBuf(buf);
+    start = mprGetBufStart(buf);
+    if ((end = scontains(start, "\r\n\r\n")) == 0) {
+        return 0;
+    }
+    headerLen = end - start + 4;
+    *status = (int) stoi(&start[9]);
+    length = -1;
+    for (cp = strchr(start, '\n'); cp && cp < end; cp = strchr(cp, '\n')) {
+        cp++;
+        if (sncaselesscmp(cp, "Content-Length:", 15) == 0) {
+            length = stoi(&cp[15]);
+        } else if (sncaselesscmp(cp, "Transfer-Encoding:", 18) == 0) {
+            mprError("Pipelined responses must not use transfer encoding");
+            return MPR_ERR_BAD_FORMAT;
+        }
+    }
+    if (length < 0) {
+        mprError("Pipelined response is missing a content length");
+        return MPR_ERR_BAD_FORMAT;
+    }
+    if (mprGetBufLength(buf) < (headerLen + length)) {
+        return 0;
+    }
+    return (ssize) (headerLen + length);
+}
+
+
+/*
+    Issue pipelined requests. Each batch of "app->pipeline" requests is written in one write before reading the 
+    responses. If the server closes the connection (keep-alive limit), a new connection is opened for the next batch.
+    Only requests without body data are supported. The socket and buffers are held by the thread data as blocking
+    I/O yields to the garbage collector.
+ */
+static int doPipeline(ThreadData *td)
+{
+    MprSocket       *sp;
+    MprBuf          *requests, *buf;
+    MprKeyValue     *header;
+    HttpUri         *uri;
+    cchar           *path, *url;
+    ssize           len, nbytes, written;
+    int             i, next, status, done, received;
+
+    url = td->url;
+    td->uri = uri = httpCreateUri(url, HTTP_COMPLETE_URI);
+    if (uri->secure) {
+        mprError("Pipelining is not supported over SSL");
+        return MPR_ERR_BAD_ARGS;
+    }
+    path = uri->query ? sfmt("%s?%s", uri->path, uri->query) : uri->path;
+    td->requests = requests = mprCreateBuf(HTTP_BUFSIZE, -1);
+    for (i = 0; i < app->pipeline; i++) {
+        mprPutFmtToBuf(requests, "%s %s HTTP/1.1\r\nHost: %s\r\n", app->method, path, uri->host);
+        for (next = 0; (header = mprGetNextItem(app->headers, &next)) != 0; ) {
+            mprPutFmtToBuf(requests, "%s: %s\r\n", header->key, header->value);
+        }
+        mprPutStringToBuf(requests, "\r\n");
+    }
+    td->responses = buf = mprCreateBuf(HTTP_BUFSIZE, -1);
+    mprLog(MPR_DEBUG, "pipeline: %d requests %s %s", app->pipeline, app->method, url);
+    sp = 0;
+    received = 0;
+
+    for (done = 0; !done && !mprShouldDenyNewRequests(); ) {
+        if (sp == 0) {
+            td->sock = sp = mprCreateSocket();
+            if (mprConnectSocket(sp, uri->host, uri->port, MPR_SOCKET_BLOCK) < 0) {
+                mprError("Can't connect to %s:%d", uri->host, uri->port);
+                return MPR_ERR_CANT_CONNECT;
+            }
+            mprFlushBuf(buf);
+            received = 0;
+        }
+        for (written = 0; written < mprGetBufLength(requests); written += nbytes) {
+            if ((nbytes = mprWriteSocket(sp, mprGetBufStart(requests) + written, 
+                    mprGetBufLength(requests) - written)) < 0) {
+                break;
+            }
+        }
+        for (i = 0; i < app->pipeline; ) {
+            if ((len = parsePipelineResponse(buf, &status)) < 0) {
+                mprCloseSocket(sp, 0);
+                return (int) len;
+            } else if (len > 0) {
+                if (status < 200 || status >= 300) {
+                    mprError("Can't process pipelined request for \"%s\" (%d)", url, status);
+                    mprCloseSocket(sp, 0);
+                    return MPR_ERR_CANT_COMPLETE;
+                }
+                mprAdjustBufStart(buf, len);
+                if (app->verbose) {
+                    mprPrintf("Pipelined response %d, status %d, length %d\n", app->fetchCount, status, len);
+                }
+                if (iterationsComplete()) {
+                    done = 1;
+                }
+                received++;
+                i++;
+                continue;
+            }
+            mprCompactBuf(buf);
+            if (mprGetBufSpace(buf) < HTTP_BUFSIZE) {
+                mprGrowBuf(buf, HTTP_BUFSIZE);
+            }
+            if ((nbytes = mprReadSocket(sp, mprGetBufEnd(buf), mprGetBufSpace(buf) - 1)) <= 0) {
+                mprCloseSocket(sp, 0);
+                td->sock = sp = 0;
+                if (received == 0) {
+                    mprError("Connection closed reading pipelined responses from %s", url);
+                    return MPR_ERR_CANT_READ;
+                }
+                /* Server closed the connection. Outstanding requests are reissued on a new connection */
+                break;
+            }
+            mprAdjustBufEnd(buf, nbytes);
+        }
+    }
+    if (sp) {
+        mprCloseSocket(sp, 0);
+    }
+    td->sock = 0;
+    return 0;
+}
+
+
 static int setContentLength(HttpConn *conn, MprList *files)
 {
     MprPath     info;
@@ -1040,11 +1220,72 @@ static bool iterationsComplete()
 }
 
 
+/*
+    Record the latency of a request for the current load thread
+ */
+static void recordLatency(uint64 ticks)
+{
+    MprThread   *tp;
+    ThreadData  *td;
+
+    if ((tp = mprGetCurrentThread()) == 0 || (td = tp->data) == 0) {
+        return;
+    }
+    if (td->latencyCount >= td->latencyMax) {
+        td->latencyMax = max(td->latencyMax * 2, 1024);
+        if ((td->latency = mprRealloc(td->latency, td->latencyMax * sizeof(uint64))) == 0) {
+            td->latencyCount = td->latencyMax = 0;
+            return;
+        }
+    }
+    td->latency[td->latencyCount++] = ticks;
+}
+
+
+static int compareLatency(uint64 *a, uint64 *b)
+{
+    return (*a < *b) ? -1 : ((*a > *b) ? 1 : 0);
+}
+
+
+/*
+    Print request latency percentiles. Ticks are converted to msec using the tick rate measured over the whole run.
+ */
+static void printLatency(uint64 ticks, MprTime elapsed)
+{
+    ThreadData  *td;
+    uint64      *all;
+    double      ticksPerMsec;
+    int         count, next;
+
+    if (elapsed <= 0 || ticks == 0) {
+        return;
+    }
+    count = 0;
+    for (next = 0; (td = mprGetNextItem(app->threadData, &next)) != 0; ) {
+        count += td->latencyCount;
+    }
+    if (count == 0 || (all = mprAlloc(count * sizeof(uint64))) == 0) {
+        return;
+    }
+    count = 0;
+    for (next = 0; (td = mprGetNextItem(app->threadData, &next)) != 0; ) {
+        memcpy(&all[count], td->latency, td->latencyCount * sizeof(uint64));
+        count += td->latencyCount;
+    }
+    qsort(all, count, sizeof(uint64), (int (*)(const void*, const void*)) compareLatency);
+    ticksPerMsec = (double) ticks / elapsed;
+    mprPrintf("Latency 50%%:         %13.4f msec\n", all[count * 50 / 100] / ticksPerMsec);
+    mprPrintf("Latency 90%%:         %13.4f msec\n", all[count * 90 / 100] / ticksPerMsec);
+    mprPrintf("Latency 99%%:         %13.4f msec\n", all[count * 99 / 100] / ticksPerMsec);
+    mprPrintf("Latency max:         %13.4f msec\n", all[count - 1] / ticksPerMsec);
+}
+
+
 static void finishThread(MprThread *tp)
 {
     if (tp) {
         mprLock(app->mutex);
-        app->activeLoadThreads--;
         if (--app->activeLoadThreads <= 0) {
             mprTerminate(MPR_EXIT_DEFAULT, -1);
         }
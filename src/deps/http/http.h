@@ -11,6 +11,12 @@
 
 #include    "mpr.h"
 
+/****************************** Default Features ******************************/
+
+#ifndef BIT_WEB_SOCKETS
+    #define BIT_WEB_SOCKETS 1
+#endif
+
 /****************************** Forward Declarations **************************/
 
 #ifdef __cplusplus
@@ -19,6 +25,8 @@ extern "C" {
 
 #if !DOXYGEN
 struct Http;
+struct Http2;
+struct Http2Stream;
 struct HttpAuth;
 struct HttpConn;
 struct HttpEndpoint;
@@ -33,6 +41,7 @@ struct HttpStage;
 struct HttpTx;
 struct HttpUri;
 struct HttpUser;
+struct HttpWebSocket;
 #endif
 
 /********************************** Tunables **********************************/
@@ -103,12 +112,19 @@ struct HttpUser;
 
 #define HTTP_MAX_TX_BODY           (INT_MAX)        /**< Maximum buffer for response data */
 #define HTTP_MAX_UPLOAD            (INT_MAX)
+#define HTTP_UPLOAD_BUFSIZE        (256 * 1024)     /**< Size of file writes for uploaded files */
+#define HTTP_UPLOAD_RESERVE        (1024 * 1024)    /**< Disk space reserved ahead of uploaded file data */
 
 /*  
     Other constants
  */
 #define HTTP_DEFAULT_MAX_THREADS  10                /**< Default number of threads */
 #define HTTP_MAX_KEEP_ALIVE       100               /**< Maximum requests per connection */
+#define HTTP_MAX_STREAMS          100               /**< Maximum concurrent HTTP/2 streams per connection */
+#define HTTP_MAX_WS_MESSAGE       (2 * 1024 * 1024) /**< Maximum received WebSockets message size */
+#define HTTP_MAX_WS_BACKLOG       (1024 * 1024)     /**< Maximum broadcast data queued for a WebSockets group member */
+#define HTTP_CONN_SLOTS           64                /**< Initial size of the open connections array */
+#define HTTP_MAX_DEFERRED         (64 * 1024)       /**< Maximum pipelined response data to coalesce per write */
 #define HTTP_MAX_PASS             64                /**< Size of password */
 #define HTTP_MAX_SECRET           32                /**< Size of secret data for auth */
 #define HTTP_PACKET_ALIGN(x)      (((x) + 0x3FF) & ~0x3FF)
@@ -136,6 +152,7 @@ struct HttpUser;
     Standard HTTP/1.1 status codes
  */
 #define HTTP_CODE_CONTINUE                  100     /**< Continue with request, only partial content transmitted */
+#define HTTP_CODE_SWITCHING                 101     /**< Switching protocols */
 #define HTTP_CODE_OK                        200     /**< The request completed successfully */
 #define HTTP_CODE_CREATED                   201     /**< The request has completed and a new resource was created */
 #define HTTP_CODE_ACCEPTED                  202     /**< The request has been accepted and processing is continuing */
@@ -244,7 +261,7 @@ extern void httpSetForkCallback(struct Http *http, MprForkCallback proc, void *a
 typedef struct Http {
     MprList         *endpoints;             /**< Currently configured listening endpoints */
     MprList         *hosts;                 /**< List of host objects */
-    MprList         *connections;           /**< Currently open connection requests */
+    struct HttpConn **connections;          /**< Currently open connections. Indexed by HttpConn.slot */
     MprHash         *stages;                /**< Possible stages in connection pipelines */
     MprCache        *sessionCache;          /**< Session state cache */
     MprHash         *statusCodes;           /**< Http status codes */
@@ -255,12 +272,14 @@ typedef struct Http {
 
     MprHash         *authTypes;             /**< Available authentication protocol types */
     MprHash         *authStores;            /**< Available password stores */
+    MprHash         *groups;                /**< WebSockets broadcast groups */
 
     /*  
         Some standard pipeline stages
      */
     struct HttpStage *netConnector;         /**< Default network connector */
     struct HttpStage *sendConnector;        /**< Optimized sendfile connector */
+    struct HttpStage *http2Connector;       /**< HTTP/2 stream connector */
     struct HttpStage *rangeFilter;          /**< Ranged requests filter */
     struct HttpStage *cacheFilter;          /**< Cache filter */
     struct HttpStage *chunkFilter;          /**< Chunked transfer encoding filter */
@@ -274,6 +293,7 @@ typedef struct Http {
     struct HttpStage *procHandler;          /**< Proc handler */
     struct HttpStage *phpHandler;           /**< PHP through handler */
     struct HttpStage *uploadFilter;         /**< Upload filter */
+    struct HttpStage *sockFilter;           /**< WebSockets filter */
 
     struct HttpLimits *clientLimits;        /**< Client resource limits */
     struct HttpLimits *serverLimits;        /**< Server resource limits */
@@ -290,7 +310,8 @@ typedef struct Http {
 
     int             nextAuth;               /**< Auth object version vector */
     int             connCount;              /**< Count of connections */
-    int             sessionCount;           /**< Count of sessions */
+    int             connLength;             /**< Number of open connections */
+    int             connSize;               /**< Allocated size of the connections array */
     void            *context;               /**< Embedding context */
     MprTime         currentTime;            /**< When currentDate was last calculated */
     char            *currentDate;           /**< Date string for HTTP response headers */
@@ -436,6 +457,32 @@ extern struct HttpEndpoint *httpLookupEndpoint(Http *http, cchar *ip, int port);
  */
 extern void httpSetSoftware(Http *http, cchar *description);
 
+/**
+    Get the number of open connections
+    @param http Http object created via #httpCreate
+    @return The count of connections created via httpCreateConn and not yet destroyed.
+ */
+extern int httpGetConnCount(Http *http);
+
+/**
+    Get the next open connection
+    @description Iterate over the open connections. Use the ITERATE_CONNS macro for convenience. The Http object must 
+        be locked via the Http mutex while iterating. Connections may be added or removed while iterating. If the current 
+        connection is removed, the last connection is moved into its position, so decrement the iterator to visit it.
+    @param http Http object created via #httpCreate
+    @param next Iterator index. Set to zero to start.
+    @return The next connection or null when all connections have been visited.
+ */
+extern struct HttpConn *httpGetNextConn(Http *http, int *next);
+
+/**
+    Iterate over the open connections
+    @param http Http object created via #httpCreate
+    @param conn Variable to hold each connection
+    @param next Iterator index variable
+ */
+#define ITERATE_CONNS(http, conn, next) next = 0; (conn = httpGetNextConn(http, &next)) != 0; 
+
 /* Internal APIs */
 extern void httpAddConn(Http *http, struct HttpConn *conn);
 extern struct HttpEndpoint *httpGetFirstEndpoint(Http *http);
@@ -468,9 +515,11 @@ typedef struct HttpLimits {
     int     clientMax;              /**< Maximum number of simultaneous clients endpoints */
     int     headerMax;              /**< Maximum number of header lines */
     int     keepAliveMax;           /**< Maximum number of Keep-Alive requests to perform per socket */
+    int     streamMax;              /**< Maximum number of concurrent HTTP/2 streams per socket. Zero disables HTTP/2 */
     int     requestMax;             /**< Maximum number of simultaneous concurrent requests */
     int     processMax;             /**< Maximum number of processes (CGI) */
     int     sessionMax;             /**< Maximum number of sessions */
+    ssize   webSocketsMessageSize;  /**< Maximum size of a received WebSockets message */
 
     MprTime inactivityTimeout;      /**< Default timeout for keep-alive and idle requests (msec) */
     MprTime requestTimeout;         /**< Default time a request can take (msec) */
@@ -718,6 +767,11 @@ typedef struct HttpRange {
 #define HTTP_PACKET_RANGE     0x2               /**< Packet is a range boundary packet */
 #define HTTP_PACKET_DATA      0x4               /**< Packet contains actual content data */
 #define HTTP_PACKET_END       0x8               /**< End of stream packet */
+#define HTTP_PACKET_FRAMED    0x10              /**< Packet has been framed as a WebSockets message */
+#define HTTP_PACKET_MORE      0x20              /**< More packets of this WebSockets message or upload file follow */
+#define HTTP_PACKET_SHARED    0x40              /**< Packet data is shared with other connections. Must not be modified */
+#define HTTP_PACKET_UPLOAD    0x80              /**< Packet contains streamed upload file data. See HttpPacket.upload */
+#define HTTP_PACKET_FILLING   0x100             /**< Packet is being filled by an asynchronous read */
 
 /**
     Callback procedure to fill a packet with data
@@ -725,7 +779,9 @@ typedef struct HttpRange {
     @param packet The packet to fill
     @param off Offset in the packet to fill with data
     @param size Size of packet from the offset to fill.
-    @return The number of bytes copied into the packet.
+    @return The number of bytes copied into the packet. Returns MPR_ERR_NOT_READY if the data is being read 
+        asynchronously. The packet is then marked with HTTP_PACKET_FILLING and the queue is suspended until the data
+        is available. The caller should put back the packet and call the fill callback again when resumed.
     @ingroup HttpPacket
  */
 typedef ssize (*HttpFillProc)(struct HttpQueue *q, struct HttpPacket *packet, MprOff pos, ssize size);
@@ -753,6 +809,8 @@ typedef struct HttpPacket {
     MprOff          epos;                   /**< Data position in entity (file) */
     HttpFillProc    fill;                   /**< Callback to fill packet with data */
     int             flags;                  /**< Packet flags */
+    int             type;                   /**< WebSockets message type. Zero for HTTP content */
+    struct HttpUploadFile *upload;          /**< Upload file described by streamed upload data */
     struct HttpPacket *next;                /**< Next packet in chain */
 } HttpPacket;
 
@@ -1303,6 +1361,7 @@ extern void httpAssignQueue(HttpQueue *q, struct HttpStage *stage, int dir);
 #define HTTP_STAGE_UNLOADED       0x20000           /**< Stage module library has been unloaded */
 #define HTTP_STAGE_RX             0x40000           /**< Stage to be used in the Rx direction */
 #define HTTP_STAGE_TX             0x80000           /**< Stage to be used in the Tx direction */
+#define HTTP_STAGE_NONBLOCK       0x100000          /**< Handler never blocks and may run on the event thread */
 
 typedef int (*HttpParse)(Http *http, cchar *key, char *value, void *state);
 
@@ -1592,12 +1651,14 @@ extern void httpSetStageData(struct HttpConn *conn, cchar *key, cvoid *data);
 extern void httpAddStage(Http *http, HttpStage *stage);
 extern int httpOpenNetConnector(Http *http);
 extern int httpOpenSendConnector(Http *http);
+extern int httpOpenHttp2Connector(Http *http);
 extern int httpOpenChunkFilter(Http *http);
 extern int httpOpenCacheHandler(Http *http);
 extern int httpOpenPassHandler(Http *http);
 extern int httpOpenProcHandler(Http *http);
 extern int httpOpenRangeFilter(Http *http);
 extern int httpOpenUploadFilter(Http *http);
+extern int httpOpenSockFilter(Http *http);
 extern void httpSendOpen(HttpQueue *q);
 extern void httpSendClose(HttpQueue *q);
 extern void httpSendOutgoingService(HttpQueue *q);
@@ -1758,6 +1819,13 @@ typedef struct HttpConn {
     struct HttpQueue *currentq;             /**< Current queue being serviced (just for GC) */
 
     HttpPacket      *input;                 /**< Header packet */
+    MprBuf          *deferred;              /**< Connection output awaiting write (HTTP/2 frames, upgrade response) */
+    MprIOVec        *deferredVec;           /**< Completed pipelined responses awaiting a coalesced write */
+    MprList         *deferredPackets;       /**< Packet buffers referenced by deferredVec */
+    int             deferredIndex;          /**< Count of entries in deferredVec */
+    ssize           deferredCount;          /**< Count of bytes in deferredVec */
+    struct Http2    *h2;                    /**< HTTP/2 session if the connection has switched to HTTP/2 */
+    struct Http2Stream *stream;             /**< HTTP/2 stream if the connection hosts a single stream request */
     HttpQueue       *readq;                 /**< End of the read pipeline */
     HttpQueue       *writeq;                /**< Start of the write pipeline */
     HttpQueue       *connectorq;            /**< Connector write queue */
@@ -1786,6 +1854,7 @@ typedef struct HttpConn {
     int             retries;                /**< Client request retries */
     int             secure;                 /**< Using https */
     int             seqno;                  /**< Unique connection sequence number */
+    int             slot;                   /**< Index in Http.connections. Set to -1 when removed */
     int             writeBlocked;           /**< Transmission writing is blocked */
     int             worker;                 /**< Use worker */
 
@@ -1814,6 +1883,16 @@ typedef struct HttpConn {
 } HttpConn;
 
 
+/**
+    Remove written bytes from the deferred output
+    @param conn HttpConn object created via $httpCreateConn
+    @param written Count of bytes written from the front of the vector returned by $httpGetDeferredVec
+    @return Count of written bytes beyond the deferred output
+    @ingroup HttpConn
+    @internal
+ */
+extern ssize httpAdjustDeferred(HttpConn *conn, ssize written);
+
 /**
     Call httpEvent with the given event mask
     @param conn HttpConn object created via $httpCreateConn
@@ -1956,6 +2035,18 @@ extern void httpError(HttpConn *conn, int status, cchar *fmt, ...);
  */
 extern void httpEvent(struct HttpConn *conn, MprEvent *event);
 
+/**
+    Flush deferred pipelined response data
+    @description When pipelined requests are queued on the connection, the net connector defers writing small
+        completed responses so that several can be coalesced into one socket write. This call writes any deferred
+        data without blocking.
+    @param conn HttpConn object created via $httpCreateConn
+    @return True if all deferred data has been written
+    @ingroup HttpConn
+    @internal
+ */
+extern bool httpFlushDeferred(HttpConn *conn);
+
 /**
     Get the async mode value for the connection
     @param conn HttpConn object created via $httpCreateConn
@@ -1988,6 +2079,26 @@ extern void *httpGetConnContext(HttpConn *conn);
  */
 extern void *httpGetConnHost(HttpConn *conn);
 
+/**
+    Get the length of the deferred output
+    @param conn HttpConn object created via $httpCreateConn
+    @return Count of deferred bytes awaiting write
+    @ingroup HttpConn
+    @internal
+ */
+extern ssize httpGetDeferredLength(HttpConn *conn);
+
+/**
+    Add the deferred output to an I/O vector
+    @description Deferred pipelined responses are held as references to their packet buffers and are not copied.
+    @param conn HttpConn object created via $httpCreateConn
+    @param iovec I/O vector with room for HTTP_MAX_IOVEC + 1 entries
+    @return Count of entries added to the vector
+    @ingroup HttpConn
+    @internal
+ */
+extern int httpGetDeferredVec(HttpConn *conn, MprIOVec *iovec);
+
 /** 
     Get the error message associated with the last request.
     @description Error messages may be generated for internal or client side errors.
@@ -2268,6 +2379,399 @@ extern void httpTraceContent(HttpConn *conn, int dir, int item, HttpPacket *pack
 extern void httpUsePrimary(HttpConn *conn);
 extern void httpUseWorker(HttpConn *conn, MprDispatcher *dispatcher, MprEvent *event);
 
+/************************************ Http2 ***********************************/
+/*
+    HTTP/2 protocol constants (RFC 7540, RFC 7541)
+ */
+#define HTTP2_PREFACE               "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"  /**< Client connection preface */
+#define HTTP2_PREFACE_SIZE          24          /**< Length of the client connection preface */
+#define HTTP2_FRAME_HEADER_SIZE     9           /**< Size of a frame header */
+#define HTTP2_DEFAULT_WINDOW        65535       /**< Initial flow control window */
+#define HTTP2_DEFAULT_FRAME_SIZE    16384       /**< Initial maximum frame size */
+#define HTTP2_MAX_FRAME_SIZE        16777215    /**< Largest frame size a peer may request */
+#define HTTP2_MAX_WINDOW            0x7FFFFFFF  /**< Largest flow control window */
+#define HTTP2_HEADER_TABLE_SIZE     4096        /**< Default HPACK dynamic table size */
+#define HTTP2_MAX_BUFFER            (64 * 1024) /**< Buffered frame output before streams are suspended */
+
+/*
+    Frame types
+ */
+#define HTTP2_DATA_FRAME            0x0
+#define HTTP2_HEADERS_FRAME         0x1
+#define HTTP2_PRIORITY_FRAME        0x2
+#define HTTP2_RESET_FRAME           0x3
+#define HTTP2_SETTINGS_FRAME        0x4
+#define HTTP2_PUSH_FRAME            0x5
+#define HTTP2_PING_FRAME            0x6
+#define HTTP2_GOAWAY_FRAME          0x7
+#define HTTP2_WINDOW_FRAME          0x8
+#define HTTP2_CONTINUE_FRAME        0x9
+
+/*
+    Frame flags
+ */
+#define HTTP2_END_STREAM_FLAG       0x1         /**< Last frame of the stream */
+#define HTTP2_ACK_FLAG              0x1         /**< Settings or ping acknowledgement */
+#define HTTP2_END_HEADERS_FLAG      0x4         /**< Last frame of a header block */
+#define HTTP2_PADDED_FLAG           0x8         /**< Frame payload is padded */
+#define HTTP2_PRIORITY_FLAG         0x20        /**< Headers frame includes priority information */
+
+/*
+    Settings
+ */
+#define HTTP2_HEADER_TABLE_SIZE_SETTING     0x1
+#define HTTP2_ENABLE_PUSH_SETTING           0x2
+#define HTTP2_MAX_STREAMS_SETTING           0x3
+#define HTTP2_INITIAL_WINDOW_SETTING        0x4
+#define HTTP2_MAX_FRAME_SIZE_SETTING        0x5
+#define HTTP2_MAX_HEADER_SIZE_SETTING       0x6
+
+/*
+    Error codes
+ */
+#define HTTP2_NO_ERROR              0x0
+#define HTTP2_PROTOCOL_ERROR        0x1
+#define HTTP2_INTERNAL_ERROR        0x2
+#define HTTP2_FLOW_CONTROL_ERROR    0x3
+#define HTTP2_STREAM_CLOSED_ERROR   0x5
+#define HTTP2_FRAME_SIZE_ERROR      0x6
+#define HTTP2_REFUSED_STREAM_ERROR  0x7
+#define HTTP2_CANCEL_ERROR          0x8
+#define HTTP2_COMPRESSION_ERROR     0x9
+
+/**
+    HPACK header compression table
+    @description Holds the dynamic table state used to decompress header blocks received on a HTTP/2 connection.
+    @stability Evolving
+    @defgroup HttpHpack HttpHpack
+    @see httpCreateHpack httpDecodeHpack httpEncodeHpack
+ */
+typedef struct HttpHpack {
+    MprList     *entries;               /**< Dynamic table entries (MprKeyValue). Most recent first. */
+    ssize       size;                   /**< Current table size (name + value + 32 for each entry) */
+    ssize       max;                    /**< Maximum table size */
+} HttpHpack;
+
+/**
+    Create a HPACK dynamic table
+    @param max Maximum size of the dynamic table
+    @return HttpHpack object
+    @ingroup HttpHpack
+ */
+extern HttpHpack *httpCreateHpack(ssize max);
+
+/**
+    Decode a HPACK header block
+    @param hp HttpHpack object created via #httpCreateHpack
+    @param data Header block
+    @param len Length of the header block
+    @param max Maximum size of the decoded header list. Each header counts its name and value length plus 32.
+    @return List of MprKeyValue header pairs in received order. Returns null if the block cannot be decoded or 
+        the decoded headers exceed the maximum size.
+    @ingroup HttpHpack
+ */
+extern MprList *httpDecodeHpack(HttpHpack *hp, cuchar *data, ssize len, ssize max);
+
+/**
+    Encode a header as a HPACK literal
+    @description The header is encoded as a literal that is not added to the peer's dynamic table. Well known
+        header names are encoded via the static table.
+    @param buf Buffer to receive the encoded header
+    @param name Header name. Must be lower case.
+    @param value Header value
+    @ingroup HttpHpack
+ */
+extern void httpEncodeHpack(MprBuf *buf, cchar *name, cchar *value);
+
+/* Internal */
+extern void httpInitHpack();
+
+/**
+    HTTP/2 connection session
+    @description A HTTP/2 session is created when a connection sends the HTTP/2 connection preface or upgrades via
+        "Upgrade: h2c". Thereafter, the connection only frames and unframes data. Each request stream is serviced
+        by a separate HttpConn with its own HttpRx, HttpTx and pipeline.
+    @stability Evolving
+    @defgroup Http2 Http2
+    @see Http2Stream httpCreateHttp2 httpDestroyHttp2 httpPumpHttp2 httpResumeHttp2 httpUpgradeHttp2
+ */
+typedef struct Http2 {
+    struct HttpConn *conn;              /**< Network connection */
+    MprList     *streams;               /**< Active streams */
+    HttpHpack   *decoder;               /**< Request header decompression state */
+    MprBuf      *headerBlock;           /**< Header block awaiting CONTINUATION frames */
+    int         headerStream;           /**< Stream ID of the header block in progress */
+    int         headerFlags;            /**< Flags of the HEADERS frame starting the header block */
+    int         lastStream;             /**< Highest stream ID received */
+    int         preface;                /**< Awaiting the client connection preface */
+    int         goaway;                 /**< Connection is closing */
+    int         closing;                /**< Client sent GOAWAY. New streams are refused */
+    ssize       window;                 /**< Connection send window */
+    ssize       recvWindow;             /**< Connection receive window remaining */
+    ssize       initialWindow;          /**< Initial stream send window */
+    ssize       frameSize;              /**< Maximum frame size accepted by the client */
+} Http2;
+
+/**
+    HTTP/2 stream
+    @ingroup Http2
+ */
+typedef struct Http2Stream {
+    Http2       *h2;                    /**< Owning session */
+    struct HttpConn *conn;              /**< Stream connection servicing the request */
+    MprEvent    *event;                 /**< Pending event to service the stream connection */
+    ssize       window;                 /**< Stream send window */
+    ssize       recvWindow;             /**< Stream receive window remaining */
+    ssize       unacked;                /**< Received data not yet acknowledged by a window update */
+    int         id;                     /**< Stream ID */
+    int         weight;                 /**< Priority weight (1-256) */
+    int         blocked;                /**< Output is waiting on flow control or the network */
+    int         chunked;                /**< Request body is relayed using chunked encoding */
+    int         eof;                    /**< Client has finished sending */
+    int         ended;                  /**< Server has finished sending */
+    int         reset;                  /**< Stream has been reset */
+} Http2Stream;
+
+/**
+    Start HTTP/2 on a connection
+    @description Create a HTTP/2 session and send the initial SETTINGS frame.
+    @param conn HttpConn object created via $httpCreateConn
+    @return Http2 session object
+    @ingroup Http2
+ */
+extern Http2 *httpCreateHttp2(struct HttpConn *conn);
+
+/**
+    Destroy the HTTP/2 session on a connection
+    @description Active streams are aborted.
+    @param conn HttpConn object created via $httpCreateConn
+    @ingroup Http2
+ */
+extern void httpDestroyHttp2(struct HttpConn *conn);
+
+/**
+    Process HTTP/2 frames
+    @param conn HttpConn object created via $httpCreateConn
+    @param packet Packet containing received data
+    @ingroup Http2
+ */
+extern void httpPumpHttp2(struct HttpConn *conn, HttpPacket *packet);
+
+/**
+    Resume streams waiting to write
+    @description Called when buffered frames have been written to the network. Streams are resumed in priority order.
+    @param conn HttpConn object created via $httpCreateConn
+    @ingroup Http2
+ */
+extern void httpResumeHttp2(struct HttpConn *conn);
+
+/**
+    Upgrade a HTTP/1.1 connection to HTTP/2
+    @description Respond to a request with "Upgrade: h2c" with a 101 response and service the request as stream 1.
+    @param conn HttpConn object created via $httpCreateConn
+    @param headers Request line and headers of the upgrade request
+    @return True if the connection was upgraded
+    @ingroup Http2
+ */
+extern bool httpUpgradeHttp2(struct HttpConn *conn, cchar *headers);
+
+/* Internal APIs */
+extern void httpCloseStream(struct HttpConn *conn);
+extern void httpScheduleStream(struct HttpConn *conn);
+
+/******************************** HttpWebSocket *******************************/
+/*
+    WebSockets message types (frame opcodes)
+ */
+#define HTTP_WS_CONT        0x0         /**< Continuation of a fragmented message */
+#define HTTP_WS_TEXT        0x1         /**< UTF-8 text message */
+#define HTTP_WS_BINARY      0x2         /**< Binary message */
+#define HTTP_WS_CLOSE       0x8         /**< Close the connection */
+#define HTTP_WS_PING        0x9         /**< Ping request */
+#define HTTP_WS_PONG        0xA         /**< Ping response */
+
+/*
+    WebSockets connection states
+ */
+#define HTTP_WS_STATE_OPEN      1       /**< Connection is open for messages */
+#define HTTP_WS_STATE_CLOSING   2       /**< Close message sent and awaiting the peer close message */
+#define HTTP_WS_STATE_CLOSED    3       /**< Connection closed */
+
+/*
+    WebSockets close status codes
+ */
+#define HTTP_WS_STATUS_OK               1000    /**< Normal closure */
+#define HTTP_WS_STATUS_GOING_AWAY       1001    /**< Endpoint is going away */
+#define HTTP_WS_STATUS_PROTOCOL_ERROR   1002    /**< Protocol error */
+#define HTTP_WS_STATUS_UNSUPPORTED      1003    /**< Unsupported message type */
+#define HTTP_WS_STATUS_NO_STATUS        1005    /**< No status was received */
+#define HTTP_WS_STATUS_INVALID_DATA     1007    /**< Message data is not valid for the message type */
+#define HTTP_WS_STATUS_TOO_LARGE        1009    /**< Message is too large */
+#define HTTP_WS_STATUS_INTERNAL_ERROR   1011    /**< Internal server error */
+
+/*
+    httpSendBlock flags
+ */
+#define HTTP_MORE           0x1         /**< More fragments of this message follow */
+
+/*
+    Broadcast group policies for members that exceed the group queue limit
+ */
+#define HTTP_GROUP_DROP         0x1     /**< Drop messages for the member until its queue drains */
+#define HTTP_GROUP_DISCONNECT   0x2     /**< Disconnect the member */
+
+/**
+    WebSockets connection state
+    @description WebSockets connections are upgraded from HTTP/1.1 requests by the sockFilter. The filter frames
+        outgoing messages and delivers each received message to the handler as a packet on the read queue. 
+        The Packet.type field is set to the message type (HTTP_WS_TEXT or HTTP_WS_BINARY). Handlers are notified of
+        new messages via HTTP_NOTIFY_READABLE events. Routes must enable the filter via "AddFilter sockFilter".
+    @stability Evolving
+    @defgroup HttpWebSocket HttpWebSocket
+    @see httpBroadcast httpCloseWebSocket httpGetWebSocketState httpJoinGroup httpLeaveGroup httpLookupGroup httpSend 
+        httpSendBlock httpSetGroupLimits httpSetRouteWebSocketsDeflate
+ */
+typedef struct HttpWebSocket {
+    int             state;                  /**< Connection state */
+    int             closeStatus;            /**< Status code from the peer close message */
+    char            *closeReason;           /**< Reason text from the peer close message */
+    HttpPacket      *input;                 /**< Received data not yet parsed into frames */
+    HttpPacket      *message;               /**< Fragmented message being received */
+    int             messageType;            /**< Type of the fragmented message being received */
+    int             compressed;             /**< Message being received is compressed */
+    int             sending;                /**< Fragmented message being sent */
+    int             deflate;                /**< The permessage-deflate extension has been negotiated */
+    int             clientNoTakeover;       /**< Reset the inflate context after each message */
+    int             serverNoTakeover;       /**< Reset the deflate context after each message */
+    void            *inflater;              /**< Decompression state */
+    void            *deflater;              /**< Compression state */
+    int             windowBits;             /**< Negotiated compression window bits */
+    int             fragmenting;            /**< Handler is sending a fragmented message */
+    struct HttpQueue *queue;                /**< Filter transmit queue */
+    MprList         *groups;                /**< Broadcast groups joined by the connection */
+    MprList         *broadcasts;            /**< Broadcast messages waiting to be queued */
+    ssize           broadcastBytes;         /**< Length of the waiting broadcast messages */
+    int             scheduled;              /**< Broadcast delivery event is scheduled */
+    int             disconnect;             /**< Connection exceeded a group limit and is to be disconnected */
+    MprMutex        *mutex;                 /**< Multithread sync for the broadcast state */
+} HttpWebSocket;
+
+/**
+    WebSockets broadcast group
+    @description Groups are named sets of WebSockets connections. Messages broadcast to a group are framed and 
+        compressed once and the resulting packet is shared by all members without copying. Each member has a limit
+        on the broadcast data that may be queued and not yet written. The group policy defines what happens when a
+        member exceeds this limit.
+    @ingroup HttpWebSocket
+ */
+typedef struct HttpGroup {
+    char            *name;                  /**< Group name */
+    MprList         *members;               /**< Member connections */
+    ssize           maxQueued;              /**< Maximum data queued for a member before applying the policy */
+    int             policy;                 /**< HTTP_GROUP_DROP or HTTP_GROUP_DISCONNECT */
+    int64           messages;               /**< Count of messages broadcast */
+    int64           dropped;                /**< Count of messages dropped for members exceeding the limit */
+} HttpGroup;
+
+/**
+    Broadcast a message to a group
+    @description The message is framed once and the frame is queued for all members of the group without copying the
+        message data. Members that have negotiated the permessage-deflate extension without server context takeover
+        receive a shared compressed frame. Other members receive the frame uncompressed. This routine may be called 
+        from any thread.
+    @param http Http service object
+    @param name Group name
+    @param type Message type. Set to HTTP_WS_TEXT or HTTP_WS_BINARY. Text messages must be valid UTF-8.
+    @param buf Message data
+    @param len Length of the message data. Set to -1 to use the string length of buf.
+    @return Number of members the message was queued for. Returns a negative MPR error code on errors.
+    @ingroup HttpWebSocket
+ */
+extern int httpBroadcast(Http *http, cchar *name, int type, cchar *buf, ssize len);
+
+/**
+    Join a broadcast group
+    @description The group is created if it does not exist. Connections leave all groups when closed.
+    @param conn HttpConn connection object
+    @param name Group name
+    @return Zero if successful, otherwise a negative MPR error code.
+    @ingroup HttpWebSocket
+ */
+extern int httpJoinGroup(struct HttpConn *conn, cchar *name);
+
+/**
+    Leave a broadcast group
+    @param conn HttpConn connection object
+    @param name Group name
+    @ingroup HttpWebSocket
+ */
+extern void httpLeaveGroup(struct HttpConn *conn, cchar *name);
+
+/**
+    Lookup a broadcast group
+    @param http Http service object
+    @param name Group name
+    @return HttpGroup object or null if the group does not exist.
+    @ingroup HttpWebSocket
+ */
+extern HttpGroup *httpLookupGroup(Http *http, cchar *name);
+
+/**
+    Set the queue limit for group members
+    @description The group is created if it does not exist.
+    @param http Http service object
+    @param name Group name
+    @param maxQueued Maximum data that may be queued for a member and not yet written. Defaults to HTTP_MAX_WS_BACKLOG.
+    @param policy Set to HTTP_GROUP_DROP to drop messages for a member while it exceeds the limit. Set to 
+        HTTP_GROUP_DISCONNECT to disconnect the member.
+    @return Zero if successful, otherwise a negative MPR error code.
+    @ingroup HttpWebSocket
+ */
+extern int httpSetGroupLimits(Http *http, cchar *name, ssize maxQueued, int policy);
+
+/**
+    Close a WebSockets connection
+    @description Send a close message. The connection is closed when the peer responds with a close message.
+    @param conn HttpConn connection object
+    @param status Close status code. Set to HTTP_WS_STATUS_OK for a normal closure.
+    @param reason Optional reason text. Must be less than 124 bytes.
+    @ingroup HttpWebSocket
+ */
+extern void httpCloseWebSocket(struct HttpConn *conn, int status, cchar *reason);
+
+/**
+    Get the WebSockets connection state
+    @param conn HttpConn connection object
+    @return HTTP_WS_STATE_OPEN, HTTP_WS_STATE_CLOSING or HTTP_WS_STATE_CLOSED. Returns zero if the connection is not
+        a WebSockets connection.
+    @ingroup HttpWebSocket
+ */
+extern int httpGetWebSocketState(struct HttpConn *conn);
+
+/**
+    Send a formatted WebSockets text message
+    @param conn HttpConn connection object
+    @param fmt Printf style formatted string
+    @param ... Arguments for fmt
+    @return Number of bytes queued for sending. Returns a negative MPR error code on errors.
+    @ingroup HttpWebSocket
+ */
+extern ssize httpSend(struct HttpConn *conn, cchar *fmt, ...);
+
+/**
+    Send a WebSockets message
+    @description The message is queued and sent as the connection becomes writable. Messages are compressed if the
+        permessage-deflate extension has been negotiated.
+    @param conn HttpConn connection object
+    @param type Message type. Set to HTTP_WS_TEXT or HTTP_WS_BINARY. Text messages must be valid UTF-8.
+    @param buf Message data
+    @param len Length of the message data
+    @param flags Set to HTTP_MORE if more fragments of this message will be sent
+    @return Number of bytes queued for sending. Returns a negative MPR error code on errors.
+    @ingroup HttpWebSocket
+ */
+extern ssize httpSendBlock(struct HttpConn *conn, int type, cchar *buf, ssize len, int flags);
+
 /********************************** HttpAuth *********************************/
 /*  
     Authorization flags for HttpAuth.flags
@@ -2824,6 +3328,9 @@ extern void httpDefineProc(cchar *uri, HttpProc fun);
 #define HTTP_ROUTE_PUT_DELETE     0x1000    /**< Support PUT|DELETE on this route */
 #define HTTP_ROUTE_GZIP           0x2000    /**< Support gzipped content on this route */
 #define HTTP_ROUTE_STARTED        0x4000    /**< Route initialized */
+#define HTTP_ROUTE_COROUTINE      0x8000    /**< Run blocking handlers on coroutines */
+#define HTTP_ROUTE_WS_NO_TAKEOVER 0x10000   /**< Reset WebSockets compression context after each message */
+#define HTTP_ROUTE_UPLOAD_STREAM  0x20000   /**< Stream upload file data to the handler instead of temp files */
 
 /**
     Route Control
@@ -2831,15 +3338,15 @@ extern void httpDefineProc(cchar *uri, HttpProc fun);
     @defgroup HttpRoute HttpRoute
     @see HttpRoute httpAddRouteCondition httpAddRouteErrorDocument httpAddRouteExpiry httpAddRouteExpiryByType 
         httpAddRouteFilter httpAddRouteHandler httpAddRouteHeader httpAddRouteLanguageDir httpAddRouteLanguageSuffix 
-        httpAddRouteLoad httpAddRouteQuery httpAddRouteUpdate httpClearRouteStages httpCreateAliasRoute 
-        httpCreateDefaultRoute httpCreateInheritedRoute httpCreateRoute httpDefineRoute
+        httpAddRouteLoad httpAddRouteQuery httpAddRouteSessionKey httpAddRouteUpdate httpClearRouteStages 
+        httpCreateAliasRoute httpCreateDefaultRoute httpCreateInheritedRoute httpCreateRoute httpDefineRoute
         httpDefineRouteCondition httpDefineRouteTarget httpDefineRouteUpdate httpFinalizeRoute httpGetRouteData 
         httpGetRouteDir httpLink httpLookupRouteErrorDocument httpMakePath httpMatchRoute httpResetRoutePipeline 
         httpSetRouteAuth httpSetRouteAutoDelete httpSetRouteCompression httpSetRouteConnector httpSetRouteData 
         httpSetRouteDefaultLanguage httpSetRouteDir httpSetRouteFlags httpSetRouteHandler httpSetRouteHost 
         httpSetRouteIndex httpSetRouteMethods httpSetRouteName httpSetRouteVar httpSetRoutePattern 
-        httpSetRoutePrefix httpSetRouteScript httpSetRouteSource httpSetRouteTarget httpSetRouteWorkers httpTemplate 
-        httpSetTrace httpSetTraceFilter httpTokenize httpTokenizev 
+        httpSetRoutePrefix httpSetRouteScript httpSetRouteSessionStore httpSetRouteSource httpSetRouteTarget 
+        httpSetRouteWorkers httpTemplate httpSetTrace httpSetTraceFilter httpTokenize httpTokenizev 
  */
 typedef struct HttpRoute {
     /* Ordered for debugging */
@@ -2905,6 +3412,10 @@ typedef struct HttpRoute {
     char            *script;                /**< Startup script for handlers serving this route */
     char            *scriptPath;            /**< Startup script path for handlers serving this route */
     int             workers;                /**< Number of workers to use for this route */
+    int             webSocketsDeflate;      /**< WebSockets compression window bits. Zero disables compression */
+    int             sessionStore;           /**< Session store (HTTP_SESSION_SERVER or HTTP_SESSION_CLIENT) */
+    ssize           sessionCookieMax;       /**< Maximum size of a client session cookie */
+    MprList         *sessionKeys;           /**< Client session signing keys. The first key signs new cookies */
 
     MprHash         *methods;               /**< Matching HTTP methods */
     MprList         *params;                /**< Matching param field data */
@@ -3774,6 +4285,45 @@ extern void httpSetRouteTemplate(HttpRoute *route, cchar *tplate);
 extern void httpSetRouteTraceFilter(HttpRoute *route, int dir, int levels[HTTP_TRACE_MAX_ITEM], 
         ssize len, cchar *include, cchar *exclude);
 
+/**
+    Configure WebSockets compression for a route
+    @description Enable the permessage-deflate extension for WebSockets connections on this route. Compression is
+        only negotiated if the client offers the extension.
+    @param route Route to modify
+    @param windowBits Base two logarithm of the compression window size (9-15). Smaller windows reduce per-connection
+        memory. Set to zero to disable compression.
+    @param takeover Set to true to preserve the compression context between messages. Set to false to reset the
+        context after each message. This reduces the compression ratio, but the compression state can be released 
+        between messages.
+    @ingroup HttpRoute
+ */
+/**
+    Add a client session store key
+    @description Client session cookies are signed with the first key added to the route. All keys are accepted when
+        verifying cookies, so keys can be rotated by adding a new key before the old key. The keys must be the same on
+        all servers that share sessions. If no keys are defined, the Http secret is used, which is unique to this 
+        process.
+    @param route Route to modify
+    @param key Secret key text
+    @ingroup HttpRoute
+ */
+extern void httpAddRouteSessionKey(HttpRoute *route, cchar *key);
+
+/**
+    Define the session store for a route
+    @description Session state is stored in the server session cache by default. The client store keeps session state 
+        in a HMAC-SHA256 signed cookie so that no server memory or locking is required for the session. 
+    @param route Route to modify
+    @param store Set to HTTP_SESSION_SERVER or HTTP_SESSION_CLIENT. Add HTTP_SESSION_ENCRYPT to encrypt the client 
+        cookie in addition to signing.
+    @param maxCookie Maximum size of the client session cookie. Larger sessions are moved to the server store. Set to
+        zero for the default size (HTTP_SESSION_MAX_COOKIE).
+    @ingroup HttpRoute
+ */
+extern void httpSetRouteSessionStore(HttpRoute *route, int store, ssize maxCookie);
+
+extern void httpSetRouteWebSocketsDeflate(HttpRoute *route, int windowBits, bool takeover);
+
 /**
     Define the maximum number of workers for a route
     @param route Route to modify
@@ -3863,11 +4413,30 @@ extern char *httpExpandRouteVars(HttpConn *conn, cchar *str);
 /*********************************** Session ***************************************/
 
 #define HTTP_SESSION_COOKIE     "-http-session-"    /**< Session cookie name */
+#define HTTP_SESSION_STATE      "-http-state-"      /**< Client session store cookie name */
 #define HTTP_SESSION_USERNAME   "_:USERNAME:_"      /**< Username variable */
 #define HTTP_SESSION_AUTHVER    "_:VERSION:_"       /**< Auth version number */
 
+/*
+    Session stores. See httpSetRouteSessionStore.
+ */
+#define HTTP_SESSION_SERVER     0x0                 /**< Store session state in the server session cache */
+#define HTTP_SESSION_CLIENT     0x1                 /**< Store session state in a signed client cookie */
+#define HTTP_SESSION_ENCRYPT    0x2                 /**< Encrypt client session cookies */
+
+#define HTTP_SESSION_MAX_COOKIE 4000                /**< Default maximum size of a client session cookie */
+
 /**
     Session state object
+    @description Session variables are stored as a single record per session in the session cache. The record is 
+        loaded when the session is first accessed by a request and variables are read and updated in the Session.data
+        hash. If modified, the record is written back once when the request is finalized and again when the request
+        completes if modified after finalization.
+    \n\n
+    If the route uses the client store, the record is kept in a signed and optionally encrypted cookie and the 
+    server keeps no state for the session. The cookie is rewritten with the response headers when the session is 
+    modified or when half the session lifespan has elapsed. Sessions that exceed the route cookie size limit are moved
+    to the server session cache.
     @defgroup HttpSession HttpSession
     @see
  */
@@ -3875,15 +4444,21 @@ typedef struct HttpSession {
     char            *id;                        /**< Session ID key */
     MprCache        *cache;                     /**< Cache store reference */
     MprTime         lifespan;                   /**< Session inactivity timeout (msecs) */
+    MprHash         *data;                      /**< Session variables */
+    MprHash         *changes;                   /**< Variables modified by this request. Removed variables are null */
+    int64           version;                    /**< Cache version of the session record */
+    MprTime         expires;                    /**< Expiry time of a client session cookie */
+    int             store;                      /**< Session store (HTTP_SESSION_SERVER or HTTP_SESSION_CLIENT) */
 } HttpSession;
 
 /**
     Allocate a new session state object.
     @description
     @param conn Http connection object
-    @param id Unique session state ID
+    @param id Unique session state ID. If no session record exists for the ID, a new session with a new ID is 
+        allocated.
     @param lifhttpan Session lifhttpan in ticks
-    @return A session state object
+    @return A session state object. Returns null if the session limit is exceeded.
     @ingroup HttpSession
  */
 extern HttpSession *httpAllocSession(HttpConn *conn, cchar *id, MprTime lifhttpan);
@@ -3936,8 +4511,14 @@ extern MprHash *httpGetSessionObj(HttpConn *conn, cchar *key);
  */
 extern cchar *httpGetSessionVar(HttpConn *conn, cchar *name, cchar *defaultValue);
 
-//  MOB
-extern int httpRemoveSessionVar(HttpConn *conn, cchar *key);
+/**
+    Remove a session variable.
+    @param conn Http connection object
+    @param name Variable name to remove
+    @return Zero if successful. Otherwise MPR_ERR_CANT_FIND if the variable does not exist.
+    @ingroup HttpSession
+ */
+extern int httpRemoveSessionVar(HttpConn *conn, cchar *name);
 
 /**
     Set a session variable.
@@ -3959,6 +4540,17 @@ extern int httpSetSessionVar(HttpConn *conn, cchar *name, cchar *value);
  */
 extern char *httpGetSessionID(HttpConn *conn);
 
+/**
+    Write the session record.
+    @description Session variables modified by the request are written to the session cache. This is called 
+        automatically when the request is finalized and when it completes. If another request has updated the session
+        since it was loaded, the record is reloaded and the modifications from this request are applied again.
+    @param conn Http connection object
+    @return Zero if successful or if the session was not modified. Otherwise a negative MPR error code.
+    @ingroup HttpSession
+ */
+extern int httpWriteSession(HttpConn *conn);
+
 /**
     Set an object into the session state store.
     @description Store an object in the session state store by serializing all properties.
@@ -3973,12 +4565,20 @@ extern int httpSetSessionObj(HttpConn *conn, cchar *key, MprHash *value);
 /**
     Upload File
     @description Each uploaded file has an HttpUploadedFile entry. This is managed by the upload handler.
+        If the route enables HTTP_ROUTE_UPLOAD_STREAM, file data is not saved to a temp file. Instead the 
+        file data is passed to the handler in packets with the HTTP_PACKET_UPLOAD flag and Packet.upload set to the
+        file entry. The final packet for each file does not have the HTTP_PACKET_MORE flag and may be empty.
+        Files are added to the Rx.files collection as they begin and the size is updated as data is received.
+        The handler should read the packets from HttpConn.readq when notified with HTTP_NOTIFY_READABLE. 
+        Reading from the connection is paused while the readq is full. If the handler consumes packets outside
+        of the notifier, it should call httpEnableConnEvents to resume reading.
     @stability Evolving
     @defgroup HttpUploadFile HttpUploadFile
     @see httpAddUploadFile httpRemoveAllUploadedFiles httpRemoveUploadFile
  */
 typedef struct HttpUploadFile {
-    cchar           *filename;              /**< Local (temp) name of the file */
+    cchar           *name;                  /**< Form field name */
+    cchar           *filename;              /**< Local (temp) name of the file. Null if streamed */
     cchar           *clientFilename;        /**< Client side name of the file */
     cchar           *contentType;           /**< Content type */
     ssize           size;                   /**< Uploaded file size */
@@ -4054,7 +4654,7 @@ extern void httpRemoveUploadFile(HttpConn *conn, cchar *id);
         httpCreateCGIParams httpGetContentLength httpGetCookies httpGetParam httpGetParams httpGetHeader 
         httpGetHeaderHash httpGetHeaders httpGetIntParam httpGetLanguage httpGetQueryString httpGetStatus 
         httpGetStatusMessage httpMatchParam httpRead httpReadString httpSetParam httpSetIntParam httpSetUri 
-        httpTestParam httpTrimExtraPath 
+        httpScanHeaderEnd httpScanLine httpSetHeaderScanner httpTestParam httpTrimExtraPath 
  */
 typedef struct HttpRx {
     /* Ordered for debugging */
@@ -4065,6 +4665,7 @@ typedef struct HttpRx {
     char            *extraPath;             /**< Extra path information (CGI|PHP) */
     int             eof;                    /**< All read data has been received (eof) */
     MprOff          bytesRead;              /**< Length of content read by user */
+    MprOff          bytesCopied;            /**< Length of content copied between buffers before reaching the handler */
     MprOff          length;                 /**< Content length header value (ENV: CONTENT_LENGTH) */
     MprOff          remainingContent;       /**< Remaining content data to read (in next chunk if chunked) */
 
@@ -4072,6 +4673,7 @@ typedef struct HttpRx {
     HttpRoute       *route;                 /**< Route for request */
     HttpSession     *session;               /**< Session for request */
     int             sessionProbed;          /**< Session has been resolved */
+    int             authPending;            /**< Authentication deferred until the request leaves the event thread */
 
     MprList         *etags;                 /**< Document etag to uniquely identify the document version */
     HttpPacket      *headerPacket;          /**< HTTP headers */
@@ -4080,6 +4682,7 @@ typedef struct HttpRx {
     HttpUri         *parsedUri;             /**< Parsed request uri */
     MprHash         *requestData;           /**< General request data storage. Users must create hash table if required */
     MprTime         since;                  /**< If-Modified date */
+    char            *ifRange;               /**< If-Range validator. Entity tag or date. */
 
     int             chunkState;             /**< Chunk encoding state */
     int             flags;                  /**< Rx modifiers */
@@ -4088,6 +4691,7 @@ typedef struct HttpRx {
     int             needInputPipeline;      /**< Input pipeline required to process received data */
     int             traceLevel;             /**< General trace level for header level info */
     int             upload;                 /**< Request is using file upload */
+    ssize           headerScan;             /**< Length of received data scanned for the end of headers */
 
     bool            ifModified;             /**< If-Modified processing requested */
     bool            ifMatch;                /**< If-Match processing requested */
@@ -4135,13 +4739,14 @@ typedef struct HttpRx {
     char            *paramString;           /**< Cached param data as a string */
     HttpLang        *lang;                  /**< Selected language */
 
-#if WSS
+#if BIT_WEB_SOCKETS
     char            *upgrade;               /**< Protocol upgrade header */
-    char            *sockKey;
-    char            *sockProtocol;
-    char            *sockVersion;
-    char            *origin;
+    char            *sockKey;               /**< WebSockets handshake key */
+    char            *sockProtocol;          /**< Requested WebSockets sub-protocols */
+    char            *sockVersion;           /**< WebSockets protocol version */
+    char            *origin;                /**< Origin header */
 #endif
+    struct HttpWebSocket *webSocket;        /**< WebSockets connection state. Set if the connection is upgraded. */
     /*
         Routing info
      */
@@ -4429,6 +5034,43 @@ extern void httpTrimExtraPath(HttpConn *conn);
  */
 extern void httpPump(HttpConn *conn, HttpPacket *packet);
 
+/*
+    Header scanners for httpSetHeaderScanner
+ */
+#define HTTP_SCAN_SCALAR    0           /**< Scan a byte at a time */
+#define HTTP_SCAN_SSE2      1           /**< Scan 16 bytes at a time using SSE2 */
+#define HTTP_SCAN_AVX2      2           /**< Scan 32 bytes at a time using AVX2 */
+
+/**
+    Find the end of the headers
+    @param buf Received data
+    @param len Length of the data
+    @return The offset of the blank line "\r\n\r\n" that ends the headers. Returns -1 if not found.
+    @ingroup HttpRx
+ */
+extern ssize httpScanHeaderEnd(cchar *buf, ssize len);
+
+/**
+    Find the end of a header line
+    @description Valid header lines only contain visible characters, spaces and tabs. The line ends at the first
+        control character which should be the carriage return of the line ending.
+    @param buf Received data
+    @param len Length of the data
+    @return The offset of the first control character other than tab. Returns -1 if not found.
+    @ingroup HttpRx
+ */
+extern ssize httpScanLine(cchar *buf, ssize len);
+
+/**
+    Select the header scanner
+    @description The fastest scanner supported by the CPU is selected when the Http service is created. 
+    @param level Set to HTTP_SCAN_SCALAR, HTTP_SCAN_SSE2 or HTTP_SCAN_AVX2. Set to -1 for the fastest scanner.
+    @return The selected scanner. This is the requested scanner if supported by the CPU, otherwise the fastest 
+        supported scanner.
+    @ingroup HttpRx
+ */
+extern int httpSetHeaderScanner(int level);
+
 /* Internal */
 extern void httpCloseRx(struct HttpConn *conn);
 extern HttpRange *httpCreateRange(HttpConn *conn, MprOff start, MprOff end);
@@ -4899,6 +5541,7 @@ typedef struct HttpEndpoint {
     MprList         *hosts;                 /**< List of host objects */
     HttpLimits      *limits;                /**< Alias for first host, default route resource limits */
     MprHash         *clientLoad;            /**< Table of active client IPs and connection counts */
+    MprList         *handshakes;            /**< Connections waiting for the SSL handshake to complete */
     char            *ip;                    /**< Listen IP address. May be null if listening on all interfaces. */
     int             port;                   /**< Listen port */
     int             async;                  /**< Listening is in async mode (non-blocking) */
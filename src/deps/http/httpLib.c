@@ -884,7 +884,7 @@ int httpOpenCacheHandler(Http *http)
     /*
         Create the cache handler to serve cached content 
      */
-    if ((handler = httpCreateHandler(http, "cacheHandler", HTTP_STAGE_ALL, NULL)) == 0) {
+    if ((handler = httpCreateHandler(http, "cacheHandler", HTTP_STAGE_ALL | HTTP_STAGE_NONBLOCK, NULL)) == 0) {
         return MPR_ERR_CANT_CREATE;
     }
     http->cacheHandler = handler;
@@ -1020,7 +1020,12 @@ static void outgoingCacheFilterService(HttpQueue *q)
                 /*
                     Using X-SendCache. Replace the data with the cached response.
                  */
-                mprFlushBuf(packet->content);
+                if (packet->flags & HTTP_PACKET_SHARED) {
+                    packet->content = mprCreateBuf(tx->length, 0);
+                    packet->flags &= ~HTTP_PACKET_SHARED;
+                } else {
+                    mprFlushBuf(packet->content);
+                }
                 mprPutBlockToBuf(packet->content, cachedData, (ssize) tx->length);
 
             } else if (tx->cacheBuffer) {
@@ -1479,9 +1484,10 @@ static int matchChunk(HttpConn *conn, HttpRoute *route, int dir)
     if (dir & HTTP_STAGE_TX) {
         /* 
             If content length is defined, don't need chunking. Also disable chunking if explicitly turned off vi 
-            the X_APPWEB_CHUNK_SIZE header which may set the chunk size to zero.
+            the X_APPWEB_CHUNK_SIZE header which may set the chunk size to zero. HTTP/2 streams use DATA frames
+            and WebSockets use message frames.
          */
-        if (conn->tx->length >= 0 || conn->tx->chunkSize == 0) {
+        if (conn->tx->length >= 0 || conn->tx->chunkSize == 0 || conn->stream || conn->rx->webSocket) {
             return HTTP_ROUTE_REJECT;
         }
         return HTTP_ROUTE_OK;
@@ -2034,6 +2040,7 @@ HttpConn *httpCreateConn(Http *http, HttpEndpoint *endpoint, MprDispatcher *disp
     }
     conn->http = http;
     conn->canProceed = 1;
+    conn->slot = -1;
 
     conn->protocol = http->protocol;
     conn->port = -1;
@@ -2085,13 +2092,26 @@ void httpDestroyConn(HttpConn *conn)
             if (conn->rx) {
                 httpValidateLimits(conn->endpoint, HTTP_VALIDATE_CLOSE_REQUEST, conn);
             }
-            httpValidateLimits(conn->endpoint, HTTP_VALIDATE_CLOSE_CONN, conn);
+            if (!conn->stream) {
+                httpValidateLimits(conn->endpoint, HTTP_VALIDATE_CLOSE_CONN, conn);
+            }
+        }
+        if (conn->h2) {
+            httpDestroyHttp2(conn);
         }
         if (HTTP_STATE_PARSED <= conn->state && conn->state < HTTP_STATE_COMPLETE) {
             HTTP_NOTIFY(conn, HTTP_STATE_COMPLETE, 0);
         }
         HTTP_NOTIFY(conn, HTTP_EVENT_CLOSE, 0);
+        if (conn->sock) {
+            httpFlushDeferred(conn);
+        }
         conn->input = 0;
+        conn->deferred = 0;
+        conn->deferredPackets = 0;
+        conn->deferredVec = 0;
+        conn->deferredIndex = 0;
+        conn->deferredCount = 0;
         if (conn->tx) {
             httpDestroyPipeline(conn);
             conn->tx->conn = 0;
@@ -2127,6 +2147,11 @@ static void manageConn(HttpConn *conn, int flags)
         mprMark(conn->serviceq);
         mprMark(conn->currentq);
         mprMark(conn->input);
+        mprMark(conn->deferred);
+        mprMark(conn->deferredPackets);
+        mprMark(conn->deferredVec);
+        mprMark(conn->h2);
+        mprMark(conn->stream);
         mprMark(conn->readq);
         mprMark(conn->writeq);
         mprMark(conn->connectorq);
@@ -2166,7 +2191,11 @@ void httpCloseConn(HttpConn *conn)
 {
     mprAssert(conn);
 
-    if (conn->sock) {
+    if (conn->stream) {
+        /* HTTP/2 streams share the network connection socket */
+        conn->sock = 0;
+
+    } else if (conn->sock) {
         mprLog(6, "Closing connection");
         if (conn->waitHandler) {
             mprRemoveWaitHandler(conn->waitHandler);
@@ -2260,6 +2289,10 @@ void httpPrepServerConn(HttpConn *conn)
 
     conn->readq = 0;
     conn->writeq = 0;
+    if (conn->async && !conn->worker && !conn->endpoint->dispatcher) {
+        conn->dispatcher->flags |= MPR_DISPATCHER_INLINE;
+        conn->dispatcher->flags &= ~MPR_DISPATCHER_COROUTINE;
+    }
     commonPrep(conn);
 }
 
@@ -2416,11 +2449,142 @@ static void writeEvent(HttpConn *conn)
     LOG(6, "httpProcessWriteEvent, state %d", conn->state);
 
     conn->writeBlocked = 0;
+    if (!httpFlushDeferred(conn)) {
+        httpSocketBlocked(conn);
+        return;
+    }
     if (conn->tx) {
         httpResumeQueue(conn->connectorq);
         httpServiceQueues(conn);
         httpPump(conn, NULL);
+    } else if (conn->h2) {
+        httpResumeHttp2(conn);
+    }
+}
+
+
+/*
+    Return the count of deferred bytes awaiting write
+ */
+ssize httpGetDeferredLength(HttpConn *conn)
+{
+    return (conn->deferred ? mprGetBufLength(conn->deferred) : 0) + conn->deferredCount;
+}
+
+
+/*
+    Add the deferred output to an I/O vector. The vector must have room for HTTP_MAX_IOVEC + 1 entries.
+    Return the count of entries added.
+ */
+int httpGetDeferredVec(HttpConn *conn, MprIOVec *iovec)
+{
+    int     count;
+
+    count = 0;
+    if (conn->deferred && mprGetBufLength(conn->deferred) > 0) {
+        iovec[count].start = mprGetBufStart(conn->deferred);
+        iovec[count].len = mprGetBufLength(conn->deferred);
+        count++;
+    }
+    if (conn->deferredIndex > 0) {
+        memcpy(&iovec[count], conn->deferredVec, conn->deferredIndex * sizeof(MprIOVec));
+        count += conn->deferredIndex;
+    }
+    return count;
+}
+
+
+/*
+    Remove written bytes from the deferred output. Return the count of written bytes beyond the deferred output.
+ */
+ssize httpAdjustDeferred(HttpConn *conn, ssize written)
+{
+    MprBuf      *buf;
+    MprIOVec    *iovec;
+    ssize       len;
+    int         i;
+
+    if ((buf = conn->deferred) != 0 && (len = mprGetBufLength(buf)) > 0) {
+        len = min(len, written);
+        mprAdjustBufStart(buf, len);
+        if (mprGetBufLength(buf) == 0) {
+            mprFlushBuf(buf);
+        }
+        written -= len;
+    }
+    iovec = conn->deferredVec;
+    for (i = 0; i < conn->deferredIndex && written > 0; i++) {
+        len = min(iovec[i].len, written);
+        iovec[i].start += len;
+        iovec[i].len -= len;
+        conn->deferredCount -= len;
+        written -= len;
+        if (iovec[i].len > 0) {
+            break;
+        }
+    }
+    if (i > 0) {
+        /* Copy down the unwritten entries */
+        memmove(iovec, &iovec[i], (conn->deferredIndex - i) * sizeof(MprIOVec));
+        conn->deferredIndex -= i;
+    }
+    if (conn->deferredIndex == 0) {
+        conn->deferredCount = 0;
+        if (conn->deferredPackets) {
+            mprClearList(conn->deferredPackets);
+        }
+    }
+    return written;
+}
+
+
+/*
+    Discard all deferred output
+ */
+static void discardDeferred(HttpConn *conn)
+{
+    if (conn->deferred) {
+        mprFlushBuf(conn->deferred);
+    }
+    conn->deferredIndex = 0;
+    conn->deferredCount = 0;
+    if (conn->deferredPackets) {
+        mprClearList(conn->deferredPackets);
+    }
+}
+
+
+/*
+    Write response data deferred by the net connector while pipelined requests were pending. Return true if all 
+    deferred data has been written. 
+ */
+bool httpFlushDeferred(HttpConn *conn)
+{
+    MprIOVec    iovec[HTTP_MAX_IOVEC + 1];
+    ssize       len, written;
+    int         errCode, count;
+
+    if ((len = httpGetDeferredLength(conn)) == 0) {
+        return 1;
+    }
+    if (!conn->sock) {
+        discardDeferred(conn);
+        return 1;
+    }
+    count = httpGetDeferredVec(conn, iovec);
+    written = mprWriteSocketVector(conn->sock, iovec, count);
+    LOG(6, "Flush deferred output wrote %d of %d", written, len);
+    if (written < 0) {
+        errCode = mprGetOsError();
+        if (errCode == EAGAIN || errCode == EWOULDBLOCK) {
+            return 0;
+        }
+        discardDeferred(conn);
+        conn->keepAliveCount = -1;
+        return 1;
     }
+    httpAdjustDeferred(conn, written);
+    return httpGetDeferredLength(conn) == 0;
 }
 
 
@@ -2486,7 +2650,8 @@ void httpEnableConnEvents(HttpConn *conn)
 
     mprLog(7, "EnableConnEvents");
 
-    if (!conn->async || !conn->sock || mprIsSocketEof(conn->sock)) {
+    if (!conn->async || !conn->sock || conn->stream || mprIsSocketEof(conn->sock)) {
+        /* HTTP/2 stream I/O events are serviced via the network connection */
         return;
     }
     tx = conn->tx;
@@ -2509,15 +2674,20 @@ void httpEnableConnEvents(HttpConn *conn)
                 eventMask |= MPR_WRITABLE;
             }
             /*
-                Enable read events if the read queue is not full. 
+                Enable read events if the read queue is not full. Streamed uploads are also paused while the
+                handler has a full queue of upload data.
              */
             q = tx->queue[HTTP_QUEUE_RX]->nextQ;
-            if (q->count < q->max || rx->form) {
+            if ((q->count < q->max || rx->form) && 
+                    !(rx->upload && rx->streamInput && conn->readq && conn->readq->count >= conn->readq->max)) {
                 eventMask |= MPR_READABLE;
             }
         } else {
             eventMask |= MPR_READABLE;
         }
+        if (httpGetDeferredLength(conn) > 0) {
+            eventMask |= MPR_WRITABLE;
+        }
         if (eventMask) {
             if (conn->waitHandler == 0) {
                 conn->waitHandler = mprCreateWaitHandler(conn->sock->fd, eventMask, conn->dispatcher, conn->ioCallback, 
@@ -2557,10 +2727,13 @@ static HttpPacket *getPacket(HttpConn *conn, ssize *size)
     } else {
         content = packet->content;
         mprResetBufIfEmpty(content);
-        mprAddNullToBuf(content);
         if (mprGetBufSpace(content) < HTTP_BUFSIZE) {
+            if (conn->rx) {
+                conn->rx->bytesCopied += mprGetBufLength(content);
+            }
             mprGrowBuf(content, HTTP_BUFSIZE);
         }
+        mprAddNullToBuf(content);
     }
     *size = mprGetBufSpace(packet->content);
     mprAssert(*size > 0);
@@ -3179,7 +3352,11 @@ static char *calcDigest(HttpConn *conn, DigestData *dp)
 /********************************** Forwards **********************************/
 
 static int manageEndpoint(HttpEndpoint *endpoint, int flags);
+static HttpConn *acceptConn(HttpEndpoint *endpoint, MprSocket *sock, MprDispatcher *dispatcher);
+static void closeHandshakes(HttpEndpoint *endpoint);
 static int destroyEndpointConnections(HttpEndpoint *endpoint);
+static void handshakeComplete(HttpConn *conn, MprSocket *sock, MprDispatcher *dispatcher, int status);
+static void startConn(HttpConn *conn, bool handshaken);
 
 /************************************ Code ************************************/
 /*
@@ -3196,6 +3373,7 @@ HttpEndpoint *httpCreateEndpoint(cchar *ip, int port, MprDispatcher *dispatcher)
     http = MPR->httpService;
     endpoint->http = http;
     endpoint->clientLoad = mprCreateHash(HTTP_CLIENTS_HASH, MPR_HASH_STATIC_VALUES);
+    endpoint->handshakes = mprCreateList(0, 0);
     endpoint->async = 1;
     endpoint->http = MPR->httpService;
     endpoint->port = port;
@@ -3225,6 +3403,7 @@ static int manageEndpoint(HttpEndpoint *endpoint, int flags)
         mprMark(endpoint->hosts);
         mprMark(endpoint->limits);
         mprMark(endpoint->clientLoad);
+        mprMark(endpoint->handshakes);
         mprMark(endpoint->ip);
         mprMark(endpoint->context);
         mprMark(endpoint->sock);
@@ -3295,10 +3474,12 @@ static int destroyEndpointConnections(HttpEndpoint *endpoint)
     http = endpoint->http;
     lock(http);
 
-    for (next = 0; (conn = mprGetNextItem(http->connections, &next)) != 0; ) {
+    closeHandshakes(endpoint);
+    for (ITERATE_CONNS(http, conn, next)) {
         if (conn->endpoint == endpoint) {
             conn->endpoint = 0;
             httpDestroyConn(conn);
+            /* The last connection was moved into this slot */
             next--;
         }
     }
@@ -3307,6 +3488,25 @@ static int destroyEndpointConnections(HttpEndpoint *endpoint)
 }
 
 
+/*
+    Close connections waiting for the SSL handshake. The handshakes are cancelled and own the sockets.
+ */
+static void closeHandshakes(HttpEndpoint *endpoint)
+{
+    HttpConn    *conn;
+    Http        *http;
+
+    http = endpoint->http;
+    lock(http);
+    while ((conn = mprPopItem(endpoint->handshakes)) != 0) {
+        mprCancelHandshake(conn->sock);
+        conn->sock = 0;
+        httpDestroyConn(conn);
+    }
+    unlock(http);
+}
+
+
 static bool validateEndpoint(HttpEndpoint *endpoint)
 {
     HttpHost    *host;
@@ -3323,7 +3523,7 @@ int httpStartEndpoint(HttpEndpoint *endpoint)
 {
     HttpHost    *host;
     cchar       *proto, *ip;
-    int         next;
+    int         next, flags;
 
     if (!validateEndpoint(endpoint)) {
         return MPR_ERR_BAD_ARGS;
@@ -3342,8 +3542,15 @@ int httpStartEndpoint(HttpEndpoint *endpoint)
         return MPR_ERR_CANT_OPEN;
     }
     if (endpoint->async && !endpoint->sock->handler) {
-        mprAddSocketHandler(endpoint->sock, MPR_SOCKET_READABLE, endpoint->dispatcher, httpAcceptConn, endpoint, 
-            (endpoint->dispatcher) ? 0 : MPR_WAIT_NEW_DISPATCHER);
+        /* 
+            Accept on the event thread so the connection is serviced there from its first request. SSL connections are
+            accepted on a worker as the handshake may have to be done there.
+         */
+        flags = 0;
+        if (!endpoint->dispatcher) {
+            flags = MPR_WAIT_NEW_DISPATCHER | (endpoint->ssl ? 0 : MPR_WAIT_INLINE);
+        }
+        mprAddSocketHandler(endpoint->sock, MPR_SOCKET_READABLE, endpoint->dispatcher, httpAcceptConn, endpoint, flags);
     } else {
         mprSetSocketBlockingMode(endpoint->sock, 1);
     }
@@ -3467,7 +3674,7 @@ bool httpValidateLimits(HttpEndpoint *endpoint, int event, HttpConn *conn)
     if (event == HTTP_VALIDATE_CLOSE_CONN || event == HTTP_VALIDATE_CLOSE_REQUEST) {
         if ((level = httpShouldTrace(conn, dir, HTTP_TRACE_LIMITS, NULL)) >= 0) {
             LOG(4, "Validate request for %s. Active connections %d, active requests: %d/%d, active client IP %d/%d", 
-                action, mprGetListLength(http->connections), endpoint->requestCount, limits->requestMax, 
+                action, httpGetConnCount(http), endpoint->requestCount, limits->requestMax, 
                 endpoint->clientCount, limits->clientMax);
         }
     }
@@ -3478,15 +3685,12 @@ bool httpValidateLimits(HttpEndpoint *endpoint, int event, HttpConn *conn)
 
 /*  
     Accept a new client connection on a new socket. If multithreaded, this will come in on a worker thread 
-    dedicated to this connection. This is called from the listen wait handler.
+    dedicated to this connection. This is called from the listen wait handler. For async secure endpoints, the SSL
+    handshake is completed by the handshake threads and the connection is started when the handshake completes.
  */
 HttpConn *httpAcceptConn(HttpEndpoint *endpoint, MprEvent *event)
 {
-    HttpConn        *conn;
     MprSocket       *sock;
-    MprDispatcher   *dispatcher;
-    MprEvent        e;
-    int             level;
 
     mprAssert(endpoint);
     mprAssert(event);
@@ -3510,13 +3714,26 @@ HttpConn *httpAcceptConn(HttpEndpoint *endpoint, MprEvent *event)
         /* Re-enable events on the listen socket */
         mprEnableSocketEvents(endpoint->sock, MPR_READABLE);
     }
-    dispatcher = event->dispatcher;
-
     if (mprShouldDenyNewRequests()) {
         mprCloseSocket(sock, 0);
         return 0;
     }
-    if ((conn = httpCreateConn(endpoint->http, endpoint, dispatcher)) == 0) {
+    return acceptConn(endpoint, sock, event->dispatcher);
+}
+
+
+/*
+    Create a connection for an accepted socket and validate the connection limits. For async secure endpoints, the 
+    connection waits on the endpoint handshake list and is not started until the handshake completes.
+ */
+static HttpConn *acceptConn(HttpEndpoint *endpoint, MprSocket *sock, MprDispatcher *dispatcher)
+{
+    HttpConn        *conn;
+    Http            *http;
+    int             rc;
+
+    http = endpoint->http;
+    if ((conn = httpCreateConn(http, endpoint, dispatcher)) == 0) {
         mprCloseSocket(sock, 0);
         return 0;
     }
@@ -3533,6 +3750,71 @@ HttpConn *httpAcceptConn(HttpEndpoint *endpoint, MprEvent *event)
         httpDestroyConn(conn);
         return 0;
     }
+    if (endpoint->ssl && endpoint->async) {
+        lock(http);
+        if ((rc = mprHandshakeSocket(sock, dispatcher, (MprHandshakeProc) handshakeComplete, conn)) == 0) {
+            /* Not serviced by the http timer until the handshake completes */
+            httpRemoveConn(http, conn);
+            mprAddItem(endpoint->handshakes, conn);
+            unlock(http);
+            return 0;
+        }
+        unlock(http);
+        if (rc == MPR_ERR_TOO_MANY) {
+            mprLog(2, "Too many pending SSL handshakes. Closing connection from %s:%d", conn->ip, conn->port);
+            httpDestroyConn(conn);
+            return 0;
+        }
+        /* Handshake threads are not available. Complete the handshake on the first read. */
+    }
+    startConn(conn, 0);
+    return conn;
+}
+
+
+static void handshakeComplete(HttpConn *conn, MprSocket *sock, MprDispatcher *dispatcher, int status)
+{
+    Http        *http;
+
+    http = conn->http;
+    lock(http);
+    if (mprRemoveItem(conn->endpoint->handshakes, conn) < 0) {
+        /* Closed by closeHandshakes */
+        unlock(http);
+        return;
+    }
+    if (status < 0) {
+        unlock(http);
+        mprLog(4, "SSL handshake failed for connection from %s:%d %s", sock->ip, sock->port, 
+            sock->errorMsg ? sock->errorMsg : "");
+        httpDestroyConn(conn);
+        return;
+    }
+    httpAddConn(http, conn);
+    unlock(http);
+    startConn(conn, 1);
+}
+
+
+/*
+    Start servicing a connection. If handshaken, the SSL handshake has been completed off the event thread.
+ */
+static void startConn(HttpConn *conn, bool handshaken)
+{
+    HttpEndpoint    *endpoint;
+    MprSocket       *sock;
+    MprEvent        e;
+    int             level;
+
+    endpoint = conn->endpoint;
+    sock = conn->sock;
+    if (conn->async && !endpoint->dispatcher && (!endpoint->ssl || handshaken)) {
+        /* 
+            Service on the event thread until a blocking handler is selected. An SSL handshake that has not yet been 
+            done is too costly to run on the event thread.
+         */
+        conn->dispatcher->flags |= MPR_DISPATCHER_INLINE;
+    }
     mprAssert(conn->state == HTTP_STATE_BEGIN);
     httpSetState(conn, HTTP_STATE_CONNECTED);
 
@@ -3543,7 +3825,6 @@ HttpConn *httpAcceptConn(HttpEndpoint *endpoint, MprEvent *event)
     e.mask = MPR_READABLE;
     e.timestamp = conn->http->now;
     (conn->ioCallback)(conn, &e);
-    return conn;
 }
 
 
@@ -3639,6 +3920,10 @@ int httpSecureEndpoint(HttpEndpoint *endpoint, struct MprSsl *ssl)
 {
 #if BIT_PACK_SSL
     endpoint->ssl = ssl;
+    if (ssl && !ssl->alpn && (!endpoint->limits || endpoint->limits->streamMax > 0)) {
+        /* Advertise HTTP/2. Clients selecting "h2" then send the connection preface. */
+        mprSetSslAlpn(ssl, "h2,http/1.1");
+    }
     return 0;
 #else
     return MPR_ERR_BAD_STATE;
@@ -3786,7 +4071,7 @@ static void formatErrorv(HttpConn *conn, int status, cchar *fmt, va_list args);
 
 void httpDisconnect(HttpConn *conn)
 {
-    if (conn->sock) {
+    if (conn->sock && !conn->stream) {
         mprDisconnectSocket(conn->sock);
     }
     conn->connError = 1;
@@ -3795,6 +4080,9 @@ void httpDisconnect(HttpConn *conn)
     if (conn->rx) {
         conn->rx->eof = 1;
     }
+    if (conn->stream) {
+        httpScheduleStream(conn);
+    }
 }
 
 
@@ -4308,1882 +4596,2527 @@ HttpRoute *httpGetDefaultRoute(HttpHost *host)
 
 /************************************************************************/
 /*
-    Start of file "src/httpService.c"
+    Start of file "src/hpack.c"
  */
 /************************************************************************/
 
 /*
-    httpService.c -- Http service. Includes timer for expired requests.
-    Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
+    hpack.c -- HPACK header compression for HTTP/2 (RFC 7541)
+
+    Header blocks received from clients are fully decoded including Huffman coded strings and dynamic table updates.
+    Response headers are encoded as literals that are not indexed and not Huffman coded. This keeps the encoder
+    stateless so responses on different streams can be encoded in any order.
+
+    Copyright (c) All Rights Reserved. See details at the end of the file.
  */
 
 /********************************* Includes ***********************************/
 
 
 
-/********************************** Locals ************************************/
-/**
-    Standard HTTP error code table
- */
-typedef struct HttpStatusCode {
-    int     code;                           /**< Http error code */
-    char    *codeString;                    /**< Code as a string (for hashing) */
-    char    *msg;                           /**< Error message */
-} HttpStatusCode;
+/*********************************** Locals ***********************************/
 
+#define HPACK_STATIC_SIZE   61
+#define HPACK_ENTRY_SIZE    32              /* Overhead per dynamic table entry */
+#define HPACK_EOS           256
+
+typedef struct HpackEntry {
+    cchar   *name;
+    cchar   *value;
+} HpackEntry;
+
+static HpackEntry staticTable[HPACK_STATIC_SIZE] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
 
-HttpStatusCode HttpStatusCodes[] = {
-    { 100, "100", "Continue" },
-    { 200, "200", "OK" },
-    { 201, "201", "Created" },
-    { 202, "202", "Accepted" },
-    { 204, "204", "No Content" },
-    { 205, "205", "Reset Content" },
-    { 206, "206", "Partial Content" },
-    { 301, "301", "Moved Permanently" },
-    { 302, "302", "Moved Temporarily" },
-    { 304, "304", "Not Modified" },
-    { 305, "305", "Use Proxy" },
-    { 307, "307", "Temporary Redirect" },
-    { 400, "400", "Bad Request" },
-    { 401, "401", "Unauthorized" },
-    { 402, "402", "Payment Required" },
-    { 403, "403", "Forbidden" },
-    { 404, "404", "Not Found" },
-    { 405, "405", "Method Not Allowed" },
-    { 406, "406", "Not Acceptable" },
-    { 408, "408", "Request Timeout" },
-    { 409, "409", "Conflict" },
-    { 410, "410", "Length Required" },
-    { 411, "411", "Length Required" },
-    { 412, "412", "Precondition Failed" },
-    { 413, "413", "Request Entity Too Large" },
-    { 414, "414", "Request-URI Too Large" },
-    { 415, "415", "Unsupported Media Type" },
-    { 416, "416", "Requested Range Not Satisfiable" },
-    { 417, "417", "Expectation Failed" },
-    { 500, "500", "Internal Server Error" },
-    { 501, "501", "Not Implemented" },
-    { 502, "502", "Bad Gateway" },
-    { 503, "503", "Service Unavailable" },
-    { 504, "504", "Gateway Timeout" },
-    { 505, "505", "Http Version Not Supported" },
-    { 507, "507", "Insufficient Storage" },
+/*
+    Huffman codes indexed by symbol and the length of each code in bits
+ */
+static const uint huffCodes[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5,
+    0xfffffe6, 0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9,
+    0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee,
+    0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9,
+    0xffffffa, 0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa,
+    0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa, 0x3fb,
+    0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b,
+    0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb,
+    0x7ffc, 0x20, 0xffb, 0x3fc, 0x1ffa, 0x21,
+    0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e,
+    0x6f, 0x70, 0x71, 0x72, 0xfc, 0x73,
+    0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5,
+    0x25, 0x26, 0x27, 0x6, 0x74, 0x75,
+    0x28, 0x29, 0x2a, 0x7, 0x2b, 0x76,
+    0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd,
+    0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8,
+    0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda,
+    0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1,
+    0x7fffe2, 0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5,
+    0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd,
+    0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf,
+    0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2,
+    0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2,
+    0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2,
+    0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde,
+    0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3,
+    0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3,
+    0x7ffffe4, 0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6,
+    0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb,
+    0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8,
+    0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed,
+    0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
 
-    /*
-        Proprietary codes (used internally) when connection to client is severed
-     */
-    { 550, "550", "Comms Error" },
-    { 551, "551", "General Client Error" },
-    { 0,   0 }
+static cuchar huffLengths[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
 };
 
-/****************************** Forward Declarations **************************/
+/*
+    Huffman decoding tree. Interior nodes index child nodes and leaves store the negated symbol plus one.
+ */
+static short huffTree[512][2];
+static int huffTreeSize;
 
-static void httpTimer(Http *http, MprEvent *event);
-static bool isIdle();
-static void manageHttp(Http *http, int flags);
-static void terminateHttp(int how, int status);
-static void updateCurrentDate(Http *http);
+/***************************** Forward Declarations ***************************/
+
+static int addEntry(HttpHpack *hp, cchar *name, cchar *value);
+static void buildHuffTree();
+static int decodeInt(cuchar **pp, cuchar *end, int bits, ssize *value);
+static char *decodeString(cuchar **pp, cuchar *end);
+static void evict(HttpHpack *hp, ssize limit);
+static MprKeyValue *getEntry(HttpHpack *hp, ssize index);
+static void manageHpack(HttpHpack *hp, int flags);
+static void putInt(MprBuf *buf, int prefix, int bits, ssize value);
+static void setMax(HttpHpack *hp, ssize max);
 
 /*********************************** Code *************************************/
 
-Http *httpCreate()
+HttpHpack *httpCreateHpack(ssize max)
 {
-    Http            *http;
-    HttpStatusCode  *code;
+    HttpHpack   *hp;
 
-    mprGlobalLock();
-    if (MPR->httpService) {
-        mprGlobalUnlock();
-        return MPR->httpService;
-    }
-    if ((http = mprAllocObj(Http, manageHttp)) == 0) {
-        mprGlobalUnlock();
+    if ((hp = mprAllocObj(HttpHpack, manageHpack)) == 0) {
         return 0;
     }
-    MPR->httpService = http;
-    http->software = sclone(HTTP_NAME);
-    http->protocol = sclone("HTTP/1.1");
-    http->mutex = mprCreateLock(http);
-    http->stages = mprCreateHash(-1, 0);
-    http->routeTargets = mprCreateHash(-1, MPR_HASH_STATIC_VALUES);
-    http->routeConditions = mprCreateHash(-1, MPR_HASH_STATIC_VALUES);
-    http->routeUpdates = mprCreateHash(-1, MPR_HASH_STATIC_VALUES);
-    http->hosts = mprCreateList(-1, MPR_LIST_STATIC_VALUES);
-    http->endpoints = mprCreateList(-1, MPR_LIST_STATIC_VALUES);
-    http->connections = mprCreateList(-1, MPR_LIST_STATIC_VALUES);
-    http->authTypes = mprCreateHash(-1, MPR_HASH_CASELESS | MPR_HASH_UNIQUE);
-    http->authStores = mprCreateHash(-1, MPR_HASH_CASELESS | MPR_HASH_UNIQUE);
-    http->defaultClientHost = sclone("127.0.0.1");
-    http->defaultClientPort = 80;
-    http->booted = mprGetTime();
-    http->sessionCache = mprCreateCache(MPR_CACHE_SHARED);
+    hp->entries = mprCreateList(0, 0);
+    hp->max = max;
+    mprAssert(huffTreeSize > 0);
+    return hp;
+}
 
-    updateCurrentDate(http);
-    http->statusCodes = mprCreateHash(41, MPR_HASH_STATIC_VALUES | MPR_HASH_STATIC_KEYS);
-    for (code = HttpStatusCodes; code->code; code++) {
-        mprAddKey(http->statusCodes, code->codeString, code);
+
+/*
+    Build the shared decoding tables. Called once when Http is created before any connections are accepted.
+ */
+void httpInitHpack()
+{
+    if (huffTreeSize == 0) {
+        buildHuffTree();
     }
-    httpCreateSecret(http);
-    httpInitAuth(http);
-    httpOpenNetConnector(http);
-    httpOpenSendConnector(http);
-    httpOpenRangeFilter(http);
-    httpOpenChunkFilter(http);
-    httpOpenUploadFilter(http);
-    httpOpenCacheHandler(http);
-    httpOpenPassHandler(http);
-    httpOpenProcHandler(http);
+}
 
-    http->clientLimits = httpCreateLimits(0);
-    http->serverLimits = httpCreateLimits(1);
-    http->clientRoute = httpCreateConfiguredRoute(0, 0);
 
-    mprSetIdleCallback(isIdle);
-    mprAddTerminator(terminateHttp);
-    httpDefineRouteBuiltins();
-    mprGlobalUnlock();
-    return http;
+static void manageHpack(HttpHpack *hp, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(hp->entries);
+    }
 }
 
 
-static void manageHttp(Http *http, int flags)
-{
-    HttpConn    *conn;
-    int         next;
+/*
+    Decode a header block into a list of name/value pairs. The decoded list size is measured as for the dynamic table.
+ */
+MprList *httpDecodeHpack(HttpHpack *hp, cuchar *data, ssize len, ssize max)
+{
+    MprKeyValue     *entry;
+    MprList         *headers;
+    cuchar          *end;
+    char            *name, *value;
+    ssize           index, size;
+    int             c, indexing;
+
+    headers = mprCreateList(0, 0);
+    end = &data[len];
+    size = 0;
+
+    while (data < end) {
+        c = *data;
+        if (c & 0x80) {
+            /* Indexed header field */
+            if (decodeInt(&data, end, 7, &index) < 0 || (entry = getEntry(hp, index)) == 0) {
+                return 0;
+            }
+            size += slen(entry->key) + slen(entry->value) + 32;
+            if (size > max) {
+                return 0;
+            }
+            mprAddItem(headers, entry);
 
-    if (flags & MPR_MANAGE_MARK) {
-        mprMark(http->endpoints);
-        mprMark(http->hosts);
-        mprMark(http->connections);
-        mprMark(http->stages);
-        mprMark(http->statusCodes);
-        mprMark(http->routeTargets);
-        mprMark(http->routeConditions);
-        mprMark(http->routeUpdates);
-        mprMark(http->sessionCache);
-        /* Don't mark convenience stage references as they will be in http->stages */
-        
-        mprMark(http->clientLimits);
-        mprMark(http->serverLimits);
-        mprMark(http->clientRoute);
-        mprMark(http->timer);
-        mprMark(http->timestamp);
-        mprMark(http->mutex);
-        mprMark(http->software);
-        mprMark(http->forkData);
-        mprMark(http->context);
-        mprMark(http->currentDate);
-#if UNUSED
-        mprMark(http->expiresDate);
-#endif
-        mprMark(http->secret);
-        mprMark(http->defaultClientHost);
-        mprMark(http->protocol);
-        mprMark(http->proxyHost);
-        mprMark(http->authTypes);
-        mprMark(http->authStores);
+        } else if ((c & 0xE0) == 0x20) {
+            /* Dynamic table size update */
+            if (decodeInt(&data, end, 5, &index) < 0 || index > HTTP2_HEADER_TABLE_SIZE) {
+                return 0;
+            }
+            setMax(hp, index);
 
-        /*
-            Endpoints keep connections alive until a timeout. Keep marking even if no other references.
-         */
-        lock(http);
-        for (next = 0; (conn = mprGetNextItem(http->connections, &next)) != 0; ) {
-            if (conn->endpoint) {
-                mprMark(conn);
+        } else {
+            /*
+                Literal header field with incremental indexing (01), without indexing (0000) or never indexed (0001)
+             */
+            indexing = (c & 0x40) ? 1 : 0;
+            if (decodeInt(&data, end, indexing ? 6 : 4, &index) < 0) {
+                return 0;
+            }
+            if (index) {
+                if ((entry = getEntry(hp, index)) == 0) {
+                    return 0;
+                }
+                name = entry->key;
+            } else if ((name = decodeString(&data, end)) == 0) {
+                return 0;
             }
+            if ((value = decodeString(&data, end)) == 0) {
+                return 0;
+            }
+            size += slen(name) + slen(value) + 32;
+            if (size > max) {
+                return 0;
+            }
+            if (indexing) {
+                addEntry(hp, name, value);
+            }
+            mprAddItem(headers, mprCreateKeyPair(name, value));
         }
-        unlock(http);
     }
+    return headers;
 }
 
 
-void httpDestroy(Http *http)
+/*
+    Encode a literal header field without indexing. Use a static table name index where possible.
+ */
+void httpEncodeHpack(MprBuf *buf, cchar *name, cchar *value)
 {
-    if (http->timer) {
-        mprRemoveEvent(http->timer);
-        http->timer = 0;
+    ssize   len;
+    int     i;
+
+    for (i = 0; i < HPACK_STATIC_SIZE; i++) {
+        if (strcmp(staticTable[i].name, name) == 0) {
+            break;
+        }
     }
-    if (http->timestamp) {
-        mprRemoveEvent(http->timestamp);
-        http->timestamp = 0;
+    if (i < HPACK_STATIC_SIZE) {
+        putInt(buf, 0x0, 4, i + 1);
+    } else {
+        mprPutCharToBuf(buf, 0);
+        len = slen(name);
+        putInt(buf, 0x0, 7, len);
+        mprPutBlockToBuf(buf, name, len);
     }
-    MPR->httpService = NULL;
-}
-
-
-void httpAddEndpoint(Http *http, HttpEndpoint *endpoint)
-{
-    mprAddItem(http->endpoints, endpoint);
+    len = slen(value);
+    putInt(buf, 0x0, 7, len);
+    mprPutBlockToBuf(buf, value, len);
 }
 
 
-void httpRemoveEndpoint(Http *http, HttpEndpoint *endpoint)
+/*
+    Get a static or dynamic table entry. Indexes are origin one.
+ */
+static MprKeyValue *getEntry(HttpHpack *hp, ssize index)
 {
-    mprRemoveItem(http->endpoints, endpoint);
+    if (index <= 0) {
+        return 0;
+    }
+    if (index <= HPACK_STATIC_SIZE) {
+        return mprCreateKeyPair(staticTable[index - 1].name, staticTable[index - 1].value);
+    }
+    return mprGetItem(hp->entries, (int) (index - HPACK_STATIC_SIZE - 1));
 }
 
 
-/*  
-    Lookup a host address. If ipAddr is null or port is -1, then those elements are wild.
+/*
+    Add an entry to the dynamic table. Entries are evicted from the end of the table to make room.
  */
-HttpEndpoint *httpLookupEndpoint(Http *http, cchar *ip, int port)
+static int addEntry(HttpHpack *hp, cchar *name, cchar *value)
 {
-    HttpEndpoint    *endpoint;
-    int             next;
+    ssize   size;
 
-    if (ip == 0) {
-        ip = "";
-    }
-    for (next = 0; (endpoint = mprGetNextItem(http->endpoints, &next)) != 0; ) {
-        if (endpoint->port <= 0 || port <= 0 || endpoint->port == port) {
-            mprAssert(endpoint->ip);
-            if (*endpoint->ip == '\0' || *ip == '\0' || scmp(endpoint->ip, ip) == 0) {
-                return endpoint;
-            }
-        }
+    size = slen(name) + slen(value) + HPACK_ENTRY_SIZE;
+    if (size > hp->max) {
+        mprClearList(hp->entries);
+        hp->size = 0;
+        return 0;
     }
+    evict(hp, hp->max - size);
+    mprInsertItemAtPos(hp->entries, 0, mprCreateKeyPair(name, value));
+    hp->size += size;
     return 0;
 }
 
 
-HttpEndpoint *httpGetFirstEndpoint(Http *http)
-{
-    return mprGetFirstItem(http->endpoints);
-}
-
-
 /*
-    WARNING: this should not be called by users as httpCreateHost will automatically call this.
+    Evict the oldest entries until the table size is at or below the limit
  */
-void httpAddHost(Http *http, HttpHost *host)
+static void evict(HttpHpack *hp, ssize limit)
 {
-    mprAddItem(http->hosts, host);
+    MprKeyValue     *entry;
+
+    while (hp->size > limit && (entry = mprGetLastItem(hp->entries)) != 0) {
+        hp->size -= slen(entry->key) + slen(entry->value) + HPACK_ENTRY_SIZE;
+        mprRemoveLastItem(hp->entries);
+    }
 }
 
 
-void httpRemoveHost(Http *http, HttpHost *host)
+static void setMax(HttpHpack *hp, ssize max)
 {
-    mprRemoveItem(http->hosts, host);
+    hp->max = max;
+    evict(hp, max);
 }
 
 
-HttpHost *httpLookupHost(Http *http, cchar *name)
+/*
+    Decode an integer with a prefix of the given number of bits
+ */
+static int decodeInt(cuchar **pp, cuchar *end, int bits, ssize *value)
 {
-    HttpHost    *host;
-    int         next;
+    cuchar  *p;
+    ssize   mask, result;
+    int     shift;
 
-    for (next = 0; (host = mprGetNextItem(http->hosts, &next)) != 0; ) {
-        if (smatch(name, host->name)) {
-            return host;
+    p = *pp;
+    if (p >= end) {
+        return MPR_ERR_BAD_FORMAT;
+    }
+    mask = (1 << bits) - 1;
+    result = *p++ & mask;
+    if (result == mask) {
+        for (shift = 0; ; shift += 7) {
+            if (p >= end || shift > 21) {
+                return MPR_ERR_BAD_FORMAT;
+            }
+            result += (ssize) (*p & 0x7F) << shift;
+            if (!(*p++ & 0x80)) {
+                break;
+            }
         }
     }
+    *pp = p;
+    *value = result;
     return 0;
 }
 
 
-void httpInitLimits(HttpLimits *limits, bool serverSide)
+/*
+    Decode a string literal. Returns null if the string is badly formed.
+ */
+static char *decodeString(cuchar **pp, cuchar *end)
 {
-    memset(limits, 0, sizeof(HttpLimits));
-    limits->cacheItemSize = HTTP_MAX_CACHE_ITEM;
-    limits->chunkSize = HTTP_MAX_CHUNK;
-    limits->clientMax = HTTP_MAX_CLIENTS;
-    limits->headerMax = HTTP_MAX_NUM_HEADERS;
-    limits->headerSize = HTTP_MAX_HEADERS;
-    limits->keepAliveMax = HTTP_MAX_KEEP_ALIVE;
-    limits->receiveFormSize = HTTP_MAX_RECEIVE_FORM;
-    limits->receiveBodySize = HTTP_MAX_RECEIVE_BODY;
-    limits->processMax = HTTP_MAX_REQUESTS;
-    limits->requestMax = HTTP_MAX_REQUESTS;
-    limits->sessionMax = HTTP_MAX_SESSIONS;
-    limits->stageBufferSize = HTTP_MAX_STAGE_BUFFER;
-    limits->transmissionBodySize = HTTP_MAX_TX_BODY;
-    limits->uploadSize = HTTP_MAX_UPLOAD;
-    limits->uriSize = MPR_MAX_URL;
-
-    limits->inactivityTimeout = HTTP_INACTIVITY_TIMEOUT;
-    limits->requestTimeout = MAXINT;
-    limits->sessionTimeout = HTTP_SESSION_TIMEOUT;
-
-#if FUTURE
-    mprSetMaxSocketClients(endpoint, atoi(value));
+    MprBuf  *buf;
+    cuchar  *p, *last;
+    ssize   len;
+    int     huff, node, bit, bits, ones;
 
-    if (scaselesscmp(key, "LimitClients") == 0) {
-        mprSetMaxSocketClients(endpoint, atoi(value));
-        return 1;
+    if (*pp >= end) {
+        return 0;
     }
-    if (scaselesscmp(key, "LimitMemoryMax") == 0) {
-        mprSetAllocLimits(endpoint, -1, atoi(value));
-        return 1;
+    huff = **pp & 0x80;
+    if (decodeInt(pp, end, 7, &len) < 0 || len > (end - *pp)) {
+        return 0;
     }
-    if (scaselesscmp(key, "LimitMemoryRedline") == 0) {
-        mprSetAllocLimits(endpoint, atoi(value), -1);
-        return 1;
+    p = *pp;
+    last = &p[len];
+    *pp = last;
+    if (!huff) {
+        return snclone((cchar*) p, len);
+    }
+    buf = mprCreateBuf(len * 2 + 1, -1);
+    node = 0;
+    bits = ones = 0;
+    for (; p < last; p++) {
+        for (bit = 7; bit >= 0; bit--) {
+            node = huffTree[node][(*p >> bit) & 0x1];
+            bits++;
+            ones = ((*p >> bit) & 0x1) ? ones + 1 : 0;
+            if (node < 0) {
+                if (-node - 1 == HPACK_EOS) {
+                    return 0;
+                }
+                mprPutCharToBuf(buf, -node - 1);
+                node = 0;
+                bits = ones = 0;
+            } else if (node == 0) {
+                return 0;
+            }
+        }
     }
-#endif
+    /* Padding must be a prefix of the EOS code (all ones) and shorter than a byte */
+    if (bits > 7 || ones != bits) {
+        return 0;
+    }
+    mprAddNullToBuf(buf);
+    return sclone(mprGetBufStart(buf));
 }
 
 
-HttpLimits *httpCreateLimits(int serverSide)
+/*
+    Encode an integer with a prefix of the given number of bits. The prefix holds the representation flags.
+ */
+static void putInt(MprBuf *buf, int prefix, int bits, ssize value)
 {
-    HttpLimits  *limits;
+    ssize   mask;
 
-    if ((limits = mprAllocStruct(HttpLimits)) != 0) {
-        httpInitLimits(limits, serverSide);
+    mask = (1 << bits) - 1;
+    if (value < mask) {
+        mprPutCharToBuf(buf, (int) (prefix | value));
+        return;
     }
-    return limits;
+    mprPutCharToBuf(buf, (int) (prefix | mask));
+    for (value -= mask; value >= 0x80; value >>= 7) {
+        mprPutCharToBuf(buf, (int) ((value & 0x7F) | 0x80));
+    }
+    mprPutCharToBuf(buf, (int) value);
 }
 
 
-void httpEaseLimits(HttpLimits *limits)
+/*
+    Build the decoding tree from the code table. Node zero is the root.
+ */
+static void buildHuffTree()
 {
-    limits->receiveFormSize = MAXOFF;
-    limits->receiveBodySize = MAXOFF;
-    limits->transmissionBodySize = MAXOFF;
-    limits->uploadSize = MAXOFF;
-}
-
+    uint    code;
+    int     sym, len, node, bit, next;
 
-void httpAddStage(Http *http, HttpStage *stage)
-{
-    mprAddKey(http->stages, stage->name, stage);
+    memset(huffTree, 0, sizeof(huffTree));
+    next = 1;
+    for (sym = 0; sym <= HPACK_EOS; sym++) {
+        if (sym == HPACK_EOS) {
+            code = 0x3fffffff;
+            len = 30;
+        } else {
+            code = huffCodes[sym];
+            len = huffLengths[sym];
+        }
+        for (node = 0; len > 1; len--) {
+            bit = (code >> (len - 1)) & 0x1;
+            if (huffTree[node][bit] == 0) {
+                huffTree[node][bit] = next++;
+            }
+            node = huffTree[node][bit];
+        }
+        huffTree[node][code & 0x1] = -(sym + 1);
+    }
+    huffTreeSize = next;
 }
 
 
-HttpStage *httpLookupStage(Http *http, cchar *name)
-{
-    return mprLookupKey(http->stages, name);
-}
+/*
+    @copy   default
 
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
 
-void *httpLookupStageData(Http *http, cchar *name)
-{
-    HttpStage   *stage;
-    if ((stage = mprLookupKey(http->stages, name)) != 0) {
-        return stage->stageData;
-    }
-    return 0;
-}
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a 
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
 
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
 
-cchar *httpLookupStatus(Http *http, int status)
-{
-    HttpStatusCode  *ep;
-    char            *key;
-    
-    key = itos(status);
-    ep = (HttpStatusCode*) mprLookupKey(http->statusCodes, key);
-    if (ep == 0) {
-        return "Custom error";
-    }
-    return ep->msg;
-}
+    @end
+ */
 
+/************************************************************************/
+/*
+    Start of file "src/http2.c"
+ */
+/************************************************************************/
 
-void httpSetForkCallback(Http *http, MprForkCallback callback, void *data)
-{
-    http->forkCallback = callback;
-    http->forkData = data;
-}
+/*
+    http2.c -- HTTP/2 connection framing layer (RFC 7540)
 
+    A HTTP/2 connection is started by the client connection preface or by a "Upgrade: h2c" request. Thereafter the
+    network connection only frames and unframes data. Each request stream is serviced by a separate stream connection
+    that shares the network socket and dispatcher. Request header blocks are decoded and presented to the stream
+    connection as a HTTP/1.1 request so the standard request parser, router and pipeline stages are used unchanged.
+    The http2Connector replaces the net connector for stream connections and writes response headers and data as
+    frames into the network connection output buffer.
 
-void httpSetListenCallback(Http *http, HttpListenCallback fn)
-{
-    http->listenCallback = fn;
-}
+    Stream output is limited by the client flow control windows and by the amount of buffered frame output. When 
+    either is exhausted, packets remain on the connector queue so upstream stages are suspended by the normal queue
+    flow control. Blocked streams are resumed in priority weight order.
 
+    Received data is limited by the stream and connection receive windows. Both windows are replenished only as the 
+    stream connection consumes its input, so a slow request handler holds back the client.
 
-/*  
-    The http timer does maintenance activities and will fire per second while there are active requests.
-    This is run in both servers and clients.
-    NOTE: Because we lock the http here, connections cannot be deleted while we are modifying the list.
+    Copyright (c) All Rights Reserved. See details at the end of the file.
  */
-static void httpTimer(Http *http, MprEvent *event)
-{
-    HttpConn    *conn;
-    HttpStage   *stage;
-    HttpRx      *rx;
-    HttpLimits  *limits;
-    MprModule   *module;
-    int         next, active;
 
-    mprAssert(event);
-    
-    updateCurrentDate(http);
-    if (mprGetDebugMode()) {
-        return;
-    }
-    /* 
-       Check for any inactive connections or expired requests (inactivityTimeout and requestTimeout)
-     */
-    lock(http);
-    mprLog(6, "httpTimer: %d active connections", mprGetListLength(http->connections));
-    for (active = 0, next = 0; (conn = mprGetNextItem(http->connections, &next)) != 0; active++) {
-        rx = conn->rx;
-        limits = conn->limits;
-        if (!conn->timeoutEvent && (
-            (conn->lastActivity + limits->inactivityTimeout) < http->now || 
-            (conn->started + limits->requestTimeout) < http->now)) {
-            if (rx) {
-                /*
-                    Don't call APIs on the conn directly (thread-race). Schedule a timer on the connection's dispatcher
-                 */
-                if (!conn->timeoutEvent) {
-                    conn->timeoutEvent = mprCreateEvent(conn->dispatcher, "connTimeout", 0, httpConnTimeout, conn, 0);
-                }
-            } else {
-                mprLog(6, "Idle connection timed out");
-                httpDisconnect(conn);
-                httpDiscardQueueData(conn->writeq, 1);
-                httpEnableConnEvents(conn);
-                conn->lastActivity = conn->started = http->now;
-            }
-        }
-    }
+/********************************* Includes ***********************************/
 
-    /*
-        Check for unloadable modules
-     */
-    if (mprGetListLength(http->connections) == 0) {
-        for (next = 0; (module = mprGetNextItem(MPR->moduleService->modules, &next)) != 0; ) {
-            if (module->timeout) {
-                if (module->lastActivity + module->timeout < http->now) {
-                    mprLog(2, "Unloading inactive module %s", module->name);
-                    if ((stage = httpLookupStage(http, module->name)) != 0) {
-                        if (mprUnloadModule(module) < 0)  {
-                            active++;
-                        } else {
-                            stage->flags |= HTTP_STAGE_UNLOADED;
-                        }
-                    } else {
-                        mprUnloadModule(module);
-                    }
-                } else {
-                    active++;
-                }
-            }
-        }
-    }
-    if (active == 0) {
-        mprRemoveEvent(event);
-        http->timer = 0;
-    }
-    //  OPT - run GC here
-    unlock(http);
-}
 
 
-static void timestamp()
-{
-    mprLog(0, "Time: %s", mprGetDate(NULL));
-}
+/*********************************** Locals ***********************************/
 
+#define HTTP2_DEFAULT_WEIGHT    16
 
-void httpSetTimestamp(MprTime period)
-{
-    Http    *http;
+#define GET24(p) ((((uint) (p)[0]) << 16) | (((uint) (p)[1]) << 8) | ((uint) (p)[2]))
+#define GET32(p) ((((uint) (p)[0]) << 24) | (((uint) (p)[1]) << 16) | (((uint) (p)[2]) << 8) | ((uint) (p)[3]))
 
-    http = MPR->httpService;
-    if (period < (10 * MPR_TICKS_PER_SEC)) {
-        period = (10 * MPR_TICKS_PER_SEC);
-    }
-    if (http->timestamp) {
-        mprRemoveEvent(http->timestamp);
-    }
-    if (period > 0) {
-        http->timestamp = mprCreateTimerEvent(NULL, "httpTimestamp", period, timestamp, NULL, 
-            MPR_EVENT_CONTINUOUS | MPR_EVENT_QUICK);
-    }
-}
+/***************************** Forward Declarations ***************************/
 
+static void ackWindow(Http2 *h2, Http2Stream *stream, ssize size);
+static int applySettings(Http2 *h2, cuchar *data, ssize size);
+static MprBuf *buildRequest(MprList *headers, int end, int *chunked);
+static void closeHttp2(HttpQueue *q);
+static Http2Stream *createStream(Http2 *h2, int id);
+static void endStream(Http2Stream *stream);
+static void feedStream(Http2Stream *stream, cchar *data, ssize size, int end);
+static void flushHttp2(Http2 *h2);
+static int getPayload(int flags, cuchar **data, ssize *size);
+static void goaway(Http2 *h2, int code, cchar *msg);
+static Http2Stream *lookupStream(Http2 *h2, int id);
+static void manageHttp2(Http2 *h2, int flags);
+static void manageStream(Http2Stream *stream, int flags);
+static void outgoingHttp2Service(HttpQueue *q);
+static void processContinuation(Http2 *h2, int flags, int id, cuchar *data, ssize size);
+static void processData(Http2 *h2, int flags, int id, cuchar *data, ssize size);
+static void processFrame(Http2 *h2, int type, int flags, int id, cuchar *data, ssize size);
+static void processGoaway(Http2 *h2, int lastStream);
+static void processHeaderBlock(Http2 *h2, int id, int flags, int weight, cuchar *data, ssize size);
+static void processHeaders(Http2 *h2, int flags, int id, cuchar *data, ssize size);
+static void processSettings(Http2 *h2, int flags, cuchar *data, ssize size);
+static void processWindow(Http2 *h2, int id, cuchar *data, ssize size);
+static void pumpStream(Http2Stream *stream, MprEvent *event);
+static void putFrame(Http2 *h2, int type, int flags, int id, cvoid *data, ssize size);
+static void putReset(Http2 *h2, int id, int code);
+static void putUint32(uchar *bp, uint value);
+static void putWindow(Http2 *h2, int id, ssize increment);
+static void schedulePump(Http2Stream *stream);
+static bool validHeader(cchar *name, cchar *value);
+static bool writeData(HttpQueue *q, MprBuf *buf, bool content);
+static void writeHeaders(HttpQueue *q, HttpPacket *packet);
 
-static void terminateHttp(int how, int status)
+/*********************************** Code *************************************/
+/*
+    Initialize the HTTP/2 stream connector
+ */
+int httpOpenHttp2Connector(Http *http)
 {
-    Http            *http;
-    HttpEndpoint    *endpoint;
-    int             next;
+    HttpStage     *stage;
 
-    /*
-        Stop listening for new requests
-     */
-    http = (Http*) mprGetMpr()->httpService;
-    if (http) {
-        for (ITERATE_ITEMS(http->endpoints, endpoint, next)) {
-            httpStopEndpoint(endpoint);
-        }
+    mprLog(5, "Open http2 connector");
+    if ((stage = httpCreateConnector(http, "http2Connector", HTTP_STAGE_ALL, NULL)) == 0) {
+        return MPR_ERR_CANT_CREATE;
     }
+    stage->close = closeHttp2;
+    stage->outgoingService = outgoingHttp2Service;
+    http->http2Connector = stage;
+    return 0;
 }
 
 
-static bool isIdle()
+Http2 *httpCreateHttp2(HttpConn *conn)
 {
-    HttpConn        *conn;
-    Http            *http;
-    MprTime         now;
-    int             next;
-    static MprTime  lastTrace = 0;
+    Http2   *h2;
+    ssize   window;
+    uchar   settings[6];
 
-    http = (Http*) mprGetMpr()->httpService;
-    now = http->now;
+    mprAssert(conn->endpoint);
 
-    lock(http);
-    for (next = 0; (conn = mprGetNextItem(http->connections, &next)) != 0; ) {
-        if (conn->state != HTTP_STATE_BEGIN) {
-            if (lastTrace < now) {
-                mprLog(1, "Waiting for request %s to complete", conn->rx->uri ? conn->rx->uri : conn->rx->pathInfo);
-                lastTrace = now;
-            }
-            unlock(http);
-            return 0;
-        }
-    }
-    unlock(http);
-    if (!mprServicesAreIdle()) {
-        if (lastTrace < now) {
-            mprLog(4, "Waiting for MPR services complete");
-            lastTrace = now;
-        }
+    if ((h2 = mprAllocObj(Http2, manageHttp2)) == 0) {
         return 0;
     }
-    return 1;
+    h2->conn = conn;
+    h2->streams = mprCreateList(0, 0);
+    h2->decoder = httpCreateHpack(HTTP2_HEADER_TABLE_SIZE);
+    h2->window = HTTP2_DEFAULT_WINDOW;
+    h2->recvWindow = HTTP2_DEFAULT_WINDOW;
+    h2->initialWindow = HTTP2_DEFAULT_WINDOW;
+    h2->frameSize = HTTP2_DEFAULT_FRAME_SIZE;
+    h2->preface = 1;
+    conn->h2 = h2;
+    if (conn->deferred == 0) {
+        conn->deferred = mprCreateBuf(HTTP_BUFSIZE, -1);
+    }
+    mprLog(4, "Start HTTP/2 on connection from %s:%d", conn->ip, conn->port);
+
+    settings[0] = 0;
+    settings[1] = HTTP2_MAX_STREAMS_SETTING;
+    putUint32(&settings[2], conn->limits->streamMax);
+    putFrame(h2, HTTP2_SETTINGS_FRAME, 0, 0, settings, sizeof(settings));
+
+    /* Allow each permitted stream a full stream window so one slow stream can't stall the others */
+    window = min((ssize) conn->limits->streamMax * HTTP2_DEFAULT_WINDOW, HTTP2_MAX_WINDOW);
+    if (window > h2->recvWindow) {
+        putWindow(h2, 0, window - h2->recvWindow);
+        h2->recvWindow = window;
+    }
+    return h2;
 }
 
 
-void httpAddConn(Http *http, HttpConn *conn)
+static void manageHttp2(Http2 *h2, int flags)
 {
-    conn->started = http->now;
-    mprAddItem(http->connections, conn);
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(h2->conn);
+        mprMark(h2->streams);
+        mprMark(h2->decoder);
+        mprMark(h2->headerBlock);
+    }
+}
 
-    lock(http);
-    conn->seqno = http->connCount++;
-    updateCurrentDate(http);
-    if (!http->timer) {
-        http->timer = mprCreateTimerEvent(NULL, "httpTimer", HTTP_TIMER_PERIOD, httpTimer, http, 
-            MPR_EVENT_CONTINUOUS | MPR_EVENT_QUICK);
+
+static void manageStream(Http2Stream *stream, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(stream->h2);
+        mprMark(stream->conn);
+        mprMark(stream->event);
     }
-    unlock(http);
 }
 
 
-void httpRemoveConn(Http *http, HttpConn *conn)
+/*
+    Abort all streams when the network connection is destroyed. The stream connections complete via their own events.
+ */
+void httpDestroyHttp2(HttpConn *conn)
 {
-    mprRemoveItem(http->connections, conn);
+    Http2Stream     *stream;
+    int             next;
+
+    for (next = 0; (stream = mprGetNextItem(conn->h2->streams, &next)) != 0; ) {
+        stream->reset = 1;
+        httpDisconnect(stream->conn);
+    }
 }
 
 
-/*  
-    Create a random secret for use in authentication. Create once for the entire http service. Created on demand.
-    Users can recall as required to update.
+/*
+    Process received frames. Incomplete frames are left in the packet until more data arrives.
  */
-int httpCreateSecret(Http *http)
+void httpPumpHttp2(HttpConn *conn, HttpPacket *packet)
 {
-    MprTime     now;
-    char        *hex = "0123456789abcdef";
-    char        bytes[HTTP_MAX_SECRET], ascii[HTTP_MAX_SECRET * 2 + 1], *ap, *cp, *bp;
-    int         i, pid;
+    Http2   *h2;
+    MprBuf  *buf;
+    cuchar  *start;
+    ssize   len, size;
 
-    if (mprGetRandomBytes(bytes, sizeof(bytes), 0) < 0) {
-        mprError("Can't get sufficient random data for secure SSL operation. If SSL is used, it may not be secure.");
-        now = http->now;
-        pid = (int) getpid();
-        cp = (char*) &now;
-        bp = bytes;
-        for (i = 0; i < sizeof(now) && bp < &bytes[HTTP_MAX_SECRET]; i++) {
-            *bp++= *cp++;
+    h2 = conn->h2;
+    if (packet == 0) {
+        return;
+    }
+    buf = packet->content;
+    if (h2->preface) {
+        len = min(mprGetBufLength(buf), HTTP2_PREFACE_SIZE);
+        if (memcmp(mprGetBufStart(buf), HTTP2_PREFACE, len) != 0) {
+            goaway(h2, HTTP2_PROTOCOL_ERROR, "Bad connection preface");
+            return;
         }
-        cp = (char*) &now;
-        for (i = 0; i < sizeof(pid) && bp < &bytes[HTTP_MAX_SECRET]; i++) {
-            *bp++ = *cp++;
+        if (len < HTTP2_PREFACE_SIZE) {
+            return;
         }
-        mprAssert(0);
-        return MPR_ERR_CANT_INITIALIZE;
+        mprAdjustBufStart(buf, HTTP2_PREFACE_SIZE);
+        h2->preface = 0;
     }
-
-    ap = ascii;
-    for (i = 0; i < (int) sizeof(bytes); i++) {
-        *ap++ = hex[((uchar) bytes[i]) >> 4];
-        *ap++ = hex[((uchar) bytes[i]) & 0xf];
+    while (!h2->goaway && (len = mprGetBufLength(buf)) >= HTTP2_FRAME_HEADER_SIZE) {
+        start = (cuchar*) mprGetBufStart(buf);
+        size = GET24(start);
+        if (size > HTTP2_DEFAULT_FRAME_SIZE) {
+            goaway(h2, HTTP2_FRAME_SIZE_ERROR, "Frame too big");
+            break;
+        }
+        if (len < (size + HTTP2_FRAME_HEADER_SIZE)) {
+            break;
+        }
+        mprAdjustBufStart(buf, size + HTTP2_FRAME_HEADER_SIZE);
+        processFrame(h2, start[3], start[4], GET32(&start[5]) & 0x7FFFFFFF, &start[HTTP2_FRAME_HEADER_SIZE], size);
     }
-    *ap = '\0';
-    http->secret = sclone(ascii);
-    return 0;
+    flushHttp2(h2);
 }
 
 
-void httpEnableTraceMethod(HttpLimits *limits, bool on)
+static void processFrame(Http2 *h2, int type, int flags, int id, cuchar *data, ssize size)
 {
-    limits->enableTraceMethod = on;
-}
+    Http2Stream     *stream;
 
+    LOG(6, "http2: receive frame type %d, flags %x, stream %d, length %d", type, flags, id, size);
+    if (h2->headerStream && type != HTTP2_CONTINUE_FRAME) {
+        goaway(h2, HTTP2_PROTOCOL_ERROR, "Expected continuation frame");
+        return;
+    }
+    switch (type) {
+    case HTTP2_DATA_FRAME:
+        processData(h2, flags, id, data, size);
+        break;
 
-char *httpGetDateString(MprPath *sbuf)
-{
-    MprTime     when;
+    case HTTP2_HEADERS_FRAME:
+        processHeaders(h2, flags, id, data, size);
+        break;
 
-    if (sbuf == 0) {
-        when = ((Http*) MPR->httpService)->now;
-    } else {
-        when = (MprTime) sbuf->mtime * MPR_TICKS_PER_SEC;
-    }
-    return mprFormatUniversalTime(HTTP_DATE_FORMAT, when);
-}
+    case HTTP2_PRIORITY_FRAME:
+        if (id == 0 || size != 5) {
+            goaway(h2, HTTP2_PROTOCOL_ERROR, "Bad priority frame");
+        } else if ((stream = lookupStream(h2, id)) != 0) {
+            stream->weight = data[4] + 1;
+        }
+        break;
 
+    case HTTP2_RESET_FRAME:
+        if (id == 0 || size != 4) {
+            goaway(h2, HTTP2_PROTOCOL_ERROR, "Bad reset frame");
+        } else if ((stream = lookupStream(h2, id)) != 0) {
+            mprLog(4, "http2: stream %d reset by client, error %d", id, GET32(data));
+            stream->reset = 1;
+            stream->eof = 1;
+            schedulePump(stream);
+        }
+        break;
 
-void *httpGetContext(Http *http)
-{
-    return http->context;
-}
+    case HTTP2_SETTINGS_FRAME:
+        if (id != 0) {
+            goaway(h2, HTTP2_PROTOCOL_ERROR, "Bad settings frame");
+        } else {
+            processSettings(h2, flags, data, size);
+        }
+        break;
 
+    case HTTP2_PING_FRAME:
+        if (id != 0 || size != 8) {
+            goaway(h2, HTTP2_PROTOCOL_ERROR, "Bad ping frame");
+        } else if (!(flags & HTTP2_ACK_FLAG)) {
+            putFrame(h2, HTTP2_PING_FRAME, HTTP2_ACK_FLAG, 0, data, size);
+        }
+        break;
 
-void httpSetContext(Http *http, void *context)
-{
-    http->context = context;
-}
+    case HTTP2_GOAWAY_FRAME:
+        if (id != 0 || size < 8) {
+            goaway(h2, HTTP2_PROTOCOL_ERROR, "Bad goaway frame");
+        } else {
+            processGoaway(h2, GET32(data) & 0x7FFFFFFF);
+        }
+        break;
 
+    case HTTP2_WINDOW_FRAME:
+        processWindow(h2, id, data, size);
+        break;
 
-int httpGetDefaultClientPort(Http *http)
-{
-    return http->defaultClientPort;
-}
+    case HTTP2_CONTINUE_FRAME:
+        processContinuation(h2, flags, id, data, size);
+        break;
 
+    case HTTP2_PUSH_FRAME:
+        goaway(h2, HTTP2_PROTOCOL_ERROR, "Client cannot push");
+        break;
 
-cchar *httpGetDefaultClientHost(Http *http)
-{
-    return http->defaultClientHost;
+    default:
+        /* Unknown frame types are ignored */
+        break;
+    }
 }
 
 
-void httpSetDefaultClientPort(Http *http, int port)
+/*
+    The client is closing the connection. Refuse new streams, fail streams above the last stream ID and close the
+    connection when the remaining streams complete.
+ */
+static void processGoaway(Http2 *h2, int lastStream)
 {
-    http->defaultClientPort = port;
+    Http2Stream     *stream;
+    int             next;
+
+    mprLog(4, "http2: client closing connection, last stream %d", lastStream);
+    h2->closing = 1;
+    h2->conn->keepAliveCount = -1;
+    for (next = 0; (stream = mprGetNextItem(h2->streams, &next)) != 0; ) {
+        if (stream->id > lastStream && !stream->reset) {
+            stream->reset = 1;
+            stream->eof = 1;
+            schedulePump(stream);
+        }
+    }
 }
 
 
-void httpSetDefaultClientHost(Http *http, cchar *host)
+static void processSettings(Http2 *h2, int flags, cuchar *data, ssize size)
 {
-    http->defaultClientHost = sclone(host);
+    if (flags & HTTP2_ACK_FLAG) {
+        return;
+    }
+    if (size % 6) {
+        goaway(h2, HTTP2_FRAME_SIZE_ERROR, "Bad settings frame");
+        return;
+    }
+    if (applySettings(h2, data, size) < 0) {
+        return;
+    }
+    putFrame(h2, HTTP2_SETTINGS_FRAME, HTTP2_ACK_FLAG, 0, NULL, 0);
 }
 
 
-void httpSetSoftware(Http *http, cchar *software)
-{
-    http->software = sclone(software);
-}
+/*
+    Apply client settings. A change to the initial window size adjusts the window of all active streams.
+ */
+static int applySettings(Http2 *h2, cuchar *data, ssize size)
+{
+    Http2Stream     *stream;
+    ssize           delta;
+    uint            value;
+    int             next, id;
+
+    for (; size >= 6; data += 6, size -= 6) {
+        id = (data[0] << 8) | data[1];
+        value = GET32(&data[2]);
+        switch (id) {
+        case HTTP2_INITIAL_WINDOW_SETTING:
+            if (value > HTTP2_MAX_WINDOW) {
+                goaway(h2, HTTP2_FLOW_CONTROL_ERROR, "Bad initial window size");
+                return MPR_ERR_BAD_VALUE;
+            }
+            delta = (ssize) value - h2->initialWindow;
+            h2->initialWindow = value;
+            for (next = 0; (stream = mprGetNextItem(h2->streams, &next)) != 0; ) {
+                stream->window += delta;
+            }
+            if (delta > 0) {
+                httpResumeHttp2(h2->conn);
+            }
+            break;
 
+        case HTTP2_MAX_FRAME_SIZE_SETTING:
+            if (value < HTTP2_DEFAULT_FRAME_SIZE || value > HTTP2_MAX_FRAME_SIZE) {
+                goaway(h2, HTTP2_PROTOCOL_ERROR, "Bad maximum frame size");
+                return MPR_ERR_BAD_VALUE;
+            }
+            h2->frameSize = value;
+            break;
 
-void httpSetProxy(Http *http, cchar *host, int port)
-{
-    http->proxyHost = sclone(host);
-    http->proxyPort = port;
+        default:
+            /* The encoder does not use the dynamic table and the server does not push */
+            break;
+        }
+    }
+    return 0;
 }
 
 
-static void updateCurrentDate(Http *http)
+static void processWindow(Http2 *h2, int id, cuchar *data, ssize size)
 {
-    http->now = mprGetTime();
-    if (http->now > (http->currentTime + MPR_TICKS_PER_SEC - 1)) {
-        http->currentTime = http->now;
-        http->currentDate = httpGetDateString(NULL);
-#if UNUSED
-    static MprTime  recalcExpires = 0;
-        if (http->expiresDate == 0 || recalcExpires < (http->now / (60 * 1000))) {
-            http->expiresDate = mprFormatUniversalTime(HTTP_DATE_FORMAT, http->now + (86400 * 1000));
-            recalcExpires = http->now / (60 * 1000);
+    Http2Stream     *stream;
+    ssize           increment;
+
+    if (size != 4) {
+        goaway(h2, HTTP2_FRAME_SIZE_ERROR, "Bad window update frame");
+        return;
+    }
+    increment = GET32(data) & 0x7FFFFFFF;
+    if (id == 0) {
+        if (increment == 0 || (h2->window + increment) > HTTP2_MAX_WINDOW) {
+            goaway(h2, HTTP2_FLOW_CONTROL_ERROR, "Bad connection window update");
+            return;
+        }
+        h2->window += increment;
+        httpResumeHttp2(h2->conn);
+
+    } else if ((stream = lookupStream(h2, id)) != 0) {
+        if (increment == 0 || (stream->window + increment) > HTTP2_MAX_WINDOW) {
+            putReset(h2, id, HTTP2_FLOW_CONTROL_ERROR);
+            stream->reset = 1;
+            schedulePump(stream);
+            return;
+        }
+        stream->window += increment;
+        if (stream->blocked) {
+            schedulePump(stream);
         }
-#endif
     }
 }
 
 
-/*
-    @copy   default
+static void processHeaders(Http2 *h2, int flags, int id, cuchar *data, ssize size)
+{
+    int     weight;
 
-    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
+    if (id == 0 || !(id & 0x1)) {
+        goaway(h2, HTTP2_PROTOCOL_ERROR, "Bad stream identifier");
+        return;
+    }
+    if (getPayload(flags, &data, &size) < 0) {
+        goaway(h2, HTTP2_PROTOCOL_ERROR, "Bad padding");
+        return;
+    }
+    weight = HTTP2_DEFAULT_WEIGHT;
+    if (flags & HTTP2_PRIORITY_FLAG) {
+        if (size < 5) {
+            goaway(h2, HTTP2_FRAME_SIZE_ERROR, "Bad priority");
+            return;
+        }
+        weight = data[4] + 1;
+        data += 5;
+        size -= 5;
+    }
+    if (flags & HTTP2_END_HEADERS_FLAG) {
+        processHeaderBlock(h2, id, flags, weight, data, size);
+    } else {
+        /* Save the weight in the unused high bits of the flags */
+        h2->headerStream = id;
+        h2->headerFlags = flags | (weight << 8);
+        h2->headerBlock = mprCreateBuf(size + HTTP_BUFSIZE, -1);
+        mprPutBlockToBuf(h2->headerBlock, (cchar*) data, size);
+    }
+}
 
-    This software is distributed under commercial and open source licenses.
-    You may use the Embedthis Open Source license or you may acquire a 
-    commercial license from Embedthis Software. You agree to be fully bound
-    by the terms of either license. Consult the LICENSE.md distributed with
-    this software for full details and other copyrights.
 
-    Local variables:
-    tab-width: 4
-    c-basic-offset: 4
-    End:
-    vim: sw=4 ts=4 expandtab
+static void processContinuation(Http2 *h2, int flags, int id, cuchar *data, ssize size)
+{
+    MprBuf  *buf;
 
-    @end
- */
+    if ((buf = h2->headerBlock) == 0 || id != h2->headerStream) {
+        goaway(h2, HTTP2_PROTOCOL_ERROR, "Unexpected continuation frame");
+        return;
+    }
+    mprPutBlockToBuf(buf, (cchar*) data, size);
+    if (mprGetBufLength(buf) > h2->conn->limits->headerSize) {
+        goaway(h2, HTTP2_PROTOCOL_ERROR, "Header block too big");
+        return;
+    }
+    if (flags & HTTP2_END_HEADERS_FLAG) {
+        h2->headerStream = 0;
+        h2->headerBlock = 0;
+        processHeaderBlock(h2, id, h2->headerFlags & 0xFF, h2->headerFlags >> 8, (cuchar*) mprGetBufStart(buf), 
+            mprGetBufLength(buf));
+    }
+}
 
-/************************************************************************/
-/*
-    Start of file "src/log.c"
- */
-/************************************************************************/
 
 /*
-    log.c -- Http request access logging
-
-    Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
+    Decode a complete header block and start a new stream. The header block must always be decoded to keep the 
+    decompression state synchronized even if the stream is refused.
  */
-
-/********************************* Includes ***********************************/
-
-
-
-/************************************ Code ************************************/
-
-int httpSetRouteLog(HttpRoute *route, cchar *path, ssize size, int backup, cchar *format, int flags)
+static void processHeaderBlock(Http2 *h2, int id, int flags, int weight, cuchar *data, ssize size)
 {
-    char    *src, *dest;
+    Http2Stream     *stream;
+    MprList         *headers;
+    MprBuf          *request;
+    int             end, chunked;
 
-    mprAssert(route);
-    mprAssert(path && *path);
-    mprAssert(format);
-    
-    if (format == NULL || *format == '\0') {
-        format = HTTP_LOG_FORMAT;
+    if ((headers = httpDecodeHpack(h2->decoder, data, size, h2->conn->limits->headerSize)) == 0) {
+        goaway(h2, HTTP2_COMPRESSION_ERROR, "Can't decode header block");
+        return;
     }
-    route->logFlags = flags;
-    route->logSize = size;
-    route->logBackup = backup;
-    route->logPath = sclone(path);
-    route->logFormat = sclone(format);
-
-    for (src = dest = route->logFormat; *src; src++) {
-        if (*src == '\\' && src[1] != '\\') {
-            continue;
+    end = flags & HTTP2_END_STREAM_FLAG;
+    if ((stream = lookupStream(h2, id)) != 0) {
+        /* Trailers are not supported and are ignored */
+        if (end && !stream->eof) {
+            feedStream(stream, NULL, 0, 1);
         }
-        *dest++ = *src;
+        return;
     }
-    *dest = '\0';
-    if (route->logBackup > 0) {
-        httpBackupRouteLog(route);
+    if (id <= h2->lastStream) {
+        putReset(h2, id, HTTP2_STREAM_CLOSED_ERROR);
+        return;
     }
-    route->logFlags &= ~MPR_LOG_ANEW;
-    if (!httpOpenRouteLog(route)) {
-        return MPR_ERR_CANT_OPEN;
+    h2->lastStream = id;
+    if (h2->closing) {
+        putReset(h2, id, HTTP2_REFUSED_STREAM_ERROR);
+        return;
     }
-    return 0;
+    if (mprGetListLength(h2->streams) >= h2->conn->limits->streamMax) {
+        mprLog(2, "http2: too many streams, limit %d", h2->conn->limits->streamMax);
+        putReset(h2, id, HTTP2_REFUSED_STREAM_ERROR);
+        return;
+    }
+    chunked = 0;
+    if ((request = buildRequest(headers, end, &chunked)) == 0) {
+        mprLog(3, "http2: bad request headers for stream %d", id);
+        putReset(h2, id, HTTP2_PROTOCOL_ERROR);
+        return;
+    }
+    if ((stream = createStream(h2, id)) == 0) {
+        putReset(h2, id, HTTP2_INTERNAL_ERROR);
+        return;
+    }
+    stream->weight = weight;
+    stream->chunked = chunked;
+    feedStream(stream, mprGetBufStart(request), mprGetBufLength(request), end);
 }
 
 
-void httpBackupRouteLog(HttpRoute *route)
+/*
+    Build a HTTP/1.1 request header from the decoded header list. Connection specific headers are removed. A request
+    body without a content length is relayed using chunked encoding.
+ */
+static MprBuf *buildRequest(MprList *headers, int end, int *chunked)
 {
-    MprPath     info;
+    MprKeyValue     *kp;
+    MprBuf          *buf, *lines;
+    char            *method, *path, *authority, *cookies, *key;
+    int             next, hasLength, regular;
 
-    mprAssert(route->logBackup);
-    mprAssert(route->logSize > 100);
+    method = path = authority = cookies = 0;
+    hasLength = regular = 0;
+    lines = mprCreateBuf(HTTP_BUFSIZE, -1);
 
-    if (route->parent && route->parent->log == route->log) {
-        httpBackupRouteLog(route->parent);
-        return;
-    }
-    lock(route);
-    mprGetPathInfo(route->logPath, &info);
-    if (info.valid && ((route->logFlags & MPR_LOG_ANEW) || info.size > route->logSize || route->logSize <= 0)) {
-        if (route->log) {
-            mprCloseFile(route->log);
-            route->log = 0;
+    for (next = 0; (kp = mprGetNextItem(headers, &next)) != 0; ) {
+        key = kp->key;
+        if (!validHeader(key, kp->value)) {
+            return 0;
         }
-        mprBackupLog(route->logPath, route->logBackup);
-        route->logFlags &= ~MPR_LOG_ANEW;
+        if (*key == ':') {
+            if (regular) {
+                return 0;
+            }
+            if (smatch(key, ":method") && !method) {
+                method = kp->value;
+            } else if (smatch(key, ":path") && !path) {
+                path = kp->value;
+            } else if (smatch(key, ":authority") && !authority) {
+                authority = kp->value;
+            } else if (!smatch(key, ":scheme")) {
+                return 0;
+            }
+            continue;
+        }
+        regular = 1;
+        if (smatch(key, "connection") || smatch(key, "keep-alive") || smatch(key, "proxy-connection") || 
+                smatch(key, "transfer-encoding") || smatch(key, "upgrade") || smatch(key, "te") || 
+                smatch(key, "expect")) {
+            continue;
+        }
+        if (smatch(key, "host")) {
+            if (!authority) {
+                authority = kp->value;
+            }
+            continue;
+        }
+        if (smatch(key, "cookie")) {
+            /* HTTP/2 may split cookies into separate fields */
+            cookies = cookies ? sjoin(cookies, "; ", kp->value, NULL) : kp->value;
+            continue;
+        }
+        if (smatch(key, "content-length")) {
+            if (end) {
+                continue;
+            }
+            hasLength = 1;
+        }
+        mprPutFmtToBuf(lines, "%s: %s\r\n", key, kp->value);
     }
-    unlock(route);
+    if (!method || !path || *path == '\0' || strpbrk(method, " \t") || strpbrk(path, " \t")) {
+        return 0;
+    }
+    buf = mprCreateBuf(mprGetBufLength(lines) + HTTP_BUFSIZE, -1);
+    mprPutFmtToBuf(buf, "%s %s HTTP/1.1\r\n", method, path);
+    if (authority) {
+        mprPutFmtToBuf(buf, "Host: %s\r\n", authority);
+    }
+    if (cookies) {
+        mprPutFmtToBuf(buf, "Cookie: %s\r\n", cookies);
+    }
+    mprPutBlockToBuf(buf, mprGetBufStart(lines), mprGetBufLength(lines));
+    if (!end && !hasLength) {
+        mprPutStringToBuf(buf, "Transfer-Encoding: chunked\r\n");
+        *chunked = 1;
+    }
+    mprPutStringToBuf(buf, "\r\n");
+    return buf;
 }
 
 
-MprFile *httpOpenRouteLog(HttpRoute *route)
+/*
+    Header names and values must not contain characters that would change the meaning of the HTTP/1.1 request
+ */
+static bool validHeader(cchar *name, cchar *value)
 {
-    MprFile     *file;
-    int         mode;
+    cchar   *cp;
 
-    mprAssert(route->log == 0);
-    mode = O_CREAT | O_WRONLY | O_TEXT;
-    if ((file = mprOpenFile(route->logPath, mode, 0664)) == 0) {
-        mprError("Can't open log file %s", route->logPath);
+    if (*name == '\0') {
         return 0;
     }
-    route->log = file;
-    return file;
+    for (cp = (*name == ':') ? &name[1] : name; *cp; cp++) {
+        if (*cp <= ' ' || *cp == ':' || *cp == 0x7F || isupper((uchar) *cp)) {
+            return 0;
+        }
+    }
+    return strpbrk(value, "\r\n") == 0;
 }
 
 
-void httpWriteRouteLog(HttpRoute *route, cchar *buf, ssize len)
+static void processData(Http2 *h2, int flags, int id, cuchar *data, ssize size)
 {
-    lock(MPR);
-    if (route->logBackup > 0) {
-        //  OPT - don't check this on every write
-        httpBackupRouteLog(route);
-        if (!route->log && !httpOpenRouteLog(route)) {
-            unlock(MPR);
+    Http2Stream     *stream;
+    ssize           total;
+
+    if (id == 0) {
+        goaway(h2, HTTP2_PROTOCOL_ERROR, "Bad data frame");
+        return;
+    }
+    total = size;
+    if (getPayload(flags, &data, &size) < 0) {
+        goaway(h2, HTTP2_PROTOCOL_ERROR, "Bad padding");
+        return;
+    }
+    if (total > h2->recvWindow) {
+        goaway(h2, HTTP2_FLOW_CONTROL_ERROR, "Connection window exceeded");
+        return;
+    }
+    h2->recvWindow -= total;
+    if ((stream = lookupStream(h2, id)) == 0 || stream->eof) {
+        if (id > h2->lastStream) {
+            goaway(h2, HTTP2_PROTOCOL_ERROR, "Data for idle stream");
             return;
         }
+        /* Discarded data is acknowledged immediately */
+        ackWindow(h2, 0, total);
+        return;
     }
-    if (mprWriteFile(route->log, (char*) buf, len) != len) {
-        mprError("Can't write to access log %s", route->logPath);
-        mprCloseFile(route->log);
-        route->log = 0;
+    if (total > stream->recvWindow) {
+        putReset(h2, id, HTTP2_FLOW_CONTROL_ERROR);
+        stream->reset = 1;
+        stream->eof = 1;
+        schedulePump(stream);
+        ackWindow(h2, 0, total);
+        return;
     }
-    unlock(MPR);
+    /*
+        Windows are replenished as the stream consumes input. A client can't send more than the stream window.
+     */
+    stream->recvWindow -= total;
+    stream->unacked += total;
+    feedStream(stream, (cchar*) data, size, flags & HTTP2_END_STREAM_FLAG);
 }
 
 
-void httpLogRequest(HttpConn *conn)
+/*
+    Acknowledge consumed data. Replenishes the stream window and the connection window.
+ */
+static void ackWindow(Http2 *h2, Http2Stream *stream, ssize size)
 {
-    HttpRx      *rx;
-    HttpTx      *tx;
-    HttpRoute   *route;
-    MprBuf      *buf;
-    char        keyBuf[80], *timeText, *fmt, *cp, *qualifier, *value, c;
-    int         len;
-
-    if ((rx = conn->rx) == 0) {
-        return;
-    }
-    tx = conn->tx;
-    if ((route = rx->route) == 0 || route->log == 0) {
+    if (size <= 0) {
         return;
     }
-    fmt = route->logFormat;
-    if (fmt == 0) {
-        fmt = HTTP_LOG_FORMAT;
+    if (stream && !stream->eof) {
+        putWindow(h2, stream->id, size);
+        stream->recvWindow += size;
     }
-    len = MPR_MAX_URL + 256;
-    buf = mprCreateBuf(len, len);
+    putWindow(h2, 0, size);
+    h2->recvWindow += size;
+}
 
-    while ((c = *fmt++) != '\0') {
-        if (c != '%' || (c = *fmt++) == '%') {
-            mprPutCharToBuf(buf, c);
-            continue;
+
+/*
+    Strip padding from a frame payload
+ */
+static int getPayload(int flags, cuchar **data, ssize *size)
+{
+    int     pad;
+
+    if (flags & HTTP2_PADDED_FLAG) {
+        if (*size < 1) {
+            return MPR_ERR_BAD_FORMAT;
         }
-        switch (c) {
-        case 'a':                           /* Remote IP */
-            mprPutStringToBuf(buf, conn->ip);
-            break;
+        pad = **data;
+        (*data)++;
+        (*size)--;
+        if (pad > *size) {
+            return MPR_ERR_BAD_FORMAT;
+        }
+        *size -= pad;
+    }
+    return 0;
+}
 
-        case 'A':                           /* Local IP */
-            mprPutStringToBuf(buf, conn->sock->listenSock->ip);
-            break;
 
-        case 'b':
-            if (tx->bytesWritten == 0) {
-                mprPutCharToBuf(buf, '-');
-            } else {
-                mprPutIntToBuf(buf, tx->bytesWritten);
-            } 
-            break;
+static Http2Stream *createStream(Http2 *h2, int id)
+{
+    Http2Stream     *stream;
+    HttpConn        *conn, *parent;
 
-        case 'B':                           /* Bytes written (minus headers) */
-            mprPutIntToBuf(buf, (tx->bytesWritten - tx->headerSize));
-            break;
+    parent = h2->conn;
+    if ((stream = mprAllocObj(Http2Stream, manageStream)) == 0) {
+        return 0;
+    }
+    if ((conn = httpCreateConn(parent->http, parent->endpoint, parent->dispatcher)) == 0) {
+        return 0;
+    }
+    stream->h2 = h2;
+    stream->conn = conn;
+    stream->id = id;
+    stream->weight = HTTP2_DEFAULT_WEIGHT;
+    stream->window = h2->initialWindow;
+    stream->recvWindow = HTTP2_DEFAULT_WINDOW;
+
+    conn->stream = stream;
+    conn->notifier = parent->notifier;
+    conn->async = parent->async;
+    conn->sock = parent->sock;
+    conn->port = parent->port;
+    conn->ip = parent->ip;
+    conn->secure = parent->secure;
+    httpSetState(conn, HTTP_STATE_CONNECTED);
+    mprAddItem(h2->streams, stream);
+    LOG(5, "http2: create stream %d", id);
+    return stream;
+}
 
-        case 'h':                           /* Remote host */
-            mprPutStringToBuf(buf, conn->ip);
-            break;
 
-        case 'n':                           /* Local host */
-            mprPutStringToBuf(buf, rx->parsedUri->host);
-            break;
+static Http2Stream *lookupStream(Http2 *h2, int id)
+{
+    Http2Stream     *stream;
+    int             next;
 
-        case 'O':                           /* Bytes written (including headers) */
-            mprPutIntToBuf(buf, tx->bytesWritten);
-            break;
+    for (next = 0; (stream = mprGetNextItem(h2->streams, &next)) != 0; ) {
+        if (stream->id == id) {
+            return stream;
+        }
+    }
+    return 0;
+}
 
-        case 'r':                           /* First line of request */
-            mprPutFmtToBuf(buf, "%s %s %s", rx->method, rx->uri, conn->protocol);
-            break;
 
-        case 's':                           /* Response code */
-            mprPutIntToBuf(buf, tx->status);
-            break;
+/*
+    Append request data to the stream connection input and schedule the stream to parse it
+ */
+static void feedStream(Http2Stream *stream, cchar *data, ssize size, int end)
+{
+    HttpConn    *conn;
+    MprBuf      *buf;
 
-        case 't':                           /* Time */
-            mprPutCharToBuf(buf, '[');
-            timeText = mprFormatLocalTime(MPR_DEFAULT_DATE, mprGetTime());
-            mprPutStringToBuf(buf, timeText);
-            mprPutCharToBuf(buf, ']');
-            break;
+    conn = stream->conn;
+    if (conn->input == 0) {
+        conn->input = httpCreatePacket(max(size + 16, HTTP_BUFSIZE));
+    }
+    buf = conn->input->content;
+    mprResetBufIfEmpty(buf);
+    if (stream->chunked) {
+        if (size > 0) {
+            mprPutFmtToBuf(buf, "%x\r\n", size);
+            mprPutBlockToBuf(buf, data, size);
+            mprPutStringToBuf(buf, "\r\n");
+        }
+        if (end) {
+            mprPutStringToBuf(buf, "0\r\n\r\n");
+        }
+    } else if (size > 0) {
+        mprPutBlockToBuf(buf, data, size);
+    }
+    mprAddNullToBuf(buf);
+    if (end) {
+        stream->eof = 1;
+    }
+    schedulePump(stream);
+}
 
-        case 'u':                           /* Remote username */
-            mprPutStringToBuf(buf, conn->username ? conn->username : "-");
-            break;
 
-        case '{':                           /* Header line */
-            qualifier = fmt;
-            if ((cp = strchr(qualifier, '}')) != 0) {
-                fmt = &cp[1];
-                *cp = '\0';
-                c = *fmt++;
-                scopy(keyBuf, sizeof(keyBuf), "HTTP_");
-                scopy(&keyBuf[5], sizeof(keyBuf) - 5, qualifier);
-                switch (c) {
-                case 'i':
-                    value = (char*) mprLookupKey(rx->headers, supper(keyBuf));
-                    mprPutStringToBuf(buf, value ? value : "-");
-                    break;
-                default:
-                    mprPutStringToBuf(buf, qualifier);
-                }
-                *cp = '}';
+/*
+    Stream connections are serviced via events on the shared dispatcher. This ensures a stream handler never runs 
+    while received frames are being processed.
+ */
+static void schedulePump(Http2Stream *stream)
+{
+    if (!stream->event && stream->conn->http) {
+        stream->event = mprCreateEvent(stream->conn->dispatcher, "http2Stream", 0, pumpStream, stream, 0);
+    }
+}
 
-            } else {
-                mprPutCharToBuf(buf, c);
-            }
-            break;
 
-        case '>':
-            if (*fmt == 's') {
-                fmt++;
-                mprPutIntToBuf(buf, tx->status);
-            }
-            break;
+static void pumpStream(Http2Stream *stream, MprEvent *event)
+{
+    HttpConn    *conn;
+    Http2       *h2;
 
-        default:
-            mprPutCharToBuf(buf, c);
+    conn = stream->conn;
+    h2 = stream->h2;
+    stream->event = 0;
+    if (!conn->http) {
+        return;
+    }
+    if (stream->reset && !conn->connError) {
+        httpError(conn, HTTP_ABORT | HTTP_CODE_COMMS_ERROR, "Stream reset");
+    }
+    if (stream->blocked && conn->connectorq) {
+        stream->blocked = 0;
+        conn->writeBlocked = 0;
+        httpResumeQueue(conn->connectorq);
+        httpServiceQueues(conn);
+    }
+    httpPump(conn, conn->input);
+
+    if (conn->http && stream->unacked > 0 && (!conn->input || httpGetPacketLength(conn->input) == 0)) {
+        ackWindow(h2, stream, stream->unacked);
+        stream->unacked = 0;
+    }
+    flushHttp2(h2);
+}
+
+
+/*
+    Resume blocked streams in priority order
+ */
+void httpResumeHttp2(HttpConn *conn)
+{
+    Http2           *h2;
+    Http2Stream     *stream, *best;
+    int             next;
+
+    if ((h2 = conn->h2) == 0 || conn->deferred == 0) {
+        return;
+    }
+    while (mprGetBufLength(conn->deferred) < HTTP2_MAX_BUFFER) {
+        for (best = 0, next = 0; (stream = mprGetNextItem(h2->streams, &next)) != 0; ) {
+            if (stream->blocked && !stream->event && stream->window > 0 && (!best || stream->weight > best->weight)) {
+                best = stream;
+            }
+        }
+        if (!best || h2->window <= 0) {
             break;
         }
+        schedulePump(best);
     }
-    mprPutCharToBuf(buf, '\n');
-    mprAddNullToBuf(buf);
-    httpWriteRouteLog(route, mprGetBufStart(buf), mprGetBufLength(buf));
 }
 
 
-
 /*
-    @copy   default
+    Called when a stream connection completes its request
+ */
+void httpCloseStream(HttpConn *conn)
+{
+    Http2Stream     *stream;
+    Http2           *h2;
+    HttpConn        *parent;
 
-    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
+    stream = conn->stream;
+    h2 = stream->h2;
+    parent = h2->conn;
 
-    This software is distributed under commercial and open source licenses.
-    You may use the Embedthis Open Source license or you may acquire a 
-    commercial license from Embedthis Software. You agree to be fully bound
-    by the terms of either license. Consult the LICENSE.md distributed with
-    this software for full details and other copyrights.
+    if (!stream->reset) {
+        if (!stream->ended) {
+            putReset(h2, stream->id, HTTP2_CANCEL_ERROR);
+        } else if (!stream->eof) {
+            /* Response complete before all the request body was received */
+            putReset(h2, stream->id, HTTP2_NO_ERROR);
+        }
+    }
+    if (stream->event) {
+        mprRemoveEvent(stream->event);
+        stream->event = 0;
+    }
+    /* Return unconsumed data to the connection window */
+    ackWindow(h2, 0, stream->unacked);
+    stream->unacked = 0;
+    mprRemoveItem(h2->streams, stream);
+    LOG(5, "http2: close stream %d", stream->id);
+    conn->input = 0;
+    httpDestroyConn(conn);
 
-    Local variables:
-    tab-width: 4
-    c-basic-offset: 4
-    End:
-    vim: sw=4 ts=4 expandtab
+    if (mprGetListLength(h2->streams) == 0 && parent->async && !parent->worker && !parent->endpoint->dispatcher) {
+        /* Idle, so service on the event thread again */
+        parent->dispatcher->flags |= MPR_DISPATCHER_INLINE;
+        parent->dispatcher->flags &= ~MPR_DISPATCHER_COROUTINE;
+    }
+    flushHttp2(h2);
+}
 
-    @end
- */
 
-/************************************************************************/
 /*
-    Start of file "src/netConnector.c"
+    Schedule a stream connection to be pumped via an event. Used to complete disconnected streams and to resume 
+    streams whose handler must run off the event thread.
  */
-/************************************************************************/
-
-/*
-    netConnector.c -- General network connector. 
+void httpScheduleStream(HttpConn *conn)
+{
+    schedulePump(conn->stream);
+}
 
-    The Network connector handles output data (only) from upstream handlers and filters. It uses vectored writes to
-    aggregate output packets into fewer actual I/O requests to the O/S. 
 
-    Copyright (c) All Rights Reserved. See details at the end of the file.
+/*
+    Respond to a "Upgrade: h2c" request and continue servicing the request as stream 1. Requests with a body are 
+    serviced using HTTP/1.1.
  */
+bool httpUpgradeHttp2(HttpConn *conn, cchar *headers)
+{
+    HttpRx          *rx;
+    Http2           *h2;
+    Http2Stream     *stream;
+    cchar           *value;
+    char            *settings, *cp;
+    ssize           len;
 
-/********************************* Includes ***********************************/
-
+    rx = conn->rx;
+    if ((value = mprLookupKey(rx->headers, "upgrade")) == 0 || !scontains(value, "h2c") || conn->http10 || 
+            rx->length > 0 || (rx->flags & HTTP_CHUNKED) || conn->h2 || conn->limits->streamMax <= 0) {
+        return 0;
+    }
+    if ((value = mprLookupKey(rx->headers, "http2-settings")) == 0) {
+        return 0;
+    }
+    /* Settings are base64url encoded without padding */
+    settings = sclone(value);
+    for (cp = settings; *cp; cp++) {
+        if (*cp == '-') {
+            *cp = '+';
+        } else if (*cp == '_') {
+            *cp = '/';
+        }
+    }
+    len = 0;
+    settings = mprDecode64Block(settings, &len, 0);
 
+    httpValidateLimits(conn->endpoint, HTTP_VALIDATE_CLOSE_REQUEST, conn);
+    rx->conn = 0;
+    conn->tx->conn = 0;
+    conn->rx = 0;
+    conn->tx = 0;
+    httpPrepServerConn(conn);
 
-/**************************** Forward Declarations ****************************/
+    if (conn->deferred == 0) {
+        conn->deferred = mprCreateBuf(HTTP_BUFSIZE, -1);
+    }
+    mprPutStringToBuf(conn->deferred, "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    if ((h2 = httpCreateHttp2(conn)) == 0) {
+        return 0;
+    }
+    if (settings && (len % 6) == 0) {
+        applySettings(h2, (cuchar*) settings, len);
+    }
+    h2->lastStream = 1;
+    if ((stream = createStream(h2, 1)) == 0) {
+        return 0;
+    }
+    feedStream(stream, headers, slen(headers), 1);
+    return 1;
+}
 
-static void addPacketForNet(HttpQueue *q, HttpPacket *packet);
-static void adjustNetVec(HttpQueue *q, ssize written);
-static MprOff buildNetVec(HttpQueue *q);
-static void freeNetPackets(HttpQueue *q, ssize written);
-static void netClose(HttpQueue *q);
-static void netOutgoingService(HttpQueue *q);
 
-/*********************************** Code *************************************/
-/*  
-    Initialize the net connector
+/*
+    Append a frame to the connection output buffer
  */
-int httpOpenNetConnector(Http *http)
+static void putFrame(Http2 *h2, int type, int flags, int id, cvoid *data, ssize size)
 {
-    HttpStage     *stage;
+    MprBuf  *buf;
+    uchar   header[HTTP2_FRAME_HEADER_SIZE];
 
-    mprLog(5, "Open net connector");
-    if ((stage = httpCreateConnector(http, "netConnector", HTTP_STAGE_ALL, NULL)) == 0) {
-        return MPR_ERR_CANT_CREATE;
+    if (!h2->conn->sock || (buf = h2->conn->deferred) == 0) {
+        return;
+    }
+    LOG(6, "http2: send frame type %d, flags %x, stream %d, length %d", type, flags, id, size);
+    header[0] = (uchar) ((size >> 16) & 0xFF);
+    header[1] = (uchar) ((size >> 8) & 0xFF);
+    header[2] = (uchar) (size & 0xFF);
+    header[3] = (uchar) type;
+    header[4] = (uchar) flags;
+    putUint32(&header[5], id);
+    mprPutBlockToBuf(buf, (cchar*) header, sizeof(header));
+    if (size > 0) {
+        mprPutBlockToBuf(buf, data, size);
     }
-    stage->close = netClose;
-    stage->outgoingService = netOutgoingService;
-    http->netConnector = stage;
-    return 0;
 }
 
 
-static void netClose(HttpQueue *q)
+static void putReset(Http2 *h2, int id, int code)
 {
-    HttpTx      *tx;
+    uchar   data[4];
 
-    tx = q->conn->tx;
-    if (tx->file) {
-        mprCloseFile(tx->file);
-        tx->file = 0;
-    }
+    putUint32(data, code);
+    putFrame(h2, HTTP2_RESET_FRAME, 0, id, data, sizeof(data));
 }
 
 
-static void netOutgoingService(HttpQueue *q)
+static void putWindow(Http2 *h2, int id, ssize increment)
 {
-    HttpConn    *conn;
-    HttpTx      *tx;
-    ssize       written;
-    int         errCode;
+    uchar   data[4];
 
-    conn = q->conn;
-    tx = conn->tx;
-    conn->lastActivity = conn->http->now;
-    mprAssert(conn->sock);
-    
-    if (!conn->sock || conn->connectorComplete) {
+    putUint32(data, (uint) increment);
+    putFrame(h2, HTTP2_WINDOW_FRAME, 0, id, data, sizeof(data));
+}
+
+
+static void putUint32(uchar *bp, uint value)
+{
+    bp[0] = (uchar) ((value >> 24) & 0xFF);
+    bp[1] = (uchar) ((value >> 16) & 0xFF);
+    bp[2] = (uchar) ((value >> 8) & 0xFF);
+    bp[3] = (uchar) (value & 0xFF);
+}
+
+
+/*
+    Send GOAWAY for a connection error. The connection is closed after the current I/O event.
+ */
+static void goaway(Http2 *h2, int code, cchar *msg)
+{
+    uchar   data[8];
+
+    if (h2->goaway) {
         return;
     }
-    if (tx->flags & HTTP_TX_NO_BODY) {
-        httpDiscardQueueData(q, 1);
-    }
-    if ((tx->bytesWritten + q->count) > conn->limits->transmissionBodySize) {
-        httpError(conn, HTTP_CODE_REQUEST_TOO_LARGE | ((tx->bytesWritten) ? HTTP_ABORT : 0),
-            "Http transmission aborted. Exceeded transmission max body of %,Ld bytes", conn->limits->transmissionBodySize);
-        if (tx->bytesWritten) {
-            httpConnectorComplete(conn);
-            return;
-        }
+    mprLog(3, "http2: connection error %d, %s", code, msg);
+    putUint32(data, h2->lastStream);
+    putUint32(&data[4], code);
+    putFrame(h2, HTTP2_GOAWAY_FRAME, 0, 0, data, sizeof(data));
+    h2->goaway = 1;
+    h2->conn->keepAliveCount = -1;
+}
+
+
+/*
+    Write buffered frames. If the socket is full, wait for a writable event.
+ */
+static void flushHttp2(Http2 *h2)
+{
+    HttpConn    *conn;
+
+    conn = h2->conn;
+    if (!conn->sock) {
+        return;
     }
-    if (tx->flags & HTTP_TX_SENDFILE) {
-        /* Relay via the send connector */
-        if (tx->file == 0) {
-            if (tx->flags & HTTP_TX_HEADERS_CREATED) {
-                tx->flags &= ~HTTP_TX_SENDFILE;
-            } else {
-                tx->connector = conn->http->sendConnector;
-                httpSendOpen(q);
-            }
-        }
-        if (tx->file) {
-            httpSendOutgoingService(q);
-            return;
-        }
+    if (httpFlushDeferred(conn)) {
+        httpResumeHttp2(conn);
+    } else {
+        conn->writeBlocked = 1;
+        httpEnableConnEvents(conn);
     }
-    while (q->first || q->ioIndex) {
-        if (q->ioIndex == 0 && buildNetVec(q) <= 0) {
-            break;
-        }
-        /*  
-            Issue a single I/O request to write all the blocks in the I/O vector
-         */
-        mprAssert(q->ioIndex > 0);
-        written = mprWriteSocketVector(conn->sock, q->iovec, q->ioIndex);
-        LOG(5, "Net connector wrote %d, written so far %Ld, q->count %d/%d", written, tx->bytesWritten, q->count, q->max);
-        if (written < 0) {
-            errCode = mprGetError(q);
-            if (errCode == EAGAIN || errCode == EWOULDBLOCK) {
-                /*  Socket full, wait for an I/O event */
-                httpSocketBlocked(conn);
-                break;
-            }
-            if (errCode != EPIPE && errCode != ECONNRESET) {
-                LOG(5, "netOutgoingService write failed, error %d", errCode);
-            }
-            httpError(conn, HTTP_ABORT | HTTP_CODE_COMMS_ERROR, "Write error %d", errCode);
-            httpConnectorComplete(conn);
-            break;
+}
 
-        } else if (written == 0) {
-            /*  Socket full, wait for an I/O event */
-            httpSocketBlocked(conn);
-            break;
 
-        } else if (written > 0) {
-            tx->bytesWritten += written;
-            freeNetPackets(q, written);
-            adjustNetVec(q, written);
-        }
-    }
-    if (q->ioCount == 0) {
-        if ((q->flags & HTTP_QUEUE_EOF)) {
-            httpConnectorComplete(conn);
-        } else {
-            httpNotifyWritable(conn);
-        }
+static void closeHttp2(HttpQueue *q)
+{
+    HttpTx      *tx;
+
+    tx = q->conn->tx;
+    if (tx->file) {
+        mprCloseFile(tx->file);
+        tx->file = 0;
     }
 }
 
 
 /*
-    Build the IO vector. Return the count of bytes to be written. Return -1 for EOF.
+    Write response packets as HEADERS and DATA frames. Packets remain queued while the flow control windows are closed
+    or too much frame output is buffered.
  */
-static MprOff buildNetVec(HttpQueue *q)
+static void outgoingHttp2Service(HttpQueue *q)
 {
-    HttpConn    *conn;
-    HttpTx      *tx;
-    HttpPacket  *packet;
+    HttpConn        *conn;
+    HttpTx          *tx;
+    HttpPacket      *packet;
+    Http2Stream     *stream;
 
     conn = q->conn;
     tx = conn->tx;
+    stream = conn->stream;
+    conn->lastActivity = conn->http->now;
+    stream->h2->conn->lastActivity = conn->lastActivity;
 
-    /*
-        Examine each packet and accumulate as many packets into the I/O vector as possible. Leave the packets on the queue 
-        for now, they are removed after the IO is complete for the entire packet.
-     */
-    for (packet = q->first; packet; packet = packet->next) {
+    if (conn->connectorComplete) {
+        return;
+    }
+    if (stream->reset || stream->h2->goaway || !stream->h2->conn->sock) {
+        httpDiscardQueueData(q, 1);
+        httpConnectorComplete(conn);
+        return;
+    }
+    if (tx->flags & HTTP_TX_NO_BODY) {
+        httpDiscardQueueData(q, 1);
+    }
+    for (packet = q->first; packet; packet = q->first) {
         if (packet->flags & HTTP_PACKET_HEADER) {
-            if (tx->chunkSize <= 0 && q->count > 0 && tx->length < 0) {
-                /* Incase no chunking filter and we've not seen all the data yet */
-                conn->keepAliveCount = 0;
-            }
-            httpWriteHeaders(conn, packet);
-            q->count += httpGetPacketLength(packet);
-
-        } else if (httpGetPacketLength(packet) == 0) {
-            q->flags |= HTTP_QUEUE_EOF;
-            if (packet->prefix == NULL) {
-                break;
-            }
+            httpGetPacket(q);
+            writeHeaders(q, packet);
+            continue;
         }
-        if (q->ioIndex >= (HTTP_MAX_IOVEC - 2)) {
+        if (packet->prefix && !writeData(q, packet->prefix, 0)) {
+            break;
+        }
+        if (packet->content && !writeData(q, packet->content, 1)) {
+            break;
+        }
+        httpGetPacket(q);
+        if (packet->flags & HTTP_PACKET_END) {
+            endStream(stream);
+            httpConnectorComplete(conn);
+            /* Ensure the request completes even if the handler is finishing via its own event */
+            schedulePump(stream);
             break;
         }
-        addPacketForNet(q, packet);
     }
-    return q->ioCount;
+    flushHttp2(stream->h2);
+    if (!conn->connectorComplete && q->count == 0) {
+        httpNotifyWritable(conn);
+    }
 }
 
 
 /*
-    Add one entry to the io vector
+    Encode the response headers as a HEADERS frame and CONTINUATION frames if required. If there is no response body,
+    the stream is ended with the headers.
  */
-static void addToNetVector(HttpQueue *q, char *ptr, ssize bytes)
+static void writeHeaders(HttpQueue *q, HttpPacket *packet)
 {
-    mprAssert(bytes > 0);
+    HttpConn        *conn;
+    HttpTx          *tx;
+    HttpPacket      *next;
+    Http2Stream     *stream;
+    Http2           *h2;
+    MprKey          *kp;
+    MprBuf          *buf;
+    char            *name, *start;
+    ssize           len, size;
+    int             type, flags;
 
-    q->iovec[q->ioIndex].start = ptr;
-    q->iovec[q->ioIndex].len = bytes;
-    q->ioCount += bytes;
-    q->ioIndex++;
+    conn = q->conn;
+    tx = conn->tx;
+    stream = conn->stream;
+    h2 = stream->h2;
+
+    httpWriteHeaders(conn, packet);
+    buf = mprCreateBuf(HTTP_BUFSIZE, -1);
+    httpEncodeHpack(buf, ":status", itos(tx->status));
+    for (kp = mprGetFirstKey(tx->headers); kp; kp = mprGetNextKey(tx->headers, kp)) {
+        name = slower(kp->key);
+        if (smatch(name, "connection") || smatch(name, "keep-alive") || smatch(name, "transfer-encoding") ||
+                smatch(name, "upgrade") || smatch(name, "proxy-connection")) {
+            continue;
+        }
+        if (smatch(name, "content-length") && tx->length < 0 && !(tx->flags & HTTP_TX_NO_BODY)) {
+            /* Unknown length, the end of the stream delimits the response */
+            continue;
+        }
+        httpEncodeHpack(buf, name, kp->data ? kp->data : "");
+    }
+    tx->headerSize = mprGetBufLength(buf);
+
+    if (tx->altBody) {
+        /* Error responses are emitted here */
+        httpDiscardQueueData(tx->queue[HTTP_QUEUE_TX]->nextQ, 0);
+        next = httpCreateDataPacket(slen(tx->altBody));
+        mprPutStringToBuf(next->content, tx->altBody);
+        httpPutBackPacket(q, next);
+
+    } else if ((tx->flags & HTTP_TX_NO_BODY) || ((next = q->first) != 0 && (next->flags & HTTP_PACKET_END) &&
+            httpGetPacketLength(next) == 0 && !next->prefix)) {
+        stream->ended = 1;
+    }
+    start = mprGetBufStart(buf);
+    len = mprGetBufLength(buf);
+    type = HTTP2_HEADERS_FRAME;
+    do {
+        size = min(len, h2->frameSize);
+        flags = (size == len) ? HTTP2_END_HEADERS_FLAG : 0;
+        if (type == HTTP2_HEADERS_FRAME && stream->ended) {
+            flags |= HTTP2_END_STREAM_FLAG;
+        }
+        putFrame(h2, type, flags, stream->id, start, size);
+        start += size;
+        len -= size;
+        type = HTTP2_CONTINUE_FRAME;
+    } while (len > 0);
 }
 
 
 /*
-    Add a packet to the io vector. Return the number of bytes added to the vector.
+    Write buffered data as DATA frames within the flow control windows. Return false if the stream is blocked.
  */
-static void addPacketForNet(HttpQueue *q, HttpPacket *packet)
+static bool writeData(HttpQueue *q, MprBuf *buf, bool content)
 {
-    HttpTx      *tx;
-    HttpConn    *conn;
-    int         item;
+    HttpConn        *conn;
+    Http2Stream     *stream;
+    Http2           *h2;
+    ssize           len, size;
 
     conn = q->conn;
-    tx = conn->tx;
+    stream = conn->stream;
+    h2 = stream->h2;
+
+    while ((len = mprGetBufLength(buf)) > 0) {
+        size = min(len, h2->frameSize);
+        size = min(size, stream->window);
+        size = min(size, h2->window);
+        if (size <= 0 || mprGetBufLength(h2->conn->deferred) >= HTTP2_MAX_BUFFER) {
+            stream->blocked = 1;
+            conn->writeBlocked = 1;
+            return 0;
+        }
+        if (!stream->ended) {
+            putFrame(h2, HTTP2_DATA_FRAME, 0, stream->id, mprGetBufStart(buf), size);
+        }
+        mprAdjustBufStart(buf, size);
+        stream->window -= size;
+        h2->window -= size;
+        conn->tx->bytesWritten += size;
+        if (content) {
+            q->count -= size;
+        }
+    }
+    return 1;
+}
 
-    mprAssert(q->count >= 0);
-    mprAssert(q->ioIndex < (HTTP_MAX_IOVEC - 2));
 
-    if (packet->prefix) {
-        addToNetVector(q, mprGetBufStart(packet->prefix), mprGetBufLength(packet->prefix));
-    }
-    if (httpGetPacketLength(packet) > 0) {
-        addToNetVector(q, mprGetBufStart(packet->content), mprGetBufLength(packet->content));
-    }
-    item = (packet->flags & HTTP_PACKET_HEADER) ? HTTP_TRACE_HEADER : HTTP_TRACE_BODY;
-    if (httpShouldTrace(conn, HTTP_TRACE_TX, item, tx->ext) >= 0) {
-        httpTraceContent(conn, HTTP_TRACE_TX, item, packet, 0, (ssize) tx->bytesWritten);
+static void endStream(Http2Stream *stream)
+{
+    if (!stream->ended) {
+        putFrame(stream->h2, HTTP2_DATA_FRAME, HTTP2_END_STREAM_FLAG, stream->id, NULL, 0);
+        stream->ended = 1;
     }
 }
 
 
-static void freeNetPackets(HttpQueue *q, ssize bytes)
-{
-    HttpPacket    *packet;
-    ssize         len;
+/*
+    @copy   default
 
-    mprAssert(q->count >= 0);
-    mprAssert(bytes >= 0);
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
 
-    while (bytes > 0 && (packet = q->first) != 0) {
-        if (packet->prefix) {
-            len = mprGetBufLength(packet->prefix);
-            len = min(len, bytes);
-            mprAdjustBufStart(packet->prefix, len);
-            bytes -= len;
-            /* Prefixes don't count in the q->count. No need to adjust */
-            if (mprGetBufLength(packet->prefix) == 0) {
-                packet->prefix = 0;
-            }
-        }
-        if (packet->content) {
-            len = mprGetBufLength(packet->content);
-            len = min(len, bytes);
-            mprAdjustBufStart(packet->content, len);
-            bytes -= len;
-            q->count -= len;
-            mprAssert(q->count >= 0);
-        }
-        if (packet->content == 0 || mprGetBufLength(packet->content) == 0) {
-            /*
-                This will remove the packet from the queue and will re-enable upstream disabled queues.
-             */
-            httpGetPacket(q);
-        }
-    }
-}
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a 
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
+
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
 
+    @end
+ */
 
+/************************************************************************/
 /*
-    Clear entries from the IO vector that have actually been transmitted. Support partial writes.
+    Start of file "src/httpService.c"
  */
-static void adjustNetVec(HttpQueue *q, ssize written)
-{
-    MprIOVec    *iovec;
-    ssize       len;
-    int         i, j;
-
-    /*
-        Cleanup the IO vector
-     */
-    if (written == q->ioCount) {
-        /*
-            Entire vector written. Just reset.
-         */
-        q->ioIndex = 0;
-        q->ioCount = 0;
-
-    } else {
-        /*
-            Partial write of an vector entry. Need to copy down the unwritten vector entries.
-         */
-        q->ioCount -= written;
-        mprAssert(q->ioCount >= 0);
-        iovec = q->iovec;
-        for (i = 0; i < q->ioIndex; i++) {
-            len = iovec[i].len;
-            if (written < len) {
-                iovec[i].start += written;
-                iovec[i].len -= written;
-                break;
-            } else {
-                written -= len;
-            }
-        }
-        /*
-            Compact
-         */
-        for (j = 0; i < q->ioIndex; ) {
-            iovec[j++] = iovec[i++];
-        }
-        q->ioIndex = j;
-    }
-}
-
+/************************************************************************/
 
 /*
-    @copy   default
-
-    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
+    httpService.c -- Http service. Includes timer for expired requests.
+    Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
+ */
 
-    This software is distributed under commercial and open source licenses.
-    You may use the Embedthis Open Source license or you may acquire a 
-    commercial license from Embedthis Software. You agree to be fully bound
-    by the terms of either license. Consult the LICENSE.md distributed with
-    this software for full details and other copyrights.
+/********************************* Includes ***********************************/
 
-    Local variables:
-    tab-width: 4
-    c-basic-offset: 4
-    End:
-    vim: sw=4 ts=4 expandtab
 
-    @end
- */
 
-/************************************************************************/
-/*
-    Start of file "src/packet.c"
+/********************************** Locals ************************************/
+/**
+    Standard HTTP error code table
  */
-/************************************************************************/
-
-/*
-    packet.c -- Queue support routines. Queues are the bi-directional data flow channels for the pipeline.
+typedef struct HttpStatusCode {
+    int     code;                           /**< Http error code */
+    char    *codeString;                    /**< Code as a string (for hashing) */
+    char    *msg;                           /**< Error message */
+} HttpStatusCode;
 
-    Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
- */
 
-/********************************* Includes ***********************************/
+HttpStatusCode HttpStatusCodes[] = {
+    { 100, "100", "Continue" },
+    { 101, "101", "Switching Protocols" },
+    { 200, "200", "OK" },
+    { 201, "201", "Created" },
+    { 202, "202", "Accepted" },
+    { 204, "204", "No Content" },
+    { 205, "205", "Reset Content" },
+    { 206, "206", "Partial Content" },
+    { 301, "301", "Moved Permanently" },
+    { 302, "302", "Moved Temporarily" },
+    { 304, "304", "Not Modified" },
+    { 305, "305", "Use Proxy" },
+    { 307, "307", "Temporary Redirect" },
+    { 400, "400", "Bad Request" },
+    { 401, "401", "Unauthorized" },
+    { 402, "402", "Payment Required" },
+    { 403, "403", "Forbidden" },
+    { 404, "404", "Not Found" },
+    { 405, "405", "Method Not Allowed" },
+    { 406, "406", "Not Acceptable" },
+    { 408, "408", "Request Timeout" },
+    { 409, "409", "Conflict" },
+    { 410, "410", "Length Required" },
+    { 411, "411", "Length Required" },
+    { 412, "412", "Precondition Failed" },
+    { 413, "413", "Request Entity Too Large" },
+    { 414, "414", "Request-URI Too Large" },
+    { 415, "415", "Unsupported Media Type" },
+    { 416, "416", "Requested Range Not Satisfiable" },
+    { 417, "417", "Expectation Failed" },
+    { 500, "500", "Internal Server Error" },
+    { 501, "501", "Not Implemented" },
+    { 502, "502", "Bad Gateway" },
+    { 503, "503", "Service Unavailable" },
+    { 504, "504", "Gateway Timeout" },
+    { 505, "505", "Http Version Not Supported" },
+    { 507, "507", "Insufficient Storage" },
 
+    /*
+        Proprietary codes (used internally) when connection to client is severed
+     */
+    { 550, "550", "Comms Error" },
+    { 551, "551", "General Client Error" },
+    { 0,   0 }
+};
 
+/****************************** Forward Declarations **************************/
 
-/********************************** Forwards **********************************/
+static void httpTimer(Http *http, MprEvent *event);
+static bool isIdle();
+static void manageHttp(Http *http, int flags);
+static void terminateHttp(int how, int status);
+static void updateCurrentDate(Http *http);
 
-static void managePacket(HttpPacket *packet, int flags);
+/*********************************** Code *************************************/
 
-/************************************ Code ************************************/
-/*  
-    Create a new packet. If size is -1, then also create a default growable buffer -- 
-    used for incoming body content. If size > 0, then create a non-growable buffer 
-    of the requested size.
- */
-HttpPacket *httpCreatePacket(ssize size)
+Http *httpCreate()
 {
-    HttpPacket  *packet;
+    Http            *http;
+    HttpStatusCode  *code;
 
-    if ((packet = mprAllocObj(HttpPacket, managePacket)) == 0) {
+    mprGlobalLock();
+    if (MPR->httpService) {
+        mprGlobalUnlock();
+        return MPR->httpService;
+    }
+    if ((http = mprAllocObj(Http, manageHttp)) == 0) {
+        mprGlobalUnlock();
         return 0;
     }
-    if (size != 0) {
-        if ((packet->content = mprCreateBuf(size < 0 ? HTTP_BUFSIZE: (ssize) size, -1)) == 0) {
-            return 0;
-        }
+    MPR->httpService = http;
+    http->software = sclone(HTTP_NAME);
+    http->protocol = sclone("HTTP/1.1");
+    http->mutex = mprCreateLock(http);
+    http->stages = mprCreateHash(-1, 0);
+    http->routeTargets = mprCreateHash(-1, MPR_HASH_STATIC_VALUES);
+    http->routeConditions = mprCreateHash(-1, MPR_HASH_STATIC_VALUES);
+    http->routeUpdates = mprCreateHash(-1, MPR_HASH_STATIC_VALUES);
+    http->hosts = mprCreateList(-1, MPR_LIST_STATIC_VALUES);
+    http->endpoints = mprCreateList(-1, MPR_LIST_STATIC_VALUES);
+    http->authTypes = mprCreateHash(-1, MPR_HASH_CASELESS | MPR_HASH_UNIQUE);
+    http->authStores = mprCreateHash(-1, MPR_HASH_CASELESS | MPR_HASH_UNIQUE);
+    http->defaultClientHost = sclone("127.0.0.1");
+    http->defaultClientPort = 80;
+    http->booted = mprGetTime();
+    /* Sessions have a private cache so the session count is the number of cached session records */
+    http->sessionCache = mprCreateCache(0);
+
+    updateCurrentDate(http);
+    http->statusCodes = mprCreateHash(41, MPR_HASH_STATIC_VALUES | MPR_HASH_STATIC_KEYS);
+    for (code = HttpStatusCodes; code->code; code++) {
+        mprAddKey(http->statusCodes, code->codeString, code);
     }
-    return packet;
+    httpCreateSecret(http);
+    httpSetHeaderScanner(-1);
+    httpInitHpack();
+    httpInitAuth(http);
+    httpOpenNetConnector(http);
+    httpOpenSendConnector(http);
+    httpOpenHttp2Connector(http);
+    httpOpenRangeFilter(http);
+    httpOpenChunkFilter(http);
+    httpOpenUploadFilter(http);
+#if BIT_WEB_SOCKETS
+    httpOpenSockFilter(http);
+#endif
+    httpOpenCacheHandler(http);
+    httpOpenPassHandler(http);
+    httpOpenProcHandler(http);
+
+    http->clientLimits = httpCreateLimits(0);
+    http->serverLimits = httpCreateLimits(1);
+    http->clientRoute = httpCreateConfiguredRoute(0, 0);
+
+    mprSetIdleCallback(isIdle);
+    mprAddTerminator(terminateHttp);
+    httpDefineRouteBuiltins();
+    mprGlobalUnlock();
+    return http;
 }
 
 
-static void managePacket(HttpPacket *packet, int flags)
+static void manageHttp(Http *http, int flags)
 {
+    HttpConn    *conn;
+    int         next;
+
     if (flags & MPR_MANAGE_MARK) {
-        mprMark(packet->prefix);
-        mprMark(packet->content);
-        /* Don't mark next packet. List owner will mark */
+        mprMark(http->endpoints);
+        mprMark(http->hosts);
+        mprMark(http->connections);
+        mprMark(http->stages);
+        mprMark(http->statusCodes);
+        mprMark(http->routeTargets);
+        mprMark(http->routeConditions);
+        mprMark(http->routeUpdates);
+        mprMark(http->sessionCache);
+        /* Don't mark convenience stage references as they will be in http->stages */
+        
+        mprMark(http->clientLimits);
+        mprMark(http->serverLimits);
+        mprMark(http->clientRoute);
+        mprMark(http->timer);
+        mprMark(http->timestamp);
+        mprMark(http->mutex);
+        mprMark(http->software);
+        mprMark(http->forkData);
+        mprMark(http->context);
+        mprMark(http->currentDate);
+#if UNUSED
+        mprMark(http->expiresDate);
+#endif
+        mprMark(http->secret);
+        mprMark(http->defaultClientHost);
+        mprMark(http->protocol);
+        mprMark(http->proxyHost);
+        mprMark(http->authTypes);
+        mprMark(http->authStores);
+        mprMark(http->groups);
+
+        /*
+            Endpoints keep connections alive until a timeout. Keep marking even if no other references.
+         */
+        lock(http);
+        for (ITERATE_CONNS(http, conn, next)) {
+            if (conn->endpoint) {
+                mprMark(conn);
+            }
+        }
+        unlock(http);
     }
 }
 
 
-HttpPacket *httpCreateDataPacket(ssize size)
+void httpDestroy(Http *http)
 {
-    HttpPacket    *packet;
-
-    if ((packet = httpCreatePacket(size)) == 0) {
-        return 0;
+    if (http->timer) {
+        mprRemoveEvent(http->timer);
+        http->timer = 0;
     }
-    packet->flags = HTTP_PACKET_DATA;
-    return packet;
+    if (http->timestamp) {
+        mprRemoveEvent(http->timestamp);
+        http->timestamp = 0;
+    }
+    MPR->httpService = NULL;
 }
 
 
-HttpPacket *httpCreateEntityPacket(MprOff pos, MprOff size, HttpFillProc fill)
+void httpAddEndpoint(Http *http, HttpEndpoint *endpoint)
 {
-    HttpPacket    *packet;
-
-    if ((packet = httpCreatePacket(0)) == 0) {
-        return 0;
-    }
-    packet->flags = HTTP_PACKET_DATA;
-    packet->epos = pos;
-    packet->esize = size;
-    packet->fill = fill;
-    return packet;
+    mprAddItem(http->endpoints, endpoint);
 }
 
 
-HttpPacket *httpCreateEndPacket()
+void httpRemoveEndpoint(Http *http, HttpEndpoint *endpoint)
 {
-    HttpPacket    *packet;
-
-    if ((packet = httpCreatePacket(0)) == 0) {
-        return 0;
-    }
-    packet->flags = HTTP_PACKET_END;
-    return packet;
+    mprRemoveItem(http->endpoints, endpoint);
 }
 
 
-HttpPacket *httpCreateHeaderPacket()
+/*  
+    Lookup a host address. If ipAddr is null or port is -1, then those elements are wild.
+ */
+HttpEndpoint *httpLookupEndpoint(Http *http, cchar *ip, int port)
 {
-    HttpPacket    *packet;
+    HttpEndpoint    *endpoint;
+    int             next;
 
-    if ((packet = httpCreatePacket(HTTP_BUFSIZE)) == 0) {
-        return 0;
+    if (ip == 0) {
+        ip = "";
     }
-    packet->flags = HTTP_PACKET_HEADER;
-    return packet;
+    for (next = 0; (endpoint = mprGetNextItem(http->endpoints, &next)) != 0; ) {
+        if (endpoint->port <= 0 || port <= 0 || endpoint->port == port) {
+            mprAssert(endpoint->ip);
+            if (*endpoint->ip == '\0' || *ip == '\0' || scmp(endpoint->ip, ip) == 0) {
+                return endpoint;
+            }
+        }
+    }
+    return 0;
 }
 
 
-HttpPacket *httpClonePacket(HttpPacket *orig)
+HttpEndpoint *httpGetFirstEndpoint(Http *http)
 {
-    HttpPacket  *packet;
-
-    if ((packet = httpCreatePacket(0)) == 0) {
-        return 0;
-    }
-    if (orig->content) {
-        packet->content = mprCloneBuf(orig->content);
-    }
-    if (orig->prefix) {
-        packet->prefix = mprCloneBuf(orig->prefix);
-    }
-    packet->flags = orig->flags;
-    packet->esize = orig->esize;
-    packet->epos = orig->epos;
-    packet->fill = orig->fill;
-    return packet;
+    return mprGetFirstItem(http->endpoints);
 }
 
 
-void httpAdjustPacketStart(HttpPacket *packet, MprOff size)
+/*
+    WARNING: this should not be called by users as httpCreateHost will automatically call this.
+ */
+void httpAddHost(Http *http, HttpHost *host)
 {
-    if (packet->esize) {
-        packet->epos += size;
-        packet->esize -= size;
-    } else if (packet->content) {
-        mprAdjustBufStart(packet->content, (ssize) size);
-    }
+    mprAddItem(http->hosts, host);
 }
 
 
-void httpAdjustPacketEnd(HttpPacket *packet, MprOff size)
+void httpRemoveHost(Http *http, HttpHost *host)
 {
-    if (packet->esize) {
-        packet->esize += size;
-    } else if (packet->content) {
-        mprAdjustBufEnd(packet->content, (ssize) size);
-    }
+    mprRemoveItem(http->hosts, host);
 }
 
 
-HttpPacket *httpGetPacket(HttpQueue *q)
+HttpHost *httpLookupHost(Http *http, cchar *name)
 {
-    HttpQueue     *prev;
-    HttpPacket    *packet;
+    HttpHost    *host;
+    int         next;
 
-    while (q->first) {
-        if ((packet = q->first) != 0) {
-            q->first = packet->next;
-            packet->next = 0;
-            q->count -= httpGetPacketLength(packet);
-            mprAssert(q->count >= 0);
-            if (packet == q->last) {
-                q->last = 0;
-                mprAssert(q->first == 0);
-            }
-        }
-        if (q->count < q->low) {
-            /*
-                This queue was full and now is below the low water mark. Back-enable the previous queue.
-             */
-            prev = httpFindPreviousQueue(q);
-            if (prev && prev->flags & HTTP_QUEUE_SUSPENDED) {
-                httpResumeQueue(prev);
-            }
+    for (next = 0; (host = mprGetNextItem(http->hosts, &next)) != 0; ) {
+        if (smatch(name, host->name)) {
+            return host;
         }
-        return packet;
     }
     return 0;
 }
 
 
-/*  
-    Test if the packet is too too large to be accepted by the downstream queue.
- */
-bool httpIsPacketTooBig(HttpQueue *q, HttpPacket *packet)
+void httpInitLimits(HttpLimits *limits, bool serverSide)
 {
-    ssize   size;
-    
-    size = mprGetBufLength(packet->content);
-    return size > q->max || size > q->packetSize;
-}
+    memset(limits, 0, sizeof(HttpLimits));
+    limits->cacheItemSize = HTTP_MAX_CACHE_ITEM;
+    limits->chunkSize = HTTP_MAX_CHUNK;
+    limits->clientMax = HTTP_MAX_CLIENTS;
+    limits->headerMax = HTTP_MAX_NUM_HEADERS;
+    limits->headerSize = HTTP_MAX_HEADERS;
+    limits->keepAliveMax = HTTP_MAX_KEEP_ALIVE;
+    limits->streamMax = HTTP_MAX_STREAMS;
+    limits->webSocketsMessageSize = HTTP_MAX_WS_MESSAGE;
+    limits->receiveFormSize = HTTP_MAX_RECEIVE_FORM;
+    limits->receiveBodySize = HTTP_MAX_RECEIVE_BODY;
+    limits->processMax = HTTP_MAX_REQUESTS;
+    limits->requestMax = HTTP_MAX_REQUESTS;
+    limits->sessionMax = HTTP_MAX_SESSIONS;
+    limits->stageBufferSize = HTTP_MAX_STAGE_BUFFER;
+    limits->transmissionBodySize = HTTP_MAX_TX_BODY;
+    limits->uploadSize = HTTP_MAX_UPLOAD;
+    limits->uriSize = MPR_MAX_URL;
 
+    limits->inactivityTimeout = HTTP_INACTIVITY_TIMEOUT;
+    limits->requestTimeout = MAXINT;
+    limits->sessionTimeout = HTTP_SESSION_TIMEOUT;
 
-/*  
-    Join a packet onto the service queue. This joins packet content data.
- */
-void httpJoinPacketForService(HttpQueue *q, HttpPacket *packet, bool serviceQ)
-{
-    if (q->first == 0) {
-        /*  Just use the service queue as a holding queue while we aggregate the post data.  */
-        httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+#if FUTURE
+    mprSetMaxSocketClients(endpoint, atoi(value));
 
-    } else {
-        /* Skip over the header packet */
-        if (q->first && q->first->flags & HTTP_PACKET_HEADER) {
-            packet = q->first->next;
-            q->first = packet;
-        } else {
-            /* Aggregate all data into one packet and free the packet.  */
-            httpJoinPacket(q->first, packet);
-        }
-        q->count += httpGetPacketLength(packet);
+    if (scaselesscmp(key, "LimitClients") == 0) {
+        mprSetMaxSocketClients(endpoint, atoi(value));
+        return 1;
     }
-    mprAssert(httpVerifyQueue(q));
-    if (serviceQ && !(q->flags & HTTP_QUEUE_SUSPENDED))  {
-        httpScheduleQueue(q);
+    if (scaselesscmp(key, "LimitMemoryMax") == 0) {
+        mprSetAllocLimits(endpoint, -1, atoi(value));
+        return 1;
+    }
+    if (scaselesscmp(key, "LimitMemoryRedline") == 0) {
+        mprSetAllocLimits(endpoint, atoi(value), -1);
+        return 1;
     }
+#endif
 }
 
 
-/*  
-    Join two packets by pulling the content from the second into the first.
-    WARNING: this will not update the queue count. Assumes the either both are on the queue or neither. 
- */
-int httpJoinPacket(HttpPacket *packet, HttpPacket *p)
+HttpLimits *httpCreateLimits(int serverSide)
 {
-    ssize   len;
-
-    mprAssert(packet->esize == 0);
-    mprAssert(p->esize == 0);
+    HttpLimits  *limits;
 
-    len = httpGetPacketLength(p);
-    if (mprPutBlockToBuf(packet->content, mprGetBufStart(p->content), (ssize) len) != len) {
-        mprAssert(0);
-        return MPR_ERR_MEMORY;
+    if ((limits = mprAllocStruct(HttpLimits)) != 0) {
+        httpInitLimits(limits, serverSide);
     }
-    return 0;
+    return limits;
 }
 
 
-/*
-    Join queue packets up to the maximum of the given size and the downstream queue packet size.
-    WARNING: this will not update the queue count.
- */
-void httpJoinPackets(HttpQueue *q, ssize size)
+void httpEaseLimits(HttpLimits *limits)
 {
-    HttpPacket  *packet, *first;
-    ssize       len;
-
-    if (size < 0) {
-        size = MAXINT;
-    }
-    if ((first = q->first) != 0 && first->next) {
-        if (first->flags & HTTP_PACKET_HEADER) {
-            /* Step over a header packet */
-            first = first->next;
-        }
-        for (packet = first->next; packet; packet = packet->next) {
-            if (packet->content == 0 || (len = httpGetPacketLength(packet)) == 0) {
-                break;
-            }
-            mprAssert(!(packet->flags & HTTP_PACKET_END));
-            httpJoinPacket(first, packet);
-            /* Unlink the packet */
-            first->next = packet->next;
-        }
-    }
+    limits->receiveFormSize = MAXOFF;
+    limits->receiveBodySize = MAXOFF;
+    limits->transmissionBodySize = MAXOFF;
+    limits->uploadSize = MAXOFF;
 }
 
 
-void httpPutPacket(HttpQueue *q, HttpPacket *packet)
+void httpAddStage(Http *http, HttpStage *stage)
 {
-    mprAssert(packet);
-    mprAssert(q->put);
-
-    q->put(q, packet);
+    mprAddKey(http->stages, stage->name, stage);
 }
 
 
-/*  
-    Pass to the next stage in the pipeline
- */
-void httpPutPacketToNext(HttpQueue *q, HttpPacket *packet)
+HttpStage *httpLookupStage(Http *http, cchar *name)
 {
-    mprAssert(packet);
-    mprAssert(q->nextQ->put);
-
-    q->nextQ->put(q->nextQ, packet);
+    return mprLookupKey(http->stages, name);
 }
 
 
-void httpPutPackets(HttpQueue *q)
+void *httpLookupStageData(Http *http, cchar *name)
 {
-    HttpPacket    *packet;
-
-    for (packet = httpGetPacket(q); packet; packet = httpGetPacket(q)) {
-        httpPutPacketToNext(q, packet);
+    HttpStage   *stage;
+    if ((stage = mprLookupKey(http->stages, name)) != 0) {
+        return stage->stageData;
     }
+    return 0;
 }
 
 
-/*  
-    Put the packet back at the front of the queue
- */
-void httpPutBackPacket(HttpQueue *q, HttpPacket *packet)
+cchar *httpLookupStatus(Http *http, int status)
 {
-    mprAssert(packet);
-    mprAssert(packet->next == 0);
-    mprAssert(q->count >= 0);
+    HttpStatusCode  *ep;
+    char            *key;
     
-    if (packet) {
-        packet->next = q->first;
-        if (q->first == 0) {
-            q->last = packet;
-        }
-        q->first = packet;
-        q->count += httpGetPacketLength(packet);
+    key = itos(status);
+    ep = (HttpStatusCode*) mprLookupKey(http->statusCodes, key);
+    if (ep == 0) {
+        return "Custom error";
     }
+    return ep->msg;
 }
 
 
-/*  
-    Put a packet on the service queue.
- */
-void httpPutForService(HttpQueue *q, HttpPacket *packet, bool serviceQ)
+void httpSetForkCallback(Http *http, MprForkCallback callback, void *data)
 {
-    mprAssert(packet);
-   
-    q->count += httpGetPacketLength(packet);
-    packet->next = 0;
-    
-    if (q->first) {
-        q->last->next = packet;
-        q->last = packet;
-    } else {
-        q->first = packet;
-        q->last = packet;
-    }
-    if (serviceQ && !(q->flags & HTTP_QUEUE_SUSPENDED))  {
-        httpScheduleQueue(q);
-    }
+    http->forkCallback = callback;
+    http->forkData = data;
 }
 
 
-/*  
-    Resize and possibly split a packet so it fits in the downstream queue. Put back the 2nd portion of the split packet 
-    on the queue. Ensure that the packet is not larger than "size" if it is greater than zero. If size < 0, then
-    use the default packet size. 
- */
-int httpResizePacket(HttpQueue *q, HttpPacket *packet, ssize size)
+void httpSetListenCallback(Http *http, HttpListenCallback fn)
 {
-    HttpPacket  *tail;
-    ssize       len;
-    
-    if (size <= 0) {
-        size = MAXINT;
-    }
-    if (packet->esize > size) {
-        if ((tail = httpSplitPacket(packet, size)) == 0) {
-            return MPR_ERR_MEMORY;
-        }
-    } else {
-        /*  
-            Calculate the size that will fit downstream
-         */
-        len = packet->content ? httpGetPacketLength(packet) : 0;
-        size = min(size, len);
-        size = min(size, q->nextQ->max);
-        size = min(size, q->nextQ->packetSize);
-        if (size == 0 || size == len) {
-            return 0;
-        }
-        if ((tail = httpSplitPacket(packet, size)) == 0) {
-            return MPR_ERR_MEMORY;
-        }
-    }
-    httpPutBackPacket(q, tail);
-    return 0;
+    http->listenCallback = fn;
 }
 
 
 /*  
-    Split a packet at a given offset and return a new packet containing the data after the offset.
-    The prefix data remains with the original packet. 
+    The http timer does maintenance activities and will fire per second while there are active requests.
+    This is run in both servers and clients.
+    NOTE: Because we lock the http here, connections cannot be deleted while we are modifying the list.
  */
-HttpPacket *httpSplitPacket(HttpPacket *orig, ssize offset)
+static void httpTimer(Http *http, MprEvent *event)
 {
-    HttpPacket  *packet;
-    ssize       count, size;
+    HttpConn    *conn;
+    HttpStage   *stage;
+    HttpRx      *rx;
+    HttpLimits  *limits;
+    MprModule   *module;
+    int         next, active;
 
-    if (orig->esize) {
-        if ((packet = httpCreateEntityPacket(orig->epos + offset, orig->esize - offset, orig->fill)) == 0) {
-            return 0;
-        }
-        orig->esize = offset;
+    mprAssert(event);
+    
+    updateCurrentDate(http);
+    if (mprGetDebugMode()) {
+        return;
+    }
+    /* 
+       Check for any inactive connections or expired requests (inactivityTimeout and requestTimeout)
+     */
+    lock(http);
+    mprLog(6, "httpTimer: %d active connections", http->connLength);
+    for (active = 0, next = 0; (conn = httpGetNextConn(http, &next)) != 0; active++) {
+        rx = conn->rx;
+        limits = conn->limits;
+        if (!conn->timeoutEvent && (
+            (conn->lastActivity + limits->inactivityTimeout) < http->now || 
+            ((conn->started + limits->requestTimeout) < http->now && !(rx && rx->webSocket)))) {
+            if (rx) {
+                /*
+                    Don't call APIs on the conn directly (thread-race). Schedule a timer on the connection's dispatcher
+                 */
+                if (!conn->timeoutEvent) {
+                    conn->timeoutEvent = mprCreateEvent(conn->dispatcher, "connTimeout", 0, httpConnTimeout, conn, 0);
+                }
+            } else if (conn->h2 && mprGetListLength(conn->h2->streams) > 0) {
+                /* HTTP/2 connection with active streams. Streams are timed out individually. */
+                conn->lastActivity = http->now;
 
-    } else {
-        if (offset >= httpGetPacketLength(orig)) {
-            mprAssert(offset < httpGetPacketLength(orig));
-            return 0;
-        }
-        /*
-            OPT - A large packet will often be resized by splitting into chunks that the
-            downstream queues will accept. This causes many allocations that are a small delta less than the large
-            packet 
-            Better:
-                - If offset is < size/2
-                    - Allocate packet size == offset
-                    - Set orig->content =   
-                    - packet->content = orig->content
-                        httpAdjustPacketStart(packet, offset) 
-                    - orig->content = Packet(size == offset)
-                        copy from packet
-                Adjust the content->start
-         */
-        count = httpGetPacketLength(orig) - offset;
-        size = max(count, HTTP_BUFSIZE);
-        size = HTTP_PACKET_ALIGN(size);
-        if ((packet = httpCreateDataPacket(size)) == 0) {
-            return 0;
+            } else {
+                mprLog(6, "Idle connection timed out");
+                httpDisconnect(conn);
+                httpDiscardQueueData(conn->writeq, 1);
+                httpEnableConnEvents(conn);
+                conn->lastActivity = conn->started = http->now;
+            }
         }
-        httpAdjustPacketEnd(orig, (ssize) -count);
-        if (mprPutBlockToBuf(packet->content, mprGetBufEnd(orig->content), (ssize) count) != count) {
-            return 0;
+    }
+
+    /*
+        Check for unloadable modules
+     */
+    if (http->connLength == 0) {
+        for (next = 0; (module = mprGetNextItem(MPR->moduleService->modules, &next)) != 0; ) {
+            if (module->timeout) {
+                if (module->lastActivity + module->timeout < http->now) {
+                    mprLog(2, "Unloading inactive module %s", module->name);
+                    if ((stage = httpLookupStage(http, module->name)) != 0) {
+                        if (mprUnloadModule(module) < 0)  {
+                            active++;
+                        } else {
+                            stage->flags |= HTTP_STAGE_UNLOADED;
+                        }
+                    } else {
+                        mprUnloadModule(module);
+                    }
+                } else {
+                    active++;
+                }
+            }
         }
-#if BIT_DEBUG
-        mprAddNullToBuf(orig->content);
-#endif
     }
-    packet->flags = orig->flags;
-    return packet;
+    if (active == 0) {
+        mprRemoveEvent(event);
+        http->timer = 0;
+    }
+    //  OPT - run GC here
+    unlock(http);
 }
 
 
-/*
-    @copy   default
+static void timestamp()
+{
+    mprLog(0, "Time: %s", mprGetDate(NULL));
+}
 
-    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
 
-    This software is distributed under commercial and open source licenses.
-    You may use the Embedthis Open Source license or you may acquire a 
-    commercial license from Embedthis Software. You agree to be fully bound
-    by the terms of either license. Consult the LICENSE.md distributed with
-    this software for full details and other copyrights.
+void httpSetTimestamp(MprTime period)
+{
+    Http    *http;
 
-    Local variables:
-    tab-width: 4
-    c-basic-offset: 4
-    End:
-    vim: sw=4 ts=4 expandtab
+    http = MPR->httpService;
+    if (period < (10 * MPR_TICKS_PER_SEC)) {
+        period = (10 * MPR_TICKS_PER_SEC);
+    }
+    if (http->timestamp) {
+        mprRemoveEvent(http->timestamp);
+    }
+    if (period > 0) {
+        http->timestamp = mprCreateTimerEvent(NULL, "httpTimestamp", period, timestamp, NULL, 
+            MPR_EVENT_CONTINUOUS | MPR_EVENT_QUICK);
+    }
+}
 
-    @end
- */
 
-/************************************************************************/
-/*
-    Start of file "src/pam.c"
- */
-/************************************************************************/
+static void terminateHttp(int how, int status)
+{
+    Http            *http;
+    HttpEndpoint    *endpoint;
+    int             next;
 
-/*
-    authPam.c - Authorization using PAM (Pluggable Authorization Module)
+    /*
+        Stop listening for new requests
+     */
+    http = (Http*) mprGetMpr()->httpService;
+    if (http) {
+        for (ITERATE_ITEMS(http->endpoints, endpoint, next)) {
+            httpStopEndpoint(endpoint);
+            closeHandshakes(endpoint);
+        }
+    }
+}
 
-    Copyright (c) All Rights Reserved. See details at the end of the file.
- */
 
-/********************************* Includes ***********************************/
+static bool isIdle()
+{
+    HttpConn        *conn;
+    Http            *http;
+    MprTime         now;
+    int             next;
+    static MprTime  lastTrace = 0;
 
+    http = (Http*) mprGetMpr()->httpService;
+    now = http->now;
 
+    lock(http);
+    for (ITERATE_CONNS(http, conn, next)) {
+        if (conn->state != HTTP_STATE_BEGIN) {
+            if (lastTrace < now) {
+                mprLog(1, "Waiting for request %s to complete", conn->rx->uri ? conn->rx->uri : conn->rx->pathInfo);
+                lastTrace = now;
+            }
+            unlock(http);
+            return 0;
+        }
+    }
+    unlock(http);
+    if (!mprServicesAreIdle()) {
+        if (lastTrace < now) {
+            mprLog(4, "Waiting for MPR services complete");
+            lastTrace = now;
+        }
+        return 0;
+    }
+    return 1;
+}
 
-#if BIT_HAS_PAM && BIT_PAM
- #include    <security/pam_appl.h>
 
-/********************************* Defines ************************************/
+/*
+    Open connections are kept in a dense array. Each connection records its index so it can be removed without 
+    searching. Removal moves the last connection into the vacated slot. The array does not retain the connections.
+ */
+void httpAddConn(Http *http, HttpConn *conn)
+{
+    HttpConn    **connections;
+    int         size;
 
-typedef struct {
-    char    *name;
-    char    *password;
-} UserInfo;
+    conn->started = http->now;
 
-#if MACOSX
-    typedef int Gid;
-#else
-    typedef gid_t Gid;
-#endif
+    lock(http);
+    if (http->connLength >= http->connSize) {
+        size = max(http->connSize * 2, HTTP_CONN_SLOTS);
+        if ((connections = mprRealloc(http->connections, size * sizeof(HttpConn*))) == 0) {
+            unlock(http);
+            return;
+        }
+        http->connections = connections;
+        http->connSize = size;
+    }
+    conn->slot = http->connLength++;
+    http->connections[conn->slot] = conn;
+    conn->seqno = http->connCount++;
+    updateCurrentDate(http);
+    if (!http->timer) {
+        http->timer = mprCreateTimerEvent(NULL, "httpTimer", HTTP_TIMER_PERIOD, httpTimer, http, 
+            MPR_EVENT_CONTINUOUS | MPR_EVENT_QUICK);
+    }
+    unlock(http);
+}
 
-/********************************* Forwards ***********************************/
 
-static int pamChat(int msgCount, const struct pam_message **msg, struct pam_response **resp, void *data);
+void httpRemoveConn(Http *http, HttpConn *conn)
+{
+    HttpConn    *last;
 
-/*********************************** Code *************************************/
+    lock(http);
+    if (conn->slot >= 0 && conn->slot < http->connLength && http->connections[conn->slot] == conn) {
+        last = http->connections[--http->connLength];
+        http->connections[conn->slot] = last;
+        last->slot = conn->slot;
+        http->connections[http->connLength] = 0;
+    }
+    conn->slot = -1;
+    unlock(http);
+}
 
-bool httpPamVerifyUser(HttpConn *conn)
+
+int httpGetConnCount(Http *http)
 {
-    MprBuf              *abilities;
-    pam_handle_t        *pamh;
-    UserInfo            info;
-    struct pam_conv     conv = { pamChat, &info };
-    struct group        *gp;
-    int                 res, i;
-   
-    mprAssert(conn->username);
-    mprAssert(conn->password);
-    mprAssert(!conn->encoded);
+    return http->connLength;
+}
 
-    info.name = (char*) conn->username;
-    info.password = (char*) conn->password;
-    pamh = NULL;
-    if ((res = pam_start("login", info.name, &conv, &pamh)) != PAM_SUCCESS) {
-        return 0;
-    }
-    if ((res = pam_authenticate(pamh, PAM_DISALLOW_NULL_AUTHTOK)) != PAM_SUCCESS) {
-        pam_end(pamh, PAM_SUCCESS);
-        mprLog(5, "httpPamVerifyUser failed to verify %s", conn->username);
-        return 0;
-    }
-    pam_end(pamh, PAM_SUCCESS);
-    mprLog(5, "httpPamVerifyUser verified %s", conn->username);
 
-    if (!conn->user) {
-        conn->user = mprLookupKey(conn->rx->route->auth->users, conn->username);
-    }
-    if (!conn->user) {
-        Gid     groups[32];
-        int     ngroups;
-        /* 
-            Create a temporary user with a abilities set to the groups 
-         */
-        ngroups = sizeof(groups) / sizeof(Gid);
-        if ((i = getgrouplist(conn->username, 99999, groups, &ngroups)) >= 0) {
-            abilities = mprCreateBuf(0, 0);
-            for (i = 0; i < ngroups; i++) {
-                if ((gp = getgrgid(groups[i])) != 0) {
-                    mprPutFmtToBuf(abilities, "%s ", gp->gr_name);
-                }
-            }
-            mprAddNullToBuf(abilities);
-            mprLog(5, "Create temp user \"%s\" with abilities: %s", conn->username, mprGetBufStart(abilities));
-            conn->user = httpCreateUser(conn->rx->route->auth, conn->username, 0, mprGetBufStart(abilities));
-        }
+HttpConn *httpGetNextConn(Http *http, int *next)
+{
+    if (*next < 0 || *next >= http->connLength) {
+        return 0;
     }
-    return 1;
+    return http->connections[(*next)++];
 }
 
+
 /*  
-    Callback invoked by the pam_authenticate function
+    Create a random secret for use in authentication. Create once for the entire http service. Created on demand.
+    Users can recall as required to update.
  */
-static int pamChat(int msgCount, const struct pam_message **msg, struct pam_response **resp, void *data) 
+int httpCreateSecret(Http *http)
 {
-    UserInfo                *info;
-    struct pam_response     *reply;
-    int                     i;
-    
-    i = 0;
-    reply = 0;
-    info = (UserInfo*) data;
+    MprTime     now;
+    char        *hex = "0123456789abcdef";
+    char        bytes[HTTP_MAX_SECRET], ascii[HTTP_MAX_SECRET * 2 + 1], *ap, *cp, *bp;
+    int         i, pid;
 
-    if (resp == 0 || msg == 0 || info == 0) {
-        return PAM_CONV_ERR;
+    if (mprGetRandomBytes(bytes, sizeof(bytes), 0) < 0) {
+        mprError("Can't get sufficient random data for secure SSL operation. If SSL is used, it may not be secure.");
+        now = http->now;
+        pid = (int) getpid();
+        cp = (char*) &now;
+        bp = bytes;
+        for (i = 0; i < sizeof(now) && bp < &bytes[HTTP_MAX_SECRET]; i++) {
+            *bp++= *cp++;
+        }
+        cp = (char*) &now;
+        for (i = 0; i < sizeof(pid) && bp < &bytes[HTTP_MAX_SECRET]; i++) {
+            *bp++ = *cp++;
+        }
+        mprAssert(0);
+        return MPR_ERR_CANT_INITIALIZE;
     }
-    if ((reply = calloc(msgCount, sizeof(struct pam_response))) == 0) {
-        return PAM_CONV_ERR;
+
+    ap = ascii;
+    for (i = 0; i < (int) sizeof(bytes); i++) {
+        *ap++ = hex[((uchar) bytes[i]) >> 4];
+        *ap++ = hex[((uchar) bytes[i]) & 0xf];
     }
-    for (i = 0; i < msgCount; i++) {
-        reply[i].resp_retcode = 0;
-        reply[i].resp = 0;
-        
-        switch (msg[i]->msg_style) {
-        case PAM_PROMPT_ECHO_ON:
-            reply[i].resp = strdup(info->name);
-            break;
+    *ap = '\0';
+    http->secret = sclone(ascii);
+    return 0;
+}
 
-        case PAM_PROMPT_ECHO_OFF:
-            /* Retrieve the user password and pass onto pam */
-            reply[i].resp = strdup(info->password);
-            break;
 
-        default:
-            free(reply);
-            return PAM_CONV_ERR;
+void httpEnableTraceMethod(HttpLimits *limits, bool on)
+{
+    limits->enableTraceMethod = on;
+}
+
+
+char *httpGetDateString(MprPath *sbuf)
+{
+    MprTime     when;
+
+    if (sbuf == 0) {
+        when = ((Http*) MPR->httpService)->now;
+    } else {
+        when = (MprTime) sbuf->mtime * MPR_TICKS_PER_SEC;
+    }
+    return mprFormatUniversalTime(HTTP_DATE_FORMAT, when);
+}
+
+
+void *httpGetContext(Http *http)
+{
+    return http->context;
+}
+
+
+void httpSetContext(Http *http, void *context)
+{
+    http->context = context;
+}
+
+
+int httpGetDefaultClientPort(Http *http)
+{
+    return http->defaultClientPort;
+}
+
+
+cchar *httpGetDefaultClientHost(Http *http)
+{
+    return http->defaultClientHost;
+}
+
+
+void httpSetDefaultClientPort(Http *http, int port)
+{
+    http->defaultClientPort = port;
+}
+
+
+void httpSetDefaultClientHost(Http *http, cchar *host)
+{
+    http->defaultClientHost = sclone(host);
+}
+
+
+void httpSetSoftware(Http *http, cchar *software)
+{
+    http->software = sclone(software);
+}
+
+
+void httpSetProxy(Http *http, cchar *host, int port)
+{
+    http->proxyHost = sclone(host);
+    http->proxyPort = port;
+}
+
+
+static void updateCurrentDate(Http *http)
+{
+    http->now = mprGetTime();
+    if (http->now > (http->currentTime + MPR_TICKS_PER_SEC - 1)) {
+        http->currentTime = http->now;
+        http->currentDate = httpGetDateString(NULL);
+#if UNUSED
+    static MprTime  recalcExpires = 0;
+        if (http->expiresDate == 0 || recalcExpires < (http->now / (60 * 1000))) {
+            http->expiresDate = mprFormatUniversalTime(HTTP_DATE_FORMAT, http->now + (86400 * 1000));
+            recalcExpires = http->now / (60 * 1000);
         }
+#endif
     }
-    *resp = reply;
-    return PAM_SUCCESS;
 }
-#endif /* BIT_HAS_PAM */
+
 
 /*
     @copy   default
@@ -6207,16 +7140,12 @@ static int pamChat(int msgCount, const struct pam_message **msg, struct pam_resp
 
 /************************************************************************/
 /*
-    Start of file "src/passHandler.c"
+    Start of file "src/log.c"
  */
 /************************************************************************/
 
 /*
-    passHandler.c -- Pass through handler
-
-    This handler simply relays all content to a network connector. It is used to when there is no handler defined 
-    and to convey errors when the actual handler fails. It is configured as the "passHandler" and "errorHandler".
-    The pipeline will also select this handler if any routing errors occur. 
+    log.c -- Http request access logging
 
     Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
  */
@@ -6225,94 +7154,226 @@ static int pamChat(int msgCount, const struct pam_message **msg, struct pam_resp
 
 
 
-/*********************************** Code *************************************/
-/*
-    Handle Trace and Options requests. Handlers can do this themselves if they desire, but typically
-    all Trace/Options requests come here.
- */
-void httpHandleOptionsTrace(HttpConn *conn)
-{
-    HttpRx      *rx;
-    HttpTx      *tx;
-    int         flags;
+/************************************ Code ************************************/
 
-    tx = conn->tx;
-    rx = conn->rx;
+int httpSetRouteLog(HttpRoute *route, cchar *path, ssize size, int backup, cchar *format, int flags)
+{
+    char    *src, *dest;
 
-    if (rx->flags & HTTP_TRACE) {
-        /* The trace method is disabled by default unless 'TraceMethod on' is specified */
-        if (!conn->limits->enableTraceMethod) {
-            tx->status = HTTP_CODE_NOT_ACCEPTABLE;
-            httpFormatResponseBody(conn, "Trace Request Denied", "The TRACE method is disabled on this server.");
-        } else {
-            httpFormatResponse(conn, "%s %s %s\r\n", rx->method, rx->uri, conn->protocol);
-        }
-        /* This finalizes output and indicates the request is now complete */
-        httpFinalize(conn);
+    mprAssert(route);
+    mprAssert(path && *path);
+    mprAssert(format);
+    
+    if (format == NULL || *format == '\0') {
+        format = HTTP_LOG_FORMAT;
+    }
+    route->logFlags = flags;
+    route->logSize = size;
+    route->logBackup = backup;
+    route->logPath = sclone(path);
+    route->logFormat = sclone(format);
 
-    } else if (rx->flags & HTTP_OPTIONS) {
-        flags = tx->traceMethods;
-        httpSetHeader(conn, "Allow", "OPTIONS%s%s%s%s%s%s",
-            (conn->limits->enableTraceMethod) ? ",TRACE" : "",
-            (flags & HTTP_STAGE_GET) ? ",GET" : "",
-            (flags & HTTP_STAGE_HEAD) ? ",HEAD" : "",
-            (flags & HTTP_STAGE_POST) ? ",POST" : "",
-            (flags & HTTP_STAGE_PUT) ? ",PUT" : "",
-            (flags & HTTP_STAGE_DELETE) ? ",DELETE" : "");
-        httpOmitBody(conn);
-        httpSetContentLength(conn, 0);
-        httpFinalize(conn);
+    for (src = dest = route->logFormat; *src; src++) {
+        if (*src == '\\' && src[1] != '\\') {
+            continue;
+        }
+        *dest++ = *src;
+    }
+    *dest = '\0';
+    if (route->logBackup > 0) {
+        httpBackupRouteLog(route);
+    }
+    route->logFlags &= ~MPR_LOG_ANEW;
+    if (!httpOpenRouteLog(route)) {
+        return MPR_ERR_CANT_OPEN;
     }
+    return 0;
 }
 
 
-static void startPass(HttpQueue *q)
+void httpBackupRouteLog(HttpRoute *route)
 {
-    mprLog(5, "Start passHandler");
-    if (q->conn->rx->flags & (HTTP_OPTIONS | HTTP_TRACE)) {
-        httpHandleOptionsTrace(q->conn);
+    MprPath     info;
+
+    mprAssert(route->logBackup);
+    mprAssert(route->logSize > 100);
+
+    if (route->parent && route->parent->log == route->log) {
+        httpBackupRouteLog(route->parent);
+        return;
+    }
+    lock(route);
+    mprGetPathInfo(route->logPath, &info);
+    if (info.valid && ((route->logFlags & MPR_LOG_ANEW) || info.size > route->logSize || route->logSize <= 0)) {
+        if (route->log) {
+            mprCloseFile(route->log);
+            route->log = 0;
+        }
+        mprBackupLog(route->logPath, route->logBackup);
+        route->logFlags &= ~MPR_LOG_ANEW;
     }
+    unlock(route);
 }
 
 
-static void readyPass(HttpQueue *q)
+MprFile *httpOpenRouteLog(HttpRoute *route)
 {
-    httpFinalize(q->conn);
+    MprFile     *file;
+    int         mode;
+
+    mprAssert(route->log == 0);
+    mode = O_CREAT | O_WRONLY | O_TEXT;
+    if ((file = mprOpenFile(route->logPath, mode, 0664)) == 0) {
+        mprError("Can't open log file %s", route->logPath);
+        return 0;
+    }
+    route->log = file;
+    return file;
 }
 
 
-static void readyError(HttpQueue *q)
+void httpWriteRouteLog(HttpRoute *route, cchar *buf, ssize len)
 {
-    if (!q->conn->error) {
-        httpError(q->conn, HTTP_CODE_SERVICE_UNAVAILABLE, "The requested resource is not available");
+    lock(MPR);
+    if (route->logBackup > 0) {
+        //  OPT - don't check this on every write
+        httpBackupRouteLog(route);
+        if (!route->log && !httpOpenRouteLog(route)) {
+            unlock(MPR);
+            return;
+        }
     }
-    httpFinalize(q->conn);
+    if (mprWriteFile(route->log, (char*) buf, len) != len) {
+        mprError("Can't write to access log %s", route->logPath);
+        mprCloseFile(route->log);
+        route->log = 0;
+    }
+    unlock(MPR);
 }
 
 
-int httpOpenPassHandler(Http *http)
+void httpLogRequest(HttpConn *conn)
 {
-    HttpStage     *stage;
+    HttpRx      *rx;
+    HttpTx      *tx;
+    HttpRoute   *route;
+    MprBuf      *buf;
+    char        keyBuf[80], *timeText, *fmt, *cp, *qualifier, *value, c;
+    int         len;
 
-    if ((stage = httpCreateHandler(http, "passHandler", HTTP_STAGE_ALL, NULL)) == 0) {
-        return MPR_ERR_CANT_CREATE;
+    if ((rx = conn->rx) == 0) {
+        return;
     }
-    http->passHandler = stage;
-    stage->start = startPass;
-    stage->ready = readyPass;
+    tx = conn->tx;
+    if ((route = rx->route) == 0 || route->log == 0) {
+        return;
+    }
+    fmt = route->logFormat;
+    if (fmt == 0) {
+        fmt = HTTP_LOG_FORMAT;
+    }
+    len = MPR_MAX_URL + 256;
+    buf = mprCreateBuf(len, len);
 
-    /*
-        PassHandler is an alias as the ErrorHandler too
-     */
-    if ((stage = httpCreateHandler(http, "errorHandler", HTTP_STAGE_ALL, NULL)) == 0) {
-        return MPR_ERR_CANT_CREATE;
+    while ((c = *fmt++) != '\0') {
+        if (c != '%' || (c = *fmt++) == '%') {
+            mprPutCharToBuf(buf, c);
+            continue;
+        }
+        switch (c) {
+        case 'a':                           /* Remote IP */
+            mprPutStringToBuf(buf, conn->ip);
+            break;
+
+        case 'A':                           /* Local IP */
+            mprPutStringToBuf(buf, conn->sock->listenSock->ip);
+            break;
+
+        case 'b':
+            if (tx->bytesWritten == 0) {
+                mprPutCharToBuf(buf, '-');
+            } else {
+                mprPutIntToBuf(buf, tx->bytesWritten);
+            } 
+            break;
+
+        case 'B':                           /* Bytes written (minus headers) */
+            mprPutIntToBuf(buf, (tx->bytesWritten - tx->headerSize));
+            break;
+
+        case 'h':                           /* Remote host */
+            mprPutStringToBuf(buf, conn->ip);
+            break;
+
+        case 'n':                           /* Local host */
+            mprPutStringToBuf(buf, rx->parsedUri->host);
+            break;
+
+        case 'O':                           /* Bytes written (including headers) */
+            mprPutIntToBuf(buf, tx->bytesWritten);
+            break;
+
+        case 'r':                           /* First line of request */
+            mprPutFmtToBuf(buf, "%s %s %s", rx->method, rx->uri, conn->protocol);
+            break;
+
+        case 's':                           /* Response code */
+            mprPutIntToBuf(buf, tx->status);
+            break;
+
+        case 't':                           /* Time */
+            mprPutCharToBuf(buf, '[');
+            timeText = mprFormatLocalTime(MPR_DEFAULT_DATE, mprGetTime());
+            mprPutStringToBuf(buf, timeText);
+            mprPutCharToBuf(buf, ']');
+            break;
+
+        case 'u':                           /* Remote username */
+            mprPutStringToBuf(buf, conn->username ? conn->username : "-");
+            break;
+
+        case '{':                           /* Header line */
+            qualifier = fmt;
+            if ((cp = strchr(qualifier, '}')) != 0) {
+                fmt = &cp[1];
+                *cp = '\0';
+                c = *fmt++;
+                scopy(keyBuf, sizeof(keyBuf), "HTTP_");
+                scopy(&keyBuf[5], sizeof(keyBuf) - 5, qualifier);
+                switch (c) {
+                case 'i':
+                    value = (char*) mprLookupKey(rx->headers, supper(keyBuf));
+                    mprPutStringToBuf(buf, value ? value : "-");
+                    break;
+                default:
+                    mprPutStringToBuf(buf, qualifier);
+                }
+                *cp = '}';
+
+            } else {
+                mprPutCharToBuf(buf, c);
+            }
+            break;
+
+        case '>':
+            if (*fmt == 's') {
+                fmt++;
+                mprPutIntToBuf(buf, tx->status);
+            }
+            break;
+
+        default:
+            mprPutCharToBuf(buf, c);
+            break;
+        }
     }
-    stage->start = startPass;
-    stage->ready = readyError;
-    return 0;
+    mprPutCharToBuf(buf, '\n');
+    mprAddNullToBuf(buf);
+    httpWriteRouteLog(route, mprGetBufStart(buf), mprGetBufLength(buf));
 }
 
 
+
 /*
     @copy   default
 
@@ -6335,12 +7396,16 @@ int httpOpenPassHandler(Http *http)
 
 /************************************************************************/
 /*
-    Start of file "src/pipeline.c"
+    Start of file "src/netConnector.c"
  */
 /************************************************************************/
 
 /*
-    pipeline.c -- HTTP pipeline processing. 
+    netConnector.c -- General network connector. 
+
+    The Network connector handles output data (only) from upstream handlers and filters. It uses vectored writes to
+    aggregate output packets into fewer actual I/O requests to the O/S. 
+
     Copyright (c) All Rights Reserved. See details at the end of the file.
  */
 
@@ -6348,327 +7413,375 @@ int httpOpenPassHandler(Http *http)
 
 
 
-/********************************** Forward ***********************************/
+/**************************** Forward Declarations ****************************/
 
-static bool matchFilter(HttpConn *conn, HttpStage *filter, HttpRoute *route, int dir);
-static void openQueues(HttpConn *conn);
-static void pairQueues(HttpConn *conn);
+static void addPacketForNet(HttpQueue *q, HttpPacket *packet);
+static void adjustNetVec(HttpQueue *q, ssize written);
+static MprOff buildNetVec(HttpQueue *q);
+static bool deferNetVec(HttpQueue *q);
+static void freeNetPackets(HttpQueue *q, ssize written);
+static void netClose(HttpQueue *q);
+static void netOutgoingService(HttpQueue *q);
+static ssize writeNetVec(HttpQueue *q);
 
 /*********************************** Code *************************************/
-
-void httpCreateTxPipeline(HttpConn *conn, HttpRoute *route)
+/*  
+    Initialize the net connector
+ */
+int httpOpenNetConnector(Http *http)
 {
-    Http        *http;
-    HttpTx      *tx;
-    HttpRx      *rx;
-    HttpQueue   *q;
-    HttpStage   *stage, *filter;
-    int         next, hasOutputFilters;
-
-    mprAssert(conn);
-    mprAssert(route);
-
-    http = conn->http;
-    rx = conn->rx;
-    tx = conn->tx;
-
-    tx->outputPipeline = mprCreateList(-1, 0);
-    if (tx->handler == 0) {
-        tx->handler = http->passHandler;
-    }
-    mprAddItem(tx->outputPipeline, tx->handler);
+    HttpStage     *stage;
 
-    hasOutputFilters = 0;
-    if (route->outputStages) {
-        for (next = 0; (filter = mprGetNextItem(route->outputStages, &next)) != 0; ) {
-            if (matchFilter(conn, filter, route, HTTP_STAGE_TX) == HTTP_ROUTE_OK) {
-                mprAddItem(tx->outputPipeline, filter);
-                mprLog(4, "Select output filter: \"%s\"", filter->name);
-                hasOutputFilters = 1;
-            }
-        }
-    }
-    if (tx->connector == 0) {
-        if (tx->handler == http->fileHandler && (rx->flags & HTTP_GET) && !hasOutputFilters && 
-                !conn->secure && httpShouldTrace(conn, HTTP_TRACE_TX, HTTP_TRACE_BODY, tx->ext) < 0) {
-            tx->connector = http->sendConnector;
-        } else if (route && route->connector) {
-            tx->connector = route->connector;
-        } else {
-            tx->connector = http->netConnector;
-        }
+    mprLog(5, "Open net connector");
+    if ((stage = httpCreateConnector(http, "netConnector", HTTP_STAGE_ALL, NULL)) == 0) {
+        return MPR_ERR_CANT_CREATE;
     }
-    mprAddItem(tx->outputPipeline, tx->connector);
-    mprLog(4, "Select connector: \"%s\"", tx->connector->name);
+    stage->close = netClose;
+    stage->outgoingService = netOutgoingService;
+    http->netConnector = stage;
+    return 0;
+}
 
-    /*  Create the outgoing queue heads and open the queues */
-    q = tx->queue[HTTP_QUEUE_TX];
-    for (next = 0; (stage = mprGetNextItem(tx->outputPipeline, &next)) != 0; ) {
-        q = httpCreateQueue(conn, stage, HTTP_QUEUE_TX, q);
-    }
-    conn->writeq = tx->queue[HTTP_QUEUE_TX]->nextQ;
-    conn->connectorq = tx->queue[HTTP_QUEUE_TX]->prevQ;
-    pairQueues(conn);
 
-    /*
-        Put the header before opening the queues incase an open routine actually services and completes the request
-        httpHandleOptionsTrace does this when called from openFile() in fileHandler.
-     */
-    httpPutForService(conn->writeq, httpCreateHeaderPacket(), HTTP_DELAY_SERVICE);
-    openQueues(conn);
+static void netClose(HttpQueue *q)
+{
+    HttpTx      *tx;
 
-    /*
-        Refinalize if httpFinalize was called before the Tx pipeline was created
-     */
-    if (conn->refinalize) {
-        conn->finalized = 0;
-        httpFinalize(conn);
+    tx = q->conn->tx;
+    if (tx->file) {
+        mprCloseFile(tx->file);
+        tx->file = 0;
     }
 }
 
 
-void httpCreateRxPipeline(HttpConn *conn, HttpRoute *route)
+static void netOutgoingService(HttpQueue *q)
 {
+    HttpConn    *conn;
     HttpTx      *tx;
-    HttpRx      *rx;
-    HttpQueue   *q;
-    HttpStage   *stage, *filter;
-    int         next;
-
-    mprAssert(conn);
-    mprAssert(route);
+    ssize       written;
+    int         errCode;
 
-    rx = conn->rx;
+    conn = q->conn;
     tx = conn->tx;
-    rx->inputPipeline = mprCreateList(-1, 0);
-    if (route) {
-        for (next = 0; (filter = mprGetNextItem(route->inputStages, &next)) != 0; ) {
-            if (matchFilter(conn, filter, route, HTTP_STAGE_RX) == HTTP_ROUTE_OK) {
-                mprAddItem(rx->inputPipeline, filter);
+    conn->lastActivity = conn->http->now;
+    mprAssert(conn->sock);
+    
+    if (!conn->sock || conn->connectorComplete) {
+        return;
+    }
+    if (tx->flags & HTTP_TX_NO_BODY) {
+        httpDiscardQueueData(q, 1);
+    }
+    if ((tx->bytesWritten + q->count) > conn->limits->transmissionBodySize) {
+        httpError(conn, HTTP_CODE_REQUEST_TOO_LARGE | ((tx->bytesWritten) ? HTTP_ABORT : 0),
+            "Http transmission aborted. Exceeded transmission max body of %,Ld bytes", conn->limits->transmissionBodySize);
+        if (tx->bytesWritten) {
+            httpConnectorComplete(conn);
+            return;
+        }
+    }
+    if (tx->flags & HTTP_TX_SENDFILE) {
+        /* Relay via the send connector */
+        if (tx->file == 0) {
+            if (tx->flags & HTTP_TX_HEADERS_CREATED) {
+                tx->flags &= ~HTTP_TX_SENDFILE;
+            } else {
+                tx->connector = conn->http->sendConnector;
+                httpSendOpen(q);
             }
         }
+        if (tx->file) {
+            httpSendOutgoingService(q);
+            return;
+        }
     }
-    mprAddItem(rx->inputPipeline, tx->handler);
+    while (q->first || q->ioIndex) {
+        if (q->ioIndex == 0 && buildNetVec(q) <= 0) {
+            break;
+        }
+        /*  
+            Issue a single I/O request to write all the blocks in the I/O vector. Complete responses are deferred 
+            while pipelined requests are waiting so they can be coalesced with following responses.
+         */
+        mprAssert(q->ioIndex > 0);
+        if (deferNetVec(q)) {
+            written = q->ioCount;
+        } else {
+            written = writeNetVec(q);
+        }
+        LOG(5, "Net connector wrote %d, written so far %Ld, q->count %d/%d", written, tx->bytesWritten, q->count, q->max);
+        if (written < 0) {
+            errCode = mprGetError(q);
+            if (errCode == EAGAIN || errCode == EWOULDBLOCK) {
+                /*  Socket full, wait for an I/O event */
+                httpSocketBlocked(conn);
+                break;
+            }
+            if (errCode != EPIPE && errCode != ECONNRESET) {
+                LOG(5, "netOutgoingService write failed, error %d", errCode);
+            }
+            httpError(conn, HTTP_ABORT | HTTP_CODE_COMMS_ERROR, "Write error %d", errCode);
+            httpConnectorComplete(conn);
+            break;
 
-    /*  Create the incoming queue heads and open the queues.  */
-    q = tx->queue[HTTP_QUEUE_RX];
-    for (next = 0; (stage = mprGetNextItem(rx->inputPipeline, &next)) != 0; ) {
-        q = httpCreateQueue(conn, stage, HTTP_QUEUE_RX, q);
+        } else if (written == 0) {
+            /*  Socket full, wait for an I/O event */
+            httpSocketBlocked(conn);
+            break;
+
+        } else if (written > 0) {
+            tx->bytesWritten += written;
+            freeNetPackets(q, written);
+            adjustNetVec(q, written);
+        }
     }
-    conn->readq = tx->queue[HTTP_QUEUE_RX]->prevQ;
-    if (!conn->endpoint) {
-        pairQueues(conn);
-        openQueues(conn);
+    if (q->ioCount == 0) {
+        if ((q->flags & HTTP_QUEUE_EOF)) {
+            httpConnectorComplete(conn);
+        } else {
+            httpNotifyWritable(conn);
+        }
     }
 }
 
 
-static void pairQueues(HttpConn *conn)
+/*
+    Defer writing a complete response if further pipelined requests have already been received. The I/O vector is 
+    appended to the connection deferred vector and written with the next response, or when httpPump runs out of 
+    requests to process. The packet buffers are retained until written. Return true if the I/O vector was deferred.
+ */
+static bool deferNetVec(HttpQueue *q)
 {
-    HttpTx      *tx;
-    HttpQueue   *q, *qhead, *rq, *rqhead;
+    HttpConn    *conn;
+    HttpPacket  *packet;
+    ssize       count;
 
-    tx = conn->tx;
-    qhead = tx->queue[HTTP_QUEUE_TX];
-    rqhead = tx->queue[HTTP_QUEUE_RX];
-    for (q = qhead->nextQ; q != qhead; q = q->nextQ) {
-        if (q->pair == 0) {
-            for (rq = rqhead->nextQ; rq != rqhead; rq = rq->nextQ) {
-                if (q->stage == rq->stage) {
-                    q->pair = rq;
-                    rq->pair = q;
-                }
-            }
+    conn = q->conn;
+    if (!conn->endpoint || !(q->flags & HTTP_QUEUE_EOF) || conn->keepAliveCount <= 0 || 
+            !conn->input || httpGetPacketLength(conn->input) == 0) {
+        return 0;
+    }
+    if ((httpGetDeferredLength(conn) + q->ioCount) > HTTP_MAX_DEFERRED || 
+            (conn->deferredIndex + q->ioIndex) > HTTP_MAX_IOVEC) {
+        return 0;
+    }
+    if (conn->deferredVec == 0) {
+        if ((conn->deferredVec = mprAlloc(HTTP_MAX_IOVEC * sizeof(MprIOVec))) == 0) {
+            return 0;
+        }
+        if ((conn->deferredPackets = mprCreateList(0, 0)) == 0) {
+            return 0;
         }
     }
-}
-
-
-static void openQueues(HttpConn *conn)
-{
-    HttpTx      *tx;
-    HttpQueue   *q, *qhead;
-    int         i;
-
-    tx = conn->tx;
-    for (i = 0; i < HTTP_MAX_QUEUE; i++) {
-        qhead = tx->queue[i];
-        for (q = qhead->nextQ; q != qhead; q = q->nextQ) {
-            if (q->open && !(q->flags & (HTTP_QUEUE_OPEN))) {
-                if (q->pair == 0 || !(q->pair->flags & HTTP_QUEUE_OPEN)) {
-                    q->flags |= HTTP_QUEUE_OPEN;
-                    httpOpenQueue(q, conn->tx->chunkSize);
-                }
-            }
+    /*
+        The vector references whole packets from the front of the queue. Keep the buffers as the packets are
+        removed from the queue once the vector is accounted as written.
+     */
+    for (count = 0, packet = q->first; packet && count < q->ioCount; packet = packet->next) {
+        if (packet->prefix) {
+            mprAddItem(conn->deferredPackets, packet->prefix);
+            count += mprGetBufLength(packet->prefix);
+        }
+        if (packet->content) {
+            mprAddItem(conn->deferredPackets, packet->content);
+            count += mprGetBufLength(packet->content);
         }
     }
+    memcpy(&conn->deferredVec[conn->deferredIndex], q->iovec, q->ioIndex * sizeof(MprIOVec));
+    conn->deferredIndex += q->ioIndex;
+    conn->deferredCount += q->ioCount;
+    LOG(6, "Net connector deferred %d, total deferred %d", q->ioCount, httpGetDeferredLength(conn));
+    return 1;
 }
 
 
-void httpSetPipelineHandler(HttpConn *conn, HttpStage *handler)
+/*
+    Write the I/O vector preceded by any deferred response data. Return the count of bytes written from the I/O vector.
+ */
+static ssize writeNetVec(HttpQueue *q)
 {
-    conn->tx->handler = (handler) ? handler : conn->http->passHandler;
+    HttpConn    *conn;
+    MprIOVec    iovec[(HTTP_MAX_IOVEC * 2) + 1];
+    ssize       written;
+    int         count;
+
+    conn = q->conn;
+    if (httpGetDeferredLength(conn) == 0) {
+        return mprWriteSocketVector(conn->sock, q->iovec, q->ioIndex);
+    }
+    count = httpGetDeferredVec(conn, iovec);
+    memcpy(&iovec[count], q->iovec, q->ioIndex * sizeof(MprIOVec));
+    if ((written = mprWriteSocketVector(conn->sock, iovec, count + q->ioIndex)) <= 0) {
+        return written;
+    }
+    return httpAdjustDeferred(conn, written);
 }
 
 
-void httpSetSendConnector(HttpConn *conn, cchar *path)
+/*
+    Build the IO vector. Return the count of bytes to be written. Return -1 for EOF.
+ */
+static MprOff buildNetVec(HttpQueue *q)
 {
-#if !BIT_ROM
+    HttpConn    *conn;
     HttpTx      *tx;
+    HttpPacket  *packet;
 
+    conn = q->conn;
     tx = conn->tx;
-    tx->flags |= HTTP_TX_SENDFILE;
-    tx->filename = sclone(path);
-#else
-    mprError("Send connector not available if ROMFS enabled");
-#endif
-}
 
+    /*
+        Examine each packet and accumulate as many packets into the I/O vector as possible. Leave the packets on the queue 
+        for now, they are removed after the IO is complete for the entire packet.
+     */
+    for (packet = q->first; packet; packet = packet->next) {
+        if (packet->flags & HTTP_PACKET_HEADER) {
+            if (tx->chunkSize <= 0 && q->count > 0 && tx->length < 0) {
+                /* Incase no chunking filter and we've not seen all the data yet */
+                conn->keepAliveCount = 0;
+            }
+            httpWriteHeaders(conn, packet);
+            q->count += httpGetPacketLength(packet);
 
-void httpDestroyPipeline(HttpConn *conn)
-{
-    HttpTx      *tx;
-    HttpQueue   *q, *qhead;
-    int         i;
-
-    tx = conn->tx;
-    if (tx) {
-        for (i = 0; i < HTTP_MAX_QUEUE; i++) {
-            qhead = tx->queue[i];
-            for (q = qhead->nextQ; q != qhead; q = q->nextQ) {
-                if (q->close && q->flags & HTTP_QUEUE_OPEN) {
-                    q->flags &= ~HTTP_QUEUE_OPEN;
-                    q->stage->close(q);
-                }
+        } else if (httpGetPacketLength(packet) == 0) {
+            q->flags |= HTTP_QUEUE_EOF;
+            if (packet->prefix == NULL) {
+                break;
             }
         }
+        if (q->ioIndex >= (HTTP_MAX_IOVEC - 2)) {
+            break;
+        }
+        addPacketForNet(q, packet);
     }
+    return q->ioCount;
 }
 
 
-void httpStartPipeline(HttpConn *conn)
+/*
+    Add one entry to the io vector
+ */
+static void addToNetVector(HttpQueue *q, char *ptr, ssize bytes)
 {
-    HttpQueue   *qhead, *q, *prevQ, *nextQ;
-    HttpTx      *tx;
-    HttpRx      *rx;
-    
-    tx = conn->tx;
-    tx->started = 1;
-    rx = conn->rx;
-    if (rx->needInputPipeline) {
-        qhead = tx->queue[HTTP_QUEUE_RX];
-        for (q = qhead->nextQ; !conn->error && q->nextQ != qhead; q = nextQ) {
-            nextQ = q->nextQ;
-            if (q->start && !(q->flags & HTTP_QUEUE_STARTED)) {
-                if (q->pair == 0 || !(q->pair->flags & HTTP_QUEUE_STARTED)) {
-                    q->flags |= HTTP_QUEUE_STARTED;
-                    q->stage->start(q);
-                }
-            }
-        }
-    }
-    qhead = tx->queue[HTTP_QUEUE_TX];
-    for (q = qhead->prevQ; !conn->error && q->prevQ != qhead; q = prevQ) {
-        prevQ = q->prevQ;
-        if (q->start && !(q->flags & HTTP_QUEUE_STARTED)) {
-            q->flags |= HTTP_QUEUE_STARTED;
-            q->stage->start(q);
-        }
-    }
-    /* Start the handler last */
-    q = qhead->nextQ;
-    if (q->start && !conn->error) {
-        mprAssert(!(q->flags & HTTP_QUEUE_STARTED));
-        q->flags |= HTTP_QUEUE_STARTED;
-        q->stage->start(q);
-    }
-    if (!conn->error && !conn->connectorComplete && rx->remainingContent > 0) {
-        /* If no remaining content, wait till the processing stage to avoid duplicate writable events */
-        httpNotifyWritable(conn);
-    }
+    mprAssert(bytes > 0);
+
+    q->iovec[q->ioIndex].start = ptr;
+    q->iovec[q->ioIndex].len = bytes;
+    q->ioCount += bytes;
+    q->ioIndex++;
 }
 
 
-void httpReadyHandler(HttpConn *conn)
+/*
+    Add a packet to the io vector. Return the number of bytes added to the vector.
+ */
+static void addPacketForNet(HttpQueue *q, HttpPacket *packet)
 {
-    HttpQueue   *q;
-    
-    q = conn->writeq;
-    if (q->stage->ready && !conn->error) {
-        q->stage->ready(q);
-    }
-}
+    HttpTx      *tx;
+    HttpConn    *conn;
+    int         item;
 
+    conn = q->conn;
+    tx = conn->tx;
 
-int httpProcessHandler(HttpConn *conn)
-{
-    HttpQueue   *q;
-    
-    q = conn->writeq;
-    if (!q->stage->writable) {
-       return 0;
+    mprAssert(q->count >= 0);
+    mprAssert(q->ioIndex < (HTTP_MAX_IOVEC - 2));
+
+    if (packet->prefix) {
+        addToNetVector(q, mprGetBufStart(packet->prefix), mprGetBufLength(packet->prefix));
     }
-    if (!conn->finalized) {
-        q->stage->writable(q);
-        if (q->count > 0) {
-            httpScheduleQueue(q);
-            httpServiceQueues(conn);
-        }
+    if (httpGetPacketLength(packet) > 0) {
+        addToNetVector(q, mprGetBufStart(packet->content), mprGetBufLength(packet->content));
+    }
+    item = (packet->flags & HTTP_PACKET_HEADER) ? HTTP_TRACE_HEADER : HTTP_TRACE_BODY;
+    if (httpShouldTrace(conn, HTTP_TRACE_TX, item, tx->ext) >= 0) {
+        httpTraceContent(conn, HTTP_TRACE_TX, item, packet, 0, (ssize) tx->bytesWritten);
     }
-    return 1;
 }
 
 
-/*  
-    Run the queue service routines until there is no more work to be done. NOTE: all I/O is non-blocking.
- */
-bool httpServiceQueues(HttpConn *conn)
+static void freeNetPackets(HttpQueue *q, ssize bytes)
 {
-    HttpQueue   *q;
-    int         workDone;
+    HttpPacket    *packet;
+    ssize         len;
 
-    workDone = 0;
-    while (conn->state < HTTP_STATE_COMPLETE && (q = httpGetNextQueueForService(conn->serviceq)) != NULL) {
-        if (q->servicing) {
-            q->flags |= HTTP_QUEUE_RESERVICE;
-        } else {
-            mprAssert(q->schedulePrev == q->scheduleNext);
-            httpServiceQueue(q);
-            workDone = 1;
+    mprAssert(q->count >= 0);
+    mprAssert(bytes >= 0);
+
+    while (bytes > 0 && (packet = q->first) != 0) {
+        if (packet->prefix) {
+            len = mprGetBufLength(packet->prefix);
+            len = min(len, bytes);
+            mprAdjustBufStart(packet->prefix, len);
+            bytes -= len;
+            /* Prefixes don't count in the q->count. No need to adjust */
+            if (mprGetBufLength(packet->prefix) == 0) {
+                packet->prefix = 0;
+            }
+        }
+        if (packet->content) {
+            len = mprGetBufLength(packet->content);
+            len = min(len, bytes);
+            mprAdjustBufStart(packet->content, len);
+            bytes -= len;
+            q->count -= len;
+            mprAssert(q->count >= 0);
+        }
+        if (packet->content == 0 || mprGetBufLength(packet->content) == 0) {
+            /*
+                This will remove the packet from the queue and will re-enable upstream disabled queues.
+             */
+            httpGetPacket(q);
         }
     }
-    return workDone;
 }
 
 
-void httpDiscardData(HttpConn *conn, int dir)
+/*
+    Clear entries from the IO vector that have actually been transmitted. Support partial writes.
+ */
+static void adjustNetVec(HttpQueue *q, ssize written)
 {
-    HttpTx      *tx;
-    HttpQueue   *q, *qhead;
-
-    tx = conn->tx;
-    if (tx == 0) {
-        return;
-    }
-    qhead = tx->queue[dir];
-    for (q = qhead->nextQ; q != qhead; q = q->nextQ) {
-        httpDiscardQueueData(q, 1);
-    }
-}
-
+    MprIOVec    *iovec;
+    ssize       len;
+    int         i, j;
 
-static bool matchFilter(HttpConn *conn, HttpStage *filter, HttpRoute *route, int dir)
-{
-    HttpTx      *tx;
+    /*
+        Cleanup the IO vector
+     */
+    if (written == q->ioCount) {
+        /*
+            Entire vector written. Just reset.
+         */
+        q->ioIndex = 0;
+        q->ioCount = 0;
 
-    tx = conn->tx;
-    if (filter->match) {
-        return filter->match(conn, route, dir);
-    }
-    if (filter->extensions && tx->ext) {
-        return mprLookupKey(filter->extensions, tx->ext) != 0;
+    } else {
+        /*
+            Partial write of an vector entry. Need to copy down the unwritten vector entries.
+         */
+        q->ioCount -= written;
+        mprAssert(q->ioCount >= 0);
+        iovec = q->iovec;
+        for (i = 0; i < q->ioIndex; i++) {
+            len = iovec[i].len;
+            if (written < len) {
+                iovec[i].start += written;
+                iovec[i].len -= written;
+                break;
+            } else {
+                written -= len;
+            }
+        }
+        /*
+            Compact
+         */
+        for (j = 0; i < q->ioIndex; ) {
+            iovec[j++] = iovec[i++];
+        }
+        q->ioIndex = j;
     }
-    return 1;
 }
 
 
@@ -6694,14 +7807,12 @@ static bool matchFilter(HttpConn *conn, HttpStage *filter, HttpRoute *route, int
 
 /************************************************************************/
 /*
-    Start of file "src/procHandler.c"
+    Start of file "src/packet.c"
  */
 /************************************************************************/
 
 /*
-    procHandler.c -- Procedure callback handler
-
-    This handler maps URIs to procction names that have been registered via httpDefineProc.
+    packet.c -- Queue support routines. Queues are the bi-directional data flow channels for the pipeline.
 
     Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
  */
@@ -6710,679 +7821,739 @@ static bool matchFilter(HttpConn *conn, HttpStage *filter, HttpRoute *route, int
 
 
 
-/*********************************** Code *************************************/
-
-static void startProc(HttpQueue *q)
-{
-    HttpConn    *conn;
-    HttpProc     proc;
-    cchar       *name;
-
-    mprLog(5, "Start procHandler");
-    conn = q->conn;
-    name = conn->rx->pathInfo;
-    if ((proc = mprLookupKey(conn->tx->handler->stageData, name)) == 0) {
-        mprError("Can't find procction callback %s", name);
-    } else {
-        (*proc)(conn);
-    }
-}
+/********************************** Forwards **********************************/
 
+static void managePacket(HttpPacket *packet, int flags);
+static int unsharePacket(HttpPacket *packet, ssize room);
 
-void httpDefineProc(cchar *name, HttpProc proc)
+/************************************ Code ************************************/
+/*  
+    Create a new packet. If size is -1, then also create a default growable buffer -- 
+    used for incoming body content. If size > 0, then create a non-growable buffer 
+    of the requested size.
+ */
+HttpPacket *httpCreatePacket(ssize size)
 {
-    HttpStage   *stage;
+    HttpPacket  *packet;
 
-    if ((stage = httpLookupStage(MPR->httpService, "procHandler")) == 0) {
-        mprError("Can't find procHandler");
-        return;
+    if ((packet = mprAllocObj(HttpPacket, managePacket)) == 0) {
+        return 0;
     }
-    mprAddKey(stage->stageData, name, proc);
+    if (size != 0) {
+        if ((packet->content = mprCreateBuf(size < 0 ? HTTP_BUFSIZE: (ssize) size, -1)) == 0) {
+            return 0;
+        }
+    }
+    return packet;
 }
 
 
-int httpOpenProcHandler(Http *http)
+static void managePacket(HttpPacket *packet, int flags)
 {
-    HttpStage     *stage;
-
-    if ((stage = httpCreateHandler(http, "procHandler", HTTP_STAGE_ALL, NULL)) == 0) {
-        return MPR_ERR_CANT_CREATE;
-    }
-    http->procHandler = stage;
-    if ((stage->stageData = mprCreateHash(0, MPR_HASH_STATIC_VALUES)) == 0) {
-        return MPR_ERR_MEMORY;
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(packet->prefix);
+        mprMark(packet->content);
+        mprMark(packet->upload);
+        /* Don't mark next packet. List owner will mark */
     }
-    stage->start = startProc;
-    return 0;
 }
 
 
-/*
-    @copy   default
-
-    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
-
-    This software is distributed under commercial and open source licenses.
-    You may use the Embedthis Open Source license or you may acquire a 
-    commercial license from Embedthis Software. You agree to be fully bound
-    by the terms of either license. Consult the LICENSE.md distributed with
-    this software for full details and other copyrights.
-
-    Local variables:
-    tab-width: 4
-    c-basic-offset: 4
-    End:
-    vim: sw=4 ts=4 expandtab
-
-    @end
- */
+HttpPacket *httpCreateDataPacket(ssize size)
+{
+    HttpPacket    *packet;
 
-/************************************************************************/
-/*
-    Start of file "src/queue.c"
- */
-/************************************************************************/
+    if ((packet = httpCreatePacket(size)) == 0) {
+        return 0;
+    }
+    packet->flags = HTTP_PACKET_DATA;
+    return packet;
+}
 
-/*
-    queue.c -- Queue support routines. Queues are the bi-directional data flow channels for the pipeline.
-    Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
- */
 
-/********************************* Includes ***********************************/
+HttpPacket *httpCreateEntityPacket(MprOff pos, MprOff size, HttpFillProc fill)
+{
+    HttpPacket    *packet;
 
+    if ((packet = httpCreatePacket(0)) == 0) {
+        return 0;
+    }
+    packet->flags = HTTP_PACKET_DATA;
+    packet->epos = pos;
+    packet->esize = size;
+    packet->fill = fill;
+    return packet;
+}
 
 
-/********************************** Forwards **********************************/
+HttpPacket *httpCreateEndPacket()
+{
+    HttpPacket    *packet;
 
-static void manageQueue(HttpQueue *q, int flags);
+    if ((packet = httpCreatePacket(0)) == 0) {
+        return 0;
+    }
+    packet->flags = HTTP_PACKET_END;
+    return packet;
+}
 
-/************************************ Code ************************************/
 
-HttpQueue *httpCreateQueueHead(HttpConn *conn, cchar *name)
+HttpPacket *httpCreateHeaderPacket()
 {
-    HttpQueue   *q;
+    HttpPacket    *packet;
 
-    if ((q = mprAllocObj(HttpQueue, manageQueue)) == 0) {
+    if ((packet = httpCreatePacket(HTTP_BUFSIZE)) == 0) {
         return 0;
     }
-    httpInitQueue(conn, q, name);
-    httpInitSchedulerQueue(q);
-    return q;
+    packet->flags = HTTP_PACKET_HEADER;
+    return packet;
 }
 
 
-HttpQueue *httpCreateQueue(HttpConn *conn, HttpStage *stage, int dir, HttpQueue *prev)
+HttpPacket *httpClonePacket(HttpPacket *orig)
 {
-    HttpQueue   *q;
+    HttpPacket  *packet;
 
-    if ((q = mprAllocObj(HttpQueue, manageQueue)) == 0) {
+    if ((packet = httpCreatePacket(0)) == 0) {
         return 0;
     }
-    q->conn = conn;
-    httpInitQueue(conn, q, stage->name);
-    httpInitSchedulerQueue(q);
-    httpAssignQueue(q, stage, dir);
-    if (prev) {
-        httpAppendQueue(prev, q);
+    if (orig->content) {
+        packet->content = mprCloneBuf(orig->content);
     }
-    return q;
+    if (orig->prefix) {
+        packet->prefix = mprCloneBuf(orig->prefix);
+    }
+    packet->flags = orig->flags;
+    packet->esize = orig->esize;
+    packet->epos = orig->epos;
+    packet->fill = orig->fill;
+    packet->upload = orig->upload;
+    return packet;
 }
 
 
-static void manageQueue(HttpQueue *q, int flags)
+void httpAdjustPacketStart(HttpPacket *packet, MprOff size)
 {
-    HttpPacket      *packet;
-
-    if (flags & MPR_MANAGE_MARK) {
-        mprMark(q->owner);
-        for (packet = q->first; packet; packet = packet->next) {
-            mprMark(packet);
-        }
-        mprMark(q->last);
-        mprMark(q->nextQ);
-        mprMark(q->prevQ);
-        mprMark(q->stage);
-        mprMark(q->conn);
-        mprMark(q->scheduleNext);
-        mprMark(q->schedulePrev);
-        mprMark(q->pair);
-        mprMark(q->queueData);
-        mprMark(q->queueData);
-        if (q->nextQ && q->nextQ->stage) {
-            /* Not a queue head */
-            mprMark(q->nextQ);
-        }
+    if (packet->esize) {
+        packet->epos += size;
+        packet->esize -= size;
+    } else if (packet->content) {
+        mprAdjustBufStart(packet->content, (ssize) size);
     }
 }
 
 
-void httpAssignQueue(HttpQueue *q, HttpStage *stage, int dir)
+void httpAdjustPacketEnd(HttpPacket *packet, MprOff size)
 {
-    q->stage = stage;
-    q->close = stage->close;
-    q->open = stage->open;
-    q->start = stage->start;
-    if (dir == HTTP_QUEUE_TX) {
-        q->put = stage->outgoing;
-        q->service = stage->outgoingService;
-    } else {
-        q->put = stage->incoming;
-        q->service = stage->incomingService;
+    if (packet->esize) {
+        packet->esize += size;
+    } else if (packet->content) {
+        mprAdjustBufEnd(packet->content, (ssize) size);
     }
-    q->owner = stage->name;
 }
 
 
-void httpInitQueue(HttpConn *conn, HttpQueue *q, cchar *name)
+HttpPacket *httpGetPacket(HttpQueue *q)
 {
-    q->conn = conn;
-    q->nextQ = q;
-    q->prevQ = q;
-    q->owner = sclone(name);
-    q->packetSize = conn->limits->stageBufferSize;
-    q->max = conn->limits->stageBufferSize;
-    q->low = q->max / 100 *  5;    
+    HttpQueue     *prev;
+    HttpPacket    *packet;
+
+    while (q->first) {
+        if ((packet = q->first) != 0) {
+            q->first = packet->next;
+            packet->next = 0;
+            q->count -= httpGetPacketLength(packet);
+            mprAssert(q->count >= 0);
+            if (packet == q->last) {
+                q->last = 0;
+                mprAssert(q->first == 0);
+            }
+        }
+        if (q->count < q->low) {
+            /*
+                This queue was full and now is below the low water mark. Back-enable the previous queue.
+             */
+            prev = httpFindPreviousQueue(q);
+            if (prev && prev->flags & HTTP_QUEUE_SUSPENDED) {
+                httpResumeQueue(prev);
+            }
+        }
+        return packet;
+    }
+    return 0;
 }
 
 
-#if UNUSED &&KEEP
 /*  
-    Insert a queue after the previous element
+    Test if the packet is too too large to be accepted by the downstream queue.
  */
-void httpAppendQueueToHead(HttpQueue *head, HttpQueue *q)
+bool httpIsPacketTooBig(HttpQueue *q, HttpPacket *packet)
 {
-    q->nextQ = head;
-    q->prevQ = head->prevQ;
-    head->prevQ->nextQ = q;
-    head->prevQ = q;
+    ssize   size;
+    
+    size = mprGetBufLength(packet->content);
+    return size > q->max || size > q->packetSize;
 }
-#endif
 
 
-void httpSuspendQueue(HttpQueue *q)
+/*  
+    Join a packet onto the service queue. This joins packet content data.
+ */
+void httpJoinPacketForService(HttpQueue *q, HttpPacket *packet, bool serviceQ)
 {
-    mprLog(7, "Suspend q %s", q->owner);
-    q->flags |= HTTP_QUEUE_SUSPENDED;
+    if (q->first == 0) {
+        /*  Just use the service queue as a holding queue while we aggregate the post data.  */
+        httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+
+    } else if ((packet->flags | q->first->flags) & HTTP_PACKET_SHARED) {
+        /* Shared frames keep their own frame header so they are queued separately */
+        httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+        mprAssert(httpVerifyQueue(q));
+        if (serviceQ && !(q->flags & HTTP_QUEUE_SUSPENDED))  {
+            httpScheduleQueue(q);
+        }
+        return;
+
+    } else {
+        /* Skip over the header packet */
+        if (q->first && q->first->flags & HTTP_PACKET_HEADER) {
+            packet = q->first->next;
+            q->first = packet;
+        } else {
+            /* Aggregate all data into one packet and free the packet.  */
+            httpJoinPacket(q->first, packet);
+        }
+        q->count += httpGetPacketLength(packet);
+    }
+    mprAssert(httpVerifyQueue(q));
+    if (serviceQ && !(q->flags & HTTP_QUEUE_SUSPENDED))  {
+        httpScheduleQueue(q);
+    }
 }
 
 
 /*  
-    Remove all data in the queue. If removePackets is true, actually remove the packet too.
-    This preserves the header and EOT packets.
+    Join two packets by pulling the content from the second into the first.
+    WARNING: this will not update the queue count. Assumes the either both are on the queue or neither. 
  */
-void httpDiscardQueueData(HttpQueue *q, bool removePackets)
+int httpJoinPacket(HttpPacket *packet, HttpPacket *p)
 {
-    HttpPacket  *packet, *prev, *next;
-    ssize       len;
+    ssize   len;
 
-    if (q == 0) {
-        return;
+    mprAssert(packet->esize == 0);
+    mprAssert(p->esize == 0);
+
+    len = httpGetPacketLength(p);
+    if (unsharePacket(packet, len) < 0) {
+        return MPR_ERR_MEMORY;
     }
-    for (prev = 0, packet = q->first; packet; packet = next) {
-        next = packet->next;
-        if (packet->flags & (HTTP_PACKET_RANGE | HTTP_PACKET_DATA)) {
-            if (removePackets) {
-                if (prev) {
-                    prev->next = next;
-                } else {
-                    q->first = next;
-                }
-                if (packet == q->last) {
-                    q->last = prev;
-                }
-                q->count -= httpGetPacketLength(packet);
-                mprAssert(q->count >= 0);
-                continue;
-            } else {
-                len = httpGetPacketLength(packet);
-                q->conn->tx->length -= len;
-                q->count -= len;
-                mprAssert(q->count >= 0);
-                if (packet->content) {
-                    mprFlushBuf(packet->content);
-                }
-            }
-        }
-        prev = packet;
+    if (mprPutBlockToBuf(packet->content, mprGetBufStart(p->content), (ssize) len) != len) {
+        mprAssert(0);
+        return MPR_ERR_MEMORY;
     }
+    return 0;
 }
 
 
-/*  
-    Flush queue data by scheduling the queue and servicing all scheduled queues. Return true if there is room for more data.
-    If blocking is requested, the call will block until the queue count falls below the queue max.
-    WARNING: Be very careful when using blocking == true. Should only be used by end applications and not by middleware.
+/*
+    Give a packet a private copy of shared content before it is modified. Room is the additional space required.
  */
-bool httpFlushQueue(HttpQueue *q, bool blocking)
+static int unsharePacket(HttpPacket *packet, ssize room)
 {
-    HttpConn    *conn;
-    HttpQueue   *next;
+    MprBuf  *content;
+    ssize   len;
 
-    conn = q->conn;
-    mprAssert(conn->sock);
-    do {
-        httpScheduleQueue(q);
-        next = q->nextQ;
-        if (next->count >= next->max) {
-            httpScheduleQueue(next);
-        }
-        httpServiceQueues(conn);
-        if (conn->sock == 0) {
-            break;
-        }
-    } while (blocking && q->count > 0);
-    return (q->count < q->max) ? 1 : 0;
+    if (!(packet->flags & HTTP_PACKET_SHARED)) {
+        return 0;
+    }
+    len = httpGetPacketLength(packet);
+    if ((content = mprCreateBuf(len + room, -1)) == 0) {
+        return MPR_ERR_MEMORY;
+    }
+    if (len > 0) {
+        mprPutBlockToBuf(content, mprGetBufStart(packet->content), len);
+    }
+    packet->content = content;
+    packet->flags &= ~HTTP_PACKET_SHARED;
+    return 0;
 }
 
 
-void httpResumeQueue(HttpQueue *q)
+/*
+    Join queue packets up to the maximum of the given size and the downstream queue packet size. Shared packets are 
+    not joined as their frame header must precede their data.
+    WARNING: this will not update the queue count.
+ */
+void httpJoinPackets(HttpQueue *q, ssize size)
 {
-    mprLog(7, "Enable q %s", q->owner);
-    q->flags &= ~HTTP_QUEUE_SUSPENDED;
-    httpScheduleQueue(q);
-}
-
+    HttpPacket  *packet, *first;
+    ssize       len, total;
 
-HttpQueue *httpFindPreviousQueue(HttpQueue *q)
-{
-    while (q->prevQ) {
-        q = q->prevQ;
-        if (q->service) {
-            return q;
+    if (size < 0) {
+        size = MAXINT;
+    }
+    if ((first = q->first) != 0 && first->next) {
+        if (first->flags & HTTP_PACKET_HEADER) {
+            /* Step over a header packet */
+            first = first->next;
+        }
+        /*
+            Grow the first packet once to hold all the data rather than growing for each joined packet
+         */
+        for (total = 0, packet = first->next; packet; packet = packet->next) {
+            if (packet->content == 0 || (len = httpGetPacketLength(packet)) == 0 || 
+                    (packet->flags & HTTP_PACKET_SHARED)) {
+                break;
+            }
+            total += len;
+        }
+        if (total == 0 || (first->flags & HTTP_PACKET_SHARED)) {
+            return;
+        }
+        if (first->content && total > mprGetBufSpace(first->content)) {
+            mprGrowBuf(first->content, total - mprGetBufSpace(first->content));
+        }
+        for (packet = first->next; packet; packet = packet->next) {
+            if (packet->content == 0 || (len = httpGetPacketLength(packet)) == 0 || 
+                    (packet->flags & HTTP_PACKET_SHARED)) {
+                break;
+            }
+            mprAssert(!(packet->flags & HTTP_PACKET_END));
+            httpJoinPacket(first, packet);
+            /* Unlink the packet */
+            first->next = packet->next;
         }
     }
-    return 0;
 }
 
 
-HttpQueue *httpGetNextQueueForService(HttpQueue *q)
+void httpPutPacket(HttpQueue *q, HttpPacket *packet)
 {
-    HttpQueue     *next;
-    
-    if (q->scheduleNext != q) {
-        next = q->scheduleNext;
-        next->schedulePrev->scheduleNext = next->scheduleNext;
-        next->scheduleNext->schedulePrev = next->schedulePrev;
-        next->schedulePrev = next->scheduleNext = next;
-        return next;
-    }
-    return 0;
+    mprAssert(packet);
+    mprAssert(q->put);
+
+    q->put(q, packet);
 }
 
 
 /*  
-    Return the number of bytes the queue will accept. Always positive.
+    Pass to the next stage in the pipeline
  */
-ssize httpGetQueueRoom(HttpQueue *q)
+void httpPutPacketToNext(HttpQueue *q, HttpPacket *packet)
 {
-    mprAssert(q->max > 0);
-    mprAssert(q->count >= 0);
-    
-    if (q->count >= q->max) {
-        return 0;
-    }
-    return q->max - q->count;
+    mprAssert(packet);
+    mprAssert(q->nextQ->put);
+
+    q->nextQ->put(q->nextQ, packet);
 }
 
 
-void httpInitSchedulerQueue(HttpQueue *q)
+void httpPutPackets(HttpQueue *q)
 {
-    q->scheduleNext = q;
-    q->schedulePrev = q;
+    HttpPacket    *packet;
+
+    for (packet = httpGetPacket(q); packet; packet = httpGetPacket(q)) {
+        httpPutPacketToNext(q, packet);
+    }
 }
 
 
 /*  
-    Append a queue after the previous element
+    Put the packet back at the front of the queue
  */
-void httpAppendQueue(HttpQueue *prev, HttpQueue *q)
+void httpPutBackPacket(HttpQueue *q, HttpPacket *packet)
 {
-    q->nextQ = prev->nextQ;
-    q->prevQ = prev;
-    prev->nextQ->prevQ = q;
-    prev->nextQ = q;
+    mprAssert(packet);
+    mprAssert(packet->next == 0);
+    mprAssert(q->count >= 0);
+    
+    if (packet) {
+        packet->next = q->first;
+        if (q->first == 0) {
+            q->last = packet;
+        }
+        q->first = packet;
+        q->count += httpGetPacketLength(packet);
+    }
 }
 
 
-bool httpIsQueueEmpty(HttpQueue *q)
+/*  
+    Put a packet on the service queue.
+ */
+void httpPutForService(HttpQueue *q, HttpPacket *packet, bool serviceQ)
 {
-    return q->first == 0;
+    mprAssert(packet);
+   
+    q->count += httpGetPacketLength(packet);
+    packet->next = 0;
+    
+    if (q->first) {
+        q->last->next = packet;
+        q->last = packet;
+    } else {
+        q->first = packet;
+        q->last = packet;
+    }
+    if (serviceQ && !(q->flags & HTTP_QUEUE_SUSPENDED))  {
+        httpScheduleQueue(q);
+    }
 }
 
 
-int httpOpenQueue(HttpQueue *q, ssize chunkSize)
+/*  
+    Resize and possibly split a packet so it fits in the downstream queue. Put back the 2nd portion of the split packet 
+    on the queue. Ensure that the packet is not larger than "size" if it is greater than zero. If size < 0, then
+    use the default packet size. 
+ */
+int httpResizePacket(HttpQueue *q, HttpPacket *packet, ssize size)
 {
-    Http        *http;
-    HttpConn    *conn;
-    HttpStage   *stage;
-    MprModule   *module;
-
-    stage = q->stage;
-    conn = q->conn;
-    http = q->conn->http;
-
-    if (chunkSize > 0) {
-        q->packetSize = min(q->packetSize, chunkSize);
+    HttpPacket  *tail;
+    ssize       len;
+    
+    if (size <= 0) {
+        size = MAXINT;
     }
-    if (stage->flags & HTTP_STAGE_UNLOADED && stage->module) {
-        module = stage->module;
-        module = mprCreateModule(module->name, module->path, module->entry, http);
-        if (mprLoadModule(module) < 0) {
-            httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Can't load module %s", module->name);
-            return MPR_ERR_CANT_READ;
+    if (packet->esize > size) {
+        if ((tail = httpSplitPacket(packet, size)) == 0) {
+            return MPR_ERR_MEMORY;
+        }
+    } else {
+        /*  
+            Calculate the size that will fit downstream
+         */
+        len = packet->content ? httpGetPacketLength(packet) : 0;
+        size = min(size, len);
+        size = min(size, q->nextQ->max);
+        size = min(size, q->nextQ->packetSize);
+        if (size == 0 || size == len) {
+            return 0;
+        }
+        if ((tail = httpSplitPacket(packet, size)) == 0) {
+            return MPR_ERR_MEMORY;
         }
-        stage->module = module;
-    }
-    if (stage->module) {
-        stage->module->lastActivity = http->now;
-    }
-    q->flags |= HTTP_QUEUE_OPEN;
-    if (q->open) {
-        q->stage->open(q);
     }
+    httpPutBackPacket(q, tail);
     return 0;
 }
 
 
 /*  
-    Read data. If sync mode, this will block. If async, will never block.
-    Will return what data is available up to the requested size. Returns a byte count.
+    Split a packet at a given offset and return a new packet containing the data after the offset.
+    The prefix data remains with the original packet. 
  */
-ssize httpRead(HttpConn *conn, char *buf, ssize size)
+HttpPacket *httpSplitPacket(HttpPacket *orig, ssize offset)
 {
     HttpPacket  *packet;
-    HttpQueue   *q;
-    MprBuf      *content;
-    ssize       nbytes, len;
 
-    q = conn->readq;
-    mprAssert(q->count >= 0);
-    mprAssert(size >= 0);
-    mprAssert(httpVerifyQueue(q));
-
-    while (q->count <= 0 && !conn->async && !conn->error && conn->sock && (conn->state <= HTTP_STATE_CONTENT)) {
-        httpServiceQueues(conn);
-        if (conn->sock) {
-            httpWait(conn, 0, MPR_TIMEOUT_NO_BUSY);
+    if (orig->esize) {
+        if ((packet = httpCreateEntityPacket(orig->epos + offset, orig->esize - offset, orig->fill)) == 0) {
+            return 0;
         }
-    }
-    //  MOB - better place for this?
-    conn->lastActivity = conn->http->now;
-    mprAssert(httpVerifyQueue(q));
+        orig->esize = offset;
 
-    for (nbytes = 0; size > 0 && q->count > 0; ) {
-        if ((packet = q->first) == 0) {
-            break;
+    } else {
+        if (offset >= httpGetPacketLength(orig)) {
+            mprAssert(offset < httpGetPacketLength(orig));
+            return 0;
         }
-        content = packet->content;
-        len = mprGetBufLength(content);
-        len = min(len, size);
-        mprAssert(len <= q->count);
-        if (len > 0) {
-            len = mprGetBlockFromBuf(content, buf, len);
-            mprAssert(len <= q->count);
+        /*
+            The packets share the content memory without copying. Each packet owns a separate region of the memory.
+         */
+        if ((packet = httpCreatePacket(0)) == 0) {
+            return 0;
         }
-        buf += len;
-        size -= len;
-        q->count -= len;
-        mprAssert(q->count >= 0);
-        nbytes += len;
-        if (mprGetBufLength(content) == 0) {
-            httpGetPacket(q);
+        if ((packet->content = mprSplitBuf(orig->content, offset)) == 0) {
+            return 0;
         }
     }
-    mprAssert(q->count >= 0);
-    mprAssert(httpVerifyQueue(q));
-    return nbytes;
+    packet->flags = orig->flags;
+    packet->upload = orig->upload;
+    return packet;
 }
 
 
-bool httpIsEof(HttpConn *conn) 
-{
-    return conn->rx == 0 || conn->rx->eof;
-}
+/*
+    @copy   default
+
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
+
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a 
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
+
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
 
+    @end
+ */
 
+/************************************************************************/
 /*
-    Read all the content buffered so far
+    Start of file "src/pam.c"
  */
-char *httpReadString(HttpConn *conn)
-{
-    HttpRx      *rx;
-    ssize       sofar, nbytes, remaining;
-    char        *content;
+/************************************************************************/
 
-    rx = conn->rx;
-    remaining = (ssize) min(MAXSSIZE, rx->length);
+/*
+    authPam.c - Authorization using PAM (Pluggable Authorization Module)
 
-    if (remaining > 0) {
-        content = mprAlloc(remaining + 1);
-        sofar = 0;
-        while (remaining > 0) {
-            nbytes = httpRead(conn, &content[sofar], remaining);
-            if (nbytes < 0) {
-                return 0;
-            }
-            sofar += nbytes;
-            remaining -= nbytes;
-        }
-    } else {
-        content = mprAlloc(HTTP_BUFSIZE);
-        sofar = 0;
-        while (1) {
-            nbytes = httpRead(conn, &content[sofar], HTTP_BUFSIZE);
-            if (nbytes < 0) {
-                return 0;
-            } else if (nbytes == 0) {
-                break;
-            }
-            sofar += nbytes;
-            content = mprRealloc(content, sofar + HTTP_BUFSIZE);
-        }
-    }
-    content[sofar] = '\0';
-    return content;
-}
+    Copyright (c) All Rights Reserved. See details at the end of the file.
+ */
 
+/********************************* Includes ***********************************/
 
-void httpRemoveQueue(HttpQueue *q)
-{
-    q->prevQ->nextQ = q->nextQ;
-    q->nextQ->prevQ = q->prevQ;
-    q->prevQ = q->nextQ = q;
-}
 
 
-void httpScheduleQueue(HttpQueue *q)
-{
-    HttpQueue     *head;
-    
-    mprAssert(q->conn);
-    head = q->conn->serviceq;
-    
-    if (q->scheduleNext == q && !(q->flags & HTTP_QUEUE_SUSPENDED)) {
-        q->scheduleNext = head;
-        q->schedulePrev = head->schedulePrev;
-        head->schedulePrev->scheduleNext = q;
-        head->schedulePrev = q;
-    }
-}
+#if BIT_HAS_PAM && BIT_PAM
+ #include    <security/pam_appl.h>
 
+/********************************* Defines ************************************/
 
-void httpServiceQueue(HttpQueue *q)
-{
-    q->conn->currentq = q;
+typedef struct {
+    char    *name;
+    char    *password;
+} UserInfo;
 
-    if (q->servicing) {
-        q->flags |= HTTP_QUEUE_RESERVICE;
-    } else {
-        /*  
-            Since we are servicing this "q" now, we can remove from the schedule queue if it is already queued.
-         */
-        if (q->conn->serviceq->scheduleNext == q) {
-            httpGetNextQueueForService(q->conn->serviceq);
-        }
-        if (!(q->flags & HTTP_QUEUE_SUSPENDED)) {
-            q->servicing = 1;
-            q->service(q);
-            if (q->flags & HTTP_QUEUE_RESERVICE) {
-                q->flags &= ~HTTP_QUEUE_RESERVICE;
-                httpScheduleQueue(q);
-            }
-            q->flags |= HTTP_QUEUE_SERVICED;
-            q->servicing = 0;
-        }
-    }
-}
+#if MACOSX
+    typedef int Gid;
+#else
+    typedef gid_t Gid;
+#endif
 
+/********************************* Forwards ***********************************/
 
-/*  
-    Return true if the next queue will accept this packet. If not, then disable the queue's service procedure.
-    This may split the packet if it exceeds the downstreams maximum packet size.
- */
-bool httpWillNextQueueAcceptPacket(HttpQueue *q, HttpPacket *packet)
+static int pamChat(int msgCount, const struct pam_message **msg, struct pam_response **resp, void *data);
+
+/*********************************** Code *************************************/
+
+bool httpPamVerifyUser(HttpConn *conn)
 {
-    HttpQueue   *nextQ;
-    ssize       size;
+    MprBuf              *abilities;
+    pam_handle_t        *pamh;
+    UserInfo            info;
+    struct pam_conv     conv = { pamChat, &info };
+    struct group        *gp;
+    int                 res, i;
+   
+    mprAssert(conn->username);
+    mprAssert(conn->password);
+    mprAssert(!conn->encoded);
 
-    nextQ = q->nextQ;
-    size = httpGetPacketLength(packet);
-    if (size <= nextQ->packetSize && (size + nextQ->count) <= nextQ->max) {
-        return 1;
+    info.name = (char*) conn->username;
+    info.password = (char*) conn->password;
+    pamh = NULL;
+    if ((res = pam_start("login", info.name, &conv, &pamh)) != PAM_SUCCESS) {
+        return 0;
     }
-    if (httpResizePacket(q, packet, 0) < 0) {
+    if ((res = pam_authenticate(pamh, PAM_DISALLOW_NULL_AUTHTOK)) != PAM_SUCCESS) {
+        pam_end(pamh, PAM_SUCCESS);
+        mprLog(5, "httpPamVerifyUser failed to verify %s", conn->username);
         return 0;
     }
-    size = httpGetPacketLength(packet);
-    mprAssert(size <= nextQ->packetSize);
-    if ((size + nextQ->count) <= nextQ->max) {
-        return 1;
+    pam_end(pamh, PAM_SUCCESS);
+    mprLog(5, "httpPamVerifyUser verified %s", conn->username);
+
+    if (!conn->user) {
+        conn->user = mprLookupKey(conn->rx->route->auth->users, conn->username);
     }
-    /*  
-        The downstream queue is full, so disable the queue and mark the downstream queue as full and service 
-     */
-    httpSuspendQueue(q);
-    if (!(nextQ->flags & HTTP_QUEUE_SUSPENDED)) {
-        httpScheduleQueue(nextQ);
+    if (!conn->user) {
+        Gid     groups[32];
+        int     ngroups;
+        /* 
+            Create a temporary user with a abilities set to the groups 
+         */
+        ngroups = sizeof(groups) / sizeof(Gid);
+        if ((i = getgrouplist(conn->username, 99999, groups, &ngroups)) >= 0) {
+            abilities = mprCreateBuf(0, 0);
+            for (i = 0; i < ngroups; i++) {
+                if ((gp = getgrgid(groups[i])) != 0) {
+                    mprPutFmtToBuf(abilities, "%s ", gp->gr_name);
+                }
+            }
+            mprAddNullToBuf(abilities);
+            mprLog(5, "Create temp user \"%s\" with abilities: %s", conn->username, mprGetBufStart(abilities));
+            conn->user = httpCreateUser(conn->rx->route->auth, conn->username, 0, mprGetBufStart(abilities));
+        }
     }
-    return 0;
+    return 1;
 }
 
-
 /*  
-    Return true if the next queue will accept a certain amount of data.
+    Callback invoked by the pam_authenticate function
  */
-bool httpWillNextQueueAcceptSize(HttpQueue *q, ssize size)
+static int pamChat(int msgCount, const struct pam_message **msg, struct pam_response **resp, void *data) 
 {
-    HttpQueue   *nextQ;
+    UserInfo                *info;
+    struct pam_response     *reply;
+    int                     i;
+    
+    i = 0;
+    reply = 0;
+    info = (UserInfo*) data;
 
-    nextQ = q->nextQ;
-    if (size <= nextQ->packetSize && (size + nextQ->count) <= nextQ->max) {
-        return 1;
+    if (resp == 0 || msg == 0 || info == 0) {
+        return PAM_CONV_ERR;
     }
-    httpSuspendQueue(q);
-    if (!(nextQ->flags & HTTP_QUEUE_SUSPENDED)) {
-        httpScheduleQueue(nextQ);
+    if ((reply = calloc(msgCount, sizeof(struct pam_response))) == 0) {
+        return PAM_CONV_ERR;
     }
-    return 0;
+    for (i = 0; i < msgCount; i++) {
+        reply[i].resp_retcode = 0;
+        reply[i].resp = 0;
+        
+        switch (msg[i]->msg_style) {
+        case PAM_PROMPT_ECHO_ON:
+            reply[i].resp = strdup(info->name);
+            break;
+
+        case PAM_PROMPT_ECHO_OFF:
+            /* Retrieve the user password and pass onto pam */
+            reply[i].resp = strdup(info->password);
+            break;
+
+        default:
+            free(reply);
+            return PAM_CONV_ERR;
+        }
+    }
+    *resp = reply;
+    return PAM_SUCCESS;
 }
+#endif /* BIT_HAS_PAM */
+
+/*
+    @copy   default
 
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
 
-/*  
-    Write a block of data. This is the lowest level write routine for data. This will buffer the data and flush if
-    the queue buffer is full. Flushing is done by calling httpFlushQueue which will service queues as required. This
-    may call the queue outgoing service routine and disable downstream queues if they are overfull.
-    This routine will always accept the data and never return "short". 
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a 
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
+
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
+
+    @end
  */
-ssize httpWriteBlock(HttpQueue *q, cchar *buf, ssize size)
+
+/************************************************************************/
+/*
+    Start of file "src/passHandler.c"
+ */
+/************************************************************************/
+
+/*
+    passHandler.c -- Pass through handler
+
+    This handler simply relays all content to a network connector. It is used to when there is no handler defined 
+    and to convey errors when the actual handler fails. It is configured as the "passHandler" and "errorHandler".
+    The pipeline will also select this handler if any routing errors occur. 
+
+    Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
+ */
+
+/********************************* Includes ***********************************/
+
+
+
+/*********************************** Code *************************************/
+/*
+    Handle Trace and Options requests. Handlers can do this themselves if they desire, but typically
+    all Trace/Options requests come here.
+ */
+void httpHandleOptionsTrace(HttpConn *conn)
 {
-    HttpPacket  *packet;
-    HttpConn    *conn;
+    HttpRx      *rx;
     HttpTx      *tx;
-    ssize       bytes, written, packetSize;
+    int         flags;
 
-    mprAssert(q == q->conn->writeq);
-               
-    conn = q->conn;
     tx = conn->tx;
-    if (conn->finalized || tx == 0) {
-        return MPR_ERR_CANT_WRITE;
-    }
-    conn->responded = 1;
+    rx = conn->rx;
 
-    for (written = 0; size > 0; ) {
-        LOG(7, "httpWriteBlock q_count %d, q_max %d", q->count, q->max);
-        if (conn->state >= HTTP_STATE_COMPLETE) {
-            return MPR_ERR_CANT_WRITE;
-        }
-        if (q->last != q->first && q->last->flags & HTTP_PACKET_DATA) {
-            packet = q->last;
-            mprAssert(packet->content);
+    if (rx->flags & HTTP_TRACE) {
+        /* The trace method is disabled by default unless 'TraceMethod on' is specified */
+        if (!conn->limits->enableTraceMethod) {
+            tx->status = HTTP_CODE_NOT_ACCEPTABLE;
+            httpFormatResponseBody(conn, "Trace Request Denied", "The TRACE method is disabled on this server.");
         } else {
-            packet = 0;
-        }
-        if (packet == 0 || mprGetBufSpace(packet->content) == 0) {
-            packetSize = (tx->chunkSize > 0) ? tx->chunkSize : q->packetSize;
-            if ((packet = httpCreateDataPacket(packetSize)) == 0) {
-                return MPR_ERR_MEMORY;
-            }
-            httpPutForService(q, packet, HTTP_DELAY_SERVICE);
-        }
-        if ((bytes = mprPutBlockToBuf(packet->content, buf, size)) == 0) {
-            return MPR_ERR_MEMORY;
-        }
-        buf += bytes;
-        size -= bytes;
-        q->count += bytes;
-        written += bytes;
-        if (q->count >= q->max) {
-            httpFlushQueue(q, 0);
+            httpFormatResponse(conn, "%s %s %s\r\n", rx->method, rx->uri, conn->protocol);
         }
+        /* This finalizes output and indicates the request is now complete */
+        httpFinalize(conn);
+
+    } else if (rx->flags & HTTP_OPTIONS) {
+        flags = tx->traceMethods;
+        httpSetHeader(conn, "Allow", "OPTIONS%s%s%s%s%s%s",
+            (conn->limits->enableTraceMethod) ? ",TRACE" : "",
+            (flags & HTTP_STAGE_GET) ? ",GET" : "",
+            (flags & HTTP_STAGE_HEAD) ? ",HEAD" : "",
+            (flags & HTTP_STAGE_POST) ? ",POST" : "",
+            (flags & HTTP_STAGE_PUT) ? ",PUT" : "",
+            (flags & HTTP_STAGE_DELETE) ? ",DELETE" : "");
+        httpOmitBody(conn);
+        httpSetContentLength(conn, 0);
+        httpFinalize(conn);
     }
-    if (conn->error) {
-        return MPR_ERR_CANT_WRITE;
-    }
-    return written;
 }
 
 
-ssize httpWriteString(HttpQueue *q, cchar *s)
+static void startPass(HttpQueue *q)
 {
-    return httpWriteBlock(q, s, strlen(s));
+    mprLog(5, "Start passHandler");
+    if (q->conn->rx->flags & (HTTP_OPTIONS | HTTP_TRACE)) {
+        httpHandleOptionsTrace(q->conn);
+    }
 }
 
 
-ssize httpWriteSafeString(HttpQueue *q, cchar *s)
+static void readyPass(HttpQueue *q)
 {
-    return httpWriteString(q, mprEscapeHtml(s));
+    httpFinalize(q->conn);
 }
 
 
-ssize httpWrite(HttpQueue *q, cchar *fmt, ...)
+static void readyError(HttpQueue *q)
 {
-    va_list     vargs;
-    char        *buf;
-    
-    va_start(vargs, fmt);
-    buf = sfmtv(fmt, vargs);
-    va_end(vargs);
-    return httpWriteString(q, buf);
+    if (!q->conn->error) {
+        httpError(q->conn, HTTP_CODE_SERVICE_UNAVAILABLE, "The requested resource is not available");
+    }
+    httpFinalize(q->conn);
 }
 
 
-bool httpVerifyQueue(HttpQueue *q)
+int httpOpenPassHandler(Http *http)
 {
-    HttpPacket  *packet;
-    ssize       count;
+    HttpStage     *stage;
 
-    count = 0;
-    for (packet = q->first; packet; packet = packet->next) {
-        count += httpGetPacketLength(packet);
+    if ((stage = httpCreateHandler(http, "passHandler", HTTP_STAGE_ALL | HTTP_STAGE_NONBLOCK, NULL)) == 0) {
+        return MPR_ERR_CANT_CREATE;
     }
-    mprAssert(count <= q->count);
-    return count <= q->count;
+    http->passHandler = stage;
+    stage->start = startPass;
+    stage->ready = readyPass;
+
+    /*
+        PassHandler is an alias as the ErrorHandler too
+     */
+    if ((stage = httpCreateHandler(http, "errorHandler", HTTP_STAGE_ALL | HTTP_STAGE_NONBLOCK, NULL)) == 0) {
+        return MPR_ERR_CANT_CREATE;
+    }
+    stage->start = startPass;
+    stage->ready = readyError;
+    return 0;
 }
 
+
 /*
     @copy   default
 
@@ -7405,12 +8576,12 @@ bool httpVerifyQueue(HttpQueue *q)
 
 /************************************************************************/
 /*
-    Start of file "src/rangeFilter.c"
+    Start of file "src/pipeline.c"
  */
 /************************************************************************/
 
 /*
-    rangeFilter.c - Ranged request filter.
+    pipeline.c -- HTTP pipeline processing. 
     Copyright (c) All Rights Reserved. See details at the end of the file.
  */
 
@@ -7418,271 +8589,337 @@ bool httpVerifyQueue(HttpQueue *q)
 
 
 
-/********************************** Forwards **********************************/
+/********************************** Forward ***********************************/
 
-static bool applyRange(HttpQueue *q, HttpPacket *packet);
-static void createRangeBoundary(HttpConn *conn);
-static HttpPacket *createRangePacket(HttpConn *conn, HttpRange *range);
-static HttpPacket *createFinalRangePacket(HttpConn *conn);
-static void outgoingRangeService(HttpQueue *q);
-static bool fixRangeLength(HttpConn *conn);
-static int matchRange(HttpConn *conn, HttpRoute *route, int dir);
-static void startRange(HttpQueue *q);
+static bool matchFilter(HttpConn *conn, HttpStage *filter, HttpRoute *route, int dir);
+static void openQueues(HttpConn *conn);
+static void pairQueues(HttpConn *conn);
 
 /*********************************** Code *************************************/
 
-int httpOpenRangeFilter(Http *http)
+void httpCreateTxPipeline(HttpConn *conn, HttpRoute *route)
 {
-    HttpStage     *filter;
-
-    mprLog(5, "Open range filter");
-    if ((filter = httpCreateFilter(http, "rangeFilter", HTTP_STAGE_ALL, NULL)) == 0) {
-        return MPR_ERR_CANT_CREATE;
-    }
-    http->rangeFilter = filter;
-    filter->match = matchRange; 
-    filter->start = startRange; 
-    filter->outgoingService = outgoingRangeService; 
-    return 0;
-}
+    Http        *http;
+    HttpTx      *tx;
+    HttpRx      *rx;
+    HttpQueue   *q;
+    HttpStage   *stage, *filter;
+    int         next, hasOutputFilters;
 
+    mprAssert(conn);
+    mprAssert(route);
 
-/*
-    This is called twice: once for TX and once for RX
- */
-static int matchRange(HttpConn *conn, HttpRoute *route, int dir)
-{
-    mprAssert(conn->rx);
+    http = conn->http;
+    rx = conn->rx;
+    tx = conn->tx;
 
-    if ((dir & HTTP_STAGE_TX) && conn->tx->outputRanges) {
-        return HTTP_ROUTE_OK;
+    tx->outputPipeline = mprCreateList(-1, 0);
+    if (tx->handler == 0) {
+        tx->handler = http->passHandler;
     }
-    return HTTP_ROUTE_REJECT;
-}
-
-
-static void startRange(HttpQueue *q)
-{
-    HttpConn    *conn;
-    HttpTx      *tx;
+    mprAddItem(tx->outputPipeline, tx->handler);
 
-    conn = q->conn;
-    tx = conn->tx;
-    /*
-        The httpContentNotModified routine can set outputRanges to zero if returning not-modified.
-     */
-    if (tx->outputRanges == 0 || tx->status != HTTP_CODE_OK || !fixRangeLength(conn)) {
-        httpRemoveQueue(q);
-    } else {
-        tx->status = HTTP_CODE_PARTIAL;
-        if (tx->outputRanges->next) {
-            createRangeBoundary(conn);
+    hasOutputFilters = 0;
+    if (route->outputStages) {
+        for (next = 0; (filter = mprGetNextItem(route->outputStages, &next)) != 0; ) {
+            if (matchFilter(conn, filter, route, HTTP_STAGE_TX) == HTTP_ROUTE_OK) {
+                mprAddItem(tx->outputPipeline, filter);
+                mprLog(4, "Select output filter: \"%s\"", filter->name);
+                /* Route filters are clones. The range filter can be used with the send connector if the length is known */
+                if (filter->match != http->rangeFilter->match || tx->length < 0) {
+                    hasOutputFilters = 1;
+                }
+            }
+        }
+    }
+    if (conn->stream) {
+        tx->connector = http->http2Connector;
+    } else if (tx->connector == 0) {
+        /* 
+            Secure connections can only use sendfile if the kernel is encrypting the TLS records. Connections serviced
+            on the event thread use the net connector as sendfile blocks while reading uncached file data. The file 
+            handler reads cached data without blocking and reads uncached data on a reader thread.
+         */
+        if (tx->handler == http->fileHandler && (rx->flags & HTTP_GET) && !hasOutputFilters && 
+                (!conn->secure || mprSocketCanSendFile(conn->sock)) && 
+                !(conn->dispatcher->flags & MPR_DISPATCHER_INLINE) &&
+                httpShouldTrace(conn, HTTP_TRACE_TX, HTTP_TRACE_BODY, tx->ext) < 0) {
+            tx->connector = http->sendConnector;
+        } else if (route && route->connector) {
+            tx->connector = route->connector;
+        } else {
+            tx->connector = http->netConnector;
         }
     }
+    mprAddItem(tx->outputPipeline, tx->connector);
+    mprLog(4, "Select connector: \"%s\"", tx->connector->name);
+
+    /*  Create the outgoing queue heads and open the queues */
+    q = tx->queue[HTTP_QUEUE_TX];
+    for (next = 0; (stage = mprGetNextItem(tx->outputPipeline, &next)) != 0; ) {
+        q = httpCreateQueue(conn, stage, HTTP_QUEUE_TX, q);
+    }
+    conn->writeq = tx->queue[HTTP_QUEUE_TX]->nextQ;
+    conn->connectorq = tx->queue[HTTP_QUEUE_TX]->prevQ;
+    pairQueues(conn);
+
+    /*
+        Put the header before opening the queues incase an open routine actually services and completes the request
+        httpHandleOptionsTrace does this when called from openFile() in fileHandler.
+     */
+    httpPutForService(conn->writeq, httpCreateHeaderPacket(), HTTP_DELAY_SERVICE);
+    openQueues(conn);
+
+    /*
+        Refinalize if httpFinalize was called before the Tx pipeline was created
+     */
+    if (conn->refinalize) {
+        conn->finalized = 0;
+        httpFinalize(conn);
+    }
 }
 
 
-static void outgoingRangeService(HttpQueue *q)
+void httpCreateRxPipeline(HttpConn *conn, HttpRoute *route)
 {
-    HttpPacket  *packet;
-    HttpConn    *conn;
     HttpTx      *tx;
+    HttpRx      *rx;
+    HttpQueue   *q;
+    HttpStage   *stage, *filter;
+    int         next;
 
-    conn = q->conn;
-    tx = conn->tx;
+    mprAssert(conn);
+    mprAssert(route);
 
-    for (packet = httpGetPacket(q); packet; packet = httpGetPacket(q)) {
-        if (packet->flags & HTTP_PACKET_DATA) {
-            if (!applyRange(q, packet)) {
-                return;
-            }
-        } else {
-            /*
-                Send headers and end packet downstream
-             */
-            if (packet->flags & HTTP_PACKET_END && tx->rangeBoundary) {
-                httpPutPacketToNext(q, createFinalRangePacket(conn));
-            }
-            if (!httpWillNextQueueAcceptPacket(q, packet)) {
-                httpPutBackPacket(q, packet);
-                return;
+    rx = conn->rx;
+    tx = conn->tx;
+    rx->inputPipeline = mprCreateList(-1, 0);
+    if (route) {
+        for (next = 0; (filter = mprGetNextItem(route->inputStages, &next)) != 0; ) {
+            if (matchFilter(conn, filter, route, HTTP_STAGE_RX) == HTTP_ROUTE_OK) {
+                mprAddItem(rx->inputPipeline, filter);
             }
-            httpPutPacketToNext(q, packet);
         }
     }
+    mprAddItem(rx->inputPipeline, tx->handler);
+
+    /*  Create the incoming queue heads and open the queues.  */
+    q = tx->queue[HTTP_QUEUE_RX];
+    for (next = 0; (stage = mprGetNextItem(rx->inputPipeline, &next)) != 0; ) {
+        q = httpCreateQueue(conn, stage, HTTP_QUEUE_RX, q);
+    }
+    conn->readq = tx->queue[HTTP_QUEUE_RX]->prevQ;
+    if (!conn->endpoint) {
+        pairQueues(conn);
+        openQueues(conn);
+    }
 }
 
 
-static bool applyRange(HttpQueue *q, HttpPacket *packet)
+static void pairQueues(HttpConn *conn)
 {
-    HttpRange   *range;
-    HttpConn    *conn;
     HttpTx      *tx;
-    MprOff      endPacket, length, gap, span;
-    ssize       count;
+    HttpQueue   *q, *qhead, *rq, *rqhead;
 
-    conn = q->conn;
     tx = conn->tx;
-    range = tx->currentRange;
-
-    /*  
-        Process the data packet over multiple ranges ranges until all the data is processed or discarded.
-        A packet may contain data or it may be empty with an associated entityLength. If empty, range packets
-        are filled with entity data as required.
-     */
-    while (range && packet) {
-        length = httpGetPacketEntityLength(packet);
-        if (length <= 0) {
-            break;
-        }
-        endPacket = tx->rangePos + length;
-        if (endPacket < range->start) {
-            /* Packet is before the next range, so discard the entire packet and seek forwards */
-            tx->rangePos += length;
-            break;
-
-        } else if (tx->rangePos < range->start) {
-            /*  Packet starts before range so skip some data, but some packet data is in range */
-            gap = (range->start - tx->rangePos);
-            tx->rangePos += gap;
-            if (gap < length) {
-                httpAdjustPacketStart(packet, (ssize) gap);
-            }
-            /* Keep going and examine next range */
-
-        } else {
-            /* In range */
-            mprAssert(range->start <= tx->rangePos && tx->rangePos < range->end);
-            span = min(length, (range->end - tx->rangePos));
-            count = (ssize) min(span, q->nextQ->packetSize);
-            mprAssert(count > 0);
-            if (!httpWillNextQueueAcceptSize(q, count)) {
-                httpPutBackPacket(q, packet);
-                return 0;
-            }
-            if (length > count) {
-                /* Split packet if packet extends past range */
-                httpPutBackPacket(q, httpSplitPacket(packet, count));
-            }
-            if (packet->fill && (*packet->fill)(q, packet, tx->rangePos, count) < 0) {
-                return 0;
-            }
-            if (tx->rangeBoundary) {
-                httpPutPacketToNext(q, createRangePacket(conn, range));
+    qhead = tx->queue[HTTP_QUEUE_TX];
+    rqhead = tx->queue[HTTP_QUEUE_RX];
+    for (q = qhead->nextQ; q != qhead; q = q->nextQ) {
+        if (q->pair == 0) {
+            for (rq = rqhead->nextQ; rq != rqhead; rq = rq->nextQ) {
+                if (q->stage == rq->stage) {
+                    q->pair = rq;
+                    rq->pair = q;
+                }
             }
-            httpPutPacketToNext(q, packet);
-            packet = 0;
-            tx->rangePos += count;
-        }
-        if (tx->rangePos >= range->end) {
-            tx->currentRange = range = range->next;
         }
     }
-    return 1;
 }
 
 
-/*  
-    Create a range boundary packet
- */
-static HttpPacket *createRangePacket(HttpConn *conn, HttpRange *range)
+static void openQueues(HttpConn *conn)
 {
-    HttpPacket  *packet;
     HttpTx      *tx;
-    char        *length;
+    HttpQueue   *q, *qhead;
+    int         i;
 
     tx = conn->tx;
+    for (i = 0; i < HTTP_MAX_QUEUE; i++) {
+        qhead = tx->queue[i];
+        for (q = qhead->nextQ; q != qhead; q = q->nextQ) {
+            if (q->open && !(q->flags & (HTTP_QUEUE_OPEN))) {
+                if (q->pair == 0 || !(q->pair->flags & HTTP_QUEUE_OPEN)) {
+                    q->flags |= HTTP_QUEUE_OPEN;
+                    httpOpenQueue(q, conn->tx->chunkSize);
+                }
+            }
+        }
+    }
+}
 
-    length = (tx->entityLength >= 0) ? itos(tx->entityLength) : "*";
-    packet = httpCreatePacket(HTTP_RANGE_BUFSIZE);
-    packet->flags |= HTTP_PACKET_RANGE;
-    mprPutFmtToBuf(packet->content, 
-        "\r\n--%s\r\n"
-        "Content-Range: bytes %Ld-%Ld/%s\r\n\r\n",
-        tx->rangeBoundary, range->start, range->end - 1, length);
-    return packet;
+
+void httpSetPipelineHandler(HttpConn *conn, HttpStage *handler)
+{
+    conn->tx->handler = (handler) ? handler : conn->http->passHandler;
 }
 
 
-/*  
-    Create a final range packet that follows all the data
- */
-static HttpPacket *createFinalRangePacket(HttpConn *conn)
+void httpSetSendConnector(HttpConn *conn, cchar *path)
 {
-    HttpPacket  *packet;
+#if !BIT_ROM
     HttpTx      *tx;
 
     tx = conn->tx;
-
-    packet = httpCreatePacket(HTTP_RANGE_BUFSIZE);
-    packet->flags |= HTTP_PACKET_RANGE;
-    mprPutFmtToBuf(packet->content, "\r\n--%s--\r\n", tx->rangeBoundary);
-    return packet;
+    tx->flags |= HTTP_TX_SENDFILE;
+    tx->filename = sclone(path);
+#else
+    mprError("Send connector not available if ROMFS enabled");
+#endif
 }
 
 
-/*  
-    Create a range boundary. This is required if more than one range is requested.
- */
-static void createRangeBoundary(HttpConn *conn)
+void httpDestroyPipeline(HttpConn *conn)
 {
     HttpTx      *tx;
-    int         when;
+    HttpQueue   *q, *qhead;
+    int         i;
 
     tx = conn->tx;
-    mprAssert(tx->rangeBoundary == 0);
-    when = (int) conn->http->now;
-    tx->rangeBoundary = sfmt("%08X%08X", PTOI(tx) + PTOI(conn) * when, when);
+    if (tx) {
+        for (i = 0; i < HTTP_MAX_QUEUE; i++) {
+            qhead = tx->queue[i];
+            for (q = qhead->nextQ; q != qhead; q = q->nextQ) {
+                if (q->close && q->flags & HTTP_QUEUE_OPEN) {
+                    q->flags &= ~HTTP_QUEUE_OPEN;
+                    q->stage->close(q);
+                }
+            }
+        }
+    }
 }
 
 
-/*  
-    Ensure all the range limits are within the entity size limits. Fixup negative ranges.
- */
-static bool fixRangeLength(HttpConn *conn)
+void httpStartPipeline(HttpConn *conn)
 {
+    HttpQueue   *qhead, *q, *prevQ, *nextQ;
     HttpTx      *tx;
-    HttpRange   *range;
-    MprOff      length;
-
+    HttpRx      *rx;
+    
     tx = conn->tx;
-    length = tx->entityLength ? tx->entityLength : tx->length;
-
-    for (range = tx->outputRanges; range; range = range->next) {
-        /*
-                Range: 0-49             first 50 bytes
-                Range: 50-99,200-249    Two 50 byte ranges from 50 and 200
-                Range: -50              Last 50 bytes
-                Range: 1-               Skip first byte then emit the rest
-         */
-        if (length) {
-            if (range->end > length) {
-                range->end = length;
-            }
-            if (range->start > length) {
-                range->start = length;
+    tx->started = 1;
+    rx = conn->rx;
+    if (rx->needInputPipeline) {
+        qhead = tx->queue[HTTP_QUEUE_RX];
+        for (q = qhead->nextQ; !conn->error && q->nextQ != qhead; q = nextQ) {
+            nextQ = q->nextQ;
+            if (q->start && !(q->flags & HTTP_QUEUE_STARTED)) {
+                if (q->pair == 0 || !(q->pair->flags & HTTP_QUEUE_STARTED)) {
+                    q->flags |= HTTP_QUEUE_STARTED;
+                    q->stage->start(q);
+                }
             }
         }
-        if (range->start < 0) {
-            if (length <= 0) {
-                /*
-                    Can't compute an offset from the end as we don't know the entity length and it is not always possible
-                    or wise to buffer all the output.
-                 */
-                httpError(conn, HTTP_CODE_RANGE_NOT_SATISFIABLE, "Can't compute end range with unknown content length"); 
-                return 0;
-            }
-            /* select last -range-end bytes */
-            range->start = length - range->end + 1;
-            range->end = length;
+    }
+    qhead = tx->queue[HTTP_QUEUE_TX];
+    for (q = qhead->prevQ; !conn->error && q->prevQ != qhead; q = prevQ) {
+        prevQ = q->prevQ;
+        if (q->start && !(q->flags & HTTP_QUEUE_STARTED)) {
+            q->flags |= HTTP_QUEUE_STARTED;
+            q->stage->start(q);
         }
-        if (range->end < 0) {
-            if (length <= 0) {
-                return 0;
-            }
-            range->end = length - range->end - 1;
+    }
+    /* Start the handler last */
+    q = qhead->nextQ;
+    if (q->start && !conn->error) {
+        mprAssert(!(q->flags & HTTP_QUEUE_STARTED));
+        q->flags |= HTTP_QUEUE_STARTED;
+        q->stage->start(q);
+    }
+    if (!conn->error && !conn->connectorComplete && rx->remainingContent > 0) {
+        /* If no remaining content, wait till the processing stage to avoid duplicate writable events */
+        httpNotifyWritable(conn);
+    }
+}
+
+
+void httpReadyHandler(HttpConn *conn)
+{
+    HttpQueue   *q;
+    
+    q = conn->writeq;
+    if (q->stage->ready && !conn->error) {
+        q->stage->ready(q);
+    }
+}
+
+
+int httpProcessHandler(HttpConn *conn)
+{
+    HttpQueue   *q;
+    
+    q = conn->writeq;
+    if (!q->stage->writable) {
+       return 0;
+    }
+    if (!conn->finalized) {
+        q->stage->writable(q);
+        if (q->count > 0) {
+            httpScheduleQueue(q);
+            httpServiceQueues(conn);
+        }
+    }
+    return 1;
+}
+
+
+/*  
+    Run the queue service routines until there is no more work to be done. NOTE: all I/O is non-blocking.
+ */
+bool httpServiceQueues(HttpConn *conn)
+{
+    HttpQueue   *q;
+    int         workDone;
+
+    workDone = 0;
+    while (conn->state < HTTP_STATE_COMPLETE && (q = httpGetNextQueueForService(conn->serviceq)) != NULL) {
+        if (q->servicing) {
+            q->flags |= HTTP_QUEUE_RESERVICE;
+        } else {
+            mprAssert(q->schedulePrev == q->scheduleNext);
+            httpServiceQueue(q);
+            workDone = 1;
         }
-        range->len = (int) (range->end - range->start);
+    }
+    return workDone;
+}
+
+
+void httpDiscardData(HttpConn *conn, int dir)
+{
+    HttpTx      *tx;
+    HttpQueue   *q, *qhead;
+
+    tx = conn->tx;
+    if (tx == 0) {
+        return;
+    }
+    qhead = tx->queue[dir];
+    for (q = qhead->nextQ; q != qhead; q = q->nextQ) {
+        httpDiscardQueueData(q, 1);
+    }
+}
+
+
+static bool matchFilter(HttpConn *conn, HttpStage *filter, HttpRoute *route, int dir)
+{
+    HttpTx      *tx;
+
+    tx = conn->tx;
+    if (filter->match) {
+        return filter->match(conn, route, dir);
+    }
+    if (filter->extensions && tx->ext) {
+        return mprLookupKey(filter->extensions, tx->ext) != 0;
     }
     return 1;
 }
@@ -7710,12 +8947,14 @@ static bool fixRangeLength(HttpConn *conn)
 
 /************************************************************************/
 /*
-    Start of file "src/route.c"
+    Start of file "src/procHandler.c"
  */
 /************************************************************************/
 
 /*
-    route.c -- Http request routing 
+    procHandler.c -- Procedure callback handler
+
+    This handler maps URIs to procction names that have been registered via httpDefineProc.
 
     Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
  */
@@ -7723,4785 +8962,7323 @@ static bool fixRangeLength(HttpConn *conn)
 /********************************* Includes ***********************************/
 
 
-#include    "pcre.h"
 
-/********************************** Forwards **********************************/
+/*********************************** Code *************************************/
 
-#define GRADUATE_LIST(route, field) \
-    if (route->field == 0) { \
-        route->field = mprCreateList(-1, 0); \
-    } else if (route->parent && route->field == route->parent->field) { \
-        route->field = mprCloneList(route->parent->field); \
-    }
+static void startProc(HttpQueue *q)
+{
+    HttpConn    *conn;
+    HttpProc     proc;
+    cchar       *name;
 
-#define GRADUATE_HASH(route, field) \
-    mprAssert(route->field) ; \
-    if (route->parent && route->field == route->parent->field) { \
-        route->field = mprCloneHash(route->parent->field); \
+    mprLog(5, "Start procHandler");
+    conn = q->conn;
+    name = conn->rx->pathInfo;
+    if ((proc = mprLookupKey(conn->tx->handler->stageData, name)) == 0) {
+        mprError("Can't find procction callback %s", name);
+    } else {
+        (*proc)(conn);
     }
+}
 
-/********************************** Forwards **********************************/
-
-static void addUniqueItem(MprList *list, HttpRouteOp *op);
-static HttpLang *createLangDef(cchar *path, cchar *suffix, int flags);
-static HttpRouteOp *createRouteOp(cchar *name, int flags);
-static void definePathVars(HttpRoute *route);
-static void defineHostVars(HttpRoute *route);
-static char *expandTokens(HttpConn *conn, cchar *path);
-static char *expandPatternTokens(cchar *str, cchar *replacement, int *matches, int matchCount);
-static char *expandRequestTokens(HttpConn *conn, char *targetKey);
-static cchar *expandRouteName(HttpConn *conn, cchar *routeName);
-static void finalizeMethods(HttpRoute *route);
-static void finalizePattern(HttpRoute *route);
-static char *finalizeReplacement(HttpRoute *route, cchar *str);
-static char *finalizeTemplate(HttpRoute *route);
-static bool opPresent(MprList *list, HttpRouteOp *op);
-static void manageRoute(HttpRoute *route, int flags);
-static void manageLang(HttpLang *lang, int flags);
-static void manageRouteOp(HttpRouteOp *op, int flags);
-static int matchRequestUri(HttpConn *conn, HttpRoute *route);
-static int testRoute(HttpConn *conn, HttpRoute *route);
-static char *qualifyName(HttpRoute *route, cchar *controller, cchar *name);
-static int selectHandler(HttpConn *conn, HttpRoute *route);
-static int testCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *condition);
-static char *trimQuotes(char *str);
-static int updateRequest(HttpConn *conn, HttpRoute *route, HttpRouteOp *update);
 
-/************************************ Code ************************************/
-/*
-    Host may be null
- */
-HttpRoute *httpCreateRoute(HttpHost *host)
+void httpDefineProc(cchar *name, HttpProc proc)
 {
-    HttpRoute  *route;
-
-    if ((route = mprAllocObj(HttpRoute, manageRoute)) == 0) {
-        return 0;
-    }
-    route->auth = httpCreateAuth();
-    route->defaultLanguage = sclone("en");
-    route->dir = mprGetCurrentPath(".");
-    route->errorDocuments = mprCreateHash(HTTP_SMALL_HASH_SIZE, 0);
-    route->extensions = mprCreateHash(HTTP_SMALL_HASH_SIZE, MPR_HASH_CASELESS);
-    route->flags = HTTP_ROUTE_GZIP;
-    route->handlers = mprCreateList(-1, 0);
-    route->handlersWithMatch = mprCreateList(-1, 0);
-    route->host = host;
-    route->http = MPR->httpService;
-    route->indicies = mprCreateList(-1, 0);
-    route->inputStages = mprCreateList(-1, 0);
-    route->lifespan = HTTP_CACHE_LIFESPAN;
-    route->outputStages = mprCreateList(-1, 0);
-    route->vars = mprCreateHash(HTTP_SMALL_HASH_SIZE, MPR_HASH_CASELESS);
-    route->pattern = MPR->emptyString;
-    route->targetRule = sclone("run");
-    route->autoDelete = 1;
-    route->workers = -1;
+    HttpStage   *stage;
 
-    if (MPR->httpService) {
-        route->limits = mprMemdup(((Http*) MPR->httpService)->serverLimits, sizeof(HttpLimits));
+    if ((stage = httpLookupStage(MPR->httpService, "procHandler")) == 0) {
+        mprError("Can't find procHandler");
+        return;
     }
-    route->mimeTypes = MPR->mimeTypes;
-    route->mutex = mprCreateLock();
-    httpInitTrace(route->trace);
-
-    if ((route->mimeTypes = mprCreateMimeTypes("mime.types")) == 0) {
-        route->mimeTypes = MPR->mimeTypes;                                                                  
-    }  
-    definePathVars(route);
-    return route;
+    mprAddKey(stage->stageData, name, proc);
 }
 
 
-/*  
-    Create a new location block. Inherit from the parent. We use a copy-on-write scheme if these are modified later.
- */
-HttpRoute *httpCreateInheritedRoute(HttpRoute *parent)
+int httpOpenProcHandler(Http *http)
 {
-    HttpRoute  *route;
+    HttpStage     *stage;
 
-    if (!parent && (parent = httpGetDefaultRoute(0)) == 0) {
-        return 0;
+    if ((stage = httpCreateHandler(http, "procHandler", HTTP_STAGE_ALL, NULL)) == 0) {
+        return MPR_ERR_CANT_CREATE;
     }
-    if ((route = mprAllocObj(HttpRoute, manageRoute)) == 0) {
-        return 0;
+    http->procHandler = stage;
+    if ((stage->stageData = mprCreateHash(0, MPR_HASH_STATIC_VALUES)) == 0) {
+        return MPR_ERR_MEMORY;
     }
-    //  OPT. Structure assigment then overwrite.
-    route->parent = parent;
-    route->auth = httpCreateInheritedAuth(parent->auth);
-    route->autoDelete = parent->autoDelete;
-    route->caching = parent->caching;
-    route->conditions = parent->conditions;
-    route->connector = parent->connector;
-    route->defaultLanguage = parent->defaultLanguage;
-    route->dir = parent->dir;
-    route->data = parent->data;
-    route->eroute = parent->eroute;
-    route->errorDocuments = parent->errorDocuments;
-    route->extensions = parent->extensions;
-    route->handler = parent->handler;
-    route->handlers = parent->handlers;
-    route->handlersWithMatch = parent->handlersWithMatch;
-    route->headers = parent->headers;
-    route->http = MPR->httpService;
-    route->host = parent->host;
-    route->inputStages = parent->inputStages;
-    route->indicies = parent->indicies;
-    route->languages = parent->languages;
-    route->lifespan = parent->lifespan;
-    route->methods = parent->methods;
-    route->methodSpec = parent->methodSpec;
-    route->outputStages = parent->outputStages;
-    route->params = parent->params;
-    route->parent = parent;
-    route->vars = parent->vars;
-    route->pattern = parent->pattern;
-    route->patternCompiled = parent->patternCompiled;
-    route->optimizedPattern = parent->optimizedPattern;
-    route->responseStatus = parent->responseStatus;
-    route->script = parent->script;
-    route->prefix = parent->prefix;
-    route->prefixLen = parent->prefixLen;
-    route->scriptPath = parent->scriptPath;
-    route->sourceName = parent->sourceName;
-    route->sourcePath = parent->sourcePath;
-    route->ssl = parent->ssl;
-    route->target = parent->target;
-    route->targetRule = parent->targetRule;
-    route->tokens = parent->tokens;
-    route->updates = parent->updates;
-    route->uploadDir = parent->uploadDir;
-    route->workers = parent->workers;
-    route->limits = parent->limits;
-    route->mimeTypes = parent->mimeTypes;
-    route->trace[0] = parent->trace[0];
-    route->trace[1] = parent->trace[1];
-    route->log = parent->log;
-    route->logFormat = parent->logFormat;
-    route->logPath = parent->logPath;
-    route->logSize = parent->logSize;
-    route->logBackup = parent->logBackup;
-    route->logFlags = parent->logFlags;
-    route->flags = parent->flags & ~(HTTP_ROUTE_FREE_PATTERN);
-    return route;
+    stage->start = startProc;
+    return 0;
 }
 
 
-static void manageRoute(HttpRoute *route, int flags)
-{
-    if (flags & MPR_MANAGE_MARK) {
-        mprMark(route->name);
-        mprMark(route->pattern);
-        mprMark(route->startSegment);
-        mprMark(route->startWith);
-        mprMark(route->optimizedPattern);
-        mprMark(route->prefix);
-        mprMark(route->tplate);
-        mprMark(route->targetRule);
-        mprMark(route->target);
-        mprMark(route->dir);
-        mprMark(route->indicies);
-        mprMark(route->methodSpec);
-        mprMark(route->handler);
-        mprMark(route->caching);
-        mprMark(route->auth);
-        mprMark(route->http);
-        mprMark(route->host);
-        mprMark(route->parent);
-        mprMark(route->defaultLanguage);
-        mprMark(route->extensions);
-        mprMark(route->handlers);
-        mprMark(route->handlersWithMatch);
-        mprMark(route->connector);
-        mprMark(route->data);
-        mprMark(route->eroute);
-        mprMark(route->vars);
-        mprMark(route->languages);
-        mprMark(route->inputStages);
-        mprMark(route->outputStages);
-        mprMark(route->errorDocuments);
-        mprMark(route->context);
-        mprMark(route->uploadDir);
-        mprMark(route->script);
-        mprMark(route->scriptPath);
-        mprMark(route->methods);
-        mprMark(route->params);
-        mprMark(route->headers);
-        mprMark(route->conditions);
-        mprMark(route->updates);
-        mprMark(route->sourceName);
-        mprMark(route->sourcePath);
-        mprMark(route->tokens);
-        mprMark(route->ssl);
-        mprMark(route->limits);
-        mprMark(route->mimeTypes);
-        httpManageTrace(&route->trace[0], flags);
-        httpManageTrace(&route->trace[1], flags);
-        mprMark(route->log);
-        mprMark(route->logFormat);
-        mprMark(route->logPath);
-        mprMark(route->mutex);
+/*
+    @copy   default
 
-    } else if (flags & MPR_MANAGE_FREE) {
-        if (route->patternCompiled && (route->flags & HTTP_ROUTE_FREE_PATTERN)) {
-            free(route->patternCompiled);
-            route->patternCompiled = 0;
-        }
-    }
-}
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
 
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a 
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
 
-HttpRoute *httpCreateDefaultRoute(HttpHost *host)
-{
-    HttpRoute   *route;
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
 
-    mprAssert(host);
-    if ((route = httpCreateRoute(host)) == 0) {
-        return 0;
-    }
-    httpSetRouteName(route, "default");
-    httpFinalizeRoute(route);
-    return route;
-}
+    @end
+ */
 
+/************************************************************************/
+/*
+    Start of file "src/queue.c"
+ */
+/************************************************************************/
 
 /*
-    Create and configure a basic route. This is mainly used for client side piplines.
-    Host may be null.
+    queue.c -- Queue support routines. Queues are the bi-directional data flow channels for the pipeline.
+    Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
  */
-HttpRoute *httpCreateConfiguredRoute(HttpHost *host, int serverSide)
-{
-    HttpRoute   *route;
-    Http        *http;
 
-    /*
-        Create default incoming and outgoing pipelines. Order matters.
-     */
-    route = httpCreateRoute(host);
-    http = route->http;
-    httpAddRouteFilter(route, http->rangeFilter->name, NULL, HTTP_STAGE_TX);
-    httpAddRouteFilter(route, http->chunkFilter->name, NULL, HTTP_STAGE_RX | HTTP_STAGE_TX);
-    if (serverSide) {
-        httpAddRouteFilter(route, http->uploadFilter->name, NULL, HTTP_STAGE_RX);
-    }
-    return route;
-}
+/********************************* Includes ***********************************/
 
 
-HttpRoute *httpCreateAliasRoute(HttpRoute *parent, cchar *pattern, cchar *path, int status)
-{
-    HttpRoute   *route;
 
-    mprAssert(parent);
-    mprAssert(pattern && *pattern);
+/********************************** Forwards **********************************/
 
-    if ((route = httpCreateInheritedRoute(parent)) == 0) {
+static void manageQueue(HttpQueue *q, int flags);
+
+/************************************ Code ************************************/
+
+HttpQueue *httpCreateQueueHead(HttpConn *conn, cchar *name)
+{
+    HttpQueue   *q;
+
+    if ((q = mprAllocObj(HttpQueue, manageQueue)) == 0) {
         return 0;
     }
-    httpSetRoutePattern(route, pattern, 0);
-    if (path) {
-        httpSetRouteDir(route, path);
-    }
-    route->responseStatus = status;
-    return route;
+    httpInitQueue(conn, q, name);
+    httpInitSchedulerQueue(q);
+    return q;
 }
 
 
-/*
-    This routine binds a new route to a URI. It creates a handler, route and binds a callback to that route. 
- */
-HttpRoute *httpCreateProcRoute(HttpRoute *parent, cchar *pattern, HttpProc proc)
+HttpQueue *httpCreateQueue(HttpConn *conn, HttpStage *stage, int dir, HttpQueue *prev)
 {
-    HttpRoute   *route;
+    HttpQueue   *q;
 
-    if (!pattern || !proc) {
+    if ((q = mprAllocObj(HttpQueue, manageQueue)) == 0) {
         return 0;
     }
-    if ((route = httpCreateInheritedRoute(parent)) != 0) {
-        route->handler = route->http->procHandler;
-        httpSetRoutePattern(route, pattern, 0);
-        httpDefineProc(pattern, proc);
-        httpFinalizeRoute(route);
+    q->conn = conn;
+    httpInitQueue(conn, q, stage->name);
+    httpInitSchedulerQueue(q);
+    httpAssignQueue(q, stage, dir);
+    if (prev) {
+        httpAppendQueue(prev, q);
     }
-    return route;
+    return q;
 }
 
 
-int httpStartRoute(HttpRoute *route)
+static void manageQueue(HttpQueue *q, int flags)
 {
-#if !BIT_ROM
-    if (!(route->flags & HTTP_ROUTE_STARTED)) {
-        route->flags |= HTTP_ROUTE_STARTED;
-        if (route->logPath && (!route->parent || route->logPath != route->parent->logPath)) {
-            if (route->logBackup > 0) {
-                httpBackupRouteLog(route);
-            }
-            mprAssert(!route->log);
-            route->log = mprOpenFile(route->logPath, O_CREAT | O_APPEND | O_WRONLY | O_TEXT, 0664);
-            if (route->log == 0) {
-                mprError("Can't open log file %s", route->logPath);
-                return MPR_ERR_CANT_OPEN;
-            }
+    HttpPacket      *packet;
+
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(q->owner);
+        for (packet = q->first; packet; packet = packet->next) {
+            mprMark(packet);
+        }
+        mprMark(q->last);
+        mprMark(q->nextQ);
+        mprMark(q->prevQ);
+        mprMark(q->stage);
+        mprMark(q->conn);
+        mprMark(q->scheduleNext);
+        mprMark(q->schedulePrev);
+        mprMark(q->pair);
+        mprMark(q->queueData);
+        mprMark(q->queueData);
+        if (q->nextQ && q->nextQ->stage) {
+            /* Not a queue head */
+            mprMark(q->nextQ);
         }
     }
-#endif
-    return 0;
 }
 
 
-void httpStopRoute(HttpRoute *route)
+void httpAssignQueue(HttpQueue *q, HttpStage *stage, int dir)
 {
-    route->log = 0;
-}
-
-
-/*
-    Find the matching route and handler for a request. If any errors occur, the pass handler is used to 
-    pass errors via the net/sendfile connectors onto the client. This process may rewrite the request 
-    URI and may redirect the request.
+    q->stage = stage;
+    q->close = stage->close;
+    q->open = stage->open;
+    q->start = stage->start;
+    if (dir == HTTP_QUEUE_TX) {
+        q->put = stage->outgoing;
+        q->service = stage->outgoingService;
+    } else {
+        q->put = stage->incoming;
+        q->service = stage->incomingService;
+    }
+    q->owner = stage->name;
+}
+
+
+void httpInitQueue(HttpConn *conn, HttpQueue *q, cchar *name)
+{
+    q->conn = conn;
+    q->nextQ = q;
+    q->prevQ = q;
+    q->owner = sclone(name);
+    q->packetSize = conn->limits->stageBufferSize;
+    q->max = conn->limits->stageBufferSize;
+    q->low = q->max / 100 *  5;    
+}
+
+
+#if UNUSED &&KEEP
+/*  
+    Insert a queue after the previous element
  */
-void httpRouteRequest(HttpConn *conn)
+void httpAppendQueueToHead(HttpQueue *head, HttpQueue *q)
 {
-    HttpRx      *rx;
-    HttpTx      *tx;
-    HttpRoute   *route;
-    int         next, rewrites, match;
+    q->nextQ = head;
+    q->prevQ = head->prevQ;
+    head->prevQ->nextQ = q;
+    head->prevQ = q;
+}
+#endif
 
-    rx = conn->rx;
-    tx = conn->tx;
 
-    for (next = rewrites = 0; rewrites < HTTP_MAX_REWRITE; ) {
-        if ((route = mprGetNextItem(conn->host->routes, &next)) == 0) {
-            break;
-        }
-        if (route->startSegment && strncmp(rx->pathInfo, route->startSegment, route->startSegmentLen) != 0) {
-            /* Failed to match the first URI segment, skip to the next group */
-            mprAssert(next <= route->nextGroup);
-            next = route->nextGroup;
+void httpSuspendQueue(HttpQueue *q)
+{
+    mprLog(7, "Suspend q %s", q->owner);
+    q->flags |= HTTP_QUEUE_SUSPENDED;
+}
 
-        } else if (route->startWith && strncmp(rx->pathInfo, route->startWith, route->startWithLen) != 0) {
-            /* Failed to match starting literal segment of the route pattern, advance to test the next route */
-            continue;
 
-        } else if ((match = httpMatchRoute(conn, route)) == HTTP_ROUTE_REROUTE) {
-            next = 0;
-            route = 0;
-            rewrites++;
+/*  
+    Remove all data in the queue. If removePackets is true, actually remove the packet too.
+    This preserves the header and EOT packets.
+ */
+void httpDiscardQueueData(HttpQueue *q, bool removePackets)
+{
+    HttpPacket  *packet, *prev, *next;
+    ssize       len;
 
-        } else if (match == HTTP_ROUTE_OK) {
-            break;
-        }
-    }
-    if (route == 0 || tx->handler == 0) {
-        /* Ensure this is emitted to the log */
-        mprError("Can't find suitable route for request %s", rx->pathInfo);
-        httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Can't find suitable route for request");
+    if (q == 0) {
         return;
     }
-    if (rx->traceLevel >= 0) {
-        mprLog(4, "Select route \"%s\" target \"%s\"", route->name, route->targetRule);
+    for (prev = 0, packet = q->first; packet; packet = next) {
+        next = packet->next;
+        if (packet->flags & (HTTP_PACKET_RANGE | HTTP_PACKET_DATA)) {
+            if (removePackets) {
+                if (prev) {
+                    prev->next = next;
+                } else {
+                    q->first = next;
+                }
+                if (packet == q->last) {
+                    q->last = prev;
+                }
+                q->count -= httpGetPacketLength(packet);
+                mprAssert(q->count >= 0);
+                continue;
+            } else {
+                len = httpGetPacketLength(packet);
+                q->conn->tx->length -= len;
+                q->count -= len;
+                mprAssert(q->count >= 0);
+                if (packet->content) {
+                    if (packet->flags & HTTP_PACKET_SHARED) {
+                        /* Flushing would let later writes overwrite the shared data */
+                        mprAdjustBufStart(packet->content, len);
+                    } else {
+                        mprFlushBuf(packet->content);
+                    }
+                }
+            }
+        }
+        prev = packet;
     }
-    rx->route = route;
-    conn->limits = route->limits;
+}
 
-    conn->trace[0] = route->trace[0];
-    conn->trace[1] = route->trace[1];
 
-    if (rewrites >= HTTP_MAX_REWRITE) {
-        httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Too many request rewrites");
-    }
-    if (conn->finalized) {
-        /* 
-            Must be no data in queues as handlers and pipeline are not yet started. Only errors and redirects 
-            using tx->altBody 
-         */ 
-        tx->handler = conn->http->passHandler;
-    }
-    if (rx->traceLevel >= 0) {
-        mprLog(rx->traceLevel, "Select handler: \"%s\" for \"%s\"", tx->handler->name, rx->uri);
-    }
-}
+/*  
+    Flush queue data by scheduling the queue and servicing all scheduled queues. Return true if there is room for more data.
+    If blocking is requested, the call will block until the queue count falls below the queue max.
+    WARNING: Be very careful when using blocking == true. Should only be used by end applications and not by middleware.
+ */
+bool httpFlushQueue(HttpQueue *q, bool blocking)
+{
+    HttpConn    *conn;
+    HttpQueue   *next;
 
+    conn = q->conn;
+    mprAssert(conn->sock);
+    do {
+        httpScheduleQueue(q);
+        next = q->nextQ;
+        if (next->count >= next->max) {
+            httpScheduleQueue(next);
+        }
+        httpServiceQueues(conn);
+        if (conn->sock == 0) {
+            break;
+        }
+    } while (blocking && q->count > 0);
+    return (q->count < q->max) ? 1 : 0;
+}
 
 
-int httpMatchRoute(HttpConn *conn, HttpRoute *route)
+void httpResumeQueue(HttpQueue *q)
 {
-    HttpRx      *rx;
-    char        *savePathInfo, *pathInfo;
-    int         rc;
-
-    mprAssert(conn);
-    mprAssert(route);
+    mprLog(7, "Enable q %s", q->owner);
+    q->flags &= ~HTTP_QUEUE_SUSPENDED;
+    httpScheduleQueue(q);
+}
 
-    rx = conn->rx;
-    savePathInfo = 0;
 
-    /*
-        Remove the route prefix. Restore after matching.
-     */
-    if (route->prefix) {
-        savePathInfo = rx->pathInfo;
-        pathInfo = &rx->pathInfo[route->prefixLen];
-        if (*pathInfo == '\0') {
-            pathInfo = "/";
+HttpQueue *httpFindPreviousQueue(HttpQueue *q)
+{
+    while (q->prevQ) {
+        q = q->prevQ;
+        if (q->service) {
+            return q;
         }
-        rx->pathInfo = sclone(pathInfo);
-        rx->scriptName = route->prefix;
-    }
-    if ((rc = matchRequestUri(conn, route)) == HTTP_ROUTE_OK) {
-        rc = testRoute(conn, route);
-    }
-    if (rc == HTTP_ROUTE_REJECT && route->prefix) {
-        /* Keep the modified pathInfo if OK or REWRITE */
-        rx->pathInfo = savePathInfo;
-        rx->scriptName = 0;
     }
-    return rc;
+    return 0;
 }
 
 
-static int matchRequestUri(HttpConn *conn, HttpRoute *route)
+HttpQueue *httpGetNextQueueForService(HttpQueue *q)
 {
-    HttpRx      *rx;
-
-    mprAssert(conn);
-    mprAssert(route);
-    rx = conn->rx;
-
-    if (route->patternCompiled) {
-        rx->matchCount = pcre_exec(route->patternCompiled, NULL, rx->pathInfo, (int) slen(rx->pathInfo), 0, 0, 
-                rx->matches, sizeof(rx->matches) / sizeof(int));
-        mprLog(6, "Test route pattern \"%s\", regexp %s, pathInfo %s", route->name, route->optimizedPattern, rx->pathInfo);
+    HttpQueue     *next;
+    
+    if (q->scheduleNext != q) {
+        next = q->scheduleNext;
+        next->schedulePrev->scheduleNext = next->scheduleNext;
+        next->scheduleNext->schedulePrev = next->schedulePrev;
+        next->schedulePrev = next->scheduleNext = next;
+        return next;
+    }
+    return 0;
+}
 
-        if (route->flags & HTTP_ROUTE_NOT) {
-            if (rx->matchCount > 0) {
-                return HTTP_ROUTE_REJECT;
-            }
-            rx->matchCount = 1;
-            rx->matches[0] = 0;
-            rx->matches[1] = (int) slen(rx->pathInfo);
 
-        } else if (rx->matchCount <= 0) {
-            return HTTP_ROUTE_REJECT;
-        }
-    } else if (route->pattern && *route->pattern) {
-        /* Pattern compilation failed */
-        return HTTP_ROUTE_REJECT;
-    }
-    mprLog(6, "Test route methods \"%s\"", route->name);
-    if (route->methods && !mprLookupKey(route->methods, rx->method)) {
-        return HTTP_ROUTE_REJECT;
+/*  
+    Return the number of bytes the queue will accept. Always positive.
+ */
+ssize httpGetQueueRoom(HttpQueue *q)
+{
+    mprAssert(q->max > 0);
+    mprAssert(q->count >= 0);
+    
+    if (q->count >= q->max) {
+        return 0;
     }
-    rx->route = route;
-    return HTTP_ROUTE_OK;
+    return q->max - q->count;
 }
 
 
-static int testRoute(HttpConn *conn, HttpRoute *route)
+void httpInitSchedulerQueue(HttpQueue *q)
 {
-    HttpRouteOp     *op, *condition, *update;
-    HttpRouteProc   *proc;
-    HttpRx          *rx;
-    HttpTx          *tx;
-    cchar           *token, *value, *header, *field;
-    int             next, rc, matched[HTTP_MAX_ROUTE_MATCHES * 2], count, result;
+    q->scheduleNext = q;
+    q->schedulePrev = q;
+}
 
-    mprAssert(conn);
-    mprAssert(route);
-    rx = conn->rx;
-    tx = conn->tx;
 
-    rx->target = route->target ? expandTokens(conn, route->target) : sclone(&conn->rx->pathInfo[1]);
+/*  
+    Append a queue after the previous element
+ */
+void httpAppendQueue(HttpQueue *prev, HttpQueue *q)
+{
+    q->nextQ = prev->nextQ;
+    q->prevQ = prev;
+    prev->nextQ->prevQ = q;
+    prev->nextQ = q;
+}
 
-    if (route->headers) {
-        for (next = 0; (op = mprGetNextItem(route->headers, &next)) != 0; ) {
-            mprLog(6, "Test route \"%s\" header \"%s\"", route->name, op->name);
-            if ((header = httpGetHeader(conn, op->name)) != 0) {
-                count = pcre_exec(op->mdata, NULL, header, (int) slen(header), 0, 0, 
-                    matched, sizeof(matched) / sizeof(int)); 
-                result = count > 0;
-                if (op->flags & HTTP_ROUTE_NOT) {
-                    result = !result;
-                }
-                if (!result) {
-                    return HTTP_ROUTE_REJECT;
-                }
-            }
-        }
-    }
-    if (route->params) {
-        for (next = 0; (op = mprGetNextItem(route->params, &next)) != 0; ) {
-            mprLog(6, "Test route \"%s\" field \"%s\"", route->name, op->name);
-            if ((field = httpGetParam(conn, op->name, "")) != 0) {
-                count = pcre_exec(op->mdata, NULL, field, (int) slen(field), 0, 0, 
-                    matched, sizeof(matched) / sizeof(int)); 
-                result = count > 0;
-                if (op->flags & HTTP_ROUTE_NOT) {
-                    result = !result;
-                }
-                if (!result) {
-                    return HTTP_ROUTE_REJECT;
-                }
-            }
-        }
-    }
-    if (route->conditions) {
-        for (next = 0; (condition = mprGetNextItem(route->conditions, &next)) != 0; ) {
-            mprLog(6, "Test route \"%s\" condition \"%s\"", route->name, condition->name);
-            rc = testCondition(conn, route, condition);
-            if (rc == HTTP_ROUTE_REROUTE) {
-                return rc;
-            }
-            if (condition->flags & HTTP_ROUTE_NOT) {
-                rc = !rc;
-            }
-            if (rc == HTTP_ROUTE_REJECT) {
-                return rc;
-            }
-        }
-    }
-    if (route->updates) {
-        for (next = 0; (update = mprGetNextItem(route->updates, &next)) != 0; ) {
-            mprLog(6, "Run route \"%s\" update \"%s\"", route->name, update->name);
-            if ((rc = updateRequest(conn, route, update)) == HTTP_ROUTE_REROUTE) {
-                return rc;
-            }
-        }
-    }
-    if (route->prefix) {
-        /* This is needed by some handler match routines */
-        httpSetParam(conn, "prefix", route->prefix);
-    }
-    if ((rc = selectHandler(conn, route)) != HTTP_ROUTE_OK) {
-        return rc;
+
+bool httpIsQueueEmpty(HttpQueue *q)
+{
+    return q->first == 0;
+}
+
+
+int httpOpenQueue(HttpQueue *q, ssize chunkSize)
+{
+    Http        *http;
+    HttpConn    *conn;
+    HttpStage   *stage;
+    MprModule   *module;
+
+    stage = q->stage;
+    conn = q->conn;
+    http = q->conn->http;
+
+    if (chunkSize > 0) {
+        q->packetSize = min(q->packetSize, chunkSize);
     }
-    if (route->tokens) {
-        for (next = 0; (token = mprGetNextItem(route->tokens, &next)) != 0; ) {
-            value = snclone(&rx->pathInfo[rx->matches[next * 2]], rx->matches[(next * 2) + 1] - rx->matches[(next * 2)]);
-            httpSetParam(conn, token, value);
+    if (stage->flags & HTTP_STAGE_UNLOADED && stage->module) {
+        module = stage->module;
+        module = mprCreateModule(module->name, module->path, module->entry, http);
+        if (mprLoadModule(module) < 0) {
+            httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Can't load module %s", module->name);
+            return MPR_ERR_CANT_READ;
         }
+        stage->module = module;
     }
-    if ((proc = mprLookupKey(conn->http->routeTargets, route->targetRule)) == 0) {
-        httpError(conn, -1, "Can't find route target rule \"%s\"", route->targetRule);
-        return HTTP_ROUTE_REJECT;
-    }
-    if ((rc = (*proc)(conn, route, 0)) != HTTP_ROUTE_OK) {
-        return rc;
+    if (stage->module) {
+        stage->module->lastActivity = http->now;
     }
-    if (!conn->finalized && tx->handler->match) {
-        rc = tx->handler->match(conn, route, HTTP_QUEUE_TX);
+    q->flags |= HTTP_QUEUE_OPEN;
+    if (q->open) {
+        q->stage->open(q);
     }
-    return rc;
+    return 0;
 }
 
 
-static int selectHandler(HttpConn *conn, HttpRoute *route)
+/*  
+    Read data. If sync mode, this will block. If async, will never block.
+    Will return what data is available up to the requested size. Returns a byte count.
+ */
+ssize httpRead(HttpConn *conn, char *buf, ssize size)
 {
-    HttpTx      *tx;
-    int         next, rc;
+    HttpPacket  *packet;
+    HttpQueue   *q;
+    MprBuf      *content;
+    ssize       nbytes, len;
 
-    mprAssert(conn);
-    mprAssert(route);
+    q = conn->readq;
+    mprAssert(q->count >= 0);
+    mprAssert(size >= 0);
+    mprAssert(httpVerifyQueue(q));
 
-    tx = conn->tx;
-    if (route->handler) {
-        tx->handler = route->handler;
-        return HTTP_ROUTE_OK;
-    }
-    /*
-        Handlers with match routines are examined first (in-order)
-     */
-    for (next = 0; (tx->handler = mprGetNextItem(route->handlersWithMatch, &next)) != 0; ) {
-        rc = tx->handler->match(conn, route, 0);
-        if (rc == HTTP_ROUTE_OK || rc == HTTP_ROUTE_REROUTE) {
-            return rc;
+    while (q->count <= 0 && !conn->async && !conn->error && conn->sock && (conn->state <= HTTP_STATE_CONTENT)) {
+        httpServiceQueues(conn);
+        if (conn->sock) {
+            httpWait(conn, 0, MPR_TIMEOUT_NO_BUSY);
         }
     }
-    if (!tx->handler) {
-        /*
-            Now match by extensions
-         */
-        if (!tx->ext || (tx->handler = mprLookupKey(route->extensions, tx->ext)) == 0) {
-            tx->handler = mprLookupKey(route->extensions, "");
+    //  MOB - better place for this?
+    conn->lastActivity = conn->http->now;
+    mprAssert(httpVerifyQueue(q));
+
+    for (nbytes = 0; size > 0 && q->count > 0; ) {
+        if ((packet = q->first) == 0) {
+            break;
+        }
+        content = packet->content;
+        len = mprGetBufLength(content);
+        len = min(len, size);
+        mprAssert(len <= q->count);
+        if (len > 0) {
+            len = mprGetBlockFromBuf(content, buf, len);
+            mprAssert(len <= q->count);
+        }
+        buf += len;
+        size -= len;
+        q->count -= len;
+        mprAssert(q->count >= 0);
+        nbytes += len;
+        if (mprGetBufLength(content) == 0) {
+            httpGetPacket(q);
         }
     }
-    return tx->handler ? HTTP_ROUTE_OK : HTTP_ROUTE_REJECT;
+    mprAssert(q->count >= 0);
+    mprAssert(httpVerifyQueue(q));
+    return nbytes;
+}
+
+
+bool httpIsEof(HttpConn *conn) 
+{
+    return conn->rx == 0 || conn->rx->eof;
 }
 
 
 /*
-    Map the target to physical storage. Sets tx->filename and tx->ext.
+    Read all the content buffered so far
  */
-void httpMapFile(HttpConn *conn, HttpRoute *route)
+char *httpReadString(HttpConn *conn)
 {
     HttpRx      *rx;
-    HttpTx      *tx;
-    HttpLang    *lang;
-    MprPath     *info;
-
-    mprAssert(conn);
-    mprAssert(route);
+    ssize       sofar, nbytes, remaining;
+    char        *content;
 
     rx = conn->rx;
-    tx = conn->tx;
-    lang = rx->lang;
+    remaining = (ssize) min(MAXSSIZE, rx->length);
 
-    mprAssert(rx->target);
-    tx->filename = rx->target;
-    if (lang && lang->path) {
-        tx->filename = mprJoinPath(lang->path, tx->filename);
-    }
-    tx->filename = mprJoinPath(route->dir, tx->filename);
-    tx->ext = httpGetExt(conn);
-    info = &tx->fileInfo;
-    mprGetPathInfo(tx->filename, info);
-    if (info->valid) {
-        tx->etag = sfmt("\"%Lx-%Lx-%Lx\"", (int64) info->inode, (int64) info->size, (int64) info->mtime);
+    if (remaining > 0) {
+        content = mprAlloc(remaining + 1);
+        sofar = 0;
+        while (remaining > 0) {
+            nbytes = httpRead(conn, &content[sofar], remaining);
+            if (nbytes < 0) {
+                return 0;
+            }
+            sofar += nbytes;
+            remaining -= nbytes;
+        }
+    } else {
+        content = mprAlloc(HTTP_BUFSIZE);
+        sofar = 0;
+        while (1) {
+            nbytes = httpRead(conn, &content[sofar], HTTP_BUFSIZE);
+            if (nbytes < 0) {
+                return 0;
+            } else if (nbytes == 0) {
+                break;
+            }
+            sofar += nbytes;
+            content = mprRealloc(content, sofar + HTTP_BUFSIZE);
+        }
     }
-    LOG(7, "mapFile uri \"%s\", filename: \"%s\", extension: \"%s\"", rx->uri, tx->filename, tx->ext);
+    content[sofar] = '\0';
+    return content;
 }
 
 
-/************************************ API *************************************/
-
-int httpAddRouteCondition(HttpRoute *route, cchar *name, cchar *details, int flags)
+void httpRemoveQueue(HttpQueue *q)
 {
-    HttpRouteOp *op;
-    cchar       *errMsg;
-    char        *pattern, *value;
-    int         column;
+    q->prevQ->nextQ = q->nextQ;
+    q->nextQ->prevQ = q->prevQ;
+    q->prevQ = q->nextQ = q;
+}
 
-    mprAssert(route);
 
-    GRADUATE_LIST(route, conditions);
-    if ((op = createRouteOp(name, flags)) == 0) {
-        return MPR_ERR_MEMORY;
+void httpScheduleQueue(HttpQueue *q)
+{
+    HttpQueue     *head;
+    
+    mprAssert(q->conn);
+    head = q->conn->serviceq;
+    
+    if (q->scheduleNext == q && !(q->flags & HTTP_QUEUE_SUSPENDED)) {
+        q->scheduleNext = head;
+        q->schedulePrev = head->schedulePrev;
+        head->schedulePrev->scheduleNext = q;
+        head->schedulePrev = q;
     }
-    if (scaselessmatch(name, "auth")) {
-        /* Nothing to do. Route->auth has it all */
-
-    } else if (scaselessmatch(name, "missing")) {
-        op->details = finalizeReplacement(route, "${request:filename}");
+}
 
-    } else if (scaselessmatch(name, "directory")) {
-        op->details = finalizeReplacement(route, details);
 
-    } else if (scaselessmatch(name, "exists")) {
-        op->details = finalizeReplacement(route, details);
+void httpServiceQueue(HttpQueue *q)
+{
+    q->conn->currentq = q;
 
-    } else if (scaselessmatch(name, "match")) {
-        /* 
-            Condition match string pattern
-            String can contain matching ${tokens} from the route->pattern and can contain request ${tokens}
+    if (q->servicing) {
+        q->flags |= HTTP_QUEUE_RESERVICE;
+    } else {
+        /*  
+            Since we are servicing this "q" now, we can remove from the schedule queue if it is already queued.
          */
-        if (!httpTokenize(route, details, "%S %S", &value, &pattern)) {
-            return MPR_ERR_BAD_SYNTAX;
+        if (q->conn->serviceq->scheduleNext == q) {
+            httpGetNextQueueForService(q->conn->serviceq);
         }
-        if ((op->mdata = pcre_compile2(pattern, 0, 0, &errMsg, &column, NULL)) == 0) {
-            mprError("Can't compile condition match pattern. Error %s at column %d", errMsg, column); 
-            return MPR_ERR_BAD_SYNTAX;
+        if (!(q->flags & HTTP_QUEUE_SUSPENDED)) {
+            q->servicing = 1;
+            q->service(q);
+            if (q->flags & HTTP_QUEUE_RESERVICE) {
+                q->flags &= ~HTTP_QUEUE_RESERVICE;
+                httpScheduleQueue(q);
+            }
+            q->flags |= HTTP_QUEUE_SERVICED;
+            q->servicing = 0;
         }
-        op->details = finalizeReplacement(route, value);
-        op->flags |= HTTP_ROUTE_FREE;
     }
-    addUniqueItem(route->conditions, op);
-    return 0;
 }
 
 
-int httpAddRouteFilter(HttpRoute *route, cchar *name, cchar *extensions, int direction)
+/*  
+    Return true if the next queue will accept this packet. If not, then disable the queue's service procedure.
+    This may split the packet if it exceeds the downstreams maximum packet size.
+ */
+bool httpWillNextQueueAcceptPacket(HttpQueue *q, HttpPacket *packet)
 {
-    HttpStage   *stage;
-    HttpStage   *filter;
-    char        *extlist, *word, *tok;
-    int         pos;
+    HttpQueue   *nextQ;
+    ssize       size;
 
-    mprAssert(route);
-    
-    stage = httpLookupStage(route->http, name);
-    if (stage == 0) {
-        mprError("Can't find filter %s", name); 
-        return MPR_ERR_CANT_FIND;
+    nextQ = q->nextQ;
+    size = httpGetPacketLength(packet);
+    if (size <= nextQ->packetSize && (size + nextQ->count) <= nextQ->max) {
+        return 1;
     }
-    /*
-        Clone an existing stage because each filter stores its own set of extensions to match against
-     */
-    filter = httpCloneStage(route->http, stage);
-
-    if (extensions && *extensions) {
-        filter->extensions = mprCreateHash(0, MPR_HASH_CASELESS);
-        extlist = sclone(extensions);
-        word = stok(extlist, " \t\r\n", &tok);
-        while (word) {
-            if (*word == '*' && word[1] == '.') {
-                word += 2;
-            } else if (*word == '.') {
-                word++;
-            } else if (*word == '\"' && word[1] == '\"') {
-                word = "";
-            }
-            mprAddKey(filter->extensions, word, filter);
-            word = stok(0, " \t\r\n", &tok);
-        }
+    if (httpResizePacket(q, packet, 0) < 0) {
+        return 0;
     }
-    if (direction & HTTP_STAGE_RX && filter->incoming) {
-        GRADUATE_LIST(route, inputStages);
-        mprAddItem(route->inputStages, filter);
+    size = httpGetPacketLength(packet);
+    mprAssert(size <= nextQ->packetSize);
+    if ((size + nextQ->count) <= nextQ->max) {
+        return 1;
     }
-    if (direction & HTTP_STAGE_TX && filter->outgoing) {
-        GRADUATE_LIST(route, outputStages);
-        if (smatch(name, "cacheFilter") && 
-                (pos = mprGetListLength(route->outputStages) - 1) >= 0 &&
-                smatch(((HttpStage*) mprGetLastItem(route->outputStages))->name, "chunkFilter")) {
-            mprInsertItemAtPos(route->outputStages, pos, filter);
-        } else {
-            mprAddItem(route->outputStages, filter);
-        }
+    /*  
+        The downstream queue is full, so disable the queue and mark the downstream queue as full and service 
+     */
+    httpSuspendQueue(q);
+    if (!(nextQ->flags & HTTP_QUEUE_SUSPENDED)) {
+        httpScheduleQueue(nextQ);
     }
     return 0;
 }
 
 
-int httpAddRouteHandler(HttpRoute *route, cchar *name, cchar *extensions)
+/*  
+    Return true if the next queue will accept a certain amount of data.
+ */
+bool httpWillNextQueueAcceptSize(HttpQueue *q, ssize size)
 {
-    Http            *http;
-    HttpStage       *handler;
-    char            *extlist, *word, *tok;
-
-    mprAssert(route);
+    HttpQueue   *nextQ;
 
-    http = route->http;
-    if ((handler = httpLookupStage(http, name)) == 0) {
-        mprError("Can't find stage %s", name); 
-        return MPR_ERR_CANT_FIND;
+    nextQ = q->nextQ;
+    if (size <= nextQ->packetSize && (size + nextQ->count) <= nextQ->max) {
+        return 1;
     }
-    GRADUATE_HASH(route, extensions);
-
-    if (extensions && *extensions) {
-        /*
-            Add to the handler extension hash. Skip over "*." and "."
-         */ 
-        extlist = sclone(extensions);
-        word = stok(extlist, " \t\r\n", &tok);
-        while (word) {
-            if (*word == '*' && word[1] == '.') {
-                word += 2;
-            } else if (*word == '.') {
-                word++;
-            } else if (*word == '\"' && word[1] == '\"') {
-                word = "";
-            }
-            mprAddKey(route->extensions, word, handler);
-            word = stok(0, " \t\r\n", &tok);
-        }
-
-    } else {
-        if (mprLookupItem(route->handlers, handler) < 0) {
-            GRADUATE_LIST(route, handlers);
-            mprAddItem(route->handlers, handler);
-        }
-        if (handler->match) {
-            if (mprLookupItem(route->handlersWithMatch, handler) < 0) {
-                GRADUATE_LIST(route, handlersWithMatch);
-                mprAddItem(route->handlersWithMatch, handler);
-            }
-        } else {
-            /*
-                Only match by extensions if no-match routine provided.
-             */
-            mprAddKey(route->extensions, "", handler);
-        }
+    httpSuspendQueue(q);
+    if (!(nextQ->flags & HTTP_QUEUE_SUSPENDED)) {
+        httpScheduleQueue(nextQ);
     }
     return 0;
 }
 
 
-/*
-    Header field valuePattern
+/*  
+    Write a block of data. This is the lowest level write routine for data. This will buffer the data and flush if
+    the queue buffer is full. Flushing is done by calling httpFlushQueue which will service queues as required. This
+    may call the queue outgoing service routine and disable downstream queues if they are overfull.
+    This routine will always accept the data and never return "short". 
  */
-void httpAddRouteHeader(HttpRoute *route, cchar *header, cchar *value, int flags)
+ssize httpWriteBlock(HttpQueue *q, cchar *buf, ssize size)
 {
-    HttpRouteOp     *op;
-    cchar           *errMsg;
-    int             column;
+    HttpPacket  *packet;
+    HttpConn    *conn;
+    HttpTx      *tx;
+    ssize       bytes, written, packetSize;
 
-    mprAssert(route);
-    mprAssert(header && *header);
-    mprAssert(value && *value);
+    mprAssert(q == q->conn->writeq);
+               
+    conn = q->conn;
+    tx = conn->tx;
+    if (conn->finalized || tx == 0) {
+        return MPR_ERR_CANT_WRITE;
+    }
+    conn->responded = 1;
 
-    GRADUATE_LIST(route, headers);
-    if ((op = createRouteOp(header, flags | HTTP_ROUTE_FREE)) == 0) {
-        return;
+    for (written = 0; size > 0; ) {
+        LOG(7, "httpWriteBlock q_count %d, q_max %d", q->count, q->max);
+        if (conn->state >= HTTP_STATE_COMPLETE) {
+            return MPR_ERR_CANT_WRITE;
+        }
+        if (q->last != q->first && q->last->flags & HTTP_PACKET_DATA && !q->last->type) {
+            packet = q->last;
+            mprAssert(packet->content);
+        } else {
+            packet = 0;
+        }
+        if (packet == 0 || mprGetBufSpace(packet->content) == 0) {
+            packetSize = (tx->chunkSize > 0) ? tx->chunkSize : q->packetSize;
+            if ((packet = httpCreateDataPacket(packetSize)) == 0) {
+                return MPR_ERR_MEMORY;
+            }
+            httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+        }
+        if ((bytes = mprPutBlockToBuf(packet->content, buf, size)) == 0) {
+            return MPR_ERR_MEMORY;
+        }
+        buf += bytes;
+        size -= bytes;
+        q->count += bytes;
+        written += bytes;
+        if (q->count >= q->max) {
+            httpFlushQueue(q, 0);
+        }
     }
-    if ((op->mdata = pcre_compile2(value, 0, 0, &errMsg, &column, NULL)) == 0) {
-        mprError("Can't compile header pattern. Error %s at column %d", errMsg, column); 
-    } else {
-        mprAddItem(route->headers, op);
+    if (conn->error) {
+        return MPR_ERR_CANT_WRITE;
     }
+    return written;
 }
 
 
-#if FUTURE && KEEP
-void httpAddRouteLoad(HttpRoute *route, cchar *module, cchar *path)
+ssize httpWriteString(HttpQueue *q, cchar *s)
 {
-    HttpRouteOp     *op;
-
-    GRADUATE_LIST(route, updates);
-    if ((op = createRouteOp("--load--", 0)) == 0) {
-        return;
-    }
-    op->var = sclone(module);
-    op->value = sclone(path);
-    mprAddItem(route->updates, op);
+    return httpWriteBlock(q, s, strlen(s));
 }
-#endif
 
 
-/*
-    Param field valuePattern
- */
-void httpAddRouteParam(HttpRoute *route, cchar *field, cchar *value, int flags)
+ssize httpWriteSafeString(HttpQueue *q, cchar *s)
 {
-    HttpRouteOp     *op;
-    cchar           *errMsg;
-    int             column;
-
-    mprAssert(route);
-    mprAssert(field && *field);
-    mprAssert(value && *value);
-
-    GRADUATE_LIST(route, params);
-    if ((op = createRouteOp(field, flags | HTTP_ROUTE_FREE)) == 0) {
-        return;
-    }
-    if ((op->mdata = pcre_compile2(value, 0, 0, &errMsg, &column, NULL)) == 0) {
-        mprError("Can't compile field pattern. Error %s at column %d", errMsg, column); 
-    } else {
-        mprAddItem(route->params, op);
-    }
+    return httpWriteString(q, mprEscapeHtml(s));
 }
 
 
-/*
-    Add a route update record. These run to modify a request.
-        Update rule var value
-        rule == "cmd|param"
-        details == "var value"
-    Value can contain pattern and request tokens.
- */
-int httpAddRouteUpdate(HttpRoute *route, cchar *rule, cchar *details, int flags)
+ssize httpWrite(HttpQueue *q, cchar *fmt, ...)
 {
-    HttpRouteOp *op;
-    char        *value;
-
-    mprAssert(route);
-    mprAssert(rule && *rule);
-
-    GRADUATE_LIST(route, updates);
-    if ((op = createRouteOp(rule, flags)) == 0) {
-        return MPR_ERR_MEMORY;
-    }
-    if (scaselessmatch(rule, "cmd")) {
-        op->details = sclone(details);
-
-    } else if (scaselessmatch(rule, "lang")) {
-        /* Nothing to do */;
-
-    } else if (scaselessmatch(rule, "param")) {
-        if (!httpTokenize(route, details, "%S %S", &op->var, &value)) {
-            return MPR_ERR_BAD_SYNTAX;
-        }
-        op->value = finalizeReplacement(route, value);
+    va_list     vargs;
+    char        *buf;
     
-    } else {
-        return MPR_ERR_BAD_SYNTAX;
-    }
-    addUniqueItem(route->updates, op);
-    return 0;
+    va_start(vargs, fmt);
+    buf = sfmtv(fmt, vargs);
+    va_end(vargs);
+    return httpWriteString(q, buf);
 }
 
 
-void httpClearRouteStages(HttpRoute *route, int direction)
+bool httpVerifyQueue(HttpQueue *q)
 {
-    mprAssert(route);
+    HttpPacket  *packet;
+    ssize       count;
 
-    if (direction & HTTP_STAGE_RX) {
-        route->inputStages = mprCreateList(-1, 0);
-    }
-    if (direction & HTTP_STAGE_TX) {
-        route->outputStages = mprCreateList(-1, 0);
+    count = 0;
+    for (packet = q->first; packet; packet = packet->next) {
+        count += httpGetPacketLength(packet);
     }
+    mprAssert(count <= q->count);
+    return count <= q->count;
 }
 
+/*
+    @copy   default
 
-void httpDefineRouteTarget(cchar *key, HttpRouteProc *proc)
-{
-    mprAssert(key && *key);
-    mprAssert(proc);
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
 
-    mprAddKey(((Http*) MPR->httpService)->routeTargets, key, proc);
-}
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a 
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
 
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
 
-void httpDefineRouteCondition(cchar *key, HttpRouteProc *proc)
-{
-    mprAssert(key && *key);
-    mprAssert(proc);
+    @end
+ */
 
-    mprAddKey(((Http*) MPR->httpService)->routeConditions, key, proc);
-}
+/************************************************************************/
+/*
+    Start of file "src/rangeFilter.c"
+ */
+/************************************************************************/
 
+/*
+    rangeFilter.c - Ranged request filter.
+    Copyright (c) All Rights Reserved. See details at the end of the file.
+ */
 
-void httpDefineRouteUpdate(cchar *key, HttpRouteProc *proc)
-{
-    mprAssert(key && *key);
-    mprAssert(proc);
+/********************************* Includes ***********************************/
 
-    mprAddKey(((Http*) MPR->httpService)->routeUpdates, key, proc);
-}
 
 
-void *httpGetRouteData(HttpRoute *route, cchar *key)
-{
-    mprAssert(route);
-    mprAssert(key && *key);
+/********************************** Forwards **********************************/
 
-    if (!route->data) {
-        return 0;
-    }
-    return mprLookupKey(route->data, key);
-}
+static bool applyRange(HttpQueue *q, HttpPacket *packet);
+static void createRangeBoundary(HttpConn *conn);
+static HttpPacket *createRangePacket(HttpConn *conn, HttpRange *range);
+static HttpPacket *createFinalRangePacket(HttpConn *conn);
+static void outgoingRangeService(HttpQueue *q);
+static bool fixRangeLength(HttpConn *conn);
+static int matchRange(HttpConn *conn, HttpRoute *route, int dir);
+static void setRangeLength(HttpConn *conn);
+static void startRange(HttpQueue *q);
 
+/*********************************** Code *************************************/
 
-cchar *httpGetRouteDir(HttpRoute *route)
+int httpOpenRangeFilter(Http *http)
 {
-    mprAssert(route);
-    return route->dir;
+    HttpStage     *filter;
+
+    mprLog(5, "Open range filter");
+    if ((filter = httpCreateFilter(http, "rangeFilter", HTTP_STAGE_ALL, NULL)) == 0) {
+        return MPR_ERR_CANT_CREATE;
+    }
+    http->rangeFilter = filter;
+    filter->match = matchRange; 
+    filter->start = startRange; 
+    filter->outgoingService = outgoingRangeService; 
+    return 0;
 }
 
 
-cchar *httpGetRouteMethods(HttpRoute *route)
+/*
+    This is called twice: once for TX and once for RX
+ */
+static int matchRange(HttpConn *conn, HttpRoute *route, int dir)
 {
-    mprAssert(route);
-    return route->methodSpec;
+    mprAssert(conn->rx);
+
+    if ((dir & HTTP_STAGE_TX) && conn->tx->outputRanges) {
+        if (conn->tx->entityLength > 0) {
+            setRangeLength(conn);
+        }
+        return HTTP_ROUTE_OK;
+    }
+    return HTTP_ROUTE_REJECT;
 }
 
 
-void httpResetRoutePipeline(HttpRoute *route)
+/*
+    Compute the response length when the entity length is known. This permits a Content-Length header so the 
+    response does not need the chunk filter and static files can be sent using the send connector.
+ */
+static void setRangeLength(HttpConn *conn)
 {
-    mprAssert(route);
+    HttpTx      *tx;
+    HttpRange   *range;
+    HttpPacket  *packet;
+    MprOff      length;
 
-    if (route->parent == 0) {
-        route->errorDocuments = mprCreateHash(HTTP_SMALL_HASH_SIZE, 0);
-        route->caching = 0;
-        route->extensions = 0;
-        route->handlers = mprCreateList(-1, 0);
-        route->handlersWithMatch = mprCreateList(-1, 0);
-        route->inputStages = mprCreateList(-1, 0);
-        route->indicies = mprCreateList(-1, 0);
+    tx = conn->tx;
+    if (!fixRangeLength(conn)) {
+        return;
     }
-    route->outputStages = mprCreateList(-1, 0);
+    if (tx->outputRanges->next == 0) {
+        tx->length = tx->outputRanges->len;
+        return;
+    }
+    createRangeBoundary(conn);
+    length = 0;
+    for (range = tx->outputRanges; range; range = range->next) {
+        packet = createRangePacket(conn, range);
+        length += httpGetPacketLength(packet) + range->len;
+    }
+    packet = createFinalRangePacket(conn);
+    tx->length = length + httpGetPacketLength(packet);
 }
 
 
-void httpResetHandlers(HttpRoute *route)
+static void startRange(HttpQueue *q)
 {
-    mprAssert(route);
-    route->handlers = mprCreateList(-1, 0);
-    route->handlersWithMatch = mprCreateList(-1, 0);
+    HttpConn    *conn;
+    HttpTx      *tx;
+
+    conn = q->conn;
+    tx = conn->tx;
+    /*
+        The httpContentNotModified routine can set outputRanges to zero if returning not-modified.
+     */
+    if (tx->outputRanges == 0 || tx->status != HTTP_CODE_OK || !fixRangeLength(conn)) {
+        httpRemoveQueue(q);
+    } else {
+        tx->status = HTTP_CODE_PARTIAL;
+        if (tx->outputRanges->next && !tx->rangeBoundary) {
+            createRangeBoundary(conn);
+        }
+    }
 }
 
 
-void httpSetRouteAuth(HttpRoute *route, HttpAuth *auth)
+static void outgoingRangeService(HttpQueue *q)
 {
-    mprAssert(route);
-    route->auth = auth;
-}
+    HttpPacket  *packet;
+    HttpConn    *conn;
+    HttpTx      *tx;
 
+    conn = q->conn;
+    tx = conn->tx;
 
-void httpSetRouteAutoDelete(HttpRoute *route, bool enable)
-{
-    mprAssert(route);
-    route->autoDelete = enable;
+    for (packet = httpGetPacket(q); packet; packet = httpGetPacket(q)) {
+        if (packet->flags & HTTP_PACKET_DATA) {
+            if (!applyRange(q, packet)) {
+                return;
+            }
+        } else {
+            /*
+                Send headers and end packet downstream
+             */
+            if (!httpWillNextQueueAcceptPacket(q, packet)) {
+                httpPutBackPacket(q, packet);
+                return;
+            }
+            if (packet->flags & HTTP_PACKET_END && tx->rangeBoundary) {
+                httpPutPacketToNext(q, createFinalRangePacket(conn));
+            }
+            httpPutPacketToNext(q, packet);
+        }
+    }
 }
 
 
-void httpSetRouteCompression(HttpRoute *route, int flags)
+static bool applyRange(HttpQueue *q, HttpPacket *packet)
 {
-    mprAssert(route);
-    route->flags &= (HTTP_ROUTE_GZIP);
-    route->flags |= (HTTP_ROUTE_GZIP & flags);
-}
+    HttpRange   *range;
+    HttpConn    *conn;
+    HttpTx      *tx;
+    MprOff      endPacket, length, gap, span, count;
+    ssize       rc;
+    bool        usingSend;
 
+    conn = q->conn;
+    tx = conn->tx;
+    range = tx->currentRange;
+    usingSend = (tx->connector == conn->http->sendConnector);
 
-int httpSetRouteConnector(HttpRoute *route, cchar *name)
-{
-    HttpStage     *stage;
+    /*  
+        Process the data packet over multiple ranges ranges until all the data is processed or discarded.
+        A packet may contain data or it may be empty with an associated entityLength. If empty, range packets
+        are filled with entity data as required. The send connector transmits entity packets directly from the file,
+        so these are not filled and each range is passed as a single packet referencing the file offset.
+     */
+    while (range && packet) {
+        length = httpGetPacketEntityLength(packet);
+        if (length <= 0) {
+            break;
+        }
+        endPacket = tx->rangePos + length;
+        if (endPacket <= range->start) {
+            /* Packet is before the next range, so discard the entire packet and seek forwards */
+            tx->rangePos += length;
+            break;
 
-    mprAssert(route);
-    
-    stage = httpLookupStage(route->http, name);
-    if (stage == 0) {
-        mprError("Can't find connector %s", name); 
-        return MPR_ERR_CANT_FIND;
+        } else if (tx->rangePos < range->start) {
+            /*  Packet starts before range so skip some data, but some packet data is in range */
+            gap = (range->start - tx->rangePos);
+            tx->rangePos += gap;
+            if (gap < length) {
+                httpAdjustPacketStart(packet, (ssize) gap);
+            }
+            /* Keep going and examine next range */
+
+        } else {
+            /* In range */
+            mprAssert(range->start <= tx->rangePos && tx->rangePos < range->end);
+            span = min(length, (range->end - tx->rangePos));
+            if (usingSend && packet->content == 0) {
+                count = span;
+            } else {
+                count = min(span, q->nextQ->packetSize);
+                mprAssert(count > 0);
+                if (!httpWillNextQueueAcceptSize(q, (ssize) count)) {
+                    httpPutBackPacket(q, packet);
+                    return 0;
+                }
+            }
+            if (length > count) {
+                /* Split packet if packet extends past range */
+                httpPutBackPacket(q, httpSplitPacket(packet, count));
+            }
+            if (!usingSend && packet->fill && (rc = (*packet->fill)(q, packet, tx->rangePos, (ssize) count)) < 0) {
+                if (rc == MPR_ERR_NOT_READY) {
+                    /* Resumed when the data has been read */
+                    httpPutBackPacket(q, packet);
+                }
+                return 0;
+            }
+            if (tx->rangeBoundary && tx->rangePos == range->start) {
+                /* Boundary precedes the first packet of each range */
+                httpPutPacketToNext(q, createRangePacket(conn, range));
+            }
+            httpPutPacketToNext(q, packet);
+            packet = 0;
+            tx->rangePos += count;
+        }
+        if (tx->rangePos >= range->end) {
+            tx->currentRange = range = range->next;
+        }
     }
-    route->connector = stage;
-    return 0;
+    return 1;
 }
 
 
-void httpSetRouteData(HttpRoute *route, cchar *key, void *data)
+/*  
+    Create a range boundary packet
+ */
+static HttpPacket *createRangePacket(HttpConn *conn, HttpRange *range)
 {
-    mprAssert(route);
-    mprAssert(key && *key);
-    mprAssert(data);
-
-    if (route->data == 0) {
-        route->data = mprCreateHash(-1, 0);
-    } else {
-        GRADUATE_HASH(route, data);
-    }
-    mprAddKey(route->data, key, data);
-}
+    HttpPacket  *packet;
+    HttpTx      *tx;
+    char        *length;
 
+    tx = conn->tx;
 
-void httpSetRouteFlags(HttpRoute *route, int flags)
-{
-    mprAssert(route);
-    route->flags = flags;
+    length = (tx->entityLength >= 0) ? itos(tx->entityLength) : "*";
+    packet = httpCreatePacket(HTTP_RANGE_BUFSIZE);
+    packet->flags |= HTTP_PACKET_RANGE;
+    mprPutFmtToBuf(packet->content, 
+        "\r\n--%s\r\n"
+        "Content-Range: bytes %Ld-%Ld/%s\r\n\r\n",
+        tx->rangeBoundary, range->start, range->end - 1, length);
+    return packet;
 }
 
 
-int httpSetRouteHandler(HttpRoute *route, cchar *name)
+/*  
+    Create a final range packet that follows all the data
+ */
+static HttpPacket *createFinalRangePacket(HttpConn *conn)
 {
-    HttpStage     *handler;
-
-    mprAssert(route);
-    mprAssert(name && *name);
-    
-    if ((handler = httpLookupStage(route->http, name)) == 0) {
-        mprError("Can't find handler %s", name); 
-        return MPR_ERR_CANT_FIND;
-    }
-    route->handler = handler;
-    return 0;
-}
+    HttpPacket  *packet;
+    HttpTx      *tx;
 
+    tx = conn->tx;
 
-void httpSetRouteDir(HttpRoute *route, cchar *path)
-{
-    mprAssert(route);
-    mprAssert(path && *path);
-    
-    route->dir = httpMakePath(route, path);
-    httpSetRouteVar(route, "DOCUMENT_ROOT", route->dir);
+    packet = httpCreatePacket(HTTP_RANGE_BUFSIZE);
+    packet->flags |= HTTP_PACKET_RANGE;
+    mprPutFmtToBuf(packet->content, "\r\n--%s--\r\n", tx->rangeBoundary);
+    return packet;
 }
 
 
-/*
-    WARNING: internal API only. 
+/*  
+    Create a range boundary. This is required if more than one range is requested.
  */
-void httpSetRouteHost(HttpRoute *route, HttpHost *host)
+static void createRangeBoundary(HttpConn *conn)
 {
-    mprAssert(route);
-    mprAssert(host);
-    
-    route->host = host;
-    defineHostVars(route);
+    HttpTx      *tx;
+    int         when;
+
+    tx = conn->tx;
+    mprAssert(tx->rangeBoundary == 0);
+    when = (int) conn->http->now;
+    tx->rangeBoundary = sfmt("%08X%08X", PTOI(tx) + PTOI(conn) * when, when);
 }
 
 
-void httpAddRouteIndex(HttpRoute *route, cchar *index)
+/*  
+    Ensure all the range limits are within the entity size limits. Fixup negative ranges.
+ */
+static bool fixRangeLength(HttpConn *conn)
 {
-    cchar   *item;
-    int     next;
+    HttpTx      *tx;
+    HttpRange   *range, *prev;
+    MprOff      length;
 
-    mprAssert(route);
-    mprAssert(index && *index);
-    
-    GRADUATE_LIST(route, indicies);
-    for (ITERATE_ITEMS(route->indicies, item, next)) {
-        if (smatch(index, item)) {
-            return;
+    tx = conn->tx;
+    length = tx->entityLength ? tx->entityLength : tx->length;
+
+    for (prev = 0, range = tx->outputRanges; range; range = range->next) {
+        /*
+                Range: 0-49             first 50 bytes
+                Range: 50-99,200-249    Two 50 byte ranges from 50 and 200
+                Range: -50              Last 50 bytes
+                Range: 1-               Skip first byte then emit the rest
+         */
+        if (length) {
+            if (range->end > length) {
+                range->end = length;
+            }
+            if (range->start >= length) {
+                /* Ranges starting at or beyond the end of the entity are not satisfiable and are ignored */
+                if (prev) {
+                    prev->next = range->next;
+                } else {
+                    tx->outputRanges = range->next;
+                }
+                continue;
+            }
+        }
+        if (range->start < 0) {
+            if (length <= 0) {
+                /*
+                    Can't compute an offset from the end as we don't know the entity length and it is not always possible
+                    or wise to buffer all the output.
+                 */
+                httpError(conn, HTTP_CODE_RANGE_NOT_SATISFIABLE, "Can't compute end range with unknown content length"); 
+                return 0;
+            }
+            /* select last -range-end bytes */
+            range->start = length - range->end + 1;
+            range->end = length;
+        }
+        if (range->end < 0) {
+            if (length <= 0) {
+                return 0;
+            }
+            range->end = length - range->end - 1;
         }
+        range->len = range->end - range->start;
+        prev = range;
     }
-    mprAddItem(route->indicies, sclone(index));
+    if (tx->outputRanges == 0) {
+        httpSetHeader(conn, "Content-Range", "bytes */%Ld", length);
+        httpError(conn, HTTP_CODE_RANGE_NOT_SATISFIABLE, "Range not satisfiable");
+        return 0;
+    }
+    tx->currentRange = tx->outputRanges;
+    return 1;
 }
 
 
-void httpSetRouteMethods(HttpRoute *route, cchar *methods)
-{
-    mprAssert(route);
-    mprAssert(methods && methods);
+/*
+    @copy   default
 
-    route->methodSpec = sclone(methods);
-    finalizeMethods(route);
-}
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
 
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a 
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
 
-void httpSetRouteName(HttpRoute *route, cchar *name)
-{
-    mprAssert(route);
-    mprAssert(name && *name);
-    
-    route->name = sclone(name);
-}
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
 
+    @end
+ */
 
-void httpSetRoutePattern(HttpRoute *route, cchar *pattern, int flags)
-{
-    mprAssert(route);
-    mprAssert(pattern && *pattern);
-    
-    route->flags |= (flags & HTTP_ROUTE_NOT);
-    route->pattern = sclone(pattern);
-    finalizePattern(route);
-}
+/************************************************************************/
+/*
+    Start of file "src/route.c"
+ */
+/************************************************************************/
 
+/*
+    route.c -- Http request routing 
 
-void httpSetRoutePrefix(HttpRoute *route, cchar *prefix)
-{
-    mprAssert(route);
-    mprAssert(prefix && *prefix);
-    
-    route->prefix = sclone(prefix);
-    route->prefixLen = slen(prefix);
-    if (route->pattern) {
-        finalizePattern(route);
-    }
-}
+    Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
+ */
 
+/********************************* Includes ***********************************/
 
-void httpSetRouteSource(HttpRoute *route, cchar *source)
-{
-    mprAssert(route);
-    mprAssert(source);
 
-    /* Source can be empty */
-    route->sourceName = sclone(source);
-}
+#include    "pcre.h"
 
+/********************************** Forwards **********************************/
 
-void httpSetRouteScript(HttpRoute *route, cchar *script, cchar *scriptPath)
-{
-    mprAssert(route);
-    
-    if (script) {
-        mprAssert(*script);
-        route->script = sclone(script);
+#define GRADUATE_LIST(route, field) \
+    if (route->field == 0) { \
+        route->field = mprCreateList(-1, 0); \
+    } else if (route->parent && route->field == route->parent->field) { \
+        route->field = mprCloneList(route->parent->field); \
     }
-    if (scriptPath) {
-        mprAssert(*scriptPath);
-        route->scriptPath = sclone(scriptPath);
+
+#define GRADUATE_HASH(route, field) \
+    mprAssert(route->field) ; \
+    if (route->parent && route->field == route->parent->field) { \
+        route->field = mprCloneHash(route->parent->field); \
     }
-}
 
+/********************************** Forwards **********************************/
 
-/*
-    Target names are extensible and hashed in http->routeTargets. 
+static void addUniqueItem(MprList *list, HttpRouteOp *op);
+static HttpLang *createLangDef(cchar *path, cchar *suffix, int flags);
+static HttpRouteOp *createRouteOp(cchar *name, int flags);
+static void definePathVars(HttpRoute *route);
+static void defineHostVars(HttpRoute *route);
+static char *expandTokens(HttpConn *conn, cchar *path);
+static char *expandPatternTokens(cchar *str, cchar *replacement, int *matches, int matchCount);
+static char *expandRequestTokens(HttpConn *conn, char *targetKey);
+static cchar *expandRouteName(HttpConn *conn, cchar *routeName);
+static void finalizeMethods(HttpRoute *route);
+static void finalizePattern(HttpRoute *route);
+static char *finalizeReplacement(HttpRoute *route, cchar *str);
+static char *finalizeTemplate(HttpRoute *route);
+static bool opPresent(MprList *list, HttpRouteOp *op);
+static void manageRoute(HttpRoute *route, int flags);
+static void manageLang(HttpLang *lang, int flags);
+static void manageRouteOp(HttpRouteOp *op, int flags);
+static int matchRequestUri(HttpConn *conn, HttpRoute *route);
+static int testRoute(HttpConn *conn, HttpRoute *route);
+static char *qualifyName(HttpRoute *route, cchar *controller, cchar *name);
+static int selectHandler(HttpConn *conn, HttpRoute *route);
+static int testCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *condition);
+static char *trimQuotes(char *str);
+static int updateRequest(HttpConn *conn, HttpRoute *route, HttpRouteOp *update);
 
-        Target close
-        Target redirect status [URI]
-        Target run ${DOCUMENT_ROOT}/${request:uri}.gz
-        Target run ${controller}-${name} 
-        Target write [-r] status "Hello World\r\n"
+/************************************ Code ************************************/
+/*
+    Host may be null
  */
-int httpSetRouteTarget(HttpRoute *route, cchar *rule, cchar *details)
+HttpRoute *httpCreateRoute(HttpHost *host)
 {
-    char    *redirect, *msg;
-
-    mprAssert(route);
-    mprAssert(rule && *rule);
-
-    route->targetRule = sclone(rule);
-    route->target = sclone(details);
-
-    if (scaselessmatch(rule, "close")) {
-        route->target = sclone(details);
+    HttpRoute  *route;
 
-    } else if (scaselessmatch(rule, "redirect")) {
-        if (!httpTokenize(route, details, "%N ?S", &route->responseStatus, &redirect)) {
-            return MPR_ERR_BAD_SYNTAX;
-        }
-        route->target = finalizeReplacement(route, redirect);
+    if ((route = mprAllocObj(HttpRoute, manageRoute)) == 0) {
         return 0;
-
-    } else if (scaselessmatch(rule, "run")) {
-        route->target = finalizeReplacement(route, details);
-
-    } else if (scaselessmatch(rule, "write")) {
-        /*
-            Write [-r] status Message
-         */
-        if (sncmp(details, "-r", 2) == 0) {
-            route->flags |= HTTP_ROUTE_RAW;
-            details = &details[2];
-        }
-        if (!httpTokenize(route, details, "%N %S", &route->responseStatus, &msg)) {
-            return MPR_ERR_BAD_SYNTAX;
-        }
-        route->target = finalizeReplacement(route, msg);
-
-    } else {
-        return MPR_ERR_BAD_SYNTAX;
     }
-    return 0;
-}
-
-
-void httpSetRouteTemplate(HttpRoute *route, cchar *tplate)
-{
-    mprAssert(route);
-    mprAssert(tplate && *tplate);
-    
-    route->tplate = sclone(tplate);
-}
-
-
-void httpSetRouteWorkers(HttpRoute *route, int workers)
-{
-    mprAssert(route);
-    route->workers = workers;
-}
-
+    route->auth = httpCreateAuth();
+    route->defaultLanguage = sclone("en");
+    route->dir = mprGetCurrentPath(".");
+    route->errorDocuments = mprCreateHash(HTTP_SMALL_HASH_SIZE, 0);
+    route->extensions = mprCreateHash(HTTP_SMALL_HASH_SIZE, MPR_HASH_CASELESS);
+    route->flags = HTTP_ROUTE_GZIP;
+    route->handlers = mprCreateList(-1, 0);
+    route->handlersWithMatch = mprCreateList(-1, 0);
+    route->host = host;
+    route->http = MPR->httpService;
+    route->indicies = mprCreateList(-1, 0);
+    route->inputStages = mprCreateList(-1, 0);
+    route->lifespan = HTTP_CACHE_LIFESPAN;
+    route->outputStages = mprCreateList(-1, 0);
+    route->vars = mprCreateHash(HTTP_SMALL_HASH_SIZE, MPR_HASH_CASELESS);
+    route->pattern = MPR->emptyString;
+    route->targetRule = sclone("run");
+    route->autoDelete = 1;
+    route->workers = -1;
+    route->sessionCookieMax = HTTP_SESSION_MAX_COOKIE;
 
-void httpAddRouteErrorDocument(HttpRoute *route, int status, cchar *url)
-{
-    char    *code;
+    if (MPR->httpService) {
+        route->limits = mprMemdup(((Http*) MPR->httpService)->serverLimits, sizeof(HttpLimits));
+    }
+    route->mimeTypes = MPR->mimeTypes;
+    route->mutex = mprCreateLock();
+    httpInitTrace(route->trace);
 
-    mprAssert(route);
-    GRADUATE_HASH(route, errorDocuments);
-    code = itos(status);
-    mprAddKey(route->errorDocuments, code, sclone(url));
+    if ((route->mimeTypes = mprCreateMimeTypes("mime.types")) == 0) {
+        route->mimeTypes = MPR->mimeTypes;                                                                  
+    }  
+    definePathVars(route);
+    return route;
 }
 
 
-cchar *httpLookupRouteErrorDocument(HttpRoute *route, int code)
+/*  
+    Create a new location block. Inherit from the parent. We use a copy-on-write scheme if these are modified later.
+ */
+HttpRoute *httpCreateInheritedRoute(HttpRoute *parent)
 {
-    char   *num;
+    HttpRoute  *route;
 
-    mprAssert(route);
-    if (route->errorDocuments == 0) {
+    if (!parent && (parent = httpGetDefaultRoute(0)) == 0) {
         return 0;
     }
-    num = itos(code);
-    return (cchar*) mprLookupKey(route->errorDocuments, num);
+    if ((route = mprAllocObj(HttpRoute, manageRoute)) == 0) {
+        return 0;
+    }
+    //  OPT. Structure assigment then overwrite.
+    route->parent = parent;
+    route->auth = httpCreateInheritedAuth(parent->auth);
+    route->autoDelete = parent->autoDelete;
+    route->caching = parent->caching;
+    route->conditions = parent->conditions;
+    route->connector = parent->connector;
+    route->defaultLanguage = parent->defaultLanguage;
+    route->dir = parent->dir;
+    route->data = parent->data;
+    route->eroute = parent->eroute;
+    route->errorDocuments = parent->errorDocuments;
+    route->extensions = parent->extensions;
+    route->handler = parent->handler;
+    route->handlers = parent->handlers;
+    route->handlersWithMatch = parent->handlersWithMatch;
+    route->headers = parent->headers;
+    route->http = MPR->httpService;
+    route->host = parent->host;
+    route->inputStages = parent->inputStages;
+    route->indicies = parent->indicies;
+    route->languages = parent->languages;
+    route->lifespan = parent->lifespan;
+    route->methods = parent->methods;
+    route->methodSpec = parent->methodSpec;
+    route->outputStages = parent->outputStages;
+    route->params = parent->params;
+    route->parent = parent;
+    route->vars = parent->vars;
+    route->pattern = parent->pattern;
+    route->patternCompiled = parent->patternCompiled;
+    route->optimizedPattern = parent->optimizedPattern;
+    route->responseStatus = parent->responseStatus;
+    route->script = parent->script;
+    route->prefix = parent->prefix;
+    route->prefixLen = parent->prefixLen;
+    route->scriptPath = parent->scriptPath;
+    route->sourceName = parent->sourceName;
+    route->sourcePath = parent->sourcePath;
+    route->ssl = parent->ssl;
+    route->target = parent->target;
+    route->targetRule = parent->targetRule;
+    route->tokens = parent->tokens;
+    route->updates = parent->updates;
+    route->uploadDir = parent->uploadDir;
+    route->workers = parent->workers;
+    route->webSocketsDeflate = parent->webSocketsDeflate;
+    route->sessionStore = parent->sessionStore;
+    route->sessionCookieMax = parent->sessionCookieMax;
+    route->sessionKeys = parent->sessionKeys;
+    route->limits = parent->limits;
+    route->mimeTypes = parent->mimeTypes;
+    route->trace[0] = parent->trace[0];
+    route->trace[1] = parent->trace[1];
+    route->log = parent->log;
+    route->logFormat = parent->logFormat;
+    route->logPath = parent->logPath;
+    route->logSize = parent->logSize;
+    route->logBackup = parent->logBackup;
+    route->logFlags = parent->logFlags;
+    route->flags = parent->flags & ~(HTTP_ROUTE_FREE_PATTERN);
+    return route;
 }
 
-/********************************* Route Finalization *************************/
 
-static void finalizeMethods(HttpRoute *route)
+static void manageRoute(HttpRoute *route, int flags)
 {
-    char    *method, *methods, *tok;
-
-    mprAssert(route);
-    methods = route->methodSpec;
-    if (methods && *methods && !scaselessmatch(methods, "ALL") && !smatch(methods, "*")) {
-        if ((route->methods = mprCreateHash(-1, 0)) == 0) {
-            return;
-        }
-        methods = sclone(methods);
-        while ((method = stok(methods, ", \t\n\r", &tok)) != 0) {
-            mprAddKey(route->methods, method, route);
-            methods = 0;
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(route->name);
+        mprMark(route->pattern);
+        mprMark(route->startSegment);
+        mprMark(route->startWith);
+        mprMark(route->optimizedPattern);
+        mprMark(route->prefix);
+        mprMark(route->tplate);
+        mprMark(route->targetRule);
+        mprMark(route->target);
+        mprMark(route->dir);
+        mprMark(route->indicies);
+        mprMark(route->methodSpec);
+        mprMark(route->handler);
+        mprMark(route->caching);
+        mprMark(route->auth);
+        mprMark(route->http);
+        mprMark(route->host);
+        mprMark(route->parent);
+        mprMark(route->defaultLanguage);
+        mprMark(route->extensions);
+        mprMark(route->handlers);
+        mprMark(route->handlersWithMatch);
+        mprMark(route->connector);
+        mprMark(route->data);
+        mprMark(route->eroute);
+        mprMark(route->vars);
+        mprMark(route->languages);
+        mprMark(route->inputStages);
+        mprMark(route->outputStages);
+        mprMark(route->errorDocuments);
+        mprMark(route->context);
+        mprMark(route->uploadDir);
+        mprMark(route->script);
+        mprMark(route->scriptPath);
+        mprMark(route->methods);
+        mprMark(route->params);
+        mprMark(route->headers);
+        mprMark(route->conditions);
+        mprMark(route->updates);
+        mprMark(route->sourceName);
+        mprMark(route->sourcePath);
+        mprMark(route->tokens);
+        mprMark(route->ssl);
+        mprMark(route->limits);
+        mprMark(route->mimeTypes);
+        mprMark(route->sessionKeys);
+        httpManageTrace(&route->trace[0], flags);
+        httpManageTrace(&route->trace[1], flags);
+        mprMark(route->log);
+        mprMark(route->logFormat);
+        mprMark(route->logPath);
+        mprMark(route->mutex);
+
+    } else if (flags & MPR_MANAGE_FREE) {
+        if (route->patternCompiled && (route->flags & HTTP_ROUTE_FREE_PATTERN)) {
+            free(route->patternCompiled);
+            route->patternCompiled = 0;
         }
-    } else {
-        route->methodSpec = sclone("*");
     }
 }
 
 
-/*
-    Finalize the pattern. 
-        - Change "\{n[:m]}" to "{n[:m]}"
-        - Change "\~" to "~"
-        - Change "(~ PAT ~)" to "(?: PAT )?"
-        - Extract the tokens and change tokens: "{word}" to "([^/]*)"
- */
-static void finalizePattern(HttpRoute *route)
+HttpRoute *httpCreateDefaultRoute(HttpHost *host)
 {
-    MprBuf      *pattern;
-    cchar       *errMsg;
-    char        *startPattern, *cp, *ep, *token, *field;
-    ssize       len;
-    int         column;
-
-    mprAssert(route);
-    route->tokens = mprCreateList(-1, 0);
-    pattern = mprCreateBuf(-1, -1);
-    startPattern = route->pattern[0] == '^' ? &route->pattern[1] : route->pattern;
+    HttpRoute   *route;
 
-    if (route->name == 0) {
-        route->name = sclone(startPattern);
-    }
-    if (route->tplate == 0) {
-        /* Do this while the prefix is still in the route pattern */
-        route->tplate = finalizeTemplate(route);
-    }
-    /*
-        Create an simple literal startWith string to optimize route rejection.
-     */
-    len = strcspn(startPattern, "^$*+?.(|{[\\");
-    if (len) {
-        route->startWith = snclone(startPattern, len);
-        route->startWithLen = len;
-        if ((cp = strchr(&route->startWith[1], '/')) != 0) {
-            route->startSegment = snclone(route->startWith, cp - route->startWith);
-        } else {
-            route->startSegment = route->startWith;
-        }
-        route->startSegmentLen = slen(route->startSegment);
-    } else {
-        /* Pattern has special characters */
-        route->startWith = 0;
-        route->startWithLen = 0;
-        route->startSegmentLen = 0;
-        route->startSegment = 0;
+    mprAssert(host);
+    if ((route = httpCreateRoute(host)) == 0) {
+        return 0;
     }
+    httpSetRouteName(route, "default");
+    httpFinalizeRoute(route);
+    return route;
+}
+
+
+/*
+    Create and configure a basic route. This is mainly used for client side piplines.
+    Host may be null.
+ */
+HttpRoute *httpCreateConfiguredRoute(HttpHost *host, int serverSide)
+{
+    HttpRoute   *route;
+    Http        *http;
 
     /*
-        Remove the route prefix from the start of the compiled pattern.
+        Create default incoming and outgoing pipelines. Order matters.
      */
-    if (route->prefix && sstarts(startPattern, route->prefix)) {
-        mprAssert(route->prefixLen <= route->startWithLen);
-        startPattern = sfmt("^%s", &startPattern[route->prefixLen]);
-    } else {
-        startPattern = sjoin("^", startPattern, NULL);
+    route = httpCreateRoute(host);
+    http = route->http;
+    httpAddRouteFilter(route, http->rangeFilter->name, NULL, HTTP_STAGE_TX);
+    httpAddRouteFilter(route, http->chunkFilter->name, NULL, HTTP_STAGE_RX | HTTP_STAGE_TX);
+    if (serverSide) {
+        httpAddRouteFilter(route, http->uploadFilter->name, NULL, HTTP_STAGE_RX);
     }
-    for (cp = startPattern; *cp; cp++) {
-        /* Alias for optional, non-capturing pattern:  "(?: PAT )?" */
-        if (*cp == '(' && cp[1] == '~') {
-            mprPutStringToBuf(pattern, "(?:");
-            cp++;
+    return route;
+}
 
-        } else if (*cp == '(') {
-            mprPutCharToBuf(pattern, *cp);
-        } else if (*cp == '~' && cp[1] == ')') {
-            mprPutStringToBuf(pattern, ")?");
-            cp++;
 
-        } else if (*cp == ')') {
-            mprPutCharToBuf(pattern, *cp);
+HttpRoute *httpCreateAliasRoute(HttpRoute *parent, cchar *pattern, cchar *path, int status)
+{
+    HttpRoute   *route;
 
-        } else if (*cp == '{') {
-            if (cp > startPattern&& cp[-1] == '\\') {
-                mprAdjustBufEnd(pattern, -1);
-                mprPutCharToBuf(pattern, *cp);
-            } else {
-                if ((ep = schr(cp, '}')) != 0) {
-                    /* Trim {} off the token and replace in pattern with "([^/]*)"  */
-                    token = snclone(&cp[1], ep - cp - 1);
-                    if ((field = schr(token, '=')) != 0) {
-                        *field++ = '\0';
-                        field = sfmt("(%s)", field);
-                    } else {
-                        field = "([^/]*)";
-                    }
-                    mprPutStringToBuf(pattern, field);
-                    mprAddItem(route->tokens, token);
-                    /* Params ends up looking like "$1:$2:$3:$4" */
-                    cp = ep;
-                }
-            }
-        } else if (*cp == '\\' && *cp == '~') {
-            mprPutCharToBuf(pattern, *++cp);
+    mprAssert(parent);
+    mprAssert(pattern && *pattern);
 
-        } else {
-            mprPutCharToBuf(pattern, *cp);
-        }
+    if ((route = httpCreateInheritedRoute(parent)) == 0) {
+        return 0;
     }
-    mprAddNullToBuf(pattern);
-    route->optimizedPattern = sclone(mprGetBufStart(pattern));
-    if (mprGetListLength(route->tokens) == 0) {
-        route->tokens = 0;
+    httpSetRoutePattern(route, pattern, 0);
+    if (path) {
+        httpSetRouteDir(route, path);
     }
-    if (route->patternCompiled && (route->flags & HTTP_ROUTE_FREE_PATTERN)) {
-        free(route->patternCompiled);
+    route->responseStatus = status;
+    return route;
+}
+
+
+/*
+    This routine binds a new route to a URI. It creates a handler, route and binds a callback to that route. 
+ */
+HttpRoute *httpCreateProcRoute(HttpRoute *parent, cchar *pattern, HttpProc proc)
+{
+    HttpRoute   *route;
+
+    if (!pattern || !proc) {
+        return 0;
     }
-    if ((route->patternCompiled = pcre_compile2(route->optimizedPattern, 0, 0, &errMsg, &column, NULL)) == 0) {
-        mprError("Can't compile route. Error %s at column %d", errMsg, column); 
+    if ((route = httpCreateInheritedRoute(parent)) != 0) {
+        route->handler = route->http->procHandler;
+        httpSetRoutePattern(route, pattern, 0);
+        httpDefineProc(pattern, proc);
+        httpFinalizeRoute(route);
     }
-    route->flags |= HTTP_ROUTE_FREE_PATTERN;
+    return route;
 }
 
 
-static char *finalizeReplacement(HttpRoute *route, cchar *str)
+int httpStartRoute(HttpRoute *route)
 {
-    MprBuf      *buf;
-    cchar       *item;
-    cchar       *tok, *cp, *ep, *token;
-    int         next, braced;
+#if !BIT_ROM
+    if (!(route->flags & HTTP_ROUTE_STARTED)) {
+        route->flags |= HTTP_ROUTE_STARTED;
+        if (route->logPath && (!route->parent || route->logPath != route->parent->logPath)) {
+            if (route->logBackup > 0) {
+                httpBackupRouteLog(route);
+            }
+            mprAssert(!route->log);
+            route->log = mprOpenFile(route->logPath, O_CREAT | O_APPEND | O_WRONLY | O_TEXT, 0664);
+            if (route->log == 0) {
+                mprError("Can't open log file %s", route->logPath);
+                return MPR_ERR_CANT_OPEN;
+            }
+        }
+    }
+#endif
+    return 0;
+}
 
-    mprAssert(route);
 
-    /*
-        Prepare a replacement string. Change $token to $N
-     */
-    buf = mprCreateBuf(-1, -1);
-    if (str && *str) {
-        for (cp = str; *cp; cp++) {
-            if ((tok = schr(cp, '$')) != 0 && (tok == str || tok[-1] != '\\')) {
-                if (tok > cp) {
-                    mprPutBlockToBuf(buf, cp, tok - cp);
-                }
-                if ((braced = (*++tok == '{')) != 0) {
-                    tok++;
-                }
-                if (*tok == '&' || *tok == '\'' || *tok == '`' || *tok == '$') {
-                    mprPutCharToBuf(buf, '$');
-                    mprPutCharToBuf(buf, *tok);
-                    ep = tok + 1;
-                } else {
-                    if (braced) {
-                        for (ep = tok; *ep && *ep != '}'; ep++) ;
-                    } else {
-                        for (ep = tok; *ep && isdigit((uchar) *ep); ep++) ;
-                    }
-                    token = snclone(tok, ep - tok);
-                    if (schr(token, ':')) {
-                        /* Double quote to get through two levels of expansion in writeTarget */
-                        mprPutStringToBuf(buf, "$${");
-                        mprPutStringToBuf(buf, token);
-                        mprPutCharToBuf(buf, '}');
-                    } else {
-                        for (next = 0; (item = mprGetNextItem(route->tokens, &next)) != 0; ) {
-                            if (scmp(item, token) == 0) {
-                                break;
-                            }
-                        }
-                        /*  Insert "$" in front of "{token}" */
-                        if (item) {
-                            mprPutCharToBuf(buf, '$');
-                            mprPutIntToBuf(buf, next);
-                        } else if (snumber(token)) {
-                            mprPutCharToBuf(buf, '$');
-                            mprPutStringToBuf(buf, token);
-                        } else {
-                            mprError("Can't find token \"%s\" in template \"%s\"", token, route->pattern);
-                        }
-                    }
-                }
-                if (braced) {
-                    ep++;
-                }
-                cp = ep - 1;
-
-            } else {
-                if (*cp == '\\') {
-                    if (cp[1] == 'r') {
-                        mprPutCharToBuf(buf, '\r');
-                        cp++;
-                    } else if (cp[1] == 'n') {
-                        mprPutCharToBuf(buf, '\n');
-                        cp++;
-                    } else {
-                        mprPutCharToBuf(buf, *cp);
-                    }
-                } else {
-                    mprPutCharToBuf(buf, *cp);
-                }
-            }
-        }
-    }
-    mprAddNullToBuf(buf);
-    return sclone(mprGetBufStart(buf));
+void httpStopRoute(HttpRoute *route)
+{
+    route->log = 0;
 }
 
 
 /*
-    Convert a route pattern into a usable template to construct URI links
-    NOTE: this is heuristic and not perfect. Users can define the template via the httpSetTemplate API or in appweb via the
-    EspURITemplate configuration directive.
+    Find the matching route and handler for a request. If any errors occur, the pass handler is used to 
+    pass errors via the net/sendfile connectors onto the client. This process may rewrite the request 
+    URI and may redirect the request.
  */
-static char *finalizeTemplate(HttpRoute *route)
+void httpRouteRequest(HttpConn *conn)
 {
-    MprBuf  *buf;
-    char    *sp, *tplate;
+    HttpRx      *rx;
+    HttpTx      *tx;
+    HttpRoute   *route;
+    int         next, rewrites, match;
 
-    if ((buf = mprCreateBuf(0, 0)) == 0) {
-        return 0;
-    }
-    /*
-        Note: the route->pattern includes the prefix
-     */
-    for (sp = route->pattern; *sp; sp++) {
-        switch (*sp) {
-        default:
-            mprPutCharToBuf(buf, *sp);
-            break;
-        case '$':
-            if (sp[1] == '\0') {
-                sp++;
-            } else {
-                mprPutCharToBuf(buf, *sp);
-            }
-            break;
-        case '^':
-            if (sp > route->pattern) {
-                mprPutCharToBuf(buf, *sp);
-            }
-            break;
-        case '+':
-        case '?':
-        case '|':
-        case '[':
-        case ']':
-        case '*':
-        case '.':
-            break;
-        case '(':
-            if (sp[1] == '~') {
-                sp++;
-            }
-            break;
-        case '~':
-            if (sp[1] == ')') {
-                sp++;
-            } else {
-                mprPutCharToBuf(buf, *sp);
-            }
-            break;
-        case ')':
-            break;
-        case '\\':
-            if (sp[1] == '\\') {
-                mprPutCharToBuf(buf, *sp++);
-            } else {
-                mprPutCharToBuf(buf, *++sp);
-            }
+    rx = conn->rx;
+    tx = conn->tx;
+
+    for (next = rewrites = 0; rewrites < HTTP_MAX_REWRITE; ) {
+        if ((route = mprGetNextItem(conn->host->routes, &next)) == 0) {
             break;
-        case '{':
-            mprPutCharToBuf(buf, '$');
-            while (sp[1] && *sp != '}') {
-                if (*sp == '=') {
-                    while (sp[1] && *sp != '}') sp++;
-                } else {
-                    mprPutCharToBuf(buf, *sp++);
-                }
-            }
-            mprPutCharToBuf(buf, '}');
+        }
+        if (route->startSegment && strncmp(rx->pathInfo, route->startSegment, route->startSegmentLen) != 0) {
+            /* Failed to match the first URI segment, skip to the next group */
+            mprAssert(next <= route->nextGroup);
+            next = route->nextGroup;
+
+        } else if (route->startWith && strncmp(rx->pathInfo, route->startWith, route->startWithLen) != 0) {
+            /* Failed to match starting literal segment of the route pattern, advance to test the next route */
+            continue;
+
+        } else if ((match = httpMatchRoute(conn, route)) == HTTP_ROUTE_REROUTE) {
+            next = 0;
+            route = 0;
+            rewrites++;
+
+        } else if (match == HTTP_ROUTE_OK) {
             break;
         }
     }
-    if (mprLookAtLastCharInBuf(buf) == '/') {
-        mprAdjustBufEnd(buf, -1);
+    if (route == 0 || tx->handler == 0) {
+        /* Ensure this is emitted to the log */
+        mprError("Can't find suitable route for request %s", rx->pathInfo);
+        httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Can't find suitable route for request");
+        return;
     }
-    mprAddNullToBuf(buf);
-    if (mprGetBufLength(buf) > 0) {
-        tplate = sclone(mprGetBufStart(buf));
-    } else {
-        tplate = sclone("/");
+    if (rx->traceLevel >= 0) {
+        mprLog(4, "Select route \"%s\" target \"%s\"", route->name, route->targetRule);
+    }
+    rx->route = route;
+    conn->limits = route->limits;
+
+    conn->trace[0] = route->trace[0];
+    conn->trace[1] = route->trace[1];
+
+    if (rewrites >= HTTP_MAX_REWRITE) {
+        httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Too many request rewrites");
+    }
+    if (conn->finalized) {
+        /* 
+            Must be no data in queues as handlers and pipeline are not yet started. Only errors and redirects 
+            using tx->altBody 
+         */ 
+        tx->handler = conn->http->passHandler;
+    }
+    if (rx->traceLevel >= 0) {
+        mprLog(rx->traceLevel, "Select handler: \"%s\" for \"%s\"", tx->handler->name, rx->uri);
     }
-    return tplate;
 }
 
 
-void httpFinalizeRoute(HttpRoute *route)
+
+int httpMatchRoute(HttpConn *conn, HttpRoute *route)
 {
+    HttpRx      *rx;
+    char        *savePathInfo, *pathInfo;
+    int         rc;
+
+    mprAssert(conn);
+    mprAssert(route);
+
+    rx = conn->rx;
+    savePathInfo = 0;
+
     /*
-        Add the route to the owning host. When using an Appweb configuration file, the order of route finalization 
-        will be from the inside out. This ensures that nested routes are defined BEFORE outer/enclosing routes.
-        This is important as requests process routes in-order.
+        Remove the route prefix. Restore after matching.
      */
-    mprAssert(route);
-    if (mprGetListLength(route->indicies) == 0) {
-        mprAddItem(route->indicies,  sclone("index.html"));
+    if (route->prefix) {
+        savePathInfo = rx->pathInfo;
+        pathInfo = &rx->pathInfo[route->prefixLen];
+        if (*pathInfo == '\0') {
+            pathInfo = "/";
+        }
+        rx->pathInfo = sclone(pathInfo);
+        rx->scriptName = route->prefix;
     }
-    httpAddRoute(route->host, route);
+    if ((rc = matchRequestUri(conn, route)) == HTTP_ROUTE_OK) {
+        rc = testRoute(conn, route);
+    }
+    if (rc == HTTP_ROUTE_REJECT && route->prefix) {
+        /* Keep the modified pathInfo if OK or REWRITE */
+        rx->pathInfo = savePathInfo;
+        rx->scriptName = 0;
+    }
+    return rc;
 }
 
 
-/********************************* Path and URI Expansion *****************************/
-/*
-    What does this return. Does it return an absolute URI?
-    MOB - rename httpUri() and move to uri.c
- */
-char *httpLink(HttpConn *conn, cchar *target, MprHash *options)
+static int matchRequestUri(HttpConn *conn, HttpRoute *route)
 {
-    HttpRoute       *route, *lroute;
-    HttpRx          *rx;
-    HttpUri         *uri;
-    cchar           *routeName, *action, *controller, *originalAction, *tplate;
-    char            *rest;
+    HttpRx      *rx;
 
+    mprAssert(conn);
+    mprAssert(route);
     rx = conn->rx;
-    route = rx->route;
-    controller = 0;
 
-    if (target == 0) {
-        target = "";
-    }
-    if (*target == '@') {
-        target = sjoin("{action: '", target, "'}", NULL);
-    } 
-    if (*target != '{') {
-        target = httpTemplate(conn, target, 0);
-    } else  {
-        if (options) {
-            options = mprBlendHash(httpGetOptions(target), options);
-        } else {
-            options = httpGetOptions(target);
+    if (route->patternCompiled) {
+        rx->matchCount = pcre_exec(route->patternCompiled, NULL, rx->pathInfo, (int) slen(rx->pathInfo), 0, 0, 
+                rx->matches, sizeof(rx->matches) / sizeof(int));
+        mprLog(6, "Test route pattern \"%s\", regexp %s, pathInfo %s", route->name, route->optimizedPattern, rx->pathInfo);
+
+        if (route->flags & HTTP_ROUTE_NOT) {
+            if (rx->matchCount > 0) {
+                return HTTP_ROUTE_REJECT;
+            }
+            rx->matchCount = 1;
+            rx->matches[0] = 0;
+            rx->matches[1] = (int) slen(rx->pathInfo);
+
+        } else if (rx->matchCount <= 0) {
+            return HTTP_ROUTE_REJECT;
         }
-        /*
-            Prep the action. Forms are:
-                . @action               # Use the current controller
-                . @controller/          # Use "list" as the action
-                . @controller/action
-         */
-        if ((action = httpGetOption(options, "action", 0)) != 0) {
-            originalAction = action;
-            if (*action == '@') {
-                action = &action[1];
+    } else if (route->pattern && *route->pattern) {
+        /* Pattern compilation failed */
+        return HTTP_ROUTE_REJECT;
+    }
+    mprLog(6, "Test route methods \"%s\"", route->name);
+    if (route->methods && !mprLookupKey(route->methods, rx->method)) {
+        return HTTP_ROUTE_REJECT;
+    }
+    rx->route = route;
+    return HTTP_ROUTE_OK;
+}
+
+
+static int testRoute(HttpConn *conn, HttpRoute *route)
+{
+    HttpRouteOp     *op, *condition, *update;
+    HttpRouteProc   *proc;
+    HttpRx          *rx;
+    HttpTx          *tx;
+    cchar           *token, *value, *header, *field;
+    int             next, rc, matched[HTTP_MAX_ROUTE_MATCHES * 2], count, result;
+
+    mprAssert(conn);
+    mprAssert(route);
+    rx = conn->rx;
+    tx = conn->tx;
+
+    rx->target = route->target ? expandTokens(conn, route->target) : sclone(&conn->rx->pathInfo[1]);
+
+    if (route->headers) {
+        for (next = 0; (op = mprGetNextItem(route->headers, &next)) != 0; ) {
+            mprLog(6, "Test route \"%s\" header \"%s\"", route->name, op->name);
+            if ((header = httpGetHeader(conn, op->name)) != 0) {
+                count = pcre_exec(op->mdata, NULL, header, (int) slen(header), 0, 0, 
+                    matched, sizeof(matched) / sizeof(int)); 
+                result = count > 0;
+                if (op->flags & HTTP_ROUTE_NOT) {
+                    result = !result;
+                }
+                if (!result) {
+                    return HTTP_ROUTE_REJECT;
+                }
             }
-            if (strchr(action, '/')) {
-                controller = stok((char*) action, "/", (char**) &action);
-                action = stok((char*) action, "/", &rest);
+        }
+    }
+    if (route->params) {
+        for (next = 0; (op = mprGetNextItem(route->params, &next)) != 0; ) {
+            mprLog(6, "Test route \"%s\" field \"%s\"", route->name, op->name);
+            if ((field = httpGetParam(conn, op->name, "")) != 0) {
+                count = pcre_exec(op->mdata, NULL, field, (int) slen(field), 0, 0, 
+                    matched, sizeof(matched) / sizeof(int)); 
+                result = count > 0;
+                if (op->flags & HTTP_ROUTE_NOT) {
+                    result = !result;
+                }
+                if (!result) {
+                    return HTTP_ROUTE_REJECT;
+                }
             }
-            if (controller) {
-                httpSetOption(options, "controller", controller);
-            } else {
-                controller = httpGetParam(conn, "controller", 0);
+        }
+    }
+    if (route->conditions) {
+        for (next = 0; (condition = mprGetNextItem(route->conditions, &next)) != 0; ) {
+            mprLog(6, "Test route \"%s\" condition \"%s\"", route->name, condition->name);
+            rc = testCondition(conn, route, condition);
+            if (rc == HTTP_ROUTE_REROUTE) {
+                return rc;
             }
-            if (action == 0 || *action == '\0') {
-                action = "list";
+            if (condition->flags & HTTP_ROUTE_NOT) {
+                rc = !rc;
             }
-            if (action != originalAction) {
-                httpSetOption(options, "action", action);
+            if (rc == HTTP_ROUTE_REJECT) {
+                return rc;
             }
         }
-        /*
-            Find the template to use. Strategy is this order:
-                . options.template
-                . options.route.template
-                . options.action mapped to a route.template, via:
-                . /app/STAR/action
-                . /app/controller/action
-                . /app/STAR/default
-                . /app/controller/default
-         */
-        if ((tplate = httpGetOption(options, "template", 0)) == 0) {
-            if ((routeName = httpGetOption(options, "route", 0)) != 0) {
-                routeName = expandRouteName(conn, routeName);
-                lroute = httpLookupRoute(conn->host, routeName);
-            } else {
-                lroute = 0;
-            }
-            if (lroute == 0) {
-                if ((lroute = httpLookupRoute(conn->host, qualifyName(route, "{controller}", action))) == 0) {
-                    if ((lroute = httpLookupRoute(conn->host, qualifyName(route, controller, action))) == 0) {
-                        if ((lroute = httpLookupRoute(conn->host, qualifyName(route, "{controller}", "default"))) == 0) {
-                            lroute = httpLookupRoute(conn->host, qualifyName(route, controller, "default"));
-                        }
-                    }
-                }
-            }
-            if (lroute) {
-                tplate = lroute->tplate;
+    }
+    if (route->updates) {
+        for (next = 0; (update = mprGetNextItem(route->updates, &next)) != 0; ) {
+            mprLog(6, "Run route \"%s\" update \"%s\"", route->name, update->name);
+            if ((rc = updateRequest(conn, route, update)) == HTTP_ROUTE_REROUTE) {
+                return rc;
             }
         }
-        if (tplate) {
-            target = httpTemplate(conn, tplate, options);
-        } else {
-            mprError("Can't find template for URI %s", target);
-            target = "/";
+    }
+    if (route->prefix) {
+        /* This is needed by some handler match routines */
+        httpSetParam(conn, "prefix", route->prefix);
+    }
+    if ((rc = selectHandler(conn, route)) != HTTP_ROUTE_OK) {
+        return rc;
+    }
+    if (route->tokens) {
+        for (next = 0; (token = mprGetNextItem(route->tokens, &next)) != 0; ) {
+            value = snclone(&rx->pathInfo[rx->matches[next * 2]], rx->matches[(next * 2) + 1] - rx->matches[(next * 2)]);
+            httpSetParam(conn, token, value);
         }
     }
-    //  OPT
-    uri = httpCreateUri(target, 0);
-    uri = httpResolveUri(httpCreateUri(rx->uri, 0), 1, &uri, 0);
-    httpNormalizeUri(uri);
-    return httpUriToString(uri, 0);
+    if ((proc = mprLookupKey(conn->http->routeTargets, route->targetRule)) == 0) {
+        httpError(conn, -1, "Can't find route target rule \"%s\"", route->targetRule);
+        return HTTP_ROUTE_REJECT;
+    }
+    if ((rc = (*proc)(conn, route, 0)) != HTTP_ROUTE_OK) {
+        return rc;
+    }
+    if (!conn->finalized && tx->handler->match) {
+        rc = tx->handler->match(conn, route, HTTP_QUEUE_TX);
+    }
+    return rc;
 }
 
 
-/*
-    Limited expansion of route names. Support ~/ and ${app} at the start of the route name
- */
-static cchar *expandRouteName(HttpConn *conn, cchar *routeName)
+static int selectHandler(HttpConn *conn, HttpRoute *route)
 {
-    HttpRoute   *route;
+    HttpTx      *tx;
+    int         next, rc;
 
-    route = conn->rx->route;
-    if (routeName[0] == '~') {
-        return sjoin(route->prefix, &routeName[1], NULL);
+    mprAssert(conn);
+    mprAssert(route);
+
+    tx = conn->tx;
+    if (route->handler) {
+        tx->handler = route->handler;
+        return HTTP_ROUTE_OK;
     }
-    if (sstarts(routeName, "${app}")) {
-        return sjoin(route->prefix, &routeName[6], NULL);
+    /*
+        Handlers with match routines are examined first (in-order)
+     */
+    for (next = 0; (tx->handler = mprGetNextItem(route->handlersWithMatch, &next)) != 0; ) {
+        rc = tx->handler->match(conn, route, 0);
+        if (rc == HTTP_ROUTE_OK || rc == HTTP_ROUTE_REROUTE) {
+            return rc;
+        }
     }
-    return routeName;
+    if (!tx->handler) {
+        /*
+            Now match by extensions
+         */
+        if (!tx->ext || (tx->handler = mprLookupKey(route->extensions, tx->ext)) == 0) {
+            tx->handler = mprLookupKey(route->extensions, "");
+        }
+    }
+    return tx->handler ? HTTP_ROUTE_OK : HTTP_ROUTE_REJECT;
 }
 
 
 /*
-    Expect a route->tplate with embedded tokens of the form: "/${controller}/${action}/${other}"
-    The options is a hash of token values.
+    Map the target to physical storage. Sets tx->filename and tx->ext.
  */
-char *httpTemplate(HttpConn *conn, cchar *tplate, MprHash *options)
+void httpMapFile(HttpConn *conn, HttpRoute *route)
 {
-    MprBuf      *buf;
-    HttpRoute   *route;
-    cchar       *cp, *ep, *value;
-    char        key[MPR_MAX_STRING];
+    HttpRx      *rx;
+    HttpTx      *tx;
+    HttpLang    *lang;
+    MprPath     *info;
 
-    route = conn->rx->route;
-    if (tplate == 0 || *tplate == '\0') {
-        return MPR->emptyString;
+    mprAssert(conn);
+    mprAssert(route);
+
+    rx = conn->rx;
+    tx = conn->tx;
+    lang = rx->lang;
+
+    mprAssert(rx->target);
+    tx->filename = rx->target;
+    if (lang && lang->path) {
+        tx->filename = mprJoinPath(lang->path, tx->filename);
     }
-    buf = mprCreateBuf(-1, -1);
-    for (cp = tplate; *cp; cp++) {
-        if (*cp == '~' && (cp == tplate || cp[-1] != '\\')) {
-            if (route->prefix) {
-                mprPutStringToBuf(buf, route->prefix);
-            }
+    tx->filename = mprJoinPath(route->dir, tx->filename);
+    tx->ext = httpGetExt(conn);
+    info = &tx->fileInfo;
+    mprGetPathInfo(tx->filename, info);
+    if (info->valid) {
+        tx->etag = sfmt("\"%Lx-%Lx-%Lx\"", (int64) info->inode, (int64) info->size, (int64) info->mtime);
+    }
+    LOG(7, "mapFile uri \"%s\", filename: \"%s\", extension: \"%s\"", rx->uri, tx->filename, tx->ext);
+}
 
-        } else if (*cp == '$' && cp[1] == '{' && (cp == tplate || cp[-1] != '\\')) {
-            cp += 2;
-            if ((ep = strchr(cp, '}')) != 0) {
-                sncopy(key, sizeof(key), cp, ep - cp);
-                if (options && (value = httpGetOption(options, key, 0)) != 0) {
-                    mprPutStringToBuf(buf, value);
-                } else if ((value = mprLookupKey(conn->rx->params, key)) != 0) {
-                    mprPutStringToBuf(buf, value);
-                }
-                if (value == 0) {
-                    /* Just emit the token name if the token can't be found */
-                    mprPutStringToBuf(buf, key);
-                }
-                cp = ep;
-            }
-        } else {
-            mprPutCharToBuf(buf, *cp);
-        }
-    }
-    mprAddNullToBuf(buf);
-    return sclone(mprGetBufStart(buf));
-}
 
+/************************************ API *************************************/
 
-void httpSetRouteVar(HttpRoute *route, cchar *key, cchar *value)
+int httpAddRouteCondition(HttpRoute *route, cchar *name, cchar *details, int flags)
 {
+    HttpRouteOp *op;
+    cchar       *errMsg;
+    char        *pattern, *value;
+    int         column;
+
     mprAssert(route);
-    mprAssert(key);
-    mprAssert(value);
 
-    GRADUATE_HASH(route, vars);
-    if (schr(value, '$')) {
-        value = stemplate(value, route->vars);
+    GRADUATE_LIST(route, conditions);
+    if ((op = createRouteOp(name, flags)) == 0) {
+        return MPR_ERR_MEMORY;
     }
-    mprAddKey(route->vars, key, sclone(value));
-}
+    if (scaselessmatch(name, "auth")) {
+        /* Nothing to do. Route->auth has it all */
 
+    } else if (scaselessmatch(name, "missing")) {
+        op->details = finalizeReplacement(route, "${request:filename}");
 
-/*
-    Make a path name. This replaces $references, converts to an absolute path name, cleans the path and maps delimiters.
-    Paths are resolved relative to host->home (ServerRoot).
- */
-char *httpMakePath(HttpRoute *route, cchar *file)
-{
-    char    *path;
+    } else if (scaselessmatch(name, "directory")) {
+        op->details = finalizeReplacement(route, details);
 
-    mprAssert(route);
-    mprAssert(file);
+    } else if (scaselessmatch(name, "exists")) {
+        op->details = finalizeReplacement(route, details);
 
-    if ((path = stemplate(file, route->vars)) == 0) {
-        return 0;
-    }
-    if (mprIsPathRel(path) && route->host) {
-        path = mprJoinPath(route->host->home, path);
+    } else if (scaselessmatch(name, "match")) {
+        /* 
+            Condition match string pattern
+            String can contain matching ${tokens} from the route->pattern and can contain request ${tokens}
+         */
+        if (!httpTokenize(route, details, "%S %S", &value, &pattern)) {
+            return MPR_ERR_BAD_SYNTAX;
+        }
+        if ((op->mdata = pcre_compile2(pattern, 0, 0, &errMsg, &column, NULL)) == 0) {
+            mprError("Can't compile condition match pattern. Error %s at column %d", errMsg, column); 
+            return MPR_ERR_BAD_SYNTAX;
+        }
+        op->details = finalizeReplacement(route, value);
+        op->flags |= HTTP_ROUTE_FREE;
     }
-    return mprGetAbsPath(path);
+    addUniqueItem(route->conditions, op);
+    return 0;
 }
 
-/********************************* Language ***********************************/
-/*
-    Language can be an empty string
- */
-int httpAddRouteLanguageSuffix(HttpRoute *route, cchar *language, cchar *suffix, int flags)
+
+int httpAddRouteFilter(HttpRoute *route, cchar *name, cchar *extensions, int direction)
 {
-    HttpLang    *lp;
+    HttpStage   *stage;
+    HttpStage   *filter;
+    char        *extlist, *word, *tok;
+    int         pos;
 
     mprAssert(route);
-    mprAssert(language);
-    mprAssert(suffix && *suffix);
+    
+    stage = httpLookupStage(route->http, name);
+    if (stage == 0) {
+        mprError("Can't find filter %s", name); 
+        return MPR_ERR_CANT_FIND;
+    }
+    /*
+        Clone an existing stage because each filter stores its own set of extensions to match against
+     */
+    filter = httpCloneStage(route->http, stage);
 
-    if (route->languages == 0) {
-        route->languages = mprCreateHash(-1, 0);
-    } else {
-        GRADUATE_HASH(route, languages);
+    if (extensions && *extensions) {
+        filter->extensions = mprCreateHash(0, MPR_HASH_CASELESS);
+        extlist = sclone(extensions);
+        word = stok(extlist, " \t\r\n", &tok);
+        while (word) {
+            if (*word == '*' && word[1] == '.') {
+                word += 2;
+            } else if (*word == '.') {
+                word++;
+            } else if (*word == '\"' && word[1] == '\"') {
+                word = "";
+            }
+            mprAddKey(filter->extensions, word, filter);
+            word = stok(0, " \t\r\n", &tok);
+        }
     }
-    if ((lp = mprLookupKey(route->languages, language)) != 0) {
-        lp->suffix = sclone(suffix);
-        lp->flags = flags;
-    } else {
-        mprAddKey(route->languages, language, createLangDef(0, suffix, flags));
+    if (direction & HTTP_STAGE_RX && filter->incoming) {
+        GRADUATE_LIST(route, inputStages);
+        mprAddItem(route->inputStages, filter);
     }
-    return httpAddRouteUpdate(route, "lang", 0, 0);
+    if (direction & HTTP_STAGE_TX && filter->outgoing) {
+        GRADUATE_LIST(route, outputStages);
+        if (smatch(name, "cacheFilter") && 
+                (pos = mprGetListLength(route->outputStages) - 1) >= 0 &&
+                smatch(((HttpStage*) mprGetLastItem(route->outputStages))->name, "chunkFilter")) {
+            mprInsertItemAtPos(route->outputStages, pos, filter);
+        } else {
+            mprAddItem(route->outputStages, filter);
+        }
+    }
+    return 0;
 }
 
 
-int httpAddRouteLanguageDir(HttpRoute *route, cchar *language, cchar *path)
+int httpAddRouteHandler(HttpRoute *route, cchar *name, cchar *extensions)
 {
-    HttpLang    *lp;
+    Http            *http;
+    HttpStage       *handler;
+    char            *extlist, *word, *tok;
 
     mprAssert(route);
-    mprAssert(language && *language);
-    mprAssert(path && *path);
 
-    if (route->languages == 0) {
-        route->languages = mprCreateHash(-1, 0);
-    } else {
-        GRADUATE_HASH(route, languages);
+    http = route->http;
+    if ((handler = httpLookupStage(http, name)) == 0) {
+        mprError("Can't find stage %s", name); 
+        return MPR_ERR_CANT_FIND;
     }
-    if ((lp = mprLookupKey(route->languages, language)) != 0) {
-        lp->path = sclone(path);
+    GRADUATE_HASH(route, extensions);
+
+    if (extensions && *extensions) {
+        /*
+            Add to the handler extension hash. Skip over "*." and "."
+         */ 
+        extlist = sclone(extensions);
+        word = stok(extlist, " \t\r\n", &tok);
+        while (word) {
+            if (*word == '*' && word[1] == '.') {
+                word += 2;
+            } else if (*word == '.') {
+                word++;
+            } else if (*word == '\"' && word[1] == '\"') {
+                word = "";
+            }
+            mprAddKey(route->extensions, word, handler);
+            word = stok(0, " \t\r\n", &tok);
+        }
+
     } else {
-        mprAddKey(route->languages, language, createLangDef(path, 0, 0));
+        if (mprLookupItem(route->handlers, handler) < 0) {
+            GRADUATE_LIST(route, handlers);
+            mprAddItem(route->handlers, handler);
+        }
+        if (handler->match) {
+            if (mprLookupItem(route->handlersWithMatch, handler) < 0) {
+                GRADUATE_LIST(route, handlersWithMatch);
+                mprAddItem(route->handlersWithMatch, handler);
+            }
+        } else {
+            /*
+                Only match by extensions if no-match routine provided.
+             */
+            mprAddKey(route->extensions, "", handler);
+        }
     }
-    return httpAddRouteUpdate(route, "lang", 0, 0);
+    return 0;
 }
 
 
-void httpSetRouteDefaultLanguage(HttpRoute *route, cchar *language)
+/*
+    Header field valuePattern
+ */
+void httpAddRouteHeader(HttpRoute *route, cchar *header, cchar *value, int flags)
 {
+    HttpRouteOp     *op;
+    cchar           *errMsg;
+    int             column;
+
     mprAssert(route);
-    mprAssert(language && *language);
+    mprAssert(header && *header);
+    mprAssert(value && *value);
 
-    route->defaultLanguage = sclone(language);
+    GRADUATE_LIST(route, headers);
+    if ((op = createRouteOp(header, flags | HTTP_ROUTE_FREE)) == 0) {
+        return;
+    }
+    if ((op->mdata = pcre_compile2(value, 0, 0, &errMsg, &column, NULL)) == 0) {
+        mprError("Can't compile header pattern. Error %s at column %d", errMsg, column); 
+    } else {
+        mprAddItem(route->headers, op);
+    }
 }
 
 
-/********************************* Conditions *********************************/
-
-static int testCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *condition)
+#if FUTURE && KEEP
+void httpAddRouteLoad(HttpRoute *route, cchar *module, cchar *path)
 {
-    HttpRouteProc   *proc;
-
-    mprAssert(conn);
-    mprAssert(route);
-    mprAssert(condition);
+    HttpRouteOp     *op;
 
-    if ((proc = mprLookupKey(conn->http->routeConditions, condition->name)) == 0) {
-        httpError(conn, -1, "Can't find route condition rule %s", condition->name);
-        return 0;
+    GRADUATE_LIST(route, updates);
+    if ((op = createRouteOp("--load--", 0)) == 0) {
+        return;
     }
-    mprLog(6, "run condition on route %s condition %s", route->name, condition->name);
-    return (*proc)(conn, route, condition);
+    op->var = sclone(module);
+    op->value = sclone(path);
+    mprAddItem(route->updates, op);
 }
+#endif
 
 
 /*
-    Allow/Deny authorization
+    Param field valuePattern
  */
-static int allowDenyCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+void httpAddRouteParam(HttpRoute *route, cchar *field, cchar *value, int flags)
 {
-    HttpRx      *rx;
-    HttpAuth    *auth;
-    int         allow, deny;
+    HttpRouteOp     *op;
+    cchar           *errMsg;
+    int             column;
 
-    mprAssert(conn);
     mprAssert(route);
+    mprAssert(field && *field);
+    mprAssert(value && *value);
 
-    rx = conn->rx;
-    auth = rx->route->auth;
-    if (auth == 0) {
-        return HTTP_ROUTE_OK;
+    GRADUATE_LIST(route, params);
+    if ((op = createRouteOp(field, flags | HTTP_ROUTE_FREE)) == 0) {
+        return;
     }
-    allow = 0;
-    deny = 0;
-    if (auth->flags & HTTP_ALLOW_DENY) {
-        if (auth->allow && mprLookupKey(auth->allow, conn->ip)) {
-            allow++;
-        } else {
-            allow++;
-        }
-        if (auth->deny && mprLookupKey(auth->deny, conn->ip)) {
-            deny++;
-        }
-        if (!allow || deny) {
-            httpError(conn, HTTP_CODE_UNAUTHORIZED, "Access denied for this server %s", conn->ip);
-            return HTTP_ROUTE_OK;
-        }
+    if ((op->mdata = pcre_compile2(value, 0, 0, &errMsg, &column, NULL)) == 0) {
+        mprError("Can't compile field pattern. Error %s at column %d", errMsg, column); 
     } else {
-        if (auth->deny && mprLookupKey(auth->deny, conn->ip)) {
-            deny++;
-        }
-        if (auth->allow && !mprLookupKey(auth->allow, conn->ip)) {
-            deny = 0;
-            allow++;
-        } else {
-            allow++;
-        }
-        if (deny || !allow) {
-            httpError(conn, HTTP_CODE_UNAUTHORIZED, "Access denied for this server %s", conn->ip);
-            return HTTP_ROUTE_OK;
-        }
-    }
-    return HTTP_ROUTE_OK;
-}
-
-
-static int authCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
-{
-    mprAssert(conn);
-    mprAssert(route);
-
-    if (!route->auth) {
-        return HTTP_ROUTE_OK;
-    }
-    if (!httpCheckAuth(conn)) {
-        /* Request has been denied and fully handled */
-        return HTTP_ROUTE_OK;
+        mprAddItem(route->params, op);
     }
-    return HTTP_ROUTE_OK;
 }
 
 
-static int directoryCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+void httpAddRouteSessionKey(HttpRoute *route, cchar *key)
 {
-    HttpTx      *tx;
-    MprPath     info;
-    char        *path;
-
-    mprAssert(conn);
     mprAssert(route);
-    mprAssert(op);
+    mprAssert(key && *key);
 
-    /* 
-        Must have tx->filename set when expanding op->details, so map target now 
-     */
-    tx = conn->tx;
-    httpMapFile(conn, route);
-    path = mprJoinPath(route->dir, expandTokens(conn, op->details));
-    tx->ext = tx->filename = 0;
-    mprGetPathInfo(path, &info);
-    if (info.isDir) {
-        return HTTP_ROUTE_OK;
-    }
-    return HTTP_ROUTE_REJECT;
+    GRADUATE_LIST(route, sessionKeys);
+    mprAddItem(route->sessionKeys, sclone(key));
 }
 
 
 /*
-    Test if a file exists
+    Add a route update record. These run to modify a request.
+        Update rule var value
+        rule == "cmd|param"
+        details == "var value"
+    Value can contain pattern and request tokens.
  */
-static int existsCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+int httpAddRouteUpdate(HttpRoute *route, cchar *rule, cchar *details, int flags)
 {
-    HttpTx  *tx;
-    char    *path;
+    HttpRouteOp *op;
+    char        *value;
 
-    mprAssert(conn);
     mprAssert(route);
-    mprAssert(op);
+    mprAssert(rule && *rule);
 
-    tx = conn->tx;
+    GRADUATE_LIST(route, updates);
+    if ((op = createRouteOp(rule, flags)) == 0) {
+        return MPR_ERR_MEMORY;
+    }
+    if (scaselessmatch(rule, "cmd")) {
+        op->details = sclone(details);
 
-    /* 
-        Must have tx->filename set when expanding op->details, so map target now 
-     */
-    httpMapFile(conn, route);
-    path = mprJoinPath(route->dir, expandTokens(conn, op->details));
-    tx->ext = tx->filename = 0;
-    if (mprPathExists(path, R_OK)) {
-        return HTTP_ROUTE_OK;
+    } else if (scaselessmatch(rule, "lang")) {
+        /* Nothing to do */;
+
+    } else if (scaselessmatch(rule, "param")) {
+        if (!httpTokenize(route, details, "%S %S", &op->var, &value)) {
+            return MPR_ERR_BAD_SYNTAX;
+        }
+        op->value = finalizeReplacement(route, value);
+    
+    } else {
+        return MPR_ERR_BAD_SYNTAX;
     }
+    addUniqueItem(route->updates, op);
     return 0;
 }
 
 
-static int matchCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+void httpClearRouteStages(HttpRoute *route, int direction)
 {
-    char    *str;
-    int     matched[HTTP_MAX_ROUTE_MATCHES * 2], count;
-
-    mprAssert(conn);
     mprAssert(route);
-    mprAssert(op);
 
-    str = expandTokens(conn, op->details);
-    count = pcre_exec(op->mdata, NULL, str, (int) slen(str), 0, 0, matched, sizeof(matched) / sizeof(int)); 
-    if (count > 0) {
-        return HTTP_ROUTE_OK;
+    if (direction & HTTP_STAGE_RX) {
+        route->inputStages = mprCreateList(-1, 0);
+    }
+    if (direction & HTTP_STAGE_TX) {
+        route->outputStages = mprCreateList(-1, 0);
     }
-    return HTTP_ROUTE_REJECT;
 }
 
 
-/********************************* Updates ******************************/
-
-static int updateRequest(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+void httpDefineRouteTarget(cchar *key, HttpRouteProc *proc)
 {
-    HttpRouteProc   *proc;
+    mprAssert(key && *key);
+    mprAssert(proc);
 
-    mprAssert(conn);
-    mprAssert(route);
-    mprAssert(op);
+    mprAddKey(((Http*) MPR->httpService)->routeTargets, key, proc);
+}
 
-    if ((proc = mprLookupKey(conn->http->routeUpdates, op->name)) == 0) {
-        httpError(conn, -1, "Can't find route update rule %s", op->name);
-        return HTTP_ROUTE_OK;
-    }
-    mprLog(6, "run update on route %s update %s", route->name, op->name);
-    return (*proc)(conn, route, op);
+
+void httpDefineRouteCondition(cchar *key, HttpRouteProc *proc)
+{
+    mprAssert(key && *key);
+    mprAssert(proc);
+
+    mprAddKey(((Http*) MPR->httpService)->routeConditions, key, proc);
 }
 
 
-static int cmdUpdate(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+void httpDefineRouteUpdate(cchar *key, HttpRouteProc *proc)
 {
-    MprCmd  *cmd;
-    char    *command, *out, *err;
-    int     status;
+    mprAssert(key && *key);
+    mprAssert(proc);
 
-    mprAssert(conn);
+    mprAddKey(((Http*) MPR->httpService)->routeUpdates, key, proc);
+}
+
+
+void *httpGetRouteData(HttpRoute *route, cchar *key)
+{
     mprAssert(route);
-    mprAssert(op);
+    mprAssert(key && *key);
 
-    command = expandTokens(conn, op->details);
-    cmd = mprCreateCmd(conn->dispatcher);
-    if ((status = mprRunCmd(cmd, command, NULL, &out, &err, -1, 0)) != 0) {
-        /* Don't call httpError, just set errorMsg which can be retrieved via: ${request:error} */
-        conn->errorMsg = sfmt("Command failed: %s\nStatus: %d\n%s\n%s", command, status, out, err);
-        mprError("%s", conn->errorMsg);
-        /* Continue */
+    if (!route->data) {
+        return 0;
     }
-    return HTTP_ROUTE_OK;
+    return mprLookupKey(route->data, key);
 }
 
 
-static int paramUpdate(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+cchar *httpGetRouteDir(HttpRoute *route)
 {
-    mprAssert(conn);
     mprAssert(route);
-    mprAssert(op);
-
-    httpSetParam(conn, op->var, expandTokens(conn, op->value));
-    return HTTP_ROUTE_OK;
+    return route->dir;
 }
 
 
-static int langUpdate(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+cchar *httpGetRouteMethods(HttpRoute *route)
 {
-    HttpUri     *prior;
-    HttpRx      *rx;
-    HttpLang    *lang;
-    char        *ext, *pathInfo, *uri;
-
-    mprAssert(conn);
     mprAssert(route);
+    return route->methodSpec;
+}
 
-    rx = conn->rx;
-    prior = rx->parsedUri;
-    mprAssert(route->languages);
 
-    if ((lang = httpGetLanguage(conn, route->languages, 0)) != 0) {
-        rx->lang = lang;
-        if (lang->suffix) {
-            pathInfo = 0;
-            if (lang->flags & HTTP_LANG_AFTER) {
-                pathInfo = sjoin(rx->pathInfo, ".", lang->suffix, NULL);
-            } else if (lang->flags & HTTP_LANG_BEFORE) {
-                ext = httpGetExt(conn);
-                if (ext && *ext) {
-                    pathInfo = sjoin(mprJoinPathExt(mprTrimPathExt(rx->pathInfo), lang->suffix), ".", ext, NULL);
-                } else {
-                    pathInfo = mprJoinPathExt(mprTrimPathExt(rx->pathInfo), lang->suffix);
-                }
-            }
-            if (pathInfo) {
-                uri = httpFormatUri(prior->scheme, prior->host, prior->port, pathInfo, prior->reference, prior->query, 0);
-                httpSetUri(conn, uri, 0);
-            }
-        }
+void httpResetRoutePipeline(HttpRoute *route)
+{
+    mprAssert(route);
+
+    if (route->parent == 0) {
+        route->errorDocuments = mprCreateHash(HTTP_SMALL_HASH_SIZE, 0);
+        route->caching = 0;
+        route->extensions = 0;
+        route->handlers = mprCreateList(-1, 0);
+        route->handlersWithMatch = mprCreateList(-1, 0);
+        route->inputStages = mprCreateList(-1, 0);
+        route->indicies = mprCreateList(-1, 0);
     }
-    return HTTP_ROUTE_OK;
+    route->outputStages = mprCreateList(-1, 0);
 }
 
 
-/*********************************** Targets **********************************/
-
-static int closeTarget(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+void httpResetHandlers(HttpRoute *route)
 {
-    mprAssert(conn);
     mprAssert(route);
+    route->handlers = mprCreateList(-1, 0);
+    route->handlersWithMatch = mprCreateList(-1, 0);
+}
 
-    httpError(conn, HTTP_CODE_RESET, "Route target \"close\" is closing request");
-    httpDisconnect(conn);
-    return HTTP_ROUTE_OK;
+
+void httpSetRouteAuth(HttpRoute *route, HttpAuth *auth)
+{
+    mprAssert(route);
+    route->auth = auth;
 }
 
 
-static int redirectTarget(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+void httpSetRouteAutoDelete(HttpRoute *route, bool enable)
 {
-    HttpRx      *rx;
-    HttpUri     *dest, *prior;
-    cchar       *scheme, *host, *query, *reference, *uri, *target;
-    int         port;
-
-    mprAssert(conn);
     mprAssert(route);
-    mprAssert(route->target);
-
-    rx = conn->rx;
-
-    /* Note: target may be empty */
-    target = expandTokens(conn, route->target);
-    if (route->responseStatus) {
-        httpRedirect(conn, route->responseStatus, target);
-        return HTTP_ROUTE_OK;
-    }
-    //  MOB - OPT Use httpCompleteUri?
-    prior = rx->parsedUri;
-    dest = httpCreateUri(route->target, 0);
-    scheme = dest->scheme ? dest->scheme : prior->scheme;
-    host = dest->host ? dest->host : prior->host;
-    port = dest->port ? dest->port : prior->port;
-    query = dest->query ? dest->query : prior->query;
-    reference = dest->reference ? dest->reference : prior->reference;
-    uri = httpFormatUri(scheme, host, port, target, reference, query, 0);
-    httpSetUri(conn, uri, 0);
-    return HTTP_ROUTE_REROUTE;
+    route->autoDelete = enable;
 }
 
 
-static int runTarget(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+void httpSetRouteCompression(HttpRoute *route, int flags)
 {
-    /*
-        Need to re-compute output string as updates may have run to define params which affect the route->target tokens
-     */
-    conn->rx->target = route->target ? expandTokens(conn, route->target) : sclone(&conn->rx->pathInfo[1]);
-    return HTTP_ROUTE_OK;
+    mprAssert(route);
+    route->flags &= (HTTP_ROUTE_GZIP);
+    route->flags |= (HTTP_ROUTE_GZIP & flags);
 }
 
 
-static int writeTarget(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+int httpSetRouteConnector(HttpRoute *route, cchar *name)
 {
-    char    *str;
+    HttpStage     *stage;
 
-    mprAssert(conn);
     mprAssert(route);
-
-    /*
-        Need to re-compute output string as updates may have run to define params which affect the route->target tokens
-     */
-    str = route->target ? expandTokens(conn, route->target) : sclone(&conn->rx->pathInfo[1]);
-    if (!(route->flags & HTTP_ROUTE_RAW)) {
-        str = mprEscapeHtml(str);
+    
+    stage = httpLookupStage(route->http, name);
+    if (stage == 0) {
+        mprError("Can't find connector %s", name); 
+        return MPR_ERR_CANT_FIND;
     }
-    httpSetStatus(conn, route->responseStatus);
-    httpFormatResponse(conn, "%s", str);
-    httpFinalize(conn);
-    return HTTP_ROUTE_OK;
+    route->connector = stage;
+    return 0;
 }
 
 
-/************************************************** Route Convenience ****************************************************/
-
-HttpRoute *httpDefineRoute(HttpRoute *parent, cchar *name, cchar *methods, cchar *pattern, cchar *target, cchar *source)
+void httpSetRouteData(HttpRoute *route, cchar *key, void *data)
 {
-    HttpRoute   *route;
+    mprAssert(route);
+    mprAssert(key && *key);
+    mprAssert(data);
 
-    if ((route = httpCreateInheritedRoute(parent)) == 0) {
-        return 0;
-    }
-    httpSetRouteName(route, name);
-    httpSetRoutePattern(route, pattern, 0);
-    if (methods) {
-        httpSetRouteMethods(route, methods);
-    }
-    if (source) {
-        httpSetRouteSource(route, source);
+    if (route->data == 0) {
+        route->data = mprCreateHash(-1, 0);
+    } else {
+        GRADUATE_HASH(route, data);
     }
-    httpSetRouteTarget(route, "run", target);
-    httpFinalizeRoute(route);
-    return route;
+    mprAddKey(route->data, key, data);
 }
 
 
-/*
-    Calculate a qualified route name. The form is: /{app}/{controller}/action
- */
-static char *qualifyName(HttpRoute *route, cchar *controller, cchar *action)
+void httpSetRouteFlags(HttpRoute *route, int flags)
 {
-    cchar   *prefix, *controllerPrefix;
-
-    prefix = route->prefix ? route->prefix : "";
-    if (action == 0 || *action == '\0') {
-        action = "default";
-    }
-    if (controller) {
-        controllerPrefix = (controller && smatch(controller, "{controller}")) ? "*" : controller;
-        return sjoin(prefix, "/", controllerPrefix, "/", action, NULL);
-    } else {
-        return sjoin(prefix, "/", action, NULL);
-    }
+    mprAssert(route);
+    route->flags = flags;
 }
 
 
-/*
-    Add a restful route. The parent route may supply a route prefix. If defined, the route name will prepend the prefix.
- */
-static void addRestful(HttpRoute *parent, cchar *action, cchar *methods, cchar *pattern, cchar *target, cchar *resource)
+int httpSetRouteHandler(HttpRoute *route, cchar *name)
 {
-    cchar   *name, *nameResource, *source;
+    HttpStage     *handler;
 
-    nameResource = smatch(resource, "{controller}") ? "*" : resource;
-    if (parent->prefix) {
-        name = sfmt("%s/%s/%s", parent->prefix, nameResource, action);
-        pattern = sfmt("^%s/%s%s", parent->prefix, resource, pattern);
-    } else {
-        name = sfmt("/%s/%s", nameResource, action);
-        pattern = sfmt("^/%s%s", resource, pattern);
-    }
-    if (*resource == '{') {
-        target = sfmt("$%s-%s", resource, target);
-        source = sfmt("$%s.c", resource);
-    } else {
-        target = sfmt("%s-%s", resource, target);
-        source = sfmt("%s.c", resource);
+    mprAssert(route);
+    mprAssert(name && *name);
+    
+    if ((handler = httpLookupStage(route->http, name)) == 0) {
+        mprError("Can't find handler %s", name); 
+        return MPR_ERR_CANT_FIND;
     }
-    httpDefineRoute(parent, name, methods, pattern, target, source);
+    route->handler = handler;
+    return 0;
 }
 
 
-/*
-    httpAddResourceGroup(parent, "{controller}")
- */
-void httpAddResourceGroup(HttpRoute *parent, cchar *resource)
+void httpSetRouteDir(HttpRoute *route, cchar *path)
 {
-    addRestful(parent, "list",      "GET",    "(/)*$",                   "list",          resource);
-    addRestful(parent, "init",      "GET",    "/init$",                  "init",          resource);
-    addRestful(parent, "create",    "POST",   "(/)*$",                   "create",        resource);
-    addRestful(parent, "edit",      "GET",    "/{id=[0-9]+}/edit$",      "edit",          resource);
-    addRestful(parent, "show",      "GET",    "/{id=[0-9]+}$",           "show",          resource);
-    addRestful(parent, "update",    "PUT",    "/{id=[0-9]+}$",           "update",        resource);
-    addRestful(parent, "destroy",   "DELETE", "/{id=[0-9]+}$",           "destroy",       resource);
-    //  MOB - rethink "custom" name - should action be after id? Should this be custom-${action}?
-    addRestful(parent, "custom",    "POST",   "/{action}/{id=[0-9]+}$",  "${action}",     resource);
-    addRestful(parent, "default",   "*",      "/{action}$",              "cmd-${action}", resource);
+    mprAssert(route);
+    mprAssert(path && *path);
+    
+    route->dir = httpMakePath(route, path);
+    httpSetRouteVar(route, "DOCUMENT_ROOT", route->dir);
 }
 
 
 /*
-    httpAddResource(parent, "{controller}")
+    WARNING: internal API only. 
  */
-void httpAddResource(HttpRoute *parent, cchar *resource)
+void httpSetRouteHost(HttpRoute *route, HttpHost *host)
 {
-    addRestful(parent, "init",      "GET",    "/init$",       "init",          resource);
-    addRestful(parent, "create",    "POST",   "(/)*$",        "create",        resource);
-    addRestful(parent, "edit",      "GET",    "/edit$",       "edit",          resource);
-    addRestful(parent, "show",      "GET",    "$",            "show",          resource);
-    addRestful(parent, "update",    "PUT",    "$",            "update",        resource);
-    addRestful(parent, "destroy",   "DELETE", "$",            "destroy",       resource);
-    addRestful(parent, "default",   "*",      "/{action}$",   "cmd-${action}", resource);
+    mprAssert(route);
+    mprAssert(host);
+    
+    route->host = host;
+    defineHostVars(route);
 }
 
 
-void httpAddStaticRoute(HttpRoute *parent)
+void httpAddRouteIndex(HttpRoute *route, cchar *index)
 {
-    cchar   *source, *name, *path, *pattern, *prefix;
+    cchar   *item;
+    int     next;
 
-    prefix = parent->prefix ? parent->prefix : "";
-    source = parent->sourceName;
-    name = qualifyName(parent, NULL, "home");
-    path = stemplate("${STATIC_DIR}/index.esp", parent->vars);
-    pattern = sfmt("^%s%s", prefix, "(/)*$");
-    httpDefineRoute(parent, name, "GET,POST,PUT", pattern, path, source);
+    mprAssert(route);
+    mprAssert(index && *index);
+    
+    GRADUATE_LIST(route, indicies);
+    for (ITERATE_ITEMS(route->indicies, item, next)) {
+        if (smatch(index, item)) {
+            return;
+        }
+    }
+    mprAddItem(route->indicies, sclone(index));
 }
 
 
-void httpAddHomeRoute(HttpRoute *parent)
+void httpSetRouteMethods(HttpRoute *route, cchar *methods)
 {
-    cchar   *source, *name, *path, *pattern, *prefix;
-
-    prefix = parent->prefix ? parent->prefix : "";
-    source = parent->sourceName;
+    mprAssert(route);
+    mprAssert(methods && methods);
 
-    name = qualifyName(parent, NULL, "static");
-    path = stemplate("${STATIC_DIR}/$1", parent->vars);
-    pattern = sfmt("^%s%s", prefix, "/static/(.*)");
-    httpDefineRoute(parent, name, "GET", pattern, path, source);
+    route->methodSpec = sclone(methods);
+    finalizeMethods(route);
 }
 
 
-void httpAddRouteSet(HttpRoute *parent, cchar *set)
+void httpSetRouteName(HttpRoute *route, cchar *name)
 {
-    if (scaselessmatch(set, "simple")) {
-        httpAddHomeRoute(parent);
+    mprAssert(route);
+    mprAssert(name && *name);
+    
+    route->name = sclone(name);
+}
 
-    } else if (scaselessmatch(set, "mvc")) {
-        httpAddHomeRoute(parent);
-        httpAddStaticRoute(parent);
-        httpDefineRoute(parent, "default", NULL, "^/{controller}(~/{action}~)", "${controller}-${action}", 
-            "${controller}.c");
 
-    } else if (scaselessmatch(set, "restful")) {
-        httpAddHomeRoute(parent);
-        httpAddStaticRoute(parent);
-        httpAddResourceGroup(parent, "{controller}");
+void httpSetRoutePattern(HttpRoute *route, cchar *pattern, int flags)
+{
+    mprAssert(route);
+    mprAssert(pattern && *pattern);
+    
+    route->flags |= (flags & HTTP_ROUTE_NOT);
+    route->pattern = sclone(pattern);
+    finalizePattern(route);
+}
 
-    } else if (!scaselessmatch(set, "none")) {
-        mprError("Unknown route set %s", set);
+
+void httpSetRoutePrefix(HttpRoute *route, cchar *prefix)
+{
+    mprAssert(route);
+    mprAssert(prefix && *prefix);
+    
+    route->prefix = sclone(prefix);
+    route->prefixLen = slen(prefix);
+    if (route->pattern) {
+        finalizePattern(route);
     }
 }
 
 
-/*************************************************** Support Routines ****************************************************/
-/*
-    Route operations are used per-route for headers and fields
- */
-static HttpRouteOp *createRouteOp(cchar *name, int flags)
+void httpSetRouteSource(HttpRoute *route, cchar *source)
 {
-    HttpRouteOp   *op;
+    mprAssert(route);
+    mprAssert(source);
 
-    mprAssert(name && *name);
-
-    if ((op = mprAllocObj(HttpRouteOp, manageRouteOp)) == 0) {
-        return 0;
-    }
-    op->name = sclone(name);
-    op->flags = flags;
-    return op;
+    /* Source can be empty */
+    route->sourceName = sclone(source);
 }
 
 
-static void manageRouteOp(HttpRouteOp *op, int flags)
+void httpSetRouteScript(HttpRoute *route, cchar *script, cchar *scriptPath)
 {
-    if (flags & MPR_MANAGE_MARK) {
-        mprMark(op->name);
-        mprMark(op->details);
-        mprMark(op->var);
-        mprMark(op->value);
-
-    } else if (flags & MPR_MANAGE_FREE) {
-        if (op->flags & HTTP_ROUTE_FREE) {
-            free(op->mdata);
-            op->mdata = 0;
-        }
+    mprAssert(route);
+    
+    if (script) {
+        mprAssert(*script);
+        route->script = sclone(script);
+    }
+    if (scriptPath) {
+        mprAssert(*scriptPath);
+        route->scriptPath = sclone(scriptPath);
     }
 }
 
 
-static bool opPresent(MprList *list, HttpRouteOp *op)
+/*
+    Target names are extensible and hashed in http->routeTargets. 
+
+        Target close
+        Target redirect status [URI]
+        Target run ${DOCUMENT_ROOT}/${request:uri}.gz
+        Target run ${controller}-${name} 
+        Target write [-r] status "Hello World\r\n"
+ */
+int httpSetRouteTarget(HttpRoute *route, cchar *rule, cchar *details)
 {
-    HttpRouteOp   *last;
+    char    *redirect, *msg;
 
-    if ((last = mprGetLastItem(list)) == 0) {
+    mprAssert(route);
+    mprAssert(rule && *rule);
+
+    route->targetRule = sclone(rule);
+    route->target = sclone(details);
+
+    if (scaselessmatch(rule, "close")) {
+        route->target = sclone(details);
+
+    } else if (scaselessmatch(rule, "redirect")) {
+        if (!httpTokenize(route, details, "%N ?S", &route->responseStatus, &redirect)) {
+            return MPR_ERR_BAD_SYNTAX;
+        }
+        route->target = finalizeReplacement(route, redirect);
         return 0;
-    }
-    if (smatch(last->name, op->name) && 
-        smatch(last->details, op->details) && 
-        smatch(last->var, op->var) && 
-        smatch(last->value, op->value) && 
-        last->mdata == op->mdata && 
-        last->flags == op->flags) {
-        return 1;
+
+    } else if (scaselessmatch(rule, "run")) {
+        route->target = finalizeReplacement(route, details);
+
+    } else if (scaselessmatch(rule, "write")) {
+        /*
+            Write [-r] status Message
+         */
+        if (sncmp(details, "-r", 2) == 0) {
+            route->flags |= HTTP_ROUTE_RAW;
+            details = &details[2];
+        }
+        if (!httpTokenize(route, details, "%N %S", &route->responseStatus, &msg)) {
+            return MPR_ERR_BAD_SYNTAX;
+        }
+        route->target = finalizeReplacement(route, msg);
+
+    } else {
+        return MPR_ERR_BAD_SYNTAX;
     }
     return 0;
 }
 
 
-static void addUniqueItem(MprList *list, HttpRouteOp *op)
+void httpSetRouteTemplate(HttpRoute *route, cchar *tplate)
 {
-    mprAssert(list);
-    mprAssert(op);
-
-    if (!opPresent(list, op)) {
-        mprAddItem(list, op);
-    }
+    mprAssert(route);
+    mprAssert(tplate && *tplate);
+    
+    route->tplate = sclone(tplate);
 }
 
 
-static HttpLang *createLangDef(cchar *path, cchar *suffix, int flags)
+void httpSetRouteWorkers(HttpRoute *route, int workers)
 {
-    HttpLang    *lang;
-
-    if ((lang = mprAllocObj(HttpLang, manageLang)) == 0) {
-        return 0;
-    }
-    if (path) {
-        lang->path = sclone(path);
-    }
-    if (suffix) {
-        lang->suffix = sclone(suffix);
-    }
-    lang->flags = flags;
-    return lang;
+    mprAssert(route);
+    route->workers = workers;
 }
 
 
-static void manageLang(HttpLang *lang, int flags)
+void httpSetRouteSessionStore(HttpRoute *route, int store, ssize maxCookie)
 {
-    if (flags & MPR_MANAGE_MARK) {
-        mprMark(lang->path);
-        mprMark(lang->suffix);
-    }
+    mprAssert(route);
+    route->sessionStore = store;
+    route->sessionCookieMax = (maxCookie > 0) ? maxCookie : HTTP_SESSION_MAX_COOKIE;
 }
 
 
-static void definePathVars(HttpRoute *route)
+void httpSetRouteWebSocketsDeflate(HttpRoute *route, int windowBits, bool takeover)
 {
     mprAssert(route);
-
-    mprAddKey(route->vars, "PRODUCT", sclone(BIT_PRODUCT));
-    mprAddKey(route->vars, "OS", sclone(BIT_OS));
-    mprAddKey(route->vars, "VERSION", sclone(BIT_VERSION));
-    mprAddKey(route->vars, "LIBDIR", mprGetAppDir());
-    if (route->host) {
-        defineHostVars(route);
+    route->webSocketsDeflate = windowBits;
+    if (takeover) {
+        route->flags &= ~HTTP_ROUTE_WS_NO_TAKEOVER;
+    } else {
+        route->flags |= HTTP_ROUTE_WS_NO_TAKEOVER;
     }
 }
 
 
-static void defineHostVars(HttpRoute *route) 
+void httpAddRouteErrorDocument(HttpRoute *route, int status, cchar *url)
 {
+    char    *code;
+
     mprAssert(route);
-    mprAddKey(route->vars, "DOCUMENT_ROOT", route->dir);
-    mprAddKey(route->vars, "SERVER_ROOT", route->host->home);
-    mprAddKey(route->vars, "SERVER_NAME", route->host->name);
-    mprAddKey(route->vars, "SERVER_PORT", itos(route->host->port));
+    GRADUATE_HASH(route, errorDocuments);
+    code = itos(status);
+    mprAddKey(route->errorDocuments, code, sclone(url));
 }
 
 
-static char *expandTokens(HttpConn *conn, cchar *str)
+cchar *httpLookupRouteErrorDocument(HttpRoute *route, int code)
 {
-    HttpRx      *rx;
-
-    mprAssert(conn);
-    mprAssert(str);
+    char   *num;
 
-    rx = conn->rx;
-    return expandRequestTokens(conn, expandPatternTokens(rx->pathInfo, str, rx->matches, rx->matchCount));
+    mprAssert(route);
+    if (route->errorDocuments == 0) {
+        return 0;
+    }
+    num = itos(code);
+    return (cchar*) mprLookupKey(route->errorDocuments, num);
 }
 
+/********************************* Route Finalization *************************/
 
-/*
-    WARNING: str is modified. Result is allocated string.
- */
-static char *expandRequestTokens(HttpConn *conn, char *str)
+static void finalizeMethods(HttpRoute *route)
 {
-    HttpRx      *rx;
-    HttpTx      *tx;
-    HttpRoute   *route;
-    MprBuf      *buf;
-    HttpLang    *lang;
-    char        *tok, *cp, *key, *value, *field, *header, *defaultValue;
-
-    mprAssert(conn);
-    mprAssert(str);
-
-    rx = conn->rx;
-    route = rx->route;
-    tx = conn->tx;
-    buf = mprCreateBuf(-1, -1);
-    tok = 0;
+    char    *method, *methods, *tok;
 
-    for (cp = str; cp && *cp; ) {
-        if ((tok = strstr(cp, "${")) == 0) {
-            break;
-        }
-        if (tok > cp) {
-            mprPutBlockToBuf(buf, cp, tok - cp);
+    mprAssert(route);
+    methods = route->methodSpec;
+    if (methods && *methods && !scaselessmatch(methods, "ALL") && !smatch(methods, "*")) {
+        if ((route->methods = mprCreateHash(-1, 0)) == 0) {
+            return;
         }
-        if ((key = stok(&tok[2], ":", &value)) == 0) {
-            continue;
+        methods = sclone(methods);
+        while ((method = stok(methods, ", \t\n\r", &tok)) != 0) {
+            mprAddKey(route->methods, method, route);
+            methods = 0;
         }
-        stok(value, "}", &cp);
-
-        if (smatch(key, "header")) {
-            header = stok(value, "=", &defaultValue);
-            if ((value = (char*) httpGetHeader(conn, header)) == 0) {
-                value = defaultValue ? defaultValue : "";
-            }
-            mprPutStringToBuf(buf, value);
-
-        } else if (smatch(key, "param")) {
-            field = stok(value, "=", &defaultValue);
-            if (defaultValue == 0) {
-                defaultValue = "";
-            }
-            mprPutStringToBuf(buf, httpGetParam(conn, field, defaultValue));
-
-        } else if (smatch(key, "request")) {
-            value = stok(value, "=", &defaultValue);
-            //  OPT with switch on first char
-            if (smatch(value, "clientAddress")) {
-                mprPutStringToBuf(buf, conn->ip);
-
-            } else if (smatch(value, "clientPort")) {
-                mprPutIntToBuf(buf, conn->port);
-
-            } else if (smatch(value, "error")) {
-                mprPutStringToBuf(buf, conn->errorMsg);
+    } else {
+        route->methodSpec = sclone("*");
+    }
+}
 
-            } else if (smatch(value, "ext")) {
-                mprPutStringToBuf(buf, rx->parsedUri->ext);
 
-            } else if (smatch(value, "extraPath")) {
-                mprPutStringToBuf(buf, rx->extraPath);
+/*
+    Finalize the pattern. 
+        - Change "\{n[:m]}" to "{n[:m]}"
+        - Change "\~" to "~"
+        - Change "(~ PAT ~)" to "(?: PAT )?"
+        - Extract the tokens and change tokens: "{word}" to "([^/]*)"
+ */
+static void finalizePattern(HttpRoute *route)
+{
+    MprBuf      *pattern;
+    cchar       *errMsg;
+    char        *startPattern, *cp, *ep, *token, *field;
+    ssize       len;
+    int         column;
 
-            } else if (smatch(value, "filename")) {
-                mprPutStringToBuf(buf, tx->filename);
+    mprAssert(route);
+    route->tokens = mprCreateList(-1, 0);
+    pattern = mprCreateBuf(-1, -1);
+    startPattern = route->pattern[0] == '^' ? &route->pattern[1] : route->pattern;
 
-            } else if (scaselessmatch(value, "language")) {
-                if (!defaultValue) {
-                    defaultValue = route->defaultLanguage;
-                }
-                if ((lang = httpGetLanguage(conn, route->languages, defaultValue)) != 0) {
-                    mprPutStringToBuf(buf, lang->suffix);
-                } else {
-                    mprPutStringToBuf(buf, defaultValue);
-                }
+    if (route->name == 0) {
+        route->name = sclone(startPattern);
+    }
+    if (route->tplate == 0) {
+        /* Do this while the prefix is still in the route pattern */
+        route->tplate = finalizeTemplate(route);
+    }
+    /*
+        Create an simple literal startWith string to optimize route rejection.
+     */
+    len = strcspn(startPattern, "^$*+?.(|{[\\");
+    if (len) {
+        route->startWith = snclone(startPattern, len);
+        route->startWithLen = len;
+        if ((cp = strchr(&route->startWith[1], '/')) != 0) {
+            route->startSegment = snclone(route->startWith, cp - route->startWith);
+        } else {
+            route->startSegment = route->startWith;
+        }
+        route->startSegmentLen = slen(route->startSegment);
+    } else {
+        /* Pattern has special characters */
+        route->startWith = 0;
+        route->startWithLen = 0;
+        route->startSegmentLen = 0;
+        route->startSegment = 0;
+    }
 
-            } else if (scaselessmatch(value, "languageDir")) {
-                lang = httpGetLanguage(conn, route->languages, 0);
-                if (!defaultValue) {
-                    defaultValue = ".";
-                }
-                mprPutStringToBuf(buf, lang ? lang->path : defaultValue);
+    /*
+        Remove the route prefix from the start of the compiled pattern.
+     */
+    if (route->prefix && sstarts(startPattern, route->prefix)) {
+        mprAssert(route->prefixLen <= route->startWithLen);
+        startPattern = sfmt("^%s", &startPattern[route->prefixLen]);
+    } else {
+        startPattern = sjoin("^", startPattern, NULL);
+    }
+    for (cp = startPattern; *cp; cp++) {
+        /* Alias for optional, non-capturing pattern:  "(?: PAT )?" */
+        if (*cp == '(' && cp[1] == '~') {
+            mprPutStringToBuf(pattern, "(?:");
+            cp++;
 
-            } else if (smatch(value, "host")) {
-                /* Includes port if present */
-                mprPutStringToBuf(buf, rx->parsedUri->host);
+        } else if (*cp == '(') {
+            mprPutCharToBuf(pattern, *cp);
+        } else if (*cp == '~' && cp[1] == ')') {
+            mprPutStringToBuf(pattern, ")?");
+            cp++;
 
-            } else if (smatch(value, "method")) {
-                mprPutStringToBuf(buf, rx->method);
+        } else if (*cp == ')') {
+            mprPutCharToBuf(pattern, *cp);
 
-            } else if (smatch(value, "originalUri")) {
-                mprPutStringToBuf(buf, rx->originalUri);
+        } else if (*cp == '{') {
+            if (cp > startPattern&& cp[-1] == '\\') {
+                mprAdjustBufEnd(pattern, -1);
+                mprPutCharToBuf(pattern, *cp);
+            } else {
+                if ((ep = schr(cp, '}')) != 0) {
+                    /* Trim {} off the token and replace in pattern with "([^/]*)"  */
+                    token = snclone(&cp[1], ep - cp - 1);
+                    if ((field = schr(token, '=')) != 0) {
+                        *field++ = '\0';
+                        field = sfmt("(%s)", field);
+                    } else {
+                        field = "([^/]*)";
+                    }
+                    mprPutStringToBuf(pattern, field);
+                    mprAddItem(route->tokens, token);
+                    /* Params ends up looking like "$1:$2:$3:$4" */
+                    cp = ep;
+                }
+            }
+        } else if (*cp == '\\' && *cp == '~') {
+            mprPutCharToBuf(pattern, *++cp);
 
-            } else if (smatch(value, "pathInfo")) {
-                mprPutStringToBuf(buf, rx->pathInfo);
+        } else {
+            mprPutCharToBuf(pattern, *cp);
+        }
+    }
+    mprAddNullToBuf(pattern);
+    route->optimizedPattern = sclone(mprGetBufStart(pattern));
+    if (mprGetListLength(route->tokens) == 0) {
+        route->tokens = 0;
+    }
+    if (route->patternCompiled && (route->flags & HTTP_ROUTE_FREE_PATTERN)) {
+        free(route->patternCompiled);
+    }
+    if ((route->patternCompiled = pcre_compile2(route->optimizedPattern, 0, 0, &errMsg, &column, NULL)) == 0) {
+        mprError("Can't compile route. Error %s at column %d", errMsg, column); 
+    }
+    route->flags |= HTTP_ROUTE_FREE_PATTERN;
+}
 
-            } else if (smatch(value, "prefix")) {
-                mprPutStringToBuf(buf, route->prefix);
 
-            } else if (smatch(value, "query")) {
-                mprPutStringToBuf(buf, rx->parsedUri->query);
+static char *finalizeReplacement(HttpRoute *route, cchar *str)
+{
+    MprBuf      *buf;
+    cchar       *item;
+    cchar       *tok, *cp, *ep, *token;
+    int         next, braced;
 
-            } else if (smatch(value, "reference")) {
-                mprPutStringToBuf(buf, rx->parsedUri->reference);
+    mprAssert(route);
 
-            } else if (smatch(value, "scheme")) {
-                if (rx->parsedUri->scheme) {
-                    mprPutStringToBuf(buf, rx->parsedUri->scheme);
-                }  else {
-                    mprPutStringToBuf(buf, (conn->secure) ? "https" : "http");
+    /*
+        Prepare a replacement string. Change $token to $N
+     */
+    buf = mprCreateBuf(-1, -1);
+    if (str && *str) {
+        for (cp = str; *cp; cp++) {
+            if ((tok = schr(cp, '$')) != 0 && (tok == str || tok[-1] != '\\')) {
+                if (tok > cp) {
+                    mprPutBlockToBuf(buf, cp, tok - cp);
                 }
+                if ((braced = (*++tok == '{')) != 0) {
+                    tok++;
+                }
+                if (*tok == '&' || *tok == '\'' || *tok == '`' || *tok == '$') {
+                    mprPutCharToBuf(buf, '$');
+                    mprPutCharToBuf(buf, *tok);
+                    ep = tok + 1;
+                } else {
+                    if (braced) {
+                        for (ep = tok; *ep && *ep != '}'; ep++) ;
+                    } else {
+                        for (ep = tok; *ep && isdigit((uchar) *ep); ep++) ;
+                    }
+                    token = snclone(tok, ep - tok);
+                    if (schr(token, ':')) {
+                        /* Double quote to get through two levels of expansion in writeTarget */
+                        mprPutStringToBuf(buf, "$${");
+                        mprPutStringToBuf(buf, token);
+                        mprPutCharToBuf(buf, '}');
+                    } else {
+                        for (next = 0; (item = mprGetNextItem(route->tokens, &next)) != 0; ) {
+                            if (scmp(item, token) == 0) {
+                                break;
+                            }
+                        }
+                        /*  Insert "$" in front of "{token}" */
+                        if (item) {
+                            mprPutCharToBuf(buf, '$');
+                            mprPutIntToBuf(buf, next);
+                        } else if (snumber(token)) {
+                            mprPutCharToBuf(buf, '$');
+                            mprPutStringToBuf(buf, token);
+                        } else {
+                            mprError("Can't find token \"%s\" in template \"%s\"", token, route->pattern);
+                        }
+                    }
+                }
+                if (braced) {
+                    ep++;
+                }
+                cp = ep - 1;
 
-            } else if (smatch(value, "scriptName")) {
-                mprPutStringToBuf(buf, rx->scriptName);
-
-            } else if (smatch(value, "serverAddress")) {
-                /* Pure IP address, no port. See "serverPort" */
-                mprPutStringToBuf(buf, conn->sock->acceptIp);
-
-            } else if (smatch(value, "serverPort")) {
-                mprPutIntToBuf(buf, conn->sock->acceptPort);
-
-            } else if (smatch(value, "uri")) {
-                mprPutStringToBuf(buf, rx->uri);
+            } else {
+                if (*cp == '\\') {
+                    if (cp[1] == 'r') {
+                        mprPutCharToBuf(buf, '\r');
+                        cp++;
+                    } else if (cp[1] == 'n') {
+                        mprPutCharToBuf(buf, '\n');
+                        cp++;
+                    } else {
+                        mprPutCharToBuf(buf, *cp);
+                    }
+                } else {
+                    mprPutCharToBuf(buf, *cp);
+                }
             }
         }
     }
-    if (tok) {
-        if (tok > cp) {
-            mprPutBlockToBuf(buf, tok, tok - cp);
-        }
-    } else {
-        mprPutStringToBuf(buf, cp);
-    }
     mprAddNullToBuf(buf);
     return sclone(mprGetBufStart(buf));
 }
 
 
-char *httpExpandRouteVars(HttpConn *conn, cchar *str)
-{
-    return expandRequestTokens(conn, stemplate(str, conn->rx->route->vars));
-}
-
-
 /*
-    Replace text using pcre regular expression match indicies
+    Convert a route pattern into a usable template to construct URI links
+    NOTE: this is heuristic and not perfect. Users can define the template via the httpSetTemplate API or in appweb via the
+    EspURITemplate configuration directive.
  */
-static char *expandPatternTokens(cchar *str, cchar *replacement, int *matches, int matchCount)
+static char *finalizeTemplate(HttpRoute *route)
 {
-    MprBuf  *result;
-    cchar   *end, *cp, *lastReplace;
-    int     submatch;
-
-    mprAssert(str);
-    mprAssert(replacement);
-    mprAssert(matches);
+    MprBuf  *buf;
+    char    *sp, *tplate;
 
-    if (matchCount <= 0) {
-        return MPR->emptyString;
+    if ((buf = mprCreateBuf(0, 0)) == 0) {
+        return 0;
     }
-    result = mprCreateBuf(-1, -1);
-    lastReplace = replacement;
-    end = &replacement[slen(replacement)];
-
-    for (cp = replacement; cp < end; ) {
-        if (*cp == '$') {
-            if (lastReplace < cp) {
-                mprPutSubStringToBuf(result, lastReplace, (int) (cp - lastReplace));
+    /*
+        Note: the route->pattern includes the prefix
+     */
+    for (sp = route->pattern; *sp; sp++) {
+        switch (*sp) {
+        default:
+            mprPutCharToBuf(buf, *sp);
+            break;
+        case '$':
+            if (sp[1] == '\0') {
+                sp++;
+            } else {
+                mprPutCharToBuf(buf, *sp);
             }
-            switch (*++cp) {
-            case '$':
-                mprPutCharToBuf(result, '$');
-                break;
-            case '&':
-                /* Replace the matched string */
-                mprPutSubStringToBuf(result, &str[matches[0]], matches[1] - matches[0]);
-                break;
-            case '`':
-                /* Insert the portion that preceeds the matched string */
-                mprPutSubStringToBuf(result, str, matches[0]);
-                break;
-            case '\'':
-                /* Insert the portion that follows the matched string */
-                mprPutSubStringToBuf(result, &str[matches[1]], slen(str) - matches[1]);
-                break;
-            default:
-                /* Insert the nth submatch */
-                if (isdigit((uchar) *cp)) {
-                    submatch = (int) wtoi(cp);
-                    while (isdigit((uchar) *++cp))
-                        ;
-                    cp--;
-                    if (submatch < matchCount) {
-                        submatch *= 2;
-                        mprPutSubStringToBuf(result, &str[matches[submatch]], matches[submatch + 1] - matches[submatch]);
-                    }
+            break;
+        case '^':
+            if (sp > route->pattern) {
+                mprPutCharToBuf(buf, *sp);
+            }
+            break;
+        case '+':
+        case '?':
+        case '|':
+        case '[':
+        case ']':
+        case '*':
+        case '.':
+            break;
+        case '(':
+            if (sp[1] == '~') {
+                sp++;
+            }
+            break;
+        case '~':
+            if (sp[1] == ')') {
+                sp++;
+            } else {
+                mprPutCharToBuf(buf, *sp);
+            }
+            break;
+        case ')':
+            break;
+        case '\\':
+            if (sp[1] == '\\') {
+                mprPutCharToBuf(buf, *sp++);
+            } else {
+                mprPutCharToBuf(buf, *++sp);
+            }
+            break;
+        case '{':
+            mprPutCharToBuf(buf, '$');
+            while (sp[1] && *sp != '}') {
+                if (*sp == '=') {
+                    while (sp[1] && *sp != '}') sp++;
                 } else {
-                    mprError("Bad replacement $ specification in page");
-                    return 0;
+                    mprPutCharToBuf(buf, *sp++);
                 }
             }
-            lastReplace = cp + 1;
+            mprPutCharToBuf(buf, '}');
+            break;
         }
-        cp++;
     }
-    if (lastReplace < cp && lastReplace < end) {
-        mprPutSubStringToBuf(result, lastReplace, (int) (cp - lastReplace));
+    if (mprLookAtLastCharInBuf(buf) == '/') {
+        mprAdjustBufEnd(buf, -1);
     }
-    mprAddNullToBuf(result);
-    return sclone(mprGetBufStart(result));
+    mprAddNullToBuf(buf);
+    if (mprGetBufLength(buf) > 0) {
+        tplate = sclone(mprGetBufStart(buf));
+    } else {
+        tplate = sclone("/");
+    }
+    return tplate;
 }
 
 
-void httpDefineRouteBuiltins()
+void httpFinalizeRoute(HttpRoute *route)
 {
     /*
-        These are the conditions that can be selected. Use httpAddRouteCondition to add to a route.
-        The allow and auth conditions are internal and are configured via various Auth APIs.
+        Add the route to the owning host. When using an Appweb configuration file, the order of route finalization 
+        will be from the inside out. This ensures that nested routes are defined BEFORE outer/enclosing routes.
+        This is important as requests process routes in-order.
      */
-    httpDefineRouteCondition("allowDeny", allowDenyCondition);
-    httpDefineRouteCondition("auth", authCondition);
-    httpDefineRouteCondition("match", matchCondition);
-    httpDefineRouteCondition("exists", existsCondition);
-    httpDefineRouteCondition("directory", directoryCondition);
-
-    httpDefineRouteUpdate("param", paramUpdate);
-    httpDefineRouteUpdate("cmd", cmdUpdate);
-    httpDefineRouteUpdate("lang", langUpdate);
-
-    httpDefineRouteTarget("close", closeTarget);
-    httpDefineRouteTarget("redirect", redirectTarget);
-    httpDefineRouteTarget("run", runTarget);
-    httpDefineRouteTarget("write", writeTarget);
+    mprAssert(route);
+    if (mprGetListLength(route->indicies) == 0) {
+        mprAddItem(route->indicies,  sclone("index.html"));
+    }
+    httpAddRoute(route->host, route);
 }
 
 
+/********************************* Path and URI Expansion *****************************/
 /*
-    Tokenizes a line using %formats. Mandatory tokens can be specified with %. Optional tokens are specified with ?. 
-    Supported tokens:
-        %B - Boolean. Parses: on/off, true/false, yes/no.
-        %N - Number. Parses numbers in base 10.
-        %S - String. Removes quotes.
-        %T - Template String. Removes quotes and expand ${PathVars}.
-        %P - Path string. Removes quotes and expands ${PathVars}. Resolved relative to host->dir (ServerRoot).
-        %W - Parse words into a list
-        %! - Optional negate. Set value to HTTP_ROUTE_NOT present, otherwise zero.
-    Values wrapped in quotes will have the outermost quotes trimmed.
+    What does this return. Does it return an absolute URI?
+    MOB - rename httpUri() and move to uri.c
  */
-bool httpTokenize(HttpRoute *route, cchar *line, cchar *fmt, ...)
-{
-    va_list     args;
-    bool        rc;
-
-    mprAssert(route);
-    mprAssert(line);
-    mprAssert(fmt);
-
-    va_start(args, fmt);
-    rc =  httpTokenizev(route, line, fmt, args);
-    va_end(args);
-    return rc;
-}
-
-
-bool httpTokenizev(HttpRoute *route, cchar *line, cchar *fmt, va_list args)
+char *httpLink(HttpConn *conn, cchar *target, MprHash *options)
 {
-    MprList     *list;
-    cchar       *f;
-    char        *tok, *etok, *value, *word, *end;
-    int         quote;
+    HttpRoute       *route, *lroute;
+    HttpRx          *rx;
+    HttpUri         *uri;
+    cchar           *routeName, *action, *controller, *originalAction, *tplate;
+    char            *rest;
 
-    mprAssert(route);
-    mprAssert(fmt);
+    rx = conn->rx;
+    route = rx->route;
+    controller = 0;
 
-    if (line == 0) {
-        line = "";
+    if (target == 0) {
+        target = "";
     }
-    tok = sclone(line);
-    end = &tok[slen(line)];
-
-    for (f = fmt; *f && tok < end; f++) {
-        for (; isspace((uchar) *tok); tok++) ;
-        if (*tok == '\0' || *tok == '#') {
-            break;
-        }
-        if (isspace((uchar) *f)) {
-            continue;
+    if (*target == '@') {
+        target = sjoin("{action: '", target, "'}", NULL);
+    } 
+    if (*target != '{') {
+        target = httpTemplate(conn, target, 0);
+    } else  {
+        if (options) {
+            options = mprBlendHash(httpGetOptions(target), options);
+        } else {
+            options = httpGetOptions(target);
         }
-        if (*f == '%' || *f == '?') {
-            f++;
-            quote = 0;
-            if (*f != '*' && (*tok == '"' || *tok == '\'')) {
-                quote = *tok++;
+        /*
+            Prep the action. Forms are:
+                . @action               # Use the current controller
+                . @controller/          # Use "list" as the action
+                . @controller/action
+         */
+        if ((action = httpGetOption(options, "action", 0)) != 0) {
+            originalAction = action;
+            if (*action == '@') {
+                action = &action[1];
             }
-            if (*f == '!') {
-                etok = &tok[1];
+            if (strchr(action, '/')) {
+                controller = stok((char*) action, "/", (char**) &action);
+                action = stok((char*) action, "/", &rest);
+            }
+            if (controller) {
+                httpSetOption(options, "controller", controller);
             } else {
-                if (quote) {
-                    for (etok = tok; *etok && !(*etok == quote && etok[-1] != '\\'); etok++) ; 
-                    *etok++ = '\0';
-                } else if (*f == '*') {
-                    for (etok = tok; *etok; etok++) {
-                        if (*etok == '#') {
-                            *etok = '\0';
+                controller = httpGetParam(conn, "controller", 0);
+            }
+            if (action == 0 || *action == '\0') {
+                action = "list";
+            }
+            if (action != originalAction) {
+                httpSetOption(options, "action", action);
+            }
+        }
+        /*
+            Find the template to use. Strategy is this order:
+                . options.template
+                . options.route.template
+                . options.action mapped to a route.template, via:
+                . /app/STAR/action
+                . /app/controller/action
+                . /app/STAR/default
+                . /app/controller/default
+         */
+        if ((tplate = httpGetOption(options, "template", 0)) == 0) {
+            if ((routeName = httpGetOption(options, "route", 0)) != 0) {
+                routeName = expandRouteName(conn, routeName);
+                lroute = httpLookupRoute(conn->host, routeName);
+            } else {
+                lroute = 0;
+            }
+            if (lroute == 0) {
+                if ((lroute = httpLookupRoute(conn->host, qualifyName(route, "{controller}", action))) == 0) {
+                    if ((lroute = httpLookupRoute(conn->host, qualifyName(route, controller, action))) == 0) {
+                        if ((lroute = httpLookupRoute(conn->host, qualifyName(route, "{controller}", "default"))) == 0) {
+                            lroute = httpLookupRoute(conn->host, qualifyName(route, controller, "default"));
                         }
                     }
-                } else {
-                    for (etok = tok; *etok && !isspace((uchar) *etok); etok++) ;
                 }
-                *etok++ = '\0';
             }
-            if (*f == '*') {
-                f++;
-                tok = trimQuotes(tok);
-                * va_arg(args, char**) = tok;
-                tok = etok;
-                break;
-            }
-
-            switch (*f) {
-            case '!':
-                if (*tok == '!') {
-                    *va_arg(args, int*) = HTTP_ROUTE_NOT;
-                } else {
-                    *va_arg(args, int*) = 0;
-                    continue;
-                }
-                break;
-            case 'B':
-                if (scaselesscmp(tok, "on") == 0 || scaselesscmp(tok, "true") == 0 || scaselesscmp(tok, "yes") == 0) {
-                    *va_arg(args, bool*) = 1;
-                } else {
-                    *va_arg(args, bool*) = 0;
-                }
-                break;
-            case 'N':
-                *va_arg(args, int*) = (int) stoi(tok);
-                break;
-            case 'P':
-                *va_arg(args, char**) = httpMakePath(route, strim(tok, "\"", MPR_TRIM_BOTH));
-                break;
-            case 'S':
-                *va_arg(args, char**) = strim(tok, "\"", MPR_TRIM_BOTH);
-                break;
-            case 'T':
-                value = strim(tok, "\"", MPR_TRIM_BOTH);
-                *va_arg(args, char**) = stemplate(value, route->vars);
-                break;
-            case 'W':
-                list = va_arg(args, MprList*);
-                word = stok(tok, " \t\r\n", &tok);
-                while (word) {
-                    mprAddItem(list, word);
-                    word = stok(0, " \t\r\n", &tok);
-                }
-                break;
-            default:
-                mprError("Unknown token pattern %%\"%c\"", *f);
-                break;
-            }
-            tok = etok;
-        }
-    }
-    if (tok < end) {
-        /*
-            Extra unparsed text
-         */
-        for (; tok < end && isspace((uchar) *tok); tok++) ;
-        if (*tok && *tok != '#') {
-            mprError("Extra unparsed text: \"%s\"", tok);
-            return 0;
-        }
-    }
-    if (*f) {
-        /*
-            Extra unparsed format tokens
-         */
-        for (; *f; f++) {
-            if (*f == '%') {
-                break;
-            } else if (*f == '?') {
-                switch (*++f) {
-                case '!':
-                case 'N':
-                    *va_arg(args, int*) = 0;
-                    break;
-                case 'B':
-                    *va_arg(args, bool*) = 0;
-                    break;
-                case 'D':
-                case 'P':
-                case 'S':
-                case 'T':
-                case '*':
-                    *va_arg(args, char**) = 0;
-                    break;
-                case 'W':
-                    break;
-                default:
-                    mprError("Unknown token pattern %%\"%c\"", *f);
-                    break;
-                }
+            if (lroute) {
+                tplate = lroute->tplate;
             }
         }
-        if (*f) {
-            mprError("Missing directive parameters");
-            return 0;
+        if (tplate) {
+            target = httpTemplate(conn, tplate, options);
+        } else {
+            mprError("Can't find template for URI %s", target);
+            target = "/";
         }
     }
-    va_end(args);
-    return 1;
+    //  OPT
+    uri = httpCreateUri(target, 0);
+    uri = httpResolveUri(httpCreateUri(rx->uri, 0), 1, &uri, 0);
+    httpNormalizeUri(uri);
+    return httpUriToString(uri, 0);
 }
 
 
-static char *trimQuotes(char *str)
+/*
+    Limited expansion of route names. Support ~/ and ${app} at the start of the route name
+ */
+static cchar *expandRouteName(HttpConn *conn, cchar *routeName)
 {
-    ssize   len;
+    HttpRoute   *route;
 
-    mprAssert(str);
-    len = slen(str);
-    if (*str == '\"' && str[len - 1] == '\"' && len > 2 && str[1] != '\"') {
-        return snclone(&str[1], len - 2);
+    route = conn->rx->route;
+    if (routeName[0] == '~') {
+        return sjoin(route->prefix, &routeName[1], NULL);
     }
-    return sclone(str);
+    if (sstarts(routeName, "${app}")) {
+        return sjoin(route->prefix, &routeName[6], NULL);
+    }
+    return routeName;
 }
 
 
-MprHash *httpGetOptions(cchar *options)
+/*
+    Expect a route->tplate with embedded tokens of the form: "/${controller}/${action}/${other}"
+    The options is a hash of token values.
+ */
+char *httpTemplate(HttpConn *conn, cchar *tplate, MprHash *options)
 {
-    if (options == 0) {
-        return mprCreateHash(-1, 0);
-    }
-    if (*options == '@') {
-        /* Allow embedded URIs as options */
-        options = sfmt("{ data-click: '%s'}", options);
+    MprBuf      *buf;
+    HttpRoute   *route;
+    cchar       *cp, *ep, *value;
+    char        key[MPR_MAX_STRING];
+
+    route = conn->rx->route;
+    if (tplate == 0 || *tplate == '\0') {
+        return MPR->emptyString;
     }
-    mprAssert(*options == '{');
-    if (*options != '{') {
-        options = sfmt("{%s}", options);
+    buf = mprCreateBuf(-1, -1);
+    for (cp = tplate; *cp; cp++) {
+        if (*cp == '~' && (cp == tplate || cp[-1] != '\\')) {
+            if (route->prefix) {
+                mprPutStringToBuf(buf, route->prefix);
+            }
+
+        } else if (*cp == '$' && cp[1] == '{' && (cp == tplate || cp[-1] != '\\')) {
+            cp += 2;
+            if ((ep = strchr(cp, '}')) != 0) {
+                sncopy(key, sizeof(key), cp, ep - cp);
+                if (options && (value = httpGetOption(options, key, 0)) != 0) {
+                    mprPutStringToBuf(buf, value);
+                } else if ((value = mprLookupKey(conn->rx->params, key)) != 0) {
+                    mprPutStringToBuf(buf, value);
+                }
+                if (value == 0) {
+                    /* Just emit the token name if the token can't be found */
+                    mprPutStringToBuf(buf, key);
+                }
+                cp = ep;
+            }
+        } else {
+            mprPutCharToBuf(buf, *cp);
+        }
     }
-    return mprDeserialize(options);
+    mprAddNullToBuf(buf);
+    return sclone(mprGetBufStart(buf));
 }
 
 
-void *httpGetOption(MprHash *options, cchar *field, cchar *defaultValue)
+void httpSetRouteVar(HttpRoute *route, cchar *key, cchar *value)
 {
-    MprKey      *kp;
-    cchar       *value;
+    mprAssert(route);
+    mprAssert(key);
+    mprAssert(value);
 
-    if (options == 0) {
-        value = defaultValue;
-    } else if ((kp = mprLookupKeyEntry(options, field)) == 0) {
-        value = defaultValue;
-    } else {
-        value = kp->data;
+    GRADUATE_HASH(route, vars);
+    if (schr(value, '$')) {
+        value = stemplate(value, route->vars);
     }
-    return (void*) value;
+    mprAddKey(route->vars, key, sclone(value));
 }
 
 
-MprHash *httpGetOptionHash(MprHash *options, cchar *field)
+/*
+    Make a path name. This replaces $references, converts to an absolute path name, cleans the path and maps delimiters.
+    Paths are resolved relative to host->home (ServerRoot).
+ */
+char *httpMakePath(HttpRoute *route, cchar *file)
 {
-    MprKey      *kp;
+    char    *path;
 
-    if (options == 0) {
-        return 0;
-    }
-    if ((kp = mprLookupKeyEntry(options, field)) == 0) {
+    mprAssert(route);
+    mprAssert(file);
+
+    if ((path = stemplate(file, route->vars)) == 0) {
         return 0;
     }
-    if (kp->type != MPR_JSON_ARRAY && kp->type != MPR_JSON_OBJ) {
-        return 0;
+    if (mprIsPathRel(path) && route->host) {
+        path = mprJoinPath(route->host->home, path);
     }
-    return (MprHash*) kp->data;
+    return mprGetAbsPath(path);
 }
 
-
-/* 
-    Prepend an option
+/********************************* Language ***********************************/
+/*
+    Language can be an empty string
  */
-void httpInsertOption(MprHash *options, cchar *field, cchar *value)
+int httpAddRouteLanguageSuffix(HttpRoute *route, cchar *language, cchar *suffix, int flags)
 {
-    MprKey      *kp;
+    HttpLang    *lp;
 
-    if (options == 0) {
-        mprAssert(options);
-        return;
+    mprAssert(route);
+    mprAssert(language);
+    mprAssert(suffix && *suffix);
+
+    if (route->languages == 0) {
+        route->languages = mprCreateHash(-1, 0);
+    } else {
+        GRADUATE_HASH(route, languages);
     }
-    if ((kp = mprLookupKeyEntry(options, field)) != 0) {
-        kp = mprAddKey(options, field, sjoin(value, " ", kp->data, NULL));
+    if ((lp = mprLookupKey(route->languages, language)) != 0) {
+        lp->suffix = sclone(suffix);
+        lp->flags = flags;
     } else {
-        kp = mprAddKey(options, field, value);
+        mprAddKey(route->languages, language, createLangDef(0, suffix, flags));
     }
-    kp->type = MPR_JSON_STRING;
+    return httpAddRouteUpdate(route, "lang", 0, 0);
 }
 
 
-void httpAddOption(MprHash *options, cchar *field, cchar *value)
+int httpAddRouteLanguageDir(HttpRoute *route, cchar *language, cchar *path)
 {
-    MprKey      *kp;
+    HttpLang    *lp;
 
-    if (options == 0) {
-        mprAssert(options);
-        return;
+    mprAssert(route);
+    mprAssert(language && *language);
+    mprAssert(path && *path);
+
+    if (route->languages == 0) {
+        route->languages = mprCreateHash(-1, 0);
+    } else {
+        GRADUATE_HASH(route, languages);
     }
-    if ((kp = mprLookupKeyEntry(options, field)) != 0) {
-        kp = mprAddKey(options, field, sjoin(kp->data, " ", value, NULL));
+    if ((lp = mprLookupKey(route->languages, language)) != 0) {
+        lp->path = sclone(path);
     } else {
-        kp = mprAddKey(options, field, value);
+        mprAddKey(route->languages, language, createLangDef(path, 0, 0));
     }
-    kp->type = MPR_JSON_STRING;
+    return httpAddRouteUpdate(route, "lang", 0, 0);
 }
 
 
-void httpRemoveOption(MprHash *options, cchar *field)
+void httpSetRouteDefaultLanguage(HttpRoute *route, cchar *language)
 {
-    if (options == 0) {
-        mprAssert(options);
-        return;
+    mprAssert(route);
+    mprAssert(language && *language);
+
+    route->defaultLanguage = sclone(language);
+}
+
+
+/********************************* Conditions *********************************/
+
+static int testCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *condition)
+{
+    HttpRouteProc   *proc;
+
+    mprAssert(conn);
+    mprAssert(route);
+    mprAssert(condition);
+
+    if ((proc = mprLookupKey(conn->http->routeConditions, condition->name)) == 0) {
+        httpError(conn, -1, "Can't find route condition rule %s", condition->name);
+        return 0;
     }
-    mprRemoveKey(options, field);
+    mprLog(6, "run condition on route %s condition %s", route->name, condition->name);
+    return (*proc)(conn, route, condition);
 }
 
 
-bool httpOption(MprHash *hash, cchar *field, cchar *value, int useDefault)
+/*
+    Allow/Deny authorization
+ */
+static int allowDenyCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
 {
-    return smatch(value, httpGetOption(hash, field, useDefault ? value : 0));
+    HttpRx      *rx;
+    HttpAuth    *auth;
+    int         allow, deny;
+
+    mprAssert(conn);
+    mprAssert(route);
+
+    rx = conn->rx;
+    auth = rx->route->auth;
+    if (auth == 0) {
+        return HTTP_ROUTE_OK;
+    }
+    allow = 0;
+    deny = 0;
+    if (auth->flags & HTTP_ALLOW_DENY) {
+        if (auth->allow && mprLookupKey(auth->allow, conn->ip)) {
+            allow++;
+        } else {
+            allow++;
+        }
+        if (auth->deny && mprLookupKey(auth->deny, conn->ip)) {
+            deny++;
+        }
+        if (!allow || deny) {
+            httpError(conn, HTTP_CODE_UNAUTHORIZED, "Access denied for this server %s", conn->ip);
+            return HTTP_ROUTE_OK;
+        }
+    } else {
+        if (auth->deny && mprLookupKey(auth->deny, conn->ip)) {
+            deny++;
+        }
+        if (auth->allow && !mprLookupKey(auth->allow, conn->ip)) {
+            deny = 0;
+            allow++;
+        } else {
+            allow++;
+        }
+        if (deny || !allow) {
+            httpError(conn, HTTP_CODE_UNAUTHORIZED, "Access denied for this server %s", conn->ip);
+            return HTTP_ROUTE_OK;
+        }
+    }
+    return HTTP_ROUTE_OK;
 }
 
 
-void httpSetOption(MprHash *options, cchar *field, cchar *value)
+static int authCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
 {
-    MprKey  *kp;
+    mprAssert(conn);
+    mprAssert(route);
 
-    if (value == 0) {
-        return;
+    if (!route->auth) {
+        return HTTP_ROUTE_OK;
     }
-    if (options == 0) {
-        mprAssert(options);
-        return;
+    if ((conn->dispatcher->flags & MPR_DISPATCHER_INLINE) && route->auth->type && 
+            !(route->auth->flags & HTTP_AUTO_LOGIN)) {
+        /* Verifying the user may block. The check is made by routeRequest once the request is on a worker */
+        conn->rx->authPending = 1;
+        return HTTP_ROUTE_OK;
     }
-    if ((kp = mprAddKey(options, field, value)) != 0) {
-        kp->type = MPR_JSON_STRING;
+    if (!httpCheckAuth(conn)) {
+        /* Request has been denied and fully handled */
+        return HTTP_ROUTE_OK;
     }
+    return HTTP_ROUTE_OK;
 }
 
 
-HttpLimits *httpGraduateLimits(HttpRoute *route, HttpLimits *limits)
+static int directoryCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
 {
-    if (route->parent && route->limits == route->parent->limits) {
-        if (limits == 0) {
-            limits = ((Http*) MPR->httpService)->serverLimits;
-        }
-        route->limits = mprMemdup(limits, sizeof(HttpLimits));
+    HttpTx      *tx;
+    MprPath     info;
+    char        *path;
+
+    mprAssert(conn);
+    mprAssert(route);
+    mprAssert(op);
+
+    /* 
+        Must have tx->filename set when expanding op->details, so map target now 
+     */
+    tx = conn->tx;
+    httpMapFile(conn, route);
+    path = mprJoinPath(route->dir, expandTokens(conn, op->details));
+    tx->ext = tx->filename = 0;
+    mprGetPathInfo(path, &info);
+    if (info.isDir) {
+        return HTTP_ROUTE_OK;
     }
-    return route->limits;
+    return HTTP_ROUTE_REJECT;
 }
 
+
 /*
-    @copy   default
+    Test if a file exists
+ */
+static int existsCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+{
+    HttpTx  *tx;
+    char    *path;
 
-    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
+    mprAssert(conn);
+    mprAssert(route);
+    mprAssert(op);
 
-    This software is distributed under commercial and open source licenses.
-    You may use the Embedthis Open Source license or you may acquire a 
-    commercial license from Embedthis Software. You agree to be fully bound
-    by the terms of either license. Consult the LICENSE.md distributed with
-    this software for full details and other copyrights.
+    tx = conn->tx;
 
-    Local variables:
-    tab-width: 4
-    c-basic-offset: 4
-    End:
-    vim: sw=4 ts=4 expandtab
+    /* 
+        Must have tx->filename set when expanding op->details, so map target now 
+     */
+    httpMapFile(conn, route);
+    path = mprJoinPath(route->dir, expandTokens(conn, op->details));
+    tx->ext = tx->filename = 0;
+    if (mprPathExists(path, R_OK)) {
+        return HTTP_ROUTE_OK;
+    }
+    return 0;
+}
 
-    @end
- */
 
-/************************************************************************/
-/*
-    Start of file "src/rx.c"
- */
-/************************************************************************/
+static int matchCondition(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+{
+    char    *str;
+    int     matched[HTTP_MAX_ROUTE_MATCHES * 2], count;
 
-/*
-    rx.c -- Http receiver. Parses http requests and client responses.
-    Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
- */
+    mprAssert(conn);
+    mprAssert(route);
+    mprAssert(op);
 
-/********************************* Includes ***********************************/
+    str = expandTokens(conn, op->details);
+    count = pcre_exec(op->mdata, NULL, str, (int) slen(str), 0, 0, matched, sizeof(matched) / sizeof(int)); 
+    if (count > 0) {
+        return HTTP_ROUTE_OK;
+    }
+    return HTTP_ROUTE_REJECT;
+}
 
 
+/********************************* Updates ******************************/
 
-/***************************** Forward Declarations ***************************/
+static int updateRequest(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+{
+    HttpRouteProc   *proc;
 
-static void addMatchEtag(HttpConn *conn, char *etag);
-static char *getToken(HttpConn *conn, cchar *delim);
-static void manageRange(HttpRange *range, int flags);
-static void manageRx(HttpRx *rx, int flags);
-static bool parseHeaders(HttpConn *conn, HttpPacket *packet);
-static bool parseIncoming(HttpConn *conn, HttpPacket *packet);
-static bool parseRange(HttpConn *conn, char *value);
-static bool parseRequestLine(HttpConn *conn, HttpPacket *packet);
-static bool parseResponseLine(HttpConn *conn, HttpPacket *packet);
-static bool processCompletion(HttpConn *conn);
-static bool processContent(HttpConn *conn, HttpPacket *packet);
-static void parseMethod(HttpConn *conn);
-static bool processParsed(HttpConn *conn);
-static bool processReady(HttpConn *conn);
-static bool processRunning(HttpConn *conn);
-static void routeRequest(HttpConn *conn);
+    mprAssert(conn);
+    mprAssert(route);
+    mprAssert(op);
 
-/*********************************** Code *************************************/
+    if ((proc = mprLookupKey(conn->http->routeUpdates, op->name)) == 0) {
+        httpError(conn, -1, "Can't find route update rule %s", op->name);
+        return HTTP_ROUTE_OK;
+    }
+    mprLog(6, "run update on route %s update %s", route->name, op->name);
+    return (*proc)(conn, route, op);
+}
 
-HttpRx *httpCreateRx(HttpConn *conn)
+
+static int cmdUpdate(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
 {
-    HttpRx      *rx;
+    MprCmd  *cmd;
+    char    *command, *out, *err;
+    int     status;
 
-    if ((rx = mprAllocObj(HttpRx, manageRx)) == 0) {
-        return 0;
+    mprAssert(conn);
+    mprAssert(route);
+    mprAssert(op);
+
+    command = expandTokens(conn, op->details);
+    cmd = mprCreateCmd(conn->dispatcher);
+    if ((status = mprRunCmd(cmd, command, NULL, &out, &err, -1, 0)) != 0) {
+        /* Don't call httpError, just set errorMsg which can be retrieved via: ${request:error} */
+        conn->errorMsg = sfmt("Command failed: %s\nStatus: %d\n%s\n%s", command, status, out, err);
+        mprError("%s", conn->errorMsg);
+        /* Continue */
     }
-    rx->conn = conn;
-    rx->length = -1;
-    rx->ifMatch = 1;
-    rx->ifModified = 1;
-    rx->pathInfo = sclone("/");
-    rx->scriptName = mprEmptyString();
-    rx->needInputPipeline = !conn->endpoint;
-    rx->headers = mprCreateHash(HTTP_SMALL_HASH_SIZE, MPR_HASH_CASELESS);
-    rx->chunkState = HTTP_CHUNK_UNCHUNKED;
-    rx->traceLevel = -1;
-    return rx;
+    return HTTP_ROUTE_OK;
 }
 
 
-static void manageRx(HttpRx *rx, int flags)
+static int paramUpdate(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
 {
-    if (flags & MPR_MANAGE_MARK) {
-        mprMark(rx->method);
-        mprMark(rx->uri);
-        mprMark(rx->pathInfo);
-        mprMark(rx->scriptName);
-        mprMark(rx->extraPath);
-        mprMark(rx->conn);
-        mprMark(rx->route);
-        mprMark(rx->etags);
-        mprMark(rx->headerPacket);
-        mprMark(rx->headers);
-        mprMark(rx->inputPipeline);
-        mprMark(rx->parsedUri);
-        mprMark(rx->requestData);
-        mprMark(rx->statusMessage);
-        mprMark(rx->accept);
-        mprMark(rx->acceptCharset);
-        mprMark(rx->acceptEncoding);
-        mprMark(rx->acceptLanguage);
-        mprMark(rx->cookie);
-        mprMark(rx->connection);
-        mprMark(rx->contentLength);
-        mprMark(rx->hostHeader);
-        mprMark(rx->pragma);
-        mprMark(rx->mimeType);
-        mprMark(rx->originalMethod);
-        mprMark(rx->originalUri);
-        mprMark(rx->redirect);
-        mprMark(rx->referrer);
-        mprMark(rx->securityToken);
-        mprMark(rx->session);
-        mprMark(rx->userAgent);
-        mprMark(rx->params);
-        mprMark(rx->svars);
-        mprMark(rx->inputRange);
-        mprMark(rx->passDigest);
-        mprMark(rx->files);
-        mprMark(rx->uploadDir);
-        mprMark(rx->paramString);
-        mprMark(rx->lang);
-        mprMark(rx->target);
+    mprAssert(conn);
+    mprAssert(route);
+    mprAssert(op);
 
-#if WSS
-        mprMark(rx->upgrade);
-        mprMark(rx->sockKey);
-        mprMark(rx->sockProtocol);
-        mprMark(rx->sockVersion);
-        mprMark(rx->origin);
-#endif
+    httpSetParam(conn, op->var, expandTokens(conn, op->value));
+    return HTTP_ROUTE_OK;
+}
 
-    } else if (flags & MPR_MANAGE_FREE) {
-        if (rx->conn) {
-            rx->conn->rx = 0;
+
+static int langUpdate(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+{
+    HttpUri     *prior;
+    HttpRx      *rx;
+    HttpLang    *lang;
+    char        *ext, *pathInfo, *uri;
+
+    mprAssert(conn);
+    mprAssert(route);
+
+    rx = conn->rx;
+    prior = rx->parsedUri;
+    mprAssert(route->languages);
+
+    if ((lang = httpGetLanguage(conn, route->languages, 0)) != 0) {
+        rx->lang = lang;
+        if (lang->suffix) {
+            pathInfo = 0;
+            if (lang->flags & HTTP_LANG_AFTER) {
+                pathInfo = sjoin(rx->pathInfo, ".", lang->suffix, NULL);
+            } else if (lang->flags & HTTP_LANG_BEFORE) {
+                ext = httpGetExt(conn);
+                if (ext && *ext) {
+                    pathInfo = sjoin(mprJoinPathExt(mprTrimPathExt(rx->pathInfo), lang->suffix), ".", ext, NULL);
+                } else {
+                    pathInfo = mprJoinPathExt(mprTrimPathExt(rx->pathInfo), lang->suffix);
+                }
+            }
+            if (pathInfo) {
+                uri = httpFormatUri(prior->scheme, prior->host, prior->port, pathInfo, prior->reference, prior->query, 0);
+                httpSetUri(conn, uri, 0);
+            }
         }
     }
+    return HTTP_ROUTE_OK;
 }
 
 
-void httpDestroyRx(HttpRx *rx)
+/*********************************** Targets **********************************/
+
+static int closeTarget(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
 {
-    if (rx->conn) {
-        rx->conn->rx = 0;
-        rx->conn = 0;
-    }
+    mprAssert(conn);
+    mprAssert(route);
+
+    httpError(conn, HTTP_CODE_RESET, "Route target \"close\" is closing request");
+    httpDisconnect(conn);
+    return HTTP_ROUTE_OK;
 }
 
 
-/*  
-    Pump the Http engine.
-    Process incoming requests and drive the state machine. This will process as many requests as possible before returning. 
-    All socket I/O is non-blocking, and this routine must not block. Note: packet may be null.
- */
-void httpPump(HttpConn *conn, HttpPacket *packet)
+static int redirectTarget(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
 {
+    HttpRx      *rx;
+    HttpUri     *dest, *prior;
+    cchar       *scheme, *host, *query, *reference, *uri, *target;
+    int         port;
+
     mprAssert(conn);
+    mprAssert(route);
+    mprAssert(route->target);
 
-    conn->canProceed = 1;
-    conn->inHttpProcess = 1;
+    rx = conn->rx;
 
-    while (conn->canProceed) {
-        LOG(7, "httpProcess %s, state %d, error %d", conn->dispatcher->name, conn->state, conn->error);
-        switch (conn->state) {
-        case HTTP_STATE_BEGIN:
-        case HTTP_STATE_CONNECTED:
-            conn->canProceed = parseIncoming(conn, packet);
-            break;
+    /* Note: target may be empty */
+    target = expandTokens(conn, route->target);
+    if (route->responseStatus) {
+        httpRedirect(conn, route->responseStatus, target);
+        return HTTP_ROUTE_OK;
+    }
+    //  MOB - OPT Use httpCompleteUri?
+    prior = rx->parsedUri;
+    dest = httpCreateUri(route->target, 0);
+    scheme = dest->scheme ? dest->scheme : prior->scheme;
+    host = dest->host ? dest->host : prior->host;
+    port = dest->port ? dest->port : prior->port;
+    query = dest->query ? dest->query : prior->query;
+    reference = dest->reference ? dest->reference : prior->reference;
+    uri = httpFormatUri(scheme, host, port, target, reference, query, 0);
+    httpSetUri(conn, uri, 0);
+    return HTTP_ROUTE_REROUTE;
+}
 
-        case HTTP_STATE_PARSED:
-            conn->canProceed = processParsed(conn);
-            break;
 
-        case HTTP_STATE_CONTENT:
-            conn->canProceed = processContent(conn, packet);
-            break;
+static int runTarget(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+{
+    /*
+        Need to re-compute output string as updates may have run to define params which affect the route->target tokens
+     */
+    conn->rx->target = route->target ? expandTokens(conn, route->target) : sclone(&conn->rx->pathInfo[1]);
+    return HTTP_ROUTE_OK;
+}
 
-        case HTTP_STATE_READY:
-            conn->canProceed = processReady(conn);
-            break;
 
-        case HTTP_STATE_RUNNING:
-            conn->canProceed = processRunning(conn);
-            break;
+static int writeTarget(HttpConn *conn, HttpRoute *route, HttpRouteOp *op)
+{
+    char    *str;
 
-        case HTTP_STATE_COMPLETE:
-            conn->canProceed = processCompletion(conn);
-            break;
-        }
-        if (conn->connError || (conn->endpoint && conn->connectorComplete && conn->state >= HTTP_STATE_RUNNING)) {
-            httpSetState(conn, HTTP_STATE_COMPLETE);
-            continue;
-        }
-        packet = conn->input;
+    mprAssert(conn);
+    mprAssert(route);
+
+    /*
+        Need to re-compute output string as updates may have run to define params which affect the route->target tokens
+     */
+    str = route->target ? expandTokens(conn, route->target) : sclone(&conn->rx->pathInfo[1]);
+    if (!(route->flags & HTTP_ROUTE_RAW)) {
+        str = mprEscapeHtml(str);
     }
-    conn->inHttpProcess = 0;
+    httpSetStatus(conn, route->responseStatus);
+    httpFormatResponse(conn, "%s", str);
+    httpFinalize(conn);
+    return HTTP_ROUTE_OK;
 }
 
 
-/*  
-    Parse the incoming http message. Return true to keep going with this or subsequent request, zero means
-    insufficient data to proceed.
- */
-static bool parseIncoming(HttpConn *conn, HttpPacket *packet)
+/************************************************** Route Convenience ****************************************************/
+
+HttpRoute *httpDefineRoute(HttpRoute *parent, cchar *name, cchar *methods, cchar *pattern, cchar *target, cchar *source)
 {
-    HttpRx      *rx;
-    ssize       len;
-    char        *start, *end;
+    HttpRoute   *route;
 
-    if (packet == NULL) {
-        return 0;
-    }
-    if (mprShouldDenyNewRequests()) {
-        httpError(conn, HTTP_ABORT | HTTP_CODE_NOT_ACCEPTABLE, "Server terminating");
+    if ((route = httpCreateInheritedRoute(parent)) == 0) {
         return 0;
     }
-    if (!conn->rx) {
-        conn->rx = httpCreateRx(conn);
-        conn->tx = httpCreateTx(conn, NULL);
+    httpSetRouteName(route, name);
+    httpSetRoutePattern(route, pattern, 0);
+    if (methods) {
+        httpSetRouteMethods(route, methods);
     }
-    rx = conn->rx;
-    if ((len = httpGetPacketLength(packet)) == 0) {
-        return 0;
+    if (source) {
+        httpSetRouteSource(route, source);
     }
-    start = mprGetBufStart(packet->content);
+    httpSetRouteTarget(route, "run", target);
+    httpFinalizeRoute(route);
+    return route;
+}
 
-#if FUTURE
-    while (*start == '\r' || *start == '\n') {
-        mprGetCharFromBuf(packet->content);
-        start = mprGetBufStart(packet->content);
-    }
-#endif
 
-    /*
-        Don't start processing until all the headers have been received (delimited by two blank lines)
-        MOB - should be tolerant and allow '\n\n'
-     */
-    if ((end = sncontains(start, "\r\n\r\n", len)) == 0) {
-        if (len >= conn->limits->headerSize) {
-            httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_TOO_LARGE, 
-                "Header too big. Length %d vs limit %d", len, conn->limits->headerSize);
-        }
-        return 0;
-    }
-    len = end - start;
-    mprAddNullToBuf(packet->content);
+/*
+    Calculate a qualified route name. The form is: /{app}/{controller}/action
+ */
+static char *qualifyName(HttpRoute *route, cchar *controller, cchar *action)
+{
+    cchar   *prefix, *controllerPrefix;
 
-    if (len >= conn->limits->headerSize) {
-        httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_TOO_LARGE, 
-            "Header too big. Length %d vs limit %d", len, conn->limits->headerSize);
-        return 0;
+    prefix = route->prefix ? route->prefix : "";
+    if (action == 0 || *action == '\0') {
+        action = "default";
     }
-    if (conn->endpoint) {
-        /* This will set conn->error if it does not validate - keep going to generate a response */
-        if (!parseRequestLine(conn, packet)) {
-            return 0;
-        }
-    } else if (!parseResponseLine(conn, packet)) {
-        return 0;
-    }
-    if (!parseHeaders(conn, packet)) {
-        return 0;
-    }
-    if (conn->endpoint) {
-        httpMatchHost(conn);
-        if (httpSetUri(conn, rx->uri, "") < 0 || rx->pathInfo[0] != '/') {
-            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad URL format");
-        }
-        if (conn->secure) {
-            rx->parsedUri->scheme = sclone("https");
-        }
-        rx->parsedUri->port = conn->sock->listenSock->port;
-
-        //  MOB - refactor what conn->host is set to
-        rx->parsedUri->host = rx->hostHeader ? rx->hostHeader : conn->host->name;
-        if (!rx->parsedUri->host) {
-           rx->parsedUri->host = (conn->host->name[0] == '*') ? conn->sock->acceptIp : conn->host->name;
-        }
-
-    } else if (!(100 <= rx->status && rx->status <= 199)) {
-        /* 
-            Ignore Expect status responses. NOTE: Clients have already created their Tx pipeline.
-         */
-        httpCreateRxPipeline(conn, conn->http->clientRoute);
+    if (controller) {
+        controllerPrefix = (controller && smatch(controller, "{controller}")) ? "*" : controller;
+        return sjoin(prefix, "/", controllerPrefix, "/", action, NULL);
+    } else {
+        return sjoin(prefix, "/", action, NULL);
     }
-    httpSetState(conn, HTTP_STATE_PARSED);
-    return 1;
 }
 
 
-static void mapMethod(HttpConn *conn)
+/*
+    Add a restful route. The parent route may supply a route prefix. If defined, the route name will prepend the prefix.
+ */
+static void addRestful(HttpRoute *parent, cchar *action, cchar *methods, cchar *pattern, cchar *target, cchar *resource)
 {
-    HttpRx      *rx;
-    cchar       *method;
+    cchar   *name, *nameResource, *source;
 
-    rx = conn->rx;
-    if (rx->flags & HTTP_POST) {
-        if ((method = httpGetParam(conn, "-http-method-", 0)) != 0) {
-            if (!scaselessmatch(method, rx->method)) {
-                mprLog(3, "Change method from %s to %s for %s", rx->method, method, rx->uri);
-                httpSetMethod(conn, method);
-            }
-        }
+    nameResource = smatch(resource, "{controller}") ? "*" : resource;
+    if (parent->prefix) {
+        name = sfmt("%s/%s/%s", parent->prefix, nameResource, action);
+        pattern = sfmt("^%s/%s%s", parent->prefix, resource, pattern);
+    } else {
+        name = sfmt("/%s/%s", nameResource, action);
+        pattern = sfmt("^/%s%s", resource, pattern);
+    }
+    if (*resource == '{') {
+        target = sfmt("$%s-%s", resource, target);
+        source = sfmt("$%s.c", resource);
+    } else {
+        target = sfmt("%s-%s", resource, target);
+        source = sfmt("%s.c", resource);
     }
+    httpDefineRoute(parent, name, methods, pattern, target, source);
 }
 
 
-static void routeRequest(HttpConn *conn)
+/*
+    httpAddResourceGroup(parent, "{controller}")
+ */
+void httpAddResourceGroup(HttpRoute *parent, cchar *resource)
 {
-    HttpRx  *rx;
-
-    mprAssert(conn->endpoint);
-
-    rx = conn->rx;
-    httpAddParams(conn);
-    mapMethod(conn);
-    httpRouteRequest(conn);  
-    httpCreateRxPipeline(conn, rx->route);
-    httpCreateTxPipeline(conn, rx->route);
+    addRestful(parent, "list",      "GET",    "(/)*$",                   "list",          resource);
+    addRestful(parent, "init",      "GET",    "/init$",                  "init",          resource);
+    addRestful(parent, "create",    "POST",   "(/)*$",                   "create",        resource);
+    addRestful(parent, "edit",      "GET",    "/{id=[0-9]+}/edit$",      "edit",          resource);
+    addRestful(parent, "show",      "GET",    "/{id=[0-9]+}$",           "show",          resource);
+    addRestful(parent, "update",    "PUT",    "/{id=[0-9]+}$",           "update",        resource);
+    addRestful(parent, "destroy",   "DELETE", "/{id=[0-9]+}$",           "destroy",       resource);
+    //  MOB - rethink "custom" name - should action be after id? Should this be custom-${action}?
+    addRestful(parent, "custom",    "POST",   "/{action}/{id=[0-9]+}$",  "${action}",     resource);
+    addRestful(parent, "default",   "*",      "/{action}$",              "cmd-${action}", resource);
 }
 
 
 /*
-    Only called by parseRequestLine
+    httpAddResource(parent, "{controller}")
  */
-static void traceRequest(HttpConn *conn, HttpPacket *packet)
+void httpAddResource(HttpRoute *parent, cchar *resource)
 {
-    MprBuf  *content;
-    cchar   *endp, *ext, *cp;
-    int     len, level;
+    addRestful(parent, "init",      "GET",    "/init$",       "init",          resource);
+    addRestful(parent, "create",    "POST",   "(/)*$",        "create",        resource);
+    addRestful(parent, "edit",      "GET",    "/edit$",       "edit",          resource);
+    addRestful(parent, "show",      "GET",    "$",            "show",          resource);
+    addRestful(parent, "update",    "PUT",    "$",            "update",        resource);
+    addRestful(parent, "destroy",   "DELETE", "$",            "destroy",       resource);
+    addRestful(parent, "default",   "*",      "/{action}$",   "cmd-${action}", resource);
+}
 
-    content = packet->content;
-    ext = 0;
-    /*
-        Find the Uri extension:   "GET /path.ext HTTP/1.1"
-     */
-    if ((cp = schr(content->start, ' ')) != 0) {
-        if ((cp = schr(++cp, ' ')) != 0) {
-            for (ext = --cp; ext > content->start && *ext != '.'; ext--) ;
-            ext = (*ext == '.') ? snclone(&ext[1], cp - ext) : 0;
-            conn->tx->ext = ext;
-        }
-    }
-    /*
-        If tracing header, do entire header including first line
-     */
-    if ((conn->rx->traceLevel = httpShouldTrace(conn, HTTP_TRACE_RX, HTTP_TRACE_HEADER, ext)) >= 0) {
-        mprLog(4, "New request from %s:%d to %s:%d", conn->ip, conn->port, conn->sock->acceptIp, conn->sock->acceptPort);
-        endp = strstr((char*) content->start, "\r\n\r\n");
-        len = (endp) ? (int) (endp - mprGetBufStart(content) + 4) : 0;
-        httpTraceContent(conn, HTTP_TRACE_RX, HTTP_TRACE_HEADER, packet, len, 0);
 
-    } else if ((level = httpShouldTrace(conn, HTTP_TRACE_RX, HTTP_TRACE_FIRST, ext)) >= 0) {
-        endp = strstr((char*) content->start, "\r\n");
-        len = (endp) ? (int) (endp - mprGetBufStart(content) + 2) : 0;
-        if (len > 0) {
-            content->start[len - 2] = '\0';
-            mprLog(level, "%s", content->start);
-            content->start[len - 2] = '\r';
-        }
-    }
-    httpValidateLimits(conn->endpoint, HTTP_VALIDATE_OPEN_REQUEST, conn);
+void httpAddStaticRoute(HttpRoute *parent)
+{
+    cchar   *source, *name, *path, *pattern, *prefix;
+
+    prefix = parent->prefix ? parent->prefix : "";
+    source = parent->sourceName;
+    name = qualifyName(parent, NULL, "home");
+    path = stemplate("${STATIC_DIR}/index.esp", parent->vars);
+    pattern = sfmt("^%s%s", prefix, "(/)*$");
+    httpDefineRoute(parent, name, "GET,POST,PUT", pattern, path, source);
 }
 
 
-static void parseMethod(HttpConn *conn)
+void httpAddHomeRoute(HttpRoute *parent)
 {
-    HttpRx      *rx;
-    cchar       *method;
-    int         methodFlags;
-
-    rx = conn->rx;
-    method = rx->method;
-    methodFlags = 0;
+    cchar   *source, *name, *path, *pattern, *prefix;
 
-    switch (method[0]) {
-    case 'D':
-        if (strcmp(method, "DELETE") == 0) {
-            methodFlags = HTTP_DELETE;
-        }
-        break;
+    prefix = parent->prefix ? parent->prefix : "";
+    source = parent->sourceName;
 
-    case 'G':
-        if (strcmp(method, "GET") == 0) {
-            methodFlags = HTTP_GET;
-        }
-        break;
+    name = qualifyName(parent, NULL, "static");
+    path = stemplate("${STATIC_DIR}/$1", parent->vars);
+    pattern = sfmt("^%s%s", prefix, "/static/(.*)");
+    httpDefineRoute(parent, name, "GET", pattern, path, source);
+}
 
-    case 'H':
-        if (strcmp(method, "HEAD") == 0) {
-            methodFlags = HTTP_HEAD;
-        }
-        break;
 
-    case 'O':
-        if (strcmp(method, "OPTIONS") == 0) {
-            methodFlags = HTTP_OPTIONS;
-        }
-        break;
+void httpAddRouteSet(HttpRoute *parent, cchar *set)
+{
+    if (scaselessmatch(set, "simple")) {
+        httpAddHomeRoute(parent);
 
-    case 'P':
-        if (strcmp(method, "POST") == 0) {
-            methodFlags = HTTP_POST;
-            rx->needInputPipeline = 1;
+    } else if (scaselessmatch(set, "mvc")) {
+        httpAddHomeRoute(parent);
+        httpAddStaticRoute(parent);
+        httpDefineRoute(parent, "default", NULL, "^/{controller}(~/{action}~)", "${controller}-${action}", 
+            "${controller}.c");
 
-        } else if (strcmp(method, "PUT") == 0) {
-            methodFlags = HTTP_PUT;
-            rx->needInputPipeline = 1;
-        }
-        break;
+    } else if (scaselessmatch(set, "restful")) {
+        httpAddHomeRoute(parent);
+        httpAddStaticRoute(parent);
+        httpAddResourceGroup(parent, "{controller}");
 
-    case 'T':
-        if (strcmp(method, "TRACE") == 0) {
-            methodFlags = HTTP_TRACE;
-        }
-        break;
-    }
-    if (methodFlags == 0) {
-        methodFlags = HTTP_UNKNOWN;
+    } else if (!scaselessmatch(set, "none")) {
+        mprError("Unknown route set %s", set);
     }
-    rx->flags |= methodFlags;
 }
 
 
-/*  
-    Parse the first line of a http request. Return true if the first line parsed. This is only called once all the headers
-    have been read and buffered. Requests look like: METHOD URL HTTP/1.X.
+/*************************************************** Support Routines ****************************************************/
+/*
+    Route operations are used per-route for headers and fields
  */
-static bool parseRequestLine(HttpConn *conn, HttpPacket *packet)
+static HttpRouteOp *createRouteOp(cchar *name, int flags)
 {
-    HttpRx      *rx;
-    char        *uri, *protocol;
-    ssize       len;
-
-    rx = conn->rx;
-#if BIT_DEBUG
-    conn->startTime = conn->http->now;
-    conn->startTicks = mprGetTicks();
-#endif
-    traceRequest(conn, packet);
+    HttpRouteOp   *op;
 
-    rx->originalMethod = rx->method = supper(getToken(conn, 0));
-    parseMethod(conn);
+    mprAssert(name && *name);
 
-    uri = getToken(conn, 0);
-    len = slen(uri);
-    if (*uri == '\0') {
-        httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad HTTP request. Empty URI");
-        return 0;
-    } else if (len >= conn->limits->uriSize) {
-        httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_URL_TOO_LARGE, 
-            "Bad request. URI too long. Length %d vs limit %d", len, conn->limits->uriSize);
-        return 0;
-    }
-    protocol = conn->protocol = supper(getToken(conn, "\r\n"));
-    if (strcmp(protocol, "HTTP/1.0") == 0) {
-        if (rx->flags & (HTTP_POST|HTTP_PUT)) {
-            rx->remainingContent = MAXINT;
-            rx->needInputPipeline = 1;
-        }
-        conn->http10 = 1;
-        conn->protocol = protocol;
-    } else if (strcmp(protocol, "HTTP/1.1") == 0) {
-        conn->protocol = protocol;
-    } else {
-        conn->protocol = sclone("HTTP/1.1");
-        httpError(conn, HTTP_ABORT | HTTP_CODE_NOT_ACCEPTABLE, "Unsupported HTTP protocol");
+    if ((op = mprAllocObj(HttpRouteOp, manageRouteOp)) == 0) {
         return 0;
     }
-    rx->originalUri = rx->uri = sclone(uri);
-    httpSetState(conn, HTTP_STATE_FIRST);
-    return 1;
+    op->name = sclone(name);
+    op->flags = flags;
+    return op;
 }
 
 
-/*  
-    Parse the first line of a http response. Return true if the first line parsed. This is only called once all the headers
-    have been read and buffered. Response status lines look like: HTTP/1.X CODE Message
- */
-static bool parseResponseLine(HttpConn *conn, HttpPacket *packet)
+static void manageRouteOp(HttpRouteOp *op, int flags)
 {
-    HttpRx      *rx;
-    HttpTx      *tx;
-    MprBuf      *content;
-    cchar       *endp;
-    char        *protocol, *status;
-    ssize       len;
-    int         level, traced;
-
-    rx = conn->rx;
-    tx = conn->tx;
-    traced = 0;
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(op->name);
+        mprMark(op->details);
+        mprMark(op->var);
+        mprMark(op->value);
 
-    if (httpShouldTrace(conn, HTTP_TRACE_RX, HTTP_TRACE_HEADER, tx->ext) >= 0) {
-        content = packet->content;
-        endp = strstr((char*) content->start, "\r\n\r\n");
-        len = (endp) ? (int) (endp - mprGetBufStart(content) + 4) : 0;
-        httpTraceContent(conn, HTTP_TRACE_RX, HTTP_TRACE_HEADER, packet, len, 0);
-        traced = 1;
-    }
-    protocol = conn->protocol = supper(getToken(conn, 0));
-    if (strcmp(protocol, "HTTP/1.0") == 0) {
-        conn->http10 = 1;
-        if (!scaselessmatch(tx->method, "HEAD")) {
-            rx->remainingContent = MAXINT;
+    } else if (flags & MPR_MANAGE_FREE) {
+        if (op->flags & HTTP_ROUTE_FREE) {
+            free(op->mdata);
+            op->mdata = 0;
         }
-    } else if (strcmp(protocol, "HTTP/1.1") != 0) {
-        httpError(conn, HTTP_ABORT | HTTP_CODE_NOT_ACCEPTABLE, "Unsupported HTTP protocol");
-        return 0;
     }
-    status = getToken(conn, 0);
-    if (*status == '\0') {
-        httpError(conn, HTTP_ABORT | HTTP_CODE_NOT_ACCEPTABLE, "Bad response status code");
+}
+
+
+static bool opPresent(MprList *list, HttpRouteOp *op)
+{
+    HttpRouteOp   *last;
+
+    if ((last = mprGetLastItem(list)) == 0) {
         return 0;
     }
-    rx->status = atoi(status);
-    rx->statusMessage = sclone(getToken(conn, "\r\n"));
+    if (smatch(last->name, op->name) && 
+        smatch(last->details, op->details) && 
+        smatch(last->var, op->var) && 
+        smatch(last->value, op->value) && 
+        last->mdata == op->mdata && 
+        last->flags == op->flags) {
+        return 1;
+    }
+    return 0;
+}
 
-    len = slen(rx->statusMessage);
-    if (len >= conn->limits->uriSize) {
-        httpError(conn, HTTP_CLOSE | HTTP_CODE_REQUEST_URL_TOO_LARGE, 
-            "Bad response. Status message too long. Length %d vs limit %d", len, conn->limits->uriSize);
+
+static void addUniqueItem(MprList *list, HttpRouteOp *op)
+{
+    mprAssert(list);
+    mprAssert(op);
+
+    if (!opPresent(list, op)) {
+        mprAddItem(list, op);
+    }
+}
+
+
+static HttpLang *createLangDef(cchar *path, cchar *suffix, int flags)
+{
+    HttpLang    *lang;
+
+    if ((lang = mprAllocObj(HttpLang, manageLang)) == 0) {
         return 0;
     }
-    if (!traced && (level = httpShouldTrace(conn, HTTP_TRACE_RX, HTTP_TRACE_FIRST, tx->ext)) >= 0) {
-        mprLog(level, "%s %d %s", protocol, rx->status, rx->statusMessage);
+    if (path) {
+        lang->path = sclone(path);
     }
-    return 1;
+    if (suffix) {
+        lang->suffix = sclone(suffix);
+    }
+    lang->flags = flags;
+    return lang;
 }
 
 
-/*  
-    Parse the request headers. Return true if the header parsed.
+static void manageLang(HttpLang *lang, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(lang->path);
+        mprMark(lang->suffix);
+    }
+}
+
+
+static void definePathVars(HttpRoute *route)
+{
+    mprAssert(route);
+
+    mprAddKey(route->vars, "PRODUCT", sclone(BIT_PRODUCT));
+    mprAddKey(route->vars, "OS", sclone(BIT_OS));
+    mprAddKey(route->vars, "VERSION", sclone(BIT_VERSION));
+    mprAddKey(route->vars, "LIBDIR", mprGetAppDir());
+    if (route->host) {
+        defineHostVars(route);
+    }
+}
+
+
+static void defineHostVars(HttpRoute *route) 
+{
+    mprAssert(route);
+    mprAddKey(route->vars, "DOCUMENT_ROOT", route->dir);
+    mprAddKey(route->vars, "SERVER_ROOT", route->host->home);
+    mprAddKey(route->vars, "SERVER_NAME", route->host->name);
+    mprAddKey(route->vars, "SERVER_PORT", itos(route->host->port));
+}
+
+
+static char *expandTokens(HttpConn *conn, cchar *str)
+{
+    HttpRx      *rx;
+
+    mprAssert(conn);
+    mprAssert(str);
+
+    rx = conn->rx;
+    return expandRequestTokens(conn, expandPatternTokens(rx->pathInfo, str, rx->matches, rx->matchCount));
+}
+
+
+/*
+    WARNING: str is modified. Result is allocated string.
  */
-static bool parseHeaders(HttpConn *conn, HttpPacket *packet)
+static char *expandRequestTokens(HttpConn *conn, char *str)
 {
     HttpRx      *rx;
     HttpTx      *tx;
-    HttpLimits  *limits;
-    MprBuf      *content;
-    char        *cp, *key, *value, *tok, *hvalue;
-    cchar       *oldValue;
-    int         count, keepAlive;
+    HttpRoute   *route;
+    MprBuf      *buf;
+    HttpLang    *lang;
+    char        *tok, *cp, *key, *value, *field, *header, *defaultValue;
+
+    mprAssert(conn);
+    mprAssert(str);
 
     rx = conn->rx;
+    route = rx->route;
     tx = conn->tx;
-    content = packet->content;
-    conn->rx->headerPacket = packet;
-    limits = conn->limits;
-    keepAlive = (conn->http10) ? 0 : 1;
+    buf = mprCreateBuf(-1, -1);
+    tok = 0;
 
-    for (count = 0; content->start[0] != '\r' && !conn->error; count++) {
-        if (count >= limits->headerMax) {
-            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Too many headers");
-            return 0;
-        }
-        if ((key = getToken(conn, ":")) == 0 || *key == '\0') {
-            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad header format");
-            return 0;
-        }
-        //  MOB - should be tolerant and allow '\n'
-        value = getToken(conn, "\r\n");
-        while (isspace((uchar) *value)) {
-            value++;
+    for (cp = str; cp && *cp; ) {
+        if ((tok = strstr(cp, "${")) == 0) {
+            break;
         }
-        LOG(8, "Key %s, value %s", key, value);
-        if (strspn(key, "%<>/\\") > 0) {
-            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad header key value");
-            return 0;
+        if (tok > cp) {
+            mprPutBlockToBuf(buf, cp, tok - cp);
         }
-        if ((oldValue = mprLookupKey(rx->headers, key)) != 0) {
-            hvalue = sfmt("%s, %s", oldValue, value);
-        } else {
-            hvalue = sclone(value);
+        if ((key = stok(&tok[2], ":", &value)) == 0) {
+            continue;
         }
-        mprAddKey(rx->headers, key, hvalue);
+        stok(value, "}", &cp);
 
-        switch (tolower((uchar) key[0])) {
-        case 'a':
-            if (strcasecmp(key, "authorization") == 0) {
-                value = sclone(value);
-                conn->authType = slower(stok(value, " \t", &tok));
-                rx->authDetails = sclone(tok);
+        if (smatch(key, "header")) {
+            header = stok(value, "=", &defaultValue);
+            if ((value = (char*) httpGetHeader(conn, header)) == 0) {
+                value = defaultValue ? defaultValue : "";
+            }
+            mprPutStringToBuf(buf, value);
 
-            } else if (strcasecmp(key, "accept-charset") == 0) {
-                rx->acceptCharset = sclone(value);
+        } else if (smatch(key, "param")) {
+            field = stok(value, "=", &defaultValue);
+            if (defaultValue == 0) {
+                defaultValue = "";
+            }
+            mprPutStringToBuf(buf, httpGetParam(conn, field, defaultValue));
 
-            } else if (strcasecmp(key, "accept") == 0) {
-                rx->accept = sclone(value);
+        } else if (smatch(key, "request")) {
+            value = stok(value, "=", &defaultValue);
+            //  OPT with switch on first char
+            if (smatch(value, "clientAddress")) {
+                mprPutStringToBuf(buf, conn->ip);
 
-            } else if (strcasecmp(key, "accept-encoding") == 0) {
-                rx->acceptEncoding = sclone(value);
+            } else if (smatch(value, "clientPort")) {
+                mprPutIntToBuf(buf, conn->port);
 
-            } else if (strcasecmp(key, "accept-language") == 0) {
-                rx->acceptLanguage = sclone(value);
-            }
-            break;
+            } else if (smatch(value, "error")) {
+                mprPutStringToBuf(buf, conn->errorMsg);
 
-        case 'c':
-            if (strcasecmp(key, "connection") == 0) {
-                rx->connection = sclone(value);
-                if (scaselesscmp(value, "KEEP-ALIVE") == 0) {
-                    keepAlive = 1;
-                } else if (scaselesscmp(value, "CLOSE") == 0) {
-                    /*  Not really required, but set to 0 to be sure */
-                    conn->keepAliveCount = 0;
-#if WSS
-                } else if (scaselesscmp(value, "upgrade") == 0) {
-#endif
-                }
+            } else if (smatch(value, "ext")) {
+                mprPutStringToBuf(buf, rx->parsedUri->ext);
 
-            } else if (strcasecmp(key, "content-length") == 0) {
-                if (rx->length >= 0) {
-                    httpError(conn, HTTP_CLOSE | HTTP_CODE_BAD_REQUEST, "Mulitple content length headers");
-                    break;
+            } else if (smatch(value, "extraPath")) {
+                mprPutStringToBuf(buf, rx->extraPath);
+
+            } else if (smatch(value, "filename")) {
+                mprPutStringToBuf(buf, tx->filename);
+
+            } else if (scaselessmatch(value, "language")) {
+                if (!defaultValue) {
+                    defaultValue = route->defaultLanguage;
                 }
-                rx->length = stoi(value);
-                if (rx->length < 0) {
-                    httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad content length");
-                    return 0;
-                }
-                if (rx->length >= conn->limits->receiveBodySize) {
-                    httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_TOO_LARGE,
-                        "Request content length %,Ld bytes is too big. Limit %,Ld", 
-                        rx->length, conn->limits->receiveBodySize);
-                    return 0;
+                if ((lang = httpGetLanguage(conn, route->languages, defaultValue)) != 0) {
+                    mprPutStringToBuf(buf, lang->suffix);
+                } else {
+                    mprPutStringToBuf(buf, defaultValue);
                 }
-                rx->contentLength = sclone(value);
-                mprAssert(rx->length >= 0);
-                if (conn->endpoint || !scaselessmatch(tx->method, "HEAD")) {
-                    rx->remainingContent = rx->length;
-                    rx->needInputPipeline = 1;
+
+            } else if (scaselessmatch(value, "languageDir")) {
+                lang = httpGetLanguage(conn, route->languages, 0);
+                if (!defaultValue) {
+                    defaultValue = ".";
                 }
+                mprPutStringToBuf(buf, lang ? lang->path : defaultValue);
 
-            } else if (strcasecmp(key, "content-range") == 0) {
-                /*
-                    This headers specifies the range of any posted body data
-                    Format is:  Content-Range: bytes n1-n2/length
-                    Where n1 is first byte pos and n2 is last byte pos
-                 */
-                char    *sp;
-                MprOff  start, end, size;
+            } else if (smatch(value, "host")) {
+                /* Includes port if present */
+                mprPutStringToBuf(buf, rx->parsedUri->host);
 
-                start = end = size = -1;
-                sp = value;
-                while (*sp && !isdigit((uchar) *sp)) {
-                    sp++;
-                }
-                if (*sp) {
-                    start = stoi(sp);
-                    if ((sp = strchr(sp, '-')) != 0) {
-                        end = stoi(++sp);
-                    }
-                    if ((sp = strchr(sp, '/')) != 0) {
-                        /*
-                            Note this is not the content length transmitted, but the original size of the input of which
-                            the client is transmitting only a portion.
-                         */
-                        size = stoi(++sp);
-                    }
-                }
-                if (start < 0 || end < 0 || size < 0 || end <= start) {
-                    httpError(conn, HTTP_CLOSE | HTTP_CODE_RANGE_NOT_SATISFIABLE, "Bad content range");
-                    break;
-                }
-                rx->inputRange = httpCreateRange(conn, start, end);
+            } else if (smatch(value, "method")) {
+                mprPutStringToBuf(buf, rx->method);
 
-            } else if (strcasecmp(key, "content-type") == 0) {
-                rx->mimeType = sclone(value);
-                if (rx->flags & (HTTP_POST | HTTP_PUT)) {
-                    rx->form = scontains(rx->mimeType, "application/x-www-form-urlencoded") != 0;
-                    rx->upload = scontains(rx->mimeType, "multipart/form-data") != 0;
-                } else { 
-                    rx->form = rx->upload = 0;
-                }
+            } else if (smatch(value, "originalUri")) {
+                mprPutStringToBuf(buf, rx->originalUri);
 
-            } else if (strcasecmp(key, "cookie") == 0) {
-                if (rx->cookie && *rx->cookie) {
-                    rx->cookie = sjoin(rx->cookie, "; ", value, NULL);
-                } else {
-                    rx->cookie = sclone(value);
-                }
-            }
-            break;
+            } else if (smatch(value, "pathInfo")) {
+                mprPutStringToBuf(buf, rx->pathInfo);
 
-        case 'e':
-            if (strcasecmp(key, "expect") == 0) {
-                /*
-                    Handle 100-continue for HTTP/1.1 clients only. This is the only expectation that is currently supported.
-                 */
-                if (!conn->http10) {
-                    if (strcasecmp(value, "100-continue") != 0) {
-                        httpError(conn, HTTP_CODE_EXPECTATION_FAILED, "Expect header value \"%s\" is unsupported", value);
-                    } else {
-                        rx->flags |= HTTP_EXPECT_CONTINUE;
-                    }
-                }
-            }
-            break;
+            } else if (smatch(value, "prefix")) {
+                mprPutStringToBuf(buf, route->prefix);
 
-        case 'h':
-            if (strcasecmp(key, "host") == 0) {
-                rx->hostHeader = sclone(value);
-            }
-            break;
+            } else if (smatch(value, "query")) {
+                mprPutStringToBuf(buf, rx->parsedUri->query);
 
-        case 'i':
-            if ((strcasecmp(key, "if-modified-since") == 0) || (strcasecmp(key, "if-unmodified-since") == 0)) {
-                MprTime     newDate = 0;
-                char        *cp;
-                bool        ifModified = (tolower((uchar) key[3]) == 'm');
+            } else if (smatch(value, "reference")) {
+                mprPutStringToBuf(buf, rx->parsedUri->reference);
 
-                if ((cp = strchr(value, ';')) != 0) {
-                    *cp = '\0';
-                }
-                if (mprParseTime(&newDate, value, MPR_UTC_TIMEZONE, NULL) < 0) {
-                    mprAssert(0);
-                    break;
-                }
-                if (newDate) {
-                    rx->since = newDate;
-                    rx->ifModified = ifModified;
-                    rx->flags |= HTTP_IF_MODIFIED;
+            } else if (smatch(value, "scheme")) {
+                if (rx->parsedUri->scheme) {
+                    mprPutStringToBuf(buf, rx->parsedUri->scheme);
+                }  else {
+                    mprPutStringToBuf(buf, (conn->secure) ? "https" : "http");
                 }
 
-            } else if ((strcasecmp(key, "if-match") == 0) || (strcasecmp(key, "if-none-match") == 0)) {
-                char    *word, *tok;
-                bool    ifMatch = (tolower((uchar) key[3]) == 'm');
+            } else if (smatch(value, "scriptName")) {
+                mprPutStringToBuf(buf, rx->scriptName);
 
-                if ((tok = strchr(value, ';')) != 0) {
-                    *tok = '\0';
-                }
-                rx->ifMatch = ifMatch;
-                rx->flags |= HTTP_IF_MODIFIED;
-                value = sclone(value);
-                word = stok(value, " ,", &tok);
-                while (word) {
-                    addMatchEtag(conn, word);
-                    word = stok(0, " ,", &tok);
-                }
+            } else if (smatch(value, "serverAddress")) {
+                /* Pure IP address, no port. See "serverPort" */
+                mprPutStringToBuf(buf, conn->sock->acceptIp);
 
-            } else if (strcasecmp(key, "if-range") == 0) {
-                char    *word, *tok;
+            } else if (smatch(value, "serverPort")) {
+                mprPutIntToBuf(buf, conn->sock->acceptPort);
 
-                if ((tok = strchr(value, ';')) != 0) {
-                    *tok = '\0';
-                }
-                rx->ifMatch = 1;
-                rx->flags |= HTTP_IF_MODIFIED;
-                value = sclone(value);
-                word = stok(value, " ,", &tok);
-                while (word) {
-                    addMatchEtag(conn, word);
-                    word = stok(0, " ,", &tok);
-                }
+            } else if (smatch(value, "uri")) {
+                mprPutStringToBuf(buf, rx->uri);
             }
-            break;
+        }
+    }
+    if (tok) {
+        if (tok > cp) {
+            mprPutBlockToBuf(buf, tok, tok - cp);
+        }
+    } else {
+        mprPutStringToBuf(buf, cp);
+    }
+    mprAddNullToBuf(buf);
+    return sclone(mprGetBufStart(buf));
+}
 
-        case 'k':
-            /* Keep-Alive: timeout=N, max=1 */
-            if (strcasecmp(key, "keep-alive") == 0) {
-                keepAlive = 1;
-                if ((tok = scontains(value, "max=")) != 0) {
-                    conn->keepAliveCount = atoi(&tok[4]);
-                    /*  
-                        IMPORTANT: Deliberately close the connection one request early. This ensures a client-led 
-                        termination and helps relieve server-side TIME_WAIT conditions.
-                     */
-                    if (conn->keepAliveCount == 1) {
-                        conn->keepAliveCount = 0;
-                    }
-                }
-            }
-            break;                
-                
-        case 'l':
-            if (strcasecmp(key, "location") == 0) {
-                rx->redirect = sclone(value);
-            }
-            break;
 
-#if WSS
-        case 'o':
-            if (strcasecmp(key, "origin") == 0) {
-                rx->origin = sclone(value);
-            }
-            break;
-#endif
+char *httpExpandRouteVars(HttpConn *conn, cchar *str)
+{
+    return expandRequestTokens(conn, stemplate(str, conn->rx->route->vars));
+}
 
-        case 'p':
-            if (strcasecmp(key, "pragma") == 0) {
-                rx->pragma = sclone(value);
-            }
-            break;
 
-        case 'r':
-            if (strcasecmp(key, "range") == 0) {
-                if (!parseRange(conn, value)) {
-                    httpError(conn, HTTP_CLOSE | HTTP_CODE_RANGE_NOT_SATISFIABLE, "Bad range");
-                }
-            } else if (strcasecmp(key, "referer") == 0) {
-                /* NOTE: yes the header is misspelt in the spec */
-                rx->referrer = sclone(value);
-            }
-            break;
+/*
+    Replace text using pcre regular expression match indicies
+ */
+static char *expandPatternTokens(cchar *str, cchar *replacement, int *matches, int matchCount)
+{
+    MprBuf  *result;
+    cchar   *end, *cp, *lastReplace;
+    int     submatch;
 
-#if WSS
-        case 's':
-            if (strcasecmp(key, "sec-websocket-key") == 0) {
-                rx->sockKey = sclone(value);
-            } else if (strcasecmp(key, "sec-websocket-protocol") == 0) {
-                rx->sockProtocol = sclone(value);
-            } else if (strcasecmp(key, "sec-websocket-version") == 0) {
-                rx->sockVersion = sclone(value);
+    mprAssert(str);
+    mprAssert(replacement);
+    mprAssert(matches);
+
+    if (matchCount <= 0) {
+        return MPR->emptyString;
+    }
+    result = mprCreateBuf(-1, -1);
+    lastReplace = replacement;
+    end = &replacement[slen(replacement)];
+
+    for (cp = replacement; cp < end; ) {
+        if (*cp == '$') {
+            if (lastReplace < cp) {
+                mprPutSubStringToBuf(result, lastReplace, (int) (cp - lastReplace));
             }
-            break;
-#endif
-        case 't':
-            if (strcasecmp(key, "transfer-encoding") == 0) {
-                if (scaselesscmp(value, "chunked") == 0) {
-                    /*  
-                        remainingContent will be revised by the chunk filter as chunks are processed and will 
-                        be set to zero when the last chunk has been received.
-                     */
-                    rx->flags |= HTTP_CHUNKED;
-                    rx->chunkState = HTTP_CHUNK_START;
-                    rx->remainingContent = MAXINT;
-                    rx->needInputPipeline = 1;
+            switch (*++cp) {
+            case '$':
+                mprPutCharToBuf(result, '$');
+                break;
+            case '&':
+                /* Replace the matched string */
+                mprPutSubStringToBuf(result, &str[matches[0]], matches[1] - matches[0]);
+                break;
+            case '`':
+                /* Insert the portion that preceeds the matched string */
+                mprPutSubStringToBuf(result, str, matches[0]);
+                break;
+            case '\'':
+                /* Insert the portion that follows the matched string */
+                mprPutSubStringToBuf(result, &str[matches[1]], slen(str) - matches[1]);
+                break;
+            default:
+                /* Insert the nth submatch */
+                if (isdigit((uchar) *cp)) {
+                    submatch = (int) wtoi(cp);
+                    while (isdigit((uchar) *++cp))
+                        ;
+                    cp--;
+                    if (submatch < matchCount) {
+                        submatch *= 2;
+                        mprPutSubStringToBuf(result, &str[matches[submatch]], matches[submatch + 1] - matches[submatch]);
+                    }
+                } else {
+                    mprError("Bad replacement $ specification in page");
+                    return 0;
                 }
             }
-            break;
+            lastReplace = cp + 1;
+        }
+        cp++;
+    }
+    if (lastReplace < cp && lastReplace < end) {
+        mprPutSubStringToBuf(result, lastReplace, (int) (cp - lastReplace));
+    }
+    mprAddNullToBuf(result);
+    return sclone(mprGetBufStart(result));
+}
 
-        case 'x':
-            if (strcasecmp(key, "x-http-method-override") == 0) {
-                httpSetMethod(conn, value);
-#if BIT_DEBUG
-            } else if (strcasecmp(key, "x-chunk-size") == 0) {
-                tx->chunkSize = atoi(value);
-                if (tx->chunkSize <= 0) {
-                    tx->chunkSize = 0;
-                } else if (tx->chunkSize > conn->limits->chunkSize) {
-                    tx->chunkSize = conn->limits->chunkSize;
+
+void httpDefineRouteBuiltins()
+{
+    /*
+        These are the conditions that can be selected. Use httpAddRouteCondition to add to a route.
+        The allow and auth conditions are internal and are configured via various Auth APIs.
+     */
+    httpDefineRouteCondition("allowDeny", allowDenyCondition);
+    httpDefineRouteCondition("auth", authCondition);
+    httpDefineRouteCondition("match", matchCondition);
+    httpDefineRouteCondition("exists", existsCondition);
+    httpDefineRouteCondition("directory", directoryCondition);
+
+    httpDefineRouteUpdate("param", paramUpdate);
+    httpDefineRouteUpdate("cmd", cmdUpdate);
+    httpDefineRouteUpdate("lang", langUpdate);
+
+    httpDefineRouteTarget("close", closeTarget);
+    httpDefineRouteTarget("redirect", redirectTarget);
+    httpDefineRouteTarget("run", runTarget);
+    httpDefineRouteTarget("write", writeTarget);
+}
+
+
+/*
+    Tokenizes a line using %formats. Mandatory tokens can be specified with %. Optional tokens are specified with ?. 
+    Supported tokens:
+        %B - Boolean. Parses: on/off, true/false, yes/no.
+        %N - Number. Parses numbers in base 10.
+        %S - String. Removes quotes.
+        %T - Template String. Removes quotes and expand ${PathVars}.
+        %P - Path string. Removes quotes and expands ${PathVars}. Resolved relative to host->dir (ServerRoot).
+        %W - Parse words into a list
+        %! - Optional negate. Set value to HTTP_ROUTE_NOT present, otherwise zero.
+    Values wrapped in quotes will have the outermost quotes trimmed.
+ */
+bool httpTokenize(HttpRoute *route, cchar *line, cchar *fmt, ...)
+{
+    va_list     args;
+    bool        rc;
+
+    mprAssert(route);
+    mprAssert(line);
+    mprAssert(fmt);
+
+    va_start(args, fmt);
+    rc =  httpTokenizev(route, line, fmt, args);
+    va_end(args);
+    return rc;
+}
+
+
+bool httpTokenizev(HttpRoute *route, cchar *line, cchar *fmt, va_list args)
+{
+    MprList     *list;
+    cchar       *f;
+    char        *tok, *etok, *value, *word, *end;
+    int         quote;
+
+    mprAssert(route);
+    mprAssert(fmt);
+
+    if (line == 0) {
+        line = "";
+    }
+    tok = sclone(line);
+    end = &tok[slen(line)];
+
+    for (f = fmt; *f && tok < end; f++) {
+        for (; isspace((uchar) *tok); tok++) ;
+        if (*tok == '\0' || *tok == '#') {
+            break;
+        }
+        if (isspace((uchar) *f)) {
+            continue;
+        }
+        if (*f == '%' || *f == '?') {
+            f++;
+            quote = 0;
+            if (*f != '*' && (*tok == '"' || *tok == '\'')) {
+                quote = *tok++;
+            }
+            if (*f == '!') {
+                etok = &tok[1];
+            } else {
+                if (quote) {
+                    for (etok = tok; *etok && !(*etok == quote && etok[-1] != '\\'); etok++) ; 
+                    *etok++ = '\0';
+                } else if (*f == '*') {
+                    for (etok = tok; *etok; etok++) {
+                        if (*etok == '#') {
+                            *etok = '\0';
+                        }
+                    }
+                } else {
+                    for (etok = tok; *etok && !isspace((uchar) *etok); etok++) ;
                 }
-#endif
+                *etok++ = '\0';
             }
-            break;
-
-        case 'u':
-#if WSS
-            if (scaselesscmp(key, "upgrade") == 0) {
-                rx->upgrade = sclone(value);
-            } else
-#endif
-            if (strcasecmp(key, "user-agent") == 0) {
-                rx->userAgent = sclone(value);
+            if (*f == '*') {
+                f++;
+                tok = trimQuotes(tok);
+                * va_arg(args, char**) = tok;
+                tok = etok;
+                break;
             }
-            break;
 
-        case 'w':
-            if (strcasecmp(key, "www-authenticate") == 0) {
-                cp = value;
-                while (*value && !isspace((uchar) *value)) {
-                    value++;
+            switch (*f) {
+            case '!':
+                if (*tok == '!') {
+                    *va_arg(args, int*) = HTTP_ROUTE_NOT;
+                } else {
+                    *va_arg(args, int*) = 0;
+                    continue;
                 }
-                *value++ = '\0';
-                conn->authType = slower(cp);
-                rx->authDetails = sclone(value);
+                break;
+            case 'B':
+                if (scaselesscmp(tok, "on") == 0 || scaselesscmp(tok, "true") == 0 || scaselesscmp(tok, "yes") == 0) {
+                    *va_arg(args, bool*) = 1;
+                } else {
+                    *va_arg(args, bool*) = 0;
+                }
+                break;
+            case 'N':
+                *va_arg(args, int*) = (int) stoi(tok);
+                break;
+            case 'P':
+                *va_arg(args, char**) = httpMakePath(route, strim(tok, "\"", MPR_TRIM_BOTH));
+                break;
+            case 'S':
+                *va_arg(args, char**) = strim(tok, "\"", MPR_TRIM_BOTH);
+                break;
+            case 'T':
+                value = strim(tok, "\"", MPR_TRIM_BOTH);
+                *va_arg(args, char**) = stemplate(value, route->vars);
+                break;
+            case 'W':
+                list = va_arg(args, MprList*);
+                word = stok(tok, " \t\r\n", &tok);
+                while (word) {
+                    mprAddItem(list, word);
+                    word = stok(0, " \t\r\n", &tok);
+                }
+                break;
+            default:
+                mprError("Unknown token pattern %%\"%c\"", *f);
+                break;
             }
-            break;
+            tok = etok;
         }
     }
-    /*
-        Don't stream input if a form or upload. NOTE: Upload needs the Files[] collection.
-     */
-    rx->streamInput = !(rx->form || rx->upload);
-    rx->eof = (rx->remainingContent == 0);
-    if (!keepAlive) {
-        conn->keepAliveCount = 0;
+    if (tok < end) {
+        /*
+            Extra unparsed text
+         */
+        for (; tok < end && isspace((uchar) *tok); tok++) ;
+        if (*tok && *tok != '#') {
+            mprError("Extra unparsed text: \"%s\"", tok);
+            return 0;
+        }
     }
-    if (!(rx->flags & HTTP_CHUNKED)) {
-        /*  
-            Step over "\r\n" after headers. 
-            Don't do this if chunked so chunking can parse a single chunk delimiter of "\r\nSIZE ...\r\n"
+    if (*f) {
+        /*
+            Extra unparsed format tokens
          */
-        if (httpGetPacketLength(packet) >= 2) {
-            mprAdjustBufStart(content, 2);
+        for (; *f; f++) {
+            if (*f == '%') {
+                break;
+            } else if (*f == '?') {
+                switch (*++f) {
+                case '!':
+                case 'N':
+                    *va_arg(args, int*) = 0;
+                    break;
+                case 'B':
+                    *va_arg(args, bool*) = 0;
+                    break;
+                case 'D':
+                case 'P':
+                case 'S':
+                case 'T':
+                case '*':
+                    *va_arg(args, char**) = 0;
+                    break;
+                case 'W':
+                    break;
+                default:
+                    mprError("Unknown token pattern %%\"%c\"", *f);
+                    break;
+                }
+            }
+        }
+        if (*f) {
+            mprError("Missing directive parameters");
+            return 0;
+        }
+    }
+    va_end(args);
+    return 1;
+}
+
+
+static char *trimQuotes(char *str)
+{
+    ssize   len;
+
+    mprAssert(str);
+    len = slen(str);
+    if (*str == '\"' && str[len - 1] == '\"' && len > 2 && str[1] != '\"') {
+        return snclone(&str[1], len - 2);
+    }
+    return sclone(str);
+}
+
+
+MprHash *httpGetOptions(cchar *options)
+{
+    if (options == 0) {
+        return mprCreateHash(-1, 0);
+    }
+    if (*options == '@') {
+        /* Allow embedded URIs as options */
+        options = sfmt("{ data-click: '%s'}", options);
+    }
+    mprAssert(*options == '{');
+    if (*options != '{') {
+        options = sfmt("{%s}", options);
+    }
+    return mprDeserialize(options);
+}
+
+
+void *httpGetOption(MprHash *options, cchar *field, cchar *defaultValue)
+{
+    MprKey      *kp;
+    cchar       *value;
+
+    if (options == 0) {
+        value = defaultValue;
+    } else if ((kp = mprLookupKeyEntry(options, field)) == 0) {
+        value = defaultValue;
+    } else {
+        value = kp->data;
+    }
+    return (void*) value;
+}
+
+
+MprHash *httpGetOptionHash(MprHash *options, cchar *field)
+{
+    MprKey      *kp;
+
+    if (options == 0) {
+        return 0;
+    }
+    if ((kp = mprLookupKeyEntry(options, field)) == 0) {
+        return 0;
+    }
+    if (kp->type != MPR_JSON_ARRAY && kp->type != MPR_JSON_OBJ) {
+        return 0;
+    }
+    return (MprHash*) kp->data;
+}
+
+
+/* 
+    Prepend an option
+ */
+void httpInsertOption(MprHash *options, cchar *field, cchar *value)
+{
+    MprKey      *kp;
+
+    if (options == 0) {
+        mprAssert(options);
+        return;
+    }
+    if ((kp = mprLookupKeyEntry(options, field)) != 0) {
+        kp = mprAddKey(options, field, sjoin(value, " ", kp->data, NULL));
+    } else {
+        kp = mprAddKey(options, field, value);
+    }
+    kp->type = MPR_JSON_STRING;
+}
+
+
+void httpAddOption(MprHash *options, cchar *field, cchar *value)
+{
+    MprKey      *kp;
+
+    if (options == 0) {
+        mprAssert(options);
+        return;
+    }
+    if ((kp = mprLookupKeyEntry(options, field)) != 0) {
+        kp = mprAddKey(options, field, sjoin(kp->data, " ", value, NULL));
+    } else {
+        kp = mprAddKey(options, field, value);
+    }
+    kp->type = MPR_JSON_STRING;
+}
+
+
+void httpRemoveOption(MprHash *options, cchar *field)
+{
+    if (options == 0) {
+        mprAssert(options);
+        return;
+    }
+    mprRemoveKey(options, field);
+}
+
+
+bool httpOption(MprHash *hash, cchar *field, cchar *value, int useDefault)
+{
+    return smatch(value, httpGetOption(hash, field, useDefault ? value : 0));
+}
+
+
+void httpSetOption(MprHash *options, cchar *field, cchar *value)
+{
+    MprKey  *kp;
+
+    if (value == 0) {
+        return;
+    }
+    if (options == 0) {
+        mprAssert(options);
+        return;
+    }
+    if ((kp = mprAddKey(options, field, value)) != 0) {
+        kp->type = MPR_JSON_STRING;
+    }
+}
+
+
+HttpLimits *httpGraduateLimits(HttpRoute *route, HttpLimits *limits)
+{
+    if (route->parent && route->limits == route->parent->limits) {
+        if (limits == 0) {
+            limits = ((Http*) MPR->httpService)->serverLimits;
+        }
+        route->limits = mprMemdup(limits, sizeof(HttpLimits));
+    }
+    return route->limits;
+}
+
+/*
+    @copy   default
+
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
+
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a 
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
+
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
+
+    @end
+ */
+
+/************************************************************************/
+/*
+    Start of file "src/rx.c"
+ */
+/************************************************************************/
+
+/*
+    rx.c -- Http receiver. Parses http requests and client responses.
+    Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
+ */
+
+/********************************* Includes ***********************************/
+
+
+
+#if (BIT_CPU_ARCH == MPR_CPU_X86 || BIT_CPU_ARCH == MPR_CPU_X64) && __GNUC__ && __SSE2__
+    #define HTTP_SIMD 1
+    #include <immintrin.h>
+#else
+    #define HTTP_SIMD 0
+#endif
+
+/************************************ Locals **********************************/
+/*
+    Valid header name characters (RFC 7230 token)
+ */
+static cuchar tokenChars[256] = {
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,1,0,1,1,1,1,1,0,0,1,1,0,1,1,0,
+    1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,0,
+    0,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1,1,1,1,0,0,0,1,1,
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1,1,1,1,0,1,0,1,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+};
+
+/*
+    Header scanners selected by httpSetHeaderScanner
+ */
+typedef ssize (*HttpScanProc)(cuchar *buf, ssize len);
+
+static HttpScanProc scanEndProc;
+static HttpScanProc scanLineProc;
+static int scanLevel = -1;
+
+/***************************** Forward Declarations ***************************/
+
+static void addMatchEtag(HttpConn *conn, char *etag);
+static char *getToken(HttpConn *conn, cchar *delim);
+static bool matchIfRange(HttpConn *conn);
+static void manageRange(HttpRange *range, int flags);
+static void manageRx(HttpRx *rx, int flags);
+static bool parseHeaders(HttpConn *conn, HttpPacket *packet);
+static bool parseIncoming(HttpConn *conn, HttpPacket *packet);
+static bool parseRange(HttpConn *conn, char *value);
+static bool parseRequestLine(HttpConn *conn, HttpPacket *packet);
+static bool parseResponseLine(HttpConn *conn, HttpPacket *packet);
+static bool processCompletion(HttpConn *conn);
+static bool processContent(HttpConn *conn, HttpPacket *packet);
+static void parseMethod(HttpConn *conn);
+static bool processParsed(HttpConn *conn);
+static bool processReady(HttpConn *conn);
+static bool processRunning(HttpConn *conn);
+static void resumeConn(HttpConn *conn, MprEvent *event);
+static bool routeRequest(HttpConn *conn);
+static ssize scanEnd(cuchar *buf, ssize len);
+static ssize scanLine(cuchar *buf, ssize len);
+static void transferConn(HttpConn *conn);
+
+#if HTTP_SIMD
+static ssize scanEndAvx2(cuchar *buf, ssize len);
+static ssize scanEndSse2(cuchar *buf, ssize len);
+static ssize scanLineAvx2(cuchar *buf, ssize len);
+static ssize scanLineSse2(cuchar *buf, ssize len);
+#endif
+
+/*********************************** Code *************************************/
+
+HttpRx *httpCreateRx(HttpConn *conn)
+{
+    HttpRx      *rx;
+
+    if ((rx = mprAllocObj(HttpRx, manageRx)) == 0) {
+        return 0;
+    }
+    rx->conn = conn;
+    rx->length = -1;
+    rx->ifMatch = 1;
+    rx->ifModified = 1;
+    rx->pathInfo = sclone("/");
+    rx->scriptName = mprEmptyString();
+    rx->needInputPipeline = !conn->endpoint;
+    rx->headers = mprCreateHash(HTTP_SMALL_HASH_SIZE, MPR_HASH_CASELESS);
+    rx->chunkState = HTTP_CHUNK_UNCHUNKED;
+    rx->traceLevel = -1;
+    return rx;
+}
+
+
+static void manageRx(HttpRx *rx, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(rx->method);
+        mprMark(rx->uri);
+        mprMark(rx->pathInfo);
+        mprMark(rx->scriptName);
+        mprMark(rx->extraPath);
+        mprMark(rx->conn);
+        mprMark(rx->route);
+        mprMark(rx->etags);
+        mprMark(rx->ifRange);
+        mprMark(rx->headerPacket);
+        mprMark(rx->headers);
+        mprMark(rx->inputPipeline);
+        mprMark(rx->parsedUri);
+        mprMark(rx->requestData);
+        mprMark(rx->statusMessage);
+        mprMark(rx->accept);
+        mprMark(rx->acceptCharset);
+        mprMark(rx->acceptEncoding);
+        mprMark(rx->acceptLanguage);
+        mprMark(rx->cookie);
+        mprMark(rx->connection);
+        mprMark(rx->contentLength);
+        mprMark(rx->hostHeader);
+        mprMark(rx->pragma);
+        mprMark(rx->mimeType);
+        mprMark(rx->originalMethod);
+        mprMark(rx->originalUri);
+        mprMark(rx->redirect);
+        mprMark(rx->referrer);
+        mprMark(rx->securityToken);
+        mprMark(rx->session);
+        mprMark(rx->userAgent);
+        mprMark(rx->params);
+        mprMark(rx->svars);
+        mprMark(rx->inputRange);
+        mprMark(rx->passDigest);
+        mprMark(rx->files);
+        mprMark(rx->uploadDir);
+        mprMark(rx->paramString);
+        mprMark(rx->lang);
+        mprMark(rx->target);
+
+#if BIT_WEB_SOCKETS
+        mprMark(rx->upgrade);
+        mprMark(rx->sockKey);
+        mprMark(rx->sockProtocol);
+        mprMark(rx->sockVersion);
+        mprMark(rx->origin);
+#endif
+        mprMark(rx->webSocket);
+
+    } else if (flags & MPR_MANAGE_FREE) {
+        if (rx->conn) {
+            rx->conn->rx = 0;
+        }
+    }
+}
+
+
+void httpDestroyRx(HttpRx *rx)
+{
+    if (rx->conn) {
+        rx->conn->rx = 0;
+        rx->conn = 0;
+    }
+}
+
+
+/*  
+    Pump the Http engine.
+    Process incoming requests and drive the state machine. This will process as many requests as possible before returning. 
+    All socket I/O is non-blocking, and this routine must not block. Note: packet may be null.
+ */
+void httpPump(HttpConn *conn, HttpPacket *packet)
+{
+    mprAssert(conn);
+
+    conn->canProceed = 1;
+    conn->inHttpProcess = 1;
+
+    while (conn->canProceed) {
+        if (conn->h2) {
+            /* The connection has switched to HTTP/2 */
+            httpPumpHttp2(conn, packet);
+            break;
+        }
+        LOG(7, "httpProcess %s, state %d, error %d", conn->dispatcher->name, conn->state, conn->error);
+        switch (conn->state) {
+        case HTTP_STATE_BEGIN:
+        case HTTP_STATE_CONNECTED:
+            conn->canProceed = parseIncoming(conn, packet);
+            break;
+
+        case HTTP_STATE_PARSED:
+            conn->canProceed = processParsed(conn);
+            break;
+
+        case HTTP_STATE_CONTENT:
+            conn->canProceed = processContent(conn, packet);
+            break;
+
+        case HTTP_STATE_READY:
+            conn->canProceed = processReady(conn);
+            break;
+
+        case HTTP_STATE_RUNNING:
+            conn->canProceed = processRunning(conn);
+            break;
+
+        case HTTP_STATE_COMPLETE:
+            conn->canProceed = processCompletion(conn);
+            break;
+        }
+        if (conn->connError || (conn->endpoint && conn->connectorComplete && conn->state >= HTTP_STATE_RUNNING)) {
+            httpSetState(conn, HTTP_STATE_COMPLETE);
+            continue;
+        }
+        packet = conn->input;
+    }
+    if (!httpFlushDeferred(conn)) {
+        conn->writeBlocked = 1;
+    }
+    conn->inHttpProcess = 0;
+}
+
+
+/*  
+    Parse the incoming http message. Return true to keep going with this or subsequent request, zero means
+    insufficient data to proceed.
+ */
+static bool parseIncoming(HttpConn *conn, HttpPacket *packet)
+{
+    HttpRx      *rx;
+    ssize       len, offset;
+    char        *start, *end, *upgrade;
+
+    if (packet == NULL) {
+        return 0;
+    }
+    if (mprShouldDenyNewRequests()) {
+        httpError(conn, HTTP_ABORT | HTTP_CODE_NOT_ACCEPTABLE, "Server terminating");
+        return 0;
+    }
+    if (!conn->rx && conn->endpoint && !conn->stream && conn->limits->streamMax > 0 && 
+            (len = httpGetPacketLength(packet)) > 0 && *mprGetBufStart(packet->content) == 'P') {
+        /* Test for the HTTP/2 client connection preface */
+        if (memcmp(mprGetBufStart(packet->content), HTTP2_PREFACE, min(len, HTTP2_PREFACE_SIZE)) == 0) {
+            if (len < HTTP2_PREFACE_SIZE) {
+                return 0;
+            }
+            return httpCreateHttp2(conn) != 0;
+        }
+    }
+    if (!conn->rx) {
+        conn->rx = httpCreateRx(conn);
+        conn->tx = httpCreateTx(conn, NULL);
+    }
+    rx = conn->rx;
+    if ((len = httpGetPacketLength(packet)) == 0) {
+        return 0;
+    }
+    start = mprGetBufStart(packet->content);
+
+#if FUTURE
+    while (*start == '\r' || *start == '\n') {
+        mprGetCharFromBuf(packet->content);
+        start = mprGetBufStart(packet->content);
+    }
+#endif
+
+    /*
+        Don't start processing until all the headers have been received (delimited by two blank lines). Scanning 
+        resumes where the last scan ended, so headers received in several packets are only scanned once.
+        MOB - should be tolerant and allow '\n\n'
+     */
+    if ((offset = httpScanHeaderEnd(&start[rx->headerScan], len - rx->headerScan)) < 0) {
+        rx->headerScan = max(len - 3, 0);
+        if (len >= conn->limits->headerSize) {
+            httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_TOO_LARGE, 
+                "Header too big. Length %d vs limit %d", len, conn->limits->headerSize);
+        }
+        return 0;
+    }
+    end = &start[rx->headerScan + offset];
+    len = end - start;
+    mprAddNullToBuf(packet->content);
+    upgrade = 0;
+    if (conn->endpoint && !conn->stream && !conn->secure && conn->limits->streamMax > 0 && sncontains(start, "h2c", len)) {
+        /* Preserve the request headers for a HTTP/2 upgrade as parsing modifies the headers in-situ */
+        upgrade = snclone(start, len + 4);
+    }
+
+    if (len >= conn->limits->headerSize) {
+        httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_TOO_LARGE, 
+            "Header too big. Length %d vs limit %d", len, conn->limits->headerSize);
+        return 0;
+    }
+    if (conn->endpoint) {
+        /* This will set conn->error if it does not validate - keep going to generate a response */
+        if (!parseRequestLine(conn, packet)) {
+            return 0;
+        }
+    } else if (!parseResponseLine(conn, packet)) {
+        return 0;
+    }
+    if (!parseHeaders(conn, packet)) {
+        return 0;
+    }
+    if (conn->endpoint) {
+        httpMatchHost(conn);
+        if (httpSetUri(conn, rx->uri, "") < 0 || rx->pathInfo[0] != '/') {
+            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad URL format");
+        }
+        if (conn->secure) {
+            rx->parsedUri->scheme = sclone("https");
+        }
+        rx->parsedUri->port = conn->sock->listenSock->port;
+
+        //  MOB - refactor what conn->host is set to
+        rx->parsedUri->host = rx->hostHeader ? rx->hostHeader : conn->host->name;
+        if (!rx->parsedUri->host) {
+           rx->parsedUri->host = (conn->host->name[0] == '*') ? conn->sock->acceptIp : conn->host->name;
+        }
+        if (upgrade && !conn->error && httpUpgradeHttp2(conn, upgrade)) {
+            return 1;
+        }
+
+    } else if (!(100 <= rx->status && rx->status <= 199)) {
+        /* 
+            Ignore Expect status responses. NOTE: Clients have already created their Tx pipeline.
+         */
+        httpCreateRxPipeline(conn, conn->http->clientRoute);
+    }
+    httpSetState(conn, HTTP_STATE_PARSED);
+    return 1;
+}
+
+
+static void mapMethod(HttpConn *conn)
+{
+    HttpRx      *rx;
+    cchar       *method;
+
+    rx = conn->rx;
+    if (rx->flags & HTTP_POST) {
+        if ((method = httpGetParam(conn, "-http-method-", 0)) != 0) {
+            if (!scaselessmatch(method, rx->method)) {
+                mprLog(3, "Change method from %s to %s for %s", rx->method, method, rx->uri);
+                httpSetMethod(conn, method);
+            }
+        }
+    }
+}
+
+
+/*
+    Route the request and create the pipeline. Return false if the request must first be transferred to a worker.
+ */
+static bool routeRequest(HttpConn *conn)
+{
+    HttpRx      *rx;
+    HttpStage   *handler;
+
+    mprAssert(conn->endpoint);
+
+    rx = conn->rx;
+    if (!rx->route) {
+        httpAddParams(conn);
+        mapMethod(conn);
+        httpRouteRequest(conn);  
+        handler = conn->tx->handler;
+        if ((rx->route->flags & HTTP_ROUTE_COROUTINE) && conn->async && !conn->worker && !conn->endpoint->dispatcher &&
+                handler && !(handler->flags & HTTP_STAGE_NONBLOCK)) {
+            /* Run the handler on a coroutine so that waiting does not hold a worker thread */
+            conn->dispatcher->flags |= MPR_DISPATCHER_COROUTINE;
+            if (!mprGetCurrentCoroutine()) {
+                transferConn(conn);
+                return 0;
+            }
+        }
+        if ((conn->dispatcher->flags & MPR_DISPATCHER_INLINE) && 
+                (rx->authPending || (handler && !(handler->flags & HTTP_STAGE_NONBLOCK)))) {
+            /*
+                The connection is being serviced on the event thread and authentication or the handler may block. 
+                Resume on a worker before the handler is opened.
+             */
+            transferConn(conn);
+            return 0;
+        }
+    }
+    if (!conn->writeq) {
+        if (rx->authPending) {
+            rx->authPending = 0;
+            if (!httpCheckAuth(conn) && conn->finalized) {
+                /* Request has been denied and fully handled */
+                conn->tx->handler = conn->http->passHandler;
+            }
+        }
+        httpCreateRxPipeline(conn, rx->route);
+        httpCreateTxPipeline(conn, rx->route);
+    }
+    return 1;
+}
+
+
+/*
+    Resume servicing a connection on a worker. Used when the connection is serviced on the event thread or must run on
+    a coroutine.
+ */
+static void transferConn(HttpConn *conn)
+{
+    conn->dispatcher->flags &= ~MPR_DISPATCHER_INLINE;
+    if (conn->stream) {
+        httpScheduleStream(conn);
+    } else {
+        mprCreateEvent(conn->dispatcher, "resumeConn", 0, resumeConn, conn, 0);
+    }
+}
+
+
+/*
+    Resume a request transferred from the event thread. Process buffered input and then service the socket as a normal
+    I/O event would. Reading stops when the socket would block.
+ */
+static void resumeConn(HttpConn *conn, MprEvent *event)
+{
+    if (conn->sock && conn->rx) {
+        httpPump(conn, conn->input);
+        event->mask = MPR_READABLE;
+        if (conn->writeBlocked || httpGetDeferredLength(conn) > 0) {
+            event->mask |= MPR_WRITABLE;
+        }
+        httpEvent(conn, event);
+    }
+}
+
+
+/*
+    Only called by parseRequestLine
+ */
+static void traceRequest(HttpConn *conn, HttpPacket *packet)
+{
+    MprBuf  *content;
+    cchar   *endp, *ext, *cp;
+    int     len, level;
+
+    content = packet->content;
+    ext = 0;
+    /*
+        Find the Uri extension:   "GET /path.ext HTTP/1.1"
+     */
+    if ((cp = schr(content->start, ' ')) != 0) {
+        if ((cp = schr(++cp, ' ')) != 0) {
+            for (ext = --cp; ext > content->start && *ext != '.'; ext--) ;
+            ext = (*ext == '.') ? snclone(&ext[1], cp - ext) : 0;
+            conn->tx->ext = ext;
+        }
+    }
+    /*
+        If tracing header, do entire header including first line
+     */
+    if ((conn->rx->traceLevel = httpShouldTrace(conn, HTTP_TRACE_RX, HTTP_TRACE_HEADER, ext)) >= 0) {
+        mprLog(4, "New request from %s:%d to %s:%d", conn->ip, conn->port, conn->sock->acceptIp, conn->sock->acceptPort);
+        endp = strstr((char*) content->start, "\r\n\r\n");
+        len = (endp) ? (int) (endp - mprGetBufStart(content) + 4) : 0;
+        httpTraceContent(conn, HTTP_TRACE_RX, HTTP_TRACE_HEADER, packet, len, 0);
+
+    } else if ((level = httpShouldTrace(conn, HTTP_TRACE_RX, HTTP_TRACE_FIRST, ext)) >= 0) {
+        endp = strstr((char*) content->start, "\r\n");
+        len = (endp) ? (int) (endp - mprGetBufStart(content) + 2) : 0;
+        if (len > 0) {
+            content->start[len - 2] = '\0';
+            mprLog(level, "%s", content->start);
+            content->start[len - 2] = '\r';
+        }
+    }
+    httpValidateLimits(conn->endpoint, HTTP_VALIDATE_OPEN_REQUEST, conn);
+}
+
+
+static void parseMethod(HttpConn *conn)
+{
+    HttpRx      *rx;
+    cchar       *method;
+    int         methodFlags;
+
+    rx = conn->rx;
+    method = rx->method;
+    methodFlags = 0;
+
+    switch (method[0]) {
+    case 'D':
+        if (strcmp(method, "DELETE") == 0) {
+            methodFlags = HTTP_DELETE;
+        }
+        break;
+
+    case 'G':
+        if (strcmp(method, "GET") == 0) {
+            methodFlags = HTTP_GET;
+        }
+        break;
+
+    case 'H':
+        if (strcmp(method, "HEAD") == 0) {
+            methodFlags = HTTP_HEAD;
+        }
+        break;
+
+    case 'O':
+        if (strcmp(method, "OPTIONS") == 0) {
+            methodFlags = HTTP_OPTIONS;
+        }
+        break;
+
+    case 'P':
+        if (strcmp(method, "POST") == 0) {
+            methodFlags = HTTP_POST;
+            rx->needInputPipeline = 1;
+
+        } else if (strcmp(method, "PUT") == 0) {
+            methodFlags = HTTP_PUT;
+            rx->needInputPipeline = 1;
+        }
+        break;
+
+    case 'T':
+        if (strcmp(method, "TRACE") == 0) {
+            methodFlags = HTTP_TRACE;
+        }
+        break;
+    }
+    if (methodFlags == 0) {
+        methodFlags = HTTP_UNKNOWN;
+    }
+    rx->flags |= methodFlags;
+}
+
+
+/*  
+    Parse the first line of a http request. Return true if the first line parsed. This is only called once all the headers
+    have been read and buffered. Requests look like: METHOD URL HTTP/1.X.
+ */
+static bool parseRequestLine(HttpConn *conn, HttpPacket *packet)
+{
+    HttpRx      *rx;
+    char        *uri, *protocol;
+    ssize       len;
+
+    rx = conn->rx;
+#if BIT_DEBUG
+    conn->startTime = conn->http->now;
+    conn->startTicks = mprGetTicks();
+#endif
+    traceRequest(conn, packet);
+
+    rx->originalMethod = rx->method = supper(getToken(conn, 0));
+    parseMethod(conn);
+
+    uri = getToken(conn, 0);
+    len = slen(uri);
+    if (*uri == '\0') {
+        httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad HTTP request. Empty URI");
+        return 0;
+    } else if (len >= conn->limits->uriSize) {
+        httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_URL_TOO_LARGE, 
+            "Bad request. URI too long. Length %d vs limit %d", len, conn->limits->uriSize);
+        return 0;
+    }
+    protocol = conn->protocol = supper(getToken(conn, "\r\n"));
+    if (strcmp(protocol, "HTTP/1.0") == 0) {
+        if (rx->flags & (HTTP_POST|HTTP_PUT)) {
+            rx->remainingContent = MAXINT;
+            rx->needInputPipeline = 1;
+        }
+        conn->http10 = 1;
+        conn->protocol = protocol;
+    } else if (strcmp(protocol, "HTTP/1.1") == 0) {
+        conn->protocol = protocol;
+    } else {
+        conn->protocol = sclone("HTTP/1.1");
+        httpError(conn, HTTP_ABORT | HTTP_CODE_NOT_ACCEPTABLE, "Unsupported HTTP protocol");
+        return 0;
+    }
+    rx->originalUri = rx->uri = sclone(uri);
+    httpSetState(conn, HTTP_STATE_FIRST);
+    return 1;
+}
+
+
+/*  
+    Parse the first line of a http response. Return true if the first line parsed. This is only called once all the headers
+    have been read and buffered. Response status lines look like: HTTP/1.X CODE Message
+ */
+static bool parseResponseLine(HttpConn *conn, HttpPacket *packet)
+{
+    HttpRx      *rx;
+    HttpTx      *tx;
+    MprBuf      *content;
+    cchar       *endp;
+    char        *protocol, *status;
+    ssize       len;
+    int         level, traced;
+
+    rx = conn->rx;
+    tx = conn->tx;
+    traced = 0;
+
+    if (httpShouldTrace(conn, HTTP_TRACE_RX, HTTP_TRACE_HEADER, tx->ext) >= 0) {
+        content = packet->content;
+        endp = strstr((char*) content->start, "\r\n\r\n");
+        len = (endp) ? (int) (endp - mprGetBufStart(content) + 4) : 0;
+        httpTraceContent(conn, HTTP_TRACE_RX, HTTP_TRACE_HEADER, packet, len, 0);
+        traced = 1;
+    }
+    protocol = conn->protocol = supper(getToken(conn, 0));
+    if (strcmp(protocol, "HTTP/1.0") == 0) {
+        conn->http10 = 1;
+        if (!scaselessmatch(tx->method, "HEAD")) {
+            rx->remainingContent = MAXINT;
+        }
+    } else if (strcmp(protocol, "HTTP/1.1") != 0) {
+        httpError(conn, HTTP_ABORT | HTTP_CODE_NOT_ACCEPTABLE, "Unsupported HTTP protocol");
+        return 0;
+    }
+    status = getToken(conn, 0);
+    if (*status == '\0') {
+        httpError(conn, HTTP_ABORT | HTTP_CODE_NOT_ACCEPTABLE, "Bad response status code");
+        return 0;
+    }
+    rx->status = atoi(status);
+    rx->statusMessage = sclone(getToken(conn, "\r\n"));
+
+    len = slen(rx->statusMessage);
+    if (len >= conn->limits->uriSize) {
+        httpError(conn, HTTP_CLOSE | HTTP_CODE_REQUEST_URL_TOO_LARGE, 
+            "Bad response. Status message too long. Length %d vs limit %d", len, conn->limits->uriSize);
+        return 0;
+    }
+    if (!traced && (level = httpShouldTrace(conn, HTTP_TRACE_RX, HTTP_TRACE_FIRST, tx->ext)) >= 0) {
+        mprLog(level, "%s %d %s", protocol, rx->status, rx->statusMessage);
+    }
+    return 1;
+}
+
+
+/*  
+    Parse the request headers. Return true if the header parsed.
+ */
+static bool parseHeaders(HttpConn *conn, HttpPacket *packet)
+{
+    HttpRx      *rx;
+    HttpTx      *tx;
+    HttpLimits  *limits;
+    MprBuf      *content;
+    char        *cp, *line, *key, *value, *tok, *hvalue;
+    cchar       *oldValue;
+    ssize       len;
+    int         count, keepAlive;
+
+    rx = conn->rx;
+    tx = conn->tx;
+    content = packet->content;
+    conn->rx->headerPacket = packet;
+    limits = conn->limits;
+    keepAlive = (conn->http10) ? 0 : 1;
+
+    for (count = 0; content->start[0] != '\r' && !conn->error; count++) {
+        if (count >= limits->headerMax) {
+            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Too many headers");
+            return 0;
+        }
+        /*
+            The line ends at the first control character which must be the carriage return of the line ending
+            MOB - should be tolerant and allow '\n'
+         */
+        line = mprGetBufStart(content);
+        if ((len = httpScanLine(line, mprGetBufLength(content))) < 0 || line[len] != '\r' || line[len + 1] != '\n') {
+            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad header format");
+            return 0;
+        }
+        line[len] = '\0';
+        mprAdjustBufStart(content, len + 2);
+        for (key = line; *key == ' ' || *key == '\t'; key++) {}
+        if ((value = strchr(key, ':')) == 0 || value == key) {
+            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad header format");
+            return 0;
+        }
+        *value++ = '\0';
+        while (isspace((uchar) *value)) {
+            value++;
+        }
+        LOG(8, "Key %s, value %s", key, value);
+        for (cp = key; tokenChars[(uchar) *cp]; cp++) {}
+        if (*cp || *key == '%') {
+            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad header key value");
+            return 0;
+        }
+        if ((oldValue = mprLookupKey(rx->headers, key)) != 0) {
+            hvalue = sfmt("%s, %s", oldValue, value);
+        } else {
+            hvalue = sclone(value);
+        }
+        mprAddKey(rx->headers, key, hvalue);
+
+        switch (tolower((uchar) key[0])) {
+        case 'a':
+            if (strcasecmp(key, "authorization") == 0) {
+                value = sclone(value);
+                conn->authType = slower(stok(value, " \t", &tok));
+                rx->authDetails = sclone(tok);
+
+            } else if (strcasecmp(key, "accept-charset") == 0) {
+                rx->acceptCharset = sclone(value);
+
+            } else if (strcasecmp(key, "accept") == 0) {
+                rx->accept = sclone(value);
+
+            } else if (strcasecmp(key, "accept-encoding") == 0) {
+                rx->acceptEncoding = sclone(value);
+
+            } else if (strcasecmp(key, "accept-language") == 0) {
+                rx->acceptLanguage = sclone(value);
+            }
+            break;
+
+        case 'c':
+            if (strcasecmp(key, "connection") == 0) {
+                rx->connection = sclone(value);
+                if (scaselesscmp(value, "KEEP-ALIVE") == 0) {
+                    keepAlive = 1;
+                } else if (scaselesscmp(value, "CLOSE") == 0) {
+                    /*  Not really required, but set to 0 to be sure */
+                    conn->keepAliveCount = 0;
+                }
+
+            } else if (strcasecmp(key, "content-length") == 0) {
+                if (rx->length >= 0) {
+                    httpError(conn, HTTP_CLOSE | HTTP_CODE_BAD_REQUEST, "Mulitple content length headers");
+                    break;
+                }
+                rx->length = stoi(value);
+                if (rx->length < 0) {
+                    httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad content length");
+                    return 0;
+                }
+                if (rx->length >= conn->limits->receiveBodySize) {
+                    httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_TOO_LARGE,
+                        "Request content length %,Ld bytes is too big. Limit %,Ld", 
+                        rx->length, conn->limits->receiveBodySize);
+                    return 0;
+                }
+                rx->contentLength = sclone(value);
+                mprAssert(rx->length >= 0);
+                if (conn->endpoint || !scaselessmatch(tx->method, "HEAD")) {
+                    rx->remainingContent = rx->length;
+                    rx->needInputPipeline = 1;
+                }
+
+            } else if (strcasecmp(key, "content-range") == 0) {
+                /*
+                    This headers specifies the range of any posted body data
+                    Format is:  Content-Range: bytes n1-n2/length
+                    Where n1 is first byte pos and n2 is last byte pos
+                 */
+                char    *sp;
+                MprOff  start, end, size;
+
+                start = end = size = -1;
+                sp = value;
+                while (*sp && !isdigit((uchar) *sp)) {
+                    sp++;
+                }
+                if (*sp) {
+                    start = stoi(sp);
+                    if ((sp = strchr(sp, '-')) != 0) {
+                        end = stoi(++sp);
+                    }
+                    if ((sp = strchr(sp, '/')) != 0) {
+                        /*
+                            Note this is not the content length transmitted, but the original size of the input of which
+                            the client is transmitting only a portion.
+                         */
+                        size = stoi(++sp);
+                    }
+                }
+                if (start < 0 || end < 0 || size < 0 || end <= start) {
+                    httpError(conn, HTTP_CLOSE | HTTP_CODE_RANGE_NOT_SATISFIABLE, "Bad content range");
+                    break;
+                }
+                rx->inputRange = httpCreateRange(conn, start, end);
+
+            } else if (strcasecmp(key, "content-type") == 0) {
+                rx->mimeType = sclone(value);
+                if (rx->flags & (HTTP_POST | HTTP_PUT)) {
+                    rx->form = scontains(rx->mimeType, "application/x-www-form-urlencoded") != 0;
+                    rx->upload = scontains(rx->mimeType, "multipart/form-data") != 0;
+                } else { 
+                    rx->form = rx->upload = 0;
+                }
+
+            } else if (strcasecmp(key, "cookie") == 0) {
+                if (rx->cookie && *rx->cookie) {
+                    rx->cookie = sjoin(rx->cookie, "; ", value, NULL);
+                } else {
+                    rx->cookie = sclone(value);
+                }
+            }
+            break;
+
+        case 'e':
+            if (strcasecmp(key, "expect") == 0) {
+                /*
+                    Handle 100-continue for HTTP/1.1 clients only. This is the only expectation that is currently supported.
+                 */
+                if (!conn->http10) {
+                    if (strcasecmp(value, "100-continue") != 0) {
+                        httpError(conn, HTTP_CODE_EXPECTATION_FAILED, "Expect header value \"%s\" is unsupported", value);
+                    } else {
+                        rx->flags |= HTTP_EXPECT_CONTINUE;
+                    }
+                }
+            }
+            break;
+
+        case 'h':
+            if (strcasecmp(key, "host") == 0) {
+                rx->hostHeader = sclone(value);
+            }
+            break;
+
+        case 'i':
+            if ((strcasecmp(key, "if-modified-since") == 0) || (strcasecmp(key, "if-unmodified-since") == 0)) {
+                MprTime     newDate = 0;
+                char        *cp;
+                bool        ifModified = (tolower((uchar) key[3]) == 'm');
+
+                if ((cp = strchr(value, ';')) != 0) {
+                    *cp = '\0';
+                }
+                if (mprParseTime(&newDate, value, MPR_UTC_TIMEZONE, NULL) < 0) {
+                    mprAssert(0);
+                    break;
+                }
+                if (newDate) {
+                    rx->since = newDate;
+                    rx->ifModified = ifModified;
+                    rx->flags |= HTTP_IF_MODIFIED;
+                }
+
+            } else if ((strcasecmp(key, "if-match") == 0) || (strcasecmp(key, "if-none-match") == 0)) {
+                char    *word, *tok;
+                bool    ifMatch = (tolower((uchar) key[3]) == 'm');
+
+                if ((tok = strchr(value, ';')) != 0) {
+                    *tok = '\0';
+                }
+                rx->ifMatch = ifMatch;
+                rx->flags |= HTTP_IF_MODIFIED;
+                value = sclone(value);
+                word = stok(value, " ,", &tok);
+                while (word) {
+                    addMatchEtag(conn, word);
+                    word = stok(0, " ,", &tok);
+                }
+
+            } else if (strcasecmp(key, "if-range") == 0) {
+                /* Ranges are only honored if the validator matches. Otherwise the entire entity is sent. */
+                rx->ifRange = sclone(value);
+            }
+            break;
+
+        case 'k':
+            /* Keep-Alive: timeout=N, max=1 */
+            if (strcasecmp(key, "keep-alive") == 0) {
+                keepAlive = 1;
+                if ((tok = scontains(value, "max=")) != 0) {
+                    conn->keepAliveCount = atoi(&tok[4]);
+                    /*  
+                        IMPORTANT: Deliberately close the connection one request early. This ensures a client-led 
+                        termination and helps relieve server-side TIME_WAIT conditions.
+                     */
+                    if (conn->keepAliveCount == 1) {
+                        conn->keepAliveCount = 0;
+                    }
+                }
+            }
+            break;                
+                
+        case 'l':
+            if (strcasecmp(key, "location") == 0) {
+                rx->redirect = sclone(value);
+            }
+            break;
+
+#if BIT_WEB_SOCKETS
+        case 'o':
+            if (strcasecmp(key, "origin") == 0) {
+                rx->origin = sclone(value);
+            }
+            break;
+#endif
+
+        case 'p':
+            if (strcasecmp(key, "pragma") == 0) {
+                rx->pragma = sclone(value);
+            }
+            break;
+
+        case 'r':
+            if (strcasecmp(key, "range") == 0) {
+                if (!parseRange(conn, value)) {
+                    httpError(conn, HTTP_CLOSE | HTTP_CODE_RANGE_NOT_SATISFIABLE, "Bad range");
+                }
+            } else if (strcasecmp(key, "referer") == 0) {
+                /* NOTE: yes the header is misspelt in the spec */
+                rx->referrer = sclone(value);
+            }
+            break;
+
+#if BIT_WEB_SOCKETS
+        case 's':
+            if (strcasecmp(key, "sec-websocket-key") == 0) {
+                rx->sockKey = sclone(value);
+            } else if (strcasecmp(key, "sec-websocket-protocol") == 0) {
+                rx->sockProtocol = sclone(value);
+            } else if (strcasecmp(key, "sec-websocket-version") == 0) {
+                rx->sockVersion = sclone(value);
+            }
+            break;
+#endif
+        case 't':
+            if (strcasecmp(key, "transfer-encoding") == 0) {
+                if (scaselesscmp(value, "chunked") == 0) {
+                    /*  
+                        remainingContent will be revised by the chunk filter as chunks are processed and will 
+                        be set to zero when the last chunk has been received.
+                     */
+                    rx->flags |= HTTP_CHUNKED;
+                    rx->chunkState = HTTP_CHUNK_START;
+                    rx->remainingContent = MAXINT;
+                    rx->needInputPipeline = 1;
+                }
+            }
+            break;
+
+        case 'x':
+            if (strcasecmp(key, "x-http-method-override") == 0) {
+                httpSetMethod(conn, value);
+#if BIT_DEBUG
+            } else if (strcasecmp(key, "x-chunk-size") == 0) {
+                tx->chunkSize = atoi(value);
+                if (tx->chunkSize <= 0) {
+                    tx->chunkSize = 0;
+                } else if (tx->chunkSize > conn->limits->chunkSize) {
+                    tx->chunkSize = conn->limits->chunkSize;
+                }
+#endif
+            }
+            break;
+
+        case 'u':
+#if BIT_WEB_SOCKETS
+            if (scaselesscmp(key, "upgrade") == 0) {
+                rx->upgrade = sclone(value);
+            } else
+#endif
+            if (strcasecmp(key, "user-agent") == 0) {
+                rx->userAgent = sclone(value);
+            }
+            break;
+
+        case 'w':
+            if (strcasecmp(key, "www-authenticate") == 0) {
+                cp = value;
+                while (*value && !isspace((uchar) *value)) {
+                    value++;
+                }
+                *value++ = '\0';
+                conn->authType = slower(cp);
+                rx->authDetails = sclone(value);
+            }
+            break;
+        }
+    }
+    /*
+        Don't stream input if a form or upload. NOTE: Upload needs the Files[] collection.
+     */
+    rx->streamInput = !(rx->form || rx->upload);
+    rx->eof = (rx->remainingContent == 0);
+    if (!keepAlive) {
+        conn->keepAliveCount = 0;
+    }
+    if (!(rx->flags & HTTP_CHUNKED)) {
+        /*  
+            Step over "\r\n" after headers. 
+            Don't do this if chunked so chunking can parse a single chunk delimiter of "\r\nSIZE ...\r\n"
+         */
+        if (httpGetPacketLength(packet) >= 2) {
+            mprAdjustBufStart(content, 2);
+        }
+    }
+    return 1;
+}
+
+
+/*
+    Sends an 100 Continue response to the client. This bypasses the transmission pipeline, writing directly to the socket.
+ */
+static int sendContinue(HttpConn *conn)
+{
+    cchar      *response;
+
+    mprAssert(conn);
+    mprAssert(conn->sock);
+
+    /* Write the response to the socket and flush. */
+    response = sfmt("%s 100 Continue\r\n\r\n", conn->protocol);
+    mprWriteSocket(conn->sock, response, slen(response));
+    mprFlushSocket(conn->sock);
+    return 0;
+}
+
+
+/*
+    Called once the HTTP request/response headers have been parsed
+ */
+static bool processParsed(HttpConn *conn)
+{
+    HttpRx      *rx;
+
+    rx = conn->rx;
+    if (!rx->form && conn->endpoint) {
+        /*
+            Routes need to be able to access form data, so forms will route later after all input is received.
+         */
+        if (!routeRequest(conn)) {
+            return 0;
+        }
+    }
+    if (rx->streamInput) {
+        httpStartPipeline(conn);
+    }
+    /*
+        Send a 100 (Continue) response if the client has requested it. If the connection has an error, that takes
+        precedence and 100 Continue will not be sent. Also, if the connector has already written bytes to the socket, we
+        do not send 100 Continue to avoid corrupting the response.
+     */
+    if ((rx->flags & HTTP_EXPECT_CONTINUE) && !conn->error && !conn->tx->bytesWritten) {
+        sendContinue(conn);
+        rx->flags &= ~HTTP_EXPECT_CONTINUE;
+    }
+    httpSetState(conn, HTTP_STATE_CONTENT);
+    if (conn->workerEvent && conn->tx->started && rx->eof) {
+        httpSetState(conn, HTTP_STATE_READY);
+        return 0;
+    }
+    return 1;
+}
+
+
+static bool analyseContent(HttpConn *conn, HttpPacket *packet)
+{
+    HttpRx      *rx;
+    HttpTx      *tx;
+    HttpQueue   *q;
+    MprBuf      *content;
+    ssize       nbytes;
+
+    rx = conn->rx;
+    if (rx->eof) {
+        return 1;
+    }
+    tx = conn->tx;
+    content = packet->content;
+    q = tx->queue[HTTP_QUEUE_RX];
+    LOG(7, "processContent: packet of %d bytes, remaining %d", mprGetBufLength(content), rx->remainingContent);
+    
+    if ((nbytes = httpFilterChunkData(q, packet)) <= 0) {
+        return rx->eof ? 1 : 0;
+    }
+    rx->remainingContent -= nbytes;
+    rx->bytesRead += nbytes;
+    if (httpShouldTrace(conn, HTTP_TRACE_RX, HTTP_TRACE_BODY, tx->ext) >= 0) {
+        httpTraceContent(conn, HTTP_TRACE_RX, HTTP_TRACE_BODY, packet, nbytes, rx->bytesRead);
+    }
+    if (rx->bytesRead >= conn->limits->receiveBodySize && !rx->webSocket) {
+        httpError(conn, HTTP_CLOSE | HTTP_CODE_REQUEST_TOO_LARGE, 
+            "Request body of %,Ld bytes is too big. Limit %,Ld", rx->bytesRead, conn->limits->receiveBodySize);
+        return 1;
+    }
+    if (rx->form && rx->length >= conn->limits->receiveFormSize) {
+        httpError(conn, HTTP_CLOSE | HTTP_CODE_REQUEST_TOO_LARGE, 
+            "Request form of %,Ld bytes is too big. Limit %,Ld", rx->bytesRead, conn->limits->receiveFormSize);
+        return 1;
+    }
+    /* Small splits are copied rather than retain the whole input buffer */
+    if (packet == rx->headerPacket && nbytes > 0) {
+        packet = httpSplitPacket(packet, 0);
+        if (packet->content->block == 0) {
+            rx->bytesCopied += httpGetPacketLength(packet);
+        }
+    }
+    if (httpGetPacketLength(packet) > nbytes) {
+        /*  Split excess data belonging to the next chunk or pipelined request */
+        LOG(7, "processContent: Split packet of %d at %d", httpGetPacketLength(packet), nbytes);
+        conn->input = httpSplitPacket(packet, nbytes);
+        if (conn->input->content->block == 0) {
+            rx->bytesCopied += httpGetPacketLength(conn->input);
+        }
+    } else {
+        conn->input = 0;
+    }
+    if (!(conn->finalized && conn->endpoint)) {
+        /* If conn->error, then finalized will also be true */
+        if (rx->form) {
+            httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+        } else {
+            httpPutPacketToNext(q, packet);
+        }
+    }
+    if (rx->remainingContent == 0 && !(rx->flags & HTTP_CHUNKED)) {
+        rx->eof = 1;
+    }
+    return 1;
+}
+
+
+/*  
+    Process request body data (typically post or put content)
+ */
+static bool processContent(HttpConn *conn, HttpPacket *packet)
+{
+    HttpRx      *rx;
+    HttpQueue   *q;
+
+    rx = conn->rx;
+
+    if (!packet && !rx->eof) {
+        /*
+            A form that reached eof on the event thread is routed here once resumed on a worker. There is no packet
+            as all the content has been received and queued.
+         */
+        return 0;
+    }
+    if (!analyseContent(conn, packet)) {
+        return 0;
+    }
+    if (rx->eof) {
+        q = conn->tx->queue[HTTP_QUEUE_RX];
+        if (!conn->finalized) {
+            if (rx->form && conn->endpoint) {
+                /* Forms wait for all data before routing */
+                if (!routeRequest(conn)) {
+                    return 0;
+                }
+                while ((packet = httpGetPacket(q)) != 0) {
+                    httpPutPacketToNext(q, packet);
+                }
+            }
+            httpPutPacketToNext(q, httpCreateEndPacket());
+            if (!rx->streamInput) {
+                httpStartPipeline(conn);
+            }
+        }
+        httpSetState(conn, HTTP_STATE_READY);
+        return conn->workerEvent ? 0 : 1;
+    }
+    httpServiceQueues(conn);
+    return conn->error || (conn->input ? httpGetPacketLength(conn->input) : 0);
+}
+
+
+/*
+    In the ready state after all content has been received
+ */
+static bool processReady(HttpConn *conn)
+{
+    httpReadyHandler(conn);
+    httpSetState(conn, HTTP_STATE_RUNNING);
+    return 1;
+}
+
+
+/*
+    Note: may be called multiple times in response to output I/O events
+ */
+static bool processRunning(HttpConn *conn)
+{
+    HttpQueue   *q;
+    int         canProceed;
+
+    q = conn->writeq;
+    canProceed = 1;
+    httpServiceQueues(conn);
+
+    if (conn->endpoint) {
+        /* Server side */
+        if (conn->finalized) {
+            if (!conn->connectorComplete) {
+                /* Wait for Tx I/O event. Do suspend incase handler not using auto-flow routines */
+                conn->writeBlocked = 1;
+                httpSuspendQueue(q);
+                httpEnableConnEvents(q->conn);
+                canProceed = 0;
+            }
+        } else if (!httpProcessHandler(conn)) {
+            /* No process callback defined */
+            canProceed = 0;
+        } else if (q->count == 0) {
+            /* Queue is empty and data may have drained above in httpServiceQueues. Yield to reclaim memory. */
+            mprYield(0);
+        } else if (q->count < q->low) {
+            if (q->flags & HTTP_QUEUE_SUSPENDED) {
+                httpResumeQueue(q);
+            }
+        } else {
+            conn->writeBlocked = 1;
+            httpSuspendQueue(q);
+            httpEnableConnEvents(q->conn);
+            canProceed = 0;
+        }
+    } else {
+        /* Client side */
+        httpServiceQueues(conn);
+        httpFinalize(conn);
+        httpSetState(conn, HTTP_STATE_COMPLETE);
+    }
+    return canProceed;
+}
+
+
+#if BIT_DEBUG
+static void measure(HttpConn *conn)
+{
+    MprTime     elapsed;
+    HttpTx      *tx;
+    cchar       *uri;
+    int         level;
+
+    tx = conn->tx;
+    if (conn->rx == 0 || tx == 0) {
+        return;
+    }
+    uri = (conn->endpoint) ? conn->rx->uri : tx->parsedUri->path;
+   
+    if ((level = httpShouldTrace(conn, HTTP_TRACE_TX, HTTP_TRACE_TIME, tx->ext)) >= 0) {
+        elapsed = mprGetTime() - conn->startTime;
+#if MPR_HIGH_RES_TIMER
+        if (elapsed < 1000) {
+            mprLog(level, "TIME: Request %s took %,d msec %,d ticks", uri, elapsed, mprGetTicks() - conn->startTicks);
+        } else
+#endif
+            mprLog(level, "TIME: Request %s took %,d msec", uri, elapsed);
+    }
+}
+#else
+#define measure(conn)
+#endif
+
+
+static bool processCompletion(HttpConn *conn)
+{
+    HttpPacket  *packet;
+    HttpRx      *rx;
+    bool        more;
+
+    rx = conn->rx;
+    mprAssert(conn->state == HTTP_STATE_COMPLETE);
+
+    if (rx && rx->session) {
+        /* Session variables updated after finalizing */
+        httpWriteSession(conn);
+    }
+    httpDestroyPipeline(conn);
+    measure(conn);
+    if (conn->endpoint && rx) {
+        if (rx->route && rx->route->log) {
+            httpLogRequest(conn);
+        }
+        httpValidateLimits(conn->endpoint, HTTP_VALIDATE_CLOSE_REQUEST, conn);
+        rx->conn = 0;
+        conn->tx->conn = 0;
+        conn->rx = 0;
+        conn->tx = 0;
+        if (conn->stream) {
+            httpCloseStream(conn);
+            return 0;
+        }
+        packet = conn->input;
+        more = packet && !conn->connError && (httpGetPacketLength(packet) > 0);
+        if (conn->sock) {
+            httpPrepServerConn(conn);
+        }
+        return more;
+    }
+    return 0;
+}
+
+
+void httpCloseRx(HttpConn *conn)
+{
+    if (!conn->rx->eof) {
+        /* May not have consumed all read data, so can't be assured the next request will be okay */
+        conn->keepAliveCount = -1;
+    }
+    if (conn->state < HTTP_STATE_COMPLETE && !conn->inHttpProcess) {
+        httpPump(conn, NULL);
+    }
+}
+
+
+bool httpContentNotModified(HttpConn *conn)
+{
+    HttpRx      *rx;
+    HttpTx      *tx;
+    MprTime     modified;
+
+    rx = conn->rx;
+    tx = conn->tx;
+
+    if (tx->outputRanges && rx->ifRange && !matchIfRange(conn)) {
+        /* The range filter may have already set the length to that of the ranges. Send the entire entity. */
+        tx->outputRanges = 0;
+        tx->rangeBoundary = 0;
+        if (tx->entityLength >= 0) {
+            tx->length = tx->entityLength;
+        }
+    }
+    if (rx->flags & HTTP_IF_MODIFIED) {
+        /*  
+            If both checks, the last modification time and etag, claim that the request doesn't need to be
+            performed, skip the transfer.
+         */
+        mprAssert(tx->fileInfo.valid);
+        modified = (MprTime) tx->fileInfo.mtime * MPR_TICKS_PER_SEC;
+        return httpMatchModified(conn, modified) && httpMatchEtag(conn, tx->etag);
+    }
+    return 0;
+}
+
+
+/*
+    Test if the If-Range validator matches the entity. An entity tag must be a strong match. Otherwise the validator
+    is a date that must equal the last modification time.
+ */
+static bool matchIfRange(HttpConn *conn)
+{
+    HttpRx      *rx;
+    HttpTx      *tx;
+    MprTime     when;
+
+    rx = conn->rx;
+    tx = conn->tx;
+    if (*rx->ifRange == '"' || sstarts(rx->ifRange, "W/")) {
+        return tx->etag && smatch(rx->ifRange, tx->etag);
+    }
+    if (!tx->fileInfo.valid || mprParseTime(&when, rx->ifRange, MPR_UTC_TIMEZONE, NULL) < 0) {
+        return 0;
+    }
+    return when == (MprTime) tx->fileInfo.mtime * MPR_TICKS_PER_SEC;
+}
+
+
+HttpRange *httpCreateRange(HttpConn *conn, MprOff start, MprOff end)
+{
+    HttpRange     *range;
+
+    if ((range = mprAllocObj(HttpRange, manageRange)) == 0) {
+        return 0;
+    }
+    range->start = start;
+    range->end = end;
+    range->len = end - start;
+    return range;
+}
+
+
+static void manageRange(HttpRange *range, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(range->next);
+    }
+}
+
+
+MprOff httpGetContentLength(HttpConn *conn)
+{
+    if (conn->rx == 0) {
+        mprAssert(conn->rx);
+        return 0;
+    }
+    return conn->rx->length;
+}
+
+
+cchar *httpGetCookies(HttpConn *conn)
+{
+    if (conn->rx == 0) {
+        mprAssert(conn->rx);
+        return 0;
+    }
+    return conn->rx->cookie;
+}
+
+
+cchar *httpGetHeader(HttpConn *conn, cchar *key)
+{
+    if (conn->rx == 0) {
+        mprAssert(conn->rx);
+        return 0;
+    }
+    return mprLookupKey(conn->rx->headers, slower(key));
+}
+
+
+char *httpGetHeadersFromHash(MprHash *hash)
+{
+    MprKey      *kp;
+    char        *headers, *cp;
+    ssize       len;
+
+    for (len = 0, kp = 0; (kp = mprGetNextKey(hash, kp)) != 0; ) {
+        len += strlen(kp->key) + 2 + strlen(kp->data) + 1;
+    }
+    if ((headers = mprAlloc(len + 1)) == 0) {
+        return 0;
+    }
+    for (kp = 0, cp = headers; (kp = mprGetNextKey(hash, kp)) != 0; ) {
+        strcpy(cp, kp->key);
+        cp += strlen(cp);
+        *cp++ = ':';
+        *cp++ = ' ';
+        strcpy(cp, kp->data);
+        cp += strlen(cp);
+        *cp++ = '\n';
+    }
+    *cp = '\0';
+    return headers;
+}
+
+
+char *httpGetHeaders(HttpConn *conn)
+{
+    return httpGetHeadersFromHash(conn->rx->headers);
+}
+
+
+MprHash *httpGetHeaderHash(HttpConn *conn)
+{
+    if (conn->rx == 0) {
+        mprAssert(conn->rx);
+        return 0;
+    }
+    return conn->rx->headers;
+}
+
+
+cchar *httpGetQueryString(HttpConn *conn)
+{
+    return (conn->rx && conn->rx->parsedUri) ? conn->rx->parsedUri->query : 0;
+}
+
+
+int httpGetStatus(HttpConn *conn)
+{
+    return (conn->rx) ? conn->rx->status : 0;
+}
+
+
+char *httpGetStatusMessage(HttpConn *conn)
+{
+    return (conn->rx) ? conn->rx->statusMessage : 0;
+}
+
+
+void httpSetMethod(HttpConn *conn, cchar *method)
+{
+    conn->rx->method = sclone(method);
+    parseMethod(conn);
+}
+
+
+int httpSetUri(HttpConn *conn, cchar *uri, cchar *query)
+{
+    HttpRx      *rx;
+    HttpTx      *tx;
+    HttpUri     *prior;
+
+    rx = conn->rx;
+    tx = conn->tx;
+    prior = rx->parsedUri;
+
+    if ((rx->parsedUri = httpCreateUri(uri, 0)) == 0) {
+        return MPR_ERR_BAD_ARGS;
+    }
+    if (prior) {
+        if (rx->parsedUri->scheme == 0) {
+            rx->parsedUri->scheme = prior->scheme;
+        }
+        if (rx->parsedUri->port == 0) {
+            rx->parsedUri->port = prior->port;
+        }
+    }
+    if (query == 0 && prior) {
+        rx->parsedUri->query = prior->query;
+        rx->parsedUri->host = prior->host;
+    } else if (*query) {
+        rx->parsedUri->query = sclone(query);
+    }
+    /*
+        Start out with no scriptName and the entire URI in the pathInfo. Stages may rewrite.
+     */
+    rx->uri = rx->parsedUri->path;
+    rx->pathInfo = httpNormalizeUriPath(mprUriDecode(rx->parsedUri->path));
+    rx->scriptName = mprEmptyString();
+    tx->ext = httpGetExt(conn);
+    return 0;
+}
+
+
+static void waitHandler(HttpConn *conn, struct MprEvent *event)
+{
+    httpCallEvent(conn, event->mask);
+}
+
+
+/*
+    Wait for the connection to reach a given state.
+    @param state Desired state. Set to zero if you want to wait for one I/O event.
+    @param timeout Timeout in msec. If timeout is zer, wait forever. If timeout is < 0, use default inactivity 
+        and duration timeouts.
+ */
+int httpWait(HttpConn *conn, int state, MprTime timeout)
+{
+    MprTime     mark, remaining, inactivityTimeout;
+    int         eventMask, saveAsync, justOne, workDone;
+
+    if (state == 0) {
+        state = HTTP_STATE_COMPLETE;
+        justOne = 1;
+    } else {
+        justOne = 0;
+    }
+    if (conn->state <= HTTP_STATE_BEGIN) {
+        mprAssert(conn->state >= HTTP_STATE_BEGIN);
+        return MPR_ERR_BAD_STATE;
+    } 
+    if (conn->input && httpGetPacketLength(conn->input) > 0) {
+        httpPump(conn, conn->input);
+    }
+    mprAssert(conn->sock);
+    if (conn->error || !conn->sock) {
+        return MPR_ERR_BAD_STATE;
+    }
+    mark = mprGetTime();
+    if (mprGetDebugMode()) {
+        inactivityTimeout = timeout = MPR_MAX_TIMEOUT;
+    } else {
+        inactivityTimeout = timeout < 0 ? conn->limits->inactivityTimeout : MPR_MAX_TIMEOUT;
+        if (timeout < 0) {
+            timeout = conn->limits->requestTimeout;
+        }
+    }
+    saveAsync = conn->async;
+    conn->async = 1;
+
+    eventMask = MPR_READABLE;
+    if (!conn->connectorComplete) {
+        eventMask |= MPR_WRITABLE;
+    }
+    if (conn->state < state && !conn->stream) {
+        if (conn->waitHandler == 0) {
+            conn->waitHandler = mprCreateWaitHandler(conn->sock->fd, eventMask, conn->dispatcher, waitHandler, conn, 0);
+        } else {
+            mprWaitOn(conn->waitHandler, eventMask);
+        }
+    }
+    remaining = timeout;
+    do {
+        workDone = httpServiceQueues(conn);
+        if (conn->state < state) {
+            mprWaitForEvent(conn->dispatcher, min(inactivityTimeout, remaining));
+        }
+        if (conn->sock && mprIsSocketEof(conn->sock) && !workDone) {
+            break;
+        }
+        remaining = mprGetRemainingTime(mark, timeout);
+    } while (!justOne && !conn->error && conn->state < state && remaining > 0);
+
+    conn->async = saveAsync;
+    if (conn->sock == 0 || conn->error) {
+        return MPR_ERR_CANT_CONNECT;
+    }
+    if (!justOne && conn->state < state) {
+        return (remaining <= 0) ? MPR_ERR_TIMEOUT : MPR_ERR_CANT_READ;
+    }
+    return 0;
+}
+
+
+/*  
+    Set the connector as write blocked and can't proceed.
+ */
+void httpSocketBlocked(HttpConn *conn)
+{
+    mprLog(6, "Socket Blocked");
+    conn->writeBlocked = 1;
+}
+
+
+static void addMatchEtag(HttpConn *conn, char *etag)
+{
+    HttpRx   *rx;
+
+    rx = conn->rx;
+    if (rx->etags == 0) {
+        rx->etags = mprCreateList(-1, 0);
+    }
+    mprAddItem(rx->etags, etag);
+}
+
+
+/*
+    Get the next input token. The content buffer is advanced to the next token. This routine always returns a
+    non-zero token. The empty string means the delimiter was not found. The delimiter is a string to match and not
+    a set of characters. If null, it means use white space (space or tab) as a delimiter. 
+ */
+static char *getToken(HttpConn *conn, cchar *delim)
+{
+    MprBuf  *buf;
+    char    *token, *endToken, *nextToken;
+
+    buf = conn->input->content;
+    token = mprGetBufStart(buf);
+    nextToken = mprGetBufEnd(buf);
+    for (token = mprGetBufStart(buf); (*token == ' ' || *token == '\t') && token < mprGetBufEnd(buf); token++) {}
+
+    if (delim == 0) {
+        delim = " \t";
+        if ((endToken = strpbrk(token, delim)) != 0) {
+            nextToken = endToken + strspn(endToken, delim);
+            *endToken = '\0';
+        }
+    } else {
+        if ((endToken = strstr(token, delim)) != 0) {
+            *endToken = '\0';
+            /* Only eat one occurence of the delimiter */
+            nextToken = endToken + strlen(delim);
+        }
+    }
+    buf->start = nextToken;
+    return token;
+}
+
+
+/*
+    Select the header scanners. The SSE2 and AVX2 scanners test 16 or 32 bytes at a time and are only used if
+    supported by the CPU.
+ */
+int httpSetHeaderScanner(int level)
+{
+    int     best;
+
+    best = HTTP_SCAN_SCALAR;
+#if HTTP_SIMD
+    best = HTTP_SCAN_SSE2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        best = HTTP_SCAN_AVX2;
+    }
+#endif
+    if (level < 0 || level > best) {
+        level = best;
+    }
+    scanEndProc = scanEnd;
+    scanLineProc = scanLine;
+#if HTTP_SIMD
+    if (level == HTTP_SCAN_AVX2) {
+        scanEndProc = scanEndAvx2;
+        scanLineProc = scanLineAvx2;
+    } else if (level == HTTP_SCAN_SSE2) {
+        scanEndProc = scanEndSse2;
+        scanLineProc = scanLineSse2;
+    }
+#endif
+    scanLevel = level;
+    return level;
+}
+
+
+ssize httpScanHeaderEnd(cchar *buf, ssize len)
+{
+    if (scanLevel < 0) {
+        httpSetHeaderScanner(-1);
+    }
+    return (scanEndProc)((cuchar*) buf, len);
+}
+
+
+ssize httpScanLine(cchar *buf, ssize len)
+{
+    if (scanLevel < 0) {
+        httpSetHeaderScanner(-1);
+    }
+    return (scanLineProc)((cuchar*) buf, len);
+}
+
+
+static ssize scanEnd(cuchar *buf, ssize len)
+{
+    ssize   i;
+
+    for (i = 3; i < len; i++) {
+        if (buf[i] == '\n' && buf[i - 1] == '\r' && buf[i - 2] == '\n' && buf[i - 3] == '\r') {
+            return i - 3;
         }
     }
-    return 1;
+    return -1;
 }
 
 
 /*
-    Sends an 100 Continue response to the client. This bypasses the transmission pipeline, writing directly to the socket.
+    Return the offset of the first control character other than tab
  */
-static int sendContinue(HttpConn *conn)
+static ssize scanLine(cuchar *buf, ssize len)
 {
-    cchar      *response;
-
-    mprAssert(conn);
-    mprAssert(conn->sock);
+    ssize   i;
 
-    /* Write the response to the socket and flush. */
-    response = sfmt("%s 100 Continue\r\n\r\n", conn->protocol);
-    mprWriteSocket(conn->sock, response, slen(response));
-    mprFlushSocket(conn->sock);
-    return 0;
+    for (i = 0; i < len; i++) {
+        if ((buf[i] < 0x20 && buf[i] != '\t') || buf[i] == 0x7F) {
+            return i;
+        }
+    }
+    return -1;
 }
 
 
+#if HTTP_SIMD
 /*
-    Called once the HTTP request/response headers have been parsed
+    Compare the data at four successive offsets with CR LF CR LF. Each set bit of the mask marks the start of a match.
  */
-static bool processParsed(HttpConn *conn)
+static ssize scanEndSse2(cuchar *buf, ssize len)
 {
-    HttpRx      *rx;
+    __m128i     cr, lf, match;
+    ssize       i, offset;
+    int         mask;
 
-    rx = conn->rx;
-    if (!rx->form && conn->endpoint) {
-        /*
-            Routes need to be able to access form data, so forms will route later after all input is received.
-         */
-        routeRequest(conn);
+    cr = _mm_set1_epi8('\r');
+    lf = _mm_set1_epi8('\n');
+    for (i = 0; i + 19 <= len; i += 16) {
+        match = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i*) &buf[i]), cr),
+                          _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*) &buf[i + 1]), lf)),
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i*) &buf[i + 2]), cr),
+                          _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*) &buf[i + 3]), lf)));
+        if ((mask = _mm_movemask_epi8(match)) != 0) {
+            return i + __builtin_ctz(mask);
+        }
     }
-    if (rx->streamInput) {
-        httpStartPipeline(conn);
+    return ((offset = scanEnd(&buf[i], len - i)) < 0) ? -1 : i + offset;
+}
+
+
+static ssize scanLineSse2(cuchar *buf, ssize len)
+{
+    __m128i     data, ctl, tab, del, match;
+    ssize       i, offset;
+    int         mask;
+
+    ctl = _mm_set1_epi8(0x1F);
+    tab = _mm_set1_epi8('\t');
+    del = _mm_set1_epi8(0x7F);
+    for (i = 0; i + 16 <= len; i += 16) {
+        data = _mm_loadu_si128((__m128i*) &buf[i]);
+        /* Unsigned data <= 0x1F, except tab, or DEL */
+        match = _mm_cmpeq_epi8(_mm_max_epu8(data, ctl), ctl);
+        match = _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi8(data, tab), match), _mm_cmpeq_epi8(data, del));
+        if ((mask = _mm_movemask_epi8(match)) != 0) {
+            return i + __builtin_ctz(mask);
+        }
     }
-    /*
-        Send a 100 (Continue) response if the client has requested it. If the connection has an error, that takes
-        precedence and 100 Continue will not be sent. Also, if the connector has already written bytes to the socket, we
-        do not send 100 Continue to avoid corrupting the response.
-     */
-    if ((rx->flags & HTTP_EXPECT_CONTINUE) && !conn->error && !conn->tx->bytesWritten) {
-        sendContinue(conn);
-        rx->flags &= ~HTTP_EXPECT_CONTINUE;
+    return ((offset = scanLine(&buf[i], len - i)) < 0) ? -1 : i + offset;
+}
+
+
+__attribute__((target("avx2"))) static ssize scanEndAvx2(cuchar *buf, ssize len)
+{
+    __m256i     cr, lf, match;
+    ssize       i, offset;
+    uint        mask;
+
+    cr = _mm256_set1_epi8('\r');
+    lf = _mm256_set1_epi8('\n');
+    for (i = 0; i + 35 <= len; i += 32) {
+        match = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) &buf[i]), cr),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) &buf[i + 1]), lf)),
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) &buf[i + 2]), cr),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) &buf[i + 3]), lf)));
+        if ((mask = (uint) _mm256_movemask_epi8(match)) != 0) {
+            return i + __builtin_ctz(mask);
+        }
     }
-    httpSetState(conn, HTTP_STATE_CONTENT);
-    if (conn->workerEvent && conn->tx->started && rx->eof) {
-        httpSetState(conn, HTTP_STATE_READY);
-        return 0;
+    return ((offset = scanEndSse2(&buf[i], len - i)) < 0) ? -1 : i + offset;
+}
+
+
+__attribute__((target("avx2"))) static ssize scanLineAvx2(cuchar *buf, ssize len)
+{
+    __m256i     data, ctl, tab, del, match;
+    ssize       i, offset;
+    uint        mask;
+
+    ctl = _mm256_set1_epi8(0x1F);
+    tab = _mm256_set1_epi8('\t');
+    del = _mm256_set1_epi8(0x7F);
+    for (i = 0; i + 32 <= len; i += 32) {
+        data = _mm256_loadu_si256((__m256i*) &buf[i]);
+        match = _mm256_cmpeq_epi8(_mm256_max_epu8(data, ctl), ctl);
+        match = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi8(data, tab), match),
+            _mm256_cmpeq_epi8(data, del));
+        if ((mask = (uint) _mm256_movemask_epi8(match)) != 0) {
+            return i + __builtin_ctz(mask);
+        }
     }
-    return 1;
+    return ((offset = scanLineSse2(&buf[i], len - i)) < 0) ? -1 : i + offset;
 }
+#endif /* HTTP_SIMD */
 
 
-static bool analyseContent(HttpConn *conn, HttpPacket *packet)
+/*  
+    Match the entity's etag with the client's provided etag.
+ */
+bool httpMatchEtag(HttpConn *conn, char *requestedEtag)
 {
-    HttpRx      *rx;
-    HttpTx      *tx;
-    HttpQueue   *q;
-    MprBuf      *content;
-    ssize       nbytes;
+    HttpRx  *rx;
+    char    *tag;
+    int     next;
 
     rx = conn->rx;
-    if (rx->eof) {
+    if (rx->etags == 0) {
         return 1;
     }
-    tx = conn->tx;
-    content = packet->content;
-    q = tx->queue[HTTP_QUEUE_RX];
-    LOG(7, "processContent: packet of %d bytes, remaining %d", mprGetBufLength(content), rx->remainingContent);
-    
-    if ((nbytes = httpFilterChunkData(q, packet)) <= 0) {
-        return rx->eof ? 1 : 0;
-    }
-    rx->remainingContent -= nbytes;
-    rx->bytesRead += nbytes;
-    if (httpShouldTrace(conn, HTTP_TRACE_RX, HTTP_TRACE_BODY, tx->ext) >= 0) {
-        httpTraceContent(conn, HTTP_TRACE_RX, HTTP_TRACE_BODY, packet, nbytes, rx->bytesRead);
+    if (requestedEtag == 0) {
+        return 0;
     }
-    if (rx->bytesRead >= conn->limits->receiveBodySize) {
-        httpError(conn, HTTP_CLOSE | HTTP_CODE_REQUEST_TOO_LARGE, 
-            "Request body of %,Ld bytes is too big. Limit %,Ld", rx->bytesRead, conn->limits->receiveBodySize);
-        return 1;
+    for (next = 0; (tag = mprGetNextItem(rx->etags, &next)) != 0; ) {
+        if (strcmp(tag, requestedEtag) == 0) {
+            return (rx->ifMatch) ? 0 : 1;
+        }
     }
-    if (rx->form && rx->length >= conn->limits->receiveFormSize) {
-        httpError(conn, HTTP_CLOSE | HTTP_CODE_REQUEST_TOO_LARGE, 
-            "Request form of %,Ld bytes is too big. Limit %,Ld", rx->bytesRead, conn->limits->receiveFormSize);
+    return (rx->ifMatch) ? 1 : 0;
+}
+
+
+/*  
+    If an IF-MODIFIED-SINCE was specified, then return true if the resource has not been modified. If using
+    IF-UNMODIFIED, then return true if the resource was modified.
+ */
+bool httpMatchModified(HttpConn *conn, MprTime time)
+{
+    HttpRx   *rx;
+
+    rx = conn->rx;
+
+    if (rx->since == 0) {
+        /*  If-Modified or UnModified not supplied. */
         return 1;
     }
-    if (packet == rx->headerPacket && nbytes > 0) {
-        packet = httpSplitPacket(packet, 0);
-    }
-    if (httpGetPacketLength(packet) > nbytes) {
-        /*  Split excess data belonging to the next chunk or pipelined request */
-        LOG(7, "processContent: Split packet of %d at %d", httpGetPacketLength(packet), nbytes);
-        conn->input = httpSplitPacket(packet, nbytes);
+    if (rx->ifModified) {
+        /*  Return true if the file has not been modified.  */
+        return !(time > rx->since);
     } else {
-        conn->input = 0;
+        /*  Return true if the file has been modified.  */
+        return (time > rx->since);
     }
-    if (!(conn->finalized && conn->endpoint)) {
-        /* If conn->error, then finalized will also be true */
-        if (rx->form) {
-            httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+}
+
+
+/*  
+    Format is:  Range: bytes=n1-n2,n3-n4,...
+    Where n1 is first byte pos and n2 is last byte pos
+
+    Examples:
+        Range: 0-49             first 50 bytes
+        Range: 50-99,200-249    Two 50 byte ranges from 50 and 200
+        Range: -50              Last 50 bytes
+        Range: 1-               Skip first byte then emit the rest
+
+    Return 1 if more ranges, 0 if end of ranges, -1 if bad range.
+ */
+static bool parseRange(HttpConn *conn, char *value)
+{
+    HttpTx      *tx;
+    HttpRange   *range, *last, *next;
+    char        *tok, *ep;
+
+    tx = conn->tx;
+    value = sclone(value);
+    if (value == 0) {
+        return 0;
+    }
+    /*  
+        Step over the "bytes="
+     */
+    stok(value, "=", &value);
+
+    for (last = 0; value && *value; ) {
+        if ((range = mprAllocObj(HttpRange, manageRange)) == 0) {
+            return 0;
+        }
+        /*  
+            A range "-7" will set the start to -1 and end to 8
+         */
+        tok = stok(value, ",", &value);
+        if (*tok != '-') {
+            range->start = (ssize) stoi(tok);
         } else {
-            httpPutPacketToNext(q, packet);
+            range->start = -1;
+        }
+        range->end = -1;
+
+        if ((ep = strchr(tok, '-')) != 0) {
+            if (*++ep != '\0') {
+                /*
+                    End is one beyond the range. Makes the math easier.
+                 */
+                range->end = (ssize) stoi(ep) + 1;
+            }
+        }
+        if (range->start >= 0 && range->end >= 0) {
+            range->len = range->end - range->start;
+        }
+        if (last == 0) {
+            tx->outputRanges = range;
+        } else {
+            last->next = range;
+        }
+        last = range;
+    }
+
+    /*  
+        Validate ranges
+     */
+    for (range = tx->outputRanges; range; range = range->next) {
+        if (range->end != -1 && range->start >= range->end) {
+            return 0;
+        }
+        if (range->start < 0 && range->end < 0) {
+            return 0;
+        }
+        next = range->next;
+        if (range->start < 0 && next) {
+            /* This range goes to the end, so can't have another range afterwards */
+            return 0;
+        }
+        if (next) {
+            if (range->end < 0) {
+                return 0;
+            }
+            if (next->start >= 0 && range->end > next->start) {
+                return 0;
+            }
+        }
+    }
+    conn->tx->currentRange = tx->outputRanges;
+    return (last) ? 1: 0;
+}
+
+
+void httpSetStageData(HttpConn *conn, cchar *key, cvoid *data)
+{
+    HttpRx      *rx;
+
+    rx = conn->rx;
+    if (rx->requestData == 0) {
+        rx->requestData = mprCreateHash(-1, 0);
+    }
+    mprAddKey(rx->requestData, key, data);
+}
+
+
+cvoid *httpGetStageData(HttpConn *conn, cchar *key)
+{
+    HttpRx      *rx;
+
+    rx = conn->rx;
+    if (rx->requestData == 0) {
+        return NULL;
+    }
+    return mprLookupKey(rx->requestData, key);
+}
+
+
+char *httpGetPathExt(cchar *path)
+{
+    char    *ep, *ext;
+
+    if ((ext = strrchr(path, '.')) != 0) {
+        ext = sclone(++ext);
+        for (ep = ext; *ep && isalnum((uchar) *ep); ep++) {
+            ;
         }
+        *ep = '\0';
     }
-    if (rx->remainingContent == 0 && !(rx->flags & HTTP_CHUNKED)) {
-        rx->eof = 1;
-    }
-    return 1;
+    return ext;
 }
 
 
-/*  
-    Process request body data (typically post or put content)
+/*
+    Get the request extension. Look first at the URI pathInfo. If no extension, look at the filename if defined.
+    Return NULL if no extension.
  */
-static bool processContent(HttpConn *conn, HttpPacket *packet)
+char *httpGetExt(HttpConn *conn)
 {
-    HttpRx      *rx;
-    HttpQueue   *q;
+    HttpRx  *rx;
+    char    *ext;
 
     rx = conn->rx;
+    if ((ext = httpGetPathExt(rx->pathInfo)) == 0) {
+        if (conn->tx->filename) {
+            ext = httpGetPathExt(conn->tx->filename);
+        }
+    }
+    return ext;
+}
 
-    if (!packet) {
-        return 0;
+
+//  MOB - can this just use the default
+static int compareLang(char **s1, char **s2)
+{
+    return scmp(*s1, *s2);
+}
+
+
+HttpLang *httpGetLanguage(HttpConn *conn, MprHash *spoken, cchar *defaultLang)
+{
+    HttpRx      *rx;
+    HttpLang    *lang;
+    MprList     *list;
+    cchar       *accept;
+    char        *nextTok, *tok, *quality, *language;
+    int         next;
+
+    rx = conn->rx;
+    if (rx->lang) {
+        return rx->lang;
     }
-    if (!analyseContent(conn, packet)) {
+    if (spoken == 0) {
         return 0;
     }
-    if (rx->eof) {
-        q = conn->tx->queue[HTTP_QUEUE_RX];
-        if (!conn->finalized) {
-            if (rx->form && conn->endpoint) {
-                /* Forms wait for all data before routing */
-                routeRequest(conn);
-                while ((packet = httpGetPacket(q)) != 0) {
-                    httpPutPacketToNext(q, packet);
-                }
+    list = mprCreateList(-1, 0);
+    if ((accept = httpGetHeader(conn, "Accept-Language")) != 0) {
+        for (tok = stok(sclone(accept), ",", &nextTok); tok; tok = stok(nextTok, ",", &nextTok)) {
+            language = stok(tok, ";", &quality);
+            if (quality == 0) {
+                quality = "1";
             }
-            httpPutPacketToNext(q, httpCreateEndPacket());
-            if (!rx->streamInput) {
-                httpStartPipeline(conn);
+            mprAddItem(list, sfmt("%03d %s", (int) (atof(quality) * 100), language));
+        }
+        mprSortList(list, (MprSortProc) compareLang, 0);
+        for (next = 0; (language = mprGetNextItem(list, &next)) != 0; ) {
+            if ((lang = mprLookupKey(rx->route->languages, &language[4])) != 0) {
+                rx->lang = lang;
+                return lang;
             }
         }
-        httpSetState(conn, HTTP_STATE_READY);
-        return conn->workerEvent ? 0 : 1;
     }
-    httpServiceQueues(conn);
-    return conn->error || (conn->input ? httpGetPacketLength(conn->input) : 0);
+    if (defaultLang && (lang = mprLookupKey(rx->route->languages, defaultLang)) != 0) {
+        rx->lang = lang;
+        return lang;
+    }
+    return 0;
 }
 
 
 /*
-    In the ready state after all content has been received
+    Trim extra path information after the uri extension. This is used by CGI and PHP only. The strategy is to 
+    heuristically find the script name in the uri. This is assumed to be the original uri up to and including 
+    first path component containing a "." Any path information after that is regarded as extra path.
+    WARNING: Extra path is an old, unreliable, CGI specific technique. Do not use directories with embedded periods.
  */
-static bool processReady(HttpConn *conn)
+void httpTrimExtraPath(HttpConn *conn)
 {
-    httpReadyHandler(conn);
-    httpSetState(conn, HTTP_STATE_RUNNING);
-    return 1;
+    HttpRx      *rx;
+    char        *cp, *extra;
+    ssize       len;
+
+    rx = conn->rx;
+    if (!(rx->flags & (HTTP_OPTIONS | HTTP_TRACE))) { 
+        if ((cp = strchr(rx->pathInfo, '.')) != 0 && (extra = strchr(cp, '/')) != 0) {
+            len = extra - rx->pathInfo;
+            if (0 < len && len < slen(rx->pathInfo)) {
+                rx->extraPath = sclone(&rx->pathInfo[len]);
+                rx->pathInfo[len] = '\0';
+            }
+        }
+        if ((cp = strchr(rx->target, '.')) != 0 && (extra = strchr(cp, '/')) != 0) {
+            len = extra - rx->target;
+            if (0 < len && len < slen(rx->target)) {
+                rx->target[len] = '\0';
+            }
+        }
+    }
 }
 
 
 /*
-    Note: may be called multiple times in response to output I/O events
+    @copy   default
+
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
+
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a 
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
+
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
+
+    @end
  */
-static bool processRunning(HttpConn *conn)
-{
-    HttpQueue   *q;
-    int         canProceed;
 
-    q = conn->writeq;
-    canProceed = 1;
-    httpServiceQueues(conn);
+/************************************************************************/
+/*
+    Start of file "src/sendConnector.c"
+ */
+/************************************************************************/
 
-    if (conn->endpoint) {
-        /* Server side */
-        if (conn->finalized) {
-            if (!conn->connectorComplete) {
-                /* Wait for Tx I/O event. Do suspend incase handler not using auto-flow routines */
-                conn->writeBlocked = 1;
-                httpSuspendQueue(q);
-                httpEnableConnEvents(q->conn);
-                canProceed = 0;
-            }
-        } else if (!httpProcessHandler(conn)) {
-            /* No process callback defined */
-            canProceed = 0;
-        } else if (q->count == 0) {
-            /* Queue is empty and data may have drained above in httpServiceQueues. Yield to reclaim memory. */
-            mprYield(0);
-        } else if (q->count < q->low) {
-            if (q->flags & HTTP_QUEUE_SUSPENDED) {
-                httpResumeQueue(q);
-            }
-        } else {
-            conn->writeBlocked = 1;
-            httpSuspendQueue(q);
-            httpEnableConnEvents(q->conn);
-            canProceed = 0;
-        }
-    } else {
-        /* Client side */
-        httpServiceQueues(conn);
-        httpFinalize(conn);
-        httpSetState(conn, HTTP_STATE_COMPLETE);
-    }
-    return canProceed;
-}
+/*
+    sendConnector.c -- Send file connector. 
 
+    The Sendfile connector supports the optimized transmission of whole static files. It uses operating system 
+    sendfile APIs to eliminate reading the document into user space and multiple socket writes. The send connector 
+    is not a general purpose connector. It cannot handle dynamic data. It does support chunked and ranged requests. 
+    Ranged requests are sent as one file packet per range with the multipart boundaries written via the IO vector.
 
-#if BIT_DEBUG
-static void measure(HttpConn *conn)
+    Copyright (c) All Rights Reserved. See details at the end of the file.
+ */
+
+/********************************* Includes ***********************************/
+
+
+
+/**************************** Forward Declarations ****************************/
+#if !BIT_ROM
+
+static void addPacketForSend(HttpQueue *q, HttpPacket *packet);
+static void adjustSendVec(HttpQueue *q, MprOff written);
+static MprOff buildSendVec(HttpQueue *q);
+static void adjustPacketData(HttpQueue *q, MprOff written);
+
+/*********************************** Code *************************************/
+
+int httpOpenSendConnector(Http *http)
 {
-    MprTime     elapsed;
-    HttpTx      *tx;
-    cchar       *uri;
-    int         level;
+    HttpStage     *stage;
 
-    tx = conn->tx;
-    if (conn->rx == 0 || tx == 0) {
-        return;
-    }
-    uri = (conn->endpoint) ? conn->rx->uri : tx->parsedUri->path;
-   
-    if ((level = httpShouldTrace(conn, HTTP_TRACE_TX, HTTP_TRACE_TIME, tx->ext)) >= 0) {
-        elapsed = mprGetTime() - conn->startTime;
-#if MPR_HIGH_RES_TIMER
-        if (elapsed < 1000) {
-            mprLog(level, "TIME: Request %s took %,d msec %,d ticks", uri, elapsed, mprGetTicks() - conn->startTicks);
-        } else
-#endif
-            mprLog(level, "TIME: Request %s took %,d msec", uri, elapsed);
+    mprLog(5, "Open send connector");
+    if ((stage = httpCreateConnector(http, "sendConnector", HTTP_STAGE_ALL, NULL)) == 0) {
+        return MPR_ERR_CANT_CREATE;
     }
+    stage->open = httpSendOpen;
+    stage->close = httpSendClose;
+    stage->outgoingService = httpSendOutgoingService; 
+    http->sendConnector = stage;
+    return 0;
 }
-#else
-#define measure(conn)
-#endif
 
 
-static bool processCompletion(HttpConn *conn)
+/*  
+    Initialize the send connector for a request
+ */
+void httpSendOpen(HttpQueue *q)
 {
-    HttpPacket  *packet;
-    HttpRx      *rx;
-    bool        more;
-
-    rx = conn->rx;
-    mprAssert(conn->state == HTTP_STATE_COMPLETE);
+    HttpConn    *conn;
+    HttpTx      *tx;
 
-    httpDestroyPipeline(conn);
-    measure(conn);
-    if (conn->endpoint && rx) {
-        if (rx->route && rx->route->log) {
-            httpLogRequest(conn);
+    conn = q->conn;
+    tx = conn->tx;
+
+    if (tx->connector != conn->http->sendConnector) {
+        httpAssignQueue(q, tx->connector, HTTP_QUEUE_TX);
+        tx->connector->open(q);
+        return;
+    }
+    if (!(tx->flags & HTTP_TX_NO_BODY)) {
+        mprAssert(tx->fileInfo.valid);
+        if (tx->fileInfo.size > conn->limits->transmissionBodySize) {
+            httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_TOO_LARGE,
+                "Http transmission aborted. File size exceeds max body of %,Ld bytes", conn->limits->transmissionBodySize);
+            return;
         }
-        httpValidateLimits(conn->endpoint, HTTP_VALIDATE_CLOSE_REQUEST, conn);
-        rx->conn = 0;
-        conn->tx->conn = 0;
-        conn->rx = 0;
-        conn->tx = 0;
-        packet = conn->input;
-        more = packet && !conn->connError && (httpGetPacketLength(packet) > 0);
-        if (conn->sock) {
-            httpPrepServerConn(conn);
+        tx->file = mprOpenFile(tx->filename, O_RDONLY | O_BINARY, 0);
+        if (tx->file == 0) {
+            httpError(conn, HTTP_CODE_NOT_FOUND, "Can't open document: %s, err %d", tx->filename, mprGetError());
         }
-        return more;
     }
-    return 0;
 }
 
 
-void httpCloseRx(HttpConn *conn)
+void httpSendClose(HttpQueue *q)
 {
-    if (!conn->rx->eof) {
-        /* May not have consumed all read data, so can't be assured the next request will be okay */
-        conn->keepAliveCount = -1;
-    }
-    if (conn->state < HTTP_STATE_COMPLETE && !conn->inHttpProcess) {
-        httpPump(conn, NULL);
+    HttpTx  *tx;
+
+    tx = q->conn->tx;
+    if (tx->file) {
+        mprCloseFile(tx->file);
+        tx->file = 0;
     }
 }
 
 
-bool httpContentNotModified(HttpConn *conn)
+void httpSendOutgoingService(HttpQueue *q)
 {
-    HttpRx      *rx;
+    HttpConn    *conn;
     HttpTx      *tx;
-    MprTime     modified;
-    bool        same;
+    MprFile     *file;
+    MprOff      written;
+    int         errCode;
 
-    rx = conn->rx;
+    conn = q->conn;
     tx = conn->tx;
+    conn->lastActivity = conn->http->now;
+    mprAssert(conn->sock);
 
-    if (rx->flags & HTTP_IF_MODIFIED) {
-        /*  
-            If both checks, the last modification time and etag, claim that the request doesn't need to be
-            performed, skip the transfer.
-         */
-        mprAssert(tx->fileInfo.valid);
-        modified = (MprTime) tx->fileInfo.mtime * MPR_TICKS_PER_SEC;
-        same = httpMatchModified(conn, modified) && httpMatchEtag(conn, tx->etag);
-        if (tx->outputRanges && !same) {
-            tx->outputRanges = 0;
+    if (!conn->sock || conn->connectorComplete) {
+        return;
+    }
+    if (tx->flags & HTTP_TX_NO_BODY) {
+        httpDiscardQueueData(q, 1);
+    }
+    if ((tx->bytesWritten + q->ioCount) > conn->limits->transmissionBodySize) {
+        httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_TOO_LARGE | ((tx->bytesWritten) ? HTTP_ABORT : 0),
+            "Http transmission aborted. Exceeded max body of %,Ld bytes", conn->limits->transmissionBodySize);
+        if (tx->bytesWritten) {
+            httpConnectorComplete(conn);
+            return;
         }
-        return same;
     }
-    return 0;
-}
+    /*
+        Loop doing non-blocking I/O until blocked or all the packets received are written.
+     */
+    while (1) {
+        /*
+            Rebuild the iovector only when the past vector has been completely written. Simplifies the logic quite a bit.
+         */
+        if (q->ioIndex == 0 && buildSendVec(q) <= 0) {
+            break;
+        }
+        if (!httpFlushDeferred(conn)) {
+            /* Prior pipelined responses must be written first */
+            httpSocketBlocked(conn);
+            break;
+        }
+        file = q->ioFile ? tx->file : 0;
+        written = mprSendFileToSocket(conn->sock, file, q->ioPos, q->ioCount, q->iovec, q->ioIndex, NULL, 0);
 
+        mprLog(8, "Send connector ioCount %d, wrote %Ld, written so far %Ld, sending file %d, q->count %d/%d", 
+                q->ioCount, written, tx->bytesWritten, q->ioFile, q->count, q->max);
+        if (written < 0) {
+            errCode = mprGetError(q);
+            if (errCode == EAGAIN || errCode == EWOULDBLOCK) {
+                /* Socket is full. Wait for an I/O event */
+                httpSocketBlocked(conn);
+                break;
+            }
+            if (errCode != EPIPE && errCode != ECONNRESET) {
+                mprLog(7, "SendFileToSocket failed, errCode %d", errCode);
+            }
+            httpError(conn, HTTP_ABORT | HTTP_CODE_COMMS_ERROR, "SendFileToSocket failed, errCode %d", errCode);
+            httpConnectorComplete(conn);
+            break;
 
-HttpRange *httpCreateRange(HttpConn *conn, MprOff start, MprOff end)
-{
-    HttpRange     *range;
+        } else if (written == 0) {
+            /* Socket is full. Wait for an I/O event */
+            httpSocketBlocked(conn);
+            break;
 
-    if ((range = mprAllocObj(HttpRange, manageRange)) == 0) {
-        return 0;
+        } else if (written > 0) {
+            tx->bytesWritten += written;
+            adjustPacketData(q, written);
+            adjustSendVec(q, written);
+        }
+    }
+    if (q->ioCount == 0) {
+        if ((q->flags & HTTP_QUEUE_EOF)) {
+            httpConnectorComplete(conn);
+        } else {
+            httpNotifyWritable(conn);
+        }
     }
-    range->start = start;
-    range->end = end;
-    range->len = end - start;
-    return range;
 }
 
 
-static void manageRange(HttpRange *range, int flags)
+/*  
+    Build the IO vector. This connector uses the send file API which permits multiple IO blocks to be written with 
+    file data. This is used to write transfer the headers and chunk encoding boundaries. Return the count of bytes to 
+    be written. Return -1 for EOF.
+ */
+static MprOff buildSendVec(HttpQueue *q)
 {
-    if (flags & MPR_MANAGE_MARK) {
-        mprMark(range->next);
+    HttpConn    *conn;
+    HttpPacket  *packet;
+
+    mprAssert(q->ioIndex == 0);
+
+    conn = q->conn;
+    q->ioCount = 0;
+    q->ioFile = 0;
+
+    /*  
+        Examine each packet and accumulate as many packets into the I/O vector as possible. Can only have one data packet at
+        a time due to the limitations of the sendfile API (on Linux). And the data packet must be after all the 
+        vector entries. Leave the packets on the queue for now, they are removed after the IO is complete for the 
+        entire packet.
+     */
+    for (packet = q->first; packet; packet = packet->next) {
+        if (packet->flags & HTTP_PACKET_HEADER) {
+            httpWriteHeaders(conn, packet);
+            q->count += httpGetPacketLength(packet);
+            
+        } else if (httpGetPacketLength(packet) == 0 && packet->esize == 0) {
+            q->flags |= HTTP_QUEUE_EOF;
+            if (packet->prefix == NULL) {
+                break;
+            }
+        }
+        if (q->ioFile || q->ioIndex >= (HTTP_MAX_IOVEC - 2)) {
+            break;
+        }
+        addPacketForSend(q, packet);
     }
+    return q->ioCount;
 }
 
 
-MprOff httpGetContentLength(HttpConn *conn)
+/*  
+    Add one entry to the io vector
+ */
+static void addToSendVector(HttpQueue *q, char *ptr, ssize bytes)
 {
-    if (conn->rx == 0) {
-        mprAssert(conn->rx);
-        return 0;
-    }
-    return conn->rx->length;
+    mprAssert(ptr > 0);
+    mprAssert(bytes > 0);
+
+    q->iovec[q->ioIndex].start = ptr;
+    q->iovec[q->ioIndex].len = bytes;
+    q->ioCount += bytes;
+    q->ioIndex++;
 }
 
 
-cchar *httpGetCookies(HttpConn *conn)
+/*  
+    Add a packet to the io vector. Return the number of bytes added to the vector.
+ */
+static void addPacketForSend(HttpQueue *q, HttpPacket *packet)
 {
-    if (conn->rx == 0) {
-        mprAssert(conn->rx);
-        return 0;
+    HttpTx      *tx;
+    HttpConn    *conn;
+    int         item;
+
+    conn = q->conn;
+    tx = conn->tx;
+    
+    mprAssert(q->count >= 0);
+    mprAssert(q->ioIndex < (HTTP_MAX_IOVEC - 2));
+
+    if (packet->prefix) {
+        addToSendVector(q, mprGetBufStart(packet->prefix), mprGetBufLength(packet->prefix));
+    }
+    if (packet->esize > 0) {
+        mprAssert(q->ioFile == 0);
+        q->ioFile = 1;
+        q->ioPos = packet->epos;
+        q->ioCount += packet->esize;
+
+    } else if (httpGetPacketLength(packet) > 0) {
+        /*
+            Header packets have actual content. File data packets are virtual and only have a count.
+         */
+        addToSendVector(q, mprGetBufStart(packet->content), httpGetPacketLength(packet));
+        item = (packet->flags & HTTP_PACKET_HEADER) ? HTTP_TRACE_HEADER : HTTP_TRACE_BODY;
+        if (httpShouldTrace(conn, HTTP_TRACE_TX, item, tx->ext) >= 0) {
+            httpTraceContent(conn, HTTP_TRACE_TX, item, packet, 0, tx->bytesWritten);
+        }
     }
-    return conn->rx->cookie;
 }
 
 
-cchar *httpGetHeader(HttpConn *conn, cchar *key)
+/*  
+    Clear entries from the IO vector that have actually been transmitted. This supports partial writes due to the socket
+    being full. Don't come here if we've seen all the packets and all the data has been completely written. ie. small files
+    don't come here.
+ */
+static void adjustPacketData(HttpQueue *q, MprOff bytes)
 {
-    if (conn->rx == 0) {
-        mprAssert(conn->rx);
-        return 0;
+    HttpPacket  *packet;
+    ssize       len;
+
+    mprAssert(q->first);
+    mprAssert(q->count >= 0);
+    mprAssert(bytes >= 0);
+
+    while ((packet = q->first) != 0) {
+        if (packet->prefix) {
+            len = mprGetBufLength(packet->prefix);
+            len = (ssize) min(len, bytes);
+            mprAdjustBufStart(packet->prefix, len);
+            bytes -= len;
+            /* Prefixes don't count in the q->count. No need to adjust */
+            if (mprGetBufLength(packet->prefix) == 0) {
+                packet->prefix = 0;
+            }
+        }
+        if (packet->esize) {
+            len = (ssize) min(packet->esize, bytes);
+            packet->esize -= len;
+            packet->epos += len;
+            bytes -= len;
+            mprAssert(packet->esize >= 0);
+            mprAssert(bytes == 0);
+            if (packet->esize > 0) {
+                break;
+            }
+        } else if ((len = httpGetPacketLength(packet)) > 0) {
+            len = (ssize) min(len, bytes);
+            mprAdjustBufStart(packet->content, len);
+            bytes -= len;
+            q->count -= len;
+            mprAssert(q->count >= 0);
+        }
+        if (httpGetPacketLength(packet) == 0) {
+            httpGetPacket(q);
+        }
+        mprAssert(bytes >= 0);
+        if (bytes == 0 && (q->first == NULL || !(q->first->flags & HTTP_PACKET_END))) {
+            break;
+        }
     }
-    return mprLookupKey(conn->rx->headers, slower(key));
 }
 
 
-char *httpGetHeadersFromHash(MprHash *hash)
+/*  
+    Clear entries from the IO vector that have actually been transmitted. This supports partial writes due to the socket
+    being full. Don't come here if we've seen all the packets and all the data has been completely written. ie. small files
+    don't come here.
+ */
+static void adjustSendVec(HttpQueue *q, MprOff written)
 {
-    MprKey      *kp;
-    char        *headers, *cp;
+    MprIOVec    *iovec;
     ssize       len;
+    int         i, j;
 
-    for (len = 0, kp = 0; (kp = mprGetNextKey(hash, kp)) != 0; ) {
-        len += strlen(kp->key) + 2 + strlen(kp->data) + 1;
-    }
-    if ((headers = mprAlloc(len + 1)) == 0) {
-        return 0;
+    iovec = q->iovec;
+    for (i = 0; i < q->ioIndex; i++) {
+        len = iovec[i].len;
+        if (written < len) {
+            iovec[i].start += (ssize) written;
+            iovec[i].len -= (ssize) written;
+            return;
+        }
+        written -= len;
+        q->ioCount -= len;
+        for (j = i + 1; i < q->ioIndex; ) {
+            iovec[j++] = iovec[i++];
+        }
+        q->ioIndex--;
+        i--;
     }
-    for (kp = 0, cp = headers; (kp = mprGetNextKey(hash, kp)) != 0; ) {
-        strcpy(cp, kp->key);
-        cp += strlen(cp);
-        *cp++ = ':';
-        *cp++ = ' ';
-        strcpy(cp, kp->data);
-        cp += strlen(cp);
-        *cp++ = '\n';
+    if (written > 0 && q->ioFile) {
+        /* All remaining data came from the file */
+        q->ioPos += written;
     }
-    *cp = '\0';
-    return headers;
+    q->ioIndex = 0;
+    q->ioCount = 0;
+    q->ioFile = 0;
 }
 
 
-char *httpGetHeaders(HttpConn *conn)
-{
-    return httpGetHeadersFromHash(conn->rx->headers);
-}
+#else
+int httpOpenSendConnector(Http *http) { return 0; }
+void httpSendOpen(HttpQueue *q) {}
+void httpSendOutgoingService(HttpQueue *q) {}
+#endif /* !BIT_ROM */
 
+/*
+    @copy   default
 
-MprHash *httpGetHeaderHash(HttpConn *conn)
-{
-    if (conn->rx == 0) {
-        mprAssert(conn->rx);
-        return 0;
-    }
-    return conn->rx->headers;
-}
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
 
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a 
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
 
-cchar *httpGetQueryString(HttpConn *conn)
-{
-    return (conn->rx && conn->rx->parsedUri) ? conn->rx->parsedUri->query : 0;
-}
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
 
+    @end
+ */
 
-int httpGetStatus(HttpConn *conn)
-{
-    return (conn->rx) ? conn->rx->status : 0;
-}
+/************************************************************************/
+/*
+    Start of file "src/session.c"
+ */
+/************************************************************************/
+
+/**
+    httpSession.c - Session data storage
 
+    Copyright (c) All Rights Reserved. See details at the end of the file.
+ */
 
-char *httpGetStatusMessage(HttpConn *conn)
-{
-    return (conn->rx) ? conn->rx->statusMessage : 0;
-}
+/********************************** Includes **********************************/
 
 
-void httpSetMethod(HttpConn *conn, cchar *method)
-{
-    conn->rx->method = sclone(method);
-    parseMethod(conn);
-}
 
+/********************************** Forwards  *********************************/
 
-int httpSetUri(HttpConn *conn, cchar *uri, cchar *query)
+static void cryptSession(cchar *key, cchar *nonce, char *buf, ssize len);
+static void deriveKey(cchar *key, cchar *purpose, char *result);
+static char *getCookie(HttpConn *conn, cchar *name);
+static MprList *getSessionKeys(HttpConn *conn);
+static int loadSession(HttpSession *sp);
+static char *makeKey(HttpSession *sp);
+static char *makeSessionID(HttpConn *conn);
+static void manageSession(HttpSession *sp, int flags);
+static char *parseField(cchar **cp, cchar *end);
+static int parseSession(MprHash *data, cchar *record, cchar *end);
+static HttpSession *readClientSession(HttpConn *conn);
+static char *serializeSession(MprHash *data);
+static int writeClientSession(HttpConn *conn, HttpSession *sp);
+static int writeServerSession(HttpConn *conn, HttpSession *sp);
+
+/************************************* Code ***********************************/
+
+/*
+    Allocate a session object. If the ID is supplied, the session record is loaded from the cache. If there is no
+    record for the ID, the ID is not trusted and a new session is created with a new ID. The record for a new session
+    is written immediately so later requests find it even if no session variables are set. The session limit applies
+    to the number of session records in the cache, so sessions are released when their records expire.
+ */
+HttpSession *httpAllocSession(HttpConn *conn, cchar *id, MprTime lifespan)
 {
-    HttpRx      *rx;
-    HttpTx      *tx;
-    HttpUri     *prior;
+    Http        *http;
+    HttpSession *sp;
 
-    rx = conn->rx;
-    tx = conn->tx;
-    prior = rx->parsedUri;
+    mprAssert(conn);
+    http = conn->http;
 
-    if ((rx->parsedUri = httpCreateUri(uri, 0)) == 0) {
-        return MPR_ERR_BAD_ARGS;
+    if ((sp = mprAllocObj(HttpSession, manageSession)) == 0) {
+        return 0;
     }
-    if (prior) {
-        if (rx->parsedUri->scheme == 0) {
-            rx->parsedUri->scheme = prior->scheme;
-        }
-        if (rx->parsedUri->port == 0) {
-            rx->parsedUri->port = prior->port;
+    mprSetName(sp, "session");
+    sp->lifespan = lifespan;
+    sp->cache = conn->http->sessionCache;
+    if (id) {
+        sp->id = sclone(id);
+        if (loadSession(sp) == 0) {
+            return sp;
         }
+        mprLog(4, "No session record for %s, create a new session", id);
     }
-    if (query == 0 && prior) {
-        rx->parsedUri->query = prior->query;
-        rx->parsedUri->host = prior->host;
-    } else if (*query) {
-        rx->parsedUri->query = sclone(query);
+    sp->id = makeSessionID(conn);
+    sp->data = mprCreateHash(HTTP_SMALL_HASH_SIZE, 0);
+    sp->changes = mprCreateHash(HTTP_SMALL_HASH_SIZE, MPR_HASH_STATIC_VALUES);
+    sp->version = 0;
+#if FUTURE
+    sp->cache= mprCreateCache(0);
+#endif
+    lock(http);
+    if (mprGetCacheLength(sp->cache) >= conn->limits->sessionMax || writeServerSession(conn, sp) < 0) {
+        unlock(http);
+        return 0;
     }
-    /*
-        Start out with no scriptName and the entire URI in the pathInfo. Stages may rewrite.
-     */
-    rx->uri = rx->parsedUri->path;
-    rx->pathInfo = httpNormalizeUriPath(mprUriDecode(rx->parsedUri->path));
-    rx->scriptName = mprEmptyString();
-    tx->ext = httpGetExt(conn);
-    return 0;
-}
-
-
-static void waitHandler(HttpConn *conn, struct MprEvent *event)
-{
-    httpCallEvent(conn, event->mask);
+    unlock(http);
+    return sp;
 }
 
 
 /*
-    Wait for the connection to reach a given state.
-    @param state Desired state. Set to zero if you want to wait for one I/O event.
-    @param timeout Timeout in msec. If timeout is zer, wait forever. If timeout is < 0, use default inactivity 
-        and duration timeouts.
+    Client sessions are destroyed by clearing the session cookie when the response headers are written
  */
-int httpWait(HttpConn *conn, int state, MprTime timeout)
+void httpDestroySession(HttpSession *sp)
 {
-    MprTime     mark, remaining, inactivityTimeout;
-    int         eventMask, saveAsync, justOne, workDone;
-
-    if (state == 0) {
-        state = HTTP_STATE_COMPLETE;
-        justOne = 1;
-    } else {
-        justOne = 0;
-    }
-    if (conn->state <= HTTP_STATE_BEGIN) {
-        mprAssert(conn->state >= HTTP_STATE_BEGIN);
-        return MPR_ERR_BAD_STATE;
-    } 
-    if (conn->input && httpGetPacketLength(conn->input) > 0) {
-        httpPump(conn, conn->input);
-    }
-    mprAssert(conn->sock);
-    if (conn->error || !conn->sock) {
-        return MPR_ERR_BAD_STATE;
-    }
-    mark = mprGetTime();
-    if (mprGetDebugMode()) {
-        inactivityTimeout = timeout = MPR_MAX_TIMEOUT;
+    mprAssert(sp);
+    if (sp->store == HTTP_SESSION_CLIENT) {
+        sp->data = mprCreateHash(HTTP_SMALL_HASH_SIZE, 0);
+        sp->changes = mprCreateHash(HTTP_SMALL_HASH_SIZE, MPR_HASH_STATIC_VALUES);
     } else {
-        inactivityTimeout = timeout < 0 ? conn->limits->inactivityTimeout : MPR_MAX_TIMEOUT;
-        if (timeout < 0) {
-            timeout = conn->limits->requestTimeout;
+        if (sp->id) {
+            mprRemoveCache(sp->cache, makeKey(sp));
         }
+        sp->changes = 0;
     }
-    saveAsync = conn->async;
-    conn->async = 1;
+    sp->id = 0;
+}
 
-    eventMask = MPR_READABLE;
-    if (!conn->connectorComplete) {
-        eventMask |= MPR_WRITABLE;
-    }
-    if (conn->state < state) {
-        if (conn->waitHandler == 0) {
-            conn->waitHandler = mprCreateWaitHandler(conn->sock->fd, eventMask, conn->dispatcher, waitHandler, conn, 0);
-        } else {
-            mprWaitOn(conn->waitHandler, eventMask);
-        }
-    }
-    remaining = timeout;
-    do {
-        workDone = httpServiceQueues(conn);
-        if (conn->state < state) {
-            mprWaitForEvent(conn->dispatcher, min(inactivityTimeout, remaining));
-        }
-        if (conn->sock && mprIsSocketEof(conn->sock) && !workDone) {
-            break;
-        }
-        remaining = mprGetRemainingTime(mark, timeout);
-    } while (!justOne && !conn->error && conn->state < state && remaining > 0);
 
-    conn->async = saveAsync;
-    if (conn->sock == 0 || conn->error) {
-        return MPR_ERR_CANT_CONNECT;
-    }
-    if (!justOne && conn->state < state) {
-        return (remaining <= 0) ? MPR_ERR_TIMEOUT : MPR_ERR_CANT_READ;
+static void manageSession(HttpSession *sp, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(sp->id);
+        mprMark(sp->cache);
+        mprMark(sp->data);
+        mprMark(sp->changes);
     }
-    return 0;
 }
 
 
-/*  
-    Set the connector as write blocked and can't proceed.
+HttpSession *httpCreateSession(HttpConn *conn)
+{
+    return httpGetSession(conn, 1);
+}
+
+
+/*
+    Routes using the client store first look for a session cookie. Sessions that have been moved to the server store
+    are identified by the session ID cookie.
  */
-void httpSocketBlocked(HttpConn *conn)
+HttpSession *httpGetSession(HttpConn *conn, int create)
 {
-    mprLog(6, "Socket Blocked");
-    conn->writeBlocked = 1;
+    HttpRx      *rx;
+    HttpSession *sp;
+    char        *id;
+    int         client;
+
+    mprAssert(conn);
+    rx = conn->rx;
+    mprAssert(rx);
+    if (rx->session || !conn) {
+        return rx->session;
+    }
+    client = rx->route && (rx->route->sessionStore & HTTP_SESSION_CLIENT);
+    if (client && (rx->session = readClientSession(conn)) != 0) {
+        return rx->session;
+    }
+    id = httpGetSessionID(conn);
+    if (id || create) {
+        if (client && !id) {
+            /* New client sessions do not count against the session limit and need no locking */
+            if ((sp = mprAllocObj(HttpSession, manageSession)) == 0) {
+                return 0;
+            }
+            mprSetName(sp, "session");
+            sp->store = HTTP_SESSION_CLIENT;
+            sp->lifespan = conn->limits->sessionTimeout;
+            sp->cache = conn->http->sessionCache;
+            sp->id = makeSessionID(conn);
+            sp->data = mprCreateHash(HTTP_SMALL_HASH_SIZE, 0);
+            rx->session = sp;
+        } else {
+            rx->session = httpAllocSession(conn, id, conn->limits->sessionTimeout);
+            if (rx->session && (!id || !smatch(rx->session->id, id))) {
+                httpSetCookie(conn, HTTP_SESSION_COOKIE, rx->session->id, "/", NULL, 0, conn->secure);
+            }
+        }
+    }
+    return rx->session;
 }
 
 
-static void addMatchEtag(HttpConn *conn, char *etag)
+MprHash *httpGetSessionObj(HttpConn *conn, cchar *key)
 {
-    HttpRx   *rx;
+    cchar   *str;
 
-    rx = conn->rx;
-    if (rx->etags == 0) {
-        rx->etags = mprCreateList(-1, 0);
+    if ((str = httpGetSessionVar(conn, key, 0)) != 0 && *str) {
+        mprAssert(*str == '{');
+        return mprDeserialize(str);
     }
-    mprAddItem(rx->etags, etag);
+    return 0;
 }
 
 
-/*
-    Get the next input token. The content buffer is advanced to the next token. This routine always returns a
-    non-zero token. The empty string means the delimiter was not found. The delimiter is a string to match and not
-    a set of characters. If null, it means use white space (space or tab) as a delimiter. 
- */
-static char *getToken(HttpConn *conn, cchar *delim)
+cchar *httpGetSessionVar(HttpConn *conn, cchar *key, cchar *defaultValue)
 {
-    MprBuf  *buf;
-    char    *token, *endToken, *nextToken;
+    HttpSession  *sp;
+    cchar       *result;
 
-    buf = conn->input->content;
-    token = mprGetBufStart(buf);
-    nextToken = mprGetBufEnd(buf);
-    for (token = mprGetBufStart(buf); (*token == ' ' || *token == '\t') && token < mprGetBufEnd(buf); token++) {}
+    mprAssert(conn);
+    mprAssert(key && *key);
 
-    if (delim == 0) {
-        delim = " \t";
-        if ((endToken = strpbrk(token, delim)) != 0) {
-            nextToken = endToken + strspn(endToken, delim);
-            *endToken = '\0';
-        }
-    } else {
-        if ((endToken = strstr(token, delim)) != 0) {
-            *endToken = '\0';
-            /* Only eat one occurence of the delimiter */
-            nextToken = endToken + strlen(delim);
-        }
+    result = 0;
+    if ((sp = httpGetSession(conn, 0)) != 0 && sp->id) {
+        result = mprLookupKey(sp->data, key);
     }
-    buf->start = nextToken;
-    return token;
+    return result ? result : defaultValue;
 }
 
 
-/*  
-    Match the entity's etag with the client's provided etag.
- */
-bool httpMatchEtag(HttpConn *conn, char *requestedEtag)
+int httpSetSessionObj(HttpConn *conn, cchar *key, MprHash *obj)
 {
-    HttpRx  *rx;
-    char    *tag;
-    int     next;
+    httpSetSessionVar(conn, key, mprSerialize(obj, 0));
+    return 0;
+}
 
-    rx = conn->rx;
-    if (rx->etags == 0) {
-        return 1;
-    }
-    if (requestedEtag == 0) {
+
+int httpSetSessionVar(HttpConn *conn, cchar *key, cchar *value)
+{
+    HttpSession  *sp;
+
+    mprAssert(conn);
+    mprAssert(key && *key);
+    mprAssert(value);
+
+    if ((sp = httpGetSession(conn, 1)) == 0 || sp->id == 0) {
         return 0;
     }
-    for (next = 0; (tag = mprGetNextItem(rx->etags, &next)) != 0; ) {
-        if (strcmp(tag, requestedEtag) == 0) {
-            return (rx->ifMatch) ? 0 : 1;
-        }
+    value = sclone(value);
+    if (mprAddKey(sp->data, key, value) == 0) {
+        return MPR_ERR_MEMORY;
     }
-    return (rx->ifMatch) ? 1 : 0;
+    if (sp->changes == 0) {
+        sp->changes = mprCreateHash(HTTP_SMALL_HASH_SIZE, MPR_HASH_STATIC_VALUES);
+    }
+    mprAddKey(sp->changes, key, value);
+    return 0;
 }
 
 
-/*  
-    If an IF-MODIFIED-SINCE was specified, then return true if the resource has not been modified. If using
-    IF-UNMODIFIED, then return true if the resource was modified.
- */
-bool httpMatchModified(HttpConn *conn, MprTime time)
+int httpRemoveSessionVar(HttpConn *conn, cchar *key)
 {
-    HttpRx   *rx;
+    HttpSession  *sp;
 
-    rx = conn->rx;
+    mprAssert(conn);
+    mprAssert(key && *key);
 
-    if (rx->since == 0) {
-        /*  If-Modified or UnModified not supplied. */
-        return 1;
+    if ((sp = httpGetSession(conn, 1)) == 0 || sp->id == 0) {
+        return 0;
     }
-    if (rx->ifModified) {
-        /*  Return true if the file has not been modified.  */
-        return !(time > rx->since);
-    } else {
-        /*  Return true if the file has been modified.  */
-        return (time > rx->since);
+    if (mprRemoveKey(sp->data, key) < 0) {
+        return MPR_ERR_CANT_FIND;
     }
+    if (sp->changes == 0) {
+        sp->changes = mprCreateHash(HTTP_SMALL_HASH_SIZE, MPR_HASH_STATIC_VALUES);
+    }
+    mprAddKey(sp->changes, key, 0);
+    return 0;
 }
 
 
-/*  
-    Format is:  Range: bytes=n1-n2,n3-n4,...
-    Where n1 is first byte pos and n2 is last byte pos
+int httpWriteSession(HttpConn *conn)
+{
+    HttpSession *sp;
 
-    Examples:
-        Range: 0-49             first 50 bytes
-        Range: 50-99,200-249    Two 50 byte ranges from 50 and 200
-        Range: -50              Last 50 bytes
-        Range: 1-               Skip first byte then emit the rest
+    if (!conn->rx || (sp = conn->rx->session) == 0) {
+        return 0;
+    }
+    if (sp->store == HTTP_SESSION_CLIENT) {
+        return writeClientSession(conn, sp);
+    }
+    return writeServerSession(conn, sp);
+}
 
-    Return 1 if more ranges, 0 if end of ranges, -1 if bad range.
- */
-static bool parseRange(HttpConn *conn, char *value)
+
+static int writeServerSession(HttpConn *conn, HttpSession *sp)
 {
-    HttpTx      *tx;
-    HttpRange   *range, *last, *next;
-    char        *tok, *ep;
+    MprKey      *kp;
+    char        *key;
+    ssize       rc;
+    int         retries;
 
-    tx = conn->tx;
-    value = sclone(value);
-    if (value == 0) {
+    if (sp->id == 0 || sp->changes == 0) {
         return 0;
     }
-    /*  
-        Step over the "bytes="
-     */
-    stok(value, "=", &value);
-
-    for (last = 0; value && *value; ) {
-        if ((range = mprAllocObj(HttpRange, manageRange)) == 0) {
-            return 0;
+    key = makeKey(sp);
+    for (retries = 0; retries < HTTP_RETRIES; retries++) {
+        rc = mprWriteCache(sp->cache, key, serializeSession(sp->data), 0, sp->lifespan, sp->version, MPR_CACHE_SET);
+        if (rc != MPR_ERR_BAD_STATE) {
+            break;
         }
-        /*  
-            A range "-7" will set the start to -1 and end to 8
+        /*
+            Another request updated the session since it was loaded. Reload and apply the changes from this request.
          */
-        tok = stok(value, ",", &value);
-        if (*tok != '-') {
-            range->start = (ssize) stoi(tok);
-        } else {
-            range->start = -1;
-        }
-        range->end = -1;
-
-        if ((ep = strchr(tok, '-')) != 0) {
-            if (*++ep != '\0') {
-                /*
-                    End is one beyond the range. Makes the math easier.
-                 */
-                range->end = (ssize) stoi(ep) + 1;
+        loadSession(sp);
+        for (ITERATE_KEYS(sp->changes, kp)) {
+            if (kp->data) {
+                mprAddKey(sp->data, kp->key, kp->data);
+            } else {
+                mprRemoveKey(sp->data, kp->key);
             }
         }
-        if (range->start >= 0 && range->end >= 0) {
-            range->len = (int) (range->end - range->start);
-        }
-        if (last == 0) {
-            tx->outputRanges = range;
-        } else {
-            last->next = range;
-        }
-        last = range;
     }
+    if (rc <= 0) {
+        mprError("Can't write session %s", sp->id);
+        return MPR_ERR_CANT_WRITE;
+    }
+    sp->changes = 0;
+    if (sp->version) {
+        sp->version++;
+    } else {
+        mprReadCache(sp->cache, key, 0, &sp->version);
+    }
+    return 0;
+}
 
-    /*  
-        Validate ranges
-     */
-    for (range = tx->outputRanges; range; range = range->next) {
-        if (range->end != -1 && range->start >= range->end) {
-            return 0;
-        }
-        if (range->start < 0 && range->end < 0) {
-            return 0;
+
+char *httpGetSessionID(HttpConn *conn)
+{
+    HttpRx  *rx;
+
+    mprAssert(conn);
+    rx = conn->rx;
+    mprAssert(rx);
+
+    if (rx->session) {
+        return rx->session->id;
+    }
+    if (rx->sessionProbed) {
+        return 0;
+    }
+    rx->sessionProbed = 1;
+    return getCookie(conn, HTTP_SESSION_COOKIE);
+}
+
+
+static char *getCookie(HttpConn *conn, cchar *name)
+{
+    cchar   *cookies, *cookie;
+    char    *cp, *value;
+    int     quoted;
+
+    cookies = httpGetCookies(conn);
+    for (cookie = cookies; cookie && (value = strstr(cookie, name)) != 0; cookie = value) {
+        value += strlen(name);
+        while (isspace((uchar) *value) || *value == '=') {
+            value++;
         }
-        next = range->next;
-        if (range->start < 0 && next) {
-            /* This range goes to the end, so can't have another range afterwards */
-            return 0;
+        quoted = 0;
+        if (*value == '"') {
+            value++;
+            quoted++;
         }
-        if (next) {
-            if (range->end < 0) {
-                return 0;
-            }
-            if (next->start >= 0 && range->end > next->start) {
-                return 0;
+        for (cp = value; *cp; cp++) {
+            if (quoted) {
+                if (*cp == '"' && cp[-1] != '\\') {
+                    break;
+                }
+            } else {
+                if ((*cp == ',' || *cp == ';') && cp[-1] != '\\') {
+                    break;
+                }
             }
         }
+        return snclone(value, cp - value);
     }
-    conn->tx->currentRange = tx->outputRanges;
-    return (last) ? 1: 0;
+    return 0;
 }
 
 
-void httpSetStageData(HttpConn *conn, cchar *key, cvoid *data)
+/*
+    Load the session record from the cache. The version is retained to detect concurrent updates when written.
+    Returns MPR_ERR_CANT_FIND if there is no record for the session.
+ */
+static int loadSession(HttpSession *sp)
 {
-    HttpRx      *rx;
+    cchar   *record;
 
-    rx = conn->rx;
-    if (rx->requestData == 0) {
-        rx->requestData = mprCreateHash(-1, 0);
+    sp->data = mprCreateHash(HTTP_SMALL_HASH_SIZE, 0);
+    sp->version = 0;
+    if ((record = mprReadCache(sp->cache, makeKey(sp), 0, &sp->version)) == 0) {
+        return MPR_ERR_CANT_FIND;
     }
-    mprAddKey(rx->requestData, key, data);
+    if (parseSession(sp->data, record, &record[slen(record)]) < 0) {
+        mprError("Corrupt session record for %s", sp->id);
+    }
+    return 0;
 }
 
 
-cvoid *httpGetStageData(HttpConn *conn, cchar *key)
+static int parseSession(MprHash *data, cchar *record, cchar *end)
 {
-    HttpRx      *rx;
+    cchar   *cp;
+    char    *key, *value;
 
-    rx = conn->rx;
-    if (rx->requestData == 0) {
-        return NULL;
+    for (cp = record; cp < end; ) {
+        if ((key = parseField(&cp, end)) == 0 || (value = parseField(&cp, end)) == 0) {
+            return MPR_ERR_BAD_FORMAT;
+        }
+        mprAddKey(data, key, value);
     }
-    return mprLookupKey(rx->requestData, key);
+    return 0;
 }
 
 
-char *httpGetPathExt(cchar *path)
+/*
+    Client session cookies are "BODY.MAC" where both parts are base-64 encoded. The body is a header of four fields 
+    (encryption mode, expiry time, session ID and nonce) followed by the session record. The record is encrypted in 
+    mode "e". The MAC is a HMAC-SHA256 of the body. Separate signing and encryption keys are derived from each key.
+ */
+static HttpSession *readClientSession(HttpConn *conn)
 {
-    char    *ep, *ext;
-
-    if ((ext = strrchr(path, '.')) != 0) {
-        ext = sclone(++ext);
-        for (ep = ext; *ep && isalnum((uchar) *ep); ep++) {
-            ;
+    HttpSession *sp;
+    MprList     *keys;
+    MprTime     expires;
+    cchar       *key, *cp, *end;
+    char        *value, *dot, *body, *mac, *mode, *when, *id, *nonce, *record;
+    char        signKey[MPR_SHA256_SIZE], cryptKey[MPR_SHA256_SIZE];
+    uchar       expected[MPR_SHA256_SIZE];
+    ssize       len, macLen;
+    int         diff, next, i;
+
+    if ((value = getCookie(conn, HTTP_SESSION_STATE)) == 0 || (dot = strchr(value, '.')) == 0) {
+        return 0;
+    }
+    *dot = '\0';
+    if ((body = mprDecode64Block(value, &len, MPR_DECODE_TOKEQ)) == 0 || 
+            (mac = mprDecode64Block(&dot[1], &macLen, MPR_DECODE_TOKEQ)) == 0 || macLen != MPR_SHA256_SIZE) {
+        return 0;
+    }
+    keys = getSessionKeys(conn);
+    for (ITERATE_ITEMS(keys, key, next)) {
+        deriveKey(key, "sign", signKey);
+        mprGetHmacSHA256(signKey, sizeof(signKey), body, len, expected);
+        for (diff = i = 0; i < MPR_SHA256_SIZE; i++) {
+            diff |= expected[i] ^ (uchar) mac[i];
+        }
+        if (diff == 0) {
+            break;
         }
-        *ep = '\0';
     }
-    return ext;
+    if (key == 0) {
+        mprLog(3, "Session cookie signature is invalid");
+        return 0;
+    }
+    cp = body;
+    end = &body[len];
+    if ((mode = parseField(&cp, end)) == 0 || (when = parseField(&cp, end)) == 0 || 
+            (id = parseField(&cp, end)) == 0 || (nonce = parseField(&cp, end)) == 0) {
+        return 0;
+    }
+    expires = stoi(when);
+    if (expires <= conn->http->now) {
+        mprLog(4, "Session cookie has expired");
+        return 0;
+    }
+    record = (char*) cp;
+    if (*mode == 'e') {
+        deriveKey(key, "encrypt", cryptKey);
+        cryptSession(cryptKey, nonce, record, end - cp);
+    }
+    if ((sp = mprAllocObj(HttpSession, manageSession)) == 0) {
+        return 0;
+    }
+    mprSetName(sp, "session");
+    sp->store = HTTP_SESSION_CLIENT;
+    sp->lifespan = conn->limits->sessionTimeout;
+    sp->cache = conn->http->sessionCache;
+    sp->id = id;
+    sp->expires = expires;
+    sp->data = mprCreateHash(HTTP_SMALL_HASH_SIZE, 0);
+    if (parseSession(sp->data, record, end) < 0) {
+        mprError("Corrupt session cookie for %s", sp->id);
+        return 0;
+    }
+    return sp;
 }
 
 
 /*
-    Get the request extension. Look first at the URI pathInfo. If no extension, look at the filename if defined.
-    Return NULL if no extension.
+    Write the client session cookie. This must happen before the response headers are written. The cookie is rewritten
+    if the session is modified or more than half the session lifespan has elapsed. Sessions larger than the route 
+    limit are moved to the server store.
  */
-char *httpGetExt(HttpConn *conn)
+static int writeClientSession(HttpConn *conn, HttpSession *sp)
 {
-    HttpRx  *rx;
-    char    *ext;
+    Http        *http;
+    HttpRoute   *route;
+    MprBuf      *buf;
+    MprList     *keys;
+    cchar       *key;
+    char        *record, *nonce, *value, signKey[MPR_SHA256_SIZE], cryptKey[MPR_SHA256_SIZE], random[16];
+    uchar       mac[MPR_SHA256_SIZE];
+    ssize       len;
+    int         flags, rc;
 
-    rx = conn->rx;
-    if ((ext = httpGetPathExt(rx->pathInfo)) == 0) {
-        if (conn->tx->filename) {
-            ext = httpGetPathExt(conn->tx->filename);
+    http = conn->http;
+    route = conn->rx->route;
+    if (sp->changes == 0 && (sp->id == 0 || (sp->expires && (sp->expires - http->now) > sp->lifespan / 2))) {
+        return 0;
+    }
+    if (conn->tx->flags & HTTP_TX_HEADERS_CREATED) {
+        if (sp->changes) {
+            mprError("Can't update session cookie after the response headers are written");
         }
+        return MPR_ERR_BAD_STATE;
     }
-    return ext;
+    flags = HTTP_COOKIE_HTTP | (conn->secure ? HTTP_COOKIE_SECURE : 0);
+    sp->changes = 0;
+    if (sp->id == 0) {
+        httpSetCookie(conn, HTTP_SESSION_STATE, "", "/", NULL, 0, flags);
+        return 0;
+    }
+    keys = getSessionKeys(conn);
+    key = mprGetFirstItem(keys);
+    sp->expires = http->now + sp->lifespan;
+    nonce = "";
+    record = serializeSession(sp->data);
+    len = slen(record);
+    if (route->sessionStore & HTTP_SESSION_ENCRYPT) {
+        mprGetRandomBytes(random, sizeof(random), 0);
+        nonce = mprGetMD5WithPrefix(random, sizeof(random), NULL);
+        deriveKey(key, "encrypt", cryptKey);
+        cryptSession(cryptKey, nonce, record, len);
+    }
+    buf = mprCreateBuf(len + 128, 0);
+    mprPutFmtToBuf(buf, "1:%c%d:%Ld%d:%s%d:%s", (route->sessionStore & HTTP_SESSION_ENCRYPT) ? 'e' : 'p', 
+        (int) slen(itos(sp->expires)), sp->expires, (int) slen(sp->id), sp->id, (int) slen(nonce), nonce);
+    mprPutBlockToBuf(buf, record, len);
+    deriveKey(key, "sign", signKey);
+    mprGetHmacSHA256(signKey, sizeof(signKey), mprGetBufStart(buf), mprGetBufLength(buf), mac);
+    value = sjoin(mprEncode64Block(mprGetBufStart(buf), mprGetBufLength(buf)), ".", 
+        mprEncode64Block((char*) mac, sizeof(mac)), NULL);
+
+    if (slen(value) <= route->sessionCookieMax) {
+        httpSetCookie(conn, HTTP_SESSION_STATE, value, "/", NULL, 0, flags);
+        return 0;
+    }
+    /*
+        Move the session to the server store
+     */
+    lock(http);
+    if (mprGetCacheLength(sp->cache) >= conn->limits->sessionMax) {
+        unlock(http);
+        mprError("Too many sessions to move an oversized session cookie to the server store");
+        return MPR_ERR_TOO_MANY;
+    }
+    mprLog(4, "Move session %s to the server store, cookie size %d", sp->id, (int) slen(value));
+    if (getCookie(conn, HTTP_SESSION_STATE)) {
+        httpSetCookie(conn, HTTP_SESSION_STATE, "", "/", NULL, 0, flags);
+    }
+    httpSetCookie(conn, HTTP_SESSION_COOKIE, sp->id, "/", NULL, 0, conn->secure);
+    sp->store = HTTP_SESSION_SERVER;
+    sp->version = 0;
+    sp->changes = mprCreateHash(HTTP_SMALL_HASH_SIZE, MPR_HASH_STATIC_VALUES);
+    rc = writeServerSession(conn, sp);
+    unlock(http);
+    return rc;
 }
 
 
-//  MOB - can this just use the default
-static int compareLang(char **s1, char **s2)
+/*
+    Keys configured for the route, or the Http secret if none are defined
+ */
+static MprList *getSessionKeys(HttpConn *conn)
 {
-    return scmp(*s1, *s2);
+    HttpRoute   *route;
+    MprList     *keys;
+
+    route = conn->rx->route;
+    if (route->sessionKeys && mprGetListLength(route->sessionKeys) > 0) {
+        return route->sessionKeys;
+    }
+    keys = mprCreateList(1, 0);
+    mprAddItem(keys, conn->http->secret);
+    return keys;
 }
 
 
-HttpLang *httpGetLanguage(HttpConn *conn, MprHash *spoken, cchar *defaultLang)
+static void deriveKey(cchar *key, cchar *purpose, char *result)
 {
-    HttpRx      *rx;
-    HttpLang    *lang;
-    MprList     *list;
-    cchar       *accept;
-    char        *nextTok, *tok, *quality, *language;
-    int         next;
+    mprGetHmacSHA256(key, -1, purpose, -1, (uchar*) result);
+}
 
-    rx = conn->rx;
-    if (rx->lang) {
-        return rx->lang;
-    }
-    if (spoken == 0) {
-        return 0;
-    }
-    list = mprCreateList(-1, 0);
-    if ((accept = httpGetHeader(conn, "Accept-Language")) != 0) {
-        for (tok = stok(sclone(accept), ",", &nextTok); tok; tok = stok(nextTok, ",", &nextTok)) {
-            language = stok(tok, ";", &quality);
-            if (quality == 0) {
-                quality = "1";
-            }
-            mprAddItem(list, sfmt("%03d %s", (int) (atof(quality) * 100), language));
-        }
-        mprSortList(list, (MprSortProc) compareLang, 0);
-        for (next = 0; (language = mprGetNextItem(list, &next)) != 0; ) {
-            if ((lang = mprLookupKey(rx->route->languages, &language[4])) != 0) {
-                rx->lang = lang;
-                return lang;
-            }
+
+/*
+    Encrypt or decrypt in place. The key stream is HMAC-SHA256(key, nonce || counter).
+ */
+static void cryptSession(cchar *key, cchar *nonce, char *buf, ssize len)
+{
+    uchar   stream[MPR_SHA256_SIZE];
+    char    block[64];
+    ssize   pos, nonceLen;
+    int     counter, i;
+
+    nonceLen = min(slen(nonce), (ssize) sizeof(block) - 4);
+    memcpy(block, nonce, nonceLen);
+    for (pos = 0, counter = 0; pos < len; counter++) {
+        block[nonceLen] = (char) (counter >> 24);
+        block[nonceLen + 1] = (char) (counter >> 16);
+        block[nonceLen + 2] = (char) (counter >> 8);
+        block[nonceLen + 3] = (char) counter;
+        mprGetHmacSHA256(key, MPR_SHA256_SIZE, block, nonceLen + 4, stream);
+        for (i = 0; i < MPR_SHA256_SIZE && pos < len; i++, pos++) {
+            buf[pos] ^= stream[i];
         }
     }
-    if (defaultLang && (lang = mprLookupKey(rx->route->languages, defaultLang)) != 0) {
-        rx->lang = lang;
-        return lang;
-    }
-    return 0;
 }
 
 
 /*
-    Trim extra path information after the uri extension. This is used by CGI and PHP only. The strategy is to 
-    heuristically find the script name in the uri. This is assumed to be the original uri up to and including 
-    first path component containing a "." Any path information after that is regarded as extra path.
-    WARNING: Extra path is an old, unreliable, CGI specific technique. Do not use directories with embedded periods.
+    Session records are a sequence of key and value fields. Each field is prefixed by its length: "LENGTH:DATA".
+    Values are stored without escaping.
  */
-void httpTrimExtraPath(HttpConn *conn)
+static char *serializeSession(MprHash *data)
 {
-    HttpRx      *rx;
-    char        *cp, *extra;
-    ssize       len;
+    MprBuf  *buf;
+    MprKey  *kp;
 
-    rx = conn->rx;
-    if (!(rx->flags & (HTTP_OPTIONS | HTTP_TRACE))) { 
-        if ((cp = strchr(rx->pathInfo, '.')) != 0 && (extra = strchr(cp, '/')) != 0) {
-            len = extra - rx->pathInfo;
-            if (0 < len && len < slen(rx->pathInfo)) {
-                rx->extraPath = sclone(&rx->pathInfo[len]);
-                rx->pathInfo[len] = '\0';
-            }
-        }
-        if ((cp = strchr(rx->target, '.')) != 0 && (extra = strchr(cp, '/')) != 0) {
-            len = extra - rx->target;
-            if (0 < len && len < slen(rx->target)) {
-                rx->target[len] = '\0';
-            }
-        }
+    buf = mprCreateBuf(0, 0);
+    for (ITERATE_KEYS(data, kp)) {
+        mprPutFmtToBuf(buf, "%d:", (int) slen(kp->key));
+        mprPutStringToBuf(buf, kp->key);
+        mprPutFmtToBuf(buf, "%d:", (int) slen(kp->data));
+        mprPutStringToBuf(buf, kp->data);
+    }
+    mprAddNullToBuf(buf);
+    return mprGetBufStart(buf);
+}
+
+
+static char *parseField(cchar **cp, cchar *end)
+{
+    cchar   *start;
+    ssize   len;
+
+    for (len = 0, start = *cp; start < end && isdigit((uchar) *start); start++) {
+        len = len * 10 + (*start - '0');
+    }
+    if (start >= end || *start != ':' || len > (end - start - 1)) {
+        return 0;
     }
+    start++;
+    *cp = start + len;
+    return snclone(start, len);
+}
+
+
+static char *makeSessionID(HttpConn *conn)
+{
+    char        idBuf[64];
+    static int  nextSession = 0;
+
+    mprAssert(conn);
+
+    /* Thread race here on nextSession++ not critical */
+    mprSprintf(idBuf, sizeof(idBuf), "%08x%08x%d", PTOI(conn->data) + PTOI(conn), (int) mprGetTime(), nextSession++);
+    return mprGetMD5WithPrefix(idBuf, sizeof(idBuf), "::http.session::");
 }
 
 
+static char *makeKey(HttpSession *sp)
+{
+    return sfmt("session-%s", sp->id);
+}
+
 /*
     @copy   default
 
@@ -12524,16 +16301,12 @@ void httpTrimExtraPath(HttpConn *conn)
 
 /************************************************************************/
 /*
-    Start of file "src/sendConnector.c"
+    Start of file "src/sockFilter.c"
  */
 /************************************************************************/
 
 /*
-    sendConnector.c -- Send file connector. 
-
-    The Sendfile connector supports the optimized transmission of whole static files. It uses operating system 
-    sendfile APIs to eliminate reading the document into user space and multiple socket writes. The send connector 
-    is not a general purpose connector. It cannot handle dynamic data or ranged requests. It does support chunked requests.
+    sockFilter.c - WebSockets filter (RFC 6455) with the permessage-deflate extension (RFC 7692).
 
     Copyright (c) All Rights Reserved. See details at the end of the file.
  */
@@ -12542,885 +16315,1289 @@ void httpTrimExtraPath(HttpConn *conn)
 
 
 
-/**************************** Forward Declarations ****************************/
-#if !BIT_ROM
+#if BIT_WEB_SOCKETS
+#if BIT_PACK_ZLIB
+ #include    <zlib.h>
+#endif
+/********************************** Locals ************************************/
 
-static void addPacketForSend(HttpQueue *q, HttpPacket *packet);
-static void adjustSendVec(HttpQueue *q, MprOff written);
-static MprOff buildSendVec(HttpQueue *q);
-static void adjustPacketData(HttpQueue *q, MprOff written);
+#define WS_MAGIC        "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_MAX_CONTROL  125             /* Maximum control frame payload */
+#define WS_VERSION      "13"
 
-/*********************************** Code *************************************/
+/********************************** Forwards **********************************/
 
-int httpOpenSendConnector(Http *http)
+static void closeSock(HttpQueue *q);
+static MprBuf *createFrameHeader(int type, MprOff len);
+static HttpPacket *createSharedFrame(HttpPacket *packet, int type, int compressed);
+static void deliverBroadcasts(HttpConn *conn, MprEvent *event);
+static void deliverMessage(HttpQueue *q, HttpWebSocket *ws, HttpPacket *message);
+static void endSock(HttpConn *conn);
+static void failSock(HttpQueue *q, int status, cchar *msg);
+static HttpPacket *frameMessage(HttpWebSocket *ws, HttpPacket *packet);
+static HttpGroup *getGroup(Http *http, cchar *name, int create);
+static void incomingSock(HttpQueue *q, HttpPacket *packet);
+static void leaveGroups(HttpConn *conn, HttpWebSocket *ws);
+static void manageGroup(HttpGroup *group, int flags);
+static void manageWebSocket(HttpWebSocket *ws, int flags);
+static int matchSock(HttpConn *conn, HttpRoute *route, int dir);
+static void outgoingSockService(HttpQueue *q);
+static bool parseFrame(HttpQueue *q, HttpWebSocket *ws);
+static void processControl(HttpQueue *q, HttpWebSocket *ws, int opcode, uchar *data, ssize len);
+static void releaseCompression(HttpWebSocket *ws);
+static void scheduleBroadcasts(HttpConn *conn, HttpWebSocket *ws);
+static void selectExtensions(HttpConn *conn, HttpWebSocket *ws, HttpRoute *route);
+static ssize sendFrame(HttpConn *conn, int type, cchar *buf, ssize len, int flags);
+static void sendClose(HttpConn *conn, int status, cchar *reason);
+static void sha1(cuchar *data, ssize len, uchar digest[20]);
+static HttpPacket *shareFrame(HttpPacket *frame);
+static void startSock(HttpQueue *q);
+static void unmask(uchar *data, ssize len, cuchar *mask);
+static bool validUtf8(cuchar *str, ssize len);
+
+#if BIT_PACK_ZLIB
+static HttpPacket *compressFrame(HttpPacket *packet, int type, int bits);
+static HttpPacket *deflateMessage(z_stream *zs, HttpPacket *packet, int reset);
+static HttpPacket *inflateMessage(HttpConn *conn, HttpWebSocket *ws, HttpPacket *packet, int *status);
+#endif
+
+/*********************************** Code *************************************/
+/* 
+   Loadable module initialization
+ */
+int httpOpenSockFilter(Http *http)
 {
-    HttpStage     *stage;
+    HttpStage     *filter;
 
-    mprLog(5, "Open send connector");
-    if ((stage = httpCreateConnector(http, "sendConnector", HTTP_STAGE_ALL, NULL)) == 0) {
+    mprLog(5, "Open sock filter");
+    if ((filter = httpCreateFilter(http, "sockFilter", HTTP_STAGE_ALL, NULL)) == 0) {
         return MPR_ERR_CANT_CREATE;
     }
-    stage->open = httpSendOpen;
-    stage->close = httpSendClose;
-    stage->outgoingService = httpSendOutgoingService; 
-    http->sendConnector = stage;
+    http->sockFilter = filter;
+    filter->match = matchSock; 
+    filter->close = closeSock; 
+    filter->start = startSock; 
+    filter->incoming = incomingSock; 
+    filter->outgoingService = outgoingSockService; 
     return 0;
 }
 
 
-/*  
-    Initialize the send connector for a request
+/*
+    Validate the WebSockets handshake and upgrade the connection. This is called for RX first, then TX.
+ */
+static int matchSock(HttpConn *conn, HttpRoute *route, int dir)
+{
+    HttpRx          *rx;
+    HttpWebSocket   *ws;
+    char            *key, *protocol, *tok;
+    uchar           digest[20];
+    ssize           len;
+
+    rx = conn->rx;
+    if (dir & HTTP_STAGE_TX) {
+        return rx->webSocket ? HTTP_ROUTE_OK : HTTP_ROUTE_REJECT;
+    }
+    if (!conn->endpoint || conn->stream || !rx->upgrade || !scaselessmatch(rx->upgrade, "websocket")) {
+        return HTTP_ROUTE_REJECT;
+    }
+    if (!(rx->flags & HTTP_GET) || !rx->connection || !scontains(slower(rx->connection), "upgrade")) {
+        httpError(conn, HTTP_CODE_BAD_REQUEST, "Bad WebSockets upgrade request");
+        return HTTP_ROUTE_REJECT;
+    }
+    if (!smatch(rx->sockVersion, WS_VERSION)) {
+        httpSetHeader(conn, "Sec-WebSocket-Version", WS_VERSION);
+        httpError(conn, HTTP_CODE_BAD_REQUEST, "Unsupported WebSockets version");
+        return HTTP_ROUTE_REJECT;
+    }
+    if (!rx->sockKey || (mprDecode64Block(rx->sockKey, &len, MPR_DECODE_TOKEQ) == 0) || len != 16) {
+        httpError(conn, HTTP_CODE_BAD_REQUEST, "Bad Sec-WebSocket-Key");
+        return HTTP_ROUTE_REJECT;
+    }
+    if ((ws = mprAllocObj(HttpWebSocket, manageWebSocket)) == 0) {
+        return HTTP_ROUTE_REJECT;
+    }
+    ws->state = HTTP_WS_STATE_OPEN;
+    ws->mutex = mprCreateLock();
+    rx->webSocket = ws;
+
+    key = sjoin(rx->sockKey, WS_MAGIC, NULL);
+    sha1((cuchar*) key, slen(key), digest);
+    httpSetStatus(conn, HTTP_CODE_SWITCHING);
+    httpSetHeader(conn, "Upgrade", "websocket");
+    httpSetHeader(conn, "Connection", "Upgrade");
+    httpSetHeader(conn, "Sec-WebSocket-Accept", mprEncode64Block((cchar*) digest, sizeof(digest)));
+    if (rx->sockProtocol && (protocol = stok(sclone(rx->sockProtocol), ", \t", &tok)) != 0) {
+        httpSetHeader(conn, "Sec-WebSocket-Protocol", protocol);
+    }
+    selectExtensions(conn, ws, route);
+
+    /*
+        Incoming data is a stream of frames that only ends with a close message. The connection is not reused.
+     */
+    rx->remainingContent = MAXOFF;
+    rx->eof = 0;
+    rx->streamInput = 1;
+    conn->keepAliveCount = 0;
+    mprLog(4, "WebSockets: upgrade connection for %s", rx->uri);
+    return HTTP_ROUTE_OK;
+}
+
+
+/*
+    Negotiate the permessage-deflate extension (RFC 7692). Select the first acceptable offer.
  */
-void httpSendOpen(HttpQueue *q)
+static void selectExtensions(HttpConn *conn, HttpWebSocket *ws, HttpRoute *route)
 {
-    HttpConn    *conn;
-    HttpTx      *tx;
-
-    conn = q->conn;
-    tx = conn->tx;
+#if BIT_PACK_ZLIB
+    z_stream    *zs;
+    cchar       *offers;
+    char        *offer, *param, *value, *response, *tok, *ptok;
+    int         serverBits, clientBits, clientBitsOffered, serverNoTakeover, clientNoTakeover, accept, bits;
 
-    if (tx->connector != conn->http->sendConnector) {
-        httpAssignQueue(q, tx->connector, HTTP_QUEUE_TX);
-        tx->connector->open(q);
+    if (route->webSocketsDeflate <= 0 || (offers = httpGetHeader(conn, "sec-websocket-extensions")) == 0) {
         return;
     }
-    if (!(tx->flags & HTTP_TX_NO_BODY)) {
-        mprAssert(tx->fileInfo.valid);
-        if (tx->fileInfo.size > conn->limits->transmissionBodySize) {
-            httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_TOO_LARGE,
-                "Http transmission aborted. File size exceeds max body of %,Ld bytes", conn->limits->transmissionBodySize);
+    for (offer = stok(sclone(offers), ",", &tok); offer; offer = stok(NULL, ",", &tok)) {
+        if ((param = stok(offer, ";", &ptok)) == 0 || !smatch(strim(param, " \t", MPR_TRIM_BOTH), "permessage-deflate")) {
+            continue;
+        }
+        serverBits = clientBits = route->webSocketsDeflate;
+        clientBitsOffered = 0;
+        serverNoTakeover = clientNoTakeover = (route->flags & HTTP_ROUTE_WS_NO_TAKEOVER) ? 1 : 0;
+        accept = 1;
+        for (param = stok(NULL, ";", &ptok); param && accept; param = stok(NULL, ";", &ptok)) {
+            param = strim(param, " \t", MPR_TRIM_BOTH);
+            if ((value = schr(param, '=')) != 0) {
+                *value++ = '\0';
+                value = strim(strim(value, " \t", MPR_TRIM_BOTH), "\"", MPR_TRIM_BOTH);
+                param = strim(param, " \t", MPR_TRIM_BOTH);
+            }
+            bits = value ? (int) stoi(value) : 0;
+            if (smatch(param, "server_no_context_takeover")) {
+                serverNoTakeover = 1;
+            } else if (smatch(param, "client_no_context_takeover")) {
+                clientNoTakeover = 1;
+            } else if (smatch(param, "server_max_window_bits")) {
+                /* Zlib does not support raw deflate with 256 byte windows */
+                if (bits < 9 || bits > 15) {
+                    accept = 0;
+                } else {
+                    serverBits = min(serverBits, bits);
+                }
+            } else if (smatch(param, "client_max_window_bits")) {
+                if (value && (bits < 8 || bits > 15)) {
+                    accept = 0;
+                } else {
+                    clientBitsOffered = 1;
+                    clientBits = value ? min(clientBits, bits) : clientBits;
+                }
+            } else {
+                accept = 0;
+            }
+        }
+        if (!accept) {
+            continue;
+        }
+        response = "permessage-deflate";
+        if (serverNoTakeover) {
+            response = sjoin(response, "; server_no_context_takeover", NULL);
+        }
+        if (clientNoTakeover) {
+            response = sjoin(response, "; client_no_context_takeover", NULL);
+        }
+        if (serverBits < 15) {
+            response = sfmt("%s; server_max_window_bits=%d", response, serverBits);
+        }
+        if (clientBitsOffered && clientBits < 15) {
+            response = sfmt("%s; client_max_window_bits=%d", response, clientBits);
+        }
+        /* Zlib state is not allocated by the MPR. It is released when the request completes. */
+        if ((zs = ws->deflater = calloc(1, sizeof(z_stream))) == 0 ||
+                deflateInit2(zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -serverBits, min(serverBits - 7, 8), 
+                Z_DEFAULT_STRATEGY) != Z_OK) {
+            releaseCompression(ws);
             return;
         }
-        tx->file = mprOpenFile(tx->filename, O_RDONLY | O_BINARY, 0);
-        if (tx->file == 0) {
-            httpError(conn, HTTP_CODE_NOT_FOUND, "Can't open document: %s, err %d", tx->filename, mprGetError());
+        if ((zs = ws->inflater = calloc(1, sizeof(z_stream))) == 0 || inflateInit2(zs, -15) != Z_OK) {
+            releaseCompression(ws);
+            return;
         }
+        ws->deflate = 1;
+        ws->windowBits = serverBits;
+        ws->serverNoTakeover = serverNoTakeover;
+        ws->clientNoTakeover = clientNoTakeover;
+        httpSetHeader(conn, "Sec-WebSocket-Extensions", response);
+        return;
     }
+#endif
 }
 
 
-void httpSendClose(HttpQueue *q)
+static void manageWebSocket(HttpWebSocket *ws, int flags)
 {
-    HttpTx  *tx;
-
-    tx = q->conn->tx;
-    if (tx->file) {
-        mprCloseFile(tx->file);
-        tx->file = 0;
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(ws->closeReason);
+        mprMark(ws->input);
+        mprMark(ws->message);
+        mprMark(ws->queue);
+        mprMark(ws->groups);
+        mprMark(ws->broadcasts);
+        mprMark(ws->mutex);
+    } else if (flags & MPR_MANAGE_FREE) {
+        releaseCompression(ws);
     }
 }
 
 
-void httpSendOutgoingService(HttpQueue *q)
+static void releaseCompression(HttpWebSocket *ws)
 {
-    HttpConn    *conn;
-    HttpTx      *tx;
-    MprFile     *file;
-    MprOff      written;
-    int         errCode;
-
-    conn = q->conn;
-    tx = conn->tx;
-    conn->lastActivity = conn->http->now;
-    mprAssert(conn->sock);
-
-    if (!conn->sock || conn->connectorComplete) {
-        return;
-    }
-    if (tx->flags & HTTP_TX_NO_BODY) {
-        httpDiscardQueueData(q, 1);
-    }
-    if ((tx->bytesWritten + q->ioCount) > conn->limits->transmissionBodySize) {
-        httpError(conn, HTTP_ABORT | HTTP_CODE_REQUEST_TOO_LARGE | ((tx->bytesWritten) ? HTTP_ABORT : 0),
-            "Http transmission aborted. Exceeded max body of %,Ld bytes", conn->limits->transmissionBodySize);
-        if (tx->bytesWritten) {
-            httpConnectorComplete(conn);
-            return;
-        }
-    }
-    /*
-        Loop doing non-blocking I/O until blocked or all the packets received are written.
-     */
-    while (1) {
-        /*
-            Rebuild the iovector only when the past vector has been completely written. Simplifies the logic quite a bit.
-         */
-        if (q->ioIndex == 0 && buildSendVec(q) <= 0) {
-            break;
-        }
-        file = q->ioFile ? tx->file : 0;
-        written = mprSendFileToSocket(conn->sock, file, q->ioPos, q->ioCount, q->iovec, q->ioIndex, NULL, 0);
-
-        mprLog(8, "Send connector ioCount %d, wrote %Ld, written so far %Ld, sending file %d, q->count %d/%d", 
-                q->ioCount, written, tx->bytesWritten, q->ioFile, q->count, q->max);
-        if (written < 0) {
-            errCode = mprGetError(q);
-            if (errCode == EAGAIN || errCode == EWOULDBLOCK) {
-                /* Socket is full. Wait for an I/O event */
-                httpSocketBlocked(conn);
-                break;
-            }
-            if (errCode != EPIPE && errCode != ECONNRESET) {
-                mprLog(7, "SendFileToSocket failed, errCode %d", errCode);
-            }
-            httpError(conn, HTTP_ABORT | HTTP_CODE_COMMS_ERROR, "SendFileToSocket failed, errCode %d", errCode);
-            httpConnectorComplete(conn);
-            break;
-
-        } else if (written == 0) {
-            /* Socket is full. Wait for an I/O event */
-            httpSocketBlocked(conn);
-            break;
-
-        } else if (written > 0) {
-            tx->bytesWritten += written;
-            adjustPacketData(q, written);
-            adjustSendVec(q, written);
-        }
+#if BIT_PACK_ZLIB
+    if (ws->deflater) {
+        deflateEnd(ws->deflater);
+        free(ws->deflater);
+        ws->deflater = 0;
     }
-    if (q->ioCount == 0) {
-        if ((q->flags & HTTP_QUEUE_EOF)) {
-            httpConnectorComplete(conn);
-        } else {
-            httpNotifyWritable(conn);
-        }
+    if (ws->inflater) {
+        inflateEnd(ws->inflater);
+        free(ws->inflater);
+        ws->inflater = 0;
     }
+#endif
+    ws->deflate = 0;
 }
 
 
-/*  
-    Build the IO vector. This connector uses the send file API which permits multiple IO blocks to be written with 
-    file data. This is used to write transfer the headers and chunk encoding boundaries. Return the count of bytes to 
-    be written. Return -1 for EOF.
- */
-static MprOff buildSendVec(HttpQueue *q)
+static void closeSock(HttpQueue *q)
 {
-    HttpConn    *conn;
-    HttpPacket  *packet;
-
-    mprAssert(q->ioIndex == 0);
+    HttpWebSocket   *ws;
 
-    conn = q->conn;
-    q->ioCount = 0;
-    q->ioFile = 0;
-
-    /*  
-        Examine each packet and accumulate as many packets into the I/O vector as possible. Can only have one data packet at
-        a time due to the limitations of the sendfile API (on Linux). And the data packet must be after all the 
-        vector entries. Leave the packets on the queue for now, they are removed after the IO is complete for the 
-        entire packet.
-     */
-    for (packet = q->first; packet; packet = packet->next) {
-        if (packet->flags & HTTP_PACKET_HEADER) {
-            httpWriteHeaders(conn, packet);
-            q->count += httpGetPacketLength(packet);
-            
-        } else if (httpGetPacketLength(packet) == 0 && packet->esize == 0) {
-            q->flags |= HTTP_QUEUE_EOF;
-            if (packet->prefix == NULL) {
-                break;
-            }
-        }
-        if (q->ioFile || q->ioIndex >= (HTTP_MAX_IOVEC - 2)) {
-            break;
-        }
-        addPacketForSend(q, packet);
+    if ((ws = q->conn->rx->webSocket) != 0) {
+        leaveGroups(q->conn, ws);
+        releaseCompression(ws);
     }
-    return q->ioCount;
 }
 
 
-/*  
-    Add one entry to the io vector
+/*
+    Send the 101 response immediately. The handler may not write any data until a message is received.
  */
-static void addToSendVector(HttpQueue *q, char *ptr, ssize bytes)
+static void startSock(HttpQueue *q)
 {
-    mprAssert(ptr > 0);
-    mprAssert(bytes > 0);
-
-    q->iovec[q->ioIndex].start = ptr;
-    q->iovec[q->ioIndex].len = bytes;
-    q->ioCount += bytes;
-    q->ioIndex++;
+    if (q->direction == HTTP_QUEUE_TX) {
+        q->conn->rx->webSocket->queue = q;
+        httpFlushQueue(q->conn->writeq, 0);
+    }
 }
 
 
-/*  
-    Add a packet to the io vector. Return the number of bytes added to the vector.
+/*
+    Parse received data into frames and pass complete messages to the handler
  */
-static void addPacketForSend(HttpQueue *q, HttpPacket *packet)
+static void incomingSock(HttpQueue *q, HttpPacket *packet)
 {
-    HttpTx      *tx;
-    HttpConn    *conn;
-    int         item;
-
-    conn = q->conn;
-    tx = conn->tx;
-    
-    mprAssert(q->count >= 0);
-    mprAssert(q->ioIndex < (HTTP_MAX_IOVEC - 2));
+    HttpWebSocket   *ws;
+    MprBuf          *buf;
+    ssize           len;
 
-    if (packet->prefix) {
-        addToSendVector(q, mprGetBufStart(packet->prefix), mprGetBufLength(packet->prefix));
+    ws = q->conn->rx->webSocket;
+    if (packet->flags & HTTP_PACKET_END) {
+        httpPutPacketToNext(q, packet);
+        return;
     }
-    if (packet->esize > 0) {
-        mprAssert(q->ioFile == 0);
-        q->ioFile = 1;
-        q->ioCount += packet->esize;
-
-    } else if (httpGetPacketLength(packet) > 0) {
-        /*
-            Header packets have actual content. File data packets are virtual and only have a count.
-         */
-        addToSendVector(q, mprGetBufStart(packet->content), httpGetPacketLength(packet));
-        item = (packet->flags & HTTP_PACKET_HEADER) ? HTTP_TRACE_HEADER : HTTP_TRACE_BODY;
-        if (httpShouldTrace(conn, HTTP_TRACE_TX, item, tx->ext) >= 0) {
-            httpTraceContent(conn, HTTP_TRACE_TX, item, packet, 0, tx->bytesWritten);
+    if (ws->state == HTTP_WS_STATE_CLOSED || (len = httpGetPacketLength(packet)) == 0) {
+        return;
+    }
+    if (ws->input == 0) {
+        ws->input = packet;
+    } else {
+        buf = ws->input->content;
+        if (mprGetBufSpace(buf) < len) {
+            mprCompactBuf(buf);
         }
+        httpJoinPacket(ws->input, packet);
     }
+    while (ws->input && parseFrame(q, ws)) {}
 }
 
 
-/*  
-    Clear entries from the IO vector that have actually been transmitted. This supports partial writes due to the socket
-    being full. Don't come here if we've seen all the packets and all the data has been completely written. ie. small files
-    don't come here.
+/*
+    Process the next frame in the received data. Returns false if more data is required.
  */
-static void adjustPacketData(HttpQueue *q, MprOff bytes)
+static bool parseFrame(HttpQueue *q, HttpWebSocket *ws)
 {
-    HttpPacket  *packet;
-    ssize       len;
-
-    mprAssert(q->first);
-    mprAssert(q->count >= 0);
-    mprAssert(bytes >= 0);
+    HttpConn    *conn;
+    HttpPacket  *packet, *message;
+    MprBuf      *buf;
+    uchar       *cp, *data;
+    MprOff      len, total;
+    ssize       avail, headerLen;
+    int         fin, rsv, opcode, i;
 
-    while ((packet = q->first) != 0) {
-        if (packet->prefix) {
-            len = mprGetBufLength(packet->prefix);
-            len = (ssize) min(len, bytes);
-            mprAdjustBufStart(packet->prefix, len);
-            bytes -= len;
-            /* Prefixes don't count in the q->count. No need to adjust */
-            if (mprGetBufLength(packet->prefix) == 0) {
-                packet->prefix = 0;
-            }
-        }
-        if (packet->esize) {
-            len = (ssize) min(packet->esize, bytes);
-            packet->esize -= len;
-            packet->epos += len;
-            bytes -= len;
-            mprAssert(packet->esize >= 0);
-            mprAssert(bytes == 0);
-            if (packet->esize > 0) {
-                break;
-            }
-        } else if ((len = httpGetPacketLength(packet)) > 0) {
-            len = (ssize) min(len, bytes);
-            mprAdjustBufStart(packet->content, len);
-            bytes -= len;
-            q->count -= len;
-            mprAssert(q->count >= 0);
+    conn = q->conn;
+    packet = ws->input;
+    buf = packet->content;
+    cp = (uchar*) mprGetBufStart(buf);
+    avail = mprGetBufLength(buf);
+    if (avail < 2) {
+        return 0;
+    }
+    fin = cp[0] & 0x80;
+    rsv = cp[0] & 0x70;
+    opcode = cp[0] & 0xF;
+    len = cp[1] & 0x7F;
+    if (!(cp[1] & 0x80)) {
+        failSock(q, HTTP_WS_STATUS_PROTOCOL_ERROR, "Frame is not masked");
+        return 0;
+    }
+    headerLen = (len == 126) ? 8 : (len == 127) ? 14 : 6;
+    if (avail < headerLen) {
+        return 0;
+    }
+    if (len == 126) {
+        len = (cp[2] << 8) | cp[3];
+    } else if (len == 127) {
+        for (len = 0, i = 2; i < 10; i++) {
+            len = (len << 8) | cp[i];
         }
-        if (httpGetPacketLength(packet) == 0) {
-            httpGetPacket(q);
+    }
+    if (opcode & 0x8) {
+        if (!fin || rsv || len > WS_MAX_CONTROL || opcode > HTTP_WS_PONG) {
+            failSock(q, HTTP_WS_STATUS_PROTOCOL_ERROR, "Bad control frame");
+            return 0;
         }
-        mprAssert(bytes >= 0);
-        if (bytes == 0 && (q->first == NULL || !(q->first->flags & HTTP_PACKET_END))) {
-            break;
+    } else if (opcode == HTTP_WS_CONT) {
+        if (!ws->messageType || rsv) {
+            failSock(q, HTTP_WS_STATUS_PROTOCOL_ERROR, "Unexpected continuation frame");
+            return 0;
+        }
+    } else if (opcode == HTTP_WS_TEXT || opcode == HTTP_WS_BINARY) {
+        if (ws->messageType || (rsv & ~(ws->deflate ? 0x40 : 0))) {
+            failSock(q, HTTP_WS_STATUS_PROTOCOL_ERROR, "Bad data frame");
+            return 0;
+        }
+    } else {
+        failSock(q, HTTP_WS_STATUS_PROTOCOL_ERROR, "Unknown frame type");
+        return 0;
+    }
+    total = len + (ws->message ? httpGetPacketLength(ws->message) : 0);
+    if (len < 0 || (!(opcode & 0x8) && total > conn->limits->webSocketsMessageSize)) {
+        failSock(q, HTTP_WS_STATUS_TOO_LARGE, "Message is too large");
+        return 0;
+    }
+    if (avail < headerLen + len) {
+        /* Wait for the rest of the frame */
+        return 0;
+    }
+    data = &cp[headerLen];
+    unmask(data, (ssize) len, &cp[headerLen - 4]);
+
+    if (opcode & 0x8) {
+        mprAdjustBufStart(buf, headerLen + (ssize) len);
+        processControl(q, ws, opcode, data, (ssize) len);
+
+    } else {
+        if (opcode != HTTP_WS_CONT) {
+            ws->messageType = opcode;
+            ws->compressed = rsv & 0x40;
+        }
+        if (fin && !ws->message) {
+            /* Unfragmented message. Deliver the received packet without copying. */
+            ws->input = (avail > headerLen + len) ? httpSplitPacket(packet, headerLen + (ssize) len) : 0;
+            mprAdjustBufStart(buf, headerLen);
+            message = packet;
+        } else {
+            if (ws->message == 0) {
+                ws->message = httpCreateDataPacket(max((ssize) len * 2, HTTP_BUFSIZE));
+            }
+            mprPutBlockToBuf(ws->message->content, (char*) data, (ssize) len);
+            mprAdjustBufStart(buf, headerLen + (ssize) len);
+            message = fin ? ws->message : 0;
+        }
+        if (message) {
+            ws->message = 0;
+            deliverMessage(q, ws, message);
         }
     }
+    if (ws->input && httpGetPacketLength(ws->input) == 0) {
+        ws->input = 0;
+    }
+    return ws->input && ws->state != HTTP_WS_STATE_CLOSED;
 }
 
 
-/*  
-    Clear entries from the IO vector that have actually been transmitted. This supports partial writes due to the socket
-    being full. Don't come here if we've seen all the packets and all the data has been completely written. ie. small files
-    don't come here.
- */
-static void adjustSendVec(HttpQueue *q, MprOff written)
+static void deliverMessage(HttpQueue *q, HttpWebSocket *ws, HttpPacket *message)
 {
-    MprIOVec    *iovec;
-    ssize       len;
-    int         i, j;
+    int     type;
 
-    iovec = q->iovec;
-    for (i = 0; i < q->ioIndex; i++) {
-        len = iovec[i].len;
-        if (written < len) {
-            iovec[i].start += (ssize) written;
-            iovec[i].len -= (ssize) written;
+    type = ws->messageType;
+    ws->messageType = 0;
+#if BIT_PACK_ZLIB
+    if (ws->compressed) {
+        int     status;
+        ws->compressed = 0;
+        if ((message = inflateMessage(q->conn, ws, message, &status)) == 0) {
+            failSock(q, status, "Cannot decompress message");
             return;
         }
-        written -= len;
-        q->ioCount -= len;
-        for (j = i + 1; i < q->ioIndex; ) {
-            iovec[j++] = iovec[i++];
-        }
-        q->ioIndex--;
-        i--;
     }
-    if (written > 0 && q->ioFile) {
-        /* All remaining data came from the file */
-        q->ioPos += written;
+#endif
+    if (type == HTTP_WS_TEXT && !validUtf8((cuchar*) mprGetBufStart(message->content), httpGetPacketLength(message))) {
+        failSock(q, HTTP_WS_STATUS_INVALID_DATA, "Text message is not valid UTF-8");
+        return;
     }
-    q->ioIndex = 0;
-    q->ioCount = 0;
-    q->ioFile = 0;
+    message->type = type;
+    message->flags = HTTP_PACKET_DATA;
+    httpPutPacketToNext(q, message);
 }
 
 
-#else
-int httpOpenSendConnector(Http *http) { return 0; }
-void httpSendOpen(HttpQueue *q) {}
-void httpSendOutgoingService(HttpQueue *q) {}
-#endif /* !BIT_ROM */
+static void processControl(HttpQueue *q, HttpWebSocket *ws, int opcode, uchar *data, ssize len)
+{
+    HttpConn    *conn;
+    int         status;
 
-/*
-    @copy   default
+    conn = q->conn;
+    switch (opcode) {
+    case HTTP_WS_PING:
+        if (ws->state == HTTP_WS_STATE_OPEN) {
+            sendFrame(conn, HTTP_WS_PONG, (cchar*) data, len, 0);
+        }
+        break;
 
-    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
+    case HTTP_WS_PONG:
+        break;
 
-    This software is distributed under commercial and open source licenses.
-    You may use the Embedthis Open Source license or you may acquire a 
-    commercial license from Embedthis Software. You agree to be fully bound
-    by the terms of either license. Consult the LICENSE.md distributed with
-    this software for full details and other copyrights.
+    case HTTP_WS_CLOSE:
+        status = HTTP_WS_STATUS_NO_STATUS;
+        if (len >= 2) {
+            status = (data[0] << 8) | data[1];
+            if (status < 1000 || status >= 5000 || status == 1004 || status == 1005 || status == 1006 || 
+                    (status > 1011 && status < 3000)) {
+                failSock(q, HTTP_WS_STATUS_PROTOCOL_ERROR, "Bad close status");
+                return;
+            }
+            if (!validUtf8(&data[2], len - 2)) {
+                failSock(q, HTTP_WS_STATUS_INVALID_DATA, "Close reason is not valid UTF-8");
+                return;
+            }
+            ws->closeReason = snclone((char*) &data[2], len - 2);
+        } else if (len == 1) {
+            failSock(q, HTTP_WS_STATUS_PROTOCOL_ERROR, "Bad close message");
+            return;
+        }
+        ws->closeStatus = status;
+        mprLog(4, "WebSockets: received close, status %d", status);
+        if (ws->state == HTTP_WS_STATE_OPEN) {
+            sendClose(conn, status == HTTP_WS_STATUS_NO_STATUS ? HTTP_WS_STATUS_OK : status, NULL);
+        }
+        ws->state = HTTP_WS_STATE_CLOSED;
+        ws->input = 0;
+        endSock(conn);
+        break;
+    }
+}
 
-    Local variables:
-    tab-width: 4
-    c-basic-offset: 4
-    End:
-    vim: sw=4 ts=4 expandtab
 
-    @end
+/*
+    Fail the connection after a protocol error. Send a close message and close the connection without waiting 
+    for the peer.
  */
+static void failSock(HttpQueue *q, int status, cchar *msg)
+{
+    HttpConn        *conn;
+    HttpWebSocket   *ws;
+
+    conn = q->conn;
+    ws = conn->rx->webSocket;
+    mprLog(3, "WebSockets: %s", msg);
+    if (ws->state == HTTP_WS_STATE_OPEN) {
+        sendClose(conn, status, NULL);
+    }
+    ws->state = HTTP_WS_STATE_CLOSED;
+    ws->input = 0;
+    ws->message = 0;
+    endSock(conn);
+}
+
 
-/************************************************************************/
 /*
-    Start of file "src/session.c"
+    No more messages can be sent or received. Complete the request and close the connection.
  */
-/************************************************************************/
+static void endSock(HttpConn *conn)
+{
+    conn->rx->eof = 1;
+    conn->keepAliveCount = -1;
+    httpFinalize(conn);
+}
 
-/**
-    httpSession.c - Session data storage
 
-    Copyright (c) All Rights Reserved. See details at the end of the file.
+/*
+    Unmask the payload a word at a time once the data is aligned
  */
+static void unmask(uchar *data, ssize len, cuchar *mask)
+{
+    uint64  wide, *wp;
+    uchar   rotated[8];
+    ssize   i;
+    int     j;
 
-/********************************** Includes **********************************/
-
+    for (i = 0; i < len && ((size_t) &data[i] & (sizeof(uint64) - 1)); i++) {
+        data[i] ^= mask[i & 3];
+    }
+    if ((len - i) >= (ssize) sizeof(uint64)) {
+        for (j = 0; j < (int) sizeof(rotated); j++) {
+            rotated[j] = mask[(i + j) & 3];
+        }
+        memcpy(&wide, rotated, sizeof(wide));
+        for (wp = (uint64*) &data[i]; (len - i) >= (ssize) sizeof(uint64); i += sizeof(uint64)) {
+            *wp++ ^= wide;
+        }
+    }
+    for (; i < len; i++) {
+        data[i] ^= mask[i & 3];
+    }
+}
 
 
-/********************************** Forwards  *********************************/
+/*
+    Validate UTF-8 text. ASCII runs are skipped a word at a time.
+ */
+static bool validUtf8(cuchar *str, ssize len)
+{
+    cuchar  *cp, *end;
+    uint64  word;
+    int     c, n, i;
 
-static char *makeKey(HttpSession *sp, cchar *key);
-static char *makeSessionID(HttpConn *conn);
-static void manageSession(HttpSession *sp, int flags);
+    end = &str[len];
+    for (cp = str; cp < end; ) {
+        if ((end - cp) >= (ssize) sizeof(uint64)) {
+            memcpy(&word, cp, sizeof(word));
+            if ((word & 0x8080808080808080ULL) == 0) {
+                cp += sizeof(uint64);
+                continue;
+            }
+        }
+        c = *cp;
+        if (c < 0x80) {
+            cp++;
+            continue;
+        } else if (c >= 0xC2 && c <= 0xDF) {
+            n = 1;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            n = 2;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            n = 3;
+        } else {
+            return 0;
+        }
+        if ((end - cp) <= n) {
+            return 0;
+        }
+        for (i = 1; i <= n; i++) {
+            if ((cp[i] & 0xC0) != 0x80) {
+                return 0;
+            }
+        }
+        /* Reject overlong encodings, surrogates and code points above U+10FFFF */
+        if ((c == 0xE0 && cp[1] < 0xA0) || (c == 0xED && cp[1] > 0x9F) || (c == 0xF0 && cp[1] < 0x90) || 
+                (c == 0xF4 && cp[1] > 0x8F)) {
+            return 0;
+        }
+        cp += n + 1;
+    }
+    return 1;
+}
 
-/************************************* Code ***********************************/
 
-HttpSession *httpAllocSession(HttpConn *conn, cchar *id, MprTime lifespan)
+#if BIT_PACK_ZLIB
+/*
+    Decompress a received message. The sender removes the trailing empty block which must be restored.
+ */
+static HttpPacket *inflateMessage(HttpConn *conn, HttpWebSocket *ws, HttpPacket *packet, int *status)
 {
-    Http        *http;
-    HttpSession *sp;
+    z_stream    *zs;
+    HttpPacket  *result;
+    MprBuf      *buf;
+    ssize       space, limit;
+    int         rc;
 
-    mprAssert(conn);
-    http = conn->http;
+    zs = ws->inflater;
+    limit = conn->limits->webSocketsMessageSize;
+    mprPutBlockToBuf(packet->content, "\0\0\377\377", 4);
+    result = httpCreateDataPacket(max(httpGetPacketLength(packet) * 4, HTTP_BUFSIZE));
+    buf = result->content;
+    zs->next_in = (Bytef*) mprGetBufStart(packet->content);
+    zs->avail_in = (uInt) httpGetPacketLength(packet);
+    do {
+        if (mprGetBufSpace(buf) < HTTP_BUFSIZE / 4) {
+            mprGrowBuf(buf, mprGetBufSize(buf));
+        }
+        space = mprGetBufSpace(buf);
+        zs->next_out = (Bytef*) mprGetBufEnd(buf);
+        zs->avail_out = (uInt) space;
+        rc = inflate(zs, Z_SYNC_FLUSH);
+        mprAdjustBufEnd(buf, space - zs->avail_out);
+        if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            *status = HTTP_WS_STATUS_INVALID_DATA;
+            return 0;
+        }
+        if (httpGetPacketLength(result) > limit) {
+            *status = HTTP_WS_STATUS_TOO_LARGE;
+            return 0;
+        }
+    } while (zs->avail_in > 0 || zs->avail_out == 0);
 
-    lock(http);
-    if (http->sessionCount >= conn->limits->sessionMax) {
-        unlock(http);
-        return 0;
+    if (ws->clientNoTakeover) {
+        inflateReset(zs);
     }
-    http->sessionCount++;
-    unlock(http);
+    return result;
+}
 
-    if ((sp = mprAllocObj(HttpSession, manageSession)) == 0) {
-        return 0;
-    }
-    mprSetName(sp, "session");
-    sp->lifespan = lifespan;
-    if (id == 0) {
-        id = makeSessionID(conn);
+
+/*
+    Compress an outgoing message (or fragment). The trailing empty block is removed from the end of the message.
+ */
+static HttpPacket *deflateMessage(z_stream *zs, HttpPacket *packet, int reset)
+{
+    HttpPacket  *result;
+    MprBuf      *buf;
+    ssize       space, len;
+
+    len = httpGetPacketLength(packet);
+    result = httpCreateDataPacket(len / 2 + 64);
+    buf = result->content;
+    zs->next_in = (Bytef*) (len ? mprGetBufStart(packet->content) : "");
+    zs->avail_in = (uInt) len;
+    do {
+        if (mprGetBufSpace(buf) < 64) {
+            mprGrowBuf(buf, mprGetBufSize(buf));
+        }
+        space = mprGetBufSpace(buf);
+        zs->next_out = (Bytef*) mprGetBufEnd(buf);
+        zs->avail_out = (uInt) space;
+        deflate(zs, Z_SYNC_FLUSH);
+        mprAdjustBufEnd(buf, space - zs->avail_out);
+    } while (zs->avail_out == 0);
+
+    if (!(packet->flags & HTTP_PACKET_MORE)) {
+        mprAdjustBufEnd(buf, -4);
+        if (mprGetBufLength(buf) == 0) {
+            mprPutCharToBuf(buf, 0);
+        }
+        if (reset) {
+            deflateReset(zs);
+        }
     }
-    sp->id = sclone(id);
-    sp->cache = conn->http->sessionCache;
-#if FUTURE
-    sp->cache= mprCreateCache(0);
-#endif
-    return sp;
+    result->type = packet->type;
+    result->flags = packet->flags;
+    return result;
 }
+#endif
 
 
-void httpDestroySession(HttpSession *sp)
+static void outgoingSockService(HttpQueue *q)
 {
-    Http    *http;
-
-    http = MPR->httpService;
+    HttpWebSocket   *ws;
+    HttpPacket      *packet;
 
-    mprAssert(sp);
-    lock(http);
-    http->sessionCount--;
-    mprAssert(http->sessionCount >= 0);
-    unlock(http);
-    sp->id = 0;
+    ws = q->conn->rx->webSocket;
+    for (packet = httpGetPacket(q); packet; packet = httpGetPacket(q)) {
+        if (!(packet->flags & (HTTP_PACKET_HEADER | HTTP_PACKET_END | HTTP_PACKET_FRAMED))) {
+            packet = frameMessage(ws, packet);
+        }
+        /* Shared frames are never split. They are passed once the connector is within its limit. */
+        if (!((packet->flags & HTTP_PACKET_SHARED) ? httpWillNextQueueAcceptSize(q, 0) : 
+                httpWillNextQueueAcceptPacket(q, packet))) {
+            httpPutBackPacket(q, packet);
+            return;
+        }
+        httpPutPacketToNext(q, packet);
+    }
 }
 
 
-static void manageSession(HttpSession *sp, int flags)
+/*
+    Define the frame header as the packet prefix so the connector writes it with the payload in a single vectored 
+    write. Packets split downstream retain the framed flag so the remainder is not framed again. Data written via
+    httpWrite is sent as text messages.
+ */
+static HttpPacket *frameMessage(HttpWebSocket *ws, HttpPacket *packet)
 {
-    if (flags & MPR_MANAGE_MARK) {
-        mprMark(sp->id);
-        mprMark(sp->cache);
+    int         type, more, compressed;
+
+    more = packet->flags & HTTP_PACKET_MORE;
+    compressed = 0;
+    if (packet->type & 0x8) {
+        type = packet->type;
+    } else {
+        type = ws->sending ? HTTP_WS_CONT : (packet->type ? packet->type : HTTP_WS_TEXT);
+#if BIT_PACK_ZLIB
+        if (ws->deflate) {
+            packet = deflateMessage(ws->deflater, packet, ws->serverNoTakeover);
+            compressed = !ws->sending;
+        }
+#endif
+        ws->sending = more;
     }
+    packet->prefix = createFrameHeader((more ? 0 : 0x80) | (compressed ? 0x40 : 0) | type, httpGetPacketLength(packet));
+    packet->flags |= HTTP_PACKET_FRAMED;
+    return packet;
 }
 
 
-HttpSession *httpCreateSession(HttpConn *conn)
+/*
+    Create the frame header. The type is the first header byte including the final and compressed bits.
+ */
+static MprBuf *createFrameHeader(int type, MprOff len)
 {
-    return httpGetSession(conn, 1);
+    MprBuf      *prefix;
+    int         i;
+
+    prefix = mprCreateBuf(16, 16);
+    mprPutCharToBuf(prefix, type);
+    if (len < 126) {
+        mprPutCharToBuf(prefix, (int) len);
+    } else if (len <= 0xFFFF) {
+        mprPutCharToBuf(prefix, 126);
+        mprPutCharToBuf(prefix, (int) (len >> 8) & 0xFF);
+        mprPutCharToBuf(prefix, (int) len & 0xFF);
+    } else {
+        mprPutCharToBuf(prefix, 127);
+        for (i = 7; i >= 0; i--) {
+            mprPutCharToBuf(prefix, (int) (len >> (i * 8)) & 0xFF);
+        }
+    }
+    return prefix;
 }
 
 
-HttpSession *httpGetSession(HttpConn *conn, int create)
+static ssize sendFrame(HttpConn *conn, int type, cchar *buf, ssize len, int flags)
 {
-    HttpRx      *rx;
-    char        *id;
+    HttpWebSocket   *ws;
+    HttpPacket      *packet;
+    HttpQueue       *q;
+    int             resume;
 
-    mprAssert(conn);
-    rx = conn->rx;
-    mprAssert(rx);
-    if (rx->session || !conn) {
-        return rx->session;
+    if (conn->finalized || conn->sock == 0) {
+        return MPR_ERR_CANT_WRITE;
     }
-    id = httpGetSessionID(conn);
-    if (id || create) {
-        rx->session = httpAllocSession(conn, id, conn->limits->sessionTimeout);
-        if (rx->session && !id) {
-            httpSetCookie(conn, HTTP_SESSION_COOKIE, rx->session->id, "/", NULL, 0, conn->secure);
+    if ((packet = httpCreateDataPacket(max(len, 1))) == 0) {
+        return MPR_ERR_MEMORY;
+    }
+    if (len > 0 && mprPutBlockToBuf(packet->content, buf, len) != len) {
+        return MPR_ERR_MEMORY;
+    }
+    packet->type = type;
+    if (flags & HTTP_MORE) {
+        packet->flags |= HTTP_PACKET_MORE;
+    }
+    /*
+        Queue directly on the filter so the message is framed whole. The handler queue would split large messages.
+        Routes clone the filter stage, so match the queue by its service routine.
+     */
+    for (q = conn->writeq; q->service != outgoingSockService; q = q->nextQ) {
+        if (q->nextQ == conn->writeq) {
+            return MPR_ERR_BAD_STATE;
         }
     }
-    return rx->session;
+    /* Broadcast messages wait while a fragmented message is being sent */
+    ws = conn->rx->webSocket;
+    resume = 0;
+    if (!(type & 0x8)) {
+        resume = ws->fragmenting && !(flags & HTTP_MORE);
+        ws->fragmenting = (flags & HTTP_MORE) ? 1 : 0;
+    }
+    httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+    httpFlushQueue(q, 0);
+    if (resume) {
+        lock(ws);
+        if (ws->broadcasts) {
+            scheduleBroadcasts(conn, ws);
+        }
+        unlock(ws);
+    }
+    return len;
 }
 
 
-MprHash *httpGetSessionObj(HttpConn *conn, cchar *key)
+static void sendClose(HttpConn *conn, int status, cchar *reason)
 {
-    cchar   *str;
+    char    msg[WS_MAX_CONTROL];
+    ssize   len;
 
-    if ((str = httpGetSessionVar(conn, key, 0)) != 0 && *str) {
-        mprAssert(*str == '{');
-        return mprDeserialize(str);
+    msg[0] = (status >> 8) & 0xFF;
+    msg[1] = status & 0xFF;
+    len = reason ? min(slen(reason), WS_MAX_CONTROL - 2) : 0;
+    if (len > 0) {
+        memcpy(&msg[2], reason, len);
     }
-    return 0;
+    sendFrame(conn, HTTP_WS_CLOSE, msg, len + 2, 0);
 }
 
 
-cchar *httpGetSessionVar(HttpConn *conn, cchar *key, cchar *defaultValue)
+ssize httpSendBlock(HttpConn *conn, int type, cchar *buf, ssize len, int flags)
 {
-    HttpSession  *sp;
-    cchar       *result;
+    HttpWebSocket   *ws;
 
-    mprAssert(conn);
-    mprAssert(key && *key);
-
-    result = 0;
-    if ((sp = httpGetSession(conn, 0)) != 0) {
-        result = mprReadCache(sp->cache, makeKey(sp, key), 0, 0);
+    if (!conn->rx || (ws = conn->rx->webSocket) == 0 || ws->state != HTTP_WS_STATE_OPEN) {
+        return MPR_ERR_BAD_STATE;
     }
-    return result ? result : defaultValue;
+    if (type != HTTP_WS_TEXT && type != HTTP_WS_BINARY && type != HTTP_WS_PING && type != HTTP_WS_PONG) {
+        return MPR_ERR_BAD_ARGS;
+    }
+    if ((type & 0x8) && (len > WS_MAX_CONTROL || (flags & HTTP_MORE))) {
+        return MPR_ERR_BAD_ARGS;
+    }
+    if (len < 0) {
+        len = slen(buf);
+    }
+    return sendFrame(conn, type, buf, len, flags);
 }
 
 
-int httpSetSessionObj(HttpConn *conn, cchar *key, MprHash *obj)
+ssize httpSend(HttpConn *conn, cchar *fmt, ...)
 {
-    httpSetSessionVar(conn, key, mprSerialize(obj, 0));
-    return 0;
+    va_list     args;
+    char        *buf;
+
+    va_start(args, fmt);
+    buf = sfmtv(fmt, args);
+    va_end(args);
+    return httpSendBlock(conn, HTTP_WS_TEXT, buf, slen(buf), 0);
 }
 
 
-int httpSetSessionVar(HttpConn *conn, cchar *key, cchar *value)
+void httpCloseWebSocket(HttpConn *conn, int status, cchar *reason)
 {
-    HttpSession  *sp;
-
-    mprAssert(conn);
-    mprAssert(key && *key);
-    mprAssert(value);
+    HttpWebSocket   *ws;
 
-    if ((sp = httpGetSession(conn, 1)) == 0) {
-        return 0;
-    }
-    if (mprWriteCache(sp->cache, makeKey(sp, key), value, 0, sp->lifespan, 0, MPR_CACHE_SET) == 0) {
-        return MPR_ERR_CANT_WRITE;
+    if (conn->rx && (ws = conn->rx->webSocket) != 0 && ws->state == HTTP_WS_STATE_OPEN) {
+        sendClose(conn, status, reason);
+        ws->state = HTTP_WS_STATE_CLOSING;
     }
-    return 0;
 }
 
 
-int httpRemoveSessionVar(HttpConn *conn, cchar *key)
+int httpGetWebSocketState(HttpConn *conn)
 {
-    HttpSession  *sp;
-
-    mprAssert(conn);
-    mprAssert(key && *key);
-
-    if ((sp = httpGetSession(conn, 1)) == 0) {
-        return 0;
-    }
-    return mprRemoveCache(sp->cache, makeKey(sp, key)) ? 0 : MPR_ERR_CANT_FIND;
+    return (conn->rx && conn->rx->webSocket) ? conn->rx->webSocket->state : 0;
 }
 
 
-char *httpGetSessionID(HttpConn *conn)
+/*
+    Broadcast groups. Group membership is protected by the Http lock. The broadcast messages waiting for each member
+    are protected by the member WebSocket lock.
+ */
+int httpJoinGroup(HttpConn *conn, cchar *name)
 {
-    HttpRx  *rx;
-    cchar   *cookies, *cookie;
-    char    *cp, *value;
-    int     quoted;
-
-    mprAssert(conn);
-    rx = conn->rx;
-    mprAssert(rx);
+    Http            *http;
+    HttpWebSocket   *ws;
+    HttpGroup       *group;
 
-    if (rx->session) {
-        return rx->session->id;
+    if (!conn->rx || (ws = conn->rx->webSocket) == 0 || ws->state != HTTP_WS_STATE_OPEN) {
+        return MPR_ERR_BAD_STATE;
     }
-    if (rx->sessionProbed) {
-        return 0;
+    http = conn->http;
+    lock(http);
+    if ((group = getGroup(http, name, 1)) == 0) {
+        unlock(http);
+        return MPR_ERR_MEMORY;
     }
-    rx->sessionProbed = 1;
-    cookies = httpGetCookies(conn);
-    for (cookie = cookies; cookie && (value = strstr(cookie, HTTP_SESSION_COOKIE)) != 0; cookie = value) {
-        value += strlen(HTTP_SESSION_COOKIE);
-        while (isspace((uchar) *value) || *value == '=') {
-            value++;
-        }
-        quoted = 0;
-        if (*value == '"') {
-            value++;
-            quoted++;
-        }
-        for (cp = value; *cp; cp++) {
-            if (quoted) {
-                if (*cp == '"' && cp[-1] != '\\') {
-                    break;
-                }
-            } else {
-                if ((*cp == ',' || *cp == ';') && cp[-1] != '\\') {
-                    break;
-                }
-            }
+    if (mprLookupItem(group->members, conn) < 0) {
+        if (ws->groups == 0) {
+            ws->groups = mprCreateList(0, 0);
         }
-        return snclone(value, cp - value);
+        mprAddItem(ws->groups, group);
+        mprAddItem(group->members, conn);
     }
+    unlock(http);
     return 0;
 }
 
 
-static char *makeSessionID(HttpConn *conn)
+void httpLeaveGroup(HttpConn *conn, cchar *name)
 {
-    char        idBuf[64];
-    static int  nextSession = 0;
-
-    mprAssert(conn);
-
-    /* Thread race here on nextSession++ not critical */
-    mprSprintf(idBuf, sizeof(idBuf), "%08x%08x%d", PTOI(conn->data) + PTOI(conn), (int) mprGetTime(), nextSession++);
-    return mprGetMD5WithPrefix(idBuf, sizeof(idBuf), "::http.session::");
-}
-
+    Http            *http;
+    HttpWebSocket   *ws;
+    HttpGroup       *group;
 
-static char *makeKey(HttpSession *sp, cchar *key)
-{
-    return sfmt("session-%s-%s", sp->id, key);
+    http = conn->http;
+    lock(http);
+    if ((group = getGroup(http, name, 0)) != 0) {
+        mprRemoveItem(group->members, conn);
+        if (conn->rx && (ws = conn->rx->webSocket) != 0 && ws->groups) {
+            mprRemoveItem(ws->groups, group);
+        }
+    }
+    unlock(http);
 }
 
-/*
-    @copy   default
-
-    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
-
-    This software is distributed under commercial and open source licenses.
-    You may use the Embedthis Open Source license or you may acquire a 
-    commercial license from Embedthis Software. You agree to be fully bound
-    by the terms of either license. Consult the LICENSE.md distributed with
-    this software for full details and other copyrights.
-
-    Local variables:
-    tab-width: 4
-    c-basic-offset: 4
-    End:
-    vim: sw=4 ts=4 expandtab
-
-    @end
- */
-
-/************************************************************************/
-/*
-    Start of file "src/sockFilter.c"
- */
-/************************************************************************/
 
 /*
-    sockFilter.c - Web Sockets filter.
-
-    Copyright (c) All Rights Reserved. See details at the end of the file.
+    Remove the connection from all groups when closed
  */
+static void leaveGroups(HttpConn *conn, HttpWebSocket *ws)
+{
+    Http        *http;
+    HttpGroup   *group;
+    int         next;
 
-/********************************* Includes ***********************************/
-
+    http = conn->http;
+    lock(http);
+    if (ws->groups) {
+        for (ITERATE_ITEMS(ws->groups, group, next)) {
+            mprRemoveItem(group->members, conn);
+        }
+    }
+    unlock(http);
 
+    /* A broadcast already fanning out from a member snapshot skips the connection once groups is cleared */
+    lock(ws);
+    ws->groups = 0;
+    ws->broadcasts = 0;
+    ws->broadcastBytes = 0;
+    unlock(ws);
+}
 
-#if BIT_WEB_SOCKETS
-/********************************** Locals ************************************/
 
-#define WSS_MAGIC "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+HttpGroup *httpLookupGroup(Http *http, cchar *name)
+{
+    HttpGroup   *group;
 
-/********************************** Forwards **********************************/
+    lock(http);
+    group = getGroup(http, name, 0);
+    unlock(http);
+    return group;
+}
 
-static int matchSock(HttpConn *conn, HttpRoute *route, int dir);
-static void openSock(HttpQueue *q);
-static void outgoingSockService(HttpQueue *q);
-static void setSockPrefix(HttpQueue *q, HttpPacket *packet);
 
-/*********************************** Code *************************************/
-/* 
-   Loadable module initialization
- */
-int httpOpenSockFilter(Http *http)
+int httpSetGroupLimits(Http *http, cchar *name, ssize maxQueued, int policy)
 {
-    HttpStage     *filter;
+    HttpGroup   *group;
 
-    mprLog(5, "Open sock filter");
-    if ((filter = httpCreateFilter(http, "sockFilter", HTTP_STAGE_ALL, NULL)) == 0) {
-        return MPR_ERR_CANT_CREATE;
+    lock(http);
+    if ((group = getGroup(http, name, 1)) == 0) {
+        unlock(http);
+        return MPR_ERR_MEMORY;
     }
-    http->sockFilter = filter;
-    filter->match = matchSock; 
-    filter->open = openSock; 
-    filter->outgoingService = outgoingSockService; 
+    group->maxQueued = maxQueued;
+    group->policy = policy;
+    unlock(http);
     return 0;
 }
 
-//  MOB
-char *sha1(char *s)
-{
-   return s;
-} 
 
 /*
-    This is called twice: once for TX and once for RX
+    Must be locked
  */
-static int matchSock(HttpConn *conn, HttpRoute *route, int dir)
+static HttpGroup *getGroup(Http *http, cchar *name, int create)
 {
-    HttpRx      *rx;
-    char        *value;
+    HttpGroup   *group;
 
-    //  MOB - what is called first TX or RX?
-
-    rx = conn->rx;
-    if (rx->upgrade && scaselessmatch(rx->upgrade, "websocket")) {
-        if (!rx->sockKey) {
-            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad Sec-WebSocketKey");
-            return HTTP_ROUTE_REJECT;
+    if (http->groups == 0) {
+        if (!create) {
+            return 0;
         }
-        value = mprDecode64(sha1(sjoin(rx->sockKey, WSS_MAGIC, NULL)));
-        httpSetHeader(conn, "Sec-WebSocket-Accept", value);
-        httpSetHeader(conn, "Sec-WebSocket-Protocol", "chat");
-        return HTTP_ROUTE_OK;
+        http->groups = mprCreateHash(-1, 0);
     }
-    return HTTP_ROUTE_REJECT;
-#if UNUSED
-    if (dir & HTTP_STAGE_TX) {
-    } else {
+    if ((group = mprLookupKey(http->groups, name)) == 0 && create) {
+        if ((group = mprAllocObj(HttpGroup, manageGroup)) == 0) {
+            return 0;
+        }
+        group->name = sclone(name);
+        group->members = mprCreateList(-1, 0);
+        group->maxQueued = HTTP_MAX_WS_BACKLOG;
+        group->policy = HTTP_GROUP_DROP;
+        mprAddKey(http->groups, name, group);
     }
-#endif
+    return group;
 }
 
 
-static void openSock(HttpQueue *q)
+static void manageGroup(HttpGroup *group, int flags)
 {
-    HttpConn    *conn;
-
-    conn = q->conn;
-    q->packetSize = min(conn->limits->sockSize, q->max);
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(group->name);
+        mprMark(group->members);
+    }
 }
 
 
-/*  
-    Filter sock headers and leave behind pure data. This is called for socked and unsocked data.
-    Socked data format is:
-        Sock spec <CRLF>
-        Data <CRLF>
-        Sock spec (size == 0) <CRLF>
-        <CRLF>
-    Sock spec is: "HEX_COUNT; sock length DECIMAL_COUNT\r\n". The "; sock length DECIMAL_COUNT is optional.
-    As an optimization, use "\r\nSIZE ...\r\n" as the delimiter so that the CRLF after data does not special consideration.
-    Achive this by parseHeaders reversing the input start by 2.
-
-    Return number of bytes available to read.
-    NOTE: may set rx->eof and return 0 bytes on EOF.
+/*
+    Frame the message once and add the frame to the waiting messages for each member. Members queue the frame when
+    the delivery event runs on the member dispatcher. The Http lock is held only to snapshot the member list so
+    joining, leaving and other broadcasts are not blocked by the fan-out. Each member is locked while its waiting
+    messages are updated. The member queue counts are read here without locking. A stale count only delays applying
+    the limit by a message.
  */
-ssize httpFilterSockData(HttpQueue *q, HttpPacket *packet)
+int httpBroadcast(Http *http, cchar *name, int type, cchar *buf, ssize len)
 {
-    HttpConn    *conn;
-    HttpRx      *rx;
-    MprBuf      *buf;
-    ssize       sockSize, nbytes;
-    char        *start, *cp;
-    int         bad;
-
-    conn = q->conn;
-    rx = conn->rx;
-    mprAssert(packet);
-    buf = packet->content;
-    mprAssert(buf);
+    HttpGroup       *group;
+    HttpConn        *conn;
+    HttpWebSocket   *ws;
+    HttpPacket      *frame, *plain, *compressed[16];
+    MprList         *members;
+    ssize           size, queued;
+    int             count, dropped, next;
 
-    switch (rx->sockState) {
-    case HTTP_CHUNK_UNCHUNKED:
-        nbytes = mprGetBufLength(buf);
-        if (conn->http10 && nbytes == 0 && mprIsSocketEof(conn->sock)) {
-            rx->eof = 1;
-        }
-        return (ssize) min(rx->remainingContent, nbytes);
+    if (type != HTTP_WS_TEXT && type != HTTP_WS_BINARY) {
+        return MPR_ERR_BAD_ARGS;
+    }
+    if (len < 0) {
+        len = slen(buf);
+    }
+    if ((plain = httpCreateDataPacket(max(len, 1))) == 0) {
+        return MPR_ERR_MEMORY;
+    }
+    if (len > 0 && mprPutBlockToBuf(plain->content, buf, len) != len) {
+        return MPR_ERR_MEMORY;
+    }
+    createSharedFrame(plain, type, 0);
+    memset(compressed, 0, sizeof(compressed));
+    count = dropped = 0;
 
-    case HTTP_CHUNK_DATA:
-        mprLog(7, "sockFilter: data %d bytes, rx->remainingContent %d", httpGetPacketLength(packet), rx->remainingContent);
-        if (rx->remainingContent > 0) {
-            return (ssize) min(rx->remainingContent, mprGetBufLength(buf));
-        }
-        /* End of sock - prep for the next sock */
-        rx->remainingContent = HTTP_BUFSIZE;
-        rx->sockState = HTTP_CHUNK_START;
-        /* Fall through */
+    lock(http);
+    if ((group = getGroup(http, name, 0)) == 0) {
+        unlock(http);
+        return 0;
+    }
+    group->messages++;
+    members = mprCloneList(group->members);
+    unlock(http);
 
-    case HTTP_CHUNK_START:
-        /*  
-            Validate:  "\r\nSIZE.*\r\n"
-         */
-        if (mprGetBufLength(buf) < 5) {
-            return MPR_ERR_NOT_READY;
-        }
-        start = mprGetBufStart(buf);
-        bad = (start[0] != '\r' || start[1] != '\n');
-        for (cp = &start[2]; cp < buf->end && *cp != '\n'; cp++) {}
-        if (*cp != '\n' && (cp - start) < 80) {
-            return MPR_ERR_NOT_READY;
-        }
-        bad += (cp[-1] != '\r' || cp[0] != '\n');
-        if (bad) {
-            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad sock specification");
-            return 0;
-        }
-        sockSize = (int) stoiradix(&start[2], 16, NULL);
-        if (!isxdigit((int) start[2]) || sockSize < 0) {
-            httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad sock specification");
-            return 0;
-        }
-        if (sockSize == 0) {
-            /*
-                Last sock. Consume the final "\r\n".
-             */
-            if ((cp + 2) >= buf->end) {
-                return MPR_ERR_NOT_READY;
+    for (ITERATE_ITEMS(members, conn, next)) {
+        if (!conn->rx || (ws = conn->rx->webSocket) == 0 || ws->state != HTTP_WS_STATE_OPEN || ws->queue == 0) {
+            continue;
+        }
+        lock(ws);
+        if (ws->groups == 0) {
+            /* Closed since the snapshot */
+            unlock(ws);
+            continue;
+        }
+        frame = plain;
+#if BIT_PACK_ZLIB
+        /*
+            The compressed frame does not reference prior messages, so it can only be shared by members without server
+            context takeover. Other members receive the uncompressed frame which does not disturb their context.
+         */
+        if (ws->deflate && ws->serverNoTakeover) {
+            if (compressed[ws->windowBits] == 0) {
+                compressed[ws->windowBits] = compressFrame(plain, type, ws->windowBits);
             }
-            cp += 2;
-            bad += (cp[-1] != '\r' || cp[0] != '\n');
-            if (bad) {
-                httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad final sock specification");
-                return 0;
+            if (compressed[ws->windowBits]) {
+                frame = compressed[ws->windowBits];
             }
         }
-        mprAdjustBufStart(buf, (cp - start + 1));
-        /* Remaining content is set to the next sock size */
-        rx->remainingContent = sockSize;
-        if (sockSize == 0) {
-            rx->sockState = HTTP_CHUNK_EOF;
-            rx->eof = 1;
-        } else {
-            rx->sockState = HTTP_CHUNK_DATA;
+#endif
+        size = httpGetPacketLength(frame);
+        queued = ws->broadcastBytes + ws->queue->count + ws->queue->nextQ->count;
+        if ((queued + size) > group->maxQueued) {
+            dropped++;
+            if (group->policy & HTTP_GROUP_DISCONNECT) {
+                ws->disconnect = 1;
+                scheduleBroadcasts(conn, ws);
+            }
+            unlock(ws);
+            continue;
+        }
+        if (ws->broadcasts == 0) {
+            ws->broadcasts = mprCreateList(0, MPR_LIST_OWN);
         }
-        mprLog(7, "sockFilter: start incoming sock of %d bytes", sockSize);
-        return min(sockSize, mprGetBufLength(buf));
+        mprAddItem(ws->broadcasts, frame);
+        ws->broadcastBytes += size;
+        scheduleBroadcasts(conn, ws);
+        unlock(ws);
+        count++;
+    }
+    if (dropped) {
+        lock(http);
+        group->dropped += dropped;
+        unlock(http);
+    }
+    return count;
+}
 
-    default:
-        httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_REQUEST, "Bad sock state %d", rx->sockState);
+
+/*
+    WebSocket must be locked
+ */
+static void scheduleBroadcasts(HttpConn *conn, HttpWebSocket *ws)
+{
+    if (!ws->scheduled) {
+        ws->scheduled = 1;
+        mprCreateEvent(conn->dispatcher, "broadcast", 0, deliverBroadcasts, conn, 0);
     }
-    return 0;
 }
 
 
-static void outgoingSockService(HttpQueue *q)
+/*
+    Queue the waiting broadcast messages. This runs on the member dispatcher.
+ */
+static void deliverBroadcasts(HttpConn *conn, MprEvent *event)
 {
-    HttpConn    *conn;
-    HttpPacket  *packet;
-    HttpTx      *tx;
-    cchar       *value;
+    Http            *http;
+    HttpWebSocket   *ws;
+    HttpPacket      *frame;
+    MprList         *frames;
+    int             disconnect, next;
 
-    conn = q->conn;
-    tx = conn->tx;
+    http = conn->http;
+    if (!conn->rx || (ws = conn->rx->webSocket) == 0) {
+        return;
+    }
+    lock(ws);
+    ws->scheduled = 0;
+    if (ws->fragmenting && !ws->disconnect) {
+        /* Rescheduled when the handler sends the final fragment */
+        unlock(ws);
+        return;
+    }
+    frames = ws->broadcasts;
+    disconnect = ws->disconnect;
+    ws->broadcasts = 0;
+    ws->broadcastBytes = 0;
+    unlock(ws);
 
-    if (!(q->flags & HTTP_QUEUE_SERVICED)) {
-        /*
-            If we don't know the content length (tx->length < 0) and if the last packet is the end packet. Then
-            we have all the data. Thus we can determine the actual content length and can bypass the sock handler.
-         */
-        if (tx->length < 0 && (value = mprLookupKey(tx->headers, "Content-Length")) != 0) {
-            tx->length = stoi(value);
-        }
-        if (tx->length < 0 && tx->sockSize < 0) {
-            if (q->last->flags & HTTP_PACKET_END) {
-                if (q->count > 0) {
-                    tx->length = q->count;
-                }
-            } else {
-                tx->sockSize = min(conn->limits->sockSize, q->max);
-            }
-        }
-        if (tx->flags & HTTP_TX_USE_OWN_HEADERS) {
-            tx->sockSize = -1;
+    if (conn->sock == 0 || conn->state >= HTTP_STATE_COMPLETE || ws->state != HTTP_WS_STATE_OPEN) {
+        return;
+    }
+    conn->lastActivity = http->now;
+    if (disconnect) {
+        mprLog(3, "WebSockets: disconnect connection exceeding the broadcast queue limit");
+        ws->state = HTTP_WS_STATE_CLOSED;
+        httpDisconnect(conn);
+        endSock(conn);
+
+    } else if (frames) {
+        for (ITERATE_ITEMS(frames, frame, next)) {
+            httpPutForService(ws->queue, shareFrame(frame), HTTP_SCHEDULE_QUEUE);
         }
     }
-    if (tx->sockSize <= 0) {
-        httpDefaultOutgoingServiceStage(q);
-    } else {
-        for (packet = httpGetPacket(q); packet; packet = httpGetPacket(q)) {
-            if (!(packet->flags & HTTP_PACKET_HEADER)) {
-                httpPutBackPacket(q, packet);
-                httpJoinPackets(q, tx->sockSize);
-                packet = httpGetPacket(q);
-                if (httpGetPacketLength(packet) > tx->sockSize) {
-                    httpResizePacket(q, packet, tx->sockSize);
-                }
-            }
-            if (!httpWillNextQueueAcceptPacket(q, packet)) {
-                httpPutBackPacket(q, packet);
-                return;
-            }
-            if (!(packet->flags & HTTP_PACKET_HEADER)) {
-                setSockPrefix(q, packet);
-            }
-            httpPutPacketToNext(q, packet);
+    httpServiceQueues(conn);
+    if (conn->state < HTTP_STATE_COMPLETE) {
+        if (conn->connectorq->count > 0) {
+            httpEnableConnEvents(conn);
         }
+    } else {
+        httpPump(conn, NULL);
     }
 }
 
 
-static void setSockPrefix(HttpQueue *q, HttpPacket *packet)
+/*
+    Frame a broadcast message. The frame is shared by all group members and must not be modified.
+ */
+static HttpPacket *createSharedFrame(HttpPacket *packet, int type, int compressed)
 {
-    if (packet->prefix) {
-        return;
+    packet->type = type;
+    packet->prefix = createFrameHeader(0x80 | (compressed ? 0x40 : 0) | type, httpGetPacketLength(packet));
+    packet->flags |= HTTP_PACKET_FRAMED | HTTP_PACKET_SHARED;
+    return packet;
+}
+
+
+/*
+    Create a member packet for a shared frame. The connector consumes packet buffers as it writes, so each member
+    needs its own view of the frame data.
+ */
+static HttpPacket *shareFrame(HttpPacket *frame)
+{
+    HttpPacket  *packet;
+
+    packet = httpCreatePacket(0);
+    packet->prefix = mprShareBuf(frame->prefix);
+    packet->content = mprShareBuf(frame->content);
+    packet->type = frame->type;
+    packet->flags = frame->flags;
+    return packet;
+}
+
+
+#if BIT_PACK_ZLIB
+/*
+    Compress a broadcast message with a new compression context
+ */
+static HttpPacket *compressFrame(HttpPacket *packet, int type, int bits)
+{
+    z_stream    zs;
+    HttpPacket  *result;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -bits, min(bits - 7, 8), Z_DEFAULT_STRATEGY) != Z_OK) {
+        return 0;
     }
-    packet->prefix = mprCreateBuf(32, 32);
-    /*  
-        NOTE: prefixes don't count in the queue length. No need to adjust q->count
-     */
-    if (httpGetPacketLength(packet)) {
-        mprPutFmtToBuf(packet->prefix, "\r\n%x\r\n", httpGetPacketLength(packet));
-    } else {
-        mprPutStringToBuf(packet->prefix, "\r\n0\r\n\r\n");
+    result = deflateMessage(&zs, packet, 0);
+    deflateEnd(&zs);
+    return createSharedFrame(result, type, 1);
+}
+#endif
+
+
+/*
+    SHA-1 digest for the handshake accept key (RFC 3174)
+ */
+static void sha1(cuchar *data, ssize len, uchar digest[20])
+{
+    uint32  h[5], w[80], a, b, c, d, e, f, k, t;
+    uchar   block[64];
+    ssize   pos, total, i;
+    int     j;
+
+    h[0] = 0x67452301;
+    h[1] = 0xEFCDAB89;
+    h[2] = 0x98BADCFE;
+    h[3] = 0x10325476;
+    h[4] = 0xC3D2E1F0;
+    total = ((len + 8) / 64 + 1) * 64;
+
+    for (pos = 0; pos < total; pos += 64) {
+        for (j = 0; j < 64; j++) {
+            i = pos + j;
+            if (i < len) {
+                block[j] = data[i];
+            } else if (i == len) {
+                block[j] = 0x80;
+            } else if (i >= total - 8) {
+                block[j] = (uchar) (((uint64) len * 8) >> ((total - 1 - i) * 8));
+            } else {
+                block[j] = 0;
+            }
+        }
+        for (j = 0; j < 16; j++) {
+            w[j] = (block[j * 4] << 24) | (block[j * 4 + 1] << 16) | (block[j * 4 + 2] << 8) | block[j * 4 + 3];
+        }
+        for (j = 16; j < 80; j++) {
+            t = w[j - 3] ^ w[j - 8] ^ w[j - 14] ^ w[j - 16];
+            w[j] = (t << 1) | (t >> 31);
+        }
+        a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+        for (j = 0; j < 80; j++) {
+            if (j < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (j < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (j < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            t = ((a << 5) | (a >> 27)) + f + e + k + w[j];
+            e = d;
+            d = c;
+            c = (b << 30) | (b >> 2);
+            b = a;
+            a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for (j = 0; j < 20; j++) {
+        digest[j] = (uchar) (h[j / 4] >> (24 - (j % 4) * 8));
     }
 }
 
@@ -13522,14 +17699,12 @@ static void incoming(HttpQueue *q, HttpPacket *packet)
     } else {
         /* This queue is the last queue in the pipeline */
         //  MOB - should this call WillAccept?
-        if (httpGetPacketLength(packet) > 0) {
-            httpJoinPacketForService(q, packet, 0);
-            HTTP_NOTIFY(q->conn, 0, HTTP_NOTIFY_READABLE);
-        } else {
-            /* Zero length packet means eof */
-            httpPutForService(q, packet, HTTP_DELAY_SERVICE);
-            HTTP_NOTIFY(q->conn, 0, HTTP_NOTIFY_READABLE);
-        }
+        /* 
+            Packets are not joined. WebSockets messages and upload file data are read as separate packets and body 
+            data is read across the packet chain by httpRead. A zero length packet means eof.
+         */
+        httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+        HTTP_NOTIFY(q->conn, 0, HTTP_NOTIFY_READABLE);
     }
     mprAssert(httpVerifyQueue(q));
 }
@@ -14112,7 +18287,9 @@ void httpFinalize(HttpConn *conn)
     }
     conn->responded = 1;
     conn->finalized = 1;
-
+    if (conn->rx && conn->rx->session) {
+        httpWriteSession(conn);
+    }
     if (conn->state >= HTTP_STATE_CONNECTED && conn->writeq && conn->sock) {
         httpPutForService(conn->writeq, httpCreateEndPacket(), HTTP_SCHEDULE_QUEUE);
         httpServiceQueues(conn);
@@ -14441,9 +18618,9 @@ static void setHeaders(HttpConn *conn, HttpPacket *packet)
         if (tx->outputRanges->next == 0) {
             range = tx->outputRanges;
             if (tx->entityLength > 0) {
-                httpSetHeader(conn, "Content-Range", "bytes %Ld-%Ld/%Ld", range->start, range->end, tx->entityLength);
+                httpSetHeader(conn, "Content-Range", "bytes %Ld-%Ld/%Ld", range->start, range->end - 1, tx->entityLength);
             } else {
-                httpSetHeader(conn, "Content-Range", "bytes %Ld-%Ld/*", range->start, range->end);
+                httpSetHeader(conn, "Content-Range", "bytes %Ld-%Ld/*", range->start, range->end - 1);
             }
         } else {
             httpSetHeader(conn, "Content-Type", "multipart/byteranges; boundary=%s", tx->rangeBoundary);
@@ -14512,6 +18689,10 @@ void httpWriteHeaders(HttpConn *conn, HttpPacket *packet)
     if (tx->flags & HTTP_TX_HEADERS_CREATED) {
         return;
     }    
+    if (conn->endpoint && conn->rx->session && conn->rx->session->store == HTTP_SESSION_CLIENT) {
+        /* Client session cookies must be set before the headers are created */
+        httpWriteSession(conn);
+    }
     tx->flags |= HTTP_TX_HEADERS_CREATED;
     conn->responded = 1;
     if (conn->headersCallback) {
@@ -14523,7 +18704,10 @@ void httpWriteHeaders(HttpConn *conn, HttpPacket *packet)
         return;
     }
     setHeaders(conn, packet);
-
+    if (conn->stream) {
+        /* HTTP/2 headers are encoded by the http2 connector */
+        return;
+    }
     if (conn->endpoint) {
         mprPutStringToBuf(buf, conn->protocol);
         mprPutCharToBuf(buf, ' ');
@@ -14629,7 +18813,8 @@ bool httpFileExists(HttpConn *conn)
 /*
     uploadFilter.c - Upload file filter.
     The upload filter processes post data according to RFC-1867 ("multipart/form-data" post data). 
-    It saves the uploaded files in a configured upload directory.
+    It saves the uploaded files in a configured upload directory. If the route enables HTTP_ROUTE_UPLOAD_STREAM, 
+    file data is passed to the handler as it is received instead.
     Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
  */
 
@@ -14655,18 +18840,24 @@ typedef struct Upload {
     MprFile         *file;              /* Current file I/O object */
     char            *boundary;          /* Boundary signature */
     ssize           boundaryLen;        /* Length of boundary */
+    ssize           searched;           /* Length of buffered form data already searched for the boundary */
+    MprOff          reserved;           /* Disk space reserved for the current file */
     int             contentState;       /* Input states */
+    int             stream;             /* Stream file data to the handler */
     char            *clientFilename;    /* Current file filename */
     char            *tmpPath;           /* Current temp filename for upload data */
     char            *id;                /* Current name keyword value */
+    int             skip[256];          /* Boundary search shift for each byte value */
 } Upload;
 
 
 /********************************** Forwards **********************************/
 
 static void closeUpload(HttpQueue *q);
-static char *getBoundary(void *buf, ssize bufLen, void *boundary, ssize boundaryLen);
+static bool findSplitBoundary(Upload *up, cchar *first, ssize firstLen, cchar *next, ssize span);
+static char *getBoundary(Upload *up, char *buf, ssize bufLen);
 static void incomingUpload(HttpQueue *q, HttpPacket *packet);
+static void initBoundary(Upload *up);
 static void manageHttpUploadFile(HttpUploadFile *file, int flags);
 static void manageUpload(Upload *up, int flags);
 static int matchUpload(HttpConn *conn, HttpRoute *route, int dir);
@@ -14674,6 +18865,9 @@ static void openUpload(HttpQueue *q);
 static int  processContentBoundary(HttpQueue *q, char *line);
 static int  processContentHeader(HttpQueue *q, char *line);
 static int  processContentData(HttpQueue *q);
+static bool queueFileData(HttpQueue *q, HttpPacket *packet);
+static int reserveFile(HttpQueue *q, MprOff need);
+static int writeToFile(HttpQueue *q, MprBuf *content, ssize len, int more);
 
 /************************************* Code ***********************************/
 
@@ -14713,6 +18907,10 @@ static int matchUpload(HttpConn *conn, HttpRoute *route, int dir)
     len = strlen(pat);
     if (sncaselesscmp(rx->mimeType, pat, len) == 0) {
         rx->upload = 1;
+        if (route->flags & HTTP_ROUTE_UPLOAD_STREAM) {
+            /* Start the handler before the body is received so it can consume file data as it arrives */
+            rx->streamInput = 1;
+        }
         mprLog(5, "matchUpload for %s", rx->uri);
         return HTTP_ROUTE_OK;
     }
@@ -14739,7 +18937,12 @@ static void openUpload(HttpQueue *q)
     }
     q->queueData = up;
     up->contentState = HTTP_UPLOAD_BOUNDARY;
+    up->stream = (rx->route->flags & HTTP_ROUTE_UPLOAD_STREAM) ? 1 : 0;
+    rx->autoDelete = rx->route->autoDelete;
 
+    if (rx->uploadDir == 0) {
+        rx->uploadDir = rx->route->uploadDir;
+    }
     if (rx->uploadDir == 0) {
 #if BIT_WIN_LIKE
         rx->uploadDir = mprNormalizePath(getenv("TEMP"));
@@ -14758,6 +18961,7 @@ static void openUpload(HttpQueue *q)
         httpError(conn, HTTP_CODE_BAD_REQUEST, "Bad boundary");
         return;
     }
+    initBoundary(up);
     httpSetParam(conn, "UPLOAD_DIR", rx->uploadDir);
 }
 
@@ -14788,8 +18992,14 @@ static void closeUpload(HttpQueue *q)
     up = q->queueData;
     
     if (up->currentFile) {
+        /* Incomplete file */
         file = up->currentFile;
         file->filename = 0;
+        if (up->file) {
+            mprCloseFile(up->file);
+            up->file = 0;
+            mprDeletePath(up->tmpPath);
+        }
     }
     if (rx->autoDelete) {
         httpRemoveAllUploadedFiles(q->conn);
@@ -14828,20 +19038,28 @@ static void incomingUpload(HttpQueue *q, HttpPacket *packet)
     
     /*  
         Put the packet data onto the service queue for buffering. This aggregates input data incase we don't have
-        a complete mime record yet.
+        a complete mime record yet. File data is not joined unless a boundary may span the packets.
      */
-    httpJoinPacketForService(q, packet, 0);
-    
+    if (!queueFileData(q, packet)) {
+        if (q->first && !(q->first->flags & HTTP_PACKET_HEADER)) {
+            rx->bytesCopied += httpGetPacketLength(packet);
+        }
+        httpJoinPacketForService(q, packet, 0);
+    }
     packet = q->first;
-    content = packet->content;
-    mprAddNullToBuf(content);
     count = httpGetPacketLength(packet);
 
     for (done = 0, line = 0; !done; ) {
+        /* Streamed file data is split from the packet so the content buffer may change */
+        content = packet->content;
         if  (up->contentState == HTTP_UPLOAD_BOUNDARY || up->contentState == HTTP_UPLOAD_CONTENT_HEADER) {
             /*
                 Parse the next input line
              */
+            if (mprGetBufSpace(content) == 0) {
+                rx->bytesCopied += mprGetBufLength(content);
+            }
+            mprAddNullToBuf(content);
             line = mprGetBufStart(content);
             stok(line, "\n", &nextTok);
             if (nextTok == 0) {
@@ -14867,7 +19085,8 @@ static void incomingUpload(HttpQueue *q, HttpPacket *packet)
 
         case HTTP_UPLOAD_CONTENT_DATA:
             rc = processContentData(q);
-            if (rc < 0) {
+            if (rc <= 0) {
+                /* Error or need more data */
                 done++;
             }
             if (httpGetPacketLength(packet) < up->boundaryLen) {
@@ -14884,7 +19103,9 @@ static void incomingUpload(HttpQueue *q, HttpPacket *packet)
     /*  
         Compact the buffer to prevent memory growth. There is often residual data after the boundary for the next block.
      */
-    if (packet != rx->headerPacket) {
+    content = packet->content;
+    if (packet != rx->headerPacket && mprGetBufStart(content) > mprGetBuf(content)) {
+        rx->bytesCopied += mprGetBufLength(content);
         mprCompactBuf(content);
     }
     q->count -= (count - httpGetPacketLength(packet));
@@ -14900,6 +19121,63 @@ static void incomingUpload(HttpQueue *q, HttpPacket *packet)
 }
 
 
+/*
+    Queue file data without joining it to the buffered data. The buffered data is the end of the current file data
+    that has already been searched for the boundary. If the boundary and its preceding CRLF can't start in the 
+    buffered data, the buffered data is written and the packet is queued in its place. Returns true if queued.
+ */
+static bool queueFileData(HttpQueue *q, HttpPacket *packet)
+{
+    HttpPacket  *first;
+    Upload      *up;
+    ssize       len;
+
+    up = q->queueData;
+    if ((first = q->first) == 0) {
+        httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+        return 1;
+    }
+    if (up->contentState != HTTP_UPLOAD_CONTENT_DATA || !up->clientFilename || first->next || 
+            (first->flags & HTTP_PACKET_HEADER) || httpGetPacketLength(packet) < (up->boundaryLen + 2)) {
+        return 0;
+    }
+    len = httpGetPacketLength(first);
+    if (findSplitBoundary(up, mprGetBufStart(first->content), len, mprGetBufStart(packet->content), len + 2)) {
+        return 0;
+    }
+    if (writeToFile(q, first->content, len, 1) < 0) {
+        return 0;
+    }
+    q->count -= len;
+    httpGetPacket(q);
+    httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+    return 1;
+}
+
+
+/*
+    Test if the boundary starts within the first "span" bytes of data held in two buffers. The next buffer must hold at 
+    least span bytes plus the boundary length. This searches across the buffers without joining them.
+ */
+static bool findSplitBoundary(Upload *up, cchar *first, ssize firstLen, cchar *next, ssize span)
+{
+    ssize   i, part;
+
+    for (i = 0; i < span; i++) {
+        if (i < firstLen) {
+            part = min(firstLen - i, up->boundaryLen);
+            if (memcmp(&first[i], up->boundary, part) == 0 && 
+                    memcmp(next, &up->boundary[part], up->boundaryLen - part) == 0) {
+                return 1;
+            }
+        } else if (memcmp(&next[i - firstLen], up->boundary, up->boundaryLen) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
 /*  
     Process the mime boundary division
     Returns  < 0 on a request or state error
@@ -14947,6 +19225,10 @@ static int processContentHeader(HttpQueue *q, char *line)
     up = q->queueData;
     
     if (line[0] == '\0') {
+        if (up->stream && up->clientFilename) {
+            /* Streamed files are visible to the handler as soon as the data begins */
+            httpAddUploadFile(conn, up->id, up->currentFile);
+        }
         up->contentState = HTTP_UPLOAD_CONTENT_DATA;
         return 0;
     }
@@ -14992,6 +19274,17 @@ static int processContentHeader(HttpQueue *q, char *line)
                     return MPR_ERR_BAD_STATE;
                 }
                 up->clientFilename = sclone(value);
+                /*  
+                    Create the files[id]
+                 */
+                file = up->currentFile = mprAllocObj(HttpUploadFile, manageHttpUploadFile);
+                file->name = up->id;
+                file->clientFilename = sclone(up->clientFilename);
+                if (up->stream) {
+                    mprLog(5, "File upload of: %s streamed to the handler", up->clientFilename);
+                    key = nextPair;
+                    continue;
+                }
                 /*  
                     Create the file to hold the uploaded data
                  */
@@ -15008,11 +19301,11 @@ static int processContentHeader(HttpQueue *q, char *line)
                     httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Can't open upload temp file %s", up->tmpPath);
                     return MPR_ERR_BAD_STATE;
                 }
-                /*  
-                    Create the files[id]
+                /*
+                    Write the file in large blocks. Disk space is reserved ahead of the data as it arrives.
                  */
-                file = up->currentFile = mprAllocObj(HttpUploadFile, manageHttpUploadFile);
-                file->clientFilename = sclone(up->clientFilename);
+                mprEnableFileBuffering(up->file, HTTP_UPLOAD_BUFSIZE, HTTP_UPLOAD_BUFSIZE);
+                up->reserved = 0;
                 file->filename = sclone(up->tmpPath);
             }
             key = nextPair;
@@ -15031,6 +19324,7 @@ static int processContentHeader(HttpQueue *q, char *line)
 static void manageHttpUploadFile(HttpUploadFile *file, int flags)
 {
     if (flags & MPR_MANAGE_MARK) {
+        mprMark(file->name);
         mprMark(file->filename);
         mprMark(file->clientFilename);
         mprMark(file->contentType);
@@ -15059,19 +19353,28 @@ static void defineFileFields(HttpQueue *q, Upload *up)
     key = sjoin("FILE_CONTENT_TYPE_", up->id, NULL);
     httpSetParam(conn, key, file->contentType);
 
-    key = sjoin("FILE_FILENAME_", up->id, NULL);
-    httpSetParam(conn, key, file->filename);
+    if (file->filename) {
+        key = sjoin("FILE_FILENAME_", up->id, NULL);
+        httpSetParam(conn, key, file->filename);
+    }
 
     key = sjoin("FILE_SIZE_", up->id, NULL);
     httpSetIntParam(conn, key, (int) file->size);
 }
 
 
-static int writeToFile(HttpQueue *q, char *data, ssize len)
+/*
+    Write file data from the start of the content buffer to the upload temp file and consume the data. Streamed uploads 
+    pass the data to the handler instead. The data is split from the content buffer without copying, so the content
+    buffer of the first queued packet is replaced. The last packet for each streamed file is sent with more set to 
+    false and omits HTTP_PACKET_MORE.
+ */
+static int writeToFile(HttpQueue *q, MprBuf *content, ssize len, int more)
 {
     HttpConn        *conn;
     HttpUploadFile  *file;
     HttpLimits      *limits;
+    HttpPacket      *packet;
     Upload          *up;
     ssize           rc;
 
@@ -15084,16 +19387,40 @@ static int writeToFile(HttpQueue *q, char *data, ssize len)
         httpError(conn, HTTP_CODE_REQUEST_TOO_LARGE, "Uploaded file exceeds maximum %,Ld", limits->uploadSize);
         return MPR_ERR_CANT_WRITE;
     }
-    if (len > 0) {
+    if (up->stream) {
+        if (len > 0 || !more) {
+            mprAssert(q->first && q->first->content == content);
+            if ((packet = httpCreatePacket(0)) == 0) {
+                httpMemoryError(conn);
+                return MPR_ERR_MEMORY;
+            }
+            packet->content = content;
+            if ((q->first->content = mprSplitBuf(content, len)) == 0) {
+                httpMemoryError(conn);
+                return MPR_ERR_MEMORY;
+            }
+            if (q->first->content->block == 0) {
+                conn->rx->bytesCopied += mprGetBufLength(q->first->content);
+            }
+            packet->flags |= HTTP_PACKET_DATA | HTTP_PACKET_UPLOAD | (more ? HTTP_PACKET_MORE : 0);
+            packet->upload = file;
+            file->size += len;
+            httpPutPacketToNext(q, packet);
+        }
+    } else if (len > 0) {
         /*  
             File upload. Write the file data.
          */
-        rc = mprWriteFile(up->file, data, len);
+        if ((file->size + len) > up->reserved && reserveFile(q, file->size + len) < 0) {
+            return MPR_ERR_CANT_WRITE;
+        }
+        rc = mprWriteFile(up->file, mprGetBufStart(content), len);
         if (rc != len) {
             httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, 
                 "Can't write to upload temp file %s, rc %d, errno %d", up->tmpPath, rc, mprGetOsError());
             return MPR_ERR_CANT_WRITE;
         }
+        mprAdjustBufStart(content, len);
         file->size += len;
         mprLog(7, "uploadFilter: Wrote %d bytes to %s", len, up->tmpPath);
     }
@@ -15101,6 +19428,37 @@ static int writeToFile(HttpQueue *q, char *data, ssize len)
 }
 
 
+/*
+    Reserve disk space for the upload file in chunks ahead of the data. The reservation is bounded by the request
+    content not yet received, so a request that declares a large body but sends little does not hold disk space.
+    Unused space is released when the file is complete.
+ */
+static int reserveFile(HttpQueue *q, MprOff need)
+{
+    HttpConn    *conn;
+    HttpRx      *rx;
+    Upload      *up;
+    MprOff      size;
+
+    conn = q->conn;
+    rx = conn->rx;
+    up = q->queueData;
+
+    size = min(need + HTTP_UPLOAD_RESERVE, conn->limits->uploadSize);
+    if (rx->length > 0) {
+        size = min(size, up->currentFile->size + rx->remainingContent + httpGetPacketLength(q->first));
+    }
+    size = max(size, need);
+    if (mprPreallocateFile(up->file, size) < 0) {
+        httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, 
+            "Can't allocate %,Ld bytes for upload temp file %s", size, up->tmpPath);
+        return MPR_ERR_CANT_WRITE;
+    }
+    up->reserved = size;
+    return 0;
+}
+
+
 /*  
     Process the content data.
     Returns < 0 on error
@@ -15114,7 +19472,7 @@ static int processContentData(HttpQueue *q)
     HttpPacket      *packet;
     MprBuf          *content;
     Upload          *up;
-    ssize           size, dataLen;
+    ssize           size, dataLen, crlf;
     char            *data, *bp, *key;
 
     conn = q->conn;
@@ -15128,75 +19486,104 @@ static int processContentData(HttpQueue *q)
         /*  Incomplete boundary. Return and get more data */
         return 0;
     }
-    bp = getBoundary(mprGetBufStart(content), size, up->boundary, up->boundaryLen);
+    /*
+        Form data is buffered until the boundary is seen. Resume the search where the last search ended.
+     */
+    data = mprGetBufStart(content);
+    bp = getBoundary(up, &data[up->searched], size - up->searched);
     if (bp == 0) {
         mprLog(7, "uploadFilter: Got boundary filename %x", up->clientFilename);
         if (up->clientFilename) {
             /*  
-                No signature found yet. probably more data to come. Must handle split boundaries.
+                No signature found yet. probably more data to come. Keep enough data to handle a split boundary 
+                and the CRLF that precedes it.
              */
-            data = mprGetBufStart(content);
-            dataLen = ((int) (mprGetBufEnd(content) - data)) - (up->boundaryLen - 1);
-            if (dataLen > 0 && writeToFile(q, mprGetBufStart(content), dataLen) < 0) {
-                return MPR_ERR_CANT_WRITE;
+            dataLen = size - (up->boundaryLen + 1);
+            if (dataLen > 0) {
+                if (writeToFile(q, content, dataLen, 1) < 0) {
+                    return MPR_ERR_CANT_WRITE;
+                }
             }
-            mprAdjustBufStart(content, dataLen);
-            return 0;       /* Get more data */
+        } else if (size > conn->limits->receiveFormSize) {
+            httpError(conn, HTTP_CODE_REQUEST_TOO_LARGE, "Upload form field exceeds maximum %,Ld", 
+                conn->limits->receiveFormSize);
+            return MPR_ERR_WONT_FIT;
+        } else {
+            up->searched = size - (up->boundaryLen - 1);
         }
+        return 0;       /* Get more data */
     }
-    data = mprGetBufStart(content);
-    dataLen = (bp) ? (bp - data) : mprGetBufLength(content);
+    up->searched = 0;
+    dataLen = bp - data;
 
     if (dataLen > 0) {
-        mprAdjustBufStart(content, dataLen);
         /*  
             This is the CRLF before the boundary
          */
-        if (dataLen >= 2 && data[dataLen - 2] == '\r' && data[dataLen - 1] == '\n') {
-            dataLen -= 2;
-        }
+        crlf = (dataLen >= 2 && data[dataLen - 2] == '\r' && data[dataLen - 1] == '\n') ? 2 : 0;
+        dataLen -= crlf;
         if (up->clientFilename) {
             /*  
                 Write the last bit of file data and add to the list of files and define environment variables
              */
-            if (writeToFile(q, data, dataLen) < 0) {
+            if (writeToFile(q, content, dataLen, 0) < 0) {
                 return MPR_ERR_CANT_WRITE;
             }
-            httpAddUploadFile(conn, up->id, file);
+            mprAdjustBufStart(q->first->content, crlf);
+            if (!up->stream) {
+                if (mprFlushFile(up->file) < 0) {
+                    httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Can't write to upload temp file %s, errno %d", 
+                        up->tmpPath, mprGetOsError());
+                    return MPR_ERR_CANT_WRITE;
+                }
+                httpAddUploadFile(conn, up->id, file);
+            }
             defineFileFields(q, up);
 
         } else {
             /*  
                 Normal string form data variables
              */
+            mprAdjustBufStart(content, dataLen + crlf);
             data[dataLen] = '\0'; 
             mprLog(5, "uploadFilter: form[%s] = %s", up->id, data);
             key = mprUriDecode(up->id);
             data = mprUriDecode(data);
             httpSetParam(conn, key, data);
 
-            if (packet == 0) {
-                packet = httpCreatePacket(HTTP_BUFSIZE);
-            }
-            if (httpGetPacketLength(packet) > 0) {
-                /*
-                    Need to add www-form-urlencoding separators
-                 */
-                mprPutCharToBuf(packet->content, '&');
-            } else {
-                conn->rx->mimeType = sclone("application/x-www-form-urlencoded");
+            if (!up->stream) {
+                /* Streamed form fields are only available as params as the handler is reading upload packets */
+                if (packet == 0) {
+                    packet = httpCreatePacket(HTTP_BUFSIZE);
+                }
+                if (httpGetPacketLength(packet) > 0) {
+                    /*
+                        Need to add www-form-urlencoding separators
+                     */
+                    mprPutCharToBuf(packet->content, '&');
+                } else {
+                    conn->rx->mimeType = sclone("application/x-www-form-urlencoded");
 
+                }
+                mprPutFmtToBuf(packet->content, "%s=%s", up->id, data);
             }
-            mprPutFmtToBuf(packet->content, "%s=%s", up->id, data);
         }
     }
     if (up->clientFilename) {
         /*  
             Now have all the data (we've seen the boundary)
          */
-        mprCloseFile(up->file);
-        up->file = 0;
+        if (up->file) {
+            mprCloseFile(up->file);
+            up->file = 0;
+        }
         up->clientFilename = 0;
+        up->currentFile = 0;
+        if (up->reserved > file->size) {
+            /* Release the unused preallocated space */
+            mprTruncateFile(up->tmpPath, file->size);
+        }
+        up->reserved = 0;
     }
     if (packet) {
         httpPutPacketToNext(q, packet);
@@ -15206,34 +19593,46 @@ static int processContentData(HttpQueue *q)
 }
 
 
+/*
+    Compute the Boyer-Moore-Horspool shift table for the boundary. Each entry is the distance to advance the search
+    when that byte value is aligned with the last byte of the boundary.
+ */
+static void initBoundary(Upload *up)
+{
+    ssize   i, last;
+
+    last = up->boundaryLen - 1;
+    for (i = 0; i < 256; i++) {
+        up->skip[i] = (int) up->boundaryLen;
+    }
+    for (i = 0; i < last; i++) {
+        up->skip[(uchar) up->boundary[i]] = (int) (last - i);
+    }
+}
+
+
 /*  
-    Find the boundary signature in memory. Returns pointer to the first match.
+    Find the boundary signature in memory. Returns pointer to the first match. This uses a Boyer-Moore-Horspool 
+    search which tests one byte per boundary length for typical upload data.
  */ 
-static char *getBoundary(void *buf, ssize bufLen, void *boundary, ssize boundaryLen)
+static char *getBoundary(Upload *up, char *buf, ssize bufLen)
 {
-    char    *cp, *endp;
-    char    first;
+    uchar   *cp, *endp, *boundary;
+    ssize   last;
 
     mprAssert(buf);
-    mprAssert(boundary);
-    mprAssert(boundaryLen > 0);
-
-    first = *((char*) boundary);
-    cp = (char*) buf;
+    mprAssert(up->boundaryLen > 0);
 
-    if (bufLen < boundaryLen) {
+    if (bufLen < up->boundaryLen) {
         return 0;
     }
-    endp = cp + (bufLen - boundaryLen) + 1;
-    while (cp < endp) {
-        cp = (char *) memchr(cp, first, endp - cp);
-        if (!cp) {
-            return 0;
-        }
-        if (memcmp(cp, boundary, boundaryLen) == 0) {
-            return cp;
+    boundary = (uchar*) up->boundary;
+    last = up->boundaryLen - 1;
+    endp = (uchar*) &buf[bufLen - last];
+    for (cp = (uchar*) buf; cp < endp; cp += up->skip[cp[last]]) {
+        if (cp[last] == boundary[last] && memcmp(cp, boundary, last) == 0) {
+            return (char*) cp;
         }
-        cp++;
     }
     return 0;
 }
@@ -16132,6 +20531,9 @@ static void addParamsFromQueue(HttpQueue *q)
     rx = conn->rx;
 
     if ((rx->form || rx->upload) && q->first && q->first->content) {
+        if (q->first->next) {
+            rx->bytesCopied += q->count - httpGetPacketLength(q->first);
+        }
         httpJoinPackets(q, -1);
         content = q->first->content;
         mprAddNullToBuf(content);
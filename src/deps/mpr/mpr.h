@@ -322,6 +322,9 @@
 
 #if LINUX
     #include    <sys/epoll.h>
+    #if BIT_IO_URING && BIT_PACK_IO_URING
+        #include    <linux/io_uring.h>
+    #endif
 #endif
 
 #if BIT_UNIX_LIKE
@@ -334,6 +337,7 @@
 
 #if LINUX
     #include    <sys/prctl.h>
+    #include    <sys/syscall.h>
 #endif
 
     #include    <sys/types.h>
@@ -370,6 +374,7 @@
 
 #if LINUX && !__UCLIBC__
     #include    <sys/sendfile.h>
+    #include    <ucontext.h>
 #endif
 
 #if MACOSX
@@ -718,6 +723,10 @@ typedef int64 MprTime;
     #define BIT_HAS_SPINLOCK    1
 #endif
 
+#if LINUX && !__UCLIBC__
+    #define BIT_HAS_UCONTEXT    1
+#endif
+
 #if BIT_HAS_DOUBLE_BRACES
     #define  NULL_INIT    {{0}}
 #else
@@ -1192,6 +1201,7 @@ struct  MprXml;
     #define MPR_BUFSIZE             4096          /**< Reasonable size for buffers */
     #define MPR_BUF_INCR            4096          /**< Default buffer growth inc */
     #define MPR_EPOLL_SIZE          32            /**< Epoll backlog */
+    #define MPR_IO_URING_SIZE       64            /**< io_uring submission ring size */
     #define MPR_MAX_BUF             4194304       /**< Max buffer size */
     #define MPR_XML_BUFSIZE         4096          /**< XML read buffer size */
     #define MPR_SSL_BUFSIZE         4096          /**< SSL has 16K max*/
@@ -1219,6 +1229,7 @@ struct  MprXml;
     #define MPR_BUF_INCR            4096
     #define MPR_MAX_BUF             -1
     #define MPR_EPOLL_SIZE          64
+    #define MPR_IO_URING_SIZE       256
     #define MPR_XML_BUFSIZE         4096
     #define MPR_SSL_BUFSIZE         4096
     #define MPR_LIST_INCR           16
@@ -1243,6 +1254,7 @@ struct  MprXml;
     #define MPR_BUFSIZE             8192
     #define MPR_MAX_BUF             -1
     #define MPR_EPOLL_SIZE          128
+    #define MPR_IO_URING_SIZE       1024
     #define MPR_XML_BUFSIZE         4096
     #define MPR_SSL_BUFSIZE         8192
     #define MPR_LIST_INCR           16
@@ -1361,6 +1373,9 @@ struct  MprXml;
  */
 #if LINUX || FREEBSD
     #define MPR_EVENT_EPOLL     1
+    #if LINUX && BIT_IO_URING && BIT_PACK_IO_URING && defined(IORING_FEAT_EXT_ARG)
+        #define MPR_EVENT_IO_URING  1   /* Use io_uring if supported by the kernel, otherwise epoll */
+    #endif
 #elif MACOSX || SOLARIS
     #define MPR_EVENT_KQUEUE    1
 #elif VXWORKS || WINCE || CYGWIN
@@ -3451,11 +3466,12 @@ typedef int (*MprBufProc)(struct MprBuf* bp, void *arg);
         mprInsertCharToBuf mprLookAtLastCharInBuf mprLookAtNextCharInBuf mprPutBlockToBuf mprPutCharToBuf 
         mprPutCharToWideBuf mprPutFmtToBuf mprPutFmtToWideBuf mprPutIntToBuf mprPutPadToBuf mprPutStringToBuf 
         mprPutStringToWideBuf mprPutSubStringToBuf mprRefillBuf mprResetBufIfEmpty mprSetBufMax mprSetBufRefillProc 
-        mprSetBufSize 
+        mprSetBufSize mprShareBuf mprSplitBuf 
     @defgroup MprBuf MprBuf
  */
 typedef struct MprBuf {
     char            *data;              /**< Actual buffer for data */
+    char            *block;             /**< Allocated memory block containing data if split from another buffer */
     char            *endbuf;            /**< Pointer one past the end of buffer */
     char            *start;             /**< Pointer to next data char */
     char            *end;               /**< Pointer one past the last data chr */
@@ -3518,6 +3534,32 @@ extern MprBuf *mprCreateBuf(ssize initialSize, ssize maxSize);
  */
 extern MprBuf *mprCloneBuf(MprBuf *orig);
 
+/**
+    Share a buffer
+    @description Create a read-only view of the buffer contents without copying. The view has its own start and 
+        end pointers, so data can be consumed from the view without modifying the original buffer. The view has
+        no free space. Writing to the view reallocates its data first. The original buffer contents must not be
+        modified while views are in use.
+    @param orig Original buffer to share
+    @return Returns a newly allocated buffer that references the original buffer data
+    @ingroup MprBuf
+ */
+extern MprBuf *mprShareBuf(MprBuf *orig);
+
+/**
+    Split a buffer
+    @description Split the buffer contents at an offset without copying. The buffer retains the contents before the
+        offset and has no free space. The returned buffer holds the contents after the offset and any free space.
+        The buffers use separate regions of the same memory, so each may be written, flushed or compacted without
+        modifying the other. The returned buffer retains the whole memory block, so contents after the offset that 
+        are small relative to the block are copied into a new buffer instead.
+    @param buf Buffer created via mprCreateBuf
+    @param offset Offset from the buffer start at which to split. Must be less than or equal to the buffer length.
+    @return Returns a new buffer containing the buffer contents after the offset
+    @ingroup MprBuf
+ */
+extern MprBuf *mprSplitBuf(MprBuf *buf, ssize offset);
+
 /**
     Compact the buffer contents
     @description Compact the buffer contents by copying the contents down to start the the buffer origin.
@@ -4972,7 +5014,8 @@ extern void mprSetPathNewline(cchar *path, cchar *newline);
     @stability Evolving.
     @see MprFile mprAttachFileFd mprCloseFile mprDisableFileBuffering mprEnableFileBuffering mprFlushFile mprGetFileChar 
         mprGetFilePosition mprGetFileSize mprGetStderr mprGetStdin mprGetStdout mprOpenFile 
-        mprPeekFileChar mprPutFileChar mprPutFileString mprReadFile mprReadLine mprSeekFile mprTruncateFile mprWriteFile 
+        mprPeekFileChar mprPreallocateFile mprPutFileChar mprPutFileString mprReadFile mprReadLine mprSeekFile 
+        mprTruncateFile mprWriteFile 
         mprWriteFormat mprWriteString 
         mprGetFileFd
     @defgroup MprFile MprFile
@@ -5139,6 +5182,18 @@ extern MprFile *mprOpenFile(cchar *filename, int omode, int perms);
  */
 extern int mprPeekFileChar(MprFile *file);
 
+/**
+    Reserve disk space for a file
+    @description Allocate disk blocks for data that will be written to the file. This does not change the file size. 
+        Preallocating a file that will be written sequentially reduces fragmentation and fails early if the
+        file system is full. This is advisory and does nothing on systems that do not support it.
+    @param file Pointer to an MprFile object returned via MprOpen.
+    @param size Number of bytes to reserve from the start of the file.
+    @return Zero if successful or if not supported. Otherwise a negative MPR error code.
+    @ingroup MprFile
+ */
+extern int mprPreallocateFile(MprFile *file, MprOff size);
+
 /**
     Write a character to the file.
     @description Writes a single character to the file. Output is buffered and is
@@ -5996,6 +6051,14 @@ extern int mprUnloadModule(MprModule *mp);
 #define MPR_EVENT_MAGIC         0x12348765
 #define MPR_DISPATCHER_MAGIC    0x23418877
 
+/*
+    Flags for MprDispatcher.flags
+ */
+#define MPR_DISPATCHER_INLINE       0x1     /**< Events never block. Service inline on the event thread if budget permits */
+#define MPR_DISPATCHER_COROUTINE    0x2     /**< Service events on a coroutine. Waiting suspends instead of blocking */
+
+#define MPR_MAX_INLINE_DISPATCH     16      /**< Max inline dispatchers serviced per event loop iteration */
+
 /**
     Event callback function
     @return Return non-zero if the dispatcher is deleted. Otherwise return 0
@@ -6051,6 +6114,11 @@ typedef struct MprDispatcher {
     struct MprEventService *service;
     struct MprWorker *requiredWorker;   /**< Worker affinity */
     MprOsThread     owner;              /**< Owning thread of the dispatcher */
+    MprTime         due;                /**< Due time of the first event when on the waitQ */
+    int             waitIndex;          /**< Index in the waitQ heap */
+    struct MprWorker *lastWorker;       /**< Worker that last serviced the dispatcher */
+    struct MprCoroutine *waiter;        /**< Coroutine suspended in mprWaitForEvent on this dispatcher */
+    int             flags;              /**< Dispatcher flags */
 } MprDispatcher;
 
 
@@ -6060,11 +6128,15 @@ typedef struct MprEventService {
     MprDispatcher   *runQ;              /**< Queue of running dispatchers */
     MprDispatcher   *readyQ;            /**< Queue of dispatchers with events ready to run */
     MprDispatcher   *waitQ;             /**< Queue of waiting (future) events */
+    MprDispatcher   **waitHeap;         /**< Waiting dispatchers ordered by due time (min-heap) */
+    int             waitCount;          /**< Count of dispatchers in the waitHeap */
+    int             waitMax;            /**< Size of the waitHeap */
     MprDispatcher   *idleQ;             /**< Queue of idle dispatchers */
     MprDispatcher   *pendingQ;          /**< Queue of pending dispatchers (waiting for resources) */
     MprOsThread     serviceThread;      /**< Thread running the dispatcher service */
     int             eventCount;         /**< Count of events */
     int             waiting;            /**< Waiting for I/O (sleeping) */
+    ssize           coroutineStackSize; /**< Default coroutine stack size */
     struct MprCond  *waitCond;          /**< Waiting sync */
     struct MprMutex *mutex;             /**< Multi-thread sync */
 } MprEventService;
@@ -6129,6 +6201,132 @@ extern int mprWaitForEvent(MprDispatcher *dispatcher, MprTime timeout);
  */
 extern void mprSignalDispatcher(MprDispatcher *dispatcher);
 
+#ifndef MPR_COROUTINE_STACK
+    #define MPR_COROUTINE_STACK     (128 * 1024)    /**< Default coroutine stack reservation. Pages are committed on first use */
+#endif
+#ifndef MPR_COROUTINE_LOCALS
+    #define MPR_COROUTINE_LOCALS    8               /**< Thread local slots saved and restored for each coroutine */
+#endif
+
+/*
+    Coroutine states
+ */
+#define MPR_COROUTINE_READY         0       /**< Created and not yet run */
+#define MPR_COROUTINE_RUNNING       1       /**< Running on a thread */
+#define MPR_COROUTINE_SUSPENDING    2       /**< Switching out. Still on the thread stack */
+#define MPR_COROUTINE_SUSPENDED     3       /**< Suspended and may be resumed by any thread */
+#define MPR_COROUTINE_DONE          4       /**< Entry procedure has returned */
+
+/**
+    Coroutine entry procedure
+    @ingroup MprCoroutine
+ */
+typedef void (*MprCoroutineProc)(void *data);
+
+/**
+    Coroutine object
+    @description Coroutines run code on a private user-space stack so that a blocking wait can suspend the
+        coroutine and return the underlying thread to the worker pool. A coroutine is bound to the thread that first
+        runs it and is always resumed on that thread. Data stored via #mprSetThreadData is saved and restored with 
+        the coroutine, so coroutines sharing a thread do not see each other's values. If the thread is busy, the 
+        resume waits until the thread completes its current work. Code must not hold a lock across a wait that may 
+        suspend. Use #mprHoldCoroutine to block the thread instead. Suspended coroutines are treated by the garbage 
+        collector the same as yielded threads: their stacks are not scanned and references must be held by managed 
+        objects.
+    @see mprCreateCoroutine mprGetCurrentCoroutine mprHoldCoroutine mprReleaseCoroutine mprResumeCoroutine 
+        mprSetCoroutineStackSize mprSuspendCoroutine mprWakeCoroutine
+    @defgroup MprCoroutine MprCoroutine
+ */
+typedef struct MprCoroutine {
+    MprCoroutineProc    proc;           /**< Entry procedure */
+    void                *data;          /**< Entry procedure data argument */
+    char                *stack;         /**< Stack memory (includes a guard page) */
+    ssize               stackSize;      /**< Size of the stack memory */
+    int                 state;          /**< Coroutine state */
+    int                 wakeRequested;  /**< Resume was requested before the coroutine finished suspending */
+    int                 signalled;      /**< Wait was satisfied by a signal rather than a timeout */
+    int                 held;           /**< Waits block the thread instead of suspending while held */
+    MprEvent            *timer;         /**< Wait timeout event */
+    struct MprDispatcher *dispatcher;   /**< Dispatcher serviced by the coroutine */
+    struct MprThread    *thread;        /**< Thread the coroutine is bound to */
+    struct MprWorker    *worker;        /**< Worker the coroutine is bound to. Null if not a worker thread */
+    void                *locals[MPR_COROUTINE_LOCALS]; /**< Thread local data while switched out */
+#if BIT_HAS_UCONTEXT
+    ucontext_t          context;        /**< Saved coroutine context */
+    ucontext_t          caller;         /**< Context of the thread that resumed the coroutine */
+#endif
+} MprCoroutine;
+
+/**
+    Create a coroutine
+    @param proc Procedure to run on the coroutine stack
+    @param data Data argument passed to proc. Must be an allocated memory object or null.
+    @param stackSize Stack size in bytes. Set to zero for the default set via #mprSetCoroutineStackSize.
+    @return A coroutine object or null if coroutines are not supported on this platform.
+    @ingroup MprCoroutine
+ */
+extern MprCoroutine *mprCreateCoroutine(MprCoroutineProc proc, void *data, ssize stackSize);
+
+/**
+    Get the coroutine running on the current thread
+    @return The current coroutine or null if not running on a coroutine
+    @ingroup MprCoroutine
+ */
+extern MprCoroutine *mprGetCurrentCoroutine();
+
+/**
+    Prevent the current coroutine from suspending
+    @description While held, waits on the current coroutine block the thread as they would without a coroutine. Call
+        before acquiring a lock that is held across a wait. Calls may be nested and must be matched by 
+        #mprReleaseCoroutine. Does nothing if not running on a coroutine.
+    @ingroup MprCoroutine
+ */
+extern void mprHoldCoroutine();
+
+/**
+    Permit the current coroutine to suspend again
+    @description Reverses a call to #mprHoldCoroutine.
+    @ingroup MprCoroutine
+ */
+extern void mprReleaseCoroutine();
+
+/**
+    Resume a coroutine on the current thread
+    @description Runs the coroutine until it suspends or its entry procedure returns. The first resume binds the 
+        coroutine to the current thread. The coroutine stack is released when the entry procedure returns.
+    @param coroutine Coroutine to resume
+    @return The coroutine state after it switches back: MPR_COROUTINE_SUSPENDED or MPR_COROUTINE_DONE. Returns
+        MPR_ERR_BAD_STATE if the coroutine is bound to another thread.
+    @ingroup MprCoroutine
+ */
+extern int mprResumeCoroutine(MprCoroutine *coroutine);
+
+/**
+    Set the default coroutine stack size
+    @param size Stack size in bytes. Set to zero to restore the default of MPR_COROUTINE_STACK.
+    @ingroup MprCoroutine
+ */
+extern void mprSetCoroutineStackSize(ssize size);
+
+/**
+    Suspend the current coroutine
+    @description Switch back to the thread that resumed the coroutine. The call returns when the coroutine is resumed
+        via #mprResumeCoroutine or a wake scheduled via #mprWakeCoroutine.
+    @ingroup MprCoroutine
+ */
+extern void mprSuspendCoroutine();
+
+/**
+    Wake a suspended coroutine
+    @description Schedule the coroutine to be resumed on the worker it is bound to. If the worker is busy, the 
+        coroutine is resumed when the worker completes its current work. If the coroutine is still in the process
+        of suspending, it will be resumed as soon as the suspend completes. Coroutines that are not bound to a 
+        worker must be resumed explicitly via #mprResumeCoroutine.
+    @param coroutine Coroutine to wake
+    @ingroup MprCoroutine
+ */
+extern void mprWakeCoroutine(MprCoroutine *coroutine);
+
 /**
     Create a new event
     @description Create a new event for service
@@ -6514,6 +6712,7 @@ extern void mprJsonParseError(MprJson *jp, cchar *fmt, ...);
  */
 typedef struct MprThreadService {
     MprList         *threads;           /**< List of all threads */
+    MprList         *locals;            /**< Thread local keys. Swapped when switching coroutines */
     struct MprThread *mainThread;       /**< Main application Mpr thread id */
     MprCond         *cond;              /**< Multi-thread sync */
     ssize           stackSize;          /**< Default thread stack size */
@@ -6565,6 +6764,7 @@ typedef struct MprThread {
 #endif
     int             stickyYield;        /**< Yielded does not auto-clear after GC */
     int             yielded;            /**< Thread has yielded to GC */
+    struct MprCoroutine *coroutine;     /**< Coroutine currently running on this thread */
 } MprThread;
 
 
@@ -6733,6 +6933,9 @@ typedef struct MprWaitService {
     struct MprWaitHandler **handlerMap;     /* Map of fds to handlers */
     int             handlerMax;             /* Size of the handlers array */
     int             breakPipe[2];           /* Pipe to wakeup select */
+#if MPR_EVENT_IO_URING
+    struct MprRing  *ring;                  /* io_uring used instead of epoll if supported */
+#endif
 #elif MPR_EVENT_KQUEUE
     int             kq;                     /* Kqueue() return descriptor */
     struct kevent   *interest;              /* Events of interest */
@@ -6793,6 +6996,12 @@ extern int  mprInitWindow();
 #if MPR_EVENT_EPOLL
     extern void mprManageEpoll(MprWaitService *ws, int flags);
 #endif
+#if MPR_EVENT_IO_URING
+    extern int  mprCreateRing(MprWaitService *ws);
+    extern bool mprIsRingActive(MprWaitService *ws);
+    extern int  mprNotifyRing(MprWaitService *ws, struct MprWaitHandler *wp, int mask);
+    extern bool mprWaitForRing(MprWaitService *ws, MprTime timeout);
+#endif
 #if MPR_EVENT_POLL
     extern void mprManagePoll(MprWaitService *ws, int flags);
 #endif
@@ -6827,20 +7036,21 @@ extern int mprWaitForSingleIO(int fd, int mask, MprTime timeout);
  */
 #define MPR_WAIT_RECALL_HANDLER     0x1     /**< Wait handler flag to recall the handler asap */
 #define MPR_WAIT_NEW_DISPATCHER     0x2     /**< Wait handler flag to create a new dispatcher for each I/O event */
+#define MPR_WAIT_INLINE             0x4     /**< Create new dispatchers with MPR_DISPATCHER_INLINE */
 
 /**
     Wait Handler Service
     @description Wait handlers provide callbacks for when I/O events occur. They provide a wait to service many
         I/O file descriptors without requiring a thread per descriptor.
-    @see MprEvent MprWaitHandler mprCreateWaitHandler mprQueueIOEvent mprRecallWaitHandler mprRecallWaitHandlerByFd 
-        mprRemoveWaitHandler mprUpdateWaitHandler mprWaitOn 
+    @see MprEvent MprWaitHandler mprCreateWaitHandler mprEnableIoUring mprQueueIOEvent mprRecallWaitHandler 
+        mprRecallWaitHandlerByFd mprRemoveWaitHandler mprUpdateWaitHandler mprWaitOn 
     @defgroup MprWaitHandler MprWaitHandler
  */
 typedef struct MprWaitHandler {
     int             desiredMask;        /**< Mask of desired events */
     int             presentMask;        /**< Mask of current events */
     int             fd;                 /**< O/S File descriptor (sp->sock) */
-    int             notifierIndex;      /**< Index for notifier */
+    int             notifierIndex;      /**< Index for notifier. Sequence of the outstanding poll for io_uring */
     int             flags;              /**< Control flags */
     void            *handlerData;       /**< Argument to pass to proc */
     MprEvent        *event;             /**< Event object to process I/O events */
@@ -6865,11 +7075,24 @@ typedef struct MprWaitHandler {
     @param proc Callback function to invoke when an I/O event of interest has occurred.
     @param data Data item to pass to the callback
     @param flags Wait handler flags. Use MPR_WAIT_NEW_DISPATCHER to auto-create a new dispatcher for each I/O event.
+        Add MPR_WAIT_INLINE to service the new dispatchers on the event thread.
     @returns A new wait handler registered with the MPR event mechanism
     @ingroup MprWaitHandler
  */
 extern MprWaitHandler *mprCreateWaitHandler(int fd, int mask, MprDispatcher *dispatcher, void *proc, void *data, int flags);
 
+/**
+    Select the io_uring or epoll wait service
+    @description On Linux, the wait service uses io_uring if configured and supported by the kernel. Otherwise epoll is
+        used. Io_uring is not configured by default. Configure with "--set io_uring=true" to enable it. If the io_uring 
+        submission ring becomes full, the wait service reverts to epoll. Registered wait handlers are moved to the 
+        selected mechanism.
+    @param enable Set to true to use io_uring and false to use epoll.
+    @returns Zero if successful. Returns MPR_ERR_BAD_STATE if io_uring is not available.
+    @ingroup MprWaitHandler
+ */
+extern int mprEnableIoUring(bool enable);
+
 /**
     Queue an IO event for dispatch on the wait handler dispatcher
     @param wp Wait handler created via #mprCreateWaitHandler
@@ -6959,6 +7182,7 @@ typedef struct MprSocketProvider {
     ssize   (*readSocket)(struct MprSocket *socket, void *buf, ssize len);
     ssize   (*writeSocket)(struct MprSocket *socket, cvoid *buf, ssize len);
     int     (*upgradeSocket)(struct MprSocket *socket, struct MprSsl *ssl, int server);
+    int     (*handshakeSocket)(struct MprSocket *socket);
 } MprSocketProvider;
 
 /**
@@ -6980,6 +7204,11 @@ typedef struct MprSocketService {
     MprHash         *providers;                 /**< Secure socket providers */         
     MprSocketPrebind prebind;                   /**< Prebind callback */
     MprList         *secureSockets;             /**< List of secured (matrixssl) sockets */
+    MprList         *handshakes;                /**< Active SSL handshakes */
+    MprList         *handshakeQ;                /**< SSL handshakes ready to run */
+    MprList         *handshakeIdle;             /**< Wakeup conditions for idle handshake threads */
+    int             handshakeMax;               /**< Maximum number of handshake threads */
+    int             handshakeThreads;           /**< Current number of handshake threads */
     MprMutex        *mutex;                     /**< Multithread locking */
 } MprSocketService;
 
@@ -7038,6 +7267,7 @@ extern void mprAddSocketProvider(cchar *name, MprSocketProvider *provider);
 #define MPR_SOCKET_CLIENT       0x800       /**< Socket is a client */
 #define MPR_SOCKET_PENDING      0x1000      /**< Pending buffered read data */
 #define MPR_SOCKET_TRACED       0x2000      /**< Socket has been traced to the log */
+#define MPR_SOCKET_KTLS         0x4000      /**< TLS records are encrypted by the kernel (kTLS) */
 
 /**
     Socket Service
@@ -7049,14 +7279,15 @@ extern void mprAddSocketProvider(cchar *name, MprSocketProvider *provider);
     by threads from the worker thread pool for scalable, multithreaded applications.
     @stability Evolving
     @see MprSocket MprSocketPrebind MprSocketProc MprSocketProvider MprSocketService mprAddSocketHandler 
-        mprCloseSocket mprConnectSocket mprCreateSocket mprCreateSocketService mprCreateSsl mprCloneSsl
-        mprDisconnectSocket mprEnableSocketEvents mprFlushSocket mprGetSocketBlockingMode mprGetSocketError 
-        mprGetSocketFd mprGetSocketInfo mprGetSocketPort mprHasSecureSockets mprIsSocketEof mprIsSocketSecure 
-        mprListenOnSocket mprLoadSsl mprParseIp mprReadSocket mprSendFileToSocket mprSetSecureProvider 
-        mprSetSocketBlockingMode mprSetSocketCallback mprSetSocketEof mprSetSocketNoDelay mprSetSslCaFile 
-        mprSetSslCaPath mprSetSslCertFile mprSetSslCiphers mprSetSslKeyFile mprSetSslSslProtocols 
-        mprSetSslVerifySslClients mprWriteSocket mprWriteSocketString mprWriteSocketVector 
-        mprSocketHasPendingData mprUpgradeSocket
+        mprCancelHandshake mprCloseSocket mprConnectSocket mprCreateSocket mprCreateSocketService mprCreateSsl 
+        mprCloneSsl mprDisconnectSocket mprEnableSocketEvents mprFlushSocket mprGetSocketBlockingMode mprGetSocketError 
+        mprGetSocketFd mprGetSocketInfo mprGetSslStats mprGetSocketPort mprHandshakeSocket mprHasSecureSockets 
+        mprIsSocketEof mprIsSocketSecure mprListenOnSocket mprLoadSsl mprParseIp mprReadSocket mprSendFileToSocket 
+        mprSetHandshakeThreads mprSetSecureProvider mprSetSocketBlockingMode mprSetSocketCallback mprSetSocketEof 
+        mprSetSocketNoDelay mprSetSslAlpn mprSetSslCache mprSetSslCacheLimits mprSetSslCaFile mprSetSslCaPath 
+        mprSetSslCertFile mprSetSslCiphers mprSetSslKernelTls mprSetSslKeyFile mprSetSslSslProtocols 
+        mprSetSslTicketRotation mprSetSslVerifySslClients mprWriteSocket mprWriteSocketString mprWriteSocketVector 
+        mprSocketCanSendFile mprSocketHasPendingData mprUpgradeSocket
     @defgroup MprSocket MprSocket
  */
 typedef struct MprSocket {
@@ -7363,6 +7594,16 @@ extern void mprSetSocketEof(MprSocket *sp, bool eof);
  */
 extern int mprSetSocketNoDelay(MprSocket *sp, bool on);
 
+/**
+    Test if file data can be sent directly to the socket.
+    @description Plain sockets can use sendfile. Secure sockets can only use sendfile if the TLS records are 
+        encrypted by the kernel. Otherwise #mprSendFileToSocket must read the file data and write it via the SSL provider.
+    @param sp Socket object returned from #mprCreateSocket
+    @return True if the socket can use sendfile.
+    @ingroup MprSocket
+ */
+extern bool mprSocketCanSendFile(MprSocket *sp);
+
 /**
     Test if the socket has buffered read data.
     @description Use this function to avoid waiting for incoming I/O if data is already buffered.
@@ -7372,6 +7613,51 @@ extern int mprSetSocketNoDelay(MprSocket *sp, bool on);
  */
 extern bool mprSocketHasPendingData(MprSocket *sp);
 
+/**
+    Callback procedure invoked when a socket handshake completes
+    @param data Data argument provided to #mprHandshakeSocket
+    @param sp Socket object
+    @param dispatcher Dispatcher running the callback
+    @param status Zero if the handshake succeeded, otherwise a negative MPR error code.
+    @ingroup MprSocket
+ */
+typedef void (*MprHandshakeProc)(void *data, struct MprSocket *sp, MprDispatcher *dispatcher, int status);
+
+/**
+    Complete the SSL/TLS handshake for a new server connection on a handshake thread
+    @description The handshake is run by a bounded pool of handshake threads that is separate from the worker pool. 
+        The socket must be upgraded via #mprUpgradeSocket and be in non-blocking mode. The handshake thread is released 
+        while waiting for the peer. When the handshake completes or fails, the callback is invoked via the dispatcher.
+    @param sp Socket object returned from #mprAcceptSocket
+    @param dispatcher Dispatcher to run the callback
+    @param proc Callback procedure
+    @param data Data argument to pass to the callback
+    @returns Zero if the handshake was scheduled. Returns MPR_ERR_BAD_STATE if the SSL provider does not support 
+        handshakes or the handshake thread pool is disabled. The caller should then complete the handshake on the 
+        first read. Returns MPR_ERR_TOO_MANY if #MPR_MAX_HANDSHAKES handshakes are already pending. The caller should 
+        then close the socket.
+    @ingroup MprSocket
+ */
+extern int mprHandshakeSocket(MprSocket *sp, MprDispatcher *dispatcher, MprHandshakeProc proc, void *data);
+
+/**
+    Cancel a pending SSL/TLS handshake
+    @description The handshake callback is not invoked and the socket is closed. If a handshake thread is running 
+        the handshake, the socket is closed by that thread when the current handshake step returns. The caller must 
+        not use the socket after a handshake is cancelled.
+    @param sp Socket object given to #mprHandshakeSocket
+    @returns True if a pending handshake was cancelled. Returns zero if the socket has no pending handshake.
+    @ingroup MprSocket
+ */
+extern int mprCancelHandshake(MprSocket *sp);
+
+/**
+    Set the maximum number of SSL handshake threads
+    @param count Maximum number of handshake threads. Set to zero to complete handshakes on the connection's worker.
+    @ingroup MprSocket
+ */
+extern void mprSetHandshakeThreads(int count);
+
 /**
     Upgrade a socket to use SSL/TLS
     @param sp Socket to upgrade
@@ -7424,6 +7710,19 @@ extern ssize mprWriteSocketVector(MprSocket *sp, MprIOVec *iovec, int count);
 #define MPR_DEFAULT_CLIENT_CERT_FILE    "client.crt"
 #define MPR_DEFAULT_CLIENT_CERT_PATH    "certs"
 
+/**
+    SSL session statistics
+    @ingroup MprSocket
+ */
+typedef struct MprSslStats {
+    int64           handshakes;         /**< Full handshakes */
+    int64           resumed;            /**< Abbreviated handshakes resuming a prior session */
+    int64           cacheHits;          /**< Sessions found in the session cache */
+    int64           cacheMisses;        /**< Session IDs not found in the session cache */
+    int64           ticketHits;         /**< Session tickets decrypted with a current or prior key */
+    int64           ticketMisses;       /**< Session tickets with an unknown key */
+} MprSslStats;
+
 typedef struct MprSsl {
     char            *providerName;      /**< SSL provider to use - null if default */
     struct MprSocketProvider *provider; /**< Cached SSL provider to use */
@@ -7434,12 +7733,19 @@ typedef struct MprSsl {
     char            *caFile;            /**< Certificate verification cert file or bundle */
     char            *caPath;            /**< Certificate verification cert directory */
     char            *ciphers;           /**< Candidate ciphers to use */
+    char            *alpn;              /**< Application protocols to negotiate via ALPN (comma separated) */
     int             configured;         /**< Set if this SSL configuration has been processed */
     void            *pconfig;           /**< Extended provider SSL configuration */
     int             verifyPeer;         /**< Verify the peer verificate */
     int             verifyIssuer;       /**< Set if the certificate issuer should be also verified */
     int             verifyDepth;        /**< Set if the cert chain depth should be verified */
     int             protocols;          /**< SSL protocols */
+    int             kernelTls;          /**< Offload TLS record encryption to the kernel if supported */
+    int             cacheSize;          /**< Maximum number of cached server sessions. Zero to disable */
+    MprTime         sessionLifespan;    /**< Lifespan of sessions and session tickets (msec) */
+    MprTime         ticketRotation;     /**< Period to rotate session ticket keys (msec). Zero to disable tickets */
+    struct MprCache *sessionCache;      /**< Session cache */
+    MprSslStats     stats;              /**< Session statistics */
 } MprSsl;
 
 
@@ -7456,6 +7762,12 @@ typedef struct MprSsl {
     Default SSL configuration
  */
 #define MPR_DEFAULT_CIPHER_SUITE "HIGH:MEDIUM"  /**< Default cipher suite */
+#define MPR_SSL_CACHE_SIZE       512            /**< Default number of cached server sessions */
+#define MPR_SSL_SESSION_LIFESPAN (300 * MPR_TICKS_PER_SEC)   /**< Default session lifespan */
+#define MPR_SSL_TICKET_ROTATION  (3600 * MPR_TICKS_PER_SEC)  /**< Default session ticket key rotation period */
+#define MPR_HANDSHAKE_THREADS    2              /**< Default maximum number of SSL handshake threads */
+#define MPR_HANDSHAKE_TIMEOUT    (30 * MPR_TICKS_PER_SEC)     /**< Timeout for a server SSL handshake */
+#define MPR_MAX_HANDSHAKES       1024           /**< Maximum pending server SSL handshakes */
 
 /**
     Load the SSL module.
@@ -7476,6 +7788,45 @@ extern struct MprSsl *mprCreateSsl();
  */
 extern struct MprSsl *mprCloneSsl(MprSsl *src);
 
+/**
+    Get the SSL session statistics
+    @param ssl SSL instance returned from #mprCreateSsl
+    @param stats Reference to stats object to receive the stats
+    @ingroup MprSocket
+ */
+extern void mprGetSslStats(struct MprSsl *ssl, MprSslStats *stats);
+
+/**
+    Set the application protocols to negotiate via ALPN
+    @description Servers select the first protocol in this list that is also offered by the client.
+    @param ssl SSL instance returned from #mprCreateSsl
+    @param protocols Comma separated list of protocols in order of preference. For example: "h2,http/1.1".
+    @ingroup MprSocket
+ */
+extern void mprSetSslAlpn(struct MprSsl *ssl, cchar *protocols);
+
+/**
+    Set the cache to store SSL sessions
+    @description Servers store sessions by session ID so returning clients can resume sessions without a full 
+        handshake. If a cache is not defined, servers create a private cache. Clients store the session for each
+        server address and only resume sessions if a cache is defined. The cache may be shared by multiple SSL 
+        configurations. Items are pruned by the cache when they expire or when the cache exceeds its limits.
+    @param ssl SSL instance returned from #mprCreateSsl
+    @param cache Cache instance returned from #mprCreateCache
+    @ingroup MprSocket
+ */
+extern void mprSetSslCache(struct MprSsl *ssl, struct MprCache *cache);
+
+/**
+    Set the SSL session cache limits
+    @param ssl SSL instance returned from #mprCreateSsl
+    @param size Maximum number of sessions in the server session cache. The least recently used sessions are pruned
+        first. Set to zero to disable the session cache. Set to -1 to leave unchanged.
+    @param lifespan Lifespan of sessions and session tickets in milliseconds. Set to zero to leave unchanged.
+    @ingroup MprSocket
+ */
+extern void mprSetSslCacheLimits(struct MprSsl *ssl, int size, MprTime lifespan);
+
 /**
     Set the ciphers to use for SSL
     @param ssl SSL instance returned from #mprCreateSsl
@@ -7492,6 +7843,17 @@ extern void mprSetSslCiphers(struct MprSsl *ssl, cchar *ciphers);
  */
 extern void mprSetSslKeyFile(struct MprSsl *ssl, cchar *keyFile);
 
+/**
+    Control kernel TLS offload
+    @description If enabled and supported by the SSL provider and the kernel, the TLS record keys are installed in the 
+        socket after the handshake so the kernel encrypts and decrypts the records. This permits the use of sendfile
+        for secure sockets. Only some ciphers can be offloaded. Other connections continue to use the SSL provider.
+    @param ssl SSL instance returned from #mprCreateSsl
+    @param on Set to true to enable kernel TLS.
+    @ingroup MprSocket
+ */
+extern void mprSetSslKernelTls(struct MprSsl *ssl, bool on);
+
 /**
     Set certificate to use for SSL
     @param ssl SSL instance returned from #mprCreateSsl
@@ -7532,6 +7894,16 @@ extern void mprSetSslProtocols(struct MprSsl *ssl, int protocols);
  */
 extern void mprSetSslProvider(MprSsl *ssl, cchar *provider);
 
+/**
+    Set the session ticket key rotation period
+    @description Servers encrypt session tickets with a random key that is replaced each period. Tickets encrypted 
+        with the prior key are accepted and renewed.
+    @param ssl SSL instance returned from #mprCreateSsl
+    @param period Rotation period in milliseconds. Set to zero to disable session tickets.
+    @ingroup MprSocket
+ */
+extern void mprSetSslTicketRotation(struct MprSsl *ssl, MprTime period);
+
 /**
     Require verification of peer certificates
     @param ssl SSL instance returned from #mprCreateSsl
@@ -7599,6 +7971,9 @@ typedef struct MprWorkerService {
     int             minThreads;         /**< Max # threads in worker pool */
     int             nextThreadNum;      /**< Unique next thread number */
     int             numThreads;         /**< Current number of threads in worker pool */
+    int             spinCount;          /**< Iterations idle workers spin before sleeping */
+    volatile int    spinning;           /**< Count of idle workers spinning for work to steal */
+    volatile int    queued;             /**< Count of procedures queued on worker run queues */
     ssize           stackSize;          /**< Stack size for worker threads */
     MprMutex        *mutex;             /**< Per task synchronization */
     struct MprEvent *pruneTimer;        /**< Timer for excess threads pruner */
@@ -7666,7 +8041,15 @@ extern void mprGetWorkerServiceStats(MprWorkerService *ws, MprWorkerStats *stats
  */
 #define MPR_WORKER_BUSY        0x1          /**< Worker currently running to a callback */
 #define MPR_WORKER_PRUNED      0x2          /**< Worker has been pruned and will be terminated */
-#define MPR_WORKER_IDLE        0x4          /**< Worker is sleeping (idle) on idleCond */
+#define MPR_WORKER_IDLE        0x4          /**< Worker is idle and spinning or sleeping on idleCond */
+
+/*
+    Worker flags
+ */
+#define MPR_WORKER_SLEEPING    0x1          /**< Idle worker is waiting on idleCond and must be signalled */
+
+#define MPR_WORKER_QUEUE       8            /**< Size of the per-worker run queue */
+#define MPR_WORKER_SPIN        50           /**< Iterations an idle worker spins before sleeping */
 
 /**
     Worker thread structure. Worker threads are allocated and dedicated to tasks. When idle, they are stored in
@@ -7686,10 +8069,23 @@ typedef struct MprWorker {
     MprTime         lastActivity;           /**< When the worker was last used */
     MprWorkerService *workerService;        /**< Worker service */
     MprCond         *idleCond;              /**< Used to wait for work */
+    MprSpin         *spin;                  /**< Run queue lock */
+    MprWorkerProc   runProc[MPR_WORKER_QUEUE];  /**< Queued procedures to run when the current procedure completes */
+    void            *runData[MPR_WORKER_QUEUE]; /**< Data for queued procedures */
+    int             runFirst;               /**< Index of the first queued procedure */
+    int             runCount;               /**< Count of queued procedures */
+    MprList         *resumeQ;               /**< Bound coroutines awaiting resumption. Never run by other workers */
+    int             coroutines;             /**< Count of unfinished coroutines bound to this worker */
 } MprWorker;
 
 extern void mprActivateWorker(MprWorker *worker, MprWorkerProc proc, void *data);
 
+/*
+    Resume a coroutine on the worker it is bound to. If the worker is busy, the coroutine is resumed when the worker
+    completes its current work. Internal.
+ */
+extern void mprResumeWorkerCoroutine(MprWorker *worker, struct MprCoroutine *coroutine);
+
 /**
     Dedicate a worker thread to a current real thread. This implements thread affinity and is required on some platforms
         where some APIs (waitpid on uClibc) cannot be called on a different thread.
@@ -7720,6 +8116,21 @@ extern void mprReleaseWorker(MprWorker *worker);
  */
 extern int mprStartWorker(MprWorkerProc proc, void *data);
 
+/**
+    Start a worker thread with affinity
+    @description Start a worker thread executing the given worker procedure callback. The preferred worker is used
+        if it is idle. If the preferred worker is busy and idle workers are spinning, the procedure is queued on its
+        run queue without taking the service lock. If all workers are busy and no more can be created, the procedure 
+        is queued on the run queue of the preferred (or least loaded) busy worker. Idle workers steal queued 
+        procedures from busy workers and sleeping workers are only woken if there is no spinning worker to steal.
+    @param preferred Worker to prefer. Typically the worker that last serviced the same data. May be null.
+    @param proc Worker procedure callback
+    @param data Data parameter to the callback
+    @returns Zero if successful, otherwise a negative MPR error code.
+    @ingroup MprWorker
+ */
+extern int mprStartPreferredWorker(MprWorker *preferred, MprWorkerProc proc, void *data);
+
 /* Internal */
 extern int mprAvailableWorkers();
 
@@ -7790,6 +8201,28 @@ extern char *mprGetMD5(cchar *s);
  */
 extern char *mprGetMD5WithPrefix(cchar *buf, ssize len, cchar *prefix);
 
+#define MPR_SHA256_SIZE 32              /**< Size of a SHA-256 digest in bytes */
+
+/**
+    Get a SHA-256 digest
+    @param buf Buffer to digest
+    @param len Size of the buffer. Set to -1 to use the length of a null terminated string.
+    @param digest Buffer to receive the MPR_SHA256_SIZE byte binary digest
+    @ingroup Mpr
+ */
+extern void mprGetSHA256(cchar *buf, ssize len, uchar digest[MPR_SHA256_SIZE]);
+
+/**
+    Get a HMAC-SHA256 message authentication code
+    @param key Secret key
+    @param keyLen Size of the key. Set to -1 to use the length of a null terminated string.
+    @param buf Buffer to authenticate
+    @param len Size of the buffer. Set to -1 to use the length of a null terminated string.
+    @param mac Buffer to receive the MPR_SHA256_SIZE byte binary authentication code
+    @ingroup Mpr
+ */
+extern void mprGetHmacSHA256(cchar *key, ssize keyLen, cchar *buf, ssize len, uchar mac[MPR_SHA256_SIZE]);
+
 /********************************* Encoding ***********************************/
 /*  
     Character encoding masks
@@ -7942,6 +8375,7 @@ typedef void (*MprForkCallback)(void *arg);
 typedef struct MprCmdService {
     MprList         *cmds;              /* List of all commands */
     MprMutex        *mutex;             /* Multithread sync */
+    int             pidfd;              /* Kernel supports waiting for child exit via pidfd */
 } MprCmdService;
 
 /*
@@ -8001,10 +8435,10 @@ typedef struct MprCmdFile {
     @description The MprCmd service enables execution of local commands. It uses three full-duplex pipes to communicate
         read, write and error data with the command. 
     @stability Evolving.
-    @see mprCloseCmdFd mprCreateCmd mprDestroyCmd mprDisableCmdEvents mprDisconnectCmd mprEnableCmdEvents 
-        mprFinalizeCmd mprGetCmdBuf mprGetCmdExitStatus mprGetCmdFd mprIsCmdComplete mprIsCmdRunning mprPollCmd 
-        mprReadCmd mprReapCmd mprRunCmd mprRunCmdV mprSetCmdCallback mprSetCmdDir mprSetCmdEnv mprSetCmdSearchPath 
-        mprStartCmd mprStopCmd mprWaitForCmd mprWriteCmd 
+    @see mprCloseCmdFd mprCloseFiles mprCreateCmd mprDestroyCmd mprDisableCmdEvents mprDisconnectCmd 
+        mprEnableCmdEvents mprFinalizeCmd mprGetCmdBuf mprGetCmdExitStatus mprGetCmdFd mprIsCmdComplete 
+        mprIsCmdRunning mprPollCmd mprReadCmd mprReapCmd mprRunCmd mprRunCmdV mprSetCmdCallback mprSetCmdDir 
+        mprSetCmdEnv mprSetCmdSearchPath mprStartCmd mprStopCmd mprWaitForCmd mprWriteCmd 
     @defgroup MprCmd MprCmd
  */
 typedef struct MprCmd {
@@ -8037,6 +8471,10 @@ typedef struct MprCmd {
     void            *callbackData;
     MprForkCallback forkCallback;       /**< Forked client callback */
     MprSignal       *signal;            /**< Signal handler for SIGCHLD */
+#if LINUX
+    int             pidfd;              /**< Process file descriptor to wait for child exit */
+    MprWaitHandler  *exitHandler;       /**< Wait handler for the pidfd */
+#endif
     void            *forkData;
     MprBuf          *stdoutBuf;         /**< Standard output from the client */
     MprBuf          *stderrBuf;         /**< Standard error output from the client */
@@ -8068,6 +8506,15 @@ typedef struct MprCmd {
  */
 extern void mprCloseCmdFd(MprCmd *cmd, int channel);
 
+/**
+    Close all file descriptors from a given descriptor upward
+    @description This is intended for use in a MprCmd fork callback to stop the child inheriting descriptors. It
+        only makes async-signal-safe calls.
+    @param fd Lowest file descriptor to close
+    @ingroup MprCmd
+ */
+extern void mprCloseFiles(int fd);
+
 /**
     Create a new Command object 
     @returns A newly allocated MprCmd object.
@@ -8323,8 +8770,8 @@ extern ssize mprWriteCmd(MprCmd *cmd, int channel, char *buf, ssize bufsize);
     pairs. Cache items have a configurable lifespan and the Cache manager will automatically prune expired items. 
     Items also have an associated version number that can be used when writing to do transactional writes.
     @defgroup MprCache MprCache
-    @see mprCreateCache mprDestroyCache mprExpireCache mprIncCache mprReadCache mprRemoveCache mprSetCacheLimits 
-        mprWriteCache 
+    @see mprCreateCache mprDestroyCache mprExpireCache mprGetCacheLength mprIncCache mprReadCache mprRemoveCache 
+        mprSetCacheLimits mprWriteCache 
  */
 typedef struct MprCache {
     MprHash         *store;             /**< Key/value store */
@@ -8364,6 +8811,15 @@ extern void *mprDestroyCache(MprCache *cache);
  */
 extern int mprExpireCache(MprCache *cache, cchar *key, MprTime expires);
 
+/**
+    Get the number of items in the cache
+    @description Expired items are counted until they are removed by the cache pruner.
+    @param cache The cache instance object returned from #mprCreateCache.
+    @return The count of cache items.
+    @ingroup MprCache
+ */
+extern int64 mprGetCacheLength(MprCache *cache);
+
 /**
     Increment a numeric cache item
     @param cache The cache instance object returned from #mprCreateCache.
@@ -9178,7 +9634,7 @@ typedef struct MprTestDef {
     struct MprTestDef   **groupDefs;
     int                 (*init)(struct MprTestGroup *gp);
     int                 (*term)(struct MprTestGroup *gp);
-    MprTestCase         caseDefs[32];
+    MprTestCase         caseDefs[64];
 } MprTestDef;
 
 
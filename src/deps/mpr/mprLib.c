@@ -235,6 +235,8 @@ Mpr *mprCreateMemService(MprManager manager, int flags)
         return NULL;
     }
     memset(heap, 0, sizeof(MprHeap));
+    heap->stats.numCpu = memStats.numCpu;
+    heap->stats.pageSize = memStats.pageSize;
     heap->stats.maxMemory = MAXINT;
     heap->stats.redLine = MAXINT / 100 * 99;
     mprInitSpinLock(&heap->heapLock);
@@ -8028,6 +8030,8 @@ void mprAtomicAdd(volatile int *ptr, int value)
             : "=r" (value), "=m" (*ptr)
             : "0" (value), "m" (*ptr)
             : "memory", "cc");
+    #elif BIT_HAS_SYNC
+        __sync_add_and_fetch(ptr, value);
     #else
         mprGlobalLock();
         *ptr += value;
@@ -8050,6 +8054,8 @@ void mprAtomicAdd64(volatile int64 *ptr, int value)
         : "=r" (value), "=m" (*ptr)
         : "0" (value), "m" (*ptr)
         : "memory", "cc");
+#elif BIT_HAS_SYNC && BIT_64
+    __sync_add_and_fetch(ptr, (int64) value);
 #else
     mprGlobalLock();
     *ptr += value;
@@ -8156,7 +8162,8 @@ MprBuf *mprCreateBuf(ssize initialSize, ssize maxSize)
 static void manageBuf(MprBuf *bp, int flags)
 {
     if (flags & MPR_MANAGE_MARK) {
-        mprMark(bp->data);
+        /* Split buffers reference the interior of a memory block */
+        mprMark(bp->block ? bp->block : bp->data);
         mprMark(bp->refillArg);
     } 
 }
@@ -8179,6 +8186,72 @@ MprBuf *mprCloneBuf(MprBuf *orig)
 }
 
 
+/*
+    Create a read-only view of the buffer contents. The view shares the data with the original buffer and has its own
+    start and end pointers. The view has no free space, so writes reallocate the view data before modifying it.
+ */
+MprBuf *mprShareBuf(MprBuf *orig)
+{
+    MprBuf      *bp;
+
+    if ((bp = mprAllocObj(MprBuf, manageBuf)) == 0) {
+        return 0;
+    }
+    bp->data = orig->data;
+    bp->block = orig->block;
+    bp->start = orig->start;
+    bp->end = orig->end;
+    bp->endbuf = orig->end;
+    bp->buflen = bp->endbuf - bp->data;
+    bp->growBy = orig->growBy;
+    return bp;
+}
+
+
+/*
+    A slice references the memory block of the original buffer and retains all of it. Small trailing contents are
+    copied so a long lived slice does not retain a much larger block.
+ */
+MprBuf *mprSplitBuf(MprBuf *orig, ssize offset)
+{
+    MprBuf      *bp;
+    char        *block;
+    ssize       len;
+
+    mprAssert(0 <= offset && offset <= mprGetBufLength(orig));
+
+    block = orig->block ? orig->block : orig->data;
+    len = mprGetBufLength(orig) - offset;
+    if (len <= MPR_BUFSIZE && (len * 4) <= mprGetBlockSize(block)) {
+        if ((bp = mprCreateBuf(len, orig->maxsize)) == 0) {
+            return 0;
+        }
+        bp->growBy = orig->growBy;
+        if (len > 0) {
+            mprPutBlockToBuf(bp, orig->start + offset, len);
+        }
+        orig->end = orig->start + offset;
+        return bp;
+    }
+    if ((bp = mprAllocObj(MprBuf, manageBuf)) == 0) {
+        return 0;
+    }
+    bp->block = block;
+    bp->data = orig->start + offset;
+    bp->start = bp->data;
+    bp->end = orig->end;
+    bp->endbuf = orig->endbuf;
+    bp->buflen = bp->endbuf - bp->data;
+    bp->maxsize = orig->maxsize;
+    bp->growBy = orig->growBy;
+
+    orig->end = bp->data;
+    orig->endbuf = bp->data;
+    orig->buflen = orig->endbuf - orig->data;
+    return bp;
+}
+
+
 char *mprGet(MprBuf *bp)
 {
     return (char*) bp->start;
@@ -8557,6 +8630,7 @@ int mprGrowBuf(MprBuf *bp, ssize need)
     bp->end = newbuf + (bp->end - bp->data);
     bp->start = newbuf + (bp->start - bp->data);
     bp->data = newbuf;
+    bp->block = 0;
     bp->endbuf = &bp->data[bp->buflen];
 
     /*
@@ -8768,6 +8842,7 @@ typedef struct CacheItem
 
 static void manageCache(MprCache *cache, int flags);
 static void manageCacheItem(CacheItem *item, int flags);
+static int compareAccess(cvoid *i1, cvoid *i2);
 static void pruneCache(MprCache *cache, MprEvent *event);
 static void removeItem(MprCache *cache, CacheItem *item);
 
@@ -8840,6 +8915,23 @@ int mprExpireCache(MprCache *cache, cchar *key, MprTime expires)
 }
 
 
+int64 mprGetCacheLength(MprCache *cache)
+{
+    int64       length;
+
+    mprAssert(cache);
+
+    if (cache->shared) {
+        cache = cache->shared;
+        mprAssert(cache == shared);
+    }
+    lock(cache);
+    length = mprGetHashLength(cache->store);
+    unlock(cache);
+    return length;
+}
+
+
 int64 mprIncCache(MprCache *cache, cchar *key, int64 amount)
 {
     CacheItem   *item;
@@ -9066,12 +9158,30 @@ static void removeItem(MprCache *cache, CacheItem *item)
 }
 
 
+/*
+    Sort items by last access time, oldest first
+ */
+static int compareAccess(cvoid *i1, cvoid *i2)
+{
+    CacheItem   *item1, *item2;
+
+    item1 = *(CacheItem**) i1;
+    item2 = *(CacheItem**) i2;
+    if (item1->lastAccessed < item2->lastAccessed) {
+        return -1;
+    } else if (item1->lastAccessed > item2->lastAccessed) {
+        return 1;
+    }
+    return 0;
+}
+
+
 static void pruneCache(MprCache *cache, MprEvent *event)
 {
-    MprTime         when, factor;
+    MprTime         when;
     MprKey          *kp;
-    CacheItem       *item;
-    ssize           excessKeys;
+    CacheItem       *item, **items;
+    ssize           excessKeys, count, i;
 
     if (!cache) {
         cache = shared;
@@ -9101,26 +9211,22 @@ static void pruneCache(MprCache *cache, MprEvent *event)
         mprAssert(cache->usedMem >= 0);
 
         /*
-            If too many keys or too much memory used, prune keys that expire soonest.
+            If too many keys or too much memory used, prune the least recently used keys
          */
-        if (cache->maxKeys < MAXSSIZE || cache->maxMem < MAXSSIZE) {
-            /*
-                Look for those expiring in the next 5 minutes, then 20 mins, then 80 ...
-             */
-            excessKeys = mprGetHashLength(cache->store) - cache->maxKeys;
-            factor = 5 * 60 * MPR_TICKS_PER_SEC; 
-            when += factor;
-            while (excessKeys > 0 || cache->usedMem > cache->maxMem) {
-                for (kp = 0; (kp = mprGetNextKey(cache->store, kp)) != 0; ) {
-                    item = (CacheItem*) kp->data;
-                    if (item->expires && item->expires <= when) {
-                        mprLog(5, "Cache too big execess keys %Ld, mem %Ld, prune key %s", 
-                                excessKeys, (cache->maxMem - cache->usedMem), kp->key);
-                        removeItem(cache, item);
-                    }
+        excessKeys = mprGetHashLength(cache->store) - cache->maxKeys;
+        if (excessKeys > 0 || cache->usedMem > cache->maxMem) {
+            count = mprGetHashLength(cache->store);
+            if ((items = mprAlloc(count * sizeof(CacheItem*))) != 0) {
+                for (i = 0, kp = 0; (kp = mprGetNextKey(cache->store, kp)) != 0 && i < count; ) {
+                    items[i++] = (CacheItem*) kp->data;
+                }
+                qsort(items, i, sizeof(CacheItem*), compareAccess);
+                for (count = i, i = 0; i < count && (excessKeys > 0 || cache->usedMem > cache->maxMem); i++) {
+                    mprLog(5, "Cache too big execess keys %Ld, mem %Ld, prune key %s", 
+                            excessKeys, (cache->maxMem - cache->usedMem), items[i]->key);
+                    removeItem(cache, items[i]);
+                    excessKeys--;
                 }
-                factor *= 4;
-                when += factor;
             }
         }
         mprAssert(cache->usedMem >= 0);
@@ -9207,12 +9313,17 @@ static void manageCacheItem(CacheItem *item, int flags)
 
 static int blendEnv(MprCmd *cmd, cchar **env, int flags);
 static void closeFiles(MprCmd *cmd);
+static void closePidfd(MprCmd *cmd);
 static ssize cmdCallback(MprCmd *cmd, int channel, void *data);
+static void completeCmd(MprCmd *cmd);
 static int makeChannel(MprCmd *cmd, int index);
 static int makeCmdIO(MprCmd *cmd);
 static void manageCmdService(MprCmdService *cmd, int flags);
 static void manageCmd(MprCmd *cmd, int flags);
 static void reapCmd(MprCmd *cmd, MprSignal *sp);
+#if LINUX
+static void pidfdCallback(MprCmd *cmd, MprEvent *event);
+#endif
 static void resetCmd(MprCmd *cmd);
 static int sanitizeArgs(MprCmd *cmd, int argc, cchar **argv, cchar **env, int flags);
 static int startProcess(MprCmd *cmd);
@@ -9251,6 +9362,15 @@ MprCmdService *mprCreateCmdService()
     }
     cs->cmds = mprCreateList(0, MPR_LIST_STATIC_VALUES);
     cs->mutex = mprCreateLock();
+#if LINUX && defined(SYS_pidfd_open)
+    {
+        int     fd;
+        if ((fd = (int) syscall(SYS_pidfd_open, getpid(), 0)) >= 0) {
+            close(fd);
+            cs->pidfd = 1;
+        }
+    }
+#endif
     return cs;
 }
 
@@ -9290,6 +9410,9 @@ MprCmd *mprCreateCmd(MprDispatcher *dispatcher)
     cmd->forkCallback = (MprForkCallback) closeFiles;
     cmd->dispatcher = dispatcher ? dispatcher : MPR->dispatcher;
     cmd->status = -1;
+#if LINUX
+    cmd->pidfd = -1;
+#endif
 
 #if VXWORKS
     cmd->startCond = semCCreate(SEM_Q_PRIORITY, SEM_EMPTY);
@@ -9325,6 +9448,9 @@ static void manageCmd(MprCmd *cmd, int flags)
         mprMark(cmd->dispatcher);
         mprMark(cmd->callbackData);
         mprMark(cmd->signal);
+#if LINUX
+        mprMark(cmd->exitHandler);
+#endif
         mprMark(cmd->forkData);
         mprMark(cmd->stdoutBuf);
         mprMark(cmd->stderrBuf);
@@ -9419,6 +9545,7 @@ static void resetCmd(MprCmd *cmd)
         reapCmd(cmd, 0);
         cmd->pid = 0;
     }
+    closePidfd(cmd);
 }
 
 
@@ -9462,7 +9589,7 @@ void mprCloseCmdFd(MprCmd *cmd, int channel)
                 reapCmd(cmd, 0);
 #endif
                 if (cmd->pid == 0) {
-                    cmd->complete = 1;
+                    completeCmd(cmd);
                 }
             }
         }
@@ -9471,6 +9598,19 @@ void mprCloseCmdFd(MprCmd *cmd, int channel)
 }
 
 
+/*
+    Mark the command as complete. The completing event may be serviced by a thread other than the one waiting in
+    mprWaitForCmd, so signal the dispatcher to wake the waiter rather than leaving it to sleep out its timeout.
+ */
+static void completeCmd(MprCmd *cmd)
+{
+    if (!cmd->complete) {
+        cmd->complete = 1;
+        mprSignalDispatcher(cmd->dispatcher);
+    }
+}
+
+
 void mprFinalizeCmd(MprCmd *cmd)
 {
     mprLog(6, "mprFinalizeCmd");
@@ -9943,9 +10083,11 @@ static void reapCmd(MprCmd *cmd, MprSignal *sp)
                 mprLog(7, "waitpid FUNNY pid %d, errno %d", cmd->pid, errno);
             }
             cmd->pid = 0;
-            mprAssert(cmd->signal);
-            mprRemoveSignalHandler(cmd->signal);
-            cmd->signal = 0;
+            if (cmd->signal) {
+                mprRemoveSignalHandler(cmd->signal);
+                cmd->signal = 0;
+            }
+            closePidfd(cmd);
         } else {
             mprLog(7, "waitpid ELSE pid %d, errno %d", cmd->pid, errno);
         }
@@ -9986,7 +10128,7 @@ static void reapCmd(MprCmd *cmd, MprSignal *sp)
 #endif
     if (cmd->pid == 0) {
         if (cmd->eofCount >= cmd->requiredEof) {
-            cmd->complete = 1;
+            completeCmd(cmd);
         }
         if (cmd->callback) {
             (cmd->callback)(cmd, -1, cmd->callbackData);
@@ -10628,11 +10770,12 @@ static int startProcess(MprCmd *cmd)
     int             rc, i, err;
 
     files = cmd->files;
-    if (!cmd->signal) {
+    if (!cmd->signal && !MPR->cmdService->pidfd) {
         cmd->signal = mprAddSignalHandler(SIGCHLD, reapCmd, cmd, cmd->dispatcher, MPR_SIGNAL_BEFORE);
     }
     /*
-        Create the child
+        Create the child. The child shares the parent's address space until exec, so the cost does not grow with
+        the size of the heap. The child must only make async-signal-safe calls before exec.
      */
     cmd->pid = vfork();
 
@@ -10650,8 +10793,7 @@ static int startProcess(MprCmd *cmd)
         }
         if (cmd->dir) {
             if (chdir(cmd->dir) < 0) {
-                mprError("cmd: Can't change directory to %s", cmd->dir);
-                return MPR_ERR_CANT_INITIALIZE;
+                _exit(-(MPR_ERR_CANT_INITIALIZE));
             }
         }
         if (cmd->flags & MPR_CMD_IN) {
@@ -10702,11 +10844,42 @@ static int startProcess(MprCmd *cmd)
                 files[i].clientFd = -1;
             }
         }
+#if LINUX && defined(SYS_pidfd_open)
+        if (MPR->cmdService->pidfd) {
+            /*
+                Wait for the child to exit via a pidfd in the wait service. This avoids polling every outstanding
+                command with waitpid on each SIGCHLD. The pidfd remains readable if the child has already exited.
+             */
+            if ((cmd->pidfd = (int) syscall(SYS_pidfd_open, cmd->pid, 0)) >= 0) {
+                fcntl(cmd->pidfd, F_SETFD, FD_CLOEXEC);
+                cmd->exitHandler = mprCreateWaitHandler(cmd->pidfd, MPR_READABLE, cmd->dispatcher, pidfdCallback, 
+                    cmd, 0);
+            } else if (!cmd->signal) {
+                cmd->signal = mprAddSignalHandler(SIGCHLD, reapCmd, cmd, cmd->dispatcher, MPR_SIGNAL_BEFORE);
+                /* The child may have exited before the signal handler was added */
+                reapCmd(cmd, 0);
+            }
+        }
+#endif
     }
     return 0;
 }
 
 
+#if LINUX
+/*
+    Pidfd wait handler callback. Invoked when the child has exited.
+ */
+static void pidfdCallback(MprCmd *cmd, MprEvent *event)
+{
+    reapCmd(cmd, 0);
+    if (cmd->pid && cmd->exitHandler) {
+        mprWaitOn(cmd->exitHandler, MPR_READABLE);
+    }
+}
+#endif
+
+
 #elif VXWORKS
 /*
     Start the command to run (stdIn and stdOut are named from the client's perspective)
@@ -10857,15 +11030,50 @@ static void cmdTaskEntry(char *program, MprCmdTaskFn entry, int cmdArg)
 #endif /* VXWORKS */
 
 
-static void closeFiles(MprCmd *cmd)
+static void closePidfd(MprCmd *cmd)
+{
+#if LINUX
+    if (cmd->exitHandler) {
+        mprRemoveWaitHandler(cmd->exitHandler);
+        cmd->exitHandler = 0;
+    }
+    if (cmd->pidfd >= 0) {
+        close(cmd->pidfd);
+        cmd->pidfd = -1;
+    }
+#endif
+}
+
+
+/*
+    Close all file descriptors from fd upward. This may be called from a vforked child so it must only make 
+    async-signal-safe calls.
+ */
+void mprCloseFiles(int fd)
 {
     int     i;
-    for (i = 3; i < MPR_MAX_FILE; i++) {
+
+#if LINUX && defined(SYS_close_range)
+    /* One system call that also closes descriptors above MPR_MAX_FILE */
+    if (syscall(SYS_close_range, fd, ~0U, 0) == 0) {
+        return;
+    }
+#endif
+    for (i = fd; i < MPR_MAX_FILE; i++) {
         close(i);
     }
 }
 
 
+/*
+    Default fork callback to close inherited file descriptors in the child
+ */
+static void closeFiles(MprCmd *cmd)
+{
+    mprCloseFiles(3);
+}
+
+
 /*
     @copy   default
 
@@ -11280,6 +11488,25 @@ typedef struct {
     uchar buffer[64];
 } MD5CONTEXT;
 
+typedef struct {
+    uint state[8];
+    uint64 count;
+    uchar buffer[64];
+} SHA256CONTEXT;
+
+#define SHA_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint shaK[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
 /******************************* Base 64 Data *********************************/
 
 #define CRYPT_HASH_SIZE   16
@@ -11333,6 +11560,10 @@ static void finalizeMD5(uchar digest[16], MD5CONTEXT *context);
 static void initMD5(MD5CONTEXT *context);
 static void transform(uint state[4], uchar block[64]);
 static void update(MD5CONTEXT *context, uchar *input, uint inputLen);
+static void finalizeSHA256(uchar digest[MPR_SHA256_SIZE], SHA256CONTEXT *context);
+static void initSHA256(SHA256CONTEXT *context);
+static void transformSHA256(uint state[8], cuchar block[64]);
+static void updateSHA256(SHA256CONTEXT *context, cuchar *input, ssize len);
 
 /*********************************** Code *************************************/
 
@@ -11431,7 +11662,7 @@ char *mprEncode64Block(cchar *s, ssize len)
     end = &s[len];
     while (s < end) {
         shiftbuf = 0;
-        for (j = 2; j >= 0 && *s; j--, s++) {
+        for (j = 2; j >= 0 && s < end; j--, s++) {
             shiftbuf |= ((*s & 0xff) << (j * 8));
         }
         shift = 18;
@@ -11680,6 +11911,148 @@ static void decode(uint *output, uchar *input, uint len)
 }
 
 
+void mprGetSHA256(cchar *buf, ssize len, uchar digest[MPR_SHA256_SIZE])
+{
+    SHA256CONTEXT   context;
+
+    if (len < 0) {
+        len = slen(buf);
+    }
+    initSHA256(&context);
+    updateSHA256(&context, (cuchar*) buf, len);
+    finalizeSHA256(digest, &context);
+}
+
+
+/*
+    HMAC-SHA256 as defined by RFC 2104. Keys longer than the block size are hashed first.
+ */
+void mprGetHmacSHA256(cchar *key, ssize keyLen, cchar *buf, ssize len, uchar mac[MPR_SHA256_SIZE])
+{
+    SHA256CONTEXT   context;
+    uchar           pad[64], inner[MPR_SHA256_SIZE];
+    int             i;
+
+    if (keyLen < 0) {
+        keyLen = slen(key);
+    }
+    if (len < 0) {
+        len = slen(buf);
+    }
+    memset(pad, 0, sizeof(pad));
+    if (keyLen > (ssize) sizeof(pad)) {
+        mprGetSHA256(key, keyLen, pad);
+    } else {
+        memcpy(pad, key, keyLen);
+    }
+    for (i = 0; i < 64; i++) {
+        pad[i] ^= 0x36;
+    }
+    initSHA256(&context);
+    updateSHA256(&context, pad, sizeof(pad));
+    updateSHA256(&context, (cuchar*) buf, len);
+    finalizeSHA256(inner, &context);
+
+    for (i = 0; i < 64; i++) {
+        pad[i] ^= 0x36 ^ 0x5c;
+    }
+    initSHA256(&context);
+    updateSHA256(&context, pad, sizeof(pad));
+    updateSHA256(&context, inner, sizeof(inner));
+    finalizeSHA256(mac, &context);
+}
+
+
+static void initSHA256(SHA256CONTEXT *context)
+{
+    context->count = 0;
+    context->state[0] = 0x6a09e667;
+    context->state[1] = 0xbb67ae85;
+    context->state[2] = 0x3c6ef372;
+    context->state[3] = 0xa54ff53a;
+    context->state[4] = 0x510e527f;
+    context->state[5] = 0x9b05688c;
+    context->state[6] = 0x1f83d9ab;
+    context->state[7] = 0x5be0cd19;
+}
+
+
+static void updateSHA256(SHA256CONTEXT *context, cuchar *input, ssize len)
+{
+    ssize   index, part;
+
+    index = (ssize) (context->count & 0x3F);
+    context->count += len;
+    if (index) {
+        part = min(64 - index, len);
+        memcpy(&context->buffer[index], input, part);
+        input += part;
+        len -= part;
+        if ((index + part) < 64) {
+            return;
+        }
+        transformSHA256(context->state, context->buffer);
+    }
+    for (; len >= 64; input += 64, len -= 64) {
+        transformSHA256(context->state, input);
+    }
+    if (len > 0) {
+        memcpy(context->buffer, input, len);
+    }
+}
+
+
+static void finalizeSHA256(uchar digest[MPR_SHA256_SIZE], SHA256CONTEXT *context)
+{
+    uchar   length[8];
+    uint64  bits;
+    int     i;
+
+    bits = context->count * 8;
+    for (i = 0; i < 8; i++) {
+        length[i] = (uchar) (bits >> (56 - i * 8));
+    }
+    updateSHA256(context, (cuchar*) "\x80", 1);
+    while ((context->count & 0x3F) != 56) {
+        updateSHA256(context, (cuchar*) "", 1);
+    }
+    updateSHA256(context, length, sizeof(length));
+    for (i = 0; i < 8; i++) {
+        digest[i * 4] = (uchar) (context->state[i] >> 24);
+        digest[i * 4 + 1] = (uchar) (context->state[i] >> 16);
+        digest[i * 4 + 2] = (uchar) (context->state[i] >> 8);
+        digest[i * 4 + 3] = (uchar) context->state[i];
+    }
+    memset(context, 0, sizeof(SHA256CONTEXT));
+}
+
+
+static void transformSHA256(uint state[8], cuchar block[64])
+{
+    uint    w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int     i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint) block[i * 4] << 24) | ((uint) block[i * 4 + 1] << 16) | ((uint) block[i * 4 + 2] << 8) | 
+            (uint) block[i * 4 + 3];
+    }
+    for (; i < 64; i++) {
+        w[i] = w[i - 16] + (SHA_ROTR(w[i - 15], 7) ^ SHA_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 7] +
+            (SHA_ROTR(w[i - 2], 17) ^ SHA_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+    }
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+    for (i = 0; i < 64; i++) {
+        t1 = h + (SHA_ROTR(e, 6) ^ SHA_ROTR(e, 11) ^ SHA_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + shaK[i] + w[i];
+        t2 = (SHA_ROTR(a, 2) ^ SHA_ROTR(a, 13) ^ SHA_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+
 /*
     @copy   default
 
@@ -12305,7 +12678,7 @@ MprDiskFileSystem *mprCreateDiskFileSystem(cchar *path)
 /***************************** Forward Declarations ***************************/
 
 static void dequeueDispatcher(MprDispatcher *dispatcher);
-static int dispatchEvents(MprDispatcher *dispatcher);
+static int dispatchEvents(MprDispatcher *dispatcher, bool inlined);
 static MprTime getDispatcherIdleTime(MprDispatcher *dispatcher, MprTime timeout);
 static MprTime getIdleTime(MprEventService *es, MprTime timeout);
 static MprDispatcher *getNextReadyDispatcher(MprEventService *es);
@@ -12313,10 +12686,21 @@ static void initDispatcher(MprDispatcher *q);
 static int makeRunnable(MprDispatcher *dispatcher);
 static void manageDispatcher(MprDispatcher *dispatcher, int flags);
 static void manageEventService(MprEventService *es, int flags);
-static void queueDispatcher(MprDispatcher *prior, MprDispatcher *dispatcher);
+static int growWait(MprEventService *es);
+static void popWait(MprEventService *es, MprDispatcher *dispatcher);
+static void pushWait(MprEventService *es, MprDispatcher *dispatcher);
+static int queueDispatcher(MprDispatcher *prior, MprDispatcher *dispatcher);
+static void siftWait(MprEventService *es, int index);
 static void scheduleDispatcher(MprDispatcher *dispatcher);
-static void serviceDispatcherMain(MprDispatcher *dispatcher);
-static bool serviceDispatcher(MprDispatcher *dp);
+static void serviceDispatcherMain(MprDispatcher *dispatcher, MprWorker *worker);
+static void serviceDispatcherCoroutine(MprDispatcher *dispatcher);
+static bool serviceDispatcher(MprDispatcher *dp, bool allowInline);
+static void coroutineTimeout(MprDispatcher *dispatcher, MprEvent *event);
+static void scheduleResume(MprCoroutine *co);
+#if BIT_HAS_UCONTEXT
+static void saveLocals(MprCoroutine *co);
+static void swapLocals(MprCoroutine *co);
+#endif
 
 #define isRunning(dispatcher) (dispatcher->parent == dispatcher->service->runQ)
 #define isReady(dispatcher) (dispatcher->parent == dispatcher->service->readyQ)
@@ -12336,6 +12720,7 @@ MprEventService *mprCreateEventService()
     }
     MPR->eventService = es;
     es->now = mprGetTime();
+    es->coroutineStackSize = MPR_COROUTINE_STACK;
     es->mutex = mprCreateLock();
     es->waitCond = mprCreateCond();
     es->runQ = mprCreateDispatcher("running", 0);
@@ -12353,6 +12738,7 @@ static void manageEventService(MprEventService *es, int flags)
         mprMark(es->runQ);
         mprMark(es->readyQ);
         mprMark(es->waitQ);
+        mprMark(es->waitHeap);
         mprMark(es->idleQ);
         mprMark(es->pendingQ);
         mprMark(es->waitCond);
@@ -12387,6 +12773,7 @@ MprDispatcher *mprCreateDispatcher(cchar *name, int enable)
     dispatcher->cond = mprCreateCond();
     dispatcher->enabled = enable;
     dispatcher->magic = MPR_DISPATCHER_MAGIC;
+    dispatcher->waitIndex = -1;
     es = dispatcher->service = MPR->eventService;
     dispatcher->eventQ = mprCreateEventQueue();
     if (enable) {
@@ -12404,6 +12791,10 @@ void mprDestroyDispatcher(MprDispatcher *dispatcher)
     MprEvent            *q, *event, *next;
 
     if (dispatcher && !dispatcher->destroyed) {
+        if (dispatcher->waiter) {
+            /* Don't leave a suspended coroutine waiting on a destroyed dispatcher */
+            mprSignalDispatcher(dispatcher);
+        }
         es = dispatcher->service;
         mprAssert(es == MPR->eventService);
         lock(es);
@@ -12443,6 +12834,8 @@ static void manageDispatcher(MprDispatcher *dispatcher, int flags)
         mprMark(dispatcher->parent);
         mprMark(dispatcher->service);
         mprMark(dispatcher->requiredWorker);
+        mprMark(dispatcher->lastWorker);
+        mprMark(dispatcher->waiter);
 
         lock(es);
         q = dispatcher->eventQ;
@@ -12503,7 +12896,7 @@ int mprServiceEvents(MprTime timeout, int flags)
     MprEventService     *es;
     MprDispatcher       *dp;
     MprTime             expires, delay;
-    int                 beginEventCount, eventCount, justOne;
+    int                 beginEventCount, eventCount, justOne, inlineCount;
 
     if (MPR->eventing) {
         mprError("mprServiceEvents() called reentrantly");
@@ -12526,10 +12919,11 @@ int mprServiceEvents(MprTime timeout, int flags)
         if (MPR->signalService->hasSignals) {
             mprServiceSignals();
         }
+        inlineCount = 0;
         while ((dp = getNextReadyDispatcher(es)) != NULL) {
             mprAssert(!dp->destroyed);
             mprAssert(dp->magic == MPR_DISPATCHER_MAGIC);
-            if (!serviceDispatcher(dp)) {
+            if (!serviceDispatcher(dp, (dp->flags & MPR_DISPATCHER_INLINE) && inlineCount++ < MPR_MAX_INLINE_DISPATCH)) {
                 queueDispatcher(es->pendingQ, dp);
                 continue;
             }
@@ -12552,6 +12946,7 @@ int mprServiceEvents(MprTime timeout, int flags)
                     delay = 10;
                 }
                 mprWaitForIO(MPR->waitService, delay);
+                es->waiting = 0;
             } else {
                 unlock(es);
             }
@@ -12566,6 +12961,48 @@ int mprServiceEvents(MprTime timeout, int flags)
 }
 
 
+/*
+    Suspend the current coroutine until the dispatcher is signalled or the delay expires. The caller has set 
+    dispatcher->waiter. The coroutine resumes on the same thread. Returns zero if signalled.
+ */
+static int suspendOnDispatcher(MprDispatcher *dispatcher, MprCoroutine *co, MprTime delay)
+{
+    MprEventService     *es;
+
+    es = MPR->eventService;
+    co->timer = mprCreateEvent(MPR->nonBlock, "coroutineTimeout", delay, coroutineTimeout, dispatcher, 0);
+    mprSuspendCoroutine();
+
+    lock(es);
+    if (dispatcher->waiter == co) {
+        dispatcher->waiter = 0;
+    }
+    unlock(es);
+    if (co->timer) {
+        mprRemoveEvent(co->timer);
+        co->timer = 0;
+    }
+    return co->signalled ? 0 : MPR_ERR_TIMEOUT;
+}
+
+
+static void coroutineTimeout(MprDispatcher *dispatcher, MprEvent *event)
+{
+    MprEventService     *es;
+    MprCoroutine        *co;
+
+    es = MPR->eventService;
+    lock(es);
+    if ((co = dispatcher->waiter) != 0) {
+        dispatcher->waiter = 0;
+    }
+    unlock(es);
+    if (co) {
+        mprWakeCoroutine(co);
+    }
+}
+
+
 /*
     Wait for an event to occur. Expect the event to signal the cond var.
     WARNING: this will enable GC while sleeping
@@ -12574,9 +13011,10 @@ int mprServiceEvents(MprTime timeout, int flags)
 int mprWaitForEvent(MprDispatcher *dispatcher, MprTime timeout)
 {
     MprEventService     *es;
+    MprCoroutine        *co;
     MprTime             expires, delay;
     MprOsThread         thread;
-    int                 claimed, signalled, wasRunning, runEvents;
+    int                 claimed, signalled, wasRunning, runEvents, rc;
 
     mprAssert(dispatcher->magic == MPR_DISPATCHER_MAGIC);
     mprAssert(!dispatcher->destroyed);
@@ -12610,11 +13048,19 @@ int mprWaitForEvent(MprDispatcher *dispatcher, MprTime timeout)
     }
     unlock(es);
 
+    /*
+        When running on a coroutine, waiting suspends the coroutine and releases the worker thread unless the 
+        coroutine is held
+     */
+    if ((co = mprGetCurrentCoroutine()) != 0 && co->held) {
+        co = 0;
+    }
+
     while (es->now < expires && !mprIsStoppingCore()) {
         mprAssert(!dispatcher->destroyed);
         if (runEvents) {
             makeRunnable(dispatcher);
-            if (dispatchEvents(dispatcher)) {
+            if (dispatchEvents(dispatcher, 0)) {
                 signalled++;
                 break;
             }
@@ -12622,20 +13068,29 @@ int mprWaitForEvent(MprDispatcher *dispatcher, MprTime timeout)
         lock(es);
         delay = getDispatcherIdleTime(dispatcher, expires - es->now);
         dispatcher->waitingOnCond = 1;
+        if (co) {
+            co->signalled = 0;
+            dispatcher->waiter = co;
+        }
         mprAssert(!dispatcher->destroyed);
         unlock(es);
         
         mprAssert(dispatcher->magic == MPR_DISPATCHER_MAGIC);
-        mprYield(MPR_YIELD_STICKY);
+        if (co) {
+            rc = suspendOnDispatcher(dispatcher, co, delay);
+        } else {
+            mprYield(MPR_YIELD_STICKY);
+            rc = mprWaitForCond(dispatcher->cond, (int) delay);
+        }
         mprAssert(dispatcher->magic == MPR_DISPATCHER_MAGIC);
 
-        if (mprWaitForCond(dispatcher->cond, (int) delay) == 0) {
+        if (rc == 0) {
             mprAssert(dispatcher->magic == MPR_DISPATCHER_MAGIC);
             mprResetYield();
             dispatcher->waitingOnCond = 0;
             if (runEvents) {
                 makeRunnable(dispatcher);
-                dispatchEvents(dispatcher);
+                dispatchEvents(dispatcher, 0);
             }
             mprAssert(dispatcher->magic == MPR_DISPATCHER_MAGIC);
             signalled++;
@@ -12668,7 +13123,7 @@ void mprWakeDispatchers()
     for (dp = runQ->next; dp != runQ; dp = dp->next) {
         mprAssert(dp->magic == MPR_DISPATCHER_MAGIC);
         mprAssert(!dp->destroyed);
-        mprSignalCond(dp->cond);
+        mprSignalDispatcher(dp);
     }
     unlock(es);
 }
@@ -12757,7 +13212,11 @@ void mprScheduleDispatcher(MprDispatcher *dispatcher)
         mustWakeWaitService = mustWakeCond = 0;
         if (event->due > es->now) {
             mprAssert(!dispatcher->destroyed);
-            queueDispatcher(es->waitQ, dispatcher);
+            if (queueDispatcher(es->waitQ, dispatcher) < 0) {
+                /* Stays on its current queue. Cannot be scheduled to wait without memory */
+                unlock(es);
+                return;
+            }
             if (event->due < es->willAwake) {
                 mustWakeWaitService = 1;
                 mustWakeCond = dispatcher->waitingOnCond;
@@ -12779,9 +13238,10 @@ void mprScheduleDispatcher(MprDispatcher *dispatcher)
 
 
 /*
-    Dispatch events for a dispatcher
+    Dispatch events for a dispatcher. If running inline on the event thread and the dispatcher becomes blocking, stop
+    so it will be rescheduled and transferred to a worker. Likewise stop if the dispatcher switches to coroutines.
  */
-static int dispatchEvents(MprDispatcher *dispatcher)
+static int dispatchEvents(MprDispatcher *dispatcher, bool inlined)
 {
     MprEventService     *es;
     MprEvent            *event;
@@ -12795,7 +13255,14 @@ static int dispatchEvents(MprDispatcher *dispatcher)
     LOG(7, "dispatchEvents for %s", dispatcher->name);
 
     lock(es);
-    for (count = 0; (event = mprGetNextEvent(dispatcher)) != 0; count++) {
+    for (count = 0; !(inlined && !(dispatcher->flags & MPR_DISPATCHER_INLINE)); count++) {
+        if ((dispatcher->flags & MPR_DISPATCHER_COROUTINE) && !inlined && !mprGetCurrentCoroutine()) {
+            /* Remaining events run when the dispatcher is rescheduled on a coroutine */
+            break;
+        }
+        if ((event = mprGetNextEvent(dispatcher)) == 0) {
+            break;
+        }
         mprAssert(event->magic == MPR_EVENT_MAGIC);
         dispatcher->current = event;
         if (event->continuous) {
@@ -12812,15 +13279,20 @@ static int dispatchEvents(MprDispatcher *dispatcher)
         lock(es);
     }
     unlock(es);
-    if (count && es->waiting) {
+    if (count) {
         es->eventCount += count;
-        mprWakeNotifier();
+        if (es->waiting) {
+            mprWakeNotifier();
+        }
     }
     return count;
 }
 
 
-static bool serviceDispatcher(MprDispatcher *dispatcher)
+/*
+    Service a dispatcher via a worker. Nonblocking dispatchers are serviced inline on this thread if permitted.
+ */
+static bool serviceDispatcher(MprDispatcher *dispatcher, bool allowInline)
 {
     mprAssert(isRunning(dispatcher));
     mprAssert(dispatcher->owner == 0);
@@ -12829,21 +13301,23 @@ static bool serviceDispatcher(MprDispatcher *dispatcher)
     
     dispatcher->owner = mprGetCurrentOsThread();
 
-    if (dispatcher == MPR->nonBlock) {
-        serviceDispatcherMain(dispatcher);
+    if (dispatcher == MPR->nonBlock || allowInline) {
+        serviceDispatcherMain(dispatcher, NULL);
 
     } else if (dispatcher->requiredWorker) {
         mprActivateWorker(dispatcher->requiredWorker, (MprWorkerProc) serviceDispatcherMain, dispatcher);
 
-    } else if (mprStartWorker((MprWorkerProc) serviceDispatcherMain, dispatcher) < 0) {
+    } else if (mprStartPreferredWorker(dispatcher->lastWorker, (MprWorkerProc) serviceDispatcherMain, dispatcher) < 0) {
         return 0;
     }
     return 1;
 }
 
 
-static void serviceDispatcherMain(MprDispatcher *dispatcher)
+static void serviceDispatcherMain(MprDispatcher *dispatcher, MprWorker *worker)
 {
+    MprCoroutine    *co;
+
     if (dispatcher->destroyed) {
         /* Dispatcher may have been destroyed after starting the worker */
         return;
@@ -12855,7 +13329,30 @@ static void serviceDispatcherMain(MprDispatcher *dispatcher)
     mprAssert(!dispatcher->destroyed);
 
     dispatcher->owner = mprGetCurrentOsThread();
-    dispatchEvents(dispatcher);
+    if (worker) {
+        dispatcher->lastWorker = worker;
+        if ((dispatcher->flags & MPR_DISPATCHER_COROUTINE) && !mprGetCurrentCoroutine() &&
+                (co = mprCreateCoroutine((MprCoroutineProc) serviceDispatcherCoroutine, dispatcher, 0)) != 0) {
+            /*
+                Run on a coroutine. If an event handler waits, the coroutine suspends and this worker returns to the 
+                pool. The coroutine completes the dispatch and reschedules the dispatcher when it is resumed.
+             */
+            co->dispatcher = dispatcher;
+            mprResumeCoroutine(co);
+            return;
+        }
+    }
+    dispatchEvents(dispatcher, !worker && dispatcher != MPR->nonBlock);
+    if (!dispatcher->destroyed) {
+        dispatcher->owner = 0;
+        scheduleDispatcher(dispatcher);
+    }
+}
+
+
+static void serviceDispatcherCoroutine(MprDispatcher *dispatcher)
+{
+    dispatchEvents(dispatcher, 0);
     if (!dispatcher->destroyed) {
         dispatcher->owner = 0;
         scheduleDispatcher(dispatcher);
@@ -12881,10 +13378,9 @@ void mprWakePendingDispatchers()
  */
 static MprDispatcher *getNextReadyDispatcher(MprEventService *es)
 {
-    MprDispatcher   *dp, *next, *pendingQ, *readyQ, *waitQ, *dispatcher;
+    MprDispatcher   *dp, *pendingQ, *readyQ, *dispatcher;
     MprEvent        *event;
 
-    waitQ = es->waitQ;
     readyQ = es->readyQ;
     pendingQ = es->pendingQ;
     dispatcher = 0;
@@ -12899,15 +13395,24 @@ static MprDispatcher *getNextReadyDispatcher(MprEventService *es)
 
     } else if (readyQ->next == readyQ) {
         /*
-            ReadyQ is empty, try to transfer a dispatcher with due events onto the readyQ
+            ReadyQ is empty, try to transfer a dispatcher with due events onto the readyQ. The waitQ heap is ordered by 
+            due time so only the dispatchers at the top need be examined. The heap key may be early if the first event 
+            has since been removed, in which case the dispatcher is re-keyed.
          */
-        for (dp = waitQ->next; dp != waitQ; dp = next) {
+        while (es->waitCount > 0 && (dp = es->waitHeap[0])->due <= es->now) {
             mprAssert(dp->magic == MPR_DISPATCHER_MAGIC);
             mprAssert(!dp->destroyed);
-            next = dp->next;
+            mprAssert(isWaiting(dp));
             event = dp->eventQ->next;
-            mprAssert(event->magic == MPR_EVENT_MAGIC);
-            if (event->due <= es->now && dp->enabled) {
+            if (event == dp->eventQ || !dp->enabled) {
+                /* mprEnableDispatcher will reschedule disabled dispatchers that have events */
+                queueDispatcher(es->idleQ, dp);
+
+            } else if (event->due > es->now) {
+                dp->due = event->due;
+                siftWait(es, 0);
+
+            } else {
                 queueDispatcher(es->readyQ, dp);
                 break;
             }
@@ -12934,11 +13439,9 @@ static MprDispatcher *getNextReadyDispatcher(MprEventService *es)
  */
 static MprTime getIdleTime(MprEventService *es, MprTime timeout)
 {
-    MprDispatcher   *readyQ, *waitQ, *dp;
-    MprEvent        *event;
+    MprDispatcher   *readyQ;
     MprTime         delay;
 
-    waitQ = es->waitQ;
     readyQ = es->readyQ;
 
     if (readyQ->next != readyQ) {
@@ -12948,19 +13451,10 @@ static MprTime getIdleTime(MprEventService *es, MprTime timeout)
     } else {
         delay = MPR_MAX_TIMEOUT;
         /*
-            Examine all the dispatchers on the waitQ
+            The dispatcher at the top of the waitQ heap has the earliest due event
          */
-        for (dp = waitQ->next; dp != waitQ; dp = dp->next) {
-            mprAssert(dp->magic == MPR_DISPATCHER_MAGIC);
-            mprAssert(!dp->destroyed);
-            event = dp->eventQ->next;
-            mprAssert(event->magic == MPR_EVENT_MAGIC);
-            if (event != dp->eventQ) {
-                delay = min(delay, (event->due - es->now));
-                if (delay <= 0) {
-                    break;
-                }
-            }
+        if (es->waitCount > 0) {
+            delay = min(delay, (es->waitHeap[0]->due - es->now));
         }
         delay = min(delay, timeout);
     }
@@ -13003,14 +13497,25 @@ static void initDispatcher(MprDispatcher *q)
 }
 
 
-static void queueDispatcher(MprDispatcher *prior, MprDispatcher *dispatcher)
+/*
+    Move a dispatcher onto the queue after prior. If the waitQ heap cannot be grown, the dispatcher is left on its 
+    current queue and MPR_ERR_MEMORY is returned.
+ */
+static int queueDispatcher(MprDispatcher *prior, MprDispatcher *dispatcher)
 {
+    MprEventService     *es;
+
     mprAssert(dispatcher->service == MPR->eventService);
-    lock(dispatcher->service);
+    es = dispatcher->service;
+    lock(es);
 
     mprAssert(dispatcher->magic == MPR_DISPATCHER_MAGIC);
     mprAssert(!dispatcher->destroyed);
 
+    if (prior->parent == es->waitQ && !isWaiting(dispatcher) && growWait(es) < 0) {
+        unlock(es);
+        return MPR_ERR_MEMORY;
+    }
     if (dispatcher->parent) {
         dequeueDispatcher(dispatcher);
     }
@@ -13019,8 +13524,12 @@ static void queueDispatcher(MprDispatcher *prior, MprDispatcher *dispatcher)
     dispatcher->next = prior->next;
     prior->next->prev = dispatcher;
     prior->next = dispatcher;
+    if (isWaiting(dispatcher)) {
+        pushWait(es, dispatcher);
+    }
     mprAssert(dispatcher->cond);
-    unlock(dispatcher->service);
+    unlock(es);
+    return 0;
 }
 
 
@@ -13036,6 +13545,9 @@ static void dequeueDispatcher(MprDispatcher *dispatcher)
     mprAssert(!dispatcher->destroyed);
            
     if (dispatcher->next) {
+        if (isWaiting(dispatcher)) {
+            popWait(dispatcher->service, dispatcher);
+        }
         dispatcher->next->prev = dispatcher->prev;
         dispatcher->prev->next = dispatcher->next;
         dispatcher->next = dispatcher;
@@ -13051,6 +13563,100 @@ static void dequeueDispatcher(MprDispatcher *dispatcher)
 }
 
 
+/*
+    Ensure the waitQ heap has room for one more dispatcher. Must be called locked.
+ */
+static int growWait(MprEventService *es)
+{
+    MprDispatcher   **heap;
+    int             size;
+
+    if (es->waitCount >= es->waitMax) {
+        size = max(es->waitMax * 2, MPR_LIST_INCR);
+        if ((heap = mprRealloc(es->waitHeap, size * sizeof(MprDispatcher*))) == 0) {
+            return MPR_ERR_MEMORY;
+        }
+        es->waitHeap = heap;
+        es->waitMax = size;
+    }
+    return 0;
+}
+
+
+/*
+    Add a dispatcher to the waitQ heap keyed by the due time of its first event. The heap must have been grown 
+    by growWait. Must be called locked.
+ */
+static void pushWait(MprEventService *es, MprDispatcher *dispatcher)
+{
+    MprEvent        *event;
+
+    mprAssert(es->waitCount < es->waitMax);
+    event = dispatcher->eventQ->next;
+    dispatcher->due = (event != dispatcher->eventQ) ? event->due : MAXINT64;
+    dispatcher->waitIndex = es->waitCount++;
+    es->waitHeap[dispatcher->waitIndex] = dispatcher;
+    siftWait(es, dispatcher->waitIndex);
+}
+
+
+/*
+    Remove a dispatcher from the waitQ heap. Must be called locked.
+ */
+static void popWait(MprEventService *es, MprDispatcher *dispatcher)
+{
+    MprDispatcher   *last;
+    int             index;
+
+    index = dispatcher->waitIndex;
+    if (index < 0 || index >= es->waitCount || es->waitHeap[index] != dispatcher) {
+        return;
+    }
+    dispatcher->waitIndex = -1;
+    last = es->waitHeap[--es->waitCount];
+    if (last != dispatcher) {
+        es->waitHeap[index] = last;
+        last->waitIndex = index;
+        siftWait(es, index);
+    }
+}
+
+
+/*
+    Restore the heap order for the dispatcher at the given index after its due time has changed
+ */
+static void siftWait(MprEventService *es, int index)
+{
+    MprDispatcher   **heap, *dp;
+    int             parent, child;
+
+    heap = es->waitHeap;
+    dp = heap[index];
+    while (index > 0) {
+        parent = (index - 1) / 2;
+        if (heap[parent]->due <= dp->due) {
+            break;
+        }
+        heap[index] = heap[parent];
+        heap[index]->waitIndex = index;
+        index = parent;
+    }
+    while ((child = index * 2 + 1) < es->waitCount) {
+        if ((child + 1) < es->waitCount && heap[child + 1]->due < heap[child]->due) {
+            child++;
+        }
+        if (dp->due <= heap[child]->due) {
+            break;
+        }
+        heap[index] = heap[child];
+        heap[index]->waitIndex = index;
+        index = child;
+    }
+    heap[index] = dp;
+    dp->waitIndex = index;
+}
+
+
 static void scheduleDispatcher(MprDispatcher *dispatcher)
 {
     MprEventService     *es;
@@ -13105,10 +13711,24 @@ void mprReleaseWorkerFromDispatcher(MprDispatcher *dispatcher, MprWorker *worker
 
 void mprSignalDispatcher(MprDispatcher *dispatcher)
 {
+    MprEventService     *es;
+    MprCoroutine        *co;
+
     if (dispatcher == NULL) {
         dispatcher = MPR->dispatcher;
     }
-    mprSignalCond(dispatcher->cond);
+    es = MPR->eventService;
+    lock(es);
+    if ((co = dispatcher->waiter) != 0) {
+        dispatcher->waiter = 0;
+        co->signalled = 1;
+    }
+    unlock(es);
+    if (co) {
+        mprWakeCoroutine(co);
+    } else {
+        mprSignalCond(dispatcher->cond);
+    }
 }
 
 
@@ -13121,6 +13741,290 @@ bool mprDispatcherHasEvents(MprDispatcher *dispatcher)
 }
 
 
+/*
+    Coroutines. Each coroutine has a private stack reserved via mmap. Pages are only committed as the stack grows, so
+    the resident cost of a coroutine is proportional to the stack depth it actually uses. The lowest page is a guard.
+ */
+#if BIT_HAS_UCONTEXT
+
+static void freeCoroutineStack(MprCoroutine *co)
+{
+    if (co->stack) {
+        munmap(co->stack, co->stackSize);
+        co->stack = 0;
+    }
+}
+
+
+static void manageCoroutine(MprCoroutine *co, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(co->data);
+        mprMark(co->timer);
+        mprMark(co->dispatcher);
+        mprMark(co->thread);
+        mprMark(co->worker);
+
+    } else if (flags & MPR_MANAGE_FREE) {
+        freeCoroutineStack(co);
+    }
+}
+
+
+static void coroutineMain()
+{
+    MprEventService     *es;
+    MprCoroutine        *co;
+
+    es = MPR->eventService;
+    co = mprGetCurrentThread()->coroutine;
+    (co->proc)(co->data);
+
+    lock(es);
+    co->state = MPR_COROUTINE_DONE;
+    unlock(es);
+    setcontext(&co->caller);
+}
+#endif /* BIT_HAS_UCONTEXT */
+
+
+MprCoroutine *mprCreateCoroutine(MprCoroutineProc proc, void *data, ssize stackSize)
+{
+#if BIT_HAS_UCONTEXT
+    MprCoroutine    *co;
+    ssize           pageSize;
+    void            *stack;
+
+    if ((co = mprAllocObj(MprCoroutine, manageCoroutine)) == 0) {
+        return 0;
+    }
+    pageSize = mprGetMemStats()->pageSize;
+    if (stackSize <= 0) {
+        stackSize = MPR->eventService->coroutineStackSize;
+    }
+    stackSize = MPR_PAGE_ALIGN(stackSize, pageSize) + pageSize;
+    stack = mmap(0, stackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        return 0;
+    }
+    co->stack = stack;
+    co->stackSize = stackSize;
+    mprotect(co->stack, pageSize, PROT_NONE);
+
+    if (getcontext(&co->context) < 0) {
+        return 0;
+    }
+    co->context.uc_stack.ss_sp = co->stack;
+    co->context.uc_stack.ss_size = co->stackSize;
+    co->context.uc_link = 0;
+    makecontext(&co->context, coroutineMain, 0);
+    co->proc = proc;
+    co->data = data;
+    co->state = MPR_COROUTINE_READY;
+    return co;
+#else
+    return 0;
+#endif
+}
+
+
+MprCoroutine *mprGetCurrentCoroutine()
+{
+    MprThread   *tp;
+
+    if ((tp = mprGetCurrentThread()) == 0) {
+        return 0;
+    }
+    return tp->coroutine;
+}
+
+
+int mprResumeCoroutine(MprCoroutine *co)
+{
+#if BIT_HAS_UCONTEXT
+    MprEventService     *es;
+    MprThread           *tp;
+    MprCoroutine        *prior;
+    int                 state, wake;
+
+    mprAssert(co->state != MPR_COROUTINE_DONE);
+    if ((tp = mprGetCurrentThread()) == 0) {
+        return MPR_ERR_BAD_STATE;
+    }
+    if (co->thread == 0) {
+        /* Bind to this thread. Compiled code may cache thread-local addresses across a suspend */
+        co->thread = tp;
+        if ((co->worker = mprGetCurrentWorker()) != 0) {
+            mprAtomicAdd(&co->worker->coroutines, 1);
+        }
+        /* Start with the thread local data of the code that created the coroutine */
+        saveLocals(co);
+    } else if (co->thread != tp) {
+        mprAssert(co->thread == tp);
+        return MPR_ERR_BAD_STATE;
+    }
+    es = MPR->eventService;
+    prior = tp->coroutine;
+    tp->coroutine = co;
+
+    lock(es);
+    co->state = MPR_COROUTINE_RUNNING;
+    unlock(es);
+
+    swapLocals(co);
+    swapcontext(&co->caller, &co->context);
+    swapLocals(co);
+    tp->coroutine = prior;
+
+    /*
+        The coroutine has switched back. It is now safe to resume it again.
+     */
+    wake = 0;
+    lock(es);
+    if (co->state == MPR_COROUTINE_SUSPENDING) {
+        if (co->wakeRequested) {
+            co->wakeRequested = 0;
+            wake = 1;
+        } else {
+            co->state = MPR_COROUTINE_SUSPENDED;
+        }
+    }
+    state = co->state;
+    unlock(es);
+
+    if (state == MPR_COROUTINE_DONE) {
+        freeCoroutineStack(co);
+        if (co->worker) {
+            mprAtomicAdd(&co->worker->coroutines, -1);
+        }
+    } else if (wake) {
+        scheduleResume(co);
+        state = MPR_COROUTINE_SUSPENDED;
+    }
+    return state;
+#else
+    return MPR_ERR_BAD_STATE;
+#endif
+}
+
+
+#if BIT_HAS_UCONTEXT
+/*
+    Thread local data belongs to the coroutine while it runs. Exchange the thread's values with those saved for the coroutine.
+ */
+static void swapLocals(MprCoroutine *co)
+{
+    MprList         *locals;
+    MprThreadLocal  *tls;
+    void            *value;
+    int             i;
+
+    locals = MPR->threadService->locals;
+    lock(locals);
+    for (i = 0; i < locals->length && i < MPR_COROUTINE_LOCALS; i++) {
+        tls = mprGetItem(locals, i);
+        value = mprGetThreadData(tls);
+        mprSetThreadData(tls, co->locals[i]);
+        co->locals[i] = value;
+    }
+    unlock(locals);
+}
+
+
+static void saveLocals(MprCoroutine *co)
+{
+    MprList         *locals;
+    int             i;
+
+    locals = MPR->threadService->locals;
+    lock(locals);
+    for (i = 0; i < locals->length && i < MPR_COROUTINE_LOCALS; i++) {
+        co->locals[i] = mprGetThreadData(mprGetItem(locals, i));
+    }
+    unlock(locals);
+}
+#endif
+
+
+void mprSuspendCoroutine()
+{
+#if BIT_HAS_UCONTEXT
+    MprEventService     *es;
+    MprCoroutine        *co;
+
+    if ((co = mprGetCurrentCoroutine()) == 0) {
+        return;
+    }
+    es = MPR->eventService;
+    lock(es);
+    co->state = MPR_COROUTINE_SUSPENDING;
+    unlock(es);
+    swapcontext(&co->context, &co->caller);
+#endif
+}
+
+
+void mprWakeCoroutine(MprCoroutine *co)
+{
+    MprEventService     *es;
+    int                 resume;
+
+    es = MPR->eventService;
+    resume = 0;
+    lock(es);
+    if (co->state == MPR_COROUTINE_SUSPENDED) {
+        co->state = MPR_COROUTINE_RUNNING;
+        resume = 1;
+    } else if (co->state == MPR_COROUTINE_RUNNING || co->state == MPR_COROUTINE_SUSPENDING) {
+        co->wakeRequested = 1;
+    }
+    unlock(es);
+    if (resume) {
+        scheduleResume(co);
+    }
+}
+
+
+void mprHoldCoroutine()
+{
+    MprCoroutine    *co;
+
+    if ((co = mprGetCurrentCoroutine()) != 0) {
+        co->held++;
+    }
+}
+
+
+void mprReleaseCoroutine()
+{
+    MprCoroutine    *co;
+
+    if ((co = mprGetCurrentCoroutine()) != 0) {
+        mprAssert(co->held > 0);
+        co->held--;
+    }
+}
+
+
+void mprSetCoroutineStackSize(ssize size)
+{
+    MPR->eventService->coroutineStackSize = (size > 0) ? size : MPR_COROUTINE_STACK;
+}
+
+
+/*
+    Resume a coroutine on the worker it is bound to. The resume runs as soon as the worker is free. 
+ */
+static void scheduleResume(MprCoroutine *co)
+{
+    if (co->worker) {
+        mprResumeWorkerCoroutine(co->worker, co);
+    } else {
+        mprError("Can't wake coroutine that is not bound to a worker");
+    }
+}
+
+
 /*
     @copy   default
 
@@ -13464,6 +14368,10 @@ int mprCreateNotifierService(MprWaitService *ws)
     ev.events = EPOLLIN | EPOLLERR | EPOLLHUP;
     ev.data.fd = ws->breakPipe[MPR_READ_PIPE];
     epoll_ctl(ws->epoll, EPOLL_CTL_ADD, ws->breakPipe[MPR_READ_PIPE], &ev);
+#if MPR_EVENT_IO_URING
+    /* Use epoll if io_uring is not supported */
+    mprCreateRing(ws);
+#endif
     return 0;
 }
 
@@ -13472,6 +14380,9 @@ void mprManageEpoll(MprWaitService *ws, int flags)
 {
     if (flags & MPR_MANAGE_MARK) {
         mprMark(ws->events);
+#if MPR_EVENT_IO_URING
+        mprMark(ws->ring);
+#endif
     
     } else if (flags & MPR_MANAGE_FREE) {
         if (ws->epoll) {
@@ -13508,6 +14419,12 @@ int mprNotifyOn(MprWaitService *ws, MprWaitHandler *wp, int mask)
     fd = wp->fd;
 
     lock(ws);
+#if MPR_EVENT_IO_URING
+    if ((rc = mprNotifyRing(ws, wp, mask)) != MPR_ERR_BAD_STATE) {
+        unlock(ws);
+        return rc;
+    }
+#endif
     if (wp->desiredMask != mask) {
         memset(&ev, 0, sizeof(ev));
         ev.data.fd = fd;
@@ -13619,6 +14536,11 @@ void mprWaitForIO(MprWaitService *ws, MprTime timeout)
         mprDoWaitRecall(ws);
         return;
     }
+#if MPR_EVENT_IO_URING
+    if (mprWaitForRing(ws, timeout)) {
+        return;
+    }
+#endif
     mprYield(MPR_YIELD_STICKY);
     rc = epoll_wait(ws->epoll, ws->events, ws->eventsMax, timeout);
     mprResetYield();
@@ -13655,6 +14577,12 @@ static void serviceIO(MprWaitService *ws, int count)
             }
             continue;
         }
+#if MPR_EVENT_IO_URING
+        if (mprIsRingActive(ws)) {
+            /* Collected before switching to io_uring. The io_uring poll reports the current state */
+            continue;
+        }
+#endif
         mask = 0;
         if (ev->events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
             mask |= MPR_READABLE;
@@ -14531,6 +15459,22 @@ MprOff mprSeekFile(MprFile *file, int seekType, MprOff pos)
 }
 
 
+int mprPreallocateFile(MprFile *file, MprOff size)
+{
+    mprAssert(file);
+
+    if (file == 0 || file->fd < 0) {
+        return MPR_ERR_BAD_HANDLE;
+    }
+#if LINUX && !__UCLIBC__ && defined(FALLOC_FL_KEEP_SIZE)
+    if (size > 0 && fallocate(file->fd, FALLOC_FL_KEEP_SIZE, 0, size) < 0 && errno != EOPNOTSUPP) {
+        return MPR_ERR_CANT_WRITE;
+    }
+#endif
+    return 0;
+}
+
+
 int mprTruncateFile(cchar *path, MprOff size)
 {
     MprFileSystem   *fs;
@@ -14568,8 +15512,8 @@ ssize mprWriteFile(MprFile *file, cvoid *buf, ssize count)
             if (bytes < 0) {
                 return bytes;
             } 
-            if (bytes != count) {
-                mprFlushFile(file);
+            if (bytes != count && mprFlushFile(file) < 0) {
+                return MPR_ERR_CANT_WRITE;
             }
             count -= bytes;
             written += bytes;
@@ -15264,35 +16208,568 @@ MprKey *mprGetNextKey(MprHash *hash, MprKey *last)
             return sp;
         }
     }
-    return 0;
-}
-
-
-static void *dupKey(MprHash *hash, MprKey *sp, cvoid *key)
-{
-#if BIT_CHAR_LEN > 1
-    if (hash->flags & MPR_HASH_UNICODE) {
-        return wclone(sp, (MprChar*) key, -1);
-    } else
-#endif
-        return sclone(key);
+    return 0;
+}
+
+
+static void *dupKey(MprHash *hash, MprKey *sp, cvoid *key)
+{
+#if BIT_CHAR_LEN > 1
+    if (hash->flags & MPR_HASH_UNICODE) {
+        return wclone(sp, (MprChar*) key, -1);
+    } else
+#endif
+        return sclone(key);
+}
+
+
+MprHash *mprCreateHashFromWords(cchar *str)
+{
+    MprHash     *hash;
+    char        *word, *next;
+
+    hash = mprCreateHash(0, 0);
+    word = stok(sclone(str), ", \t\n\r", &next);
+    while (word) {
+        mprAddKey(hash, word, word);
+        word = stok(NULL, " \t\n\r", &next);
+    }
+    return hash;
+}
+
+
+/*
+    @copy   default
+
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
+
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a 
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
+
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
+
+    @end
+ */
+
+/************************************************************************/
+/*
+    Start of file "src/mprIoUring.c"
+ */
+/************************************************************************/
+
+/**
+    mprIoUring.c - Wait for I/O by using io_uring on Linux.
+
+    This module augments the mprEpoll wait service. Interest in I/O is a one-shot poll request on the io_uring 
+    submission ring. Completed polls are not removed and requests made while the wait service thread is awake are 
+    submitted in one batch when it next waits. If io_uring is not supported by the kernel, epoll is used. 
+    This module is thread-safe.
+
+    Copyright (c) All Rights Reserved. See details at the end of the file.
+ */
+
+/********************************* Includes ***********************************/
+
+
+
+#if MPR_EVENT_IO_URING
+/*********************************** Locals ***********************************/
+
+#define RING_IGNORE     ((uint64) -1)       /* User data for requests whose completion is ignored */
+
+typedef struct MprRing {
+    int             fd;                     /* io_uring descriptor */
+    int             active;                 /* Ring is used instead of epoll */
+    int             waiting;                /* Wait service thread is waiting for completions */
+    int             breakArmed;             /* Poll on the breakout pipe is outstanding */
+    int             seq;                    /* Sequence number of the last poll request */
+    uint            *sqHead;                /* Submission ring head (updated by the kernel) */
+    uint            *sqTail;                /* Submission ring tail */
+    uint            *sqMask;
+    uint            *sqEntries;
+    uint            *sqArray;
+    struct io_uring_sqe *sqes;              /* Submission entries */
+    uint            *cqHead;                /* Completion ring head */
+    uint            *cqTail;                /* Completion ring tail (updated by the kernel) */
+    uint            *cqMask;
+    struct io_uring_cqe *cqes;              /* Completion entries */
+    void            *sqRing;                /* Mapped submission ring */
+    void            *cqRing;                /* Mapped completion ring. May be the same as sqRing */
+    ssize           sqRingSize;
+    ssize           cqRingSize;
+    ssize           sqesSize;
+} MprRing;
+
+/********************************** Forwards **********************************/
+
+static struct io_uring_sqe *getEntry(MprWaitService *ws);
+static void manageRing(MprRing *ring, int flags);
+static int openRing(MprRing *ring);
+static void queueBreak(MprWaitService *ws);
+static int queuePoll(MprWaitService *ws, MprWaitHandler *wp, int mask);
+static int queueRemove(MprWaitService *ws, MprWaitHandler *wp);
+static void serviceRing(MprWaitService *ws);
+static void submitRing(MprWaitService *ws);
+static void useEpoll(MprWaitService *ws);
+
+/************************************ Code ************************************/
+
+int mprCreateRing(MprWaitService *ws)
+{
+    MprRing     *ring;
+
+    if ((ring = mprAllocObj(MprRing, manageRing)) == 0) {
+        return MPR_ERR_MEMORY;
+    }
+    ring->fd = -1;
+    if (openRing(ring) < 0) {
+        mprLog(2, "io_uring is not supported, using epoll");
+        return MPR_ERR_CANT_INITIALIZE;
+    }
+    ws->ring = ring;
+    ring->active = 1;
+    queueBreak(ws);
+    return 0;
+}
+
+
+static int openRing(MprRing *ring)
+{
+    struct io_uring_params  params;
+    char                    *sq, *cq;
+
+    memset(&params, 0, sizeof(params));
+    if ((ring->fd = (int) syscall(__NR_io_uring_setup, MPR_IO_URING_SIZE, &params)) < 0) {
+        return MPR_ERR_CANT_INITIALIZE;
+    }
+    /* Extended arguments are required for wait timeouts */
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        return MPR_ERR_CANT_INITIALIZE;
+    }
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sqRingSize = ring->cqRingSize = max(ring->sqRingSize, ring->cqRingSize);
+    }
+    sq = mmap(0, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        return MPR_ERR_CANT_INITIALIZE;
+    }
+    ring->sqRing = sq;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+    } else {
+        cq = mmap(0, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            return MPR_ERR_CANT_INITIALIZE;
+        }
+    }
+    ring->cqRing = cq;
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(0, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = 0;
+        return MPR_ERR_CANT_INITIALIZE;
+    }
+    ring->sqHead = (uint*) &sq[params.sq_off.head];
+    ring->sqTail = (uint*) &sq[params.sq_off.tail];
+    ring->sqMask = (uint*) &sq[params.sq_off.ring_mask];
+    ring->sqEntries = (uint*) &sq[params.sq_off.ring_entries];
+    ring->sqArray = (uint*) &sq[params.sq_off.array];
+    ring->cqHead = (uint*) &cq[params.cq_off.head];
+    ring->cqTail = (uint*) &cq[params.cq_off.tail];
+    ring->cqMask = (uint*) &cq[params.cq_off.ring_mask];
+    ring->cqes = (struct io_uring_cqe*) &cq[params.cq_off.cqes];
+    return 0;
+}
+
+
+static void manageRing(MprRing *ring, int flags)
+{
+    if (flags & MPR_MANAGE_FREE) {
+        if (ring->sqes) {
+            munmap(ring->sqes, ring->sqesSize);
+        }
+        if (ring->cqRing && ring->cqRing != ring->sqRing) {
+            munmap(ring->cqRing, ring->cqRingSize);
+        }
+        if (ring->sqRing) {
+            munmap(ring->sqRing, ring->sqRingSize);
+        }
+        if (ring->fd >= 0) {
+            close(ring->fd);
+            ring->fd = -1;
+        }
+    }
+}
+
+
+bool mprIsRingActive(MprWaitService *ws)
+{
+    return ws->ring && ws->ring->active;
+}
+
+
+/*
+    Move the registered wait handlers between io_uring and epoll
+ */
+int mprEnableIoUring(bool enable)
+{
+    MprWaitService      *ws;
+    MprWaitHandler      *wp;
+    MprRing             *ring;
+    struct epoll_event  ev;
+    int                 fd, mask;
+
+    ws = MPR->waitService;
+    lock(ws);
+    if ((ring = ws->ring) == 0) {
+        unlock(ws);
+        return enable ? MPR_ERR_BAD_STATE : 0;
+    }
+    if (ring->active != enable) {
+        for (fd = 0; fd < ws->handlerMax; fd++) {
+            if ((wp = ws->handlerMap[fd]) == 0 || (mask = wp->desiredMask) == 0) {
+                continue;
+            }
+            if (enable) {
+                memset(&ev, 0, sizeof(ev));
+                ev.data.fd = fd;
+                epoll_ctl(ws->epoll, EPOLL_CTL_DEL, fd, &ev);
+            } else {
+                queueRemove(ws, wp);
+            }
+        }
+        ring->active = enable;
+        for (fd = 0; fd < ws->handlerMax; fd++) {
+            if ((wp = ws->handlerMap[fd]) == 0 || (mask = wp->desiredMask) == 0) {
+                continue;
+            }
+            wp->desiredMask = 0;
+            mprNotifyOn(ws, wp, mask);
+        }
+        if (enable && !ring->breakArmed) {
+            queueBreak(ws);
+        }
+        submitRing(ws);
+    }
+    unlock(ws);
+    mprWakeNotifier();
+    return 0;
+}
+
+
+/*
+    Move the registered wait handlers to epoll if the submission ring is full. The desired masks of the handlers are
+    unchanged so no interest is lost. Must be locked.
+ */
+static void useEpoll(MprWaitService *ws)
+{
+    MprWaitHandler  *wp;
+    int             fd, mask;
+
+    mprError("io_uring submission ring is full, using epoll");
+    ws->ring->active = 0;
+    for (fd = 0; fd < ws->handlerMax; fd++) {
+        if ((wp = ws->handlerMap[fd]) == 0 || (mask = wp->desiredMask) == 0) {
+            continue;
+        }
+        /* Outstanding polls no longer match and their completions are ignored */
+        wp->notifierIndex = -1;
+        wp->desiredMask = 0;
+        mprNotifyOn(ws, wp, mask);
+    }
+    /* Wake the wait service thread from the io_uring wait so it waits using epoll */
+    mprWakeNotifier();
+}
+
+
+/*
+    Update the poll request for a wait handler. Must be locked. Returns MPR_ERR_BAD_STATE if using epoll.
+ */
+int mprNotifyRing(MprWaitService *ws, MprWaitHandler *wp, int mask)
+{
+    MprRing     *ring;
+    int         fd;
+
+    if ((ring = ws->ring) == 0 || !ring->active) {
+        return MPR_ERR_BAD_STATE;
+    }
+    fd = wp->fd;
+    if (wp->desiredMask != mask) {
+        if ((wp->notifierIndex >= 0 && queueRemove(ws, wp) < 0) || (mask && queuePoll(ws, wp, mask) < 0)) {
+            /* The caller applies the new mask using epoll */
+            useEpoll(ws);
+            return MPR_ERR_BAD_STATE;
+        }
+        if (mask && fd >= ws->handlerMax) {
+            ws->handlerMax = fd + 32;
+            if ((ws->handlerMap = mprRealloc(ws->handlerMap, sizeof(MprWaitHandler*) * ws->handlerMax)) == 0) {
+                mprAssert(!MPR_ERR_MEMORY);
+                return MPR_ERR_MEMORY;
+            }
+        }
+        mprAssert(ws->handlerMap[fd] == 0 || ws->handlerMap[fd] == wp);
+        wp->desiredMask = mask;
+        if (ring->waiting) {
+            /* Otherwise submitted when the wait service thread next waits */
+            submitRing(ws);
+        }
+    }
+    ws->handlerMap[fd] = (mask) ? wp : 0;
+    return 0;
+}
+
+
+/*
+    Get a free submission entry. Must be locked.
+ */
+static struct io_uring_sqe *getEntry(MprWaitService *ws)
+{
+    MprRing             *ring;
+    struct io_uring_sqe *sqe;
+    uint                tail;
+
+    ring = ws->ring;
+    tail = *ring->sqTail;
+    if ((tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE)) >= *ring->sqEntries) {
+        submitRing(ws);
+        if ((tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE)) >= *ring->sqEntries) {
+            return 0;
+        }
+    }
+    sqe = &ring->sqes[tail & *ring->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+
+/*
+    Add the entry returned by getEntry to the submission ring
+ */
+static void putEntry(MprRing *ring)
+{
+    uint    tail;
+
+    tail = *ring->sqTail;
+    ring->sqArray[tail & *ring->sqMask] = tail & *ring->sqMask;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+    Queue a poll request for a wait handler. Returns MPR_ERR_TOO_MANY if the submission ring is full.
+ */
+static int queuePoll(MprWaitService *ws, MprWaitHandler *wp, int mask)
+{
+    MprRing             *ring;
+    struct io_uring_sqe *sqe;
+    uint                events;
+
+    ring = ws->ring;
+    if ((sqe = getEntry(ws)) == 0) {
+        return MPR_ERR_TOO_MANY;
+    }
+    events = 0;
+    if (mask & MPR_READABLE) {
+        events |= POLLIN | POLLHUP;
+    }
+    if (mask & MPR_WRITABLE) {
+        events |= POLLOUT;
+    }
+#if BIT_ENDIAN == MPR_BIG_ENDIAN
+    events = (events << 16) | (events >> 16);
+#endif
+    if (++ring->seq <= 0) {
+        ring->seq = 1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wp->fd;
+    sqe->poll32_events = events;
+    sqe->user_data = ((uint64) ring->seq << 32) | (uint) wp->fd;
+    wp->notifierIndex = ring->seq;
+    putEntry(ring);
+    return 0;
+}
+
+
+/*
+    Cancel the outstanding poll for a wait handler. The cancelled poll completes with a sequence that does not match.
+    Returns MPR_ERR_TOO_MANY if the submission ring is full.
+ */
+static int queueRemove(MprWaitService *ws, MprWaitHandler *wp)
+{
+    struct io_uring_sqe *sqe;
+
+    if (wp->notifierIndex < 0) {
+        return 0;
+    }
+    if ((sqe = getEntry(ws)) == 0) {
+        return MPR_ERR_TOO_MANY;
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = ((uint64) wp->notifierIndex << 32) | (uint) wp->fd;
+    sqe->user_data = RING_IGNORE;
+    wp->notifierIndex = -1;
+    putEntry(ws->ring);
+    return 0;
+}
+
+
+/*
+    Poll the breakout pipe. This uses sequence zero.
+ */
+static void queueBreak(MprWaitService *ws)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = getEntry(ws)) == 0) {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = ws->breakPipe[MPR_READ_PIPE];
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = (uint) ws->breakPipe[MPR_READ_PIPE];
+    ws->ring->breakArmed = 1;
+    putEntry(ws->ring);
+}
+
+
+/*
+    Submit queued entries without waiting. The kernel submits no more than the entries in the ring, so concurrent
+    submissions from the wait service thread are safe.
+ */
+static void submitRing(MprWaitService *ws)
+{
+    MprRing     *ring;
+    uint        count;
+
+    ring = ws->ring;
+    if ((count = *ring->sqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE)) > 0) {
+        if (syscall(__NR_io_uring_enter, ring->fd, count, 0, 0, NULL, 0) < 0) {
+            mprLog(7, "io_uring_enter returned errno %d", errno);
+        }
+    }
+}
+
+
+/*
+    Submit queued entries and wait for completions. Returns false if using epoll.
+ */
+bool mprWaitForRing(MprWaitService *ws, MprTime timeout)
+{
+    MprRing                         *ring;
+    struct io_uring_getevents_arg   arg;
+    struct __kernel_timespec        ts;
+    uint                            count;
+
+    lock(ws);
+    if ((ring = ws->ring) == 0 || !ring->active) {
+        unlock(ws);
+        return 0;
+    }
+    count = *ring->sqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    ring->waiting = 1;
+    unlock(ws);
+
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64) (size_t) &ts;
+
+    mprYield(MPR_YIELD_STICKY);
+    if (syscall(__NR_io_uring_enter, ring->fd, count, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, 
+            &arg, sizeof(arg)) < 0) {
+        if (errno != EINTR && errno != ETIME) {
+            mprLog(7, "io_uring_enter returned errno %d", errno);
+        }
+    }
+    mprResetYield();
+    serviceRing(ws);
+    ws->wakeRequested = 0;
+    return 1;
+}
+
+
+static void serviceRing(MprWaitService *ws)
+{
+    MprWaitHandler      *wp;
+    MprRing             *ring;
+    struct io_uring_cqe *cqe;
+    uint64              data;
+    uint                head, tail;
+    int                 fd, seq, mask, events;
+    char                buf[128];
+
+    lock(ws);
+    ring = ws->ring;
+    ring->waiting = 0;
+    head = *ring->cqHead;
+    tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        cqe = &ring->cqes[head & *ring->cqMask];
+        if ((data = cqe->user_data) == RING_IGNORE) {
+            continue;
+        }
+        fd = (int) (data & 0xFFFFFFFF);
+        seq = (int) (data >> 32);
+        if (seq == 0) {
+            if (fd == ws->breakPipe[MPR_READ_PIPE]) {
+                if (read(fd, buf, sizeof(buf)) < 0) {}
+                ring->breakArmed = 0;
+            }
+            continue;
+        }
+        if (fd >= ws->handlerMax || (wp = ws->handlerMap[fd]) == 0 || wp->notifierIndex != seq) {
+            /* Cancelled or replaced */
+            continue;
+        }
+        wp->notifierIndex = -1;
+        if (cqe->res < 0) {
+            /* Let the handler discover the error */
+            mprLog(7, "io_uring poll for fd %d failed, errno %d", fd, -cqe->res);
+            events = POLLERR;
+        } else {
+            events = cqe->res;
+        }
+        mask = 0;
+        if (events & (POLLIN | POLLERR | POLLHUP)) {
+            mask |= MPR_READABLE;
+        }
+        if (events & (POLLOUT | POLLERR | POLLHUP)) {
+            mask |= MPR_WRITABLE;
+        }
+        wp->presentMask = mask & wp->desiredMask;
+        if (wp->presentMask) {
+            wp->desiredMask = 0;
+            ws->handlerMap[fd] = 0;
+            mprQueueIOEvent(wp);
+        } else if (queuePoll(ws, wp, wp->desiredMask) < 0) {
+            /* Remaining completions do not match the reset sequences and are skipped */
+            useEpoll(ws);
+        }
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    if (ring->active && !ring->breakArmed) {
+        queueBreak(ws);
+    }
+    unlock(ws);
 }
 
-
-MprHash *mprCreateHashFromWords(cchar *str)
+#else
+int mprEnableIoUring(bool enable)
 {
-    MprHash     *hash;
-    char        *word, *next;
-
-    hash = mprCreateHash(0, 0);
-    word = stok(sclone(str), ", \t\n\r", &next);
-    while (word) {
-        mprAddKey(hash, word, word);
-        word = stok(NULL, " \t\n\r", &next);
-    }
-    return hash;
+    return enable ? MPR_ERR_BAD_STATE : 0;
 }
-
+#endif /* MPR_EVENT_IO_URING */
 
 /*
     @copy   default
@@ -23109,20 +24586,45 @@ static void standardSignalHandler(void *ignored, MprSignal *sp)
 #define BIT_HAS_GETADDRINFO 1
 #endif
 
+/************************************ Locals **********************************/
+/*
+    Server SSL handshake run by the handshake threads
+ */
+typedef struct MprHandshake {
+    MprSocket       *sock;                  /* Socket being secured */
+    MprDispatcher   *dispatcher;            /* Dispatcher for the completion callback */
+    MprHandshakeProc proc;                  /* Completion callback */
+    void            *data;                  /* Callback data */
+    MprWaitHandler  *handler;               /* Wait handler while waiting for the peer */
+    MprEvent        *timer;                 /* Handshake timeout */
+    int             status;                 /* Completion status */
+    int             waiting;                /* Waiting for I/O */
+    int             expired;                /* Handshake timed out or cancelled */
+    int             cancelled;              /* Cancelled. The callback is not invoked. */
+    int             done;                   /* Handshake complete and the callback is scheduled */
+} MprHandshake;
+
 /******************************* Forward Declarations *************************/
 
 static void closeSocket(MprSocket *sp, bool gracefully);
 static int connectSocket(MprSocket *sp, cchar *ipAddr, int port, int initialFlags);
 static MprSocketProvider *createStandardProvider(MprSocketService *ss);
 static void disconnectSocket(MprSocket *sp);
+static void driveHandshake(MprSocketService *ss, MprHandshake *hs);
 static ssize flushSocket(MprSocket *sp);
 static int getSocketIpAddr(struct sockaddr *addr, int addrlen, char *ip, int size, int *port);
+static void handshakeComplete(MprHandshake *hs, MprEvent *event);
+static void handshakeMain(MprCond *cond, MprThread *tp);
+static void handshakeTimeout(MprHandshake *hs, MprEvent *event);
 static int ipv6(cchar *ip);
 static int listenSocket(MprSocket *sp, cchar *ip, int port, int initialFlags);
+static void manageHandshake(MprHandshake *hs, int flags);
 static void manageSocket(MprSocket *sp, int flags);
 static void manageSocketService(MprSocketService *ss, int flags);
 static void manageSsl(MprSsl *ssl, int flags);
+static void queueHandshake(MprSocketService *ss, MprHandshake *hs);
 static ssize readSocket(MprSocket *sp, void *buf, ssize bufsize);
+static void resumeHandshake(MprHandshake *hs, MprEvent *event);
 static ssize writeSocket(MprSocket *sp, cvoid *buf, ssize bufsize);
 
 /************************************ Code ************************************/
@@ -23167,6 +24669,10 @@ MprSocketService *mprCreateSocketService()
     mprSetDomainName(domainName);
     mprSetHostName(hostName);
     ss->secureSockets = mprCreateList(0, 0);
+    ss->handshakes = mprCreateList(0, 0);
+    ss->handshakeQ = mprCreateList(0, 0);
+    ss->handshakeIdle = mprCreateList(0, 0);
+    ss->handshakeMax = MPR_HANDSHAKE_THREADS;
     return ss;
 }
 
@@ -23179,6 +24685,9 @@ static void manageSocketService(MprSocketService *ss, int flags)
         mprMark(ss->defaultProvider);
         mprMark(ss->mutex);
         mprMark(ss->secureSockets);
+        mprMark(ss->handshakes);
+        mprMark(ss->handshakeQ);
+        mprMark(ss->handshakeIdle);
     }
 }
 
@@ -23964,7 +25473,10 @@ ssize mprWriteSocketVector(MprSocket *sp, MprIOVec *iovec, int count)
 
 
 #if !BIT_ROM
-#if !LINUX || __UCLIBC__
+/*
+    Read file data and write via the socket provider. Used where sendfile is not available and for secure sockets
+    that are not using kernel TLS.
+ */
 static ssize localSendfile(MprSocket *sp, MprFile *file, MprOff offset, ssize len)
 {
     char    buf[MPR_BUFSIZE];
@@ -23977,12 +25489,28 @@ static ssize localSendfile(MprSocket *sp, MprFile *file, MprOff offset, ssize le
     }
     return mprWriteSocket(sp, buf, len);
 }
+
+
+#if LINUX && defined(TCP_CORK)
+/*
+    Hold back partial frames while writing the headers, file data and trailers as separate system calls. This lets 
+    the headers share a segment with the start of the file data.
+ */
+static void corkSocket(MprSocket *sock, int on)
+{
+    int     err;
+
+    err = errno;
+    setsockopt(sock->fd, IPPROTO_TCP, TCP_CORK, (char*) &on, sizeof(int));
+    errno = err;
+}
 #endif
 
 
 /*  
     Write data from a file to a socket. Includes the ability to write header before and after the file data.
-    Works even with a null "file" to just output the headers.
+    Works even with a null "file" to just output the headers. Secure sockets only use sendfile if the kernel is
+    encrypting the TLS records.
  */
 MprOff mprSendFileToSocket(MprSocket *sock, MprFile *file, MprOff offset, MprOff bytes, MprIOVec *beforeVec, 
     int beforeCount, MprIOVec *afterVec, int afterCount)
@@ -23992,9 +25520,10 @@ MprOff mprSendFileToSocket(MprSocket *sock, MprFile *file, MprOff offset, MprOff
 #endif
     MprOff          written, toWriteFile;
     ssize           i, rc, toWriteBefore, toWriteAfter, nbytes;
-    int             done;
+    int             done, corked;
 
     rc = 0;
+    corked = 0;
 
 #if MACOSX && __MAC_OS_X_VERSION_MIN_REQUIRED >= 1050
     def.hdr_cnt = (int) beforeCount;
@@ -24002,7 +25531,7 @@ MprOff mprSendFileToSocket(MprSocket *sock, MprFile *file, MprOff offset, MprOff
     def.trl_cnt = (int) afterCount;
     def.trailers = (afterCount > 0) ? (struct iovec*) afterVec: 0;
 
-    if (file && file->fd >= 0) {
+    if (file && file->fd >= 0 && mprSocketCanSendFile(sock)) {
         written = bytes;
         if (sock->flags & MPR_SOCKET_BLOCK) {
             mprYield(MPR_YIELD_STICKY);
@@ -24028,6 +25557,13 @@ MprOff mprSendFileToSocket(MprSocket *sock, MprFile *file, MprOff offset, MprOff
         toWriteFile = (bytes - toWriteBefore - toWriteAfter);
         mprAssert(toWriteFile >= 0);
 
+#if LINUX && defined(TCP_CORK)
+        if ((beforeCount > 0 || afterCount > 0) && toWriteFile > 0 && file && file->fd >= 0) {
+            corkSocket(sock, 1);
+            corked = 1;
+        }
+#endif
+
         /*
             Linux sendfile does not have the integrated ability to send headers. Must do it separately here.
             I/O requests may return short (write fewer than requested bytes).
@@ -24052,11 +25588,15 @@ MprOff mprSendFileToSocket(MprSocket *sock, MprFile *file, MprOff offset, MprOff
                     mprYield(MPR_YIELD_STICKY);
                 }
 #if LINUX && !__UCLIBC__
+                if (mprSocketCanSendFile(sock)) {
     #if BIT_HAS_OFF64
-                rc = sendfile64(sock->fd, file->fd, &offset, nbytes);
+                    rc = sendfile64(sock->fd, file->fd, &offset, nbytes);
     #else
-                rc = sendfile(sock->fd, file->fd, &off, nbytes);
+                    rc = sendfile(sock->fd, file->fd, &off, nbytes);
     #endif
+                } else {
+                    rc = localSendfile(sock, file, offset, nbytes);
+                }
 #else
                 rc = localSendfile(sock, file, offset, nbytes);
 #endif
@@ -24079,6 +25619,12 @@ MprOff mprSendFileToSocket(MprSocket *sock, MprFile *file, MprOff offset, MprOff
                 written += rc;
             }
         }
+#if LINUX && defined(TCP_CORK)
+        if (corked) {
+            /* Uncork even if the write was short so that whatever was queued is transmitted now */
+            corkSocket(sock, 0);
+        }
+#endif
     }
     if (rc < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -24106,6 +25652,12 @@ ssize mprFlushSocket(MprSocket *sp)
 }
 
 
+bool mprSocketCanSendFile(MprSocket *sp)
+{
+    return (sp->sslSocket == 0 || (sp->flags & MPR_SOCKET_KTLS)) ? 1 : 0;
+}
+
+
 bool mprSocketHasPendingData(MprSocket *sp)
 {
     return (sp->flags & MPR_SOCKET_PENDING) ? 1 : 0;
@@ -24614,127 +26166,448 @@ static void manageSsl(MprSsl *ssl, int flags)
         mprMark(ssl->caFile);
         mprMark(ssl->caPath);
         mprMark(ssl->ciphers);
+        mprMark(ssl->alpn);
         mprMark(ssl->pconfig);
         mprMark(ssl->provider);
         mprMark(ssl->providerName);
+        mprMark(ssl->sessionCache);
+    }
+}
+
+
+/*
+    Create a new SSL context object
+ */
+MprSsl *mprCreateSsl()
+{
+    MprSsl      *ssl;
+
+    if ((ssl = mprAllocObj(MprSsl, manageSsl)) == 0) {
+        return 0;
+    }
+    ssl->ciphers = sclone(MPR_DEFAULT_CIPHER_SUITE);
+    ssl->protocols = MPR_PROTO_TLSV1 | MPR_PROTO_TLSV11;
+    ssl->verifyDepth = 1;
+    ssl->verifyPeer = 0;
+    ssl->verifyIssuer = 0;
+    ssl->cacheSize = MPR_SSL_CACHE_SIZE;
+    ssl->sessionLifespan = MPR_SSL_SESSION_LIFESPAN;
+    ssl->ticketRotation = MPR_SSL_TICKET_ROTATION;
+    return ssl;
+}
+
+
+/*
+    Clone a SSL context object
+ */
+MprSsl *mprCloneSsl(MprSsl *src)
+{
+    MprSsl      *ssl;
+
+    if ((ssl = mprAllocObj(MprSsl, manageSsl)) == 0) {
+        return 0;
+    }
+    if (src) {
+        *ssl = *src;
+    }
+    return ssl;
+}
+
+
+int mprLoadSsl()
+{
+#if BIT_PACK_SSL
+    MprSocketService    *ss;
+    MprModule           *mp;
+    cchar               *path;
+
+    ss = MPR->socketService;
+    if (ss->providers) {
+        return 0;
+    }
+    path = mprJoinPath(mprGetAppDir(), "libmprssl");
+    if ((mp = mprCreateModule("sslModule", path, "mprSslInit", NULL)) == 0) {
+        return MPR_ERR_CANT_CREATE;
+    }
+    if (mprLoadModule(mp) < 0) {
+        mprError("Can't load %s", path);
+        ss->providers = 0;
+        return MPR_ERR_CANT_READ;
+    }
+    return 0;
+#else
+    mprError("SSL communications support not included in build");
+    return MPR_ERR_BAD_STATE;
+#endif
+}
+
+
+static int loadProviders()
+{
+    MprSocketService    *ss;
+
+    ss = MPR->socketService;
+    if (!ss->providers && mprLoadSsl() < 0) {
+        return MPR_ERR_CANT_READ;
+    }
+    if (!ss->providers) {
+        mprError("Can't load SSL provider");
+        return MPR_ERR_CANT_INITIALIZE;
+    }
+    return 0;
+}
+
+
+/*
+    Upgrade a socket to use SSL
+ */
+int mprUpgradeSocket(MprSocket *sp, MprSsl *ssl, int server)
+{
+    MprSocketService    *ss;
+    char                *providerName;
+
+    ss  = sp->service;
+    mprAssert(sp);
+
+    if (!ssl) {
+        return MPR_ERR_BAD_ARGS;
+    }
+    if (!ssl->provider) {
+        if (loadProviders() < 0) {
+            return MPR_ERR_CANT_INITIALIZE;
+        }
+        providerName = (ssl->providerName) ? ssl->providerName : ss->defaultProvider;
+        if ((ssl->provider = mprLookupKey(ss->providers, providerName)) == 0) {
+            mprError("Can't use SSL, missing SSL provider %s", providerName);
+            return MPR_ERR_CANT_INITIALIZE;
+        }
+        ssl->providerName = providerName;
+    }
+    mprLog(5, "Using %s SSL provider", ssl->providerName);
+    sp->provider = ssl->provider;
+#if FUTURE
+    //  MOB - session resumption can cause problems with Nagle. 
+    //  However, appweb opens sockets with nodelay by default
+    sp->flags |= MPR_SOCKET_NODELAY;
+    mprSetSocketNoDelay(sp, 1);
+#endif
+    return sp->provider->upgradeSocket(sp, ssl, server);
+}
+
+
+/*
+    Complete the handshake for a new server connection on a handshake thread. The completion callback runs on the
+    given dispatcher so the caller can then attach the connection without blocking its worker on the handshake.
+ */
+int mprHandshakeSocket(MprSocket *sp, MprDispatcher *dispatcher, MprHandshakeProc proc, void *data)
+{
+    MprSocketService    *ss;
+    MprHandshake        *hs;
+
+    mprAssert(sp);
+    mprAssert(proc);
+
+    ss = sp->service;
+    if (sp->provider == 0 || sp->provider->handshakeSocket == 0 || ss->handshakeMax <= 0) {
+        return MPR_ERR_BAD_STATE;
+    }
+    if ((hs = mprAllocObj(MprHandshake, manageHandshake)) == 0) {
+        return MPR_ERR_MEMORY;
+    }
+    hs->sock = sp;
+    hs->dispatcher = dispatcher;
+    hs->proc = proc;
+    hs->data = data;
+
+    lock(ss);
+    if (mprGetListLength(ss->handshakes) >= MPR_MAX_HANDSHAKES) {
+        unlock(ss);
+        return MPR_ERR_TOO_MANY;
+    }
+    mprAddItem(ss->handshakes, hs);
+    hs->timer = mprCreateEvent(MPR->nonBlock, "handshakeTimeout", MPR_HANDSHAKE_TIMEOUT, handshakeTimeout, hs, 0);
+    queueHandshake(ss, hs);
+    unlock(ss);
+    return 0;
+}
+
+
+/*
+    Cancel a pending handshake. If the handshake is not running, the socket is closed here. Otherwise the handshake 
+    thread closes the socket when the current handshake step returns.
+ */
+int mprCancelHandshake(MprSocket *sp)
+{
+    MprSocketService    *ss;
+    MprHandshake        *hs;
+    MprWaitHandler      *handler;
+    int                 next, running;
+
+    mprAssert(sp);
+
+    ss = sp->service;
+    lock(ss);
+    for (ITERATE_ITEMS(ss->handshakes, hs, next)) {
+        if (hs->sock == sp) {
+            break;
+        }
+    }
+    if (hs == 0) {
+        unlock(ss);
+        return 0;
+    }
+    hs->cancelled = 1;
+    hs->expired = 1;
+    if (hs->timer) {
+        mprRemoveEvent(hs->timer);
+        hs->timer = 0;
+    }
+    running = !(hs->done || hs->waiting || mprRemoveItem(ss->handshakeQ, hs) >= 0);
+    handler = 0;
+    if (!running) {
+        hs->waiting = 0;
+        handler = hs->handler;
+        hs->handler = 0;
+        mprRemoveItem(ss->handshakes, hs);
+    }
+    unlock(ss);
+
+    if (!running) {
+        mprRemoveWaitHandler(handler);
+        mprCloseSocket(sp, 0);
+    }
+    return 1;
+}
+
+
+void mprSetHandshakeThreads(int count)
+{
+    MprSocketService    *ss;
+    MprCond             *cond;
+    int                 next;
+
+    ss = MPR->socketService;
+    lock(ss);
+    ss->handshakeMax = max(count, 0);
+    /* Wake idle threads so surplus threads can exit */
+    for (ITERATE_ITEMS(ss->handshakeIdle, cond, next)) {
+        mprSignalCond(cond);
+    }
+    unlock(ss);
+}
+
+
+static void manageHandshake(MprHandshake *hs, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(hs->sock);
+        mprMark(hs->dispatcher);
+        mprMark(hs->data);
+        mprMark(hs->handler);
+        mprMark(hs->timer);
+    }
+}
+
+
+/*
+    Queue a handshake to run and wake or start a handshake thread. Must be locked.
+ */
+static void queueHandshake(MprSocketService *ss, MprHandshake *hs)
+{
+    MprThread   *tp;
+    MprCond     *cond;
+
+    mprAddItem(ss->handshakeQ, hs);
+    if ((cond = mprPopItem(ss->handshakeIdle)) != 0) {
+        mprSignalCond(cond);
+
+    } else if (ss->handshakeThreads < ss->handshakeMax) {
+        if ((cond = mprCreateCond()) == 0) {
+            return;
+        }
+        if ((tp = mprCreateThread("handshake", handshakeMain, cond, 0)) == 0) {
+            return;
+        }
+        ss->handshakeThreads++;
+        if (mprStartThread(tp) < 0) {
+            ss->handshakeThreads--;
+        }
+    }
+}
+
+
+/*
+    Handshake thread. Run queued handshakes and sleep when idle. Threads exit when the pool is reduced.
+ */
+static void handshakeMain(MprCond *cond, MprThread *tp)
+{
+    MprSocketService    *ss;
+    MprHandshake        *hs;
+
+    ss = MPR->socketService;
+    lock(ss);
+    while (!mprIsStopping() && ss->handshakeThreads <= ss->handshakeMax) {
+        if ((hs = mprGetFirstItem(ss->handshakeQ)) != 0) {
+            mprRemoveItemAtPos(ss->handshakeQ, 0);
+            unlock(ss);
+            driveHandshake(ss, hs);
+            lock(ss);
+            continue;
+        }
+        mprAddItem(ss->handshakeIdle, cond);
+        unlock(ss);
+
+        mprYield(MPR_YIELD_STICKY);
+        mprWaitForCond(cond, MPR_TICKS_PER_SEC);
+        mprResetYield();
+
+        lock(ss);
+        mprRemoveItem(ss->handshakeIdle, cond);
     }
+    ss->handshakeThreads--;
+    unlock(ss);
 }
 
 
 /*
-    Create a new SSL context object
+    Advance the handshake as far as possible without blocking. If the peer has not responded, wait for I/O and release
+    the thread to run other handshakes.
  */
-MprSsl *mprCreateSsl()
+static void driveHandshake(MprSocketService *ss, MprHandshake *hs)
 {
-    MprSsl      *ssl;
+    MprSocket       *sp;
+    MprWaitHandler  *handler;
+    int             rc;
 
-    if ((ssl = mprAllocObj(MprSsl, manageSsl)) == 0) {
-        return 0;
+    sp = hs->sock;
+    if (hs->expired) {
+        rc = MPR_ERR_TIMEOUT;
+    } else {
+        rc = sp->provider->handshakeSocket(sp);
+    }
+    lock(ss);
+    if (rc > 0 && hs->expired) {
+        /* Timed out or cancelled while the handshake step was running */
+        rc = MPR_ERR_TIMEOUT;
+    }
+    if (rc > 0) {
+        hs->waiting = 1;
+        if (hs->handler == 0) {
+            hs->handler = mprCreateWaitHandler(sp->fd, rc, MPR->nonBlock, resumeHandshake, hs, 0);
+        } else {
+            mprWaitOn(hs->handler, rc);
+        }
+        unlock(ss);
+        return;
+    }
+    if (hs->timer) {
+        mprRemoveEvent(hs->timer);
+        hs->timer = 0;
+    }
+    handler = hs->handler;
+    hs->handler = 0;
+    hs->status = rc;
+    hs->done = 1;
+    if (rc < 0) {
+        sp->flags |= MPR_SOCKET_EOF;
+    }
+    if (hs->cancelled) {
+        mprRemoveItem(ss->handshakes, hs);
+    }
+    unlock(ss);
+
+    mprRemoveWaitHandler(handler);
+    if (hs->cancelled) {
+        mprCloseSocket(sp, 0);
+    } else {
+        mprCreateEvent(hs->dispatcher, "handshakeComplete", 0, handshakeComplete, hs, 0);
     }
-    ssl->ciphers = sclone(MPR_DEFAULT_CIPHER_SUITE);
-    ssl->protocols = MPR_PROTO_TLSV1 | MPR_PROTO_TLSV11;
-    ssl->verifyDepth = 1;
-    ssl->verifyPeer = 0;
-    ssl->verifyIssuer = 0;
-    return ssl;
 }
 
 
 /*
-    Clone a SSL context object
+    I/O event for a handshake waiting on the peer. This runs on the event thread and only requeues the handshake.
  */
-MprSsl *mprCloneSsl(MprSsl *src)
+static void resumeHandshake(MprHandshake *hs, MprEvent *event)
 {
-    MprSsl      *ssl;
+    MprSocketService    *ss;
 
-    if ((ssl = mprAllocObj(MprSsl, manageSsl)) == 0) {
-        return 0;
-    }
-    if (src) {
-        *ssl = *src;
+    ss = MPR->socketService;
+    lock(ss);
+    if (hs->waiting) {
+        hs->waiting = 0;
+        queueHandshake(ss, hs);
     }
-    return ssl;
+    unlock(ss);
 }
 
 
-int mprLoadSsl()
+static void handshakeTimeout(MprHandshake *hs, MprEvent *event)
 {
-#if BIT_PACK_SSL
     MprSocketService    *ss;
-    MprModule           *mp;
-    cchar               *path;
 
     ss = MPR->socketService;
-    if (ss->providers) {
-        return 0;
-    }
-    path = mprJoinPath(mprGetAppDir(), "libmprssl");
-    if ((mp = mprCreateModule("sslModule", path, "mprSslInit", NULL)) == 0) {
-        return MPR_ERR_CANT_CREATE;
-    }
-    if (mprLoadModule(mp) < 0) {
-        mprError("Can't load %s", path);
-        ss->providers = 0;
-        return MPR_ERR_CANT_READ;
+    lock(ss);
+    if (hs->timer) {
+        /* Not yet complete */
+        mprLog(4, "SSL handshake timed out for %s:%d", hs->sock->ip, hs->sock->port);
+        hs->timer = 0;
+        hs->expired = 1;
+        if (hs->waiting) {
+            hs->waiting = 0;
+            queueHandshake(ss, hs);
+        }
     }
-    return 0;
-#else
-    mprError("SSL communications support not included in build");
-    return MPR_ERR_BAD_STATE;
-#endif
+    unlock(ss);
 }
 
 
-static int loadProviders()
+static void handshakeComplete(MprHandshake *hs, MprEvent *event)
 {
     MprSocketService    *ss;
 
     ss = MPR->socketService;
-    if (!ss->providers && mprLoadSsl() < 0) {
-        return MPR_ERR_CANT_READ;
-    }
-    if (!ss->providers) {
-        mprError("Can't load SSL provider");
-        return MPR_ERR_CANT_INITIALIZE;
+    lock(ss);
+    if (hs->cancelled) {
+        unlock(ss);
+        return;
     }
-    return 0;
+    mprRemoveItem(ss->handshakes, hs);
+    unlock(ss);
+    (hs->proc)(hs->data, hs->sock, event->dispatcher, hs->status);
 }
 
 
-/*
-    Upgrade a socket to use SSL
- */
-int mprUpgradeSocket(MprSocket *sp, MprSsl *ssl, int server)
+void mprGetSslStats(MprSsl *ssl, MprSslStats *stats)
 {
-    MprSocketService    *ss;
-    char                *providerName;
+    mprAssert(ssl);
+    *stats = ssl->stats;
+}
 
-    ss  = sp->service;
-    mprAssert(sp);
 
-    if (!ssl) {
-        return MPR_ERR_BAD_ARGS;
+void mprSetSslAlpn(MprSsl *ssl, cchar *protocols)
+{
+    mprAssert(ssl);
+    ssl->alpn = sclone(protocols);
+}
+
+
+void mprSetSslCache(MprSsl *ssl, MprCache *cache)
+{
+    mprAssert(ssl);
+    ssl->sessionCache = cache;
+}
+
+
+void mprSetSslCacheLimits(MprSsl *ssl, int size, MprTime lifespan)
+{
+    mprAssert(ssl);
+    if (size >= 0) {
+        ssl->cacheSize = size;
     }
-    if (!ssl->provider) {
-        if (loadProviders() < 0) {
-            return MPR_ERR_CANT_INITIALIZE;
-        }
-        providerName = (ssl->providerName) ? ssl->providerName : ss->defaultProvider;
-        if ((ssl->provider = mprLookupKey(ss->providers, providerName)) == 0) {
-            mprError("Can't use SSL, missing SSL provider %s", providerName);
-            return MPR_ERR_CANT_INITIALIZE;
-        }
-        ssl->providerName = providerName;
+    if (lifespan > 0) {
+        ssl->sessionLifespan = lifespan;
     }
-    mprLog(5, "Using %s SSL provider", ssl->providerName);
-    sp->provider = ssl->provider;
-#if FUTURE
-    //  MOB - session resumption can cause problems with Nagle. 
-    //  However, appweb opens sockets with nodelay by default
-    sp->flags |= MPR_SOCKET_NODELAY;
-    mprSetSocketNoDelay(sp, 1);
-#endif
-    return sp->provider->upgradeSocket(sp, ssl, server);
 }
 
 
@@ -24745,6 +26618,13 @@ void mprSetSslCiphers(MprSsl *ssl, cchar *ciphers)
 }
 
 
+void mprSetSslKernelTls(MprSsl *ssl, bool on)
+{
+    mprAssert(ssl);
+    ssl->kernelTls = on;
+}
+
+
 void mprSetSslKeyFile(MprSsl *ssl, cchar *keyFile)
 {
     mprAssert(ssl);
@@ -24785,6 +26665,12 @@ void mprSetSslProvider(MprSsl *ssl, cchar *provider)
 }
 
 
+void mprSetSslTicketRotation(MprSsl *ssl, MprTime period)
+{
+    ssl->ticketRotation = max(period, 0);
+}
+
+
 void mprVerifySslPeer(MprSsl *ssl, bool on)
 {
     ssl->verifyPeer = on;
@@ -26875,7 +28761,12 @@ static void manageThreadService(MprThreadService *ts, int flags);
 static void manageThread(MprThread *tp, int flags);
 static void manageWorker(MprWorker *worker, int flags);
 static void manageWorkerService(MprWorkerService *ws, int flags);
+static bool popWork(MprWorker *worker, MprWorker *from);
 static void pruneWorkers(MprWorkerService *ws, MprEvent *timer);
+static int pushWork(MprWorker *worker, MprWorkerProc proc, void *data);
+static void resumeCoroutine(MprCoroutine *co, MprWorker *worker);
+static bool stealIdleWork(MprWorkerService *ws, MprWorker *worker);
+static bool stealWork(MprWorkerService *ws, MprWorker *worker);
 static void threadProc(MprThread *tp);
 static void workerMain(MprWorker *worker, MprThread *tp);
 
@@ -26894,6 +28785,9 @@ MprThreadService *mprCreateThreadService()
     if ((ts->threads = mprCreateList(-1, 0)) == 0) {
         return 0;
     }
+    if ((ts->locals = mprCreateList(-1, 0)) == 0) {
+        return 0;
+    }
     MPR->mainOsThread = mprGetCurrentOsThread();
     MPR->threadService = ts;
     ts->stackSize = MPR_DEFAULT_STACK;
@@ -26918,6 +28812,7 @@ static void manageThreadService(MprThreadService *ts, int flags)
 {
     if (flags & MPR_MANAGE_MARK) {
         mprMark(ts->threads);
+        mprMark(ts->locals);
         mprMark(ts->mainThread);
         mprMark(ts->cond);
 
@@ -27033,6 +28928,7 @@ static void manageThread(MprThread *tp, int flags)
         mprMark(tp->data);
         mprMark(tp->cond);
         mprMark(tp->mutex);
+        mprMark(tp->coroutine);
 
     } else if (flags & MPR_MANAGE_FREE) {
         if (ts->threads) {
@@ -27222,6 +29118,7 @@ MprThreadLocal *mprCreateThreadLocal()
         return 0;
     }
 #endif
+    mprAddItem(MPR->threadService->locals, tls);
     return tls;
 }
 
@@ -27399,6 +29296,11 @@ MprWorkerService *mprCreateWorkerService()
     ws->minThreads = MPR_DEFAULT_MIN_THREADS;
     ws->maxThreads = MPR_DEFAULT_MAX_THREADS;
 
+    /*
+        Spinning idle workers only helps if another CPU can produce work meanwhile
+     */
+    ws->spinCount = (mprGetMemStats()->numCpu > 1) ? MPR_WORKER_SPIN : 0;
+
     /*
         Presize the lists so they cannot get memory allocation failures later on.
      */
@@ -27548,6 +29450,30 @@ void mprActivateWorker(MprWorker *worker, MprWorkerProc proc, void *data)
 }
 
 
+void mprResumeWorkerCoroutine(MprWorker *worker, MprCoroutine *co)
+{
+    MprWorkerService    *ws;
+
+    ws = worker->workerService;
+    mprLock(ws->mutex);
+    if (worker->state == MPR_WORKER_IDLE) {
+        worker->proc = (MprWorkerProc) resumeCoroutine;
+        worker->data = co;
+        changeState(worker, MPR_WORKER_BUSY);
+    } else {
+        /* Resumed by workerMain when the current work completes */
+        mprAddItem(worker->resumeQ, co);
+    }
+    mprUnlock(ws->mutex);
+}
+
+
+static void resumeCoroutine(MprCoroutine *co, MprWorker *worker)
+{
+    mprResumeCoroutine(co);
+}
+
+
 void mprSetWorkerStartCallback(MprWorkerProc start)
 {
     MPR->workerService->startWorker = start;
@@ -27568,19 +29494,46 @@ int mprAvailableWorkers()
 
 
 int mprStartWorker(MprWorkerProc proc, void *data)
+{
+    return mprStartPreferredWorker(NULL, proc, data);
+}
+
+
+int mprStartPreferredWorker(MprWorker *preferred, MprWorkerProc proc, void *data)
 {
     MprWorkerService    *ws;
-    MprWorker           *worker;
+    MprWorker           *worker, *wp;
+    int                 next;
 
     ws = MPR->workerService;
+
+    /*
+        If idle workers are spinning, queue on the busy preferred worker without taking the service lock. The preferred
+        worker runs the procedure when its current procedure completes unless a spinning worker steals it first. 
+        Only wake a sleeping worker to steal it if the spinners have since gone to sleep.
+     */
+    if (preferred && ws->spinning > 0 && pushWork(preferred, proc, data) == 0) {
+        if (ws->spinning == 0) {
+            mprLock(ws->mutex);
+            if ((worker = mprGetFirstItem(ws->idleThreads)) != 0) {
+                changeState(worker, MPR_WORKER_BUSY);
+            }
+            mprUnlock(ws->mutex);
+        }
+        return 0;
+    }
     mprLock(ws->mutex);
 
     /*
-        Try to find an idle thread and wake it up. It will wakeup in workerMain(). If not any available, then add 
-        another thread to the worker. Must account for workers we've already created but have not yet gone to work 
-        and inserted themselves in the idle/busy queues.
+        Try to find an idle thread and wake it up. It will wakeup in workerMain(). Prefer the given worker as its 
+        cache is likely to be warm. If not any available, then add another thread to the worker. Must account for 
+        workers we've already created but have not yet gone to work and inserted themselves in the idle/busy queues.
      */
-    worker = mprGetFirstItem(ws->idleThreads);
+    if (preferred && preferred->state == MPR_WORKER_IDLE) {
+        worker = preferred;
+    } else {
+        worker = mprGetFirstItem(ws->idleThreads);
+    }
     if (worker) {
         worker->proc = proc;
         worker->data = data;
@@ -27603,6 +29556,23 @@ int mprStartWorker(MprWorkerProc proc, void *data)
         mprStartThread(worker->thread);
 
     } else {
+        /*
+            All workers are busy. Queue on the preferred worker if it has nothing else queued, otherwise on the 
+            least loaded worker. Idle workers will steal from the queue if the busy worker does not get to it first.
+         */
+        if (preferred && preferred->state == MPR_WORKER_BUSY && preferred->runCount == 0) {
+            worker = preferred;
+        } else {
+            for (next = 0; (wp = mprGetNextItem(ws->busyThreads, &next)) != 0; ) {
+                if (worker == 0 || wp->runCount < worker->runCount) {
+                    worker = wp;
+                }
+            }
+        }
+        if (worker && pushWork(worker, proc, data) == 0) {
+            mprUnlock(ws->mutex);
+            return 0;
+        }
         /*
             No free workers and can't create anymore
          */
@@ -27634,7 +29604,8 @@ static void pruneWorkers(MprWorkerService *ws, MprEvent *timer)
             break;
         }
         worker = mprGetItem(ws->idleThreads, index);
-        if ((worker->lastActivity + MPR_TIMEOUT_WORKER) < MPR->eventService->now) {
+        if ((worker->lastActivity + MPR_TIMEOUT_WORKER) < MPR->eventService->now && worker->coroutines == 0) {
+            /* Workers with suspended coroutines must remain to resume them */
             changeState(worker, MPR_WORKER_PRUNED);
         }
     }
@@ -27703,6 +29674,8 @@ static MprWorker *createWorker(MprWorkerService *ws, ssize stackSize)
     worker->state = 0;
     worker->workerService = ws;
     worker->idleCond = mprCreateCond();
+    worker->spin = mprCreateSpinLock();
+    worker->resumeQ = mprCreateList(0, 0);
 
     mprSprintf(name, sizeof(name), "worker.%u", getNextThreadNum(ws));
     worker->thread = mprCreateThread(name, (MprThreadProc) workerMain, worker, stackSize);
@@ -27712,18 +29685,110 @@ static MprWorker *createWorker(MprWorkerService *ws, ssize stackSize)
 
 static void manageWorker(MprWorker *worker, int flags)
 {
+    int     i;
+
     if (flags & MPR_MANAGE_MARK) {
-        mprMark(worker->data);
         mprMark(worker->thread);
         mprMark(worker->workerService);
         mprMark(worker->idleCond);
+        mprMark(worker->spin);
+        mprMark(worker->resumeQ);
+        mprSpinLock(worker->spin);
+        mprMark(worker->data);
+        for (i = 0; i < MPR_WORKER_QUEUE; i++) {
+            mprMark(worker->runData[i]);
+        }
+        mprSpinUnlock(worker->spin);
+    }
+}
+
+
+/*
+    Queue a procedure to run when a busy worker completes its current procedure. The state is tested under the run 
+    queue lock so the service lock is not required. A worker going idle re-checks its run queue after changing state.
+ */
+static int pushWork(MprWorker *worker, MprWorkerProc proc, void *data)
+{
+    int     index, rc;
+
+    rc = 0;
+    mprSpinLock(worker->spin);
+    if (worker->state != MPR_WORKER_BUSY || worker->runCount >= MPR_WORKER_QUEUE) {
+        rc = MPR_ERR_BUSY;
+    } else {
+        index = (worker->runFirst + worker->runCount) % MPR_WORKER_QUEUE;
+        worker->runProc[index] = proc;
+        worker->runData[index] = data;
+        worker->runCount++;
+        mprAtomicAdd(&worker->workerService->queued, 1);
+    }
+    mprSpinUnlock(worker->spin);
+    return rc;
+}
+
+
+/*
+    Take the oldest queued procedure from a worker's run queue and make it the current procedure for the given worker
+ */
+static bool popWork(MprWorker *worker, MprWorker *from)
+{
+    bool    found;
+    int     index;
+
+    found = 0;
+    mprSpinLock(from->spin);
+    if (from->runCount > 0) {
+        index = from->runFirst;
+        worker->data = from->runData[index];
+        worker->proc = from->runProc[index];
+        from->runProc[index] = 0;
+        from->runData[index] = 0;
+        from->runFirst = (index + 1) % MPR_WORKER_QUEUE;
+        from->runCount--;
+        mprAtomicAdd(&from->workerService->queued, -1);
+        found = 1;
+    }
+    mprSpinUnlock(from->spin);
+    return found;
+}
+
+
+/*
+    Steal work from the busiest worker (which may be the given worker). Caller must hold the service lock.
+ */
+static bool stealWork(MprWorkerService *ws, MprWorker *worker)
+{
+    MprWorker   *wp, *victim;
+    int         next;
+
+    victim = 0;
+    for (next = 0; (wp = mprGetNextItem(ws->busyThreads, &next)) != 0; ) {
+        if (wp->runCount > 0 && (victim == 0 || wp->runCount > victim->runCount)) {
+            victim = wp;
+        }
+    }
+    return victim && popWork(worker, victim);
+}
+
+
+/*
+    Steal work for an idle worker and make it busy. Caller must hold the service lock.
+ */
+static bool stealIdleWork(MprWorkerService *ws, MprWorker *worker)
+{
+    if (ws->queued > 0 && worker->state == MPR_WORKER_IDLE && stealWork(ws, worker)) {
+        changeState(worker, MPR_WORKER_BUSY);
+        return 1;
     }
+    return 0;
 }
 
 
 static void workerMain(MprWorker *worker, MprThread *tp)
 {
     MprWorkerService    *ws;
+    MprCoroutine        *co;
+    int                 spin;
 
     ws = MPR->workerService;
     mprAssert(worker->state == MPR_WORKER_BUSY);
@@ -27736,14 +29801,36 @@ static void workerMain(MprWorker *worker, MprThread *tp)
 
     while (!(worker->state & MPR_WORKER_PRUNED) && !mprIsStopping()) {
         if (worker->proc) {
+            /*
+                Run the procedure and then drain this worker's run queue without taking the service lock
+             */
             mprUnlock(ws->mutex);
-            (*worker->proc)(worker->data, worker);
+            do {
+                (*worker->proc)(worker->data, worker);
+                worker->proc = 0;
+            } while (popWork(worker, worker));
             mprLock(ws->mutex);
-            worker->proc = 0;
+        }
+        if ((co = mprGetFirstItem(worker->resumeQ)) != 0) {
+            mprRemoveItemAtPos(worker->resumeQ, 0);
+            worker->proc = (MprWorkerProc) resumeCoroutine;
+            worker->data = co;
+            continue;
+        }
+        if (stealWork(ws, worker)) {
+            continue;
         }
         worker->lastActivity = MPR->eventService->now;
         changeState(worker, MPR_WORKER_IDLE);
 
+        /*
+            Work may have been pushed without the service lock before the idle state was visible
+         */
+        if (popWork(worker, worker)) {
+            changeState(worker, MPR_WORKER_BUSY);
+            continue;
+        }
+
         mprAssert(worker->cleanup == 0);
         if (worker->cleanup) {
             (*worker->cleanup)(worker->data, worker);
@@ -27753,12 +29840,33 @@ static void workerMain(MprWorker *worker, MprThread *tp)
         mprUnlock(ws->mutex);
 
         /*
-            Sleep till there is more work to do. Yield for GC first.
+            Sleep till there is more work to do. Yield for GC first. Spin briefly before sleeping as new work often 
+            arrives soon after and waking a sleeping thread is expensive. While spinning, steal work queued on busy 
+            workers. Only sleeping workers are signalled so the idle condition is not left triggered after spinning.
          */
         mprYield(MPR_YIELD_STICKY);
-        mprWaitForCond(worker->idleCond, -1);
+        mprAtomicAdd(&ws->spinning, 1);
+        for (spin = 0; spin < ws->spinCount && worker->state == MPR_WORKER_IDLE; spin++) {
+            if (ws->queued > 0) {
+                mprLock(ws->mutex);
+                stealIdleWork(ws, worker);
+                mprUnlock(ws->mutex);
+            }
+            mprNap(0);
+        }
+        mprAtomicAdd(&ws->spinning, -1);
+        mprLock(ws->mutex);
+        if (worker->state == MPR_WORKER_IDLE && !stealIdleWork(ws, worker)) {
+            worker->flags |= MPR_WORKER_SLEEPING;
+            mprUnlock(ws->mutex);
+            mprWaitForCond(worker->idleCond, -1);
+        } else {
+            mprResetCond(worker->idleCond);
+            mprUnlock(ws->mutex);
+        }
         mprResetYield();
         mprLock(ws->mutex);
+        worker->flags &= ~MPR_WORKER_SLEEPING;
     }
     changeState(worker, 0);
     worker->thread = 0;
@@ -27789,7 +29897,8 @@ static void changeState(MprWorker *worker, int state)
 
     case MPR_WORKER_IDLE:
         lp = ws->idleThreads;
-        wake = 1;
+        wake = (worker->flags & MPR_WORKER_SLEEPING) ? 1 : 0;
+        worker->flags &= ~MPR_WORKER_SLEEPING;
         break;
         
     case MPR_WORKER_PRUNED:
@@ -27827,10 +29936,13 @@ static void changeState(MprWorker *worker, int state)
             return;
         }
     }
-    mprUnlock(ws->mutex);
+    /*
+        Signal under the service lock so a late signal cannot trigger idleCond after the worker next goes idle
+     */
     if (wake) {
         mprSignalCond(worker->idleCond); 
     }
+    mprUnlock(ws->mutex);
 }
 
 
@@ -29550,9 +31662,10 @@ int gettimeofday(struct timeval *tv, struct timezone *tz)
 #if MPR_HIGH_RES_TIMER
     #if BIT_UNIX_LIKE
         uint64 mprGetTicks() {
-            uint64  now;
-            __asm__ __volatile__ ("rdtsc" : "=A" (now));
-            return now;
+            uint    lo, hi;
+            /* The "=A" constraint only returns the low word on x64 */
+            __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+            return ((uint64) hi << 32) | lo;
         }
     #elif BIT_WIN_LIKE
         uint64 mprGetTicks() {
@@ -30206,11 +32319,30 @@ void mprRemoveWaitHandler(MprWaitHandler *wp)
 void mprQueueIOEvent(MprWaitHandler *wp)
 {
     MprDispatcher   *dispatcher;
+    MprEventService *es;
     MprEvent        *event;
 
     lock(wp->service);
+    if ((event = wp->event) != 0 && event->dispatcher) {
+        es = event->dispatcher->service;
+        lock(es);
+        if (event->next) {
+            /* 
+                The prior event has not run. Add to its mask rather than queue a second event which would not be 
+                removed if the handler is removed before the events run.
+             */
+            event->mask |= wp->presentMask;
+            unlock(es);
+            unlock(wp->service);
+            return;
+        }
+        unlock(es);
+    }
     if (wp->flags & MPR_WAIT_NEW_DISPATCHER) {
         dispatcher = mprCreateDispatcher("IO", 1);
+        if (wp->flags & MPR_WAIT_INLINE) {
+            dispatcher->flags |= MPR_DISPATCHER_INLINE;
+        }
     } else {
         dispatcher = (wp->dispatcher) ? wp->dispatcher: mprGetDispatcher();
     }
@@ -30237,7 +32369,10 @@ void mprWaitOn(MprWaitHandler *wp, int mask)
             wp->service->needRecall = 1;
         }
         mprNotifyOn(wp->service, wp, mask);
-        mprWakeNotifier();
+        if (MPR->eventService->waiting) {
+            /* Not required if the event thread is awake, such as when servicing a dispatcher inline */
+            mprWakeNotifier();
+        }
     }
     unlock(wp->service);
 }
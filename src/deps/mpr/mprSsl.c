@@ -784,6 +784,7 @@ int mprCreateMatrixSslModule() { return -1; }
 #include    <openssl/rand.h>
 #include    <openssl/err.h>
 #include    <openssl/dh.h>
+#include    <openssl/hmac.h>
 
 /************************************* Defines ********************************/
 
@@ -792,12 +793,26 @@ int mprCreateMatrixSslModule() { return -1; }
 #define MPR_DEFAULT_CLIENT_CERT_FILE    "client.crt"
 #define MPR_DEFAULT_CLIENT_CERT_PATH    "certs"
 
+/*
+    Session ticket encryption key
+ */
+typedef struct TicketKey {
+    uchar           name[16];
+    uchar           aesKey[16];
+    uchar           hmacKey[16];
+} TicketKey;
+
 typedef struct MprOpenSsl {
     SSL_CTX         *context;
     RSA             *rsaKey512;
     RSA             *rsaKey1024;
     DH              *dhKey512;
     DH              *dhKey1024;
+    uchar           *alpn;              /* ALPN protocols in wire format */
+    int             alpnLen;
+    TicketKey       ticketKeys[2];      /* Current and prior session ticket keys */
+    MprEvent        *ticketTimer;       /* Ticket key rotation timer */
+    MprMutex        *mutex;             /* Ticket key lock */
 #if UNUSED
     MprMutex        **locks;
 #endif
@@ -819,6 +834,12 @@ static MprMutex **olocks;
 static MprSocketProvider *openSslProvider;
 static MprOpenSsl *defaultOpenSsl;
 
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    typedef const uchar SessionId;
+#else
+    typedef uchar SessionId;
+#endif
+
 struct CRYPTO_dynlock_value {
     MprMutex    *mutex;
 };
@@ -826,18 +847,36 @@ typedef struct CRYPTO_dynlock_value DynLock;
 
 /***************************** Forward Declarations ***************************/
 
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+static int      alpnCallback(SSL *ssl, cuchar **out, uchar *outlen, cuchar *in, uint inlen, void *arg);
+#endif
+static void     checkKernelTls(MprSocket *sp);
 static void     closeOss(MprSocket *sp, bool gracefully);
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+static void     configureAlpn(MprOpenSsl *ossl, cchar *protocols);
+#endif
 static int      configureCertificateFiles(MprSsl *ssl, SSL_CTX *ctx, char *key, char *cert);
+static void     configureSessions(MprSsl *ssl, MprOpenSsl *ossl, int server);
 static MprOpenSsl *createOpenSslConfig(MprSsl *ssl, int server);
 static MprSocketProvider *createOpenSslProvider();
+static SSL_SESSION *decodeSession(cchar *value);
 static DH       *dhCallback(SSL *ssl, int isExport, int keyLength);
 static void     disconnectOss(MprSocket *sp);
+static char     *encodeSession(SSL_SESSION *session);
 static ssize    flushOss(MprSocket *sp);
+static SSL_SESSION *getSession(SSL *handle, SessionId *id, int len, int *copy);
+static int      handshakeOss(MprSocket *sp);
 static int      listenOss(MprSocket *sp, cchar *host, int port, int flags);
 static void     manageOpenSsl(MprOpenSsl *ossl, int flags);
 static void     manageOpenSocket(MprOpenSocket *ssp, int flags);
+static int      newSession(SSL *handle, SSL_SESSION *session);
 static ssize    readOss(MprSocket *sp, void *buf, ssize len);
+static void     removeSession(SSL_CTX *context, SSL_SESSION *session);
+static void     resumeSession(MprSocket *sp);
+static void     rotateTicketKeys(MprOpenSsl *ossl, MprEvent *event);
 static RSA      *rsaCallback(SSL *ssl, int isExport, int keyLength);
+static char     *sessionKey(MprSocket *sp, SSL_SESSION *session);
+static int      ticketKeyCallback(SSL *handle, uchar *name, uchar *iv, EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int encrypt);
 static int      upgradeOss(MprSocket *sp, MprSsl *ssl, int server);
 static int      verifyX509Certificate(int ok, X509_STORE_CTX *ctx);
 static ssize    writeOss(MprSocket *sp, cvoid *buf, ssize len);
@@ -923,8 +962,14 @@ int mprCreateOpenSslModule()
 static void manageOpenSsl(MprOpenSsl *ossl, int flags)
 {
     if (flags & MPR_MANAGE_MARK) {
-        ;
+        mprMark(ossl->alpn);
+        mprMark(ossl->ticketTimer);
+        mprMark(ossl->mutex);
     } else if (flags & MPR_MANAGE_FREE) {
+        if (ossl->ticketTimer) {
+            mprRemoveEvent(ossl->ticketTimer);
+            ossl->ticketTimer = 0;
+        }
         if (ossl->context != 0) {
             SSL_CTX_free(ossl->context);
             ossl->context = 0;
@@ -987,6 +1032,7 @@ static MprSocketProvider *createOpenSslProvider()
     provider->closeSocket = closeOss;
     provider->disconnectSocket = disconnectOss;
     provider->flushSocket = flushOss;
+    provider->handshakeSocket = handshakeOss;
     provider->listenSocket = listenOss;
     provider->readSocket = readOss;
     provider->writeSocket = writeOss;
@@ -1024,7 +1070,6 @@ static MprOpenSsl *createOpenSslConfig(MprSsl *ssl, int server)
         return 0;
     }
     SSL_CTX_set_app_data(context, (void*) ssl);
-    SSL_CTX_sess_set_cache_size(context, 512);
     RAND_bytes(resume, sizeof(resume));
     SSL_CTX_set_session_id_context(context, resume, sizeof(resume));
 
@@ -1081,9 +1126,6 @@ static MprOpenSsl *createOpenSslConfig(MprSsl *ssl, int server)
     SSL_CTX_set_tmp_dh_callback(context, dhCallback);
 
     SSL_CTX_set_options(context, SSL_OP_ALL);
-#ifdef SSL_OP_NO_TICKET
-    SSL_CTX_set_options(context, SSL_OP_NO_TICKET);
-#endif
 #ifdef SSL_OP_NO_SESSION_RESUMPTION_ON_RENEGOTIATION
     SSL_CTX_set_options(context, SSL_OP_NO_SESSION_RESUMPTION_ON_RENEGOTIATION);
 #endif
@@ -1104,11 +1146,299 @@ static MprOpenSsl *createOpenSslConfig(MprSsl *ssl, int server)
         Ensure we generate a new private key for each connection
      */
     SSL_CTX_set_options(context, SSL_OP_SINGLE_DH_USE);
+
+#ifdef SSL_OP_ENABLE_KTLS
+    if (ssl->kernelTls) {
+        /* 
+            After the handshake, OpenSSL installs the record keys in the socket via setsockopt(SOL_TLS) if the kernel
+            supports the negotiated cipher 
+         */
+        SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+    if (ssl->alpn) {
+        configureAlpn(ossl, ssl->alpn);
+        if (server) {
+            SSL_CTX_set_alpn_select_cb(context, alpnCallback, ossl);
+        } else {
+            SSL_CTX_set_alpn_protos(context, ossl->alpn, ossl->alpnLen);
+        }
+    }
+#endif
     ossl->context = context;
+    configureSessions(ssl, ossl, server);
     return ossl;
 }
 
 
+/*
+    Configure session resumption. Sessions are stored in an MprCache in DER format which manages the session lifespan
+    and prunes the least recently used sessions. Servers key sessions by session ID and clients by server address.
+    Servers also issue session tickets encrypted with keys that are rotated by a timer.
+ */
+static void configureSessions(MprSsl *ssl, MprOpenSsl *ossl, int server)
+{
+    SSL_CTX     *context;
+
+    context = ossl->context;
+    SSL_CTX_set_timeout(context, (long) (ssl->sessionLifespan / MPR_TICKS_PER_SEC));
+    if (server) {
+        if (ssl->cacheSize > 0) {
+            if (!ssl->sessionCache) {
+                ssl->sessionCache = mprCreateCache(0);
+                mprSetCacheLimits(ssl->sessionCache, ssl->cacheSize, ssl->sessionLifespan, 0, 0);
+            }
+            SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+            SSL_CTX_sess_set_new_cb(context, newSession);
+            SSL_CTX_sess_set_get_cb(context, getSession);
+            SSL_CTX_sess_set_remove_cb(context, removeSession);
+        } else {
+            SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+        }
+        if (ssl->ticketRotation > 0) {
+            ossl->mutex = mprCreateLock();
+            rotateTicketKeys(ossl, NULL);
+            rotateTicketKeys(ossl, NULL);
+            SSL_CTX_set_tlsext_ticket_key_cb(context, ticketKeyCallback);
+            /* The timer must not retain the configuration. It is removed when the configuration is freed. */
+            ossl->ticketTimer = mprCreateTimerEvent(MPR->dispatcher, "sslTicketKeys", ssl->ticketRotation, 
+                rotateTicketKeys, ossl, MPR_EVENT_STATIC_DATA);
+        }
+    } else if (ssl->sessionCache) {
+        SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(context, newSession);
+    }
+#ifdef SSL_OP_NO_TICKET
+    if (ssl->ticketRotation <= 0) {
+        SSL_CTX_set_options(context, SSL_OP_NO_TICKET);
+    }
+#endif
+}
+
+
+/*
+    Save a new session in the session cache
+ */
+static int newSession(SSL *handle, SSL_SESSION *session)
+{
+    MprOpenSocket   *osp;
+    MprSsl          *ssl;
+    char            *key, *value;
+
+    osp = (MprOpenSocket*) SSL_get_app_data(handle);
+    ssl = osp->sock->ssl;
+    if (ssl->sessionCache && (key = sessionKey(osp->sock, session)) != 0 && (value = encodeSession(session)) != 0) {
+        mprWriteCache(ssl->sessionCache, key, value, 0, ssl->sessionLifespan, 0, MPR_CACHE_SET);
+    }
+    /* The session is not retained */
+    return 0;
+}
+
+
+/*
+    Lookup the session requested by a client
+ */
+static SSL_SESSION *getSession(SSL *handle, SessionId *id, int len, int *copy)
+{
+    MprOpenSocket   *osp;
+    MprSsl          *ssl;
+    SSL_SESSION     *session;
+    char            *value;
+
+    osp = (MprOpenSocket*) SSL_get_app_data(handle);
+    ssl = osp->sock->ssl;
+    *copy = 0;
+    session = 0;
+    if ((value = mprReadCache(ssl->sessionCache, sjoin("ssl:", mprEncode64Block((cchar*) id, len), NULL), 0, 0)) != 0) {
+        session = decodeSession(value);
+    }
+    mprAtomicAdd64(session ? &ssl->stats.cacheHits : &ssl->stats.cacheMisses, 1);
+    return session;
+}
+
+
+static void removeSession(SSL_CTX *context, SSL_SESSION *session)
+{
+    MprSsl      *ssl;
+    char        *key;
+
+    ssl = (MprSsl*) SSL_CTX_get_app_data(context);
+    if (ssl->sessionCache && (key = sessionKey(NULL, session)) != 0) {
+        mprRemoveCache(ssl->sessionCache, key);
+    }
+}
+
+
+/*
+    Set the session to resume for a client connection
+ */
+static void resumeSession(MprSocket *sp)
+{
+    MprOpenSocket   *osp;
+    SSL_SESSION     *session;
+    char            *value;
+
+    osp = sp->sslSocket;
+    if (sp->ssl->sessionCache && (value = mprReadCache(sp->ssl->sessionCache, sessionKey(sp, NULL), 0, 0)) != 0) {
+        if ((session = decodeSession(value)) != 0) {
+            SSL_set_session(osp->handle, session);
+            SSL_SESSION_free(session);
+        }
+    }
+}
+
+
+/*
+    Get the cache key for a session. Client sessions are keyed by the server address.
+ */
+static char *sessionKey(MprSocket *sp, SSL_SESSION *session)
+{
+    cuchar      *id;
+    uint        len;
+
+    if (sp && (sp->flags & MPR_SOCKET_CLIENT)) {
+        return sfmt("ssl:%s:%d", sp->ip, sp->port);
+    }
+    if (session == 0 || (id = SSL_SESSION_get_id(session, &len)) == 0 || len == 0) {
+        return 0;
+    }
+    return sjoin("ssl:", mprEncode64Block((cchar*) id, len), NULL);
+}
+
+
+static char *encodeSession(SSL_SESSION *session)
+{
+    uchar   *data, *dp;
+    int     len;
+
+    if ((len = i2d_SSL_SESSION(session, NULL)) <= 0) {
+        return 0;
+    }
+    if ((data = mprAlloc(len)) == 0) {
+        return 0;
+    }
+    dp = data;
+    i2d_SSL_SESSION(session, &dp);
+    return mprEncode64Block((cchar*) data, len);
+}
+
+
+static SSL_SESSION *decodeSession(cchar *value)
+{
+    cuchar  *dp;
+    char    *data;
+    ssize   len;
+
+    if ((data = mprDecode64Block(value, &len, MPR_DECODE_TOKEQ)) == 0) {
+        return 0;
+    }
+    dp = (cuchar*) data;
+    return d2i_SSL_SESSION(NULL, &dp, (long) len);
+}
+
+
+/*
+    Replace the session ticket key. Tickets encrypted with the prior key remain valid until the next rotation.
+ */
+static void rotateTicketKeys(MprOpenSsl *ossl, MprEvent *event)
+{
+    TicketKey   key;
+
+    if (RAND_bytes(key.name, sizeof(key.name)) <= 0 || RAND_bytes(key.aesKey, sizeof(key.aesKey)) <= 0 ||
+            RAND_bytes(key.hmacKey, sizeof(key.hmacKey)) <= 0) {
+        mprError("OpenSSL: Can't create session ticket key");
+        return;
+    }
+    lock(ossl);
+    ossl->ticketKeys[1] = ossl->ticketKeys[0];
+    ossl->ticketKeys[0] = key;
+    unlock(ossl);
+    memset(&key, 0, sizeof(key));
+}
+
+
+/*
+    Initialize the cipher and HMAC contexts to encrypt or decrypt a session ticket. Return 1 to use the ticket,
+    2 to use and renew the ticket and 0 if the ticket key is unknown.
+ */
+static int ticketKeyCallback(SSL *handle, uchar *name, uchar *iv, EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int encrypt)
+{
+    MprSsl      *ssl;
+    MprOpenSsl  *ossl;
+    TicketKey   *key;
+    int         i, rc;
+
+    ssl = (MprSsl*) SSL_CTX_get_app_data(SSL_get_SSL_CTX(handle));
+    ossl = ssl->pconfig;
+    rc = 0;
+    lock(ossl);
+    if (encrypt) {
+        key = &ossl->ticketKeys[0];
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_128_cbc())) > 0) {
+            memcpy(name, key->name, sizeof(key->name));
+            EVP_EncryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key->aesKey, iv);
+            HMAC_Init_ex(hctx, key->hmacKey, sizeof(key->hmacKey), EVP_sha256(), NULL);
+            rc = 1;
+        } else {
+            rc = -1;
+        }
+    } else {
+        for (i = 0; i < 2; i++) {
+            key = &ossl->ticketKeys[i];
+            if (memcmp(name, key->name, sizeof(key->name)) == 0) {
+                HMAC_Init_ex(hctx, key->hmacKey, sizeof(key->hmacKey), EVP_sha256(), NULL);
+                EVP_DecryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key->aesKey, iv);
+                rc = (i == 0) ? 1 : 2;
+                break;
+            }
+        }
+        mprAtomicAdd64(rc ? &ssl->stats.ticketHits : &ssl->stats.ticketMisses, 1);
+    }
+    unlock(ossl);
+    return rc;
+}
+
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+/*
+    Convert a comma separated protocol list into the ALPN wire format of length prefixed names
+ */
+static void configureAlpn(MprOpenSsl *ossl, cchar *protocols)
+{
+    char    *proto, *tok;
+    ssize   len;
+    int     pos;
+
+    ossl->alpn = mprAlloc(slen(protocols) + 2);
+    pos = 0;
+    for (proto = stok(sclone(protocols), ", \t", &tok); proto; proto = stok(NULL, ", \t", &tok)) {
+        if ((len = slen(proto)) > 0 && len < 256) {
+            ossl->alpn[pos++] = (uchar) len;
+            memcpy(&ossl->alpn[pos], proto, len);
+            pos += (int) len;
+        }
+    }
+    ossl->alpnLen = pos;
+}
+
+
+/*
+    Select the first configured protocol that is also offered by the client. If none match, continue without ALPN.
+ */
+static int alpnCallback(SSL *ssl, cuchar **out, uchar *outlen, cuchar *in, uint inlen, void *arg)
+{
+    MprOpenSsl  *ossl;
+
+    ossl = arg;
+    if (SSL_select_next_proto((uchar**) out, outlen, ossl->alpn, ossl->alpnLen, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+#endif
+
+
 /*
     Configure the SSL certificate information using key and cert files
  */
@@ -1230,6 +1560,7 @@ static int upgradeOss(MprSocket *sp, MprSsl *ssl, int server)
     if (server) {
         SSL_set_accept_state(osp->handle);
     } else {
+        resumeSession(sp);
         /* Block while connecting */
         mprSetSocketBlockingMode(sp, 1);
         if ((rc = SSL_connect(osp->handle)) < 1) {
@@ -1241,12 +1572,68 @@ static int upgradeOss(MprSocket *sp, MprSsl *ssl, int server)
             return MPR_ERR_CANT_CONNECT;
         }
         mprSetSocketBlockingMode(sp, 0);
+        mprAtomicAdd64(SSL_session_reused(osp->handle) ? &ssl->stats.resumed : &ssl->stats.handshakes, 1);
+        checkKernelTls(sp);
     }
     unlock(sp);
     return 0;
 }
 
 
+/*
+    Advance the handshake on a non-blocking socket. Return zero when complete, otherwise the I/O mask to wait for
+    or a negative MPR error code.
+ */
+static int handshakeOss(MprSocket *sp)
+{
+    MprOpenSocket   *osp;
+    char            ebuf[MPR_MAX_STRING];
+    int             rc, error;
+
+    lock(sp);
+    osp = (MprOpenSocket*) sp->sslSocket;
+    if (osp == 0 || osp->handle == 0) {
+        unlock(sp);
+        return MPR_ERR_BAD_STATE;
+    }
+    if ((rc = SSL_do_handshake(osp->handle)) > 0) {
+        unlock(sp);
+        return 0;
+    }
+    error = SSL_get_error(osp->handle, rc);
+    if (error == SSL_ERROR_WANT_READ) {
+        rc = MPR_READABLE;
+    } else if (error == SSL_ERROR_WANT_WRITE) {
+        rc = MPR_WRITABLE;
+    } else {
+        ERR_error_string_n(ERR_get_error(), ebuf, sizeof(ebuf) - 1);
+        sp->errorMsg = sclone(ebuf);
+        mprLog(4, "OpenSSL: handshake failed: %s", ebuf);
+        rc = MPR_ERR_CANT_CONNECT;
+    }
+    unlock(sp);
+    return rc;
+}
+
+
+/*
+    Test if the kernel is encrypting the TLS records. Called once the handshake is complete.
+ */
+static void checkKernelTls(MprSocket *sp)
+{
+#ifdef BIO_get_ktls_send
+    MprOpenSocket   *osp;
+
+    osp = sp->sslSocket;
+    if (BIO_get_ktls_send(SSL_get_wbio(osp->handle))) {
+        sp->flags |= MPR_SOCKET_KTLS;
+        mprLog(4, "OpenSSL: kernel TLS enabled for transmit%s", 
+            BIO_get_ktls_recv(SSL_get_rbio(osp->handle)) ? " and receive" : "");
+    }
+#endif
+}
+
+
 static void disconnectOss(MprSocket *sp)
 {
     sp->service->standardProvider->disconnectSocket(sp);
@@ -1313,6 +1700,10 @@ static ssize readOss(MprSocket *sp, void *buf, ssize len)
             mprLog(4, "OpenSSL Peer: %s", peer);
             X509_free(cert);
         }
+        if (!(sp->flags & MPR_SOCKET_CLIENT)) {
+            mprAtomicAdd64(SSL_session_reused(osp->handle) ? &ssl->stats.resumed : &ssl->stats.handshakes, 1);
+        }
+        checkKernelTls(sp);
         sp->flags |= MPR_SOCKET_TRACED;
     }
     if (rc <= 0) {
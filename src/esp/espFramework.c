@@ -937,6 +937,8 @@ void espShowRequest(HttpConn *conn)
      */
     q = conn->readq;
     if (q->first && rx->bytesRead > 0 && scmp(rx->mimeType, "application/x-www-form-urlencoded") == 0) {
+        /* Body data may span several packets */
+        httpJoinPackets(q, -1);
         buf = q->first->content;
         mprAddNullToBuf(buf);
         if ((numKeys = getParams(&keys, mprGetBufStart(buf), (int) mprGetBufLength(buf))) > 0) {
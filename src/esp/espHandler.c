@@ -26,11 +26,13 @@ static int espEnvDirective(MaState *state, cchar *key, cchar *value);
 static char *getControllerEntry(cchar *controllerName);
 static EspRoute *getEroute(HttpRoute *route);
 static int loadApp(HttpConn *conn, int *updated);
+static void lockCompile();
 static void manageEsp(Esp *esp, int flags);
 static void manageReq(EspReq *req, int flags);
 static int  runAction(HttpConn *conn);
 static void setRouteDirs(MaState *state, cchar *kind);
 static int unloadEsp(MprModule *mp);
+static void unlockCompile();
 static bool viewExists(HttpConn *conn);
 
 /************************************* Code ***********************************/
@@ -228,31 +230,31 @@ static int runAction(HttpConn *conn)
             httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Can't find controller %s", req->controllerPath);
             return 0;
         }
-        lock(req->esp);
+        lockCompile();
         if (espModuleIsStale(req->controllerPath, req->module, &recompile)) {
             /*  WARNING: GC yield here */
             if (recompile && !espCompile(conn, req->controllerPath, req->module, req->cacheName, 0)) {
-                unlock(req->esp);
+                unlockCompile();
                 return 0;
             }
         }
         if (mprLookupModule(req->controllerPath) == 0) {
             req->entry = getControllerEntry(req->controllerName);
             if ((mp = mprCreateModule(req->controllerPath, req->module, req->entry, route)) == 0) {
-                unlock(req->esp);
+                unlockCompile();
                 httpMemoryError(conn);
                 return 0;
             }
             mprSetThreadData(esp->local, conn);
             if (mprLoadModule(mp) < 0) {
-                unlock(req->esp);
+                unlockCompile();
                 httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, 
                     "Can't load compiled esp module for %s", req->controllerPath);
                 return 0;
             }
             updated = 1;
         }
-        unlock(req->esp);
+        unlockCompile();
     }
     key = mprJoinPath(eroute->controllersDir, rx->target);
     if ((action = mprLookupKey(esp->actions, key)) == 0) {
@@ -331,11 +333,11 @@ void espRenderView(HttpConn *conn, cchar *name)
             httpError(conn, HTTP_CODE_NOT_FOUND, "Can't find web page %s", req->source);
             return;
         }
-        lock(req->esp);
+        lockCompile();
         if (espModuleIsStale(req->source, req->module, &recompile)) {
             /* WARNING: this will allow GC */
             if (recompile && !espCompile(conn, req->source, req->module, req->cacheName, 1)) {
-                unlock(req->esp);
+                unlockCompile();
                 return;
             }
         }
@@ -343,19 +345,19 @@ void espRenderView(HttpConn *conn, cchar *name)
             req->entry = sfmt("esp_%s", req->cacheName);
             //  MOB - who keeps reference to module?
             if ((mp = mprCreateModule(req->source, req->module, req->entry, req->route)) == 0) {
-                unlock(req->esp);
+                unlockCompile();
                 httpMemoryError(conn);
                 return;
             }
             //  MOB - this should return an error msg
             mprSetThreadData(esp->local, conn);
             if (mprLoadModule(mp) < 0) {
-                unlock(req->esp);
+                unlockCompile();
                 httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Can't load compiled esp module for %s", req->source);
                 return;
             }
         }
-        unlock(req->esp);
+        unlockCompile();
     }
     if ((view = mprLookupKey(esp->views, mprGetPortablePath(req->source))) == 0) {
         httpError(conn, HTTP_CODE_NOT_FOUND, "Can't find defined view for %s", req->view);
@@ -370,6 +372,23 @@ void espRenderView(HttpConn *conn, cchar *name)
 
 
 /************************************ Support *********************************/
+/*
+    Serialize compiling and loading modules. Compiling waits for the compiler command. On a coroutine, that wait must
+    block the thread rather than suspend, otherwise another coroutine on the same thread could enter the lock.
+ */
+static void lockCompile()
+{
+    mprHoldCoroutine();
+    lock(esp);
+}
+
+
+static void unlockCompile()
+{
+    unlock(esp);
+    mprReleaseCoroutine();
+}
+
 
 static char *getControllerEntry(cchar *controllerName)
 {
@@ -2,7 +2,8 @@
     fileHandler.c -- Static file content handler
 
     This handler manages static file based content such as HTML, GIF /or JPEG pages. It supports all methods including:
-    GET, PUT, DELETE, OPTIONS and TRACE. It is event based and does not use worker threads.
+    GET, PUT, DELETE, OPTIONS and TRACE. It is event based and does not use worker threads, except to read
+    file data that is not cached.
 
     The fileHandler also manages requests for directories that require redirection to an index or responding with
     a directory listing. 
@@ -14,12 +15,44 @@
 
 #include    "appweb.h"
 
+/*********************************** Locals ***********************************/
+/*
+    Asynchronous file read request. Reads that would block on the disk are run by a reader thread so they do not stall
+    the event thread or the connection dispatcher.
+ */
+typedef struct FileRead {
+    HttpConn        *conn;              /* Requesting connection */
+    HttpTx          *tx;                /* Request transmitter. Used to detect if the request has completed */
+    HttpQueue       *q;                 /* Queue to resume when the read completes */
+    HttpPacket      *packet;            /* Packet to fill */
+    MprBuf          *buf;               /* Buffer for the file data */
+    MprOff          pos;                /* File position to read */
+    ssize           size;               /* Size to read */
+    ssize           nbytes;             /* Bytes read */
+    int             fd;                 /* Duplicate file descriptor. Closed by the reader thread. */
+} FileRead;
+
+/*
+    Reader threads for uncached file data. These are separate from the MPR worker pool, so slow disks can't exhaust the
+    workers used by other requests. Requests wait in the queue when all reader threads are busy.
+ */
+static MprList      *readQueue;         /* Read requests waiting for a reader thread */
+static MprCond      *readCond;          /* Signalled when a read request is queued */
+static int          readers;            /* Reader threads started */
+static int          idleReaders;        /* Reader threads waiting for a request */
+
 /***************************** Forward Declarations ***************************/
 
 static int findFile(HttpConn *conn);
 static void handleDeleteRequest(HttpQueue *q);
 static void handlePutRequest(HttpQueue *q);
+static void manageFileRead(FileRead *fr, int flags);
+static int queueFileRead(FileRead *fr);
+static void readFile(FileRead *fr);
 static ssize readFileData(HttpQueue *q, HttpPacket *packet, MprOff pos, ssize size);
+static void readFileDone(FileRead *fr, MprEvent *event);
+static void readerMain(void *data, MprThread *tp);
+static ssize startFileRead(HttpQueue *q, HttpPacket *packet, MprOff pos, ssize size);
 
 /*********************************** Code *************************************/
 /*
@@ -183,6 +216,11 @@ static void openFileHandler(HttpQueue *q)
                     } else {
                         httpError(conn, HTTP_CODE_NOT_FOUND, "Can't open document: %s from %s", tx->filename);
                     }
+#if LINUX
+                } else if (!tx->outputRanges && tx->file->fd >= 0) {
+                    /* Read ahead aggressively when streaming the entire file */
+                    posix_fadvise(tx->file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
                 }
             }
         }
@@ -244,7 +282,7 @@ static void readyFileHandler(HttpQueue *q)
 
 /*  
     Populate a packet with file data. Return the number of bytes read or a negative error code. Will not return with
-    a short read.
+    a short read. Returns MPR_ERR_NOT_READY if the data is not cached and is being read by a reader thread. 
  */
 static ssize readFileData(HttpQueue *q, HttpPacket *packet, MprOff pos, ssize size)
 {
@@ -255,6 +293,18 @@ static ssize readFileData(HttpQueue *q, HttpPacket *packet, MprOff pos, ssize si
     conn = q->conn;
     tx = conn->tx;
 
+    if (packet->flags & HTTP_PACKET_FILLING) {
+        return MPR_ERR_NOT_READY;
+    }
+    if (packet->content && packet->esize == 0 && mprGetBufLength(packet->content) == size) {
+        /* Already filled by an asynchronous read */
+        return size;
+    }
+    if (pos >= 0 && tx->file->fd >= 0 && packet->content == 0) {
+        if ((nbytes = startFileRead(q, packet, pos, size)) != MPR_ERR_CANT_COMPLETE) {
+            return nbytes;
+        }
+    }
     if (packet->content == 0 && (packet->content = mprCreateBuf(size, -1)) == 0) {
         return MPR_ERR_MEMORY;
     }
@@ -279,6 +329,194 @@ static ssize readFileData(HttpQueue *q, HttpPacket *packet, MprOff pos, ssize si
 }
 
 
+/*
+    Read cached file data without blocking. If the data is not cached, queue an asynchronous read for a reader thread.
+    Returns the number of bytes read, MPR_ERR_NOT_READY if the read has been queued, or MPR_ERR_CANT_COMPLETE if 
+    nonblocking reads are not supported and the data must be read synchronously.
+ */
+static ssize startFileRead(HttpQueue *q, HttpPacket *packet, MprOff pos, ssize size)
+{
+#if LINUX && defined(RWF_NOWAIT)
+    HttpConn    *conn;
+    HttpTx      *tx;
+    FileRead    *fr;
+    MprBuf      *buf;
+    struct iovec iov;
+    ssize       nbytes;
+
+    conn = q->conn;
+    tx = conn->tx;
+    if ((buf = mprCreateBuf(size, -1)) == 0) {
+        return MPR_ERR_MEMORY;
+    }
+    iov.iov_base = mprGetBufStart(buf);
+    iov.iov_len = size;
+    if ((nbytes = preadv2(tx->file->fd, &iov, 1, pos, RWF_NOWAIT)) == size) {
+        mprAdjustBufEnd(buf, nbytes);
+        packet->content = buf;
+        packet->esize -= nbytes;
+        return nbytes;
+    }
+    /* Partially cached, not cached or the file system does not support nonblocking reads */
+    if ((fr = mprAllocObj(FileRead, manageFileRead)) == 0) {
+        return MPR_ERR_MEMORY;
+    }
+    fr->conn = conn;
+    fr->tx = tx;
+    fr->q = q;
+    fr->packet = packet;
+    fr->buf = buf;
+    fr->pos = pos;
+    fr->size = size;
+    if ((fr->fd = dup(tx->file->fd)) < 0) {
+        httpError(conn, HTTP_CODE_SERVICE_UNAVAILABLE, "Can't read file %s", tx->filename);
+        return MPR_ERR_CANT_READ;
+    }
+    mprAddRoot(fr);
+    if (queueFileRead(fr) < 0) {
+        mprRemoveRoot(fr);
+        close(fr->fd);
+        httpError(conn, HTTP_CODE_SERVICE_UNAVAILABLE, "Can't start a thread to read file %s", tx->filename);
+        return MPR_ERR_CANT_READ;
+    }
+    mprLog(6, "Asynchronous read of %s, size %d, pos %Ld", tx->filename, size, pos);
+    packet->flags |= HTTP_PACKET_FILLING;
+    httpSuspendQueue(q);
+    return MPR_ERR_NOT_READY;
+#else
+    return MPR_ERR_CANT_COMPLETE;
+#endif
+}
+
+
+static void manageFileRead(FileRead *fr, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(fr->conn);
+        mprMark(fr->tx);
+        mprMark(fr->q);
+        mprMark(fr->packet);
+        mprMark(fr->buf);
+    }
+}
+
+
+/*
+    Queue a read request and start a reader thread if none is idle and the limit permits.
+ */
+static int queueFileRead(FileRead *fr)
+{
+    MprThread   *tp;
+
+    lock(readQueue);
+    if (idleReaders == 0 && readers < MA_MAX_FILE_READS) {
+        if ((tp = mprCreateThread("fileRead", readerMain, NULL, 0)) != 0 && mprStartThread(tp) == 0) {
+            readers++;
+        } else if (readers == 0) {
+            unlock(readQueue);
+            return MPR_ERR_CANT_CREATE;
+        }
+    }
+    mprAddItem(readQueue, fr);
+    unlock(readQueue);
+    mprSignalCond(readCond);
+    return 0;
+}
+
+
+/*
+    Reader thread main. Requests are read in order until the queue is empty.
+ */
+static void readerMain(void *data, MprThread *tp)
+{
+    FileRead    *fr;
+
+    while (!mprIsStopping()) {
+        lock(readQueue);
+        if ((fr = mprGetFirstItem(readQueue)) != 0) {
+            mprRemoveItemAtPos(readQueue, 0);
+        } else {
+            idleReaders++;
+        }
+        unlock(readQueue);
+        if (fr) {
+            readFile(fr);
+        } else {
+            mprYield(MPR_YIELD_STICKY);
+            mprWaitForCond(readCond, MPR_TICKS_PER_SEC * 60);
+            mprResetYield();
+            lock(readQueue);
+            idleReaders--;
+            unlock(readQueue);
+        }
+    }
+    lock(readQueue);
+    readers--;
+    unlock(readQueue);
+}
+
+
+/*
+    Read the file data on a reader thread. The read may block, so yield to permit garbage collection.
+ */
+static void readFile(FileRead *fr)
+{
+    ssize   nbytes;
+
+    mprYield(MPR_YIELD_STICKY);
+    fr->nbytes = 0;
+    while (fr->nbytes < fr->size) {
+        if ((nbytes = pread(fr->fd, mprGetBufEnd(fr->buf) + fr->nbytes, fr->size - fr->nbytes, 
+                fr->pos + fr->nbytes)) <= 0) {
+            if (nbytes < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        fr->nbytes += nbytes;
+    }
+    close(fr->fd);
+    mprResetYield();
+    if (fr->conn->dispatcher) {
+        /* The event retains the read request */
+        mprCreateEvent(fr->conn->dispatcher, "fileRead", 0, readFileDone, fr, 0);
+    }
+    mprRemoveRoot(fr);
+}
+
+
+/*
+    Complete an asynchronous read on the connection dispatcher and resume the pipeline
+ */
+static void readFileDone(FileRead *fr, MprEvent *event)
+{
+    HttpConn    *conn;
+    HttpPacket  *packet;
+
+    conn = fr->conn;
+    packet = fr->packet;
+    packet->flags &= ~HTTP_PACKET_FILLING;
+    if (conn->tx != fr->tx || conn->state >= HTTP_STATE_COMPLETE || !conn->http) {
+        /* Request has completed or been aborted */
+        return;
+    }
+    if (fr->nbytes != fr->size) {
+        httpError(conn, HTTP_CODE_SERVICE_UNAVAILABLE, "Can't read file %s", fr->tx->filename);
+    } else {
+        mprAdjustBufEnd(fr->buf, fr->nbytes);
+        packet->content = fr->buf;
+        packet->esize -= fr->nbytes;
+    }
+    httpResumeQueue(fr->q);
+    if (conn->stream) {
+        httpScheduleStream(conn);
+    } else if (conn->sock) {
+        httpPump(conn, conn->input);
+        httpCallEvent(conn, 0);
+    }
+}
+
+
 /*  
     Prepare a data packet for sending downstream. This involves reading file data into a suitably sized packet. Return
     the 1 if the packet was sent entirely, return zero if the packet could not be completely sent. Return a negative
@@ -290,6 +528,15 @@ static int prepPacket(HttpQueue *q, HttpPacket *packet)
     ssize       size, nbytes;
 
     nextQ = q->nextQ;
+    if (packet->flags & HTTP_PACKET_FILLING) {
+        /* Waiting for an asynchronous read */
+        return 0;
+    }
+    if (packet->content && packet->esize == 0) {
+        /* Filled by an asynchronous read */
+        q->ioPos += mprGetBufLength(packet->content);
+        return 1;
+    }
     if (packet->esize > nextQ->packetSize) {
         httpPutBackPacket(q, httpSplitPacket(packet, nextQ->packetSize));
         size = nextQ->packetSize;
@@ -308,7 +555,7 @@ static int prepPacket(HttpQueue *q, HttpPacket *packet)
         return 0;
     }
     if ((nbytes = readFileData(q, packet, q->ioPos, size)) != size) {
-        return MPR_ERR_CANT_READ;
+        return (nbytes == MPR_ERR_NOT_READY) ? 0 : MPR_ERR_CANT_READ;
     }
     q->ioPos += nbytes;
     return 1;
@@ -473,9 +720,20 @@ int maOpenFileHandler(Http *http)
     HttpStage     *handler;
 
     /* 
-        This handler serves requests without using thread workers.
+        This handler serves requests without using thread workers if file data can be read without blocking.
      */
-    if ((handler = httpCreateHandler(http, "fileHandler", 0, NULL)) == 0) {
+#if LINUX && defined(RWF_NOWAIT)
+    handler = httpCreateHandler(http, "fileHandler", HTTP_STAGE_NONBLOCK, NULL);
+    if (readQueue == 0) {
+        readQueue = mprCreateList(0, 0);
+        readCond = mprCreateCond();
+        mprAddRoot(readQueue);
+        mprAddRoot(readCond);
+    }
+#else
+    handler = httpCreateHandler(http, "fileHandler", 0, NULL);
+#endif
+    if (handler == 0) {
         return MPR_ERR_CANT_CREATE;
     }
     handler->match = matchFileHandler;
@@ -0,0 +1,1365 @@
+/*
+    fastHandler.c -- FastCGI Handler
+
+    Support the FastCGI protocol for persistent gateway application processes. Unlike the CGI handler which
+    creates a new process for every request, this handler maintains a pool of long-lived FastCGI application
+    processes per route and communicates with them over Unix domain sockets.
+
+    Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
+
+    LoadModule fastHandler mod_fast
+    <Route /app>
+        FastProgram /path/to/program [args...] [min=N] [max=N] [maxRequests=N] [multiplex=N] [idle=SECS] [socketDir=DIR]
+    </Route>
+
+        min         Minimum number of processes to keep running once started (default 1)
+        max         Maximum number of processes to run (default 4)
+        maxRequests Recycle a process after it has served this many requests. Zero for unlimited (default 0).
+        multiplex   Maximum concurrent requests per process connection (default 1)
+        idle        Idle time in seconds before surplus processes are stopped (default 60)
+        socketDir   Parent directory for the Unix domain sockets (default /tmp). The sockets are created in a 
+                    private (0700) per-application directory beneath this directory.
+
+    Design:
+        Each process is started with a listening Unix socket as its stdin (per the FastCGI spec). Appweb makes one
+        persistent connection to each process and issues requests with FCGI_KEEP_CONN. Up to "multiplex" requests
+        are assigned distinct request IDs on the same connection.
+
+        Process I/O is serviced on a per-application dispatcher. Response data is queued on the request and
+        delivered via an event on the connection's dispatcher. All application state is guarded by the app lock.
+
+        Backpressure: when a client's response queue is full, reading from the process is suspended until the
+        queue drains. When the process connection output buffer is full, request body data is left on the incoming
+        queue and resumed when the process connection becomes writable.
+ */
+
+/*********************************** Includes *********************************/
+
+#include    "appweb.h"
+
+#if BIT_PACK_FAST && BIT_UNIX_LIKE
+
+#include    <sys/un.h>
+
+/************************************ Locals ***********************************/
+
+#define FAST_VERSION            1
+#define FAST_BEGIN_REQUEST      1
+#define FAST_ABORT_REQUEST      2
+#define FAST_END_REQUEST        3
+#define FAST_PARAMS             4
+#define FAST_STDIN              5
+#define FAST_STDOUT             6
+#define FAST_STDERR             7
+
+#define FAST_RESPONDER          1       /* FastCGI responder role */
+#define FAST_KEEP_CONN          1       /* Keep the connection open after the request */
+
+#define FAST_HEADER_LEN         8       /* Size of a record header */
+#define FAST_MAX_RECORD         32768   /* Maximum content written in one record (multiple of 8) */
+#define FAST_MAX_BUFFER         (64 * 1024) /* Maximum buffered output before applying backpressure */
+
+#define FAST_MIN_PROCS          1
+#define FAST_MAX_PROCS          4
+#define FAST_MULTIPLEX          1
+#define FAST_IDLE_TIMEOUT       (60 * MPR_TICKS_PER_SEC)
+#define FAST_TIMER_PERIOD       (5 * MPR_TICKS_PER_SEC)
+
+#define FAST_APP                "fastApp"   /* Route data key */
+
+/*
+    FastCGI application. One per route.
+ */
+typedef struct FastApp {
+    char            *program;               /* Application program path */
+    cchar           **argv;                 /* Program arguments (argv[0] == program) */
+    int             argc;                   /* Count of arguments */
+    char            *socketDir;             /* Parent directory for the private socket directory */
+    char            *sockets;               /* Private directory for Unix sockets */
+    int             minProcs;               /* Minimum number of processes */
+    int             maxProcs;               /* Maximum number of processes */
+    int             maxRequests;            /* Requests before a process is recycled */
+    int             multiplex;              /* Maximum concurrent requests per process */
+    MprTime         idleTimeout;            /* Idle time before surplus processes are stopped */
+    int             nextSocket;             /* Socket name sequence number */
+    MprList         *procs;                 /* Running processes */
+    MprList         *pending;               /* Requests waiting for a process */
+    MprList         *exiting;               /* Commands waiting to be reaped */
+    MprDispatcher   *dispatcher;            /* Dispatcher for process I/O */
+    MprEvent        *timer;                 /* Idle process timer */
+    MprMutex        *mutex;                 /* Multithread sync */
+} FastApp;
+
+/*
+    FastCGI application process
+ */
+typedef struct FastProc {
+    FastApp         *app;                   /* Owning application */
+    MprCmd          *cmd;                   /* Command object for the process */
+    char            *path;                  /* Unix socket path */
+    int             fd;                     /* Connection to the process */
+    int             listenFd;               /* Listening socket passed to the process on startup */
+    MprWaitHandler  *handler;               /* I/O wait handler for fd */
+    MprBuf          *input;                 /* Records read from the process */
+    MprBuf          *output;                /* Records waiting to be written to the process */
+    struct FastReq  **reqs;                 /* Active requests indexed by request ID */
+    int             inflight;               /* Number of active requests */
+    int             served;                 /* Number of requests completed */
+    int             throttled;              /* Number of requests with full client queues */
+    int             retiring;               /* Accept no more requests and exit when idle */
+    int             destroyed;              /* Process has been closed */
+    MprTime         lastActivity;           /* Time of last request completion */
+} FastProc;
+
+/*
+    Per-request state
+ */
+typedef struct FastReq {
+    FastApp         *app;                   /* Owning application */
+    FastProc        *proc;                  /* Assigned process (null if pending or complete) */
+    HttpConn        *conn;                  /* Connection (null once the request is closed) */
+    HttpQueue       *writeq;                /* Handler output queue */
+    MprList         *packets;               /* Response packets awaiting delivery */
+    MprBuf          *header;                /* Response header accumulation buffer */
+    int             id;                     /* FastCGI request ID */
+    int             started;                /* BEGIN_REQUEST has been sent */
+    int             ended;                  /* END_REQUEST received */
+    int             failed;                 /* Process failed before completing the request */
+    int             scheduled;              /* Delivery event has been posted */
+    int             blocked;                /* Body data blocked on the process output buffer */
+    int             throttled;              /* Client output queue is full */
+    int             seenHeader;             /* Response headers have been parsed */
+} FastReq;
+
+/*********************************** Forwards *********************************/
+
+static MprList *apps;                       /* List of FastCGI applications */
+
+static FastReq *allocReq(FastApp *app, HttpConn *conn, HttpQueue *q);
+static void assignReq(FastProc *proc, FastReq *req);
+static void beginReq(FastReq *req);
+static FastProc *createProc(FastApp *app);
+static void deliverEvent(FastReq *req, MprEvent *event);
+static void destroyProc(FastProc *proc);
+static FastProc *findProc(FastApp *app);
+static void flushProc(FastProc *proc);
+static void manageApp(FastApp *app, int flags);
+static void manageProc(FastProc *proc, int flags);
+static void manageReq(FastReq *req, int flags);
+static void parseRecords(FastProc *proc);
+static int parseFastHeaders(FastReq *req, HttpPacket *packet, HttpPacket **body);
+static void postReqEvent(FastReq *req, cchar *name, void *proc);
+static void procEvent(FastProc *proc, MprEvent *event);
+static void putParams(FastProc *proc, FastReq *req);
+static void putRecord(FastProc *proc, int type, int id, cchar *data, ssize len);
+static void releaseReq(FastProc *proc, FastReq *req);
+static void resumeEvent(FastReq *req, MprEvent *event);
+static void scheduleDelivery(FastReq *req);
+static void startPending(FastApp *app);
+static void updateProcEvents(FastProc *proc);
+static void writeToFast(HttpQueue *q);
+
+/************************************* Code ***********************************/
+
+static void openFast(HttpQueue *q)
+{
+    HttpConn    *conn;
+    HttpRx      *rx;
+
+    conn = q->conn;
+    rx = conn->rx;
+    mprLog(5, "Open FastCGI handler");
+
+    if (rx->flags & (HTTP_OPTIONS | HTTP_TRACE)) {
+        httpHandleOptionsTrace(conn);
+    } else {
+        httpTrimExtraPath(conn);
+        httpMapFile(conn, rx->route);
+        httpCreateCGIParams(conn);
+    }
+}
+
+
+/*
+    Close the request. If the application has not yet completed the request, it is aborted. The request ID remains
+    reserved until the application acknowledges with END_REQUEST.
+ */
+static void closeFast(HttpQueue *q)
+{
+    FastReq     *req;
+    FastApp     *app;
+    FastProc    *proc;
+
+    if ((req = q->queueData) == 0) {
+        return;
+    }
+    app = req->app;
+    lock(app);
+    req->conn = 0;
+    if ((proc = req->proc) != 0) {
+        if (!req->ended && !proc->destroyed) {
+            putRecord(proc, FAST_ABORT_REQUEST, req->id, 0, 0);
+            flushProc(proc);
+        }
+    } else {
+        mprRemoveItem(app->pending, req);
+    }
+    unlock(app);
+    q->queueData = 0;
+}
+
+
+/*
+    Assign the request to an application process. If all processes are busy and the pool is at its maximum, the
+    request waits on the pending queue until a process becomes free.
+ */
+static void startFast(HttpQueue *q)
+{
+    HttpConn    *conn;
+    FastApp     *app;
+    FastReq     *req;
+    FastProc    *proc;
+
+    conn = q->conn;
+    if ((app = httpGetRouteData(conn->rx->route, FAST_APP)) == 0) {
+        httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Missing FastProgram directive for route");
+        return;
+    }
+    if ((req = allocReq(app, conn, q)) == 0) {
+        httpError(conn, HTTP_CODE_SERVICE_UNAVAILABLE, "Can't allocate FastCGI request");
+        return;
+    }
+    q->queueData = req;
+
+    lock(app);
+    if ((proc = findProc(app)) != 0) {
+        assignReq(proc, req);
+    } else if (mprGetListLength(app->procs) == 0) {
+        unlock(app);
+        httpError(conn, HTTP_CODE_SERVICE_UNAVAILABLE, "Can't start FastCGI program %s", app->program);
+        return;
+    } else {
+        mprLog(5, "FastCGI: all processes busy, queue request");
+        mprAddItem(app->pending, req);
+    }
+    unlock(app);
+
+    if (req->proc) {
+        beginReq(req);
+    }
+}
+
+
+/*
+    Service outgoing data destined for the client. Release process backpressure once the queue drains.
+ */
+static void outgoingFastService(HttpQueue *q)
+{
+    FastReq     *req;
+    FastApp     *app;
+
+    httpDefaultOutgoingServiceStage(q);
+
+    if ((req = q->queueData) != 0 && req->throttled && q->count < q->low) {
+        app = req->app;
+        lock(app);
+        if (req->throttled) {
+            req->throttled = 0;
+            if (req->proc) {
+                req->proc->throttled--;
+                updateProcEvents(req->proc);
+            }
+        }
+        unlock(app);
+    }
+}
+
+
+/*
+    Accept incoming body data from the client destined for the FastCGI application. The zero length end packet
+    is queued too and sent as the empty STDIN record that terminates the request body.
+ */
+static void incomingFast(HttpQueue *q, HttpPacket *packet)
+{
+    HttpConn    *conn;
+    FastReq     *req;
+
+    conn = q->conn;
+    conn->lastActivity = conn->http->now;
+
+    if (httpGetPacketLength(packet) == 0 && conn->rx->remainingContent > 0) {
+        httpError(conn, HTTP_CODE_BAD_REQUEST, "Client supplied insufficient body data");
+        return;
+    }
+    httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+    if ((req = q->pair->queueData) != 0 && req->started) {
+        writeToFast(q);
+    }
+}
+
+
+/*
+    Encode queued body data as STDIN records. Stop when the process output buffer is full.
+ */
+static void writeToFast(HttpQueue *q)
+{
+    HttpPacket  *packet;
+    FastReq     *req;
+    FastApp     *app;
+    FastProc    *proc;
+    MprBuf      *buf;
+    ssize       len;
+
+    if ((req = q->pair->queueData) == 0) {
+        return;
+    }
+    app = req->app;
+    lock(app);
+    if ((proc = req->proc) == 0 || proc->destroyed) {
+        unlock(app);
+        return;
+    }
+    req->blocked = 0;
+    for (packet = httpGetPacket(q); packet; packet = httpGetPacket(q)) {
+        if (mprGetBufLength(proc->output) >= FAST_MAX_BUFFER) {
+            httpPutBackPacket(q, packet);
+            req->blocked = 1;
+            break;
+        }
+        buf = packet->content;
+        if ((len = httpGetPacketLength(packet)) == 0) {
+            putRecord(proc, FAST_STDIN, req->id, 0, 0);
+        } else {
+            while ((len = mprGetBufLength(buf)) > 0) {
+                len = min(len, FAST_MAX_RECORD);
+                putRecord(proc, FAST_STDIN, req->id, mprGetBufStart(buf), len);
+                mprAdjustBufStart(buf, len);
+            }
+        }
+    }
+    flushProc(proc);
+    unlock(app);
+}
+
+
+/*
+    Deliver response packets to the client. This runs on the connection dispatcher.
+ */
+static void deliverEvent(FastReq *req, MprEvent *event)
+{
+    HttpConn    *conn;
+    HttpQueue   *q;
+    HttpPacket  *packet, *body;
+    FastApp     *app;
+    MprList     *packets;
+    int         ended, failed, next;
+
+    app = req->app;
+    lock(app);
+    packets = req->packets;
+    req->packets = mprCreateList(0, 0);
+    req->scheduled = 0;
+    ended = req->ended;
+    failed = req->failed;
+    unlock(app);
+
+    if ((conn = req->conn) == 0 || conn->tx == 0 || conn->state >= HTTP_STATE_COMPLETE) {
+        return;
+    }
+    q = req->writeq;
+    conn->lastActivity = conn->http->now;
+
+    for (ITERATE_ITEMS(packets, packet, next)) {
+        if (conn->finalized) {
+            break;
+        }
+        body = packet;
+        if (!req->seenHeader && !parseFastHeaders(req, packet, &body)) {
+            continue;
+        }
+        if (body && !conn->finalized) {
+            httpPutForService(q, body, HTTP_SCHEDULE_QUEUE);
+        }
+    }
+    if (failed && !req->seenHeader) {
+        httpError(conn, HTTP_CODE_BAD_GATEWAY, "FastCGI program %s failed", app->program);
+
+    } else if (failed && !conn->finalized) {
+        /* Headers have been sent. Abort the connection so a truncated body is not taken as complete */
+        httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_GATEWAY, "FastCGI program %s failed", app->program);
+
+    } else if (ended && !conn->finalized) {
+        if (!req->seenHeader && req->header) {
+            /* Program emitted headers without a terminating blank line */
+            packet = httpCreateDataPacket(0);
+            parseFastHeaders(req, packet, &body);
+        }
+        httpFinalize(conn);
+    }
+    if (q->count >= q->max && !req->throttled && !ended) {
+        lock(app);
+        req->throttled = 1;
+        if (req->proc) {
+            req->proc->throttled++;
+            updateProcEvents(req->proc);
+        }
+        unlock(app);
+    }
+    httpServiceQueues(conn);
+    if (conn->state < HTTP_STATE_COMPLETE) {
+        if (conn->connectorq->count > 0) {
+            httpEnableConnEvents(conn);
+        }
+    } else {
+        httpPump(conn, NULL);
+    }
+}
+
+
+/*
+    Resume writing request body data. This runs on the connection dispatcher.
+ */
+static void resumeEvent(FastReq *req, MprEvent *event)
+{
+    if (req->conn && req->writeq) {
+        writeToFast(req->writeq->pair);
+    }
+}
+
+
+/*
+    Start the request once a process has been assigned. This runs on the connection dispatcher.
+ */
+static void beginEvent(FastReq *req, MprEvent *event)
+{
+    if (req->conn) {
+        beginReq(req);
+    }
+}
+
+
+static void beginReq(FastReq *req)
+{
+    FastApp     *app;
+    FastProc    *proc;
+    uchar       body[8];
+
+    app = req->app;
+    lock(app);
+    if ((proc = req->proc) == 0 || proc->destroyed) {
+        unlock(app);
+        return;
+    }
+    memset(body, 0, sizeof(body));
+    body[1] = FAST_RESPONDER;
+    body[2] = FAST_KEEP_CONN;
+    putRecord(proc, FAST_BEGIN_REQUEST, req->id, (cchar*) body, sizeof(body));
+    putParams(proc, req);
+    req->started = 1;
+    flushProc(proc);
+    unlock(app);
+
+    /* Send any body data that has already arrived */
+    writeToFast(req->writeq->pair);
+}
+
+
+/*
+    Parse the CGI style response headers. Returns true when the headers are complete and sets *body to a packet
+    containing any remaining body data.
+ */
+static int parseFastHeaders(FastReq *req, HttpPacket *packet, HttpPacket **body)
+{
+    HttpConn    *conn;
+    MprBuf      *buf;
+    char        *start, *end, *line, *key, *value, *location, *tok;
+    ssize       len, blen;
+
+    conn = req->conn;
+    *body = 0;
+    if (req->header == 0) {
+        req->header = mprCreateBuf(HTTP_BUFSIZE, -1);
+    }
+    buf = req->header;
+    mprPutBlockToBuf(buf, mprGetBufStart(packet->content), httpGetPacketLength(packet));
+    mprAddNullToBuf(buf);
+    start = mprGetBufStart(buf);
+
+    if ((end = strstr(start, "\r\n\r\n")) != 0) {
+        len = 4;
+    } else if ((end = strstr(start, "\n\n")) != 0) {
+        len = 2;
+    } else if (!req->ended && mprGetBufLength(buf) < conn->limits->headerSize) {
+        return 0;
+    } else {
+        end = mprGetBufEnd(buf);
+        len = 0;
+    }
+    *end = '\0';
+    location = 0;
+    for (line = stok(start, "\r\n", &tok); line; line = stok(NULL, "\r\n", &tok)) {
+        if ((value = strchr(line, ':')) == 0) {
+            continue;
+        }
+        *value++ = '\0';
+        key = slower(strim(line, " \t", MPR_TRIM_BOTH));
+        value = strim(value, " \t", MPR_TRIM_BOTH);
+
+        if (strcmp(key, "location") == 0) {
+            location = value;
+
+        } else if (strcmp(key, "status") == 0) {
+            httpSetStatus(conn, atoi(value));
+
+        } else if (strcmp(key, "content-type") == 0) {
+            httpSetHeaderString(conn, "Content-Type", value);
+
+        } else if (strcmp(key, "content-length") == 0) {
+            httpSetContentLength(conn, (MprOff) stoi(value));
+            httpSetChunkSize(conn, 0);
+
+        } else {
+            httpSetHeader(conn, key, "%s", value);
+        }
+    }
+    req->seenHeader = 1;
+    if (location) {
+        httpRedirect(conn, conn->tx->status, location);
+        httpFinalize(conn);
+        return 1;
+    }
+    start = &end[len];
+    if ((blen = mprGetBufEnd(buf) - start) > 0) {
+        *body = httpCreateDataPacket(blen);
+        mprPutBlockToBuf((*body)->content, start, blen);
+    }
+    req->header = 0;
+    return 1;
+}
+
+
+/*********************************** Protocol *********************************/
+/*
+    Append a record to the process output buffer. Must be locked.
+ */
+static void putRecord(FastProc *proc, int type, int id, cchar *data, ssize len)
+{
+    MprBuf      *buf;
+    ssize       pad;
+
+    mprAssert(len <= 65535);
+    buf = proc->output;
+    pad = (8 - (len % 8)) % 8;
+    mprPutCharToBuf(buf, FAST_VERSION);
+    mprPutCharToBuf(buf, type);
+    mprPutCharToBuf(buf, (id >> 8) & 0xFF);
+    mprPutCharToBuf(buf, id & 0xFF);
+    mprPutCharToBuf(buf, (int) ((len >> 8) & 0xFF));
+    mprPutCharToBuf(buf, (int) (len & 0xFF));
+    mprPutCharToBuf(buf, (int) pad);
+    mprPutCharToBuf(buf, 0);
+    if (len > 0) {
+        mprPutBlockToBuf(buf, data, len);
+    }
+    while (pad-- > 0) {
+        mprPutCharToBuf(buf, 0);
+    }
+}
+
+
+static void putLength(MprBuf *buf, ssize len)
+{
+    if (len < 128) {
+        mprPutCharToBuf(buf, (int) len);
+    } else {
+        mprPutCharToBuf(buf, (int) (((len >> 24) & 0x7F) | 0x80));
+        mprPutCharToBuf(buf, (int) ((len >> 16) & 0xFF));
+        mprPutCharToBuf(buf, (int) ((len >> 8) & 0xFF));
+        mprPutCharToBuf(buf, (int) (len & 0xFF));
+    }
+}
+
+
+static void putParam(MprBuf *buf, cchar *prefix, cchar *key, cchar *value)
+{
+    char    *name, *cp;
+
+    name = sjoin(prefix, key, NULL);
+    for (cp = name; *cp; cp++) {
+        if (*cp == '-') {
+            *cp = '_';
+        } else {
+            *cp = toupper((uchar) *cp);
+        }
+    }
+    putLength(buf, slen(name));
+    putLength(buf, slen(value));
+    mprPutStringToBuf(buf, name);
+    mprPutStringToBuf(buf, value);
+}
+
+
+/*
+    Encode the CGI variables as PARAMS records terminated by an empty PARAMS record. Must be locked.
+ */
+static void putParams(FastProc *proc, FastReq *req)
+{
+    HttpRx      *rx;
+    MprBuf      *buf;
+    MprKey      *kp;
+    ssize       len;
+
+    rx = req->conn->rx;
+    buf = mprCreateBuf(HTTP_BUFSIZE, -1);
+    for (ITERATE_KEYS(rx->svars, kp)) {
+        if (kp->data) {
+            putParam(buf, "", kp->key, kp->data);
+        }
+    }
+    for (ITERATE_KEYS(rx->headers, kp)) {
+        if (kp->data) {
+            putParam(buf, "HTTP_", kp->key, kp->data);
+        }
+    }
+    while ((len = mprGetBufLength(buf)) > 0) {
+        len = min(len, FAST_MAX_RECORD);
+        putRecord(proc, FAST_PARAMS, req->id, mprGetBufStart(buf), len);
+        mprAdjustBufStart(buf, len);
+    }
+    putRecord(proc, FAST_PARAMS, req->id, 0, 0);
+}
+
+
+/*
+    Post an event to the request's connection dispatcher. Must be locked.
+ */
+static void postReqEvent(FastReq *req, cchar *name, void *proc)
+{
+    if (req->conn) {
+        mprCreateEvent(req->conn->dispatcher, name, 0, proc, req, 0);
+    }
+}
+
+
+static void scheduleDelivery(FastReq *req)
+{
+    if (!req->scheduled && req->conn) {
+        req->scheduled = 1;
+        postReqEvent(req, "fastDeliver", deliverEvent);
+    }
+}
+
+
+/*
+    Dispatch a complete record received from the process. Must be locked.
+ */
+static void handleRecord(FastProc *proc, int type, int id, char *data, ssize len)
+{
+    FastReq     *req;
+    HttpPacket  *packet;
+
+    req = (id > 0 && id <= proc->app->multiplex) ? proc->reqs[id] : 0;
+
+    switch (type) {
+    case FAST_STDOUT:
+        if (req && req->conn && len > 0) {
+            packet = httpCreateDataPacket(len);
+            mprPutBlockToBuf(packet->content, data, len);
+            mprAddItem(req->packets, packet);
+            scheduleDelivery(req);
+        }
+        break;
+
+    case FAST_STDERR:
+        if (len > 0) {
+            mprError("FastCGI: error output from %s\n%s", proc->app->program, snclone(data, len));
+        }
+        break;
+
+    case FAST_END_REQUEST:
+        if (req) {
+            req->ended = 1;
+            releaseReq(proc, req);
+            scheduleDelivery(req);
+        }
+        break;
+
+    default:
+        mprLog(5, "FastCGI: ignore record type %d", type);
+        break;
+    }
+}
+
+
+/*
+    Parse records from the process input buffer. Must be locked.
+ */
+static void parseRecords(FastProc *proc)
+{
+    MprBuf      *buf;
+    uchar       *start;
+    ssize       len, pad;
+    int         type, id;
+
+    buf = proc->input;
+    while (!proc->destroyed && mprGetBufLength(buf) >= FAST_HEADER_LEN) {
+        start = (uchar*) mprGetBufStart(buf);
+        type = start[1];
+        id = (start[2] << 8) | start[3];
+        len = (start[4] << 8) | start[5];
+        pad = start[6];
+        if (mprGetBufLength(buf) < (FAST_HEADER_LEN + len + pad)) {
+            break;
+        }
+        handleRecord(proc, type, id, (char*) &start[FAST_HEADER_LEN], len);
+        mprAdjustBufStart(buf, FAST_HEADER_LEN + len + pad);
+    }
+    if (mprGetBufLength(buf) == 0) {
+        mprFlushBuf(buf);
+    } else {
+        mprCompactBuf(buf);
+    }
+}
+
+
+/*
+    Read records from the process. Must be locked. Returns false if the process has exited.
+ */
+static bool readProc(FastProc *proc)
+{
+    MprBuf      *buf;
+    ssize       nbytes, space;
+
+    buf = proc->input;
+    while (!proc->destroyed && !proc->throttled) {
+        if ((space = mprGetBufSpace(buf)) < MPR_BUFSIZE) {
+            mprGrowBuf(buf, MPR_BUFSIZE);
+            space = mprGetBufSpace(buf);
+        }
+        nbytes = read(proc->fd, mprGetBufEnd(buf), space);
+        if (nbytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return 0;
+        } else if (nbytes == 0) {
+            return 0;
+        }
+        mprAdjustBufEnd(buf, nbytes);
+        parseRecords(proc);
+    }
+    return 1;
+}
+
+
+/*
+    Write buffered records to the process. Must be locked.
+ */
+static void flushProc(FastProc *proc)
+{
+    FastReq     *req;
+    MprBuf      *buf;
+    ssize       nbytes, len;
+    int         id;
+
+    buf = proc->output;
+    while ((len = mprGetBufLength(buf)) > 0) {
+        nbytes = write(proc->fd, mprGetBufStart(buf), len);
+        if (nbytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                mprLog(2, "FastCGI: write to %s failed, errno %d", proc->app->program, errno);
+                mprFlushBuf(buf);
+            }
+            break;
+        }
+        mprAdjustBufStart(buf, nbytes);
+    }
+    if (mprGetBufLength(buf) == 0) {
+        mprFlushBuf(buf);
+    }
+    if (mprGetBufLength(buf) < FAST_MAX_BUFFER) {
+        for (id = 1; id <= proc->app->multiplex; id++) {
+            if ((req = proc->reqs[id]) != 0 && req->blocked) {
+                req->blocked = 0;
+                postReqEvent(req, "fastResume", resumeEvent);
+            }
+        }
+    }
+    updateProcEvents(proc);
+}
+
+
+/*
+    Set the I/O events of interest for the process. Must be locked.
+ */
+static void updateProcEvents(FastProc *proc)
+{
+    int     mask;
+
+    if (proc->destroyed || proc->handler == 0) {
+        return;
+    }
+    mask = (proc->throttled > 0) ? 0 : MPR_READABLE;
+    if (mprGetBufLength(proc->output) > 0) {
+        mask |= MPR_WRITABLE;
+    }
+    mprWaitOn(proc->handler, mask);
+}
+
+
+/*
+    I/O event on the process connection. This runs on the application dispatcher.
+ */
+static void procEvent(FastProc *proc, MprEvent *event)
+{
+    FastApp     *app;
+
+    app = proc->app;
+    lock(app);
+    if (!proc->destroyed) {
+        if (event->mask & MPR_WRITABLE) {
+            flushProc(proc);
+        }
+        if (event->mask & MPR_READABLE) {
+            if (!readProc(proc)) {
+                mprLog(3, "FastCGI: program %s pid %d exited", app->program, proc->cmd->pid);
+                destroyProc(proc);
+            }
+        }
+        updateProcEvents(proc);
+    }
+    unlock(app);
+}
+
+
+/*********************************** Process Pool *********************************/
+
+static FastReq *allocReq(FastApp *app, HttpConn *conn, HttpQueue *q)
+{
+    FastReq     *req;
+
+    if ((req = mprAllocObj(FastReq, manageReq)) == 0) {
+        return 0;
+    }
+    req->app = app;
+    req->conn = conn;
+    req->writeq = q;
+    req->packets = mprCreateList(0, 0);
+    return req;
+}
+
+
+/*
+    Assign a request ID on the process. Must be locked.
+ */
+static void assignReq(FastProc *proc, FastReq *req)
+{
+    int     id;
+
+    for (id = 1; id <= proc->app->multiplex; id++) {
+        if (proc->reqs[id] == 0) {
+            break;
+        }
+    }
+    mprAssert(id <= proc->app->multiplex);
+    proc->reqs[id] = req;
+    proc->inflight++;
+    req->proc = proc;
+    req->id = id;
+}
+
+
+/*
+    Release the request ID once the request has ended. Start pending requests and recycle the process if it has
+    served its quota. Must be locked.
+ */
+static void releaseReq(FastProc *proc, FastReq *req)
+{
+    FastApp     *app;
+    FastReq     *next;
+
+    app = proc->app;
+    proc->reqs[req->id] = 0;
+    proc->inflight--;
+    proc->served++;
+    proc->lastActivity = mprGetTime();
+    if (req->throttled) {
+        req->throttled = 0;
+        proc->throttled--;
+    }
+    req->proc = 0;
+
+    if ((app->maxRequests > 0 && proc->served >= app->maxRequests) || mprIsStopping()) {
+        proc->retiring = 1;
+    }
+    if (proc->retiring) {
+        if (proc->inflight == 0) {
+            mprLog(4, "FastCGI: recycle process for %s after %d requests", app->program, proc->served);
+            destroyProc(proc);
+        }
+        startPending(app);
+        return;
+    }
+    while (proc->inflight < app->multiplex && (next = mprGetFirstItem(app->pending)) != 0) {
+        mprRemoveItem(app->pending, next);
+        assignReq(proc, next);
+        postReqEvent(next, "fastBegin", beginEvent);
+    }
+}
+
+
+/*
+    Assign pending requests to processes with free request slots, starting processes as required. If no process 
+    can be started, the pending requests are failed. Must be locked.
+ */
+static void startPending(FastApp *app)
+{
+    FastProc    *proc;
+    FastReq     *req;
+
+    while ((req = mprGetFirstItem(app->pending)) != 0) {
+        proc = mprIsStopping() ? 0 : findProc(app);
+        if (proc == 0 && mprGetListLength(app->procs) > 0 && !mprIsStopping()) {
+            /* All processes are busy. Wait for a request to complete. */
+            break;
+        }
+        mprRemoveItem(app->pending, req);
+        if (proc) {
+            assignReq(proc, req);
+            postReqEvent(req, "fastBegin", beginEvent);
+        } else {
+            req->failed = req->ended = 1;
+            scheduleDelivery(req);
+        }
+    }
+}
+
+
+/*
+    Find a process with a free request slot, starting a new process if required. Must be locked.
+ */
+static FastProc *findProc(FastApp *app)
+{
+    FastProc    *proc, *best;
+    int         next, count;
+
+    best = 0;
+    for (ITERATE_ITEMS(app->procs, proc, next)) {
+        if (!proc->retiring && proc->inflight < app->multiplex && (best == 0 || proc->inflight < best->inflight)) {
+            best = proc;
+        }
+    }
+    if (best == 0 || best->inflight > 0) {
+        count = mprGetListLength(app->procs);
+        if (count < app->maxProcs) {
+            if ((proc = createProc(app)) != 0) {
+                best = proc;
+            }
+            while (++count < app->minProcs && createProc(app)) ;
+        }
+    }
+    return best;
+}
+
+
+static void forkCallback(FastProc *proc)
+{
+    if (proc->listenFd != 0) {
+        dup2(proc->listenFd, 0);
+    }
+    mprCloseFiles(3);
+}
+
+
+/*
+    Create the private socket directory. This is deferred until the first process is started so the directory is
+    owned by the user the server runs as. Must be locked.
+ */
+static bool makeSocketDir(FastApp *app)
+{
+    char    *dir;
+
+    if (app->sockets) {
+        return 1;
+    }
+    dir = mprJoinPath(app->socketDir, "appweb-fast-XXXXXX");
+    if (mkdtemp(dir) == 0) {
+        mprError("FastCGI: can't create socket directory in %s, errno %d", app->socketDir, errno);
+        return 0;
+    }
+    app->sockets = dir;
+    return 1;
+}
+
+
+/*
+    Start a new FastCGI application process and connect to it. Must be locked.
+ */
+static FastProc *createProc(FastApp *app)
+{
+    FastProc            *proc;
+    struct sockaddr_un  addr;
+    int                 fd;
+
+    if (!makeSocketDir(app) || (proc = mprAllocObj(FastProc, manageProc)) == 0) {
+        return 0;
+    }
+    proc->app = app;
+    proc->fd = -1;
+    proc->input = mprCreateBuf(HTTP_BUFSIZE, -1);
+    proc->output = mprCreateBuf(HTTP_BUFSIZE, -1);
+    proc->reqs = mprAllocZeroed((app->multiplex + 1) * sizeof(FastReq*));
+    proc->lastActivity = mprGetTime();
+    proc->path = mprJoinPath(app->sockets, sfmt("%d.sock", app->nextSocket++));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (slen(proc->path) >= sizeof(addr.sun_path)) {
+        mprError("FastCGI: socket path too long %s", proc->path);
+        return 0;
+    }
+    scopy(addr.sun_path, sizeof(addr.sun_path), proc->path);
+
+    if ((proc->listenFd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        mprError("FastCGI: can't create socket, errno %d", errno);
+        return 0;
+    }
+    if (bind(proc->listenFd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(proc->listenFd, 64) < 0) {
+        mprError("FastCGI: can't listen on %s, errno %d", proc->path, errno);
+        close(proc->listenFd);
+        return 0;
+    }
+    proc->cmd = mprCreateCmd(app->dispatcher);
+    proc->cmd->forkCallback = (MprForkCallback) forkCallback;
+    proc->cmd->forkData = proc;
+    mprSetCmdDir(proc->cmd, mprGetPathDir(app->program));
+
+    if (mprStartCmd(proc->cmd, app->argc, app->argv, NULL, 0) < 0) {
+        mprError("FastCGI: can't start program %s", app->program);
+        close(proc->listenFd);
+        unlink(proc->path);
+        mprDestroyCmd(proc->cmd);
+        return 0;
+    }
+    close(proc->listenFd);
+    proc->listenFd = -1;
+
+    /*
+        The process inherited the listening socket, so the connection is queued even if it has not yet called accept
+     */
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        mprError("FastCGI: can't connect to %s, errno %d", proc->path, errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        mprStopCmd(proc->cmd, -1);
+        mprAddItem(app->exiting, proc->cmd);
+        unlink(proc->path);
+        return 0;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    proc->fd = fd;
+    proc->handler = mprCreateWaitHandler(fd, MPR_READABLE, app->dispatcher, procEvent, proc, 0);
+    mprAddItem(app->procs, proc);
+    mprLog(3, "FastCGI: started %s pid %d, socket %s", app->program, proc->cmd->pid, proc->path);
+    return proc;
+}
+
+
+/*
+    Close the process connection and stop the process. Requests still assigned are failed. Pending requests are
+    started on another process. Must be locked.
+ */
+static void destroyProc(FastProc *proc)
+{
+    FastApp     *app;
+    FastReq     *req;
+    int         id;
+
+    if (proc->destroyed) {
+        return;
+    }
+    app = proc->app;
+    proc->destroyed = 1;
+    mprRemoveItem(app->procs, proc);
+    for (id = 1; id <= app->multiplex; id++) {
+        if ((req = proc->reqs[id]) != 0) {
+            proc->reqs[id] = 0;
+            req->proc = 0;
+            req->failed = req->ended = 1;
+            scheduleDelivery(req);
+        }
+    }
+    proc->inflight = 0;
+    if (proc->handler) {
+        mprRemoveWaitHandler(proc->handler);
+        proc->handler = 0;
+    }
+    if (proc->fd >= 0) {
+        close(proc->fd);
+        proc->fd = -1;
+    }
+    unlink(proc->path);
+    if (mprIsStopping()) {
+        /* Signals are no longer serviced, so stop and reap now */
+        mprDestroyCmd(proc->cmd);
+        if (mprGetListLength(app->procs) == 0) {
+            rmdir(app->sockets);
+        }
+
+    } else if (proc->cmd->pid) {
+        mprStopCmd(proc->cmd, -1);
+        /* Retain the command until the child is reaped */
+        mprAddItem(app->exiting, proc->cmd);
+    }
+    startPending(app);
+}
+
+
+/*
+    Stop surplus idle processes and release reaped commands
+ */
+static void fastTimer(FastApp *app, MprEvent *event)
+{
+    FastProc    *proc;
+    MprCmd      *cmd;
+    MprTime     now;
+    int         next;
+
+    now = mprGetTime();
+    lock(app);
+    for (next = 0; (cmd = mprGetNextItem(app->exiting, &next)) != 0; ) {
+        if (cmd->pid == 0) {
+            mprRemoveItem(app->exiting, cmd);
+            next--;
+        }
+    }
+    for (next = 0; (proc = mprGetNextItem(app->procs, &next)) != 0; ) {
+        if (mprGetListLength(app->procs) <= app->minProcs) {
+            break;
+        }
+        if (proc->inflight == 0 && (now - proc->lastActivity) > app->idleTimeout) {
+            mprLog(4, "FastCGI: stop idle process for %s", app->program);
+            destroyProc(proc);
+            next--;
+        }
+    }
+    unlock(app);
+}
+
+
+/*
+    Stop idle processes when the server is exiting. Busy processes are retired when their last request completes so
+    that a graceful exit is not held up by the persistent process pool.
+ */
+static void terminateFast(int how, int status)
+{
+    FastApp     *app;
+    FastProc    *proc;
+    MprCmd      *cmd;
+    int         next, pnext;
+
+    for (ITERATE_ITEMS(apps, app, next)) {
+        lock(app);
+        mprRemoveEvent(app->timer);
+        for (pnext = 0; (proc = mprGetNextItem(app->procs, &pnext)) != 0; ) {
+            proc->retiring = 1;
+            if (proc->inflight == 0) {
+                destroyProc(proc);
+                pnext--;
+            }
+        }
+        for (ITERATE_ITEMS(app->exiting, cmd, pnext)) {
+            mprDestroyCmd(cmd);
+        }
+        mprClearList(app->exiting);
+        unlock(app);
+    }
+}
+
+
+/*********************************** Config *********************************/
+
+static void manageApp(FastApp *app, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(app->program);
+        mprMark(app->argv);
+        mprMark(app->socketDir);
+        mprMark(app->sockets);
+        mprMark(app->procs);
+        mprMark(app->pending);
+        mprMark(app->exiting);
+        mprMark(app->dispatcher);
+        mprMark(app->timer);
+        mprMark(app->mutex);
+    }
+}
+
+
+static void manageProc(FastProc *proc, int flags)
+{
+    int     id;
+
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(proc->app);
+        mprMark(proc->cmd);
+        mprMark(proc->path);
+        mprMark(proc->handler);
+        mprMark(proc->input);
+        mprMark(proc->output);
+        mprMark(proc->reqs);
+        if (proc->reqs) {
+            for (id = 1; id <= proc->app->multiplex; id++) {
+                mprMark(proc->reqs[id]);
+            }
+        }
+    }
+}
+
+
+static void manageReq(FastReq *req, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(req->app);
+        mprMark(req->proc);
+        mprMark(req->conn);
+        mprMark(req->writeq);
+        mprMark(req->packets);
+        mprMark(req->header);
+    }
+}
+
+
+/*
+    FastProgram path [args...] [min=N] [max=N] [maxRequests=N] [multiplex=N] [idle=SECS] [socketDir=DIR]
+ */
+static int fastProgramDirective(MaState *state, cchar *key, cchar *value)
+{
+    FastApp     *app;
+    MprList     *args;
+    char        *option, *ovalue, *tok;
+
+    if ((app = mprAllocObj(FastApp, manageApp)) == 0) {
+        return MPR_ERR_MEMORY;
+    }
+    app->minProcs = FAST_MIN_PROCS;
+    app->maxProcs = FAST_MAX_PROCS;
+    app->multiplex = FAST_MULTIPLEX;
+    app->idleTimeout = FAST_IDLE_TIMEOUT;
+    app->socketDir = sclone("/tmp");
+    app->procs = mprCreateList(0, 0);
+    app->pending = mprCreateList(0, 0);
+    app->exiting = mprCreateList(0, 0);
+    app->mutex = mprCreateLock();
+    args = mprCreateList(0, 0);
+
+    for (option = stok(sclone(value), " \t", &tok); option; option = stok(0, " \t", &tok)) {
+        if (!schr(option, '=')) {
+            mprAddItem(args, strim(option, "\"'", MPR_TRIM_BOTH));
+            continue;
+        }
+        option = stok(option, " =\t,", &ovalue);
+        ovalue = strim(ovalue, "\"'", MPR_TRIM_BOTH);
+        if (smatch(option, "min")) {
+            app->minProcs = (int) stoi(ovalue);
+
+        } else if (smatch(option, "max")) {
+            app->maxProcs = max((int) stoi(ovalue), 1);
+
+        } else if (smatch(option, "maxRequests")) {
+            app->maxRequests = (int) stoi(ovalue);
+
+        } else if (smatch(option, "multiplex")) {
+            app->multiplex = max((int) stoi(ovalue), 1);
+
+        } else if (smatch(option, "idle")) {
+            app->idleTimeout = stoi(ovalue) * MPR_TICKS_PER_SEC;
+
+        } else if (smatch(option, "socketDir")) {
+            app->socketDir = httpMakePath(state->route, ovalue);
+
+        } else {
+            mprError("Unknown FastProgram option '%s'", option);
+            return MPR_ERR_BAD_SYNTAX;
+        }
+    }
+    if (mprGetListLength(args) == 0) {
+        mprError("Missing FastProgram program path");
+        return MPR_ERR_BAD_SYNTAX;
+    }
+    app->program = httpMakePath(state->route, mprGetItem(args, 0));
+    mprSetItem(args, 0, app->program);
+    mprAddNullItem(args);
+    app->argc = mprGetListLength(args);
+    app->argv = (cchar**) args->items;
+    app->minProcs = min(app->minProcs, app->maxProcs);
+
+    app->dispatcher = mprCreateDispatcher("fastApp", 1);
+    app->timer = mprCreateTimerEvent(app->dispatcher, "fastTimer", FAST_TIMER_PERIOD, fastTimer, app, 0);
+    mprAddItem(apps, app);
+    httpSetRouteData(state->route, FAST_APP, app);
+    httpSetRouteHandler(state->route, "fastHandler");
+    return 0;
+}
+
+
+/*
+    Loadable module initialization
+ */
+int maFastHandlerInit(Http *http, MprModule *module)
+{
+    HttpStage   *handler;
+    MaAppweb    *appweb;
+
+    if ((handler = httpCreateHandler(http, "fastHandler", 0, module)) == 0) {
+        return MPR_ERR_CANT_CREATE;
+    }
+    handler->close = closeFast;
+    handler->outgoingService = outgoingFastService;
+    handler->incoming = incomingFast;
+    handler->open = openFast;
+    handler->start = startFast;
+
+    apps = mprCreateList(0, 0);
+    mprAddRoot(apps);
+    mprAddTerminator(terminateFast);
+
+    appweb = httpGetContext(http);
+    maAddDirective(appweb, "FastProgram", fastProgramDirective);
+    return 0;
+}
+
+#else /* BIT_PACK_FAST */
+
+int maFastHandlerInit(Http *http, MprModule *module)
+{
+    mprNop(0);
+    return 0;
+}
+#endif /* BIT_PACK_FAST */
+
+/*
+    @copy   default
+
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
+
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
+
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
+
+    @end
+ */
@@ -448,24 +448,14 @@ static int writeHeader(sapi_header_struct *sapiHeader, sapi_headers_struct *sapi
 static int readBodyData(char *buffer, uint bufsize TSRMLS_DC)
 {
     HttpConn    *conn;
-    HttpQueue   *q;
-    MprBuf      *content;
     ssize       len;
 
+    /*
+        Body data is not joined into one packet, so read across the packets
+     */
     conn = (HttpConn*) SG(server_context);
-    q = conn->tx->queue[HTTP_QUEUE_RX]->prevQ;
-    if (q->first == 0) {
-        return 0;
-    }
-    if ((content = q->first->content) == 0) {
-        return 0;
-    }
-    len = (ssize) min(mprGetBufLength(content), (ssize) bufsize);
-    if (len > 0) {
-        mprMemcpy(buffer, len, mprGetBufStart(content), len);
-        mprAdjustBufStart(content, len);
-    }
-    mprLog(5, "php: read post data len %d remaining %d", len, mprGetBufLength(content));
+    len = httpRead(conn, buffer, bufsize);
+    mprLog(5, "php: read post data len %d remaining %d", len, conn->readq->count);
     return (int) len;
 }
 
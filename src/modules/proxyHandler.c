@@ -1,14 +1,28 @@
 /* 
-    proxyHandler.c -- Test handler prototype only
+    proxyHandler.c -- Reverse proxy handler
+
+    Forward requests to a set of upstream HTTP backends and relay the responses to the client.
 
     Copyright (c) All Rights Reserved. See copyright notice at the bottom of the file.
 
     LoadModule proxyHandler mod_proxy
-    AddHandler proxyHandler 
+    <Route ^/prefix/>
+        Prefix /prefix
+        ProxyUpstream round-robin|least-conn|hash [header=NAME] [cookie=NAME] [failures=N] [eject=SECS] [maxEject=SECS]
+        ProxyMember host:port [host:port]...
+    </Route>
+
+        Define a set of upstream backends for the current route. Each proxied request is assigned one member
+        according to the policy. Members that fail "failures" consecutive requests are ejected for "eject" seconds.
+        Repeated ejections double the period up to "maxEject" seconds. A successful request restores the member.
+        The route prefix is removed from the forwarded URI.
+
+    <Route ^/proxy-status$>
+        SetHandler proxyStatusHandler
+    </Route>
 
-    ProxyPass /prefix http://ipaddr:port/uri timeout=NN keepalive=NN min=NN max=NN buffer=NN rewrite=headers,body
-        /prefix creates a location block
-        rewrite rewrites Header and body URIs to appear to come from the proxy. Default == headers
+        Report the members of every upstream as JSON keyed by route name. Each member reports its availability, 
+        in-flight requests, total requests, errors and average latency in msec.
 
     Headers:
         X-Forwarded-For     IP address of the client
@@ -16,8 +30,15 @@
         X-Forwarded-Host    The orignal host requested by the client in the Host header
 
     Design:
-        Routed to proxy just like any other request
-        
+        The upstream is stored as route data under "proxyUpstream" so it is inherited by nested routes.
+        Member selection is lock-free. The member set is immutable once configuration is complete, and the
+        round-robin cursor and per-member counters are updated via atomic operations.
+
+        Each request is forwarded over a new client HttpConn that shares the dispatcher of the client connection,
+        so upstream and client events are serialized and no locking is required. Request body data is streamed
+        upstream as it arrives. Response data is relayed as it is read. When the client response queue is full,
+        upstream I/O events are paused until the queue drains below its low water mark.
+        Connecting to the member is blocking, so the handler does not run on the event thread.
  */
 
 /*********************************** Includes *********************************/
@@ -27,240 +48,927 @@
 #if BIT_PACK_PROXY
 /************************************ Locals ***********************************/
 
+#define PROXY_UPSTREAM          "proxyUpstream"     /* Route data key */
+
+#define PROXY_ROUND_ROBIN       1                   /* Rotate through members in turn */
+#define PROXY_LEAST_CONN        2                   /* Select the member with the fewest in-flight requests */
+#define PROXY_HASH              3                   /* Consistent hash of a request header or cookie */
+
+#define PROXY_FAILURES          3                   /* Default consecutive failures before ejection */
+#define PROXY_EJECT             (5 * MPR_TICKS_PER_SEC)     /* Default base ejection period */
+#define PROXY_MAX_EJECT         (300 * MPR_TICKS_PER_SEC)   /* Default maximum ejection period */
+#define PROXY_VNODES            64                  /* Hash ring points per member */
+
+/*
+    Upstream backend member. Counters are updated atomically and may be read without locking.
+ */
+typedef struct ProxyMember {
+    char            *name;                  /* Member "host:port" */
+    char            *host;                  /* Backend host name */
+    int             port;                   /* Backend port */
+    volatile int    inflight;               /* Requests currently assigned */
+    volatile int    failures;               /* Consecutive failed requests */
+    volatile int    ejections;              /* Consecutive ejections (back-off exponent) */
+    volatile int64  requests;               /* Total requests assigned */
+    volatile int64  errors;                 /* Total failed requests */
+    volatile int64  elapsed;                /* Cumulative request latency in ticks */
+    volatile MprTime ejectedUntil;          /* Member is ejected until this time */
+} ProxyMember;
+
+typedef struct ProxyPoint {
+    uint            hash;                   /* Ring position */
+    int             index;                  /* Member index */
+} ProxyPoint;
+
+typedef struct ProxyUpstream {
+    MprList         *members;               /* List of ProxyMember. Immutable after configuration */
+    ProxyPoint      *ring;                  /* Sorted consistent hash ring */
+    int             ringSize;               /* Number of points in the ring */
+    int             policy;                 /* Balancing policy */
+    char            *hashHeader;            /* Request header to hash */
+    char            *hashCookie;            /* Request cookie to hash */
+    int             maxFailures;            /* Consecutive failures before ejection */
+    MprTime         eject;                  /* Base ejection period */
+    MprTime         maxEject;               /* Maximum ejection period */
+    void * volatile cursor;                 /* Round-robin cursor (used as an integer) */
+} ProxyUpstream;
+
+/*
+    Per-request proxy state
+ */
+typedef struct Proxy {
+    ProxyUpstream   *upstream;              /* Upstream for the route */
+    ProxyMember     *member;                /* Selected member */
+    HttpConn        *conn;                  /* Client connection. Cleared when the request is closed */
+    HttpConn        *target;                /* Connection to the upstream member */
+    MprEvent        *event;                 /* Pending resume event */
+    MprTime         started;                /* Time the member was assigned */
+    int             seenHeaders;            /* Upstream response headers have been relayed */
+    int             complete;               /* Upstream response is complete */
+    int             failed;                 /* Upstream request failed */
+    int             released;               /* Member request accounting is complete */
+    int             throttled;              /* Upstream I/O paused while the client queue drains */
+} Proxy;
+
+static MprList *upstreamRoutes;             /* Routes that define an upstream */
+
+/*
+    Hop-by-hop headers that apply to a single connection and are not forwarded
+ */
+static cchar *hopHeaders[] = {
+    "Connection", "Content-Length", "Expect", "Host", "Keep-Alive", "Proxy-Authenticate", "Proxy-Authorization", 
+    "Proxy-Connection", "TE", "Trailer", "Transfer-Encoding", "Upgrade", 0
+};
+
 /*********************************** Forwards *********************************/
 
+static ProxyUpstream *createUpstream();
+static void finishMember(Proxy *proxy, bool failed);
+static void readUpstream(Proxy *proxy);
+static void releaseMember(ProxyUpstream *up, ProxyMember *mp, MprTime elapsed, bool failed);
+static void scheduleResume(Proxy *proxy);
+static ProxyMember *selectMember(ProxyUpstream *up, HttpConn *conn);
+static void upstreamNotifier(HttpConn *target, int event, int arg);
+static void writeUpstream(Proxy *proxy);
+
 /************************************* Code ***********************************/
 
+static void manageProxy(Proxy *proxy, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(proxy->upstream);
+        mprMark(proxy->member);
+        mprMark(proxy->conn);
+        mprMark(proxy->target);
+        mprMark(proxy->event);
+    }
+}
+
+
 static void openProxy(HttpQueue *q)
 {
-#if UNUSED
-    if ((pp = mprAllocObj(Proxy, manageProxy)) == 0) {
+    HttpConn        *conn;
+    ProxyUpstream   *up;
+    Proxy           *proxy;
+
+    conn = q->conn;
+    if ((up = httpGetRouteData(conn->rx->route, PROXY_UPSTREAM)) == 0) {
+        httpError(conn, HTTP_CODE_INTERNAL_SERVER_ERROR, "Missing ProxyUpstream directive for route");
+        return;
+    }
+    if ((proxy = mprAllocObj(Proxy, manageProxy)) == 0) {
+        httpError(conn, HTTP_CODE_SERVICE_UNAVAILABLE, "Can't allocate proxy request");
+        return;
     }
-#endif
+    proxy->upstream = up;
+    proxy->conn = conn;
+    if ((proxy->member = selectMember(up, conn)) == 0) {
+        httpError(conn, HTTP_CODE_SERVICE_UNAVAILABLE, "No upstream proxy member is available");
+        return;
+    }
+    proxy->started = mprGetTime();
+    q->queueData = proxy;
+    mprLog(5, "proxy: assigned upstream member %s", proxy->member->name);
 }
 
 
+/*
+    Close the request. An incomplete upstream request is aborted by closing its connection.
+ */
 static void closeProxy(HttpQueue *q)
 {
+    HttpConn    *conn, *target;
+    Proxy       *proxy;
+    bool        failed;
+
+    conn = q->conn;
+    if ((proxy = q->queueData) == 0) {
+        return;
+    }
+    if ((target = proxy->target) != 0) {
+        proxy->target = 0;
+        httpSetConnNotifier(target, 0);
+        httpDestroyConn(target);
+    }
+    if (proxy->event) {
+        mprRemoveEvent(proxy->event);
+        proxy->event = 0;
+    }
+    failed = proxy->failed || (conn->tx && conn->tx->status >= HTTP_CODE_BAD_GATEWAY);
+    finishMember(proxy, failed);
+    proxy->conn = 0;
+    q->queueData = 0;
 }
 
 
-HttpConn *getConn(HttpConn *conn)
+static bool isHopHeader(cchar *key)
 {
-#if UNUSED
-    HttpConn    *target;
+    cchar   **hp;
 
-    if ((target = mprPopItem(conn->proxies)) != 0) {
-        return target;
+    for (hp = hopHeaders; *hp; hp++) {
+        if (scaselessmatch(key, *hp)) {
+            return 1;
+        }
     }
-#endif
     return 0;
 }
 
 
+/*
+    Return the URI to request from the member. The route prefix is removed.
+ */
+static char *getUpstreamUri(HttpConn *conn, ProxyMember *mp)
+{
+    HttpRoute   *route;
+    cchar       *path;
+
+    route = conn->rx->route;
+    path = conn->rx->originalUri;
+    if (route->prefix && sstarts(path, route->prefix)) {
+        path = &path[route->prefixLen];
+    }
+    if (*path != '/') {
+        path = sjoin("/", path, NULL);
+    }
+    return sfmt("http://%s:%d%s", mp->host, mp->port, path);
+}
+
+
+static void setUpstreamHeaders(Proxy *proxy)
+{
+    HttpConn    *conn, *target;
+    HttpRx      *rx;
+    MprKey      *kp;
+    cchar       *forwarded;
+
+    conn = proxy->conn;
+    target = proxy->target;
+    rx = conn->rx;
+
+    for (kp = 0; (kp = mprGetNextKey(rx->headers, kp)) != 0; ) {
+        if (!isHopHeader(kp->key)) {
+            httpSetHeaderString(target, kp->key, kp->data);
+        }
+    }
+    if ((forwarded = httpGetHeader(conn, "X-Forwarded-For")) != 0) {
+        httpSetHeader(target, "X-Forwarded-For", "%s, %s", forwarded, conn->ip);
+    } else {
+        httpSetHeaderString(target, "X-Forwarded-For", conn->ip);
+    }
+    if (rx->hostHeader) {
+        httpSetHeaderString(target, "X-Forwarded-Host", rx->hostHeader);
+    }
+    httpSetHeaderString(target, "X-Forwarded-Server", mprGetHostName());
+    httpSetHeaderString(target, "Connection", "close");
+    if (rx->length >= 0) {
+        httpSetContentLength(target, rx->length);
+    } else if (rx->chunkState == HTTP_CHUNK_UNCHUNKED) {
+        httpSetContentLength(target, 0);
+    }
+}
+
+
+/*
+    Open a connection to the assigned member and send the request headers. Body data follows as it arrives.
+ */
 static void startProxy(HttpQueue *q)
 {
-#if UNUSED
     HttpConn    *conn, *target;
-    MprHash     *hp;
+    Proxy       *proxy;
+    ProxyMember *mp;
 
     conn = q->conn;
-    rx = conn->rx;
-    loc = rx->loc;
-    
-    httpo
-    uri = httpJoinUriPath(NULL, rx->parsedUri, loc->prefix);
+    if ((proxy = q->queueData) == 0) {
+        return;
+    }
+    mp = proxy->member;
+    if ((target = httpCreateConn(conn->http, 0, conn->dispatcher)) == 0) {
+        httpError(conn, HTTP_CODE_SERVICE_UNAVAILABLE, "Can't create upstream connection");
+        return;
+    }
+    proxy->target = target;
+    httpSetConnContext(target, proxy);
+    httpSetConnNotifier(target, upstreamNotifier);
+    httpSetAsync(target, 1);
+
+    if (httpConnect(target, conn->rx->method, getUpstreamUri(conn, mp), NULL) < 0) {
+        proxy->failed = 1;
+        finishMember(proxy, 1);
+        httpError(conn, HTTP_CODE_BAD_GATEWAY, "Can't connect to upstream member %s", mp->name);
+        return;
+    }
+    setUpstreamHeaders(proxy);
+    writeUpstream(proxy);
+}
 
-    pp->target = getConnection(conn);
 
-    - how to hook into the pipeline for the target
+/*
+    Accept request body data from the client. The zero length end packet is queued too and finalizes the 
+    upstream request.
+ */
+static void incomingProxy(HttpQueue *q, HttpPacket *packet)
+{
+    Proxy   *proxy;
 
-    if (httpConnect(pp->target, rx->method, httpUriToString(uri)) < 0) {
-        for (mprGetFirstHash(rx->headers); hp; hp = mprGetNextHash(rx->headers, hp)) {
-            httpSetHeader(target, hp->key, hp->data);
-        }
-        httpSetHeader(target, "X-Forwarded-Host", );
-        httpSetHeader(target, "Host", );
-        httpSetHeader(target, "X-Forwarded-Server", );
-        httpSetHeader(target, "X-Forwarded-For", );
+    httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+    if ((proxy = q->pair->queueData) != 0 && proxy->target) {
+        writeUpstream(proxy);
     }
-    //  Push headers out - this may not work
-    httpFlush();
-#endif
 }
 
 
-static void readyProxy(HttpQueue *q)
+/*
+    Service outgoing data destined for the client. Resume upstream I/O once the queue drains.
+ */
+static void outgoingProxyService(HttpQueue *q)
 {
-    //  Anything to do here?
+    Proxy   *proxy;
+
+    httpDefaultOutgoingServiceStage(q);
+
+    if ((proxy = q->queueData) != 0 && proxy->throttled && q->count < q->low) {
+        proxy->throttled = 0;
+        scheduleResume(proxy);
+    }
 }
 
 
-static int sofar;
+/*
+    Move request body packets to the upstream connection while its queue has room
+ */
+static void writeUpstream(Proxy *proxy)
+{
+    HttpConn    *target;
+    HttpQueue   *q, *tq;
+    HttpPacket  *packet;
+
+    target = proxy->target;
+    if (target->sock == 0 || target->state < HTTP_STATE_CONNECTED || target->finalized) {
+        return;
+    }
+    q = proxy->conn->readq;
+    tq = target->writeq;
+    for (packet = httpGetPacket(q); packet; packet = httpGetPacket(q)) {
+        if (httpGetPacketLength(packet) == 0) {
+            httpFinalize(target);
+            break;
+        }
+        if (tq->count >= tq->max) {
+            httpPutBackPacket(q, packet);
+            break;
+        }
+        httpPutForService(tq, packet, HTTP_SCHEDULE_QUEUE);
+    }
+    httpServiceQueues(target);
+    if (!proxy->throttled) {
+        httpEnableConnEvents(target);
+    }
+}
+
 
-static void processProxy(HttpQueue *q)
+/*
+    Relay the upstream response status and headers to the client
+ */
+static void relayHeaders(Proxy *proxy)
 {
-    int     count = 50000;
-    
-    q->max = 65536;
-    
-#if USE0
-    /*
-     May overflow q->max
-     */
-    while (sofar < count) {
-        httpWrite(q, "%d aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\n", sofar++);
+    HttpConn    *conn;
+    HttpRx      *rx;
+    MprKey      *kp;
+
+    conn = proxy->conn;
+    rx = proxy->target->rx;
+    proxy->seenHeaders = 1;
+
+    httpSetStatus(conn, rx->status);
+    for (kp = 0; (kp = mprGetNextKey(rx->headers, kp)) != 0; ) {
+        if (!isHopHeader(kp->key)) {
+            httpSetHeaderString(conn, kp->key, kp->data);
+        }
     }
-    httpFinalize(q->conn);
-    sofar = 0;
-#endif
-    
-    
-#if USE1
-    httpWrite(q, "%d aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\n", sofar++);
-    if (sofar == count) {
-        httpFinalize(q->conn);
-        sofar = 0;
-    }
-#endif
-    
-    
-#if USE2
-    while (sofar < count && q->count < (q->max * 3 / 4)) {
-        /* NOTE: httpWrite may do internal flush if count > max */
-        httpWrite(q, "%d aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\n", sofar++);
-    }
-    if (sofar == count) {
-        httpFinalize(q->conn);
-        sofar = 0;
-    }
-#endif
-    
-    
-#if USE3
-    /*
-        MANUAL FLOW CONTROL
-     */
+    if (rx->length >= 0) {
+        httpSetContentLength(conn, rx->length);
+    }
+}
+
+
+/*
+    Move response packets to the client. If the client queue is full, pause upstream I/O. An asynchronous 
+    connection is not re-armed by httpEnableConnEvents, so clearing async suspends upstream events.
+ */
+static void readUpstream(Proxy *proxy)
+{
+    HttpConn    *conn, *target;
+    HttpQueue   *q, *tq;
     HttpPacket  *packet;
-    int         i, size;
-    
-    size = 1024;
-    for (; sofar < count && q->count < q->max; sofar++) {
-        packet = httpCreateDataPacket(size);
-        for (i = 1; i < size - 1; i++) {
-            mprPutCharToBuf(packet->content, 'a');
+
+    conn = proxy->conn;
+    target = proxy->target;
+    q = conn->writeq;
+    if ((tq = target->readq) == 0) {
+        return;
+    }
+    for (packet = httpGetPacket(tq); packet; packet = httpGetPacket(tq)) {
+        if (httpGetPacketLength(packet) == 0 || conn->finalized) {
+            continue;
         }
-        mprPutCharToBuf(packet->content, '\n');
-        httpPutForService(q, packet, HTTP_DELAY_SERVICE);
+        if (q->count >= q->max) {
+            httpPutBackPacket(tq, packet);
+            proxy->throttled = 1;
+            break;
+        }
+        httpPutForService(q, packet, HTTP_SCHEDULE_QUEUE);
+    }
+    httpSetAsync(target, !proxy->throttled);
+}
+
+
+/*
+    Notifier for the upstream connection. This runs inside the upstream connection's event handler, so client
+    completion and errors are deferred to a resume event.
+ */
+static void upstreamNotifier(HttpConn *target, int event, int arg)
+{
+    Proxy   *proxy;
+
+    if ((proxy = httpGetConnContext(target)) == 0 || proxy->conn == 0) {
+        return;
     }
-    if (sofar == count) {
-        httpFinalize(q->conn);
-        sofar = 0;
+    switch (event) {
+    case HTTP_EVENT_IO:
+        if (arg & HTTP_NOTIFY_WRITABLE) {
+            scheduleResume(proxy);
+        }
+        if ((arg & HTTP_NOTIFY_READABLE) && proxy->seenHeaders) {
+            readUpstream(proxy);
+            scheduleResume(proxy);
+        }
+        break;
+
+    case HTTP_STATE_PARSED:
+        relayHeaders(proxy);
+        scheduleResume(proxy);
+        break;
+
+    case HTTP_STATE_COMPLETE:
+    case HTTP_EVENT_CLOSE:
+        if (!proxy->complete) {
+            proxy->complete = 1;
+            if (target->error || !proxy->seenHeaders) {
+                proxy->failed = 1;
+                /* Account for the failure now so the next request sees it before this connection closes */
+                finishMember(proxy, 1);
+            }
+            scheduleResume(proxy);
+        }
+        break;
     }
-#endif
+}
 
-#if USE4 || 1
-    httpStealConn(q->conn);
-#endif
+
+static void resumeEvent(Proxy *proxy, MprEvent *event)
+{
+    HttpConn    *conn, *target;
+
+    proxy->event = 0;
+    if ((conn = proxy->conn) == 0 || (target = proxy->target) == 0 || conn->tx == 0) {
+        return;
+    }
+    conn->lastActivity = conn->http->now;
+    if (!conn->finalized) {
+        if (proxy->failed) {
+            if (proxy->seenHeaders) {
+                httpError(conn, HTTP_ABORT | HTTP_CODE_BAD_GATEWAY, "Upstream member %s failed", proxy->member->name);
+            } else {
+                httpError(conn, HTTP_CODE_BAD_GATEWAY, "Upstream member %s failed", proxy->member->name);
+            }
+        } else {
+            if (proxy->seenHeaders && !proxy->throttled) {
+                readUpstream(proxy);
+            }
+            if (proxy->complete && !proxy->throttled) {
+                httpFinalize(conn);
+            }
+        }
+    }
+    if (!proxy->complete) {
+        /* Send more body data and re-arm upstream events */
+        writeUpstream(proxy);
+        if (!proxy->throttled) {
+            httpEnableConnEvents(conn);
+        }
+    }
+    httpServiceQueues(conn);
+    if (conn->state < HTTP_STATE_COMPLETE) {
+        if (conn->connectorq && conn->connectorq->count > 0) {
+            httpEnableConnEvents(conn);
+        }
+    } else {
+        httpPump(conn, NULL);
+    }
 }
 
 
-static void incomingProxyData(HttpQueue *q, HttpPacket *packet)
+static void scheduleResume(Proxy *proxy)
 {
-    httpPutForService(q, packet, 1);
+    if (proxy->event == 0 && proxy->conn) {
+        proxy->event = mprCreateEvent(proxy->conn->dispatcher, "proxyResume", 0, resumeEvent, proxy, 0);
+    }
 }
 
+/************************************ Upstream *********************************/
 
-static void incomingProxyService(HttpQueue *q)
+static void manageUpstream(ProxyUpstream *up, int flags)
 {
-    HttpPacket  *packet;
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(up->members);
+        mprMark(up->ring);
+        mprMark(up->hashHeader);
+        mprMark(up->hashCookie);
+    }
+}
 
-    for (packet = httpGetPacket(q); packet; packet = httpGetPacket(q)) {
-        if (packet->flags & HTTP_PACKET_DATA) {
-            if (!httpWillNextQueueAcceptPacket(q, packet)) {
-                mprLog(7, "IncomingProxyService downstream full, putback");
-                httpPutBackPacket(q, packet);
-                return;
-            }
+
+static void manageMember(ProxyMember *mp, int flags)
+{
+    if (flags & MPR_MANAGE_MARK) {
+        mprMark(mp->name);
+        mprMark(mp->host);
+    }
+}
+
+
+static ProxyUpstream *createUpstream()
+{
+    ProxyUpstream   *up;
+
+    if ((up = mprAllocObj(ProxyUpstream, manageUpstream)) == 0) {
+        return 0;
+    }
+    up->members = mprCreateList(0, 0);
+    up->policy = PROXY_ROUND_ROBIN;
+    up->maxFailures = PROXY_FAILURES;
+    up->eject = PROXY_EJECT;
+    up->maxEject = PROXY_MAX_EJECT;
+    return up;
+}
+
+
+static int comparePoints(cvoid *p1, cvoid *p2)
+{
+    uint    h1, h2;
+
+    h1 = ((ProxyPoint*) p1)->hash;
+    h2 = ((ProxyPoint*) p2)->hash;
+    return (h1 < h2) ? -1 : ((h1 > h2) ? 1 : 0);
+}
+
+
+/*
+    Rebuild the consistent hash ring. Only called while parsing configuration.
+ */
+static void buildRing(ProxyUpstream *up)
+{
+    ProxyMember     *mp;
+    ProxyPoint      *ring;
+    char            *key;
+    int             next, i, count;
+
+    count = mprGetListLength(up->members) * PROXY_VNODES;
+    if ((ring = mprAlloc(count * sizeof(ProxyPoint))) == 0) {
+        return;
+    }
+    for (count = 0, ITERATE_ITEMS(up->members, mp, next)) {
+        for (i = 0; i < PROXY_VNODES; i++) {
+            key = sfmt("%s-%d", mp->name, i);
+            ring[count].hash = shash(key, slen(key));
+            ring[count].index = next - 1;
+            count++;
         }
-        httpPutPacketToNext(q, packet);
     }
+    qsort(ring, count, sizeof(ProxyPoint), comparePoints);
+    up->ring = ring;
+    up->ringSize = count;
 }
 
 
-static void outgoingProxyData(HttpQueue *q)
+static int addMember(ProxyUpstream *up, cchar *address)
 {
-#if UNUSED
-    httpPutForService(q, packet, 1);
-#endif
+    ProxyMember     *mp;
+    char            *host;
+    int             port;
+
+    if (mprParseSocketAddress(address, &host, &port, 80) < 0 || host == 0 || *host == '\0') {
+        return MPR_ERR_BAD_SYNTAX;
+    }
+    if ((mp = mprAllocObj(ProxyMember, manageMember)) == 0) {
+        return MPR_ERR_MEMORY;
+    }
+    mp->host = host;
+    mp->port = port;
+    mp->name = sfmt("%s:%d", host, port);
+    mprAddItem(up->members, mp);
+    buildRing(up);
+    return 0;
 }
 
 
-static void outgoingProxyService(HttpQueue *q)
+static bool isAvailable(ProxyMember *mp, MprTime now)
 {
-    HttpPacket  *packet;
+    return mp->ejectedUntil <= now;
+}
 
-    for (packet = httpGetPacket(q); packet; packet = httpGetPacket(q)) {
-        if (packet->flags & HTTP_PACKET_DATA) {
-            if (!httpWillNextQueueAcceptPacket(q, packet)) {
-                mprLog(7, "OutgoingProxyService downstream full, putback");
-                httpPutBackPacket(q, packet);
-                return;
-            }
+
+/*
+    Extract a named cookie value from the request
+ */
+static char *getCookie(HttpConn *conn, cchar *name)
+{
+    cchar   *cookies, *cp, *value, *end;
+    ssize   len;
+
+    if ((cookies = httpGetCookies(conn)) == 0) {
+        return 0;
+    }
+    len = slen(name);
+    for (cp = cookies; (cp = strstr(cp, name)) != 0; cp += len) {
+        if (cp != cookies && !isspace((uchar) cp[-1]) && cp[-1] != ';' && cp[-1] != ',') {
+            continue;
         }
-        httpPutPacketToNext(q, packet);
+        for (value = &cp[len]; isspace((uchar) *value); value++) ;
+        if (*value++ != '=') {
+            continue;
+        }
+        for (end = value; *end && *end != ';' && *end != ','; end++) ;
+        return strim(snclone(value, end - value), " \t\"", MPR_TRIM_BOTH);
     }
+    return 0;
 }
 
-static ssize doOutput(HttpQueue *q, cchar *data, ssize len)
+
+static int nextCursor(ProxyUpstream *up)
 {
-    HttpPacket  *packet;
-    ssize       count;
+    void    *cursor;
 
-    count = min(len, q->max - q->count);
-    count = min(count, q->packetSize);
-    packet = httpCreateDataPacket(count);
-    mprPutBlockToBuf(packet->content, data, len);
-    httpPutForService(q, packet, HTTP_SCHEDULE_QUEUE);
-    return count;
+    do {
+        cursor = up->cursor;
+    } while (!mprAtomicCas(&up->cursor, cursor, (void*) ((ssize) cursor + 1)));
+    return (int) ((ssize) cursor & MAXINT);
 }
 
-static int proxyDirective(MaState *state, cchar *key, cchar *value)
+
+static ProxyMember *selectRoundRobin(ProxyUpstream *up, MprTime now)
 {
-#if UNUSED
-    HttpRoute   *route;
+    ProxyMember     *mp;
+    int             count, start, i;
+
+    count = mprGetListLength(up->members);
+    start = nextCursor(up);
+    for (i = 0; i < count; i++) {
+        mp = mprGetItem(up->members, (start + i) % count);
+        if (isAvailable(mp, now)) {
+            return mp;
+        }
+    }
+    return 0;
+}
+
+
+static ProxyMember *selectLeastConn(ProxyUpstream *up, MprTime now)
+{
+    ProxyMember     *mp, *best;
+    int             count, start, i;
+
+    /*
+        Start from a rotating position so ties are spread over the members
+     */
+    count = mprGetListLength(up->members);
+    start = nextCursor(up);
+    best = 0;
+    for (i = 0; i < count; i++) {
+        mp = mprGetItem(up->members, (start + i) % count);
+        if (isAvailable(mp, now) && (best == 0 || mp->inflight < best->inflight)) {
+            best = mp;
+        }
+    }
+    return best;
+}
+
+
+static ProxyMember *selectHash(ProxyUpstream *up, HttpConn *conn, MprTime now)
+{
+    ProxyMember     *mp;
+    cchar           *key;
+    uint            hash;
+    int             low, high, mid, i;
+
+    key = 0;
+    if (up->hashHeader) {
+        key = httpGetHeader(conn, up->hashHeader);
+    } else if (up->hashCookie) {
+        key = getCookie(conn, up->hashCookie);
+    }
+    if (key == 0 || *key == '\0' || up->ringSize == 0) {
+        /* Requests without a key have no affinity */
+        return selectRoundRobin(up, now);
+    }
+    hash = shash(key, slen(key));
 
     /*
-        Syntax: Proxy URI_PATH URI [key=value]...
-        Example:
-        Proxy /prefix http://ipaddr:port/uri timeout=NN keepalive=NN min=NN max=NN buffer=NN rewrite=headers,body
+        Binary search for the first ring point at or after the hash. Skip ejected members by walking the ring.
      */
-    if (maTokenize(state, value, "...", &mimeType, &program) < 0) {
+    low = 0;
+    high = up->ringSize;
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (up->ring[mid].hash < hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    for (i = 0; i < up->ringSize; i++) {
+        mp = mprGetItem(up->members, up->ring[(low + i) % up->ringSize].index);
+        if (isAvailable(mp, now)) {
+            return mp;
+        }
+    }
+    return 0;
+}
+
+
+static ProxyMember *selectMember(ProxyUpstream *up, HttpConn *conn)
+{
+    ProxyMember     *mp;
+    MprTime         now;
+
+    if (mprGetListLength(up->members) == 0) {
+        return 0;
+    }
+    now = mprGetTime();
+    if (up->policy == PROXY_LEAST_CONN) {
+        mp = selectLeastConn(up, now);
+    } else if (up->policy == PROXY_HASH) {
+        mp = selectHash(up, conn, now);
+    } else {
+        mp = selectRoundRobin(up, now);
+    }
+    if (mp) {
+        mprAtomicAdd(&mp->inflight, 1);
+        mprAtomicAdd64(&mp->requests, 1);
+    }
+    return mp;
+}
+
+
+/*
+    Release the request's member once. The member is retained for error messages.
+ */
+static void finishMember(Proxy *proxy, bool failed)
+{
+    if (proxy->member && !proxy->released) {
+        proxy->released = 1;
+        releaseMember(proxy->upstream, proxy->member, mprGetElapsedTime(proxy->started), failed);
+    }
+}
+
+
+/*
+    Account for a completed request. Consecutive failures eject the member with exponential back-off.
+ */
+static void releaseMember(ProxyUpstream *up, ProxyMember *mp, MprTime elapsed, bool failed)
+{
+    MprTime     period;
+    int         shift;
+
+    mprAtomicAdd(&mp->inflight, -1);
+    mprAtomicAdd64(&mp->elapsed, (int) min(elapsed, MAXINT));
+    if (!failed) {
+        if (mp->failures || mp->ejections) {
+            mprLog(3, "proxy: upstream member %s restored", mp->name);
+        }
+        mp->failures = 0;
+        mp->ejections = 0;
+        return;
+    }
+    mprAtomicAdd64(&mp->errors, 1);
+    mprAtomicAdd(&mp->failures, 1);
+    if (mp->failures >= up->maxFailures) {
+        shift = min(mp->ejections, 16);
+        period = min(up->eject << shift, up->maxEject);
+        mp->ejectedUntil = mprGetTime() + period;
+        mp->failures = 0;
+        mprAtomicAdd(&mp->ejections, 1);
+        mprLog(2, "proxy: ejecting upstream member %s for %d msec", mp->name, (int) period);
+    }
+}
+
+
+/*
+    Return upstream member statistics for the route as a JSON string. Returns null if the route has no upstream.
+ */
+char *maGetProxyStats(HttpRoute *route)
+{
+    ProxyUpstream   *up;
+    ProxyMember     *mp;
+    MprBuf          *buf;
+    MprTime         now;
+    int             next;
+
+    if ((up = httpGetRouteData(route, PROXY_UPSTREAM)) == 0) {
+        return 0;
+    }
+    now = mprGetTime();
+    buf = mprCreateBuf(0, 0);
+    mprPutCharToBuf(buf, '[');
+    for (ITERATE_ITEMS(up->members, mp, next)) {
+        mprPutFmtToBuf(buf, "%s{\"member\":\"%s\",\"available\":%s,\"inflight\":%d,\"requests\":%Ld,"
+            "\"errors\":%Ld,\"averageLatency\":%Ld}", (next > 1) ? "," : "", mp->name,
+            isAvailable(mp, now) ? "true" : "false", mp->inflight, mp->requests, mp->errors,
+            mp->requests ? (mp->elapsed / mp->requests) : 0);
+    }
+    mprPutCharToBuf(buf, ']');
+    mprAddNullToBuf(buf);
+    return mprGetBufStart(buf);
+}
+
+
+/*
+    Report upstream statistics for all proxy routes
+ */
+static void readyProxyStatus(HttpQueue *q)
+{
+    HttpRoute   *route;
+    MprBuf      *buf;
+    cchar       *cp;
+    int         next;
+
+    buf = mprCreateBuf(0, 0);
+    mprPutCharToBuf(buf, '{');
+    for (ITERATE_ITEMS(upstreamRoutes, route, next)) {
+        mprPutStringToBuf(buf, (next > 1) ? ",\"" : "\"");
+        for (cp = route->name; *cp; cp++) {
+            if (*cp == '"' || *cp == '\\') {
+                mprPutCharToBuf(buf, '\\');
+            }
+            mprPutCharToBuf(buf, *cp);
+        }
+        mprPutFmtToBuf(buf, "\":%s", maGetProxyStats(route));
+    }
+    mprPutStringToBuf(buf, "}\n");
+    mprAddNullToBuf(buf);
+    httpSetContentType(q->conn, "application/json");
+    httpWriteString(q, mprGetBufStart(buf));
+    httpFinalize(q->conn);
+}
+
+
+/*
+    ProxyUpstream round-robin|least-conn|hash [header=NAME] [cookie=NAME] [failures=N] [eject=SECS] [maxEject=SECS]
+ */
+static int proxyUpstreamDirective(MaState *state, cchar *key, cchar *value)
+{
+    ProxyUpstream   *up;
+    char            *option, *ovalue, *tok;
+
+    if ((up = createUpstream()) == 0) {
+        return MPR_ERR_MEMORY;
+    }
+    for (option = stok(sclone(value), " \t", &tok); option; option = stok(0, " \t", &tok)) {
+        option = stok(option, " =\t,", &ovalue);
+        ovalue = strim(ovalue, "\"'", MPR_TRIM_BOTH);
+        if (smatch(option, "round-robin")) {
+            up->policy = PROXY_ROUND_ROBIN;
+
+        } else if (smatch(option, "least-conn")) {
+            up->policy = PROXY_LEAST_CONN;
+
+        } else if (smatch(option, "hash")) {
+            up->policy = PROXY_HASH;
+
+        } else if (smatch(option, "header")) {
+            up->hashHeader = sclone(ovalue);
+
+        } else if (smatch(option, "cookie")) {
+            up->hashCookie = sclone(ovalue);
+
+        } else if (smatch(option, "failures")) {
+            up->maxFailures = max((int) stoi(ovalue), 1);
+
+        } else if (smatch(option, "eject")) {
+            up->eject = stoi(ovalue) * MPR_TICKS_PER_SEC;
+
+        } else if (smatch(option, "maxEject")) {
+            up->maxEject = stoi(ovalue) * MPR_TICKS_PER_SEC;
+
+        } else {
+            mprError("Unknown ProxyUpstream option '%s'", option);
+            return MPR_ERR_BAD_SYNTAX;
+        }
+    }
+    if (up->policy == PROXY_HASH && !up->hashHeader && !up->hashCookie) {
+        mprError("ProxyUpstream hash policy requires a header or cookie");
         return MPR_ERR_BAD_SYNTAX;
     }
-#endif
+    httpSetRouteData(state->route, PROXY_UPSTREAM, up);
+    httpSetRouteHandler(state->route, "proxyHandler");
+    if (mprLookupItem(upstreamRoutes, state->route) < 0) {
+        mprAddItem(upstreamRoutes, state->route);
+    }
+    return 0;
+}
+
+
+/*
+    ProxyMember host:port [host:port]...
+ */
+static int proxyMemberDirective(MaState *state, cchar *key, cchar *value)
+{
+    ProxyUpstream   *up;
+    char            *address, *tok;
+
+    if ((up = httpGetRouteData(state->route, PROXY_UPSTREAM)) == 0) {
+        mprError("ProxyMember must follow a ProxyUpstream directive");
+        return MPR_ERR_BAD_STATE;
+    }
+    for (address = stok(sclone(value), " \t,", &tok); address; address = stok(0, " \t,", &tok)) {
+        if (addMember(up, address) < 0) {
+            mprError("Bad ProxyMember address '%s'", address);
+            return MPR_ERR_BAD_SYNTAX;
+        }
+    }
     return 0;
 }
 
 
+/*
+    Loadable module initialization
+ */
 int maProxyHandlerInit(Http *http, MprModule *module)
 {
     HttpStage   *handler;
     MaAppweb    *appweb;
 
-    if ((handler = httpCreateHandler(http, module->name, 0, module)) == 0) {
+    if ((handler = httpCreateHandler(http, "proxyHandler", HTTP_STAGE_ALL, module)) == 0) {
         return MPR_ERR_CANT_CREATE;
     }
-    handler->open = openProxy; 
-    handler->close = closeProxy; 
-    handler->incomingData = incomingProxyData; 
+    handler->open = openProxy;
+    handler->close = closeProxy;
+    handler->incoming = incomingProxy;
     handler->outgoingService = outgoingProxyService;
-    handler->start = startProxy; 
-    handler->ready = readyProxy; 
-    handler->process = processProxy; 
+    handler->start = startProxy;
 
+    if ((handler = httpCreateHandler(http, "proxyStatusHandler", HTTP_STAGE_ALL | HTTP_STAGE_NONBLOCK, module)) == 0) {
+        return MPR_ERR_CANT_CREATE;
+    }
+    handler->ready = readyProxyStatus;
+
+    if (upstreamRoutes == 0) {
+        upstreamRoutes = mprCreateList(0, 0);
+        mprAddRoot(upstreamRoutes);
+    }
     appweb = httpGetContext(http);
-    maAddDirective(appweb, "Proxy", proxyDirective);
+    maAddDirective(appweb, "ProxyUpstream", proxyUpstreamDirective);
+    maAddDirective(appweb, "ProxyMember", proxyMemberDirective);
     return 0;
 }
 #else
@@ -270,6 +978,11 @@ int maProxyHandlerInit(Http *http, MprModule *mp)
     return 0;
 }
 
+char *maGetProxyStats(HttpRoute *route)
+{
+    return 0;
+}
+
 #endif /* BIT_PACK_PROXY */
 
 /*
@@ -63,6 +63,34 @@ static int sslCipherSuiteDirective(MaState *state, cchar *key, cchar *value)
 }
 
 
+/*
+    SSLHandshakeThreads count
+ */
+static int sslHandshakeThreadsDirective(MaState *state, cchar *key, cchar *value)
+{
+    int     count;
+
+    if (!maTokenize(state, value, "%N", &count)) {
+        return MPR_ERR_BAD_SYNTAX;
+    }
+    mprSetHandshakeThreads(count);
+    return 0;
+}
+
+
+static int sslKernelTlsDirective(MaState *state, cchar *key, cchar *value)
+{
+    bool    on;
+
+    checkSsl(state);
+    if (!maTokenize(state, value, "%B", &on)) {
+        return MPR_ERR_BAD_SYNTAX;
+    }
+    mprSetSslKernelTls(state->route->ssl, on);
+    return 0;
+}
+
+
 static int sslDirective(MaState *state, cchar *key, cchar *value)
 {
     char    *provider;
@@ -83,6 +111,44 @@ static int sslDirective(MaState *state, cchar *key, cchar *value)
 }
 
 
+/*
+    SSLSessionCache off|size [lifespan]
+ */
+static int sslSessionCacheDirective(MaState *state, cchar *key, cchar *value)
+{
+    char    *size;
+    int     lifespan;
+
+    checkSsl(state);
+    if (!maTokenize(state, value, "%S ?N", &size, &lifespan)) {
+        return MPR_ERR_BAD_SYNTAX;
+    }
+    mprSetSslCacheLimits(state->route->ssl, scaselessmatch(size, "off") ? 0 : (int) stoi(size), 
+        (MprTime) lifespan * MPR_TICKS_PER_SEC);
+    return 0;
+}
+
+
+/*
+    SSLSessionTickets on|off [rotation]
+ */
+static int sslSessionTicketsDirective(MaState *state, cchar *key, cchar *value)
+{
+    bool    on;
+    int     period;
+
+    checkSsl(state);
+    if (!maTokenize(state, value, "%B ?N", &on, &period)) {
+        return MPR_ERR_BAD_SYNTAX;
+    }
+    if (on && period <= 0) {
+        period = MPR_SSL_TICKET_ROTATION / MPR_TICKS_PER_SEC;
+    }
+    mprSetSslTicketRotation(state->route->ssl, on ? (MprTime) period * MPR_TICKS_PER_SEC : 0);
+    return 0;
+}
+
+
 static int sslVerifyClientDirective(MaState *state, cchar *key, cchar *value)
 {
     checkSsl(state);
@@ -179,7 +245,11 @@ int maSslModuleInit(Http *http, MprModule *module)
     maAddDirective(appweb, "SSLCertificateFile", sslCertificateFileDirective);
     maAddDirective(appweb, "SSLCertificateKeyFile", sslCertificateKeyFileDirective);
     maAddDirective(appweb, "SSLCipherSuite", sslCipherSuiteDirective);
+    maAddDirective(appweb, "SSLHandshakeThreads", sslHandshakeThreadsDirective);
+    maAddDirective(appweb, "SSLKernelTls", sslKernelTlsDirective);
     maAddDirective(appweb, "SSLProtocol", sslProtocolDirective);
+    maAddDirective(appweb, "SSLSessionCache", sslSessionCacheDirective);
+    maAddDirective(appweb, "SSLSessionTickets", sslSessionTicketsDirective);
     maAddDirective(appweb, "SSLVerifyClient", sslVerifyClientDirective);
     maAddDirective(appweb, "SSLVerifyDepth", sslVerifyDepthDirective);
     maAddDirective(appweb, "SSLVerifyIssuer", sslVerifyIssuerDirective);
@@ -0,0 +1,398 @@
+/*
+    fastProgram.c - Test FastCGI program
+
+    A minimal FastCGI responder used to test the FastCGI handler. It accepts connections on the listening socket
+    passed as stdin (per the FastCGI spec) and supports multiplexed requests on a single connection.
+
+    Copyright (c) All Rights Reserved. See details at the end of the file.
+
+    Usage:
+        fastProgram
+
+    Query parameters:
+        bytes=N             Output content "N" bytes long instead of the default report
+        status=N            Output a "Status" header
+        location=URI        Output a "Location" header
+        delay=MSEC          Wait before responding
+        exit=1              Exit without responding
+        exit=partial        Exit after writing the headers and half of the content
+
+    By default, the program outputs the request parameters and any post data.
+ */
+
+/********************************** Includes **********************************/
+
+#define _GNU_SOURCE 1
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/*********************************** Locals ***********************************/
+
+#define FAST_VERSION            1
+#define FAST_BEGIN_REQUEST      1
+#define FAST_ABORT_REQUEST      2
+#define FAST_END_REQUEST        3
+#define FAST_PARAMS             4
+#define FAST_STDIN              5
+#define FAST_STDOUT             6
+#define FAST_GET_VALUES         9
+#define FAST_GET_VALUES_RESULT  10
+#define FAST_UNKNOWN_TYPE       11
+
+#define FAST_KEEP_CONN          1
+#define FAST_REQUEST_COMPLETE   0
+#define FAST_HEADER_LEN         8
+#define FAST_MAX_RECORD         32768
+#define MAX_REQUESTS            64
+
+typedef struct Buf {
+    char    *data;
+    size_t  len;
+    size_t  size;
+} Buf;
+
+typedef struct Request {
+    int     active;
+    int     keepConn;
+    int     paramsDone;
+    Buf     params;
+    Buf     input;
+} Request;
+
+static Request  requests[MAX_REQUESTS];
+static Buf      output;
+
+/***************************** Forward Declarations ***************************/
+
+static void     append(Buf *buf, const char *data, size_t len);
+static char     *getParam(Request *req, const char *name);
+static int      handleConnection(int fd);
+static void     putRecord(int type, int id, const char *data, size_t len);
+static void     respond(int fd, int id, Request *req);
+static int      flushOutput(int fd);
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int     fd;
+
+    signal(SIGPIPE, SIG_IGN);
+    while (1) {
+        if ((fd = accept(0, NULL, NULL)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "fastProgram: accept failed, errno %d\n", errno);
+            return 1;
+        }
+        handleConnection(fd);
+        close(fd);
+    }
+    return 0;
+}
+
+
+static int readFully(int fd, char *buf, size_t len)
+{
+    ssize_t     nbytes;
+    size_t      total;
+
+    for (total = 0; total < len; total += nbytes) {
+        if ((nbytes = read(fd, &buf[total], len - total)) < 0) {
+            if (errno == EINTR) {
+                nbytes = 0;
+                continue;
+            }
+            return -1;
+        } else if (nbytes == 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+    Service requests on a connection until the server closes it
+ */
+static int handleConnection(int fd)
+{
+    Request         *req;
+    unsigned char   header[FAST_HEADER_LEN];
+    char            content[65536 + 256], body[8];
+    size_t          len, pad;
+    int             type, id, keepConn;
+
+    memset(requests, 0, sizeof(requests));
+    keepConn = 1;
+    while (keepConn) {
+        if (readFully(fd, (char*) header, FAST_HEADER_LEN) < 0) {
+            return -1;
+        }
+        type = header[1];
+        id = (header[2] << 8) | header[3];
+        len = (header[4] << 8) | header[5];
+        pad = header[6];
+        if (readFully(fd, content, len + pad) < 0) {
+            return -1;
+        }
+        if (type == FAST_GET_VALUES) {
+            putRecord(FAST_GET_VALUES_RESULT, 0, "\016\001FCGI_MPXS_CONNS1", 18);
+            flushOutput(fd);
+            continue;
+        }
+        if (id <= 0 || id >= MAX_REQUESTS) {
+            memset(body, 0, sizeof(body));
+            body[0] = type;
+            putRecord(FAST_UNKNOWN_TYPE, 0, body, sizeof(body));
+            flushOutput(fd);
+            continue;
+        }
+        req = &requests[id];
+
+        switch (type) {
+        case FAST_BEGIN_REQUEST:
+            memset(req, 0, sizeof(Request));
+            req->active = 1;
+            req->keepConn = content[2] & FAST_KEEP_CONN;
+            break;
+
+        case FAST_ABORT_REQUEST:
+            if (req->active) {
+                memset(body, 0, sizeof(body));
+                body[4] = FAST_REQUEST_COMPLETE;
+                putRecord(FAST_END_REQUEST, id, body, sizeof(body));
+                keepConn = req->keepConn;
+                free(req->params.data);
+                free(req->input.data);
+                memset(req, 0, sizeof(Request));
+            }
+            break;
+
+        case FAST_PARAMS:
+            if (len == 0) {
+                req->paramsDone = 1;
+            } else {
+                append(&req->params, content, len);
+            }
+            break;
+
+        case FAST_STDIN:
+            if (len > 0) {
+                append(&req->input, content, len);
+            } else if (req->active) {
+                respond(fd, id, req);
+                keepConn = req->keepConn;
+                free(req->params.data);
+                free(req->input.data);
+                memset(req, 0, sizeof(Request));
+            }
+            break;
+        }
+        if (flushOutput(fd) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static void respond(int fd, int id, Request *req)
+{
+    Buf         out;
+    char        line[1024], body[8], *name, *value, *cp, *bytes, *status, *location, *delay, *quit;
+    size_t      pos, nlen, vlen, i, count, hlen;
+    int         lens[2], k, partial;
+    unsigned char *p;
+
+    if ((delay = getParam(req, "delay=")) != 0) {
+        usleep(atoi(delay) * 1000);
+        free(delay);
+    }
+    partial = 0;
+    if ((quit = getParam(req, "exit=")) != 0) {
+        partial = strcmp(quit, "partial") == 0;
+        free(quit);
+        if (!partial) {
+            exit(0);
+        }
+    }
+    memset(&out, 0, sizeof(out));
+    bytes = getParam(req, "bytes=");
+    status = getParam(req, "status=");
+    location = getParam(req, "location=");
+
+    if (status) {
+        snprintf(line, sizeof(line), "Status: %d\r\n", atoi(status));
+        append(&out, line, strlen(line));
+    }
+    if (location) {
+        snprintf(line, sizeof(line), "Location: %s\r\n", location);
+        append(&out, line, strlen(line));
+    }
+    append(&out, "Content-Type: text/plain\r\n\r\n", 28);
+    hlen = out.len;
+
+    if (bytes) {
+        count = (size_t) atol(bytes);
+        for (i = 0; i < count; i++) {
+            append(&out, (i % 64) == 63 ? "\n" : "a", 1);
+        }
+    } else {
+        snprintf(line, sizeof(line), "FastCGI request %d, pid %d\n\nPARAMS\n", id, (int) getpid());
+        append(&out, line, strlen(line));
+        for (pos = 0, p = (unsigned char*) req->params.data; pos < req->params.len; ) {
+            for (k = 0; k < 2; k++) {
+                if (p[pos] & 0x80) {
+                    lens[k] = ((p[pos] & 0x7F) << 24) | (p[pos + 1] << 16) | (p[pos + 2] << 8) | p[pos + 3];
+                    pos += 4;
+                } else {
+                    lens[k] = p[pos++];
+                }
+            }
+            nlen = lens[0];
+            vlen = lens[1];
+            name = (char*) &p[pos];
+            value = (char*) &p[pos + nlen];
+            pos += nlen + vlen;
+            append(&out, name, nlen);
+            append(&out, "=", 1);
+            append(&out, value, vlen);
+            append(&out, "\n", 1);
+        }
+        if (req->input.len > 0) {
+            cp = "\nPOST DATA\n";
+            append(&out, cp, strlen(cp));
+            append(&out, req->input.data, req->input.len);
+            append(&out, "\n", 1);
+        }
+    }
+    if (partial) {
+        out.len = hlen + (out.len - hlen) / 2;
+    }
+    for (pos = 0; pos < out.len; pos += nlen) {
+        nlen = out.len - pos;
+        if (nlen > FAST_MAX_RECORD) {
+            nlen = FAST_MAX_RECORD;
+        }
+        putRecord(FAST_STDOUT, id, &out.data[pos], nlen);
+    }
+    if (partial) {
+        /* Let the headers reach the client before failing */
+        flushOutput(fd);
+        usleep(100 * 1000);
+        exit(0);
+    }
+    putRecord(FAST_STDOUT, id, NULL, 0);
+    memset(body, 0, sizeof(body));
+    body[4] = FAST_REQUEST_COMPLETE;
+    putRecord(FAST_END_REQUEST, id, body, sizeof(body));
+    free(out.data);
+    free(bytes);
+    free(status);
+    free(location);
+}
+
+
+/*
+    Find a query parameter value. Returns an allocated string or null.
+ */
+static char *getParam(Request *req, const char *name)
+{
+    char    *query, *start, *end;
+    size_t  len;
+
+    if ((query = memmem(req->params.data, req->params.len, "QUERY_STRING", 12)) == 0) {
+        return 0;
+    }
+    query += 12;
+    len = req->params.len - (query - req->params.data);
+    if ((start = memmem(query, len, name, strlen(name))) == 0) {
+        return 0;
+    }
+    start += strlen(name);
+    for (end = start; end < &req->params.data[req->params.len] && *end != '&' && (unsigned char) *end >= ' '; end++) ;
+    return strndup(start, end - start);
+}
+
+
+static void append(Buf *buf, const char *data, size_t len)
+{
+    if (buf->len + len > buf->size) {
+        buf->size = (buf->len + len) * 2 + 256;
+        buf->data = realloc(buf->data, buf->size);
+    }
+    if (len > 0) {
+        memcpy(&buf->data[buf->len], data, len);
+        buf->len += len;
+    }
+}
+
+
+static void putRecord(int type, int id, const char *data, size_t len)
+{
+    char    header[FAST_HEADER_LEN], padding[8];
+    size_t  pad;
+
+    pad = (8 - (len % 8)) % 8;
+    header[0] = FAST_VERSION;
+    header[1] = (char) type;
+    header[2] = (char) ((id >> 8) & 0xFF);
+    header[3] = (char) (id & 0xFF);
+    header[4] = (char) ((len >> 8) & 0xFF);
+    header[5] = (char) (len & 0xFF);
+    header[6] = (char) pad;
+    header[7] = 0;
+    append(&output, header, FAST_HEADER_LEN);
+    append(&output, data, len);
+    memset(padding, 0, sizeof(padding));
+    append(&output, padding, pad);
+}
+
+
+static int flushOutput(int fd)
+{
+    ssize_t     nbytes;
+    size_t      pos;
+
+    for (pos = 0; pos < output.len; pos += nbytes) {
+        if ((nbytes = write(fd, &output.data[pos], output.len - pos)) < 0) {
+            if (errno == EINTR) {
+                nbytes = 0;
+                continue;
+            }
+            output.len = 0;
+            return -1;
+        }
+    }
+    output.len = 0;
+    return 0;
+}
+
+/*
+    @copy   default
+
+    Copyright (c) Embedthis Software LLC, 2003-2012. All Rights Reserved.
+
+    This software is distributed under commercial and open source licenses.
+    You may use the Embedthis Open Source license or you may acquire a
+    commercial license from Embedthis Software. You agree to be fully bound
+    by the terms of either license. Consult the LICENSE.md distributed with
+    this software for full details and other copyrights.
+
+    Local variables:
+    tab-width: 4
+    c-basic-offset: 4
+    End:
+    vim: sw=4 ts=4 expandtab
+
+    @end
+ */
@@ -41,6 +41,262 @@ static void login() {
     }
 }
 
+/*
+    WebSockets echo. Messages are echoed back with the same type. The text message "fanout COUNT SIZE" requests COUNT 
+    JSON messages of SIZE bytes to measure large message throughput. Broadcast groups are tested with the messages:
+    "join GROUP", "limit GROUP BYTES drop|disconnect" and "publish GROUP COUNT SIZE".
+ */
+#define ITEM "{\"id\":1,\"value\":\"ok\"},"
+
+static char *createJson(int size)
+{
+    char    *json;
+    int     i;
+
+    json = mprAlloc(size + 1);
+    for (i = 0; i < size; i++) {
+        json[i] = ITEM[i % (sizeof(ITEM) - 1)];
+    }
+    json[size] = '\0';
+    return json;
+}
+
+
+static void echoMessages(HttpConn *conn, int state, int flags)
+{
+    HttpPacket  *packet;
+    char        *json, *cp, *name, *tok;
+    ssize       len;
+    int         count, size, members, i;
+
+    if (!(flags & HTTP_NOTIFY_READABLE)) {
+        return;
+    }
+    while ((packet = httpGetPacket(conn->readq)) != 0) {
+        if (!packet->type) {
+            continue;
+        }
+        cp = mprGetBufStart(packet->content);
+        len = httpGetPacketLength(packet);
+        if (packet->type != HTTP_WS_TEXT || len >= 64) {
+            httpSendBlock(conn, packet->type, cp, len, 0);
+            continue;
+        }
+        mprAddNullToBuf(packet->content);
+        cp = mprGetBufStart(packet->content);
+        if (sncmp(cp, "fanout ", 7) == 0) {
+            count = (int) stoi(&cp[7]);
+            size = (int) stoi(schr(&cp[7], ' ') ? schr(&cp[7], ' ') : "0");
+            json = createJson(size);
+            for (i = 0; i < count; i++) {
+                httpSendBlock(conn, HTTP_WS_TEXT, json, size, 0);
+            }
+        } else if (sncmp(cp, "join ", 5) == 0) {
+            httpJoinGroup(conn, &cp[5]);
+            httpSend(conn, "joined %s", &cp[5]);
+
+        } else if (sncmp(cp, "limit ", 6) == 0) {
+            name = stok(sclone(&cp[6]), " ", &tok);
+            size = (int) stoi(stok(NULL, " ", &tok));
+            httpSetGroupLimits(conn->http, name, size, smatch(tok, "disconnect") ? HTTP_GROUP_DISCONNECT : HTTP_GROUP_DROP);
+            httpSend(conn, "limited %s", name);
+
+        } else if (sncmp(cp, "publish ", 8) == 0) {
+            name = stok(sclone(&cp[8]), " ", &tok);
+            count = (int) stoi(stok(NULL, " ", &tok));
+            size = (int) stoi(tok);
+            json = createJson(size);
+            for (members = 0, i = 0; i < count; i++) {
+                members = httpBroadcast(conn->http, name, HTTP_WS_TEXT, json, size);
+            }
+            httpSend(conn, "published %d", members);
+
+        } else {
+            httpSendBlock(conn, packet->type, cp, len, 0);
+        }
+    }
+}
+
+
+static void echo() { 
+    if (!getConn()->rx->webSocket) {
+        render("Echo: OK\r\n");
+        finalize();
+        return;
+    }
+    dontAutoFinalize();
+    httpSetConnNotifier(getConn(), echoMessages);
+}
+
+
+/*
+    Upload summary. Reports the form field "name" and the size of each uploaded file with an MD5 digest of small files.
+    The count of body bytes copied by the pipeline is reported last.
+ */
+static void upload() { 
+    HttpUploadFile  *file;
+    MprKey          *kp;
+    char            *data, *digest;
+    ssize           len;
+
+    render("name=%s\r\n", param("name"));
+    for (ITERATE_KEY_DATA(getUploads(), kp, file)) {
+        digest = "-";
+        if (file->size <= (1024 * 1024) && (data = mprReadPathContents(file->filename, &len)) != 0) {
+            digest = mprGetMD5WithPrefix(data, len, NULL);
+        }
+        render("%s=%Ld %s\r\n", kp->key, file->size, digest);
+    }
+    render("copied=%Ld\r\n", getConn()->rx->bytesCopied);
+    finalize();
+}
+
+
+/*
+    Streamed upload summary. File data is received in packets as it arrives and no temp files are created. Reports the 
+    size of each file, an MD5 digest of small files, whether the last packet for the file was seen and where the file
+    data was stored. The count of body bytes copied by the pipeline is reported last.
+ */
+static void uploadStreamData(HttpConn *conn, int state, int flags)
+{
+    HttpPacket      *packet;
+    HttpUploadFile  *file;
+    MprHash         *parts;
+    MprBuf          *buf;
+    MprKey          *kp;
+    char            *digest;
+    ssize           len;
+
+    if (!(flags & HTTP_NOTIFY_READABLE)) {
+        return;
+    }
+    parts = (MprHash*) httpGetStageData(conn, "uploadStream");
+    while ((packet = httpGetPacket(conn->readq)) != 0) {
+        if ((file = packet->upload) != 0) {
+            if ((buf = mprLookupKey(parts, file->name)) == 0) {
+                buf = mprCreateBuf(0, 0);
+                mprAddKey(parts, file->name, buf);
+            }
+            len = httpGetPacketLength(packet);
+            if (len > 0 && (mprGetBufLength(buf) + len) <= (1024 * 1024)) {
+                mprPutBlockToBuf(buf, mprGetBufStart(packet->content), len);
+            }
+            if (!(packet->flags & HTTP_PACKET_MORE)) {
+                mprAddKey(parts, sjoin(file->name, ".end", NULL), sclone("end"));
+            }
+        } else if (packet->flags & HTTP_PACKET_END) {
+            httpWrite(conn->writeq, "name=%s\r\n", httpGetParam(conn, "name", ""));
+            for (ITERATE_KEY_DATA(conn->rx->files, kp, file)) {
+                digest = "-";
+                buf = mprLookupKey(parts, kp->key);
+                if (buf && file->size <= (1024 * 1024)) {
+                    digest = mprGetMD5WithPrefix(mprGetBufStart(buf), mprGetBufLength(buf), NULL);
+                }
+                httpWrite(conn->writeq, "%s=%Ld %s %s %s\r\n", kp->key, file->size, digest, 
+                    mprLookupKey(parts, sjoin(kp->key, ".end", NULL)) ? "end" : "-", file->filename ? "file" : "stream");
+            }
+            httpWrite(conn->writeq, "copied=%Ld\r\n", conn->rx->bytesCopied);
+            httpFinalize(conn);
+        }
+    }
+}
+
+
+static void uploadStream() { 
+    HttpConn    *conn;
+
+    conn = getConn();
+    httpSetStageData(conn, "uploadStream", mprCreateHash(0, 0));
+    dontAutoFinalize();
+    httpSetConnNotifier(conn, uploadStreamData);
+}
+
+
+/*
+    Request body summary. The body is read with httpRead as it arrives. Reports the body size, an MD5 digest and the
+    count of body bytes copied by the pipeline.
+ */
+static void bodyData(HttpConn *conn, int state, int flags)
+{
+    MprBuf      *buf;
+    char        block[MPR_BUFSIZE];
+    ssize       nbytes;
+
+    if (!(flags & HTTP_NOTIFY_READABLE) || conn->finalized) {
+        return;
+    }
+    buf = (MprBuf*) httpGetStageData(conn, "body");
+    while ((nbytes = httpRead(conn, block, sizeof(block))) > 0) {
+        mprPutBlockToBuf(buf, block, nbytes);
+    }
+    if (httpIsEof(conn)) {
+        httpWrite(conn->writeq, "body=%Ld %s copied=%Ld\r\n", (MprOff) mprGetBufLength(buf), 
+            mprGetMD5WithPrefix(mprGetBufStart(buf), mprGetBufLength(buf), NULL), conn->rx->bytesCopied);
+        httpFinalize(conn);
+    }
+}
+
+
+static void body() { 
+    HttpConn    *conn;
+
+    conn = getConn();
+    httpSetStageData(conn, "body", mprCreateBuf(0, 0));
+    dontAutoFinalize();
+    httpSetConnNotifier(conn, bodyData);
+    bodyData(conn, 0, HTTP_NOTIFY_READABLE);
+}
+
+
+/*
+    Session counter. Reads a set of session variables and updates one per request.
+ */
+static void session() { 
+    char    key[16];
+    int     count, i;
+
+    if (!getSessionVar("v0")[0]) {
+        for (i = 0; i < 10; i++) {
+            mprSprintf(key, sizeof(key), "v%d", i);
+            setSessionVar(key, "0123456789012345678901234567890123456789");
+        }
+    }
+    for (i = 0; i < 10; i++) {
+        mprSprintf(key, sizeof(key), "v%d", i);
+        getSessionVar(key);
+    }
+    count = (int) stoi(getSessionVar("count")) + 1;
+    setSessionVar("count", itos(count));
+    render("count=%d", count);
+}
+
+
+/*
+    Create a session without setting any session variables
+ */
+static void newSession() { 
+    createSession();
+    render("session");
+}
+
+
+/*
+    Coroutine wait. Waiting suspends the request on its coroutine. Reports whether the request resumed on the same 
+    thread with its own thread-local connection.
+ */
+static void coroutine() { 
+    HttpConn        *conn;
+    MprCoroutine    *co;
+    MprThread       *thread;
+
+    conn = getConn();
+    co = mprGetCurrentCoroutine();
+    thread = mprGetCurrentThread();
+    mprWaitForEvent(conn->dispatcher, 50);
+    render("coroutine=%d thread=%d conn=%d", co != 0, mprGetCurrentThread() == thread, getConn() == conn);
+}
+
+
 static void missing() {
     renderError(HTTP_CODE_INTERNAL_SERVER_ERROR, "Missing action");
 }
@@ -48,7 +304,14 @@ static void missing() {
 ESP_EXPORT int esp_controller_test(HttpRoute *route, MprModule *module) {
     espDefineAction(route, "test-missing", missing);
     espDefineAction(route, "test-cmd-check", check);
+    espDefineAction(route, "test-cmd-echo", echo);
     espDefineAction(route, "test-cmd-details", details);
     espDefineAction(route, "test-cmd-login", login);
+    espDefineAction(route, "test-cmd-upload", upload);
+    espDefineAction(route, "test-cmd-uploadStream", uploadStream);
+    espDefineAction(route, "test-cmd-body", body);
+    espDefineAction(route, "test-cmd-session", session);
+    espDefineAction(route, "test-cmd-newSession", newSession);
+    espDefineAction(route, "test-cmd-coroutine", coroutine);
     return 0;
 }
@@ -0,0 +1,62 @@
+/*
+    fast.tst - FastCGI tests
+ */
+
+const HTTP = App.config.uris.http || "127.0.0.1:4100"
+let http: Http = new Http
+
+if (App.config.bit_fast && test.hostOs != "WIN") {
+
+    function basic() {
+        http.get(HTTP + "/fast/test?a=b")
+        assert(http.status == 200)
+        assert(http.header("Content-Type") == "text/plain")
+        assert(http.response.contains("FastCGI request"))
+        assert(http.response.contains("QUERY_STRING=a=b"))
+        assert(http.response.contains("SCRIPT_NAME="))
+    }
+
+    function post() {
+        http.post(HTTP + "/fast/test", "name=Peter&address=Mulberry")
+        assert(http.status == 200)
+        assert(http.response.contains("POST DATA"))
+        assert(http.response.contains("name=Peter&address=Mulberry"))
+    }
+
+    function large() {
+        //  Larger than the handler queue and the process output buffer to exercise backpressure
+        http.get(HTTP + "/fast/test?bytes=1000000")
+        assert(http.status == 200)
+        assert(http.response.length == 1000000)
+    }
+
+    function headers() {
+        http.get(HTTP + "/fast/test?status=711")
+        assert(http.status == 711)
+
+        let client = new Http
+        client.followRedirects = false
+        client.get(HTTP + "/fast/test?location=/index.html")
+        assert(client.status == 302)
+        client.close()
+    }
+
+    function reuse() {
+        //  Exceeds maxRequests so processes are recycled
+        for (let i = 0; i < 1200; i++) {
+            http.get(HTTP + "/fast/test?bytes=10")
+            assert(http.status == 200)
+            assert(http.response.length == 10)
+        }
+    }
+
+    basic()
+    post()
+    large()
+    headers()
+    reuse()
+    http.close()
+
+} else {
+    test.skip("FastCGI not enabled")
+}
@@ -0,0 +1,37 @@
+/*
+    proxy.tst - Reverse proxy tests
+ */
+
+const HTTP = App.config.uris.http || "127.0.0.1:4100"
+let http: Http = new Http
+
+if (App.config.bit_proxy) {
+
+    function basic() {
+        http.get(HTTP + "/proxy/index.html")
+        assert(http.status == 200)
+        assert(http.response.contains("Hello /index.html"))
+
+        http.get(HTTP + "/proxy/missing.html")
+        assert(http.status == 404)
+    }
+
+    function large() {
+        http.get(HTTP + "/proxy/big.txt")
+        assert(http.status == 200)
+        assert(http.response.length == 117016)
+    }
+
+    function down() {
+        http.get(HTTP + "/proxy-down/index.html")
+        assert(http.status == 502 || http.status == 503)
+    }
+
+    basic()
+    large()
+    down()
+    http.close()
+
+} else {
+    test.skip("Proxy not enabled")
+}
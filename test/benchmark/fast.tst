@@ -0,0 +1,40 @@
+/*
+    fast.tst - Compare FastCGI and CGI request throughput
+ */
+if (test.depth >= 6) {
+
+    const HTTP = App.config.uris.http || "127.0.0.1:4100"
+    const ITER = 2000
+
+    let command = Cmd.locate("http").portable + " --host " + HTTP + " "
+
+    function run(args): Void {
+        try {
+            let cmd = Cmd(command + args)
+            assert(cmd.status == 0)
+        } catch (e) {
+            assert(false, e)
+        }
+    }
+
+    function bench(name, uri) {
+        for each (threads in [1, 4, 8]) {
+            let start = new Date
+            let count = (ITER / threads).toFixed()
+            run("-q -i " + count + " -t " + threads + " " + HTTP + uri)
+            elapsed = start.elapsed
+            App.log.activity("Benchmark", "%s throughput %.0f request/sec, with %d threads" % 
+                [name, ITER / elapsed * 1000, threads])
+        }
+    }
+
+    if (App.config.bit_fast && App.config.bit_cgi && test.hostOs != "WIN") {
+        bench("FastCGI", "/fast/bench?bytes=1000")
+        bench("CGI", "/cgi-bin/cgiProgram")
+    } else {
+        test.skip("FastCGI or CGI not enabled")
+    }
+
+} else {
+    test.skip("Test runs at depth 6")
+}
@@ -0,0 +1,37 @@
+/*
+    latency.tst - Benchmark request latency percentiles under load
+ */
+if (test.depth >= 6) {
+
+    const HTTP = App.config.uris.http || "127.0.0.1:4100"
+    const ITER = 10000
+
+    let command = Cmd.locate("http").portable + " --host " + HTTP + " "
+
+    function run(args): String {
+        try {
+            let cmd = Cmd(command + args)
+            assert(cmd.status == 0)
+            return cmd.response
+        } catch (e) {
+            assert(false, e)
+        }
+        return null
+    }
+
+    function latency(response: String, percent: String): Number {
+        let match = response.match(RegExp("Latency " + percent + ":\\s+([0-9.]+)"))
+        assert(match)
+        return match[1] cast Number
+    }
+
+    for each (threads in [4, 16, 64]) {
+        let count = (ITER / threads).toFixed()
+        let response = run("-q --benchmark -i " + count + " -t " + threads + " " + HTTP + "/index.html")
+        App.log.activity("Benchmark", "Latency 50%% %.2f, 90%% %.2f, 99%% %.2f msec, with %d threads" %
+            [latency(response, "50%"), latency(response, "90%"), latency(response, "99%"), threads])
+    }
+
+} else {
+    test.skip("Test runs at depth 6")
+}
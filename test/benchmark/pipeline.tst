@@ -0,0 +1,31 @@
+/*
+    pipeline.tst - Benchmark pipelined requests
+ */
+if (test.depth >= 6) {
+
+    const HTTP = App.config.uris.http || "127.0.0.1:4100"
+    const ITER = 10000
+
+    let command = Cmd.locate("http").portable + " --host " + HTTP + " "
+
+    function run(args): String {
+        try {
+            let cmd = Cmd(command + args)
+            assert(cmd.status == 0)
+            return cmd.response
+        } catch (e) {
+            assert(false, e)
+        }
+        return null
+    }
+
+    for each (depth in [1, 4, 16, 64]) {
+        let start = new Date
+        run("-q -i " + ITER + " --pipeline " + depth + " " + HTTP + "/index.html")
+        elapsed = start.elapsed
+        App.log.activity("Benchmark", "Throughput %.0f request/sec, with pipeline depth %d" % [ITER / elapsed * 1000, depth])
+    }
+
+} else {
+    test.skip("Test runs at depth 6")
+}
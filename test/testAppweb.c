@@ -234,7 +234,6 @@ bool simplePost(MprTestGroup *gp, char *uri, char *bodyData, ssize len, int expe
     int         status;
 
     contentLen = 0;
-    conn = getConn(gp);
 
     if (expectStatus <= 0) {
         expectStatus = 200;
@@ -242,6 +241,7 @@ bool simplePost(MprTestGroup *gp, char *uri, char *bodyData, ssize len, int expe
     if (startRequest(gp, "POST", uri) < 0) {
         return 0;
     }
+    conn = getConn(gp);
     if (bodyData) {
         if (httpWrite(conn->writeq, bodyData, len) != len) {
             return MPR_ERR_CANT_WRITE;
@@ -259,6 +259,8 @@ bool simplePost(MprTestGroup *gp, char *uri, char *bodyData, ssize len, int expe
     }
     gp->content = httpReadString(conn);
     contentLen = httpGetContentLength(conn);
+    httpDestroyConn(conn);
+    gp->conn = 0;
     if (! assert(gp->content != 0 && contentLen > 0)) {
         return 0;
     }